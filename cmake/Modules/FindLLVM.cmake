@@ -89,12 +89,20 @@ if ((WIN32 AND NOT(MINGW OR CYGWIN)) OR NOT LLVM_CONFIG)
             list(APPEND LLVM_FIND_COMPONENTS AMDGPUUtils)
         endif()
         if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-6][\\.0-9A-Za-z]*")
+            if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-5][\\.0-9A-Za-z]*")
+                # Versions below 3.6 do not support component orcjit
+                list(REMOVE_ITEM LLVM_FIND_COMPONENTS "orcjit" index)
+            endif()
             # Versions below 3.7 do not support components debuginfo[dwarf|pdb]
             # Only debuginfo is available
             list(REMOVE_ITEM LLVM_FIND_COMPONENTS "debuginfodwarf" index)
             list(REMOVE_ITEM LLVM_FIND_COMPONENTS "debuginfopdb" index)
             list(APPEND LLVM_FIND_COMPONENTS "debuginfo")
         endif()
+        if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-7][\\.0-9A-Za-z]*")
+            # Versions below 3.8 do not support component passes
+            list(REMOVE_ITEM LLVM_FIND_COMPONENTS "passes" index)
+        endif()
         if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-8][\\.0-9A-Za-z]*")
             # Versions below 3.9 do not support components debuginfocodeview, globalisel
             list(REMOVE_ITEM LLVM_FIND_COMPONENTS "debuginfocodeview" index)
@@ -190,12 +198,20 @@ else()
     llvm_set(ENABLE_ASSERTIONS assertion-mode)
 
     if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-6][\\.0-9A-Za-z]*")
+        if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-5][\\.0-9A-Za-z]*")
+            # Versions below 3.6 do not support component orcjit
+            list(REMOVE_ITEM LLVM_FIND_COMPONENTS "orcjit" index)
+        endif()
         # Versions below 3.7 do not support components debuginfo[dwarf|pdb]
         # Only debuginfo is available
         list(REMOVE_ITEM LLVM_FIND_COMPONENTS "debuginfodwarf" index)
         list(REMOVE_ITEM LLVM_FIND_COMPONENTS "debuginfopdb" index)
         list(APPEND LLVM_FIND_COMPONENTS "debuginfo")
     endif()
+    if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-7][\\.0-9A-Za-z]*")
+        # Versions below 3.8 do not support component passes
+        list(REMOVE_ITEM LLVM_FIND_COMPONENTS "passes" index)
+    endif()
     if(${LLVM_VERSION_STRING} MATCHES "^3\\.[0-8][\\.0-9A-Za-z]*")
         # Versions below 3.9 do not support components debuginfocodeview, globalisel
         list(REMOVE_ITEM LLVM_FIND_COMPONENTS "debuginfocodeview" index)
@@ -0,0 +1,62 @@
+# Multi-stage build of a profile-guided and link-time optimized LDC, run via
+# the ldc-pgo-bootstrap target (cmake -P), with the following variables:
+#   SOURCE_DIR     - the LDC source tree
+#   BINARY_DIR     - the directory for the stage builds and the profiles
+#   GENERATOR      - the CMake generator to use
+#   CONFIGURE_ARGS - the CMake arguments for both stages, separated by |
+#   LDC_EXE_NAME   - the file name of the ldc2 executable (without suffix)
+#   LDCPROFDATA_EXE_NAME - the file name of the ldc-profdata executable
+#
+#  1. Build an instrumented LDC (pgo-stage1, LDC_BUILD_INSTRUMENTED).
+#  2. Train it by building druntime/Phobos and compiling the compile-time
+#     benchmark corpus (tests/bench).
+#  3. Merge the collected profiles into ldc.profdata with ldc-profdata.
+#  4. Build the optimized LDC (pgo-stage2, LDC_PROFILE_DATA and LDC_LTO).
+
+string(REPLACE "|" ";" configure_args "${CONFIGURE_ARGS}")
+set(stage1 ${BINARY_DIR}/pgo-stage1)
+set(stage2 ${BINARY_DIR}/pgo-stage2)
+set(profile_dir ${BINARY_DIR}/profiles)
+set(profdata ${BINARY_DIR}/ldc.profdata)
+
+# Runs the command in the given directory, aborting on failure.
+function(run_in dir)
+    execute_process(COMMAND ${ARGN} WORKING_DIRECTORY ${dir} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        string(REPLACE ";" " " cmd "${ARGN}")
+        message(FATAL_ERROR "Command failed: ${cmd}")
+    endif()
+endfunction()
+
+file(REMOVE_RECURSE ${profile_dir})
+file(MAKE_DIRECTORY ${stage1} ${stage2} ${profile_dir})
+
+message(STATUS "Stage 1: building the instrumented LDC")
+run_in(${stage1} ${CMAKE_COMMAND} -G ${GENERATOR} ${configure_args}
+    -DLDC_BUILD_INSTRUMENTED=ON -DLDC_PROFILE_DATA= -DLDC_LTO=OFF ${SOURCE_DIR})
+run_in(${stage1} ${CMAKE_COMMAND} --build . --target ldc2)
+run_in(${stage1} ${CMAKE_COMMAND} --build . --target ldc-profdata)
+
+message(STATUS "Training the instrumented LDC")
+set(ENV{LLVM_PROFILE_FILE} ${profile_dir}/ldc-%p.profraw)
+run_in(${stage1} ${CMAKE_COMMAND} --build . --target druntime-ldc)
+run_in(${stage1} ${CMAKE_COMMAND} --build . --target phobos2-ldc)
+run_in(${stage1} python ${SOURCE_DIR}/tests/bench/runbench.py
+    --ldc2 ${stage1}/bin/${LDC_EXE_NAME}${CMAKE_EXECUTABLE_SUFFIX}
+    --druntime ${SOURCE_DIR}/runtime/druntime
+    --phobos ${SOURCE_DIR}/runtime/phobos
+    --output ${BINARY_DIR}/bench --repeat 1 --no-baselines)
+unset(ENV{LLVM_PROFILE_FILE})
+
+message(STATUS "Merging the profiles into ${profdata}")
+file(GLOB profiles ${profile_dir}/*.profraw)
+if(NOT profiles)
+    message(FATAL_ERROR "No profiles found in ${profile_dir}.")
+endif()
+run_in(${stage1} ${stage1}/bin/${LDCPROFDATA_EXE_NAME} merge -output=${profdata} ${profiles})
+
+message(STATUS "Stage 2: building the optimized LDC")
+run_in(${stage2} ${CMAKE_COMMAND} -G ${GENERATOR} ${configure_args}
+    -DLDC_BUILD_INSTRUMENTED=OFF -DLDC_PROFILE_DATA=${profdata} -DLDC_LTO=ON ${SOURCE_DIR})
+run_in(${stage2} ${CMAKE_COMMAND} --build .)
+message(STATUS "The optimized LDC has been built in ${stage2}.")
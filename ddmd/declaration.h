@@ -548,6 +548,10 @@ public:
     // Whether to emit instrumentation code if -fprofile-instr-generate is specified,
     // the value is set with pragma(LDC_profile_instr, true|false)
     bool emitInstrumentation;
+
+    // true if a template instance is nested in this function or gets one of
+    // its (possibly static) nested functions as alias argument
+    bool hasNestedTemplateInstances;
 #endif
 
     Identifier *outId;                  // identifier for out statement
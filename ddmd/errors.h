@@ -45,4 +45,10 @@ void fatal();
 
 void halt();
 
+#if IN_LLVM
+// If set, called by fatal() instead of exit(), e.g. to terminate a forked
+// compiler process with _exit(). Must not return.
+extern void (*fatalExitHook)(int status);
+#endif
+
 #endif /* DMD_ERRORS_H */
@@ -371,6 +371,9 @@ public:
     unsigned char committed;    // !=0 if type is committed
     utf8_t postfix;      // 'c', 'w', 'd'
     OwnedBy ownedByCtfe;
+#if IN_LLVM
+    const char *importedFile;
+#endif
 
     StringExp(Loc loc, char *s);
     StringExp(Loc loc, void *s, size_t len);
@@ -219,6 +219,9 @@ struct Param
     uint32_t dwarfVersion;
 
     uint32_t hashThreshold; // MD5 hash symbols larger than this threshold (0 = no hashing)
+
+    const char *makeDepsFile;                // filename for Make/Ninja depfile output
+    Array<const char *> *stringImportFiles;  // files read by import expressions (for makeDepsFile)
 #endif
 };
 
@@ -21,6 +21,9 @@ struct HdrGenState
     int tpltMember;
     int autoMember;
     int forStmtInit;
+#if IN_LLVM
+    bool interfaceCache; // true if generating a cached interface
+#endif
 
     HdrGenState() { memset(this, 0, sizeof(HdrGenState)); }
 };
@@ -192,7 +192,10 @@ public:
     // Coverage analysis
     llvm::GlobalVariable* d_cover_valid;  // private immutable size_t[] _d_cover_valid;
     llvm::GlobalVariable* d_cover_data;   // private uint[] _d_cover_data;
+    llvm::GlobalVariable* d_cover_data_tls; // private static uint[] _d_cover_data_tls;
     Array<size_t>         d_cover_valid_init; // initializer for _d_cover_valid
+
+    bool sourceParsed; // by parseSource()
 #endif
 
     Module *isModule() { return this; }
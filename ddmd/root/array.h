@@ -34,9 +34,21 @@ struct Array
 
   private:
     d_size_t allocdim;
-    #define SMALLARRAYCAP       1
+    // Most arrays (call arguments, template arguments, ...) have only a few
+    // elements, so these are stored inline. Keep in sync with array.d.
+    #define SMALLARRAYCAP       4
     TYPE smallarray[SMALLARRAYCAP];    // inline storage for small arrays
 
+    // Returns the power of two (larger than SMALLARRAYCAP, which identifies
+    // the inline storage) to grow the heap storage to.
+    static d_size_t grownCapacity(d_size_t needed)
+    {
+        d_size_t cap = SMALLARRAYCAP * 2;
+        while (cap < needed)
+            cap *= 2;
+        return cap;
+    }
+
   public:
     Array()
     {
@@ -51,6 +63,13 @@ struct Array
             mem.xfree(data);
     }
 
+#if IN_LLVM
+    // Arrays created by the glue code live on the frontend heap, so that the
+    // GC finds their elements with -lowmem.
+    static void *operator new(size_t size) { return mem.xmalloc(size); }
+    static void operator delete(void *p) { mem.xfree(p); }
+#endif
+
     char *toChars()
     {
         const char **buf = (const char **)mem.xmalloc(dim * sizeof(const char *));
@@ -90,18 +109,18 @@ struct Array
                     data = SMALLARRAYCAP ? &smallarray[0] : NULL;
                 }
                 else
-                {   allocdim = nentries;
+                {   allocdim = grownCapacity(nentries);
                     data = (TYPE *)mem.xmalloc(allocdim * sizeof(*data));
                 }
             }
             else if (allocdim == SMALLARRAYCAP)
             {
-                allocdim = dim + nentries;
+                allocdim = grownCapacity(dim + nentries);
                 data = (TYPE *)mem.xmalloc(allocdim * sizeof(*data));
                 memcpy(data, &smallarray[0], dim * sizeof(*data));
             }
             else
-            {   allocdim = dim + nentries;
+            {   allocdim = grownCapacity(dim + nentries);
                 data = (TYPE *)mem.xrealloc(data, allocdim * sizeof(*data));
             }
         }
@@ -118,19 +137,20 @@ struct Array
 
     void fixDim()
     {
-        if (dim != allocdim)
+        if (dim != allocdim && allocdim != SMALLARRAYCAP)
         {
-            if (allocdim >= SMALLARRAYCAP)
+            if (dim <= SMALLARRAYCAP)
             {
-                if (dim <= SMALLARRAYCAP)
-                {
-                    memcpy(&smallarray[0], data, dim * sizeof(*data));
-                    mem.xfree(data);
-                }
-                else
-                    data = (TYPE *)mem.xrealloc(data, dim * sizeof(*data));
+                memcpy(&smallarray[0], data, dim * sizeof(*data));
+                mem.xfree(data);
+                data = &smallarray[0];
+                allocdim = SMALLARRAYCAP;
+            }
+            else
+            {
+                data = (TYPE *)mem.xrealloc(data, dim * sizeof(*data));
+                allocdim = dim;
             }
-            allocdim = dim;
         }
     }
 
@@ -261,8 +281,6 @@ struct Array
 #if LLVM_HAS_RVALUE_REFERENCES
     Array(Array<TYPE> &&a)
     {
-        if (data != &smallarray[0])
-            mem.xfree(data);
         dim = a.dim;
         allocdim = a.allocdim;
         if (a.data == &a.smallarray[0])
@@ -47,6 +47,11 @@ struct OutBuffer
     {
         mem.xfree(data);
     }
+#if IN_LLVM
+    // See Array.
+    static void *operator new(size_t size) { return mem.xmalloc(size); }
+    static void operator delete(void *p) { mem.xfree(p); }
+#endif
     char *extractData();
 
     void reserve(size_t nbytes);
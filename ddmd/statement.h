@@ -284,6 +284,10 @@ class DoStatement : public Statement
 public:
     Statement *_body;
     Expression *condition;
+#if IN_LLVM
+    int unrollHint;             // pragma(LDC_unroll[, n]): n (-1 if no count), else 0
+    int vectorizeHint;          // pragma(LDC_vectorize[, n]): n (-1 if no width), else 0
+#endif
 
     DoStatement(Loc loc, Statement *b, Expression *c);
     Statement *syntaxCopy();
@@ -308,6 +312,15 @@ public:
     // treat that label as referring to this loop.
     Statement *relatedLabeled;
 
+#if IN_LLVM
+    int unrollHint;             // pragma(LDC_unroll[, n]): n (-1 if no count), else 0
+    int vectorizeHint;          // pragma(LDC_vectorize[, n]): n (-1 if no width), else 0
+    // For loops lowered from foreach over a slice or an integral range: the
+    // key, if its increment provably doesn't overflow (see
+    // ForeachStatement::semantic and ForeachRangeStatement::semantic).
+    VarDeclaration *foreachKey;
+#endif
+
     ForStatement(Loc loc, Statement *init, Expression *condition, Expression *increment, Statement *body, Loc endloc);
     Statement *syntaxCopy();
     Statement *semantic(Scope *sc);
@@ -377,6 +390,9 @@ public:
     Statement *elsebody;
 
     VarDeclaration *match;      // for MatchExpression results
+#if IN_LLVM
+    int expectedCondition;      // 1 (-1) if pragma(LDC_expect, true (false)), else 0
+#endif
 
     IfStatement(Loc loc, Parameter *prm, Expression *condition, Statement *ifbody, Statement *elsebody);
     Statement *syntaxCopy();
@@ -547,6 +563,9 @@ class ReturnStatement : public Statement
 public:
     Expression *exp;
     size_t caseDim;
+#if IN_LLVM
+    bool isMusttail;            // true iff marked with pragma(LDC_musttail)
+#endif
 
     ReturnStatement(Loc loc, Expression *exp);
     Statement *syntaxCopy();
@@ -33,6 +33,9 @@ struct Target
     static int c_longsize;           // size of a C 'long' or 'unsigned long' type
     static int c_long_doublesize;    // size of a C 'long double'
     static int classinfosize;        // size of 'ClassInfo'
+#if IN_LLVM
+    static bool realIsDouble;        // set if real has the properties of double
+#endif
 
     static void _init();
     // Type sizes and support.
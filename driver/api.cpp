@@ -0,0 +1,328 @@
+//===-- api.cpp -----------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/api.h"
+#include "errors.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <tuple>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// From druntime/src/rt/dmain2.d and druntime/src/gc/proxy.d.
+extern "C" {
+int rt_init();
+void gc_disable();
+}
+
+// In driver/main.cpp
+int cppmain(int argc, char **argv);
+
+namespace ldc {
+namespace api {
+
+namespace {
+
+std::once_flag initFlag;
+std::string hostArgv0;
+
+/// Replaces all occurrences of `from` in `str` by `to`.
+void replaceAll(std::string &str, llvm::StringRef from, llvm::StringRef to) {
+  size_t pos = 0;
+  while ((pos = str.find(from.data(), pos, from.size())) != std::string::npos) {
+    str.replace(pos, from.size(), to.data(), to.size());
+    pos += to.size();
+  }
+}
+
+bool parseNumber(llvm::StringRef str, unsigned &result) {
+  return !str.empty() && !str.getAsInteger(10, result);
+}
+
+/// Parses a line of the form `file(line[,column]): Kind: message`, or
+/// `Kind: message` for diagnostics without location. Lines of the form
+/// `file(line):        message` belong to the previous diagnostic.
+bool parseDiagnostic(llvm::StringRef line, Diagnostic &result) {
+  static const struct {
+    const char *prefix;
+    Diagnostic::Kind kind;
+  } kinds[] = {{"Error: ", Diagnostic::Error},
+               {"Warning: ", Diagnostic::Warning},
+               {"Deprecation: ", Diagnostic::Deprecation}};
+
+  llvm::StringRef rest = line;
+  bool hasLocation = false;
+  const size_t locEnd = line.find("): ");
+  if (locEnd != llvm::StringRef::npos) {
+    const size_t locBegin = line.rfind('(', locEnd);
+    if (locBegin != llvm::StringRef::npos && locBegin > 0) {
+      llvm::StringRef lineCol = line.slice(locBegin + 1, locEnd);
+      llvm::StringRef lineStr = lineCol;
+      llvm::StringRef colStr;
+      std::tie(lineStr, colStr) = lineCol.split(',');
+      unsigned lineNum, colNum = 0;
+      if (parseNumber(lineStr, lineNum) &&
+          (colStr.empty() || parseNumber(colStr, colNum))) {
+        result.file = line.substr(0, locBegin);
+        result.line = lineNum;
+        result.column = colNum;
+        rest = line.substr(locEnd + 3);
+        hasLocation = true;
+      }
+    }
+  }
+
+  for (const auto &k : kinds) {
+    if (rest.startswith(k.prefix)) {
+      result.kind = k.kind;
+      result.message = rest.substr(strlen(k.prefix));
+      return true;
+    }
+  }
+
+  if (hasLocation && rest.startswith(" ")) {
+    result.kind = Diagnostic::Supplemental;
+    result.message = rest.ltrim();
+    return true;
+  }
+  return false;
+}
+
+void removeTree(llvm::StringRef dir) {
+  std::vector<std::string> paths;
+  std::error_code ec;
+  for (llvm::sys::fs::recursive_directory_iterator it(dir, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    paths.push_back(it->path());
+  }
+  // Children come after their parent directory.
+  for (auto it = paths.rbegin(), end = paths.rend(); it != end; ++it) {
+    llvm::sys::fs::remove(*it);
+  }
+  llvm::sys::fs::remove(dir);
+}
+
+bool writeFile(llvm::StringRef path, llvm::StringRef contents) {
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path));
+  std::ofstream os(path.str(), std::ios::binary);
+  os.write(contents.data(), contents.size());
+  return static_cast<bool>(os);
+}
+
+bool readFile(llvm::StringRef path, std::string &contents) {
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return false;
+  }
+  contents = (*buffer)->getBuffer().str();
+  return true;
+}
+
+#ifndef _WIN32
+/// Terminates the child process without running the host's exit handlers and
+/// static destructors, which belong to the host's copy of the process state.
+void exitChild(int status) {
+  fflush(nullptr);
+  _exit(status);
+}
+
+/// Catches the exit() calls not going through fatal() (e.g. for -help).
+void exitChildOnExit() { exitChild(EXIT_FAILURE); }
+
+/// Runs the compiler with the given command line in a child process, with its
+/// stdout and stderr redirected to `logPath`. Returns the exit status, or -1
+/// if the child has been killed by a signal.
+int runCompiler(const std::vector<std::string> &args,
+                const std::string &logPath) {
+  std::vector<char *> argv;
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  // Don't let the child write the host's buffered output a second time.
+  fflush(nullptr);
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    const int logFd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const int nullFd = open("/dev/null", O_RDONLY);
+    if (logFd < 0 || nullFd < 0) {
+      _exit(127);
+    }
+    dup2(nullFd, 0);
+    dup2(logFd, 1);
+    dup2(logFd, 2);
+    close(nullFd);
+    close(logFd);
+
+    // The compiler terminates the process on fatal errors.
+    fatalExitHook = &exitChild;
+    atexit(&exitChildOnExit);
+
+    exitChild(cppmain(static_cast<int>(args.size()), argv.data()));
+  }
+  if (pid < 0) {
+    return -1;
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
+} // anonymous namespace
+
+void initialize(const char *argv0) {
+  std::call_once(initFlag, [argv0]() {
+    hostArgv0 = argv0;
+    rt_init();
+    // The compiler runs in children forked from a possibly multi-threaded
+    // host, where stopping the world for a collection would wait for threads
+    // which don't exist there. The frontend doesn't need the GC anyway.
+    gc_disable();
+    llvm::InitializeAllTargetInfos();
+  });
+}
+
+void CompileSession::addArgument(llvm::StringRef arg) {
+  args.push_back(arg.str());
+}
+
+void CompileSession::addSourceFile(llvm::StringRef path) {
+  sources.push_back(path.str());
+}
+
+void CompileSession::addMemoryFile(llvm::StringRef name,
+                                   llvm::StringRef contents, bool compile) {
+  memoryFiles.push_back({name.str(), contents.str(), compile});
+}
+
+void CompileSession::setCacheDir(llvm::StringRef dir) { cacheDir = dir.str(); }
+
+bool CompileSession::compile() {
+  diags.clear();
+  objs.clear();
+  out.clear();
+
+  auto addError = [this](llvm::StringRef message) {
+    Diagnostic d;
+    d.kind = Diagnostic::Error;
+    d.message = message.str();
+    diags.push_back(std::move(d));
+  };
+
+#ifdef _WIN32
+  addError("compile sessions are not supported on Windows");
+  return false;
+#else
+  if (hostArgv0.empty()) {
+    addError("ldc::api::initialize() has not been called");
+    return false;
+  }
+
+  llvm::SmallString<128> tmpDir;
+  if (llvm::sys::fs::createUniqueDirectory("ldc-session", tmpDir)) {
+    addError("cannot create a temporary directory");
+    return false;
+  }
+  const std::string tmpPrefix = (tmpDir + "/").str();
+  const std::string outDir = tmpPrefix + "out";
+  const std::string srcDir = tmpPrefix + "src";
+
+  std::vector<std::string> argv = {hostArgv0};
+  argv.insert(argv.end(), args.begin(), args.end());
+  argv.push_back("-c");
+  argv.push_back("-od" + outDir);
+  argv.push_back("-I" + srcDir);
+  argv.push_back("-J" + srcDir);
+  // Keep the temporary directory out of the object code, so that the
+  // in-memory files hit the cache in later sessions too.
+  argv.push_back("-ffile-prefix-map=" + srcDir + "/=");
+  if (!cacheDir.empty()) {
+    argv.push_back("-cache=" + cacheDir);
+  }
+  argv.insert(argv.end(), sources.begin(), sources.end());
+
+  bool ok = true;
+  for (const auto &f : memoryFiles) {
+    const std::string path = srcDir + "/" + f.name;
+    if (!writeFile(path, f.contents)) {
+      addError("cannot write " + f.name);
+      ok = false;
+    }
+    if (f.compile) {
+      argv.push_back(path);
+    }
+  }
+
+  const int status = ok ? runCompiler(argv, tmpPrefix + "output.txt") : 1;
+  ok = status == 0;
+  if (status < 0) {
+    addError("the compiler has crashed");
+  }
+
+  if (readFile(tmpPrefix + "output.txt", out)) {
+    // Refer to the in-memory files by the names they have been added with.
+    replaceAll(out, srcDir + "/", "");
+    llvm::StringRef rest = out;
+    while (!rest.empty()) {
+      llvm::StringRef line;
+      std::tie(line, rest) = rest.split('\n');
+      Diagnostic d;
+      if (parseDiagnostic(line.rtrim(), d)) {
+        diags.push_back(std::move(d));
+      }
+    }
+  }
+
+  if (ok) {
+    std::error_code ec;
+    for (llvm::sys::fs::recursive_directory_iterator it(outDir, ec), end;
+         it != end && !ec; it.increment(ec)) {
+      if (!llvm::sys::fs::is_regular_file(it->path())) {
+        continue;
+      }
+      ObjectFile obj;
+      obj.name = llvm::StringRef(it->path()).substr(outDir.size() + 1).str();
+      if (!readFile(it->path(), obj.contents)) {
+        addError("cannot read " + obj.name);
+        ok = false;
+        break;
+      }
+      objs.push_back(std::move(obj));
+    }
+  }
+
+  removeTree(tmpDir);
+  return ok;
+#endif
+}
+
+} // namespace api
+} // namespace ldc
@@ -0,0 +1,120 @@
+//===-- driver/api.h - Compile sessions for embedding LDC -------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A library interface to the compiler for build systems and IDE tooling,
+// which would otherwise have to spawn an ldc2 process for every compile.
+//
+// The frontend keeps its state in globals (global.params, the module and
+// type tables, gIR, gTargetMachine, ...) and terminates the process on fatal
+// errors, so it cannot be run twice in the same address space. Each session
+// is therefore compiled in a child process forked from the (initialized)
+// host: there is no executable to load and no startup to pay for, sessions
+// can be compiled on separate threads, and a compiler crash doesn't take the
+// host down. State which is to survive a session, such as the object and
+// inlining caches, is kept on disk (see CompileSession::setCacheDir()).
+//
+// Only available on POSIX systems.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_API_H
+#define LDC_DRIVER_API_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace ldc {
+namespace api {
+
+/// Performs the process-wide setup (D runtime, LLVM target registry). Must be
+/// called before the first session is compiled; further calls are no-ops.
+/// argv0 is the path of the host program, used to locate the ldc2.conf
+/// configuration file like for the ldc2 executable. Thread-safe.
+void initialize(const char *argv0);
+
+struct Diagnostic {
+  enum Kind { Error, Warning, Deprecation, Supplemental };
+
+  Kind kind;
+  /// The file name as passed to the session, or empty if the diagnostic has
+  /// no location.
+  std::string file;
+  unsigned line = 0;
+  unsigned column = 0;
+  std::string message;
+};
+
+struct ObjectFile {
+  /// The path of the object file relative to the output directory.
+  std::string name;
+  std::string contents;
+};
+
+/// The command line, sources and results of a single compilation.
+///
+/// A session is compiled with -c: linking is left to the host. A session
+/// object must not be used from several threads at the same time, but
+/// different sessions can be compiled concurrently.
+class CompileSession {
+public:
+  /// Appends a command line option, e.g. "-O", "-m64" or "-d-version=Foo".
+  /// Output options (-of, -od, -c, -lib, -run) are managed by the
+  /// session.
+  void addArgument(llvm::StringRef arg);
+
+  /// Adds a source file on disk to the compilation.
+  void addSourceFile(llvm::StringRef path);
+
+  /// Adds a file which only exists in memory. The name is relative, e.g.
+  /// "pkg/mod.d", and the file can be imported accordingly. It is compiled
+  /// too if `compile` is true, otherwise it is only available for imports
+  /// (and string imports with -J).
+  void addMemoryFile(llvm::StringRef name, llvm::StringRef contents,
+                     bool compile = true);
+
+  /// Enables the persistent caches (-cache) in the given directory, so that
+  /// unchanged modules aren't compiled again in later sessions.
+  void setCacheDir(llvm::StringRef dir);
+
+  /// Compiles the session, replacing the results of a previous call. Returns
+  /// whether the compilation succeeded.
+  bool compile();
+
+  /// The diagnostics of the last compile() call, in order.
+  const std::vector<Diagnostic> &diagnostics() const { return diags; }
+
+  /// The object files written by the last successful compile() call.
+  const std::vector<ObjectFile> &objects() const { return objs; }
+
+  /// The complete stdout/stderr output of the last compile() call, including
+  /// the lines which aren't diagnostics (e.g. the output of -v or pragma(msg)).
+  const std::string &output() const { return out; }
+
+private:
+  struct MemoryFile {
+    std::string name;
+    std::string contents;
+    bool compile;
+  };
+
+  std::vector<std::string> args;
+  std::vector<std::string> sources;
+  std::vector<MemoryFile> memoryFiles;
+  std::string cacheDir;
+
+  std::vector<Diagnostic> diags;
+  std::vector<ObjectFile> objs;
+  std::string out;
+};
+
+} // namespace api
+} // namespace ldc
+
+#endif
@@ -14,16 +14,44 @@
 // that file is used and machine code gen is skipped entirely. If the cache
 // doesn't contain that file, machine codegen happens as normal and the object
 // code is added to the cache.
+// The other output files (-output-bc, -output-ll, -output-s) are cached the
+// same way as <hash>.bc etc.; the cache is only used if it contains all the
+// requested outputs.
 // The goal is to speed up successive builds of large codebases after minor
 // changes that trigger recompilation of many files but with little effective
 // changes (in the extreme case, adding a comment in a "globals.d").
 //
-// The current limitation is that hashing and cache look-up are done with
-// whole-module granularity. Future work could attempt to do this for module
-// "fragments".
+// Hashing and cache look-up are done with whole-module granularity, unless
+// -cache-fragments is used to split modules into separately cached fragments.
+//
+// With -cache-shared, a second cache directory (typically on a network file
+// system shared by several build machines) backs the local one: local misses
+// are looked up there and copied into the local cache, and newly generated
+// objects are published to it. Files are written to the shared directory via a
+// rename of a temporary file, so that concurrent readers never see partial
+// objects. Failing to access the shared directory is not an error; the
+// compiler warns once and continues with the local cache only. Pruning is only
+// applied to the local cache directory.
+//
+// With -cache-compress, cache entries are stored zlib-compressed as
+// ircache_<hash>.o.z, and decompressed into the output object file on a cache
+// hit. Uncompressed entries are hard-linked (or, where that fails, copied)
+// to the output file.
+//
+// Several compiler processes may use the same cache directory concurrently:
+// new entries are written to a temporary file which is then renamed, so that
+// lookups never see partially written entries, and an entry pruned between
+// its lookup and recovery is treated as a cache miss.
 //
 // The hash depends on the IR code (obviously), but also on the compiler+LLVM
-// versions and several compile flags (e.g. -O*, -mcpu, and -mattr).
+// versions and on the parsed values of the compile flags influencing codegen
+// (e.g. the optimization level, target CPU and features), with -mcpu=native
+// resolved to the host CPU and its features. The spelling and order of the
+// flags on the commandline don't matter.
+// The IR is hashed by walking the module structure directly (see
+// driver/irhasher.cpp); modules containing constructs not covered by that walk
+// (e.g. funclet-based EH pads, operand bundles or ifuncs) are hashed via their
+// serialized bitcode instead.
 //
 //===----------------------------------------------------------------------===//
 
@@ -32,15 +60,32 @@
 #include "ddmd/errors.h"
 #include "driver/cache_pruning.h"
 #include "driver/cl_options.h"
+#include "driver/irhasher.h"
 #include "driver/ldc-version.h"
+#include "driver/statistics.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <tuple>
 
 // Include close() declaration.
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
@@ -49,6 +94,8 @@
 #include <io.h>
 #endif
 
+extern llvm::TargetMachine *gTargetMachine;
+
 namespace {
 
 // Options for the cache pruning algorithm
@@ -79,6 +126,54 @@ llvm::cl::opt<unsigned> pruneSizeLimitPercentage(
         "space (default: 75%). Implies -cache-prune."),
     llvm::cl::value_desc("perc"), llvm::cl::init(75));
 
+llvm::cl::opt<std::string> sharedCacheDir(
+    "cache-shared",
+    llvm::cl::desc("Use <dir> (e.g. on a network file system) as a second-level "
+                   "cache shared between machines. Objects missing in the "
+                   "local -cache directory are fetched from there, and new "
+                   "objects are published to it."),
+    llvm::cl::value_desc("dir"), llvm::cl::ZeroOrMore);
+
+llvm::cl::opt<bool>
+    showStatistics("cache-stats",
+                   llvm::cl::desc("Print statistics about the cache usage."),
+                   llvm::cl::ZeroOrMore);
+llvm::cl::opt<std::string> statisticsFile(
+    "cache-stats-file",
+    llvm::cl::desc("Append statistics about the cache usage to <file>, as one "
+                   "JSON object per line."),
+    llvm::cl::value_desc("file"), llvm::cl::ZeroOrMore);
+
+bool isStatisticsEnabled() {
+  return showStatistics || !statisticsFile.empty() || stats::isEnabled();
+}
+
+/// Counters for -cache-stats. Cache files are added from the codegen worker
+/// threads, everything else happens on the main thread.
+struct Statistics {
+  unsigned hits = 0;
+  unsigned misses = 0;
+  uint64_t bytesRestored = 0;
+  double hashMillis = 0;
+  uint64_t savedMillis = 0;
+  unsigned hitsWithoutCodegenTime = 0;
+  std::atomic<unsigned> filesAdded{0};
+} statistics;
+
+llvm::cl::opt<bool> compressEntries(
+    "cache-compress",
+    llvm::cl::desc("Store zlib-compressed object files in the cache."),
+    llvm::cl::ZeroOrMore);
+
+llvm::cl::opt<bool> cacheLinkOutputs(
+    "cache-link",
+    llvm::cl::desc("Also cache the linked executable or shared library and "
+                   "the static library created with -lib, keyed by the "
+                   "contents of the input files and the linker commandline. "
+                   "Libraries found via the library search paths (-L-l...) "
+                   "are only identified by their name."),
+    llvm::cl::ZeroOrMore);
+
 bool isPruningEnabled() {
   if (pruneEnabled)
     return true;
@@ -121,112 +216,480 @@ public:
   }
 };
 
-void storeCacheFileName(llvm::StringRef cacheObjectHash,
+/// Guards diagnostics emitted by cache functions, which are called from the
+/// codegen worker threads too.
+std::mutex diagnosticsMutex;
+
+/// Compressed cache files start with this magic, followed by the uncompressed
+/// size as 64-bit little-endian integer.
+const char compressedMagic[4] = {'L', 'D', 'C', 'Z'};
+const char *const compressedExtension = ".z";
+
+bool useCompression() {
+  if (!compressEntries)
+    return false;
+  if (llvm::zlib::isAvailable())
+    return true;
+
+  static std::once_flag warnOnce;
+  std::call_once(warnOnce, [] {
+    std::lock_guard<std::mutex> lock(diagnosticsMutex);
+    warning(Loc(), "-cache-compress ignored, LLVM was built without zlib");
+  });
+  return false;
+}
+
+void storeCacheFileName(llvm::StringRef cacheDir,
+                        llvm::StringRef cacheObjectHash,
+                        llvm::StringRef extension, bool compressed,
                         llvm::SmallString<128> &filePath) {
-  filePath = opts::cacheDir;
+  filePath = cacheDir;
   llvm::sys::path::append(filePath, llvm::Twine("ircache_") + cacheObjectHash +
-                                        "." + global.obj_ext);
+                                        "." + extension +
+                                        (compressed ? compressedExtension : ""));
 }
 
-// Output to `hash_os` all commandline flags, and try to skip the ones that have
-// no influence on the object code output. The cmdline flags need to be added
-// to the ir2obj cache hash to uniquely identify the object file output.
-// Because the compiler version is part of the hash, differences in the
-// default settings between compiler versions are already taken care of.
-// (Note: config and response files may also add compiler flags.)
-void outputIR2ObjRelevantCmdlineArgs(llvm::raw_ostream &hash_os)
-{
-  // Use a "whitelist" of cmdline args that do not need to be added to the hash,
-  // and add all others. There is no harm (other than missed cache
-  // opportunities) in adding commandline arguments that also change the hashed
-  // IR, which simplifies the code here.
-  // The code does not deal well with options specified without equals sign, and
-  // will add those to the hash, resulting in missed cache opportunities.
-
-  auto it = opts::allArguments.begin();
-  auto end_it = opts::allArguments.end();
-  // The first argument is the compiler executable filename: we can skip it.
-  ++it;
-  for (; it != end_it; ++it) {
-    const char *arg = *it;
-    if (!arg || !arg[0])
-      continue;
+/// Looks for the cache file for the given hash in the cache directory, in
+/// either compressed or uncompressed form (preferring the current mode).
+bool findCacheFile(llvm::StringRef cacheDir, llvm::StringRef cacheObjectHash,
+                   llvm::StringRef extension, llvm::SmallString<128> &filePath,
+                   bool &compressed) {
+  compressed = useCompression();
+  storeCacheFileName(cacheDir, cacheObjectHash, extension, compressed,
+                     filePath);
+  if (llvm::sys::fs::exists(filePath.c_str()))
+    return true;
+  compressed = !compressed;
+  storeCacheFileName(cacheDir, cacheObjectHash, extension, compressed,
+                     filePath);
+  return llvm::sys::fs::exists(filePath.c_str());
+}
 
-    // Out of pre-caution, all arguments that are not prefixed with '-' are
-    // added to the hash. Such an argument could be a source file "foo.d", but
-    // also a value for the previous argument when the equals sign is omitted,
-    // for example: "-code-model default" becomes "-code-model" "default".
-    // It results in missed cache opportunities. :(
-    if (arg[0] == '-') {
-      if (arg[1] == 'O') {
-        // We deal with -O later ("-O" and "-O3" should hash equally, "" and
-        // "-O0" too)
-        continue;
-      }
-      if (arg[1] == 'c' && !arg[2])
-        continue;
-      // All options starting with these characters can be ignored (LLVM does
-      // not have options starting with capitals)
-      if (arg[1] == 'D' || arg[1] == 'H' || arg[1] == 'I' || arg[1] == 'J' ||
-          arg[1] == 'L' || arg[1] == 'X')
-        continue;
-      if (arg[1] == 'd' || arg[1] == 'v' || arg[1] == 'w') {
-        // LLVM options are long, so short options starting with 'v' or 'w' can
-        // be ignored.
-        unsigned len = 2;
-        for (; len < 11; ++len)
-          if (!arg[len])
-            break;
-        if (len < 11)
-          continue;
+/// Returns false if the cache directory doesn't exist and cannot be created.
+bool createCacheDirectory() {
+  return llvm::sys::fs::exists(opts::cacheDir) ||
+         !llvm::sys::fs::create_directories(opts::cacheDir);
+}
+
+/// Creates a uniquely named temporary file next to `to`, to be renamed to `to`
+/// once fully written.
+std::error_code createTemporaryFor(llvm::StringRef to,
+                                   llvm::SmallString<128> &tempFile) {
+  int fd;
+  if (auto ec = llvm::sys::fs::createUniqueFile(to + "-%%%%%%%%.tmp", fd,
+                                                tempFile)) {
+    return ec;
+  }
+  close(fd);
+  return std::error_code();
+}
+
+std::error_code renameOrRemove(llvm::StringRef tempFile, llvm::StringRef to,
+                               std::error_code ec) {
+  if (!ec)
+    ec = llvm::sys::fs::rename(tempFile, to);
+  if (ec)
+    llvm::sys::fs::remove(tempFile);
+  return ec;
+}
+
+/// Copies `from` to `to` such that other processes never observe a partially
+/// written `to`: the data is first copied to a uniquely named temporary in the
+/// target directory, which is then renamed.
+std::error_code copyFileAtomically(llvm::StringRef from, llvm::StringRef to) {
+  llvm::SmallString<128> tempFile;
+  if (auto ec = createTemporaryFor(to, tempFile))
+    return ec;
+  return renameOrRemove(tempFile, to, llvm::sys::fs::copy_file(from, tempFile));
+}
+
+/// Writes a zlib-compressed copy of `from` to `to`, atomically like above.
+std::error_code compressFileAtomically(llvm::StringRef from,
+                                       llvm::StringRef to) {
+  auto buffer = llvm::MemoryBuffer::getFile(from);
+  if (!buffer)
+    return buffer.getError();
+
+  llvm::SmallString<0> compressed;
+  if (llvm::zlib::compress((*buffer)->getBuffer(), compressed,
+                           llvm::zlib::BestSpeedCompression) !=
+      llvm::zlib::StatusOK) {
+    return std::make_error_code(std::errc::io_error);
+  }
+
+  llvm::SmallString<128> tempFile;
+  if (auto ec = createTemporaryFor(to, tempFile))
+    return ec;
+
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream os(tempFile, ec, llvm::sys::fs::F_None);
+    if (!ec) {
+      os.write(compressedMagic, sizeof(compressedMagic));
+      char size[8];
+      llvm::support::endian::write64le(size, (*buffer)->getBufferSize());
+      os.write(size, sizeof(size));
+      os << compressed;
+      os.close();
+      if (os.has_error()) {
+        ec = std::make_error_code(std::errc::io_error);
+        os.clear_error();
       }
-      // "-of..." can be ignored
-      if (arg[1] == 'o' && arg[2] == 'f')
-        continue;
-      // "-od..." can be ignored
-      if (arg[1] == 'o' && arg[2] == 'd')
-        continue;
-      // All  "-cache..." options can be ignored
-      if (strncmp(arg+1, "cache", 5) == 0)
-        continue;
-      // Ignore "-lib"
-      if (arg[1] == 'l' && arg[2] == 'i' && arg[3] == 'b' && !arg[4])
-        continue;
-      // All effects of -d-version... are already included in the IR hash.
-      if (strncmp(arg+1, "d-version", 9) == 0)
-        continue;
-      // All effects of -unittest are already included in the IR hash.
-      if (strcmp(arg + 1, "unittest") == 0) {
+    }
+  }
+  return renameOrRemove(tempFile, to, ec);
+}
+
+/// Decompresses the compressed cache file `from` into the object file `to`.
+bool decompressFile(llvm::StringRef from, llvm::StringRef to) {
+  auto buffer = llvm::MemoryBuffer::getFile(from);
+  if (!buffer)
+    return false;
+
+  llvm::StringRef data = (*buffer)->getBuffer();
+  const size_t headerSize = sizeof(compressedMagic) + 8;
+  if (data.size() < headerSize ||
+      data.substr(0, sizeof(compressedMagic)) !=
+          llvm::StringRef(compressedMagic, sizeof(compressedMagic))) {
+    return false;
+  }
+  const uint64_t size = llvm::support::endian::read64le(
+      data.data() + sizeof(compressedMagic));
+
+  llvm::SmallString<0> uncompressed;
+  if (llvm::zlib::uncompress(data.substr(headerSize), uncompressed, size) !=
+      llvm::zlib::StatusOK) {
+    return false;
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(to, ec, llvm::sys::fs::F_None);
+  if (ec)
+    return false;
+  os << uncompressed;
+  os.close();
+  if (os.has_error()) {
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+/// The size of the cache index journal above which the index is compacted at
+/// the end of the compilation, even if the cache isn't pruned.
+const uint64_t maxIndexJournalBytes = 1 << 20;
+
+/// Set when the journal has grown larger than maxIndexJournalBytes.
+std::atomic<bool> indexNeedsCompaction(false);
+
+/// Appends a record for the given cache file to the cache index journal, which
+/// allows the pruning to work without scanning the cache directory (see
+/// driver/cache_pruning.d). The record is written with a single write to a file
+/// opened in append mode, so concurrent compiler processes don't interleave
+/// records. Failures are ignored; an incomplete index only results in missed
+/// pruning opportunities until the next full directory scan.
+void recordCacheFileAccess(llvm::StringRef cacheFile,
+                           unsigned codegenMillis = 0) {
+  uint64_t size;
+  if (llvm::sys::fs::file_size(cacheFile, size))
+    return;
+
+  llvm::SmallString<128> indexFile(opts::cacheDir);
+  llvm::sys::path::append(indexFile, "ircache_index");
+  int fd;
+  if (llvm::sys::fs::openFileForWrite(indexFile, fd, llvm::sys::fs::F_Append))
+    return;
+
+  std::string record =
+      (llvm::Twine(static_cast<int64_t>(time(nullptr))) + " " +
+       llvm::Twine(size) + " " + llvm::sys::path::filename(cacheFile))
+          .str();
+  if (codegenMillis) {
+    record += (" " + llvm::Twine(codegenMillis)).str();
+  }
+  record += '\n';
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << record;
+  }
+
+  uint64_t indexSize;
+  if (!llvm::sys::fs::file_size(indexFile, indexSize) &&
+      indexSize > maxIndexJournalBytes) {
+    indexNeedsCompaction = true;
+  }
+}
+
+/// Returns the codegen time recorded in the cache index for the given cache
+/// file, or 0 if unknown. The index is only read once (and only for
+/// -cache-stats).
+unsigned lookupCodegenMillis(llvm::StringRef fileName) {
+  static llvm::StringMap<unsigned> codegenMillis;
+  static bool loaded = false;
+  if (!loaded) {
+    loaded = true;
+    // The compacted index, then the previous and current journals.
+    for (const char *name :
+         {"ircache_index.base", "ircache_index.prev", "ircache_index"}) {
+      llvm::SmallString<128> indexFile(opts::cacheDir);
+      llvm::sys::path::append(indexFile, name);
+      auto buffer = llvm::MemoryBuffer::getFile(indexFile);
+      if (!buffer)
         continue;
+      llvm::SmallVector<llvm::StringRef, 0> lines;
+      (*buffer)->getBuffer().split(lines, '\n', -1, false);
+      for (auto line : lines) {
+        // "<time> <size> <name>[ <codegen ms>]"
+        llvm::SmallVector<llvm::StringRef, 4> fields;
+        line.split(fields, ' ');
+        unsigned millis;
+        if (fields.size() == 4 && !fields[3].getAsInteger(10, millis))
+          codegenMillis[fields[2]] = millis;
       }
+    }
+  }
 
-      // All arguments following -run can safely be ignored
-      if (strcmp(arg + 1, "run") == 0) {
-        break;
-      }
+  auto it = codegenMillis.find(fileName);
+  return it == codegenMillis.end() ? 0 : it->second;
+}
+
+/// Set after the first failure to access the shared cache directory, to stop
+/// retrying (and slowing down) every subsequent lookup.
+std::atomic<bool> sharedCacheFailed(false);
+
+bool isSharedCacheEnabled() {
+  return !sharedCacheDir.empty() && !sharedCacheFailed;
+}
+
+/// Stops using the shared cache directory, warning the user once. Errors
+/// accessing the shared cache are not fatal; compilation continues using the
+/// local cache only.
+void disableSharedCache(const char *what, llvm::StringRef file,
+                        std::error_code ec) {
+  IF_LOG Logger::println("Shared cache error: %s %s: %s", what,
+                         file.str().c_str(), ec.message().c_str());
+  if (sharedCacheFailed.exchange(true))
+    return;
+  std::lock_guard<std::mutex> lock(diagnosticsMutex);
+  warning(Loc(), "Shared cache disabled, failed to %s %s: %s", what,
+          file.str().c_str(), ec.message().c_str());
+}
+
+/// Copies the cache file for the given hash from the shared to the local cache
+/// directory, keeping its compressed or uncompressed form. Returns the local
+/// file, or an empty string if the shared cache doesn't contain it.
+std::string fetchFromSharedCache(llvm::StringRef cacheObjectHash,
+                                 llvm::StringRef extension) {
+  llvm::SmallString<128> sharedFile;
+  bool compressed;
+  if (!findCacheFile(sharedCacheDir, cacheObjectHash, extension, sharedFile,
+                     compressed)) {
+    return "";
+  }
+
+  IF_LOG Logger::println("Shared cache object found! %s", sharedFile.c_str());
+  if (!createCacheDirectory()) {
+    error(Loc(), "Unable to create cache directory: %s",
+          opts::cacheDir.c_str());
+    fatal();
+  }
+  llvm::SmallString<128> localFile;
+  storeCacheFileName(opts::cacheDir, cacheObjectHash, extension, compressed,
+                     localFile);
+  if (auto ec = copyFileAtomically(sharedFile, localFile)) {
+    disableSharedCache("fetch", sharedFile, ec);
+    return "";
+  }
+  return localFile.str().str();
+}
+
+/// Publishes a local cache file to the shared cache directory, unless another
+/// machine did so already.
+void publishToSharedCache(llvm::StringRef cacheObjectHash,
+                          llvm::StringRef extension,
+                          llvm::StringRef localFile) {
+  llvm::SmallString<128> sharedFile;
+  bool compressed;
+  if (findCacheFile(sharedCacheDir, cacheObjectHash, extension, sharedFile,
+                    compressed)) {
+    return;
+  }
+
+  sharedFile = sharedCacheDir;
+  llvm::sys::path::append(sharedFile, llvm::sys::path::filename(localFile));
+  IF_LOG Logger::println("Publish object file to shared cache: %s",
+                         sharedFile.c_str());
+  if (!llvm::sys::fs::exists(sharedCacheDir)) {
+    if (auto ec = llvm::sys::fs::create_directories(sharedCacheDir)) {
+      disableSharedCache("create directory", sharedCacheDir, ec);
+      return;
     }
+  }
+  if (auto ec = copyFileAtomically(localFile, sharedFile))
+    disableSharedCache("publish", sharedFile, ec);
+}
 
-    // If we reach here, add the argument to the hash.
-    hash_os << arg;
+/// Commandline options which aren't hashed by name and value: their effects
+/// are either hashed as parsed settings by outputIR2ObjRelevantSettings(),
+/// fully reflected in the hashed IR, or don't influence the object code.
+const char *const unhashedOptions[] = {
+    // Hashed as parsed settings.
+    "O", "O0", "O1", "O2", "O3", "O4", "O5", "Os", "Oz", "march", "m32", "m64",
+    "mcpu", "mattr", "mtriple", "float-abi", "relocation-model", "code-model",
+    "disable-fp-elim", "disable-linker-strip-dead",
+    // Reflected in the IR.
+    "d-debug", "d-version", "unittest", "ffile-prefix-map",
+    "fdebug-prefix-map",
+    // No influence on the object code.
+    "c", "lib", "of", "od", "op", "oq", "I", "J", "L", "D", "Dd", "Df", "H",
+    "Hd", "Hf", "X", "Xf", "d", "de", "dw", "v", "vv", "vcolumns", "verrors",
+    "vgc", "vtls", "w", "wi", "template-stats", "vmem", "lowmem",
+    "stats-file"};
+
+/// Name prefixes of further options without influence on the object code.
+const char *const unhashedOptionPrefixes[] = {
+    "cache", "ftime-trace", "ctfe-bytecode", "ctfe-jit", "prefetch-sources",
+    "parallel-parse"};
+
+bool isHashedOption(llvm::StringRef name) {
+  for (const char *unhashed : unhashedOptions) {
+    if (name == unhashed)
+      return false;
+  }
+  for (const char *prefix : unhashedOptionPrefixes) {
+    if (name.startswith(prefix))
+      return false;
   }
+  return true;
+}
 
-  // Adding these options to the hash should not be needed after adding all
-  // cmdline args. We keep this code here however, in case we find a different
-  // solution for dealing with LLVM commandline flags. See GH #1773.
-  // Also, having these options explicitly added to the hash protects against
-  // the possibility of different default settings on different platforms (while
-  // sharing the cache).
+/// Looks up the registered option for the name of a commandline argument
+/// (without leading dashes and value), also matching cl::Prefix options like
+/// "-Ipath". On success, `name` is set to the option's name.
+cl::Option *findOption(llvm::StringMap<cl::Option *> &map,
+                       llvm::StringRef &name) {
+  auto it = map.find(name);
+  if (it != map.end())
+    return it->getValue();
+
+  for (size_t len = name.size() - 1; len > 0; --len) {
+    it = map.find(name.substr(0, len));
+    if (it != map.end() &&
+        it->getValue()->getFormattingFlag() == cl::Prefix) {
+      name = name.substr(0, len);
+      return it->getValue();
+    }
+  }
+  return nullptr;
+}
+
+// Output to `hash_os` the parsed values of all settings that influence the
+// object code output in ways that are not observable in the pre-LLVM passes
+// IR used for hashing. Because the compiler version is part of the hash,
+// differences in the default settings between compiler versions are already
+// taken care of.
+void outputIR2ObjRelevantSettings(llvm::raw_ostream &hash_os) {
   outputOptimizationSettings(hash_os);
-  hash_os << opts::mCPU;
-  for (auto &attr : opts::mAttrs) {
-    hash_os << attr;
+
+  const llvm::TargetMachine &tm = *gTargetMachine;
+  hash_os << llvm::Triple(tm.getTargetTriple()).str();
+  // -mcpu=native resolves to the CPU and features of the host, which differ
+  // between the machines sharing a cache.
+  hash_os << tm.getTargetCPU();
+  // The last setting of each feature wins, so their order doesn't matter.
+  std::map<std::string, char> features;
+  llvm::SmallVector<llvm::StringRef, 32> featureStrings;
+  tm.getTargetFeatureString().split(featureStrings, ',');
+  for (auto feature : featureStrings) {
+    feature = feature.trim();
+    if (feature.empty())
+      continue;
+    const char sign = feature[0] == '-' ? '-' : '+';
+    if (feature[0] == '+' || feature[0] == '-')
+      feature = feature.drop_front();
+    features[feature.str()] = sign;
+  }
+  for (const auto &feature : features) {
+    hash_os << feature.second << feature.first << ',';
   }
-  hash_os << opts::mFloatABI;
-  hash_os << opts::mRelocModel;
-  hash_os << opts::mCodeModel;
+
+  const llvm::TargetOptions &options = tm.Options;
+  hash_os << static_cast<int>(options.FloatABIType);
+  hash_os << options.FunctionSections << options.DataSections;
+#if LDC_LLVM_VER >= 307
+  hash_os << options.MCOptions.ABIName;
+#else
+  hash_os << options.UseSoftFloat << options.NoFramePointerElim;
+#endif
+#if LDC_LLVM_VER >= 400
+  hash_os << static_cast<int>(options.CompressDebugSections);
+#endif
+  hash_os << static_cast<int>(tm.getRelocationModel());
+  hash_os << static_cast<int>(tm.getCodeModel());
+  hash_os << static_cast<int>(tm.getOptLevel());
   hash_os << opts::disableFpElim;
 }
 
+// Output to `hash_os` the remaining commandline options that may influence
+// the object code, i.e., all options except for the ones whose parsed values
+// are hashed by outputIR2ObjRelevantSettings(), whose effects are reflected in
+// the hashed IR, or which have no influence (see unhashedOptions).
+// The options are hashed by name and value, independent of their order and of
+// whether the value is specified with an equals sign or as separate argument.
+// Positional arguments (source files etc.) are reflected in the IR.
+// (Note: config and response files may also add compiler flags.)
+void outputIR2ObjRelevantCmdlineArgs(llvm::raw_ostream &hash_os) {
+#if LDC_LLVM_VER >= 307
+  llvm::StringMap<cl::Option *> &map = cl::getRegisteredOptions();
+#else
+  llvm::StringMap<cl::Option *> map;
+  cl::getRegisteredOptions(map);
+#endif
+
+  // The values of each option in commandline order, which matters for
+  // repeated occurrences.
+  std::map<std::string, std::vector<std::string>> hashedOptions;
+
+  // The first argument is the compiler executable filename: we can skip it.
+  for (size_t i = 1, n = opts::allArguments.size(); i < n; ++i) {
+    llvm::StringRef arg = opts::allArguments[i];
+    if (arg.size() < 2 || arg[0] != '-')
+      continue;
+
+    // All arguments following -run are passed to the program.
+    if (arg == "-run" || arg == "--run")
+      break;
+
+    llvm::StringRef name, value;
+    std::tie(name, value) = arg.ltrim('-').split('=');
+    if (name.empty())
+      continue;
+    const bool hasValue = name.end() != arg.end();
+
+    const size_t nameLength = name.size();
+    if (cl::Option *option = findOption(map, name)) {
+      if (name.size() < nameLength) {
+        // The value of a cl::Prefix option directly follows its name.
+        value = arg.substr(name.end() - arg.begin());
+      } else if (!hasValue &&
+                 option->getValueExpectedFlag() == cl::ValueRequired &&
+                 i + 1 < n) {
+        value = opts::allArguments[++i];
+      }
+    }
+
+    if (isHashedOption(name))
+      hashedOptions[name.str()].push_back(value.str());
+  }
+
+  for (const auto &option : hashedOptions) {
+    hash_os << option.first << '=';
+    for (const auto &value : option.second) {
+      hash_os << value << '\0';
+    }
+  }
+}
+
 // Output to `hash_os` all environment flags that influence object code output
 // in ways that are not observable in the pre-LLVM passes IR used for hashing.
 void outputIR2ObjRelevantEnvironmentOpts(llvm::raw_ostream &hash_os)
@@ -248,70 +711,201 @@ void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str) {
   // Let hash depend on compile flags that change the outputted obj file,
   // but whose changes are not always observable in the pre-optimized IR used
   // for hashing:
+  outputIR2ObjRelevantSettings(hash_os);
   outputIR2ObjRelevantCmdlineArgs(hash_os);
   outputIR2ObjRelevantEnvironmentOpts(hash_os);
 
-  llvm::WriteBitcodeToFile(m, hash_os);
+  const auto startTime = std::chrono::steady_clock::now();
+
+  // Prefer the cheap structural hash, and only serialize the module to
+  // bitcode if the structural walk doesn't cover all of its contents.
+  const char *method = "structural";
+  llvm::MD5 structuralHasher;
+  // Local value names need to be hashed if they end up in an output file.
+  const bool hashLocalNames = global.params.output_bc || global.params.output_ll;
+  if (hashModuleStructure(*m, hashLocalNames, structuralHasher)) {
+    llvm::MD5::MD5Result structuralHash;
+    structuralHasher.final(structuralHash);
+    hash_os << method;
+    hash_os.write(reinterpret_cast<const char *>(&structuralHash[0]),
+                  sizeof(structuralHash));
+  } else {
+    method = "bitcode";
+    llvm::WriteBitcodeToFile(m, hash_os);
+  }
+  hash_os.resultAsString(str);
+
+  const double milliseconds =
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - startTime)
+          .count();
+  statistics.hashMillis += milliseconds;
+  IF_LOG Logger::println("Module's LLVM IR hash (%s) is: %s", method,
+                         str.c_str());
+  if (global.params.verbose) {
+    fprintf(global.stdmsg, "cachehash %s (%s, %.2f ms)\n", str.c_str(),
+            method, milliseconds);
+  }
+}
+
+bool isLinkCacheEnabled() {
+  return !opts::cacheDir.empty() && cacheLinkOutputs;
+}
+
+void calculateLinkHash(llvm::StringRef tool, llvm::ArrayRef<std::string> args,
+                       llvm::StringRef output, llvm::SmallString<32> &str) {
+  raw_hash_ostream hash_os;
+  hash_os << global.ldc_version << global.version << global.llvm_version
+          << ldc::built_with_Dcompiler_version;
+  hash_os << tool << '\0';
+
+  // The object files are identified by their contents. Their order only
+  // influences the layout of the output, so they are hashed sorted, which
+  // makes the key independent of the order of the source files.
+  std::set<llvm::StringRef> objectFiles;
+  std::vector<std::string> objectHashes;
+  for (const char *objfile : *global.params.objfiles) {
+    objectFiles.insert(objfile);
+    raw_hash_ostream object_os;
+    if (auto buffer = llvm::MemoryBuffer::getFile(objfile))
+      object_os << (*buffer)->getBuffer();
+    llvm::SmallString<32> objectHash;
+    object_os.resultAsString(objectHash);
+    objectHashes.push_back(objectHash.str().str());
+  }
+  std::sort(objectHashes.begin(), objectHashes.end());
+  for (const auto &objectHash : objectHashes) {
+    hash_os << objectHash;
+  }
+
+  for (const auto &arg : args) {
+    if (objectFiles.count(arg))
+      continue;
+    // The output file name doesn't influence its contents.
+    if (arg == output || arg == ("/OUT:" + output).str()) {
+      hash_os << "<output>" << '\0';
+      continue;
+    }
+    hash_os << arg << '\0';
+    // Other input files, e.g. static libraries, are identified by their
+    // contents too.
+    if (llvm::sys::fs::is_regular_file(arg)) {
+      if (auto buffer = llvm::MemoryBuffer::getFile(arg))
+        hash_os << (*buffer)->getBuffer();
+    }
+  }
+
   hash_os.resultAsString(str);
-  IF_LOG Logger::println("Module's LLVM bitcode hash is: %s", str.c_str());
+  IF_LOG Logger::println("Link hash is: %s", str.c_str());
 }
 
-std::string cacheLookup(llvm::StringRef cacheObjectHash) {
+std::string cacheLookup(llvm::StringRef cacheObjectHash,
+                        llvm::StringRef extension) {
   if (opts::cacheDir.empty())
     return "";
 
+  llvm::SmallString<128> filePath;
+  bool compressed;
   if (!llvm::sys::fs::exists(opts::cacheDir)) {
     IF_LOG Logger::println("Cache directory does not exist, no object found.");
-    return "";
-  }
-
-  llvm::SmallString<128> filePath;
-  storeCacheFileName(cacheObjectHash, filePath);
-  if (llvm::sys::fs::exists(filePath.c_str())) {
+  } else if (findCacheFile(opts::cacheDir, cacheObjectHash, extension,
+                           filePath, compressed)) {
     IF_LOG Logger::println("Cache object found! %s", filePath.c_str());
     return filePath.str().str();
   }
 
+  if (isSharedCacheEnabled()) {
+    std::string sharedObject = fetchFromSharedCache(cacheObjectHash, extension);
+    if (!sharedObject.empty()) {
+      IF_LOG Logger::println("Cache object found! %s", sharedObject.c_str());
+      return sharedObject;
+    }
+  }
+
   IF_LOG Logger::println("Cache object not found.");
+  ++statistics.misses;
   return "";
 }
 
-void cacheObjectFile(llvm::StringRef objectFile,
-                     llvm::StringRef cacheObjectHash) {
+std::string cacheObjectFile(llvm::StringRef objectFile,
+                            llvm::StringRef cacheObjectHash,
+                            llvm::StringRef extension, unsigned codegenMillis) {
   if (opts::cacheDir.empty())
-    return;
+    return "";
 
-  if (!llvm::sys::fs::exists(opts::cacheDir) &&
-      llvm::sys::fs::create_directories(opts::cacheDir)) {
-    error(Loc(), "Unable to create cache directory: %s",
-          opts::cacheDir.c_str());
-    fatal();
-  }
+  if (!createCacheDirectory())
+    return "Unable to create cache directory: " + std::string(opts::cacheDir);
 
+  const bool compressed = useCompression();
   llvm::SmallString<128> cacheFile;
-  storeCacheFileName(cacheObjectHash, cacheFile);
+  storeCacheFileName(opts::cacheDir, cacheObjectHash, extension, compressed,
+                     cacheFile);
 
-  IF_LOG Logger::println("Copy object file to cache: %s to %s",
+  IF_LOG Logger::println("%s object file to cache: %s to %s",
+                         compressed ? "Compress" : "Copy",
                          objectFile.str().c_str(), cacheFile.c_str());
-  if (llvm::sys::fs::copy_file(objectFile, cacheFile.c_str())) {
-    error(Loc(), "Failed to copy object file to cache: %s to %s",
-          objectFile.str().c_str(), cacheFile.c_str());
-    fatal();
+  // Concurrent lookups by other processes must never see a partially written
+  // cache file.
+  if (compressed ? compressFileAtomically(objectFile, cacheFile)
+                 : copyFileAtomically(objectFile, cacheFile)) {
+    return "Failed to copy object file to cache: " + objectFile.str() +
+           " to " + cacheFile.str().str();
   }
+
+  recordCacheFileAccess(cacheFile, codegenMillis);
+  ++statistics.filesAdded;
+
+  if (isSharedCacheEnabled())
+    publishToSharedCache(cacheObjectHash, extension, cacheFile);
+  return "";
 }
 
-void recoverObjectFile(llvm::StringRef cacheObjectHash,
-                       llvm::StringRef objectFile) {
+bool recoverObjectFile(llvm::StringRef cacheObjectHash,
+                       llvm::StringRef extension, llvm::StringRef objectFile) {
   llvm::SmallString<128> cacheFile;
-  storeCacheFileName(cacheObjectHash, cacheFile);
+  bool compressed;
+  // Another process may have pruned the cache entry since the lookup.
+  if (!findCacheFile(opts::cacheDir, cacheObjectHash, extension, cacheFile,
+                     compressed)) {
+    IF_LOG Logger::println("Cache object was pruned before its recovery.");
+    ++statistics.misses;
+    return false;
+  }
 
   // Remove the potentially pre-existing output file.
   llvm::sys::fs::remove(objectFile);
 
-  IF_LOG Logger::println("SymLink output to cached object file: %s -> %s",
-                         objectFile.str().c_str(), cacheFile.c_str());
-  if (llvm::sys::fs::create_link(cacheFile.c_str(), objectFile)) {
-    error(Loc(), "Failed to create a symlink to the cached file: %s -> %s",
+  bool recovered;
+  if (compressed) {
+    IF_LOG Logger::println("Decompress cached object file: %s -> %s",
+                           cacheFile.c_str(), objectFile.str().c_str());
+    recovered = decompressFile(cacheFile, objectFile);
+  } else {
+    // Prefer a hard link, and copy the file otherwise. Unlike a symlink, both
+    // keep the output valid if the cache entry is pruned before linking.
+    std::error_code ec;
+#if LDC_LLVM_VER >= 400
+    IF_LOG Logger::println("HardLink output to cached object file: %s -> %s",
+                           objectFile.str().c_str(), cacheFile.c_str());
+    ec = llvm::sys::fs::create_hard_link(cacheFile.c_str(), objectFile);
+    if (ec)
+#endif
+    {
+      IF_LOG Logger::println("Copy output from cached object file: %s -> %s",
+                             objectFile.str().c_str(), cacheFile.c_str());
+      ec = llvm::sys::fs::copy_file(cacheFile.c_str(), objectFile);
+    }
+    recovered = !ec;
+  }
+
+  if (!recovered) {
+    if (!llvm::sys::fs::exists(cacheFile)) {
+      IF_LOG Logger::println("Cache object was pruned during its recovery.");
+      llvm::sys::fs::remove(objectFile);
+      ++statistics.misses;
+      return false;
+    }
+    error(Loc(), "Failed to recover the output from the cached file: %s -> %s",
           cacheFile.c_str(), objectFile.str().c_str());
     fatal();
   }
@@ -321,31 +915,101 @@ void recoverObjectFile(llvm::StringRef cacheObjectHash,
   // On some systems the last accessed time is not automatically updated so set
   // it explicitly here. Because the file will really only be accessed later
   // during linking, it's not perfect but it's the best we can do.
+  // The file is opened for reading only, so that an entry pruned in the
+  // meantime isn't recreated as empty file. Failures are ignored; the access
+  // is recorded in the cache index anyway.
   {
     int FD;
-    if (llvm::sys::fs::openFileForWrite(cacheFile.c_str(), FD,
-                                        llvm::sys::fs::F_Append)) {
-      error(Loc(), "Failed to open the cached file for writing: %s",
-            cacheFile.c_str());
-      fatal();
+    if (!llvm::sys::fs::openFileForRead(cacheFile.c_str(), FD)) {
+      if (llvm::sys::fs::setLastModificationAndAccessTime(
+              FD, llvm::sys::TimeValue::now())) {
+        IF_LOG Logger::println("Failed to set the cached file modification "
+                               "time: %s",
+                               cacheFile.c_str());
+      }
+      close(FD);
     }
+  }
 
-    if (llvm::sys::fs::setLastModificationAndAccessTime(
-            FD, llvm::sys::TimeValue::now())) {
-      error(Loc(), "Failed to set the cached file modification time: %s",
-            cacheFile.c_str());
-      fatal();
+  recordCacheFileAccess(cacheFile);
+
+  if (isStatisticsEnabled()) {
+    ++statistics.hits;
+    uint64_t size;
+    if (!llvm::sys::fs::file_size(objectFile, size))
+      statistics.bytesRestored += size;
+    if (unsigned millis =
+            lookupCodegenMillis(llvm::sys::path::filename(cacheFile))) {
+      statistics.savedMillis += millis;
+    } else {
+      ++statistics.hitsWithoutCodegenTime;
     }
+  }
+
+  return true;
+}
 
-    close(FD);
+void printStatistics() {
+  if (opts::cacheDir.empty() || !isStatisticsEnabled())
+    return;
+
+  const Statistics &s = statistics;
+  if (showStatistics) {
+    fprintf(global.stdmsg,
+            "Cache statistics: %u hits, %u misses, %u files added, %llu bytes "
+            "restored, %.2f ms hashing, ~%llu ms codegen saved",
+            s.hits, s.misses, s.filesAdded.load(),
+            static_cast<unsigned long long>(s.bytesRestored), s.hashMillis,
+            static_cast<unsigned long long>(s.savedMillis));
+    if (s.hitsWithoutCodegenTime) {
+      fprintf(global.stdmsg, " (+ %u hits without recorded codegen time)",
+              s.hitsWithoutCodegenTime);
+    }
+    fprintf(global.stdmsg, "\n");
+  }
+
+  if (!statisticsFile.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(statisticsFile, ec, llvm::sys::fs::F_Append);
+    if (ec) {
+      error(Loc(), "Failed to open cache statistics file: %s: %s",
+            statisticsFile.c_str(), ec.message().c_str());
+      fatal();
+    }
+    os << "{\"cacheDir\": \"";
+    for (char c : opts::cacheDir) {
+      if (c == '"' || c == '\\')
+        os << '\\';
+      os << c;
+    }
+    os << "\", \"hits\": " << s.hits << ", \"misses\": " << s.misses
+       << ", \"filesAdded\": " << s.filesAdded.load()
+       << ", \"bytesRestored\": " << s.bytesRestored
+       << ", \"hashMillis\": " << llvm::format("%.2f", s.hashMillis)
+       << ", \"savedMillis\": " << s.savedMillis
+       << ", \"hitsWithoutCodegenTime\": " << s.hitsWithoutCodegenTime
+       << "}\n";
   }
 }
 
+void getHitsAndMisses(unsigned &hits, unsigned &misses) {
+  hits = statistics.hits;
+  misses = statistics.misses;
+}
+
 void pruneCache() {
-  if (!opts::cacheDir.empty() && isPruningEnabled()) {
+  if (opts::cacheDir.empty())
+    return;
+
+  if (isPruningEnabled()) {
     ::pruneCache(opts::cacheDir.data(), opts::cacheDir.size(),
                  pruneInterval, pruneExpiration, pruneSizeLimitInBytes,
                  pruneSizeLimitPercentage);
   }
+  // Pruning compacts the index too, but only once per pruning interval.
+  if (indexNeedsCompaction) {
+    ::compactCacheIndex(opts::cacheDir.data(), opts::cacheDir.size(),
+                        maxIndexJournalBytes);
+  }
 }
 } // namespace cache
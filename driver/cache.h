@@ -15,19 +15,50 @@
 namespace llvm {
 class Module;
 class StringRef;
+template <typename> class ArrayRef;
 template <unsigned> class SmallString;
 }
 
 namespace cache {
 
 void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str);
-std::string cacheLookup(llvm::StringRef cacheObjectHash);
-void cacheObjectFile(llvm::StringRef objectFile,
-                     llvm::StringRef cacheObjectHash);
-void recoverObjectFile(llvm::StringRef cacheObjectHash,
-                       llvm::StringRef objectFile);
 
-/// Prune the cache to avoid filling up disk space.
+// Cache entries are identified by the module hash and the default file
+// extension of the output kind (global.obj_ext, global.bc_ext, ...).
+std::string cacheLookup(llvm::StringRef cacheObjectHash,
+                        llvm::StringRef extension);
+// The codegen time (0 if unknown) is recorded for the -cache-stats estimate of
+// the time saved by cache hits.
+// May be called from codegen worker threads, so doesn't report errors itself;
+// returns the error message on failure and an empty string on success.
+std::string cacheObjectFile(llvm::StringRef objectFile,
+                            llvm::StringRef cacheObjectHash,
+                            llvm::StringRef extension,
+                            unsigned codegenMillis = 0);
+// Returns false if the cache entry was pruned since the lookup, in which case
+// the output needs to be generated.
+bool recoverObjectFile(llvm::StringRef cacheObjectHash,
+                       llvm::StringRef extension, llvm::StringRef objectFile);
+
+/// Whether -cache-link caches the outputs of the linker and archiver too.
+bool isLinkCacheEnabled();
+/// Calculates the cache key for the output of a link or archive step from the
+/// tool, its arguments and the contents of the input files. Link outputs are
+/// cached like object files, with linkOutputExtension.
+void calculateLinkHash(llvm::StringRef tool, llvm::ArrayRef<std::string> args,
+                       llvm::StringRef output, llvm::SmallString<32> &str);
+const char *const linkOutputExtension = "link";
+
+/// Print the cache hit/miss statistics if requested via -cache-stats, and/or
+/// append them (in JSON format) to the -cache-stats-file.
+void printStatistics();
+
+/// The number of cache hits and misses (only counted if statistics are
+/// requested, e.g. also via -stats-file).
+void getHitsAndMisses(unsigned &hits, unsigned &misses);
+
+/// Prune the cache to avoid filling up disk space. Also compacts the cache
+/// index if it has grown too large.
 ///
 /// Note: Does nothing for LLVM < 3.7.
 void pruneCache();
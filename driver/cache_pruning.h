@@ -20,4 +20,7 @@ void pruneCache(const char *cacheDirectoryPtr, size_t cacheDirectoryLen,
                 uint32_t pruneIntervalSeconds, uint32_t expireIntervalSeconds,
                 d_ulong sizeLimitBytes, uint32_t sizeLimitPercentage);
 
+void compactCacheIndex(const char *cacheDirectoryPtr, size_t cacheDirectoryLen,
+                       d_ulong maxJournalBytes);
+
 #endif
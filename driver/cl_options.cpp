@@ -125,6 +125,24 @@ static cl::opt<unsigned, true>
                  cl::location(global.params.dwarfVersion), cl::init(0),
                  cl::Hidden);
 
+cl::opt<bool> lineTablesOnly(
+    "gline-tables-only", cl::ZeroOrMore,
+    cl::desc("Emit debug line number tables only, without any variable and "
+             "type info (implies -g)"));
+
+cl::opt<bool> splitDwarf(
+    "gsplit-dwarf", cl::ZeroOrMore,
+    cl::desc("Write the DWARF debug info of each object file to a separate "
+             ".dwo file (ELF only, implies -g)"));
+
+cl::opt<bool> compressDebugSections("gz", cl::ZeroOrMore,
+                                    cl::desc("Compress debug sections"));
+
+cl::opt<bool> debugTypeUnits(
+    "fdebug-types-section", cl::ZeroOrMore,
+    cl::desc("Emit the debug info of aggregate types into type units, which "
+             "the linker deduplicates (ELF only)"));
+
 cl::opt<bool> noAsm("noasm", cl::desc("Disallow use of inline assembler"));
 
 // Output file options
@@ -208,6 +226,126 @@ cl::opt<std::string>
                                "store cache files (experimental)"),
              cl::value_desc("cache dir"));
 
+cl::opt<unsigned> cacheFragments(
+    "cache-fragments",
+    cl::desc("Split each module into <N> fragments which are cached and "
+             "compiled to separate object files, so that a change only "
+             "invalidates the affected fragments (experimental) (LLVM >= 3.9)"),
+    cl::value_desc("N"), cl::init(0));
+
+cl::opt<unsigned> parallelCodegen(
+    "parallel-codegen",
+    cl::desc("Optimize and emit machine code for the generated modules on <N> "
+             "background threads (default: 0, i.e. sequentially) (LLVM >= "
+             "3.7). With -singleobj, split the machine code into <N> object "
+             "files generated in parallel (LLVM >= 3.9)"),
+    cl::value_desc("N"), cl::init(0));
+
+cl::opt<bool> useJobserver(
+    "jobserver",
+    cl::desc("When invoked by a parallel GNU make, only start the "
+             "-parallel-codegen threads the make jobserver has job tokens "
+             "for (default: true)"),
+    cl::init(true));
+
+// Defined in driver/parallelparse.d.
+extern unsigned parallelParseThreads;
+static cl::opt<unsigned, true> parallelParse(
+    "parallel-parse",
+    cl::desc("Read and parse the root modules on <N> threads (default: 0, "
+             "i.e. sequentially)"),
+    cl::value_desc("N"), cl::location(parallelParseThreads));
+
+// Defined in driver/lazysemantic.d.
+extern bool lazyImportSemantic;
+static cl::opt<bool, true> lazyImportSemantic_(
+    "lazy-import-semantic",
+    cl::desc("Analyze the functions of imported modules only once they are "
+             "looked up (experimental)"),
+    cl::ZeroOrMore, cl::location(lazyImportSemantic));
+
+cl::list<std::string> filePrefixMap(
+    "ffile-prefix-map", cl::ZeroOrMore, cl::value_desc("old=new"),
+    cl::desc("Replace the path prefix <old> by <new> in all source file "
+             "paths embedded in the output (__FILE__, assert messages, "
+             "coverage, debug info)"));
+
+cl::list<std::string> debugPrefixMap(
+    "fdebug-prefix-map", cl::ZeroOrMore, cl::value_desc("old=new"),
+    cl::desc("Replace the path prefix <old> by <new> in the debug info"));
+
+cl::opt<bool> timeTrace(
+    "ftime-trace",
+    cl::desc("Write a trace of where the compiler spends its time (parsing, "
+             "semantic analysis, template instantiations, CTFE, codegen, "
+             "optimization, linking) in the Chrome trace event format"),
+    cl::ZeroOrMore);
+
+cl::opt<std::string> timeTraceFile(
+    "ftime-trace-file",
+    cl::desc("Output file of -ftime-trace (default: the first output file "
+             "with extension .time-trace)"),
+    cl::value_desc("filename"));
+
+cl::opt<unsigned> timeTraceGranularity(
+    "ftime-trace-granularity",
+    cl::desc("Minimum duration of the events recorded by -ftime-trace, in "
+             "microseconds (default: 500)"),
+    cl::value_desc("us"), cl::init(500));
+
+#if LDC_LLVM_VER >= 400
+cl::opt<bool> saveOptimizationRecord(
+    "fsave-optimization-record",
+    cl::desc("Write the optimization remarks of each module in YAML format "
+             "to <object file>.opt.yaml"),
+    cl::ZeroOrMore);
+#endif
+
+cl::opt<bool> templateStats(
+    "template-stats",
+    cl::desc("Print how often each template instance is instantiated, the "
+             "time spent in its semantic analysis and the number and size of "
+             "the functions emitted for it"),
+    cl::ZeroOrMore);
+
+cl::opt<bool> memoryStats(
+    "vmem",
+    cl::desc("Print the memory allocated by the frontend in each compilation "
+             "phase (parse, semantic, templates, CTFE, codegen) and the peak "
+             "RSS"),
+    cl::ZeroOrMore);
+
+static cl::opt<bool> lowmem(
+    "lowmem",
+    cl::desc("Enable the garbage collector for the frontend, reducing the "
+             "memory usage of CTFE-heavy code at the expense of compilation "
+             "speed (experimental; only effective on the command line itself, "
+             "not in response or config files)"),
+    cl::ZeroOrMore);
+
+// Defined in gen/ctfebytecode.d.
+extern bool ctfeBytecodeEnabled;
+static cl::opt<bool, true> ctfeBytecode(
+    "ctfe-bytecode",
+    cl::desc("Run integer-only functions with the CTFE bytecode engine "
+             "instead of the AST interpreter (default: true)"),
+    cl::ZeroOrMore, cl::Hidden, cl::location(ctfeBytecodeEnabled));
+
+// Defined in gen/ctfebytecode.d.
+extern bool ctfeJitEnabled;
+extern unsigned ctfeJitThreshold;
+static cl::opt<bool, true> ctfeJit(
+    "ctfe-jit",
+    cl::desc("Compile integer-only functions run often by the CTFE bytecode "
+             "engine to native code (experimental)"),
+    cl::ZeroOrMore, cl::location(ctfeJitEnabled));
+
+static cl::opt<unsigned, true> ctfeJitThreshold_(
+    "ctfe-jit-threshold",
+    cl::desc("Number of bytecode instructions a function must have executed "
+             "during CTFE before -ctfe-jit compiles it (default: 100000)"),
+    cl::value_desc("n"), cl::ZeroOrMore, cl::location(ctfeJitThreshold));
+
 static StringsAdapter strImpPathStore("J", global.params.fileImppath);
 static cl::list<std::string, StringsAdapter>
     stringImportPaths("J", cl::desc("Where to look for string imports"),
@@ -272,6 +410,17 @@ cl::opt<std::string>
                cl::desc("Write module dependencies to filename (only imports)"),
                cl::value_desc("filename"), cl::ValueOptional);
 
+cl::opt<std::string>
+    makeDeps("makedeps",
+             cl::desc("Write a Make/Ninja-compatible dependency file, listing "
+                      "the imported and string-imported files"),
+             cl::value_desc("filename"));
+
+cl::opt<bool> makeDepsTransitive(
+    "makedeps-transitive",
+    cl::desc("List all (transitively) imported files in the -makedeps file"),
+    cl::ZeroOrMore);
+
 cl::opt<std::string> mArch("march",
                            cl::desc("Architecture to generate code for:"));
 
@@ -299,6 +448,12 @@ cl::opt<std::string>
          cl::Hidden, cl::init(""));
 #endif
 
+cl::opt<unsigned> dABIVersion(
+    "fd-abi-version", cl::ZeroOrMore, cl::value_desc("version"),
+    cl::desc("extern(D) calling convention revision (x86-64: 0 = System V "
+             "(default), 1 = pass aggregates of up to 4 words in registers)"),
+    cl::init(0));
+
 cl::opt<llvm::Reloc::Model> mRelocModel(
     "relocation-model", cl::desc("Relocation model"),
 #if LDC_LLVM_VER < 309
@@ -338,11 +493,54 @@ cl::opt<FloatABI::Type> mFloatABI(
         clEnumValN(FloatABI::Hard, "hard",
                    "Hardware floating-point ABI and instructions")));
 
+cl::opt<RealPrecision> realPrecision(
+    "real-precision", cl::ZeroOrMore,
+    cl::desc("Precision of the real type (changes the ABI; druntime and "
+             "Phobos need to be built with the same setting, e.g., via the "
+             "D_FLAGS of the runtime build):"),
+    cl::init(RealPrecision_Default),
+    clEnumValues(clEnumValN(RealPrecision_Default, "default",
+                            "Target default (e.g., 80-bit x87 on x86)"),
+                 clEnumValN(RealPrecision_Double, "double",
+                            "64-bit double precision")));
+
 cl::opt<bool>
     disableFpElim("disable-fp-elim",
                   cl::desc("Disable frame pointer elimination optimization"),
                   cl::init(false));
 
+cl::opt<bool> splitStack(
+    "fsplit-stack", cl::ZeroOrMore,
+    cl::desc("Use segmented stacks, growing on demand (x86 ELF only)"));
+
+cl::opt<std::string> stackProbeFunction(
+    "fstack-probe-function", cl::ZeroOrMore, cl::value_desc("symbol"),
+    cl::desc("Call <symbol> in the prologue of functions with frames larger "
+             "than a page to probe the stack (x86 only)"));
+
+cl::opt<bool> xrayInstrument(
+    "fxray-instrument", cl::ZeroOrMore,
+    cl::desc("Insert patchable XRay sleds at the entry and exit of functions "
+             "for tracing (Linux only)"));
+
+cl::opt<unsigned> xrayInstructionThreshold(
+    "fxray-instruction-threshold", cl::ZeroOrMore, cl::value_desc("N"),
+    cl::desc("Only instrument functions with at least <N> machine "
+             "instructions with -fxray-instrument (default: 200)"),
+    cl::init(200));
+
+cl::opt<unsigned> alignFunctions(
+    "falign-functions", cl::ZeroOrMore, cl::value_desc("bytes"),
+    cl::desc("Align the start of all defined functions to <bytes> (a power "
+             "of 2)"),
+    cl::init(0));
+
+cl::opt<unsigned> alignLoops(
+    "falign-loops", cl::ZeroOrMore, cl::value_desc("bytes"),
+    cl::desc("Align loop headers to <bytes> (a power of 2; x86 with LLVM "
+             "4.0+ only)"),
+    cl::init(0));
+
 static cl::opt<bool, true, FlagParser<bool>>
     asserts("asserts", cl::desc("(*) Enable assertions"),
             cl::value_desc("bool"), cl::location(global.params.useAssert),
@@ -404,11 +602,69 @@ cl::opt<bool> linkonceTemplates(
         "Use linkonce_odr linkage for template symbols instead of weak_odr"),
     cl::ZeroOrMore);
 
+cl::opt<bool> contiguousMulDimArrays(
+    "contiguous-muldim-arrays", cl::ZeroOrMore,
+    cl::desc("Allocate multi-dimensional `new` arrays as a single GC block, "
+             "with the sub-arrays pointing into it (the whole block is "
+             "scanned by the GC)"));
+
 cl::opt<bool> disableLinkerStripDead(
     "disable-linker-strip-dead",
     cl::desc("Do not try to remove unused symbols during linking"),
     cl::init(false));
 
+cl::opt<SymbolVisibility> symbolVisibility(
+    "fvisibility", cl::ZeroOrMore,
+    cl::desc("Default visibility of the defined symbols:"),
+    cl::init(SymbolVisibility_default),
+    clEnumValues(
+        clEnumValN(SymbolVisibility_default, "default",
+                   "Export all symbols which aren't private"),
+        clEnumValN(SymbolVisibility_hidden, "hidden",
+                   "Only export the symbols declared with `export`")));
+
+cl::opt<bool> noPLT(
+    "fno-plt", cl::ZeroOrMore,
+    cl::desc("Call external functions through the GOT instead of the PLT"));
+
+cl::opt<UnwindTables> unwindTables(
+    "funwind-tables", cl::ZeroOrMore,
+    cl::desc("Unwind tables and exception handling tables to emit:"),
+    cl::init(UnwindTables_full),
+    clEnumValues(
+        clEnumValN(UnwindTables_full, "full",
+                   "Run all cleanups when unwinding, also for Errors"),
+        clEnumValN(UnwindTables_minimal, "minimal",
+                   "Errors skip the cleanups in nothrow functions; no unwind "
+                   "tables for nothrow leaf functions")));
+
+cl::opt<LTOKind> ltoMode(
+    "flto", cl::ZeroOrMore,
+    cl::desc("Set LTO mode, requires linker support (LLVM >= 3.9)"),
+    cl::init(LTO_None),
+    clEnumValues(
+        clEnumValN(LTO_Full, "full", "Merges all input into a single module"),
+        clEnumValN(LTO_Thin, "thin",
+                   "Parallel importing and codegen (faster than 'full')")));
+
+cl::opt<std::string>
+    ltoLibrary("flto-binary", cl::ZeroOrMore,
+               cl::desc("Set the linker LTO plugin library file (e.g. "
+                        "LLVMgold.so (Unixes) or libLTO.dylib (Darwin))"),
+               cl::value_desc("file"));
+
+cl::opt<bool> wholeProgramVtables(
+    "fwhole-program-vtables", cl::ZeroOrMore,
+    cl::desc("Emit vtable type information for whole-program optimizations "
+             "such as devirtualizing calls to classes with a single "
+             "implementation (requires -flto=full)"));
+
+cl::opt<bool> enableDynamicCompile(
+    "enable-dynamic-compile", cl::ZeroOrMore,
+    cl::desc("Embed the bitcode of @ldc.attributes.dynamicCompile functions, "
+             "to be compiled for the host CPU by compileDynamicCode() at "
+             "runtime (links the ldc-jit-rt library)"));
+
 cl::opt<bool, true>
     allinst("allinst",
             cl::desc("generate code for all template instantiations"),
@@ -442,6 +698,38 @@ cl::opt<unsigned char, true, CoverageParser> coverageAnalysis(
                     "minimum required coverage)"),
     cl::location(global.params.covPercent), cl::ValueOptional, cl::init(127));
 
+cl::opt<CoverageIncrement> coverageIncrement(
+    "cov-increment", cl::ZeroOrMore,
+    cl::desc("Set the type of the -cov line count increments"),
+    cl::init(CoverageIncrement_atomic),
+    clEnumValues(
+        clEnumValN(CoverageIncrement_atomic, "atomic",
+                   "Atomic increment of the shared counters (default)"),
+        clEnumValN(CoverageIncrement_nonatomic, "non-atomic",
+                   "Non-atomic increment of the shared counters (counts may "
+                   "be lost with several threads)"),
+        clEnumValN(CoverageIncrement_tls, "thread-local",
+                   "Non-atomic increment of thread-local counters, merged "
+                   "into the shared ones when a thread terminates")));
+
+cl::opt<CoverageFormat> coverageFormat(
+    "cov-format", cl::ZeroOrMore,
+    cl::desc("Set the output format of the -cov line counts"),
+    cl::init(CoverageFormat_lst),
+    clEnumValues(
+        clEnumValN(CoverageFormat_lst, "lst",
+                   "<source>.lst listings written by druntime (default)"),
+        clEnumValN(CoverageFormat_raw, "raw",
+                   "Binary counters of all modules written to "
+                   "$LDC_COVERAGE_DIR/ldc-<pid>.covraw, to be merged and "
+                   "rendered by ldc-covdata")));
+
+cl::opt<bool, true> profileGC(
+    "profile-gc", cl::ZeroOrMore,
+    cl::desc("Count the GC allocations of each allocation site, written to "
+             "profilegc.log when the program exits"),
+    cl::location(global.params.tracegc));
+
 #if LDC_WITH_PGO
 cl::opt<std::string>
     genfileInstrProf("fprofile-instr-generate", cl::value_desc("filename"),
@@ -453,8 +741,20 @@ cl::opt<std::string> usefileInstrProf(
     "fprofile-instr-use", cl::value_desc("filename"),
     cl::desc("Use instrumentation data for profile-guided optimization"),
     cl::ValueRequired);
+
+cl::opt<bool> instrProfIRLevel(
+    "fprofile-instr-ir", cl::ZeroOrMore,
+    cl::desc("Generate (-fprofile-instr-generate) or use "
+             "(-fprofile-instr-use) the instrumentation at the IR level, after "
+             "inlining the small functions (LLVM >= 3.9)"));
 #endif
 
+cl::opt<std::string> usefileSampleProf(
+    "fprofile-sample-use", cl::value_desc("filename"),
+    cl::desc("Use sample profile data (e.g. converted from perf data) for "
+             "profile-guided optimization (implies -g)"),
+    cl::ValueRequired);
+
 static cl::extrahelp footer(
     "\n"
     "-d-debug can also be specified without options, in which case it enables "
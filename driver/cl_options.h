@@ -41,6 +41,10 @@ extern cl::list<std::string> fileList;
 extern cl::list<std::string> runargs;
 extern cl::opt<bool> compileOnly;
 extern cl::opt<bool, true> enforcePropertySyntax;
+extern cl::opt<bool> lineTablesOnly;
+extern cl::opt<bool> splitDwarf;
+extern cl::opt<bool> compressDebugSections;
+extern cl::opt<bool> debugTypeUnits;
 extern cl::opt<bool> noAsm;
 extern cl::opt<bool> dontWriteObj;
 extern cl::opt<std::string> objectFile;
@@ -59,7 +63,22 @@ extern cl::opt<std::string> hdrFile;
 extern cl::list<std::string> versions;
 extern cl::list<std::string> transitions;
 extern cl::opt<std::string> moduleDeps;
+extern cl::opt<std::string> makeDeps;
+extern cl::opt<bool> makeDepsTransitive;
 extern cl::opt<std::string> cacheDir;
+extern cl::opt<unsigned> cacheFragments;
+extern cl::opt<unsigned> parallelCodegen;
+extern cl::opt<bool> useJobserver;
+extern cl::list<std::string> filePrefixMap;
+extern cl::list<std::string> debugPrefixMap;
+extern cl::opt<bool> timeTrace;
+extern cl::opt<std::string> timeTraceFile;
+extern cl::opt<unsigned> timeTraceGranularity;
+#if LDC_LLVM_VER >= 400
+extern cl::opt<bool> saveOptimizationRecord;
+#endif
+extern cl::opt<bool> templateStats;
+extern cl::opt<bool> memoryStats;
 
 extern cl::opt<std::string> mArch;
 extern cl::opt<bool> m32bits;
@@ -70,13 +89,46 @@ extern cl::opt<std::string> mTargetTriple;
 #if LDC_LLVM_VER >= 307
 extern cl::opt<std::string> mABI;
 #endif
+extern cl::opt<unsigned> dABIVersion;
 extern cl::opt<llvm::Reloc::Model> mRelocModel;
 extern cl::opt<llvm::CodeModel::Model> mCodeModel;
 extern cl::opt<bool> disableFpElim;
+extern cl::opt<bool> splitStack;
+extern cl::opt<std::string> stackProbeFunction;
+extern cl::opt<bool> xrayInstrument;
+extern cl::opt<unsigned> xrayInstructionThreshold;
+extern cl::opt<unsigned> alignFunctions;
+extern cl::opt<unsigned> alignLoops;
 extern cl::opt<FloatABI::Type> mFloatABI;
+enum RealPrecision { RealPrecision_Default, RealPrecision_Double };
+extern cl::opt<RealPrecision> realPrecision;
 extern cl::opt<bool, true> singleObj;
 extern cl::opt<bool> linkonceTemplates;
+extern cl::opt<bool> contiguousMulDimArrays;
 extern cl::opt<bool> disableLinkerStripDead;
+enum SymbolVisibility { SymbolVisibility_default, SymbolVisibility_hidden };
+extern cl::opt<SymbolVisibility> symbolVisibility;
+extern cl::opt<bool> noPLT;
+enum UnwindTables { UnwindTables_full, UnwindTables_minimal };
+extern cl::opt<UnwindTables> unwindTables;
+
+enum LTOKind { LTO_None, LTO_Full, LTO_Thin };
+extern cl::opt<LTOKind> ltoMode;
+inline bool isUsingLTO() { return ltoMode != LTO_None; }
+inline bool isUsingThinLTO() { return ltoMode == LTO_Thin; }
+extern cl::opt<std::string> ltoLibrary;
+extern cl::opt<bool> wholeProgramVtables;
+extern cl::opt<bool> enableDynamicCompile;
+
+enum CoverageIncrement {
+  CoverageIncrement_atomic,
+  CoverageIncrement_nonatomic,
+  CoverageIncrement_tls
+};
+extern cl::opt<CoverageIncrement> coverageIncrement;
+
+enum CoverageFormat { CoverageFormat_lst, CoverageFormat_raw };
+extern cl::opt<CoverageFormat> coverageFormat;
 
 extern cl::opt<BOUNDSCHECK> boundsCheck;
 extern bool nonSafeBoundsChecks;
@@ -86,7 +138,9 @@ extern cl::opt<unsigned, true> nestedTemplateDepth;
 #if LDC_WITH_PGO
 extern cl::opt<std::string> genfileInstrProf;
 extern cl::opt<std::string> usefileInstrProf;
+extern cl::opt<bool> instrProfIRLevel;
 #endif
+extern cl::opt<std::string> usefileSampleProf;
 
 // Arguments to -d-debug
 extern std::vector<std::string> debugArgs;
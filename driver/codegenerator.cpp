@@ -13,10 +13,17 @@
 #include "mars.h"
 #include "module.h"
 #include "scope.h"
+#include "driver/inlinecache.h"
+#include "driver/instancecache.h"
 #include "driver/linker.h"
+#include "driver/memorystats.h"
+#include "driver/statistics.h"
+#include "driver/timetrace.h"
 #include "driver/toobj.h"
+#include "gen/llvmhelpers.h"
 #include "gen/logger.h"
 #include "gen/modules.h"
+#include "gen/optimizer.h"
 #include "gen/runtime.h"
 
 /// The module with the frontend-generated C main() definition.
@@ -25,6 +32,9 @@ extern Module *g_entrypointModule;
 /// The module that contains the actual D main() (_Dmain) definition.
 extern Module *g_dMainModule;
 
+/// Defined in driver/codegenerator.d.
+void releaseFunctionBodies(Module *m);
+
 namespace {
 
 /// Add the linker options metadata flag.
@@ -103,6 +113,12 @@ CodeGenerator::~CodeGenerator() {
     insertBitcodeFiles(ir_->module, ir_->context(),
                        *global.params.bitcodeFiles);
 
+    if (inlineCacheEnabled()) {
+      finishInlineCache(ir_->module);
+    }
+    if (instanceCacheEnabled()) {
+      finishInstanceCache(filename);
+    }
     writeAndFreeLLModule(filename);
   }
 }
@@ -111,6 +127,8 @@ void CodeGenerator::prepareLLModule(Module *m) {
   ++moduleCount_;
 
   if (singleObj_ && ir_) {
+    // Each module gets its own compile unit in the shared LLVM module.
+    ir_->DBuilder.EmitCompileUnit(m);
     return;
   }
 
@@ -119,7 +137,7 @@ void CodeGenerator::prepareLLModule(Module *m) {
   // See http://llvm.org/bugs/show_bug.cgi?id=11479 – just use the source file
   // name, as it should not collide with a symbol name used somewhere in the
   // module.
-  ir_ = new IRState(m->srcfile->toChars(), context_);
+  ir_ = new IRState(remapFilePrefix(m->srcfile->toChars()), context_);
   ir_->module.setTargetTriple(global.params.targetTriple->str());
 #if LDC_LLVM_VER >= 308
   ir_->module.setDataLayout(*gDataLayout);
@@ -127,8 +145,6 @@ void CodeGenerator::prepareLLModule(Module *m) {
   ir_->module.setDataLayout(gDataLayout->getStringRepresentation());
 #endif
 
-  // TODO: Make ldc::DIBuilder per-Module to be able to emit several CUs for
-  // single-object compilations?
   ir_->DBuilder.EmitCompileUnit(m);
 
   IrDsymbol::resetAll();
@@ -147,6 +163,12 @@ void CodeGenerator::finishLLModule(Module *m) {
   }
 
   m->deleteObjFile();
+  if (inlineCacheEnabled()) {
+    finishInlineCache(ir_->module);
+  }
+  if (instanceCacheEnabled()) {
+    finishInstanceCache(m->objfile->name->str);
+  }
   writeAndFreeLLModule(m->objfile->name->str);
 }
 
@@ -155,6 +177,9 @@ void CodeGenerator::writeAndFreeLLModule(const char *filename) {
 
   emitLinkerOptions(*ir_, ir_->module, ir_->context());
 
+  DtoSetThreadLocalModels(ir_->module);
+  DtoPoolStringLiteralSuffixes(ir_->module);
+
   // Emit ldc version as llvm.ident metadata.
   llvm::NamedMDNode *IdentMetadata =
       ir_->module.getOrInsertNamedMetadata("llvm.ident");
@@ -171,6 +196,9 @@ void CodeGenerator::writeAndFreeLLModule(const char *filename) {
   writeModule(&ir_->module, filename);
   delete ir_;
   ir_ = nullptr;
+
+  // Only now, so that the IRState isn't kept alive while waiting.
+  throttleParallelCodegen();
 }
 
 namespace {
@@ -199,6 +227,12 @@ void CodeGenerator::emit(Module *m) {
   IF_LOG Logger::println("CodeGenerator::emit(%s)", m->toPrettyChars());
   LOG_SCOPE;
 
+  TimeTraceScope timeTraceScope("Codegen module", m->toChars());
+  MemoryPhaseScope memoryPhaseScope(MemoryPhase::Codegen);
+  if (stats::isEnabled()) {
+    ++stats::counters().modules;
+  }
+
   if (global.params.verbose_cg) {
     printf("codegen: %s (%s)\n", m->toPrettyChars(), m->srcfile->toChars());
   }
@@ -240,6 +274,11 @@ void CodeGenerator::emit(Module *m) {
 
   finishLLModule(m);
 
+  // With -lowmem, the ASTs of the function bodies can be reclaimed now.
+  if (!willCrossModuleInline()) {
+    releaseFunctionBodies(m);
+  }
+
   if (m->llvmForceLogging && !loggerWasEnabled) {
     Logger::disable();
   }
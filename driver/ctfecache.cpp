@@ -0,0 +1,166 @@
+//===-- ctfecache.cpp -----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// An entry is stored as <cache dir>/ctfecache_<hash of the key>, consisting of
+//   LDC CTFE cache 1
+//   <number of dependencies>
+//   <MD5 of the file contents> <path>     (for each dependency)
+//   <result>
+// The key hash includes the compiler version and the target triple. Entries
+// are written to a temporary file which is then renamed, so that concurrent
+// compiler invocations never see partially written entries.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/ctfecache.h"
+#include "mars.h"
+#include "driver/cl_options.h"
+#include "driver/ldc-version.h"
+#include "gen/logger.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+namespace {
+
+llvm::cl::opt<bool> cacheCtfe(
+    "cache-ctfe",
+    llvm::cl::desc("Also cache the results of CTFE calls with integer or "
+                   "string arguments and results in the -cache directory "
+                   "(experimental)"),
+    llvm::cl::ZeroOrMore);
+
+const char magic[] = "LDC CTFE cache 1\n";
+
+std::string toHex(llvm::MD5 &hasher) {
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> str;
+  llvm::MD5::stringifyResult(result, str);
+  return str.str();
+}
+
+/// Returns the MD5 of the file's contents, or an empty string if it cannot be
+/// read. The hashes are computed once per compiler invocation.
+const std::string &getFileHash(llvm::StringRef path) {
+  static llvm::StringMap<std::string> fileHashes;
+  auto it = fileHashes.find(path);
+  if (it != fileHashes.end())
+    return it->second;
+
+  std::string &hash = fileHashes[path];
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (buffer) {
+    llvm::MD5 hasher;
+    hasher.update((*buffer)->getBuffer());
+    hash = toHex(hasher);
+  }
+  return hash;
+}
+
+void getEntryPath(const char *key, unsigned keyLength,
+                  llvm::SmallString<128> &path) {
+  llvm::MD5 hasher;
+  hasher.update(global.ldc_version);
+  hasher.update(global.version);
+  hasher.update(global.llvm_version);
+  hasher.update(ldc::built_with_Dcompiler_version);
+  hasher.update(global.params.targetTriple->str());
+  hasher.update(llvm::StringRef(key, keyLength));
+
+  path = opts::cacheDir;
+  llvm::sys::path::append(path, "ctfecache_" + toHex(hasher));
+}
+}
+
+bool ctfeCacheEnabled() { return cacheCtfe && !opts::cacheDir.empty(); }
+
+const char *ctfeCacheLookup(const char *key, unsigned keyLength,
+                            unsigned *resultLength) {
+  static std::string result;
+
+  llvm::SmallString<128> path;
+  getEntryPath(key, keyLength, path);
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+    return nullptr;
+
+  llvm::StringRef data = (*buffer)->getBuffer();
+  if (!data.startswith(magic))
+    return nullptr;
+  data = data.drop_front(sizeof(magic) - 1);
+
+  auto line = data.split('\n');
+  unsigned numDeps;
+  if (line.first.getAsInteger(10, numDeps))
+    return nullptr;
+  data = line.second;
+  for (unsigned i = 0; i < numDeps; ++i) {
+    line = data.split('\n');
+    data = line.second;
+    auto dep = line.first.split(' ');
+    if (dep.first.empty() || getFileHash(dep.second) != dep.first) {
+      IF_LOG Logger::println("CTFE cache entry %s is outdated (%s changed)",
+                             path.c_str(), dep.second.str().c_str());
+      return nullptr;
+    }
+  }
+
+  IF_LOG Logger::println("CTFE cache hit: %s", path.c_str());
+  result = data.str();
+  *resultLength = result.size();
+  return result.data();
+}
+
+void ctfeCacheStore(const char *key, unsigned keyLength, const char **deps,
+                    unsigned numDeps, const char *result,
+                    unsigned resultLength) {
+  std::string contents = magic;
+  contents += std::to_string(numDeps) + "\n";
+  for (unsigned i = 0; i < numDeps; ++i) {
+    const std::string &hash = getFileHash(deps[i]);
+    if (hash.empty())
+      return;
+    contents += hash + " " + deps[i] + "\n";
+  }
+  contents.append(result, resultLength);
+
+  if (llvm::sys::fs::create_directories(opts::cacheDir))
+    return;
+  llvm::SmallString<128> path;
+  getEntryPath(key, keyLength, path);
+
+  int fd;
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(llvm::Twine(path) + "-%%%%%%%%.tmp", fd,
+                                       tempFile))
+    return;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << contents;
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempFile);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tempFile, path)) {
+    llvm::sys::fs::remove(tempFile);
+    return;
+  }
+  IF_LOG Logger::println("Stored CTFE result in cache: %s", path.c_str());
+}
@@ -0,0 +1,35 @@
+//===-- driver/ctfecache.h - Persistent cache of CTFE results --*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Stores the results of CTFE calls in the -cache directory (-cache-ctfe), so
+// that identical calls in later compiler invocations are not interpreted
+// again. The keys, results and dependencies are determined by the frontend
+// (see driver/ctfecache.d); an entry is only used if none of the files it
+// depends on changed.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_CTFECACHE_H
+#define LDC_DRIVER_CTFECACHE_H
+
+/// Whether -cache-ctfe is in effect (and a -cache directory specified).
+bool ctfeCacheEnabled();
+
+/// Returns the cached result for the key, or null on a miss. The result is
+/// valid until the next lookup.
+const char *ctfeCacheLookup(const char *key, unsigned keyLength,
+                            unsigned *resultLength);
+
+/// Stores the result for the key, along with the current contents hashes of
+/// the files it depends on.
+void ctfeCacheStore(const char *key, unsigned keyLength, const char **deps,
+                    unsigned numDeps, const char *result,
+                    unsigned resultLength);
+
+#endif
@@ -0,0 +1,165 @@
+//===-- dircache.cpp ------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The listings are not invalidated: the import directories aren't expected to
+// change during a compilation. Entries whose type isn't reported by the
+// directory listing (symbolic links, some file systems) are stat()ed on
+// demand. The reader threads of driver/prefetch.cpp use the cache too, so it
+// doesn't log.
+//
+// Directories on case-insensitive file systems (Windows; macOS depending on
+// the volume) are looked up case-insensitively. Only ASCII letters are folded
+// though, so names with other characters are stat()ed: the file systems fold
+// Unicode, and macOS lists names in decomposed form.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/dircache.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#if _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+llvm::cl::opt<bool> cacheImportDirs(
+    "cache-import-dirs",
+    llvm::cl::desc("Look up modules in listings of the import directories, "
+                   "read once per compilation (default: true)"),
+    llvm::cl::ZeroOrMore, llvm::cl::init(true));
+
+enum EntryKind : unsigned char { Unknown, RegularFile, Directory };
+
+struct Listing {
+  /// The entries of the directory; empty if it doesn't exist. The names are
+  /// lowercased if ignoreCase is set.
+  llvm::StringMap<EntryKind> entries;
+  bool ignoreCase = false;
+};
+
+std::mutex mutex;
+llvm::StringMap<std::unique_ptr<Listing>> listings;
+
+int statExists(const char *path) {
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(path, status))
+    return 0;
+  return llvm::sys::fs::is_directory(status) ? 2 : 1;
+}
+
+bool isASCII(llvm::StringRef name) {
+  for (char c : name) {
+    if (static_cast<unsigned char>(c) >= 0x80)
+      return false;
+  }
+  return true;
+}
+
+/// Whether the file system containing the directory compares file names
+/// case-insensitively.
+bool isCaseInsensitive(const std::string &path) {
+#if _WIN32
+  return true;
+#elif defined(_PC_CASE_SENSITIVE)
+  // macOS; the default volumes are case-insensitive.
+  return pathconf(path.c_str(), _PC_CASE_SENSITIVE) == 0;
+#else
+  return false;
+#endif
+}
+
+std::string getKey(llvm::StringRef name, bool ignoreCase) {
+  return ignoreCase ? name.lower() : name.str();
+}
+
+void listDirectory(const std::string &path, Listing &listing) {
+  listing.ignoreCase = isCaseInsensitive(path);
+#if _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE h = FindFirstFileA((path + "\\*").c_str(), &data);
+  if (h == INVALID_HANDLE_VALUE)
+    return;
+  do {
+    EntryKind kind = RegularFile;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+      kind = Unknown;
+    else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      kind = Directory;
+    listing.entries[getKey(data.cFileName, listing.ignoreCase)] = kind;
+  } while (FindNextFileA(h, &data));
+  FindClose(h);
+#else
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  while (dirent *entry = readdir(dir)) {
+    EntryKind kind = Unknown;
+#ifdef DT_DIR
+    if (entry->d_type == DT_DIR)
+      kind = Directory;
+    else if (entry->d_type == DT_REG)
+      kind = RegularFile;
+#endif
+    listing.entries[getKey(entry->d_name, listing.ignoreCase)] = kind;
+  }
+  closedir(dir);
+#endif
+}
+}
+
+int fileExistsCached(const char *path) {
+  if (!cacheImportDirs)
+    return statExists(path);
+
+  llvm::StringRef p(path);
+#if _WIN32
+  const size_t sep = p.find_last_of("\\/:");
+#else
+  const size_t sep = p.rfind('/');
+#endif
+  llvm::StringRef name = sep == llvm::StringRef::npos ? p : p.substr(sep + 1);
+  if (name.empty() || name == "." || name == "..")
+    return statExists(path);
+  std::string dirPath = ".";
+  if (sep != llvm::StringRef::npos)
+    dirPath = sep == 0 ? p.substr(0, 1).str() : p.substr(0, sep).str();
+#if _WIN32
+  // Keep "C:" referring to the current directory of drive C.
+  if (sep != llvm::StringRef::npos && p[sep] == ':')
+    dirPath = p.substr(0, sep + 1).str() + ".";
+#endif
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &listing = listings[dirPath];
+  if (!listing) {
+    listing.reset(new Listing);
+    listDirectory(dirPath, *listing);
+  }
+  if (listing->ignoreCase && !isASCII(name))
+    return statExists(path);
+  auto it = listing->entries.find(getKey(name, listing->ignoreCase));
+  if (it == listing->entries.end())
+    return 0;
+  if (it->second == Unknown) {
+    const int result = statExists(path);
+    if (result == 0)
+      return 0;
+    it->second = result == 2 ? Directory : RegularFile;
+  }
+  return it->second == Directory ? 2 : 1;
+}
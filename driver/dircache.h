@@ -0,0 +1,24 @@
+//===-- driver/dircache.h - Cached import directory listings ----*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Looking up a module probes the .di, .d and package.d candidates along all
+// import paths. Instead of a stat() call per candidate, each directory is
+// listed once per compiler invocation and the candidates are looked up in the
+// listing.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_DIRCACHE_H
+#define LDC_DRIVER_DIRCACHE_H
+
+/// Like FileName::exists(): returns 0 if the path doesn't exist, 2 if it is a
+/// directory and 1 otherwise. Thread-safe.
+int fileExistsCached(const char *path);
+
+#endif
@@ -0,0 +1,491 @@
+//===-- inlinecache.cpp ---------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A candidate is stored as <cache dir>/inline_<key>.bc, a bitcode module
+// containing the available_externally definition of the function (before
+// optimization) and the local variables it references. Its summary, the
+// number of IR instructions, is stored as <cache dir>/inline_<key>.summary;
+// later compilations don't define candidates whose summary exceeds
+// -inline-summary-threshold at all, instead of having the inliner reject them
+// after generating and optimizing their IR. The key hashes
+//   - the compiler version, the target and the commandline options (except
+//     for the ones only selecting outputs or cache settings),
+//   - the mangled name of the function,
+//   - the contents of the source of the module defining the function and of
+//     all modules imported by it, directly or indirectly.
+// Entries are written to a temporary file which is then renamed, so that
+// concurrent compiler invocations never see partially written entries.
+//
+// The summary is stored for all candidates, the IR only for functions whose
+// IR references nothing but the cached local variables,
+// other available_externally functions and symbols declared in the module are
+// stored, so that linking the entry into another module doesn't require any
+// definitions besides the ones of the build. Functions whose attributes are
+// still to be inferred by semantic3 aren't cached, as their mangled name isn't
+// known before, and neither are functions which may contain import
+// declarations, as the modules imported by them are only known after semantic3
+// too. With debug info or -J string import paths, the cache is not used.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/inlinecache.h"
+#include "declaration.h"
+#include "dsymbol.h"
+#include "expression.h"
+#include "mars.h"
+#include "module.h"
+#include "statement.h"
+#include "template.h"
+#include "driver/cl_options.h"
+#include "driver/ldc-version.h"
+#include "gen/logger.h"
+#include "gen/recursivevisitor.h"
+#include "ir/irfunction.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#if LDC_LLVM_VER >= 309
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#endif
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern llvm::TargetMachine *gTargetMachine;
+
+namespace {
+
+llvm::cl::opt<bool> cacheInlineCandidates(
+    "cache-inline-candidates",
+    llvm::cl::desc("Store the IR of the functions defined for cross-module "
+                   "inlining in the -cache directory, and reuse it instead of "
+                   "analyzing and generating them again (experimental)"),
+    llvm::cl::ZeroOrMore);
+
+llvm::cl::opt<unsigned> summaryThreshold(
+    "inline-summary-threshold", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::init(500),
+    llvm::cl::desc("With -cache-inline-candidates, don't define the "
+                   "candidates whose unoptimized IR recorded in the cache "
+                   "has more instructions (except for pragma(inline, true) "
+                   "functions)"));
+
+/// The cache entries to be linked into the current module.
+std::vector<std::string> cachedCandidates;
+
+/// The candidates of the current module missing in the cache, with the paths
+/// of their entries (without extension).
+std::vector<std::pair<FuncDeclaration *, std::string>> missingCandidates;
+
+std::string toHex(llvm::MD5 &hasher) {
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> str;
+  llvm::MD5::stringifyResult(result, str);
+  return str.str();
+}
+
+/// Returns the MD5 of the file's contents, or an empty string if it cannot be
+/// read. The hashes are computed once per compiler invocation.
+const std::string &getFileHash(llvm::StringRef path) {
+  static llvm::StringMap<std::string> fileHashes;
+  auto it = fileHashes.find(path);
+  if (it != fileHashes.end())
+    return it->second;
+
+  std::string &hash = fileHashes[path];
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (buffer) {
+    llvm::MD5 hasher;
+    hasher.update((*buffer)->getBuffer());
+    hash = toHex(hasher);
+  }
+  return hash;
+}
+
+void collectImports(Module *m, std::set<Module *> &modules) {
+  if (!modules.insert(m).second)
+    return;
+  for (Module *imported : m->aimports) {
+    collectImports(imported, modules);
+  }
+}
+
+/// Returns the hash of the sources the semantic analysis of the functions of
+/// `m` may depend on, or an empty string if one of them cannot be read.
+const std::string &getSourcesHash(Module *m) {
+  static llvm::DenseMap<Module *, std::string> sourcesHashes;
+  auto it = sourcesHashes.find(m);
+  if (it != sourcesHashes.end())
+    return it->second;
+
+  std::set<Module *> modules;
+  collectImports(m, modules);
+  std::set<std::string> paths;
+  for (Module *imported : modules) {
+    if (!imported->srcfile)
+      return sourcesHashes[m];
+    paths.insert(imported->srcfile->toChars());
+  }
+
+  llvm::MD5 hasher;
+  for (const auto &path : paths) {
+    const std::string &hash = getFileHash(path);
+    if (hash.empty())
+      return sourcesHashes[m];
+    hasher.update(path);
+    hasher.update(hash);
+  }
+  return sourcesHashes[m] = toHex(hasher);
+}
+
+/// Finds the constructs in a function body which may import modules, before
+/// its semantic analysis: import statements, including the ones possibly hidden
+/// in string mixins, static ifs and nested declarations, in nested functions
+/// and function literals.
+struct MayImport : public StoppableVisitor {
+  using StoppableVisitor::visit;
+
+  void visit(Statement *) override {}
+  void visit(Expression *) override {}
+  void visit(Declaration *) override {}
+  void visit(Initializer *) override {}
+  void visit(Dsymbol *) override {}
+
+  void visit(ImportStatement *) override { stop = true; }
+  void visit(CompileStatement *) override { stop = true; }
+  void visit(ConditionalStatement *) override { stop = true; }
+  void visit(NewAnonClassExp *) override { stop = true; }
+
+  void visit(DeclarationExp *e) override {
+    // Variables and nested functions are walked into, but aggregates and
+    // template mixins may contain imports too.
+    Dsymbol *d = e->declaration;
+    if (!d->isVarDeclaration() && !d->isFuncDeclaration())
+      stop = true;
+  }
+
+  void visit(FuncExp *e) override {
+    FuncDeclaration *fd = e->fd;
+    if (!fd && e->td && e->td->onemember)
+      fd = e->td->onemember->isFuncDeclaration();
+    if (!fd) {
+      stop = true;
+      return;
+    }
+    if (fd->fbody) {
+      RecursiveWalker walker(this, false);
+      fd->fbody->accept(&walker);
+    }
+  }
+};
+
+bool mayImport(FuncDeclaration &fdecl) {
+  MayImport visitor;
+  RecursiveWalker walker(&visitor, false);
+  for (Statement *s : {fdecl.frequire, fdecl.fensure, fdecl.fbody}) {
+    if (s && !visitor.stop)
+      s->accept(&walker);
+  }
+  return visitor.stop;
+}
+
+/// Whether the option only selects an output or configures the cache (and
+/// thus doesn't influence the IR of the candidates).
+bool isIgnoredOption(llvm::StringRef name) {
+  static const char *const ignored[] = {"of", "od", "op", "oq", "c", "v",
+                                        "vv", "lib", "stats-file",
+                                        "inline-summary-threshold"};
+  for (const char *option : ignored) {
+    if (name == option)
+      return true;
+  }
+  return name.startswith("cache") || name.startswith("output-");
+}
+
+const std::string &getOptionsHash() {
+  static std::string optionsHash;
+  if (!optionsHash.empty())
+    return optionsHash;
+
+  llvm::MD5 hasher;
+  hasher.update(global.ldc_version);
+  hasher.update(global.version);
+  hasher.update(global.llvm_version);
+  hasher.update(ldc::built_with_Dcompiler_version);
+  hasher.update(global.params.targetTriple->str());
+  hasher.update(gTargetMachine->getTargetCPU());
+  hasher.update(gTargetMachine->getTargetFeatureString());
+  // Separate values of options (e.g. `-of out.o`) aren't distinguished from
+  // source files and are skipped, like the latter.
+  for (size_t i = 1, n = opts::allArguments.size(); i < n; ++i) {
+    llvm::StringRef arg = opts::allArguments[i];
+    if (arg == "-run" || arg == "--run")
+      break;
+    if (arg.size() < 2 || arg[0] != '-' ||
+        isIgnoredOption(arg.ltrim('-').split('=').first)) {
+      continue;
+    }
+    hasher.update(arg);
+    hasher.update(llvm::StringRef("", 1));
+  }
+  return optionsHash = toHex(hasher);
+}
+
+void getEntryPath(llvm::StringRef key, llvm::SmallString<128> &path) {
+  path = opts::cacheDir;
+  llvm::sys::path::append(path, llvm::Twine("inline_") + key);
+}
+
+/// Writes the file via a temporary one, so that concurrent compiler
+/// invocations never see it partially written.
+template <typename F> bool writeFile(const std::string &path, F write) {
+  int fd;
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", fd, tempFile))
+    return false;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    write(os);
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempFile);
+      return false;
+    }
+  }
+  if (llvm::sys::fs::rename(tempFile, path)) {
+    llvm::sys::fs::remove(tempFile);
+    return false;
+  }
+  return true;
+}
+
+/// Returns the number of instructions recorded for the candidate, or -1 if
+/// there is no summary.
+long readSummary(const std::string &path) {
+  auto buffer = llvm::MemoryBuffer::getFile(path + ".summary");
+  unsigned long long size;
+  if (!buffer || (*buffer)->getBuffer().trim().getAsInteger(10, size))
+    return -1;
+  return static_cast<long>(size);
+}
+
+#if LDC_LLVM_VER >= 309
+/// Returns whether all symbols referenced by `f` are cloned along with it
+/// (local variables), or are expected to be defined by the build anyway
+/// (declarations and other available_externally definitions).
+bool isSelfContained(const llvm::Function &f) {
+  llvm::SmallPtrSet<const llvm::Constant *, 16> visited;
+  llvm::SmallVector<const llvm::Constant *, 16> worklist;
+  for (const auto &bb : f) {
+    for (const auto &inst : bb) {
+      for (const llvm::Value *op : inst.operands()) {
+        if (auto c = llvm::dyn_cast<llvm::Constant>(op))
+          worklist.push_back(c);
+      }
+    }
+  }
+
+  while (!worklist.empty()) {
+    const llvm::Constant *c = worklist.pop_back_val();
+    if (!visited.insert(c).second)
+      continue;
+
+    if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+      if (gv == &f || gv->isDeclaration() ||
+          gv->hasAvailableExternallyLinkage()) {
+        continue;
+      }
+      auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv);
+      if (!var || !var->hasLocalLinkage()) {
+        IF_LOG Logger::println("References %s, not caching",
+                               gv->getName().str().c_str());
+        return false;
+      }
+      worklist.push_back(var->getInitializer());
+      continue;
+    }
+
+    for (const llvm::Value *op : c->operands()) {
+      worklist.push_back(llvm::cast<llvm::Constant>(op));
+    }
+  }
+  return true;
+}
+
+/// Removes the unreferenced declarations and local variables left over from
+/// cloning.
+void removeUnusedGlobals(llvm::Module &m) {
+  bool changed;
+  do {
+    changed = false;
+    for (auto it = m.global_begin(); it != m.global_end();) {
+      llvm::GlobalVariable &var = *it++;
+      var.removeDeadConstantUsers();
+      if (var.use_empty() &&
+          (var.isDeclaration() || var.hasLocalLinkage())) {
+        var.eraseFromParent();
+        changed = true;
+      }
+    }
+    for (auto it = m.begin(); it != m.end();) {
+      llvm::Function &fn = *it++;
+      fn.removeDeadConstantUsers();
+      if (fn.use_empty() && fn.isDeclaration()) {
+        fn.eraseFromParent();
+        changed = true;
+      }
+    }
+  } while (changed);
+}
+
+void storeCandidate(const llvm::Function &f, const std::string &path) {
+  if (!isSelfContained(f))
+    return;
+
+  llvm::ValueToValueMapTy vmap;
+  std::unique_ptr<llvm::Module> entry = llvm::CloneModule(
+      f.getParent(), vmap, [&f](const llvm::GlobalValue *gv) {
+        return gv == &f || (llvm::isa<llvm::GlobalVariable>(gv) &&
+                            gv->hasLocalLinkage());
+      });
+  removeUnusedGlobals(*entry);
+
+  if (writeFile(path + ".bc", [&entry](llvm::raw_ostream &os) {
+        llvm::WriteBitcodeToFile(entry.get(), os);
+      })) {
+    IF_LOG Logger::println("Stored inlining candidate %s: %s.bc",
+                           f.getName().str().c_str(), path.c_str());
+  }
+}
+
+void storeSummary(const llvm::Function &f, const std::string &path) {
+  size_t size = 0;
+  for (const auto &bb : f) {
+    size += bb.size();
+  }
+  writeFile(path + ".summary",
+            [size](llvm::raw_ostream &os) { os << size << '\n'; });
+}
+
+void linkCandidate(llvm::Module &m, const std::string &path) {
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> entry =
+      llvm::parseIRFile(path + ".bc", err, m.getContext());
+  if (!entry) {
+    // The entry may have been pruned in the meantime; the function then just
+    // isn't available for inlining.
+    IF_LOG Logger::println("Cannot read cached inlining candidate %s",
+                           path.c_str());
+    return;
+  }
+
+  // Only the definitions of the functions declared in `m` are linked in.
+  if (llvm::Linker(m).linkInModule(std::move(entry),
+                                   llvm::Linker::Flags::LinkOnlyNeeded)) {
+    IF_LOG Logger::println("Failed to link cached inlining candidate %s",
+                           path.c_str());
+  }
+}
+#endif
+}
+
+bool inlineCacheEnabled() {
+#if LDC_LLVM_VER >= 309
+  return cacheInlineCandidates && !opts::cacheDir.empty() &&
+         !global.params.symdebug &&
+         (!global.params.fileImppath || !global.params.fileImppath->dim);
+#else
+  return false;
+#endif
+}
+
+InlineCandidateStatus lookupInlineCandidate(FuncDeclaration &fdecl) {
+  // The attributes to be inferred are part of the mangled name.
+  const unsigned inferring = FUNCFLAGpurityInprocess | FUNCFLAGsafetyInprocess |
+                             FUNCFLAGnothrowInprocess | FUNCFLAGnogcInprocess |
+                             FUNCFLAGreturnInprocess;
+  if (fdecl.inferRetType || (fdecl.flags & inferring))
+    return InlineCandidateStatus::notCached;
+
+  // Local imports aren't part of the sources hash.
+  if (mayImport(fdecl)) {
+    IF_LOG Logger::println("Inlining candidate may import modules, not cached");
+    return InlineCandidateStatus::notCached;
+  }
+
+  const std::string &sourcesHash = getSourcesHash(fdecl.getModule());
+  if (sourcesHash.empty())
+    return InlineCandidateStatus::notCached;
+
+  llvm::MD5 hasher;
+  hasher.update(getOptionsHash());
+  hasher.update(sourcesHash);
+  hasher.update(mangleExact(&fdecl));
+  llvm::SmallString<128> path;
+  getEntryPath(toHex(hasher), path);
+
+  const long size = readSummary(path.str());
+  if (size > static_cast<long>(summaryThreshold.getValue()) &&
+      fdecl.inlining != PINLINEalways) {
+    IF_LOG Logger::println("Inlining candidate has %ld instructions: %s", size,
+                           path.c_str());
+    return InlineCandidateStatus::tooLarge;
+  }
+
+  if (size >= 0 && llvm::sys::fs::exists(llvm::Twine(path) + ".bc")) {
+    IF_LOG Logger::println("Inlining candidate cached: %s.bc", path.c_str());
+    cachedCandidates.push_back(path.str());
+    return InlineCandidateStatus::cached;
+  }
+
+  missingCandidates.emplace_back(&fdecl, path.str());
+  return InlineCandidateStatus::notCached;
+}
+
+void finishInlineCache(llvm::Module &m) {
+#if LDC_LLVM_VER >= 309
+  if (!missingCandidates.empty() &&
+      !llvm::sys::fs::create_directories(opts::cacheDir)) {
+    for (const auto &candidate : missingCandidates) {
+      FuncDeclaration *fdecl = candidate.first;
+      // Semantic3 may have failed, the function then is only declared.
+      if (!isIrFuncCreated(fdecl))
+        continue;
+      llvm::Function *f = getIrFunc(fdecl)->func;
+      if (f && !f->isDeclaration() && f->hasAvailableExternallyLinkage()) {
+        storeCandidate(*f, candidate.second);
+        storeSummary(*f, candidate.second);
+      }
+    }
+  }
+
+  for (const auto &path : cachedCandidates) {
+    linkCandidate(m, path);
+  }
+#endif
+
+  cachedCandidates.clear();
+  missingCandidates.clear();
+}
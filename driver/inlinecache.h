@@ -0,0 +1,51 @@
+//===-- driver/inlinecache.h - Cached inlining candidates -------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -cache-inline-candidates, the IR of the functions defined as
+// available_externally for cross-module inlining is stored in the -cache
+// directory, along with a summary of its size. Later compiler invocations link
+// it into their modules instead of running semantic3 on the imported function
+// and generating its IR again, and skip the candidates which are too large to
+// be inlined altogether.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_INLINECACHE_H
+#define LDC_DRIVER_INLINECACHE_H
+
+class FuncDeclaration;
+namespace llvm {
+class Module;
+}
+
+/// Whether -cache-inline-candidates is in effect (and a -cache directory
+/// specified).
+bool inlineCacheEnabled();
+
+enum class InlineCandidateStatus {
+  /// The IR generated for the function is stored by finishInlineCache().
+  notCached,
+  /// The function only needs to be declared; its cached definition is linked
+  /// into the module by finishInlineCache().
+  cached,
+  /// The cached summary shows that the function is too large to be inlined,
+  /// so it should only be declared.
+  tooLarge
+};
+
+/// Looks up the inlining candidate in the cache. Called before semantic3 has
+/// been run on the function.
+InlineCandidateStatus lookupInlineCandidate(FuncDeclaration &fdecl);
+
+/// Links the cached inlining candidates into the module and stores the ones
+/// generated for it. Called once the IR of the module is complete, before
+/// optimizing it.
+void finishInlineCache(llvm::Module &m);
+
+#endif
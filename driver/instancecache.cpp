@@ -0,0 +1,272 @@
+//===-- instancecache.cpp -------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// An instance is recorded as <cache dir>/instance_<key>, containing the
+// absolute path of the object file defining it on the first line, followed by
+// the paths of the object files referencing it. The key is the hash of the
+// mangled name of the instance, the target and the compiler version. The
+// first compilation needing the instance creates the entry exclusively; an
+// entry whose object file doesn't exist (anymore) is taken over.
+//
+// The keys defined and referenced by an object file are listed in
+// <cache dir>/instances_<hash of the object file path>. When the object file
+// is generated again, it is removed from the entries it doesn't reference
+// anymore. The entries of the instances it doesn't define anymore are
+// removed together with the object files still referencing them, which
+// would fail to link otherwise: the build system compiles them again, and
+// the first one still needing an instance defines it. The cache directory is
+// thus meant to be used for a single build whose object files are all linked
+// together.
+//
+// The defining object file needs to keep the instances even if it doesn't
+// use them itself anymore after optimization, so they are emitted with the
+// (default) weak_odr linkage; -linkonce-templates is rejected. The other
+// object files get available_externally definitions of the instances'
+// functions when inlining, so that they can still be inlined.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/instancecache.h"
+#include "dsymbol.h"
+#include "mars.h"
+#include "template.h"
+#include "driver/cl_options.h"
+#include "driver/ldc-version.h"
+#include "gen/logger.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<bool> cacheTemplateInstances(
+    "cache-template-instances",
+    llvm::cl::desc("Define each template instance only in the first object "
+                   "file of the build needing it, as recorded in the -cache "
+                   "directory (experimental)"),
+    llvm::cl::ZeroOrMore);
+
+/// The keys of the instances defined and referenced by each object file
+/// generated by this compiler invocation.
+llvm::StringMap<llvm::StringSet<>> definedInstances;
+llvm::StringMap<llvm::StringSet<>> referencedInstances;
+
+struct Entry {
+  std::string owner;
+  std::vector<std::string> references;
+};
+
+std::string hashToString(llvm::MD5 &hasher) {
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> str;
+  llvm::MD5::stringifyResult(result, str);
+  return str.str();
+}
+
+std::string getKey(TemplateInstance *ti) {
+  llvm::MD5 hasher;
+  hasher.update(global.ldc_version);
+  hasher.update(global.version);
+  hasher.update(ldc::built_with_Dcompiler_version);
+  hasher.update(global.params.targetTriple->str());
+  hasher.update(mangle(ti));
+  return hashToString(hasher);
+}
+
+void getEntryPath(llvm::StringRef key, llvm::SmallString<128> &path) {
+  path = opts::cacheDir;
+  llvm::sys::path::append(path, llvm::Twine("instance_") + key);
+}
+
+void getListPath(llvm::StringRef objfile, llvm::SmallString<128> &path) {
+  llvm::MD5 hasher;
+  hasher.update(objfile);
+  path = opts::cacheDir;
+  llvm::sys::path::append(path, "instances_" + hashToString(hasher));
+}
+
+/// Reads the entry, returning an empty owner if there is none.
+Entry readEntry(const llvm::SmallString<128> &path) {
+  Entry entry;
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+    return entry;
+  llvm::SmallVector<llvm::StringRef, 8> lines;
+  (*buffer)->getBuffer().split(lines, "\n", -1, false);
+  for (auto line : lines) {
+    if (entry.owner.empty())
+      entry.owner = line.str();
+    else
+      entry.references.push_back(line.str());
+  }
+  return entry;
+}
+
+std::string formatEntry(const Entry &entry) {
+  std::string data = entry.owner + '\n';
+  for (const auto &ref : entry.references)
+    data += ref + '\n';
+  return data;
+}
+
+/// Writes the file via a temporary one, so that concurrent compiler
+/// invocations never see it partially written.
+bool writeFile(const llvm::SmallString<128> &path, llvm::StringRef data) {
+  int fd;
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(llvm::Twine(path) + "-%%%%%%%%.tmp", fd,
+                                       tempFile))
+    return false;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempFile);
+      return false;
+    }
+  }
+  if (llvm::sys::fs::rename(tempFile, path)) {
+    llvm::sys::fs::remove(tempFile);
+    return false;
+  }
+  return true;
+}
+
+/// Records objfile as referencing the instance. The record is appended with a
+/// single write, so that concurrent compilations don't interleave.
+void addReference(const llvm::SmallString<128> &path,
+                  const std::string &objfile) {
+  int fd;
+  if (llvm::sys::fs::openFileForWrite(path, fd, llvm::sys::fs::F_Append))
+    return;
+  llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+  os << objfile + '\n';
+}
+
+std::string getAbsolutePath(const char *objfile) {
+  llvm::SmallString<128> path(objfile);
+  llvm::sys::fs::make_absolute(path);
+  return path.str();
+}
+}
+
+bool instanceCacheEnabled() {
+  return cacheTemplateInstances && !opts::cacheDir.empty() &&
+         global.params.obj && global.params.output_o != OUTPUTFLAGno;
+}
+
+bool isInstanceDefinedElsewhere(TemplateInstance *ti, const char *objfile) {
+  if (llvm::sys::fs::create_directories(opts::cacheDir))
+    return false;
+  const std::string key = getKey(ti);
+  const std::string owner = getAbsolutePath(objfile);
+  llvm::SmallString<128> path;
+  getEntryPath(key, path);
+
+  int fd;
+  if (!llvm::sys::fs::openFileForWrite(path, fd, llvm::sys::fs::F_Excl)) {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << owner << '\n';
+  } else {
+    Entry entry = readEntry(path);
+    if (entry.owner != owner) {
+      if (!entry.owner.empty() && llvm::sys::fs::exists(entry.owner)) {
+        IF_LOG Logger::println("Defined by %s (%s)", entry.owner.c_str(),
+                               path.c_str());
+        if (std::find(entry.references.begin(), entry.references.end(),
+                      owner) == entry.references.end()) {
+          addReference(path, owner);
+        }
+        referencedInstances[owner].insert(key);
+        return true;
+      }
+      // Take it over, keeping the references.
+      entry.owner = owner;
+      if (!writeFile(path, formatEntry(entry)))
+        return false;
+    }
+  }
+
+  IF_LOG Logger::println("Defined by this object file (%s)", path.c_str());
+  definedInstances[owner].insert(key);
+  return false;
+}
+
+void finishInstanceCache(const char *objfile) {
+  const std::string owner = getAbsolutePath(objfile);
+  llvm::SmallString<128> listPath;
+  getListPath(owner, listPath);
+  const llvm::StringSet<> &defined = definedInstances[owner];
+  const llvm::StringSet<> &referenced = referencedInstances[owner];
+
+  if (auto buffer = llvm::MemoryBuffer::getFile(listPath)) {
+    llvm::SmallVector<llvm::StringRef, 64> lines;
+    (*buffer)->getBuffer().split(lines, "\n", -1, false);
+    for (auto line : lines) {
+      // "D <key>" for defined, "R <key>" for referenced instances
+      const bool wasDefined = line.startswith("D ");
+      const llvm::StringRef key = line.substr(2);
+      if (wasDefined ? defined.count(key) : referenced.count(key))
+        continue;
+
+      llvm::SmallString<128> path;
+      getEntryPath(key, path);
+      Entry entry = readEntry(path);
+      if (wasDefined && entry.owner == owner) {
+        IF_LOG Logger::println("Not defined anymore: %s", path.c_str());
+        for (const auto &ref : entry.references) {
+          if (ref != owner && llvm::sys::fs::exists(ref)) {
+            IF_LOG Logger::println("Removing referencing object file %s",
+                                   ref.c_str());
+            llvm::sys::fs::remove(ref);
+          }
+        }
+        llvm::sys::fs::remove(path);
+      } else if (!wasDefined && entry.owner != owner) {
+        auto it = std::find(entry.references.begin(), entry.references.end(),
+                            owner);
+        if (it != entry.references.end()) {
+          IF_LOG Logger::println("Not referenced anymore: %s", path.c_str());
+          entry.references.erase(it);
+          writeFile(path, formatEntry(entry));
+        }
+      }
+    }
+  }
+
+  if (defined.empty() && referenced.empty()) {
+    llvm::sys::fs::remove(listPath);
+    return;
+  }
+  std::string list;
+  for (const auto &entry : defined) {
+    list += "D ";
+    list += entry.getKey();
+    list += '\n';
+  }
+  for (const auto &entry : referenced) {
+    list += "R ";
+    list += entry.getKey();
+    list += '\n';
+  }
+  if (!llvm::sys::fs::create_directories(opts::cacheDir))
+    writeFile(listPath, list);
+}
@@ -0,0 +1,36 @@
+//===-- driver/instancecache.h - Template instances per build ---*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -cache-template-instances, each template instance is defined in the
+// first object file of the build whose compilation needs it, as recorded in
+// the -cache directory. The object files compiled later only reference it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_INSTANCECACHE_H
+#define LDC_DRIVER_INSTANCECACHE_H
+
+class TemplateInstance;
+
+/// Whether -cache-template-instances is in effect (and a -cache directory
+/// specified).
+bool instanceCacheEnabled();
+
+/// Returns true if the instance is defined by another object file of the
+/// build, and records `objfile` as referencing it. Otherwise, records
+/// `objfile` as the object file defining it.
+bool isInstanceDefinedElsewhere(TemplateInstance *ti, const char *objfile);
+
+/// Releases the instances recorded for `objfile` by an earlier compilation
+/// which it doesn't define or reference anymore. The object files referencing
+/// a released definition are removed, to be compiled again. Called once the
+/// code of `objfile` has been generated.
+void finishInstanceCache(const char *objfile);
+
+#endif
@@ -0,0 +1,133 @@
+//===-- interfacecache.cpp ------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// An entry is stored as <cache dir>/interface_<key>.di, starting with the
+// "// LDC interface cache 1" line. The key is the hash of the source contents,
+// its path (after -ffile-prefix-map remapping), the compiler version and
+// whether the parser keeps unittests; the interface doesn't depend on other
+// flags, as it is generated before semantic analysis. The path is part of the
+// key so that the same source in different places doesn't share an entry,
+// whose locations would refer to the other file.
+// Entries are written to a temporary file which is then renamed, so that
+// concurrent compiler invocations never see partially written entries.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/interfacecache.h"
+#include "mars.h"
+#include "driver/cl_options.h"
+#include "driver/ldc-version.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+llvm::cl::opt<bool> cacheInterfaces(
+    "cache-interfaces",
+    llvm::cl::desc("Also cache the interfaces of imported modules in the "
+                   "-cache directory and parse them instead of the sources "
+                   "(experimental)"),
+    llvm::cl::ZeroOrMore);
+
+const char magic[] = "// LDC interface cache 1\n";
+
+void getEntryPath(const char *key, llvm::SmallString<128> &path) {
+  path = opts::cacheDir;
+  llvm::sys::path::append(path, llvm::Twine("interface_") + key + ".di");
+}
+}
+
+bool interfaceCacheEnabled() {
+  return cacheInterfaces && !opts::cacheDir.empty();
+}
+
+void interfaceCacheKey(const char *path, const unsigned char *source,
+                       size_t length, char *key) {
+  llvm::MD5 hasher;
+  hasher.update(global.ldc_version);
+  hasher.update(global.version);
+  hasher.update(ldc::built_with_Dcompiler_version);
+  // See the parsing of unittest blocks in ddmd/parse.d.
+  const bool parseUnitTests = global.params.useUnitTests ||
+                              global.params.doDocComments ||
+                              global.params.doHdrGeneration;
+  hasher.update(parseUnitTests ? "unittests" : "");
+  // Including the terminating zero, to separate it from the source.
+  const char *remappedPath = remapFilePrefix(path);
+  hasher.update(llvm::ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(remappedPath),
+      strlen(remappedPath) + 1));
+  hasher.update(llvm::ArrayRef<uint8_t>(source, length));
+
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> str;
+  llvm::MD5::stringifyResult(result, str);
+  memcpy(key, str.c_str(), str.size() + 1);
+}
+
+unsigned char *interfaceCacheLookup(const char *key, size_t *length) {
+  llvm::SmallString<128> path;
+  getEntryPath(key, path);
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+    return nullptr;
+
+  llvm::StringRef data = (*buffer)->getBuffer();
+  if (!data.startswith(magic))
+    return nullptr;
+
+  auto result = static_cast<unsigned char *>(malloc(data.size() + 2));
+  if (!result)
+    return nullptr;
+  memcpy(result, data.data(), data.size());
+  result[data.size()] = 0;
+  result[data.size() + 1] = 0;
+  *length = data.size();
+  IF_LOG Logger::println("Interface cache hit: %s", path.c_str());
+  return result;
+}
+
+void interfaceCacheStore(const char *key, const char *data, size_t length) {
+  if (llvm::sys::fs::create_directories(opts::cacheDir))
+    return;
+  llvm::SmallString<128> path;
+  getEntryPath(key, path);
+
+  int fd;
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(llvm::Twine(path) + "-%%%%%%%%.tmp", fd,
+                                       tempFile))
+    return;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << magic;
+    os.write(data, length);
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempFile);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tempFile, path)) {
+    llvm::sys::fs::remove(tempFile);
+    return;
+  }
+  IF_LOG Logger::println("Stored interface in cache: %s", path.c_str());
+}
@@ -0,0 +1,36 @@
+//===-- driver/interfacecache.h - Cached module interfaces ------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -cache-interfaces, the interfaces generated from the sources of
+// imported modules are stored in the -cache directory and parsed instead of
+// the sources in later compiler invocations (see driver/interfacecache.d).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_INTERFACECACHE_H
+#define LDC_DRIVER_INTERFACECACHE_H
+
+#include <cstddef>
+
+/// Whether -cache-interfaces is in effect (and a -cache directory specified).
+bool interfaceCacheEnabled();
+
+/// Computes the key of the module source read from the given path as 32 hex
+/// digits plus a terminating zero.
+void interfaceCacheKey(const char *path, const unsigned char *source,
+                       size_t length, char *key);
+
+/// Returns the cached interface for the key, or null on a miss. The buffer is
+/// malloc'ed and terminated by two zero bytes, like the ones of File::read().
+unsigned char *interfaceCacheLookup(const char *key, size_t *length);
+
+/// Stores the interface for the key.
+void interfaceCacheStore(const char *key, const char *data, size_t length);
+
+#endif
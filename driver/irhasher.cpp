@@ -0,0 +1,666 @@
+//===-- driver/irhasher.cpp -----------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The structural hash walks the module once, feeding a compact binary
+// description of every global, function, instruction, constant and metadata
+// node to an MD5 hasher. Types, constants and metadata nodes are memoized, so
+// that shared subgraphs are only described once and referenced by ordinal
+// afterwards. Local values (arguments, basic blocks, instructions) are
+// referenced by their position inside the function, so that their names do not
+// matter (unless requested, for outputs in which the names are visible).
+//
+// Debug info is included, as it ends up in the object file. Debug locations
+// are described by their line, column and operands. The other debug info
+// nodes have many more fields that aren't operands, so their textual IR form
+// is hashed instead. Metadata references in that form are slot numbers
+// assigned by a ModuleSlotTracker, which is only created for modules with
+// such nodes. There are few of these nodes compared to the debug locations.
+//
+// Only a whitelist of IR constructs is handled. Whenever something unknown is
+// encountered (funclet-based EH, operand bundles, ...), the walk is aborted
+// and the caller falls back to hashing the bitcode.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/irhasher.h"
+
+#include "gen/llvm.h"
+
+#if LDC_LLVM_VER >= 309
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+#include <memory>
+
+namespace {
+
+/// Tags written in front of memoized entities, telling apart their first
+/// occurrence from later back-references.
+enum : uint8_t {
+  TagNull,
+  TagNew,
+  TagRef,
+  TagLocal,
+  TagGlobal,
+  TagConstant,
+  TagMetadata,
+  TagInlineAsm,
+};
+
+class ModuleHasher {
+  llvm::MD5 &hasher;
+  const bool hashLocalNames;
+  const llvm::Module *module = nullptr;
+  /// Numbers the metadata for printing debug info nodes; created on demand.
+  std::unique_ptr<llvm::ModuleSlotTracker> slotTracker;
+
+  /// Small write buffer in front of the MD5 hasher; updating the hasher for
+  /// every individual integer would be needlessly slow.
+  uint8_t buffer[4096];
+  size_t bufferSize = 0;
+
+  llvm::DenseMap<llvm::Type *, unsigned> types;
+  llvm::DenseMap<const llvm::Constant *, unsigned> constants;
+  llvm::DenseMap<const llvm::Metadata *, unsigned> metadata;
+  llvm::DenseMap<const llvm::GlobalValue *, unsigned> globals;
+  llvm::DenseMap<const llvm::Value *, unsigned> locals;
+  llvm::SmallVector<llvm::StringRef, 16> mdKindNames;
+
+  void flushBuffer() {
+    hasher.update(llvm::ArrayRef<uint8_t>(buffer, bufferSize));
+    bufferSize = 0;
+  }
+
+  void raw(const void *data, size_t size) {
+    if (size > sizeof(buffer) - bufferSize) {
+      flushBuffer();
+      if (size > sizeof(buffer)) {
+        hasher.update(llvm::ArrayRef<uint8_t>(
+            static_cast<const uint8_t *>(data), size));
+        return;
+      }
+    }
+    memcpy(buffer + bufferSize, data, size);
+    bufferSize += size;
+  }
+
+  void add(uint64_t value) { raw(&value, sizeof(value)); }
+
+  void add(llvm::StringRef str) {
+    add(str.size());
+    raw(str.data(), str.size());
+  }
+
+  void add(const llvm::APInt &value) {
+    add(value.getBitWidth());
+    raw(value.getRawData(), value.getNumWords() * sizeof(uint64_t));
+  }
+
+  /// Adds a back-reference if `entity` has been seen before, otherwise assigns
+  /// it the next ordinal. Returns true if the entity still needs to be
+  /// described.
+  template <typename Map, typename Key> bool memoize(Map &map, Key entity) {
+    auto it = map.find(entity);
+    if (it != map.end()) {
+      add(TagRef);
+      add(it->second);
+      return false;
+    }
+    const unsigned ordinal = map.size();
+    map[entity] = ordinal;
+    add(TagNew);
+    return true;
+  }
+
+  void addType(llvm::Type *type);
+  void addAttributes(llvm::AttributeSet attrs);
+  bool addValue(const llvm::Value *value);
+  bool addConstant(const llvm::Constant *c);
+  bool addMetadata(const llvm::Metadata *md);
+  bool addAttachments(
+      const llvm::SmallVectorImpl<std::pair<unsigned, llvm::MDNode *>> &mds);
+  void addGlobalValueProperties(const llvm::GlobalValue &gv);
+  bool addGlobalObjectProperties(const llvm::GlobalObject &go);
+  bool addInstruction(const llvm::Instruction &inst);
+  bool addFunction(const llvm::Function &f);
+
+public:
+  ModuleHasher(llvm::MD5 &hasher, bool hashLocalNames)
+      : hasher(hasher), hashLocalNames(hashLocalNames) {}
+
+  bool run(const llvm::Module &m);
+};
+
+void ModuleHasher::addType(llvm::Type *type) {
+  if (!memoize(types, type))
+    return;
+
+  add(type->getTypeID());
+  switch (type->getTypeID()) {
+  case llvm::Type::IntegerTyID:
+    add(llvm::cast<llvm::IntegerType>(type)->getBitWidth());
+    break;
+  case llvm::Type::PointerTyID:
+    add(type->getPointerAddressSpace());
+    addType(type->getPointerElementType());
+    break;
+  case llvm::Type::ArrayTyID:
+    add(type->getArrayNumElements());
+    addType(type->getArrayElementType());
+    break;
+  case llvm::Type::VectorTyID:
+    add(type->getVectorNumElements());
+    addType(type->getVectorElementType());
+    break;
+  case llvm::Type::FunctionTyID: {
+    auto ft = llvm::cast<llvm::FunctionType>(type);
+    add(ft->isVarArg());
+    addType(ft->getReturnType());
+    add(ft->getNumParams());
+    for (auto param : ft->params())
+      addType(param);
+    break;
+  }
+  case llvm::Type::StructTyID: {
+    auto st = llvm::cast<llvm::StructType>(type);
+    add(st->isLiteral());
+    if (!st->isLiteral())
+      add(st->getName());
+    add(st->isOpaque());
+    if (st->isOpaque())
+      break;
+    add(st->isPacked());
+    add(st->getNumElements());
+    for (auto element : st->elements())
+      addType(element);
+    break;
+  }
+  default:
+    // Primitive types are fully described by their ID.
+    break;
+  }
+}
+
+void ModuleHasher::addAttributes(llvm::AttributeSet attrs) {
+  add(attrs.getNumSlots());
+  for (unsigned i = 0, e = attrs.getNumSlots(); i != e; ++i) {
+    const unsigned index = attrs.getSlotIndex(i);
+    add(index);
+    add(attrs.getAsString(index));
+  }
+}
+
+bool ModuleHasher::addValue(const llvm::Value *value) {
+  if (!value) {
+    add(TagNull);
+    return true;
+  }
+
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(value)) {
+    add(TagGlobal);
+    auto it = globals.find(gv);
+    if (it == globals.end())
+      return false;
+    add(it->second);
+    return true;
+  }
+
+  if (auto c = llvm::dyn_cast<llvm::Constant>(value)) {
+    add(TagConstant);
+    return addConstant(c);
+  }
+
+  if (auto mav = llvm::dyn_cast<llvm::MetadataAsValue>(value)) {
+    add(TagMetadata);
+    return addMetadata(mav->getMetadata());
+  }
+
+  if (auto ia = llvm::dyn_cast<llvm::InlineAsm>(value)) {
+    add(TagInlineAsm);
+    addType(ia->getType());
+    add(ia->getAsmString());
+    add(ia->getConstraintString());
+    add(ia->hasSideEffects());
+    add(ia->isAlignStack());
+    add(ia->getDialect());
+    return true;
+  }
+
+  // Arguments, basic blocks and instructions have been numbered in advance.
+  auto it = locals.find(value);
+  if (it == locals.end())
+    return false;
+  add(TagLocal);
+  add(it->second);
+  return true;
+}
+
+bool ModuleHasher::addConstant(const llvm::Constant *c) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(c))
+    return addValue(gv);
+
+  if (!memoize(constants, c))
+    return true;
+
+  add(c->getValueID());
+  addType(c->getType());
+
+  if (auto ci = llvm::dyn_cast<llvm::ConstantInt>(c)) {
+    add(ci->getValue());
+    return true;
+  }
+  if (auto cfp = llvm::dyn_cast<llvm::ConstantFP>(c)) {
+    add(cfp->getValueAPF().bitcastToAPInt());
+    return true;
+  }
+  if (auto cds = llvm::dyn_cast<llvm::ConstantDataSequential>(c)) {
+    add(cds->getRawDataValues());
+    return true;
+  }
+  if (llvm::isa<llvm::ConstantPointerNull>(c) ||
+      llvm::isa<llvm::ConstantAggregateZero>(c) ||
+      llvm::isa<llvm::UndefValue>(c) || llvm::isa<llvm::ConstantTokenNone>(c)) {
+    return true;
+  }
+
+  if (auto ce = llvm::dyn_cast<llvm::ConstantExpr>(c)) {
+    add(ce->getOpcode());
+    add(ce->getRawSubclassOptionalData());
+    if (ce->isCompare())
+      add(ce->getPredicate());
+    if (ce->hasIndices()) {
+      auto indices = ce->getIndices();
+      add(indices.size());
+      for (auto idx : indices)
+        add(idx);
+    }
+    if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(ce))
+      addType(gep->getSourceElementType());
+  } else if (!llvm::isa<llvm::ConstantAggregate>(c)) {
+    // Block addresses and anything added to LLVM in the future.
+    return false;
+  }
+
+  add(c->getNumOperands());
+  for (const auto &op : c->operands()) {
+    if (!addValue(op.get()))
+      return false;
+  }
+  return true;
+}
+
+bool ModuleHasher::addMetadata(const llvm::Metadata *md) {
+  if (!md) {
+    add(TagNull);
+    return true;
+  }
+
+  if (!memoize(metadata, md))
+    return true;
+
+  add(md->getMetadataID());
+
+  if (auto str = llvm::dyn_cast<llvm::MDString>(md)) {
+    add(str->getString());
+    return true;
+  }
+  if (auto cam = llvm::dyn_cast<llvm::ConstantAsMetadata>(md)) {
+    return addValue(cam->getValue());
+  }
+  if (auto lam = llvm::dyn_cast<llvm::LocalAsMetadata>(md)) {
+    return addValue(lam->getValue());
+  }
+  if (auto tuple = llvm::dyn_cast<llvm::MDTuple>(md)) {
+    add(tuple->isDistinct());
+    add(tuple->getNumOperands());
+    for (const auto &op : tuple->operands()) {
+      if (!addMetadata(op.get()))
+        return false;
+    }
+    return true;
+  }
+
+  // Specialized nodes, i.e., debug info.
+  auto node = llvm::dyn_cast<llvm::MDNode>(md);
+  if (!node)
+    return false;
+  add(node->isDistinct());
+  if (auto loc = llvm::dyn_cast<llvm::DILocation>(node)) {
+    add(loc->getLine());
+    add(loc->getColumn());
+  } else {
+    if (!slotTracker)
+      slotTracker.reset(new llvm::ModuleSlotTracker(module));
+    std::string str;
+    llvm::raw_string_ostream os(str);
+    node->print(os, *slotTracker, module);
+    add(os.str());
+  }
+  add(node->getNumOperands());
+  for (const auto &op : node->operands()) {
+    if (!addMetadata(op.get()))
+      return false;
+  }
+  return true;
+}
+
+bool ModuleHasher::addAttachments(
+    const llvm::SmallVectorImpl<std::pair<unsigned, llvm::MDNode *>> &mds) {
+  add(mds.size());
+  for (const auto &md : mds) {
+    if (md.first >= mdKindNames.size())
+      return false;
+    add(mdKindNames[md.first]);
+    if (!addMetadata(md.second))
+      return false;
+  }
+  return true;
+}
+
+void ModuleHasher::addGlobalValueProperties(const llvm::GlobalValue &gv) {
+  add(gv.getValueID());
+  add(gv.getName());
+  addType(gv.getType());
+  addType(gv.getValueType());
+  add(gv.getLinkage());
+  add(gv.getVisibility());
+  add(gv.getDLLStorageClass());
+  add(gv.getThreadLocalMode());
+  add(static_cast<unsigned>(gv.getUnnamedAddr()));
+}
+
+bool ModuleHasher::addGlobalObjectProperties(const llvm::GlobalObject &go) {
+  add(go.getAlignment());
+  add(go.getSection());
+  auto comdat = go.getComdat();
+  add(comdat != nullptr);
+  if (comdat) {
+    add(comdat->getName());
+    add(comdat->getSelectionKind());
+  }
+
+  llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 4> mds;
+  go.getAllMetadata(mds);
+  return addAttachments(mds);
+}
+
+bool ModuleHasher::addInstruction(const llvm::Instruction &inst) {
+  using namespace llvm;
+
+  switch (inst.getOpcode()) {
+  // Instructions fully described by opcode, type, flags and operands.
+  case Instruction::Ret:
+  case Instruction::Br:
+  case Instruction::Switch:
+  case Instruction::IndirectBr:
+  case Instruction::Resume:
+  case Instruction::Unreachable:
+  case Instruction::Select:
+  case Instruction::VAArg:
+  case Instruction::ExtractElement:
+  case Instruction::InsertElement:
+  case Instruction::ShuffleVector:
+    break;
+
+  case Instruction::Alloca: {
+    auto ai = cast<AllocaInst>(&inst);
+    addType(ai->getAllocatedType());
+    add(ai->getAlignment());
+    add(ai->isUsedWithInAlloca());
+    add(ai->isSwiftError());
+    break;
+  }
+  case Instruction::Load: {
+    auto li = cast<LoadInst>(&inst);
+    add(li->isVolatile());
+    add(li->getAlignment());
+    add(static_cast<unsigned>(li->getOrdering()));
+    add(li->getSynchScope());
+    break;
+  }
+  case Instruction::Store: {
+    auto si = cast<StoreInst>(&inst);
+    add(si->isVolatile());
+    add(si->getAlignment());
+    add(static_cast<unsigned>(si->getOrdering()));
+    add(si->getSynchScope());
+    break;
+  }
+  case Instruction::GetElementPtr:
+    addType(cast<GetElementPtrInst>(&inst)->getSourceElementType());
+    break;
+  case Instruction::ICmp:
+  case Instruction::FCmp:
+    add(cast<CmpInst>(&inst)->getPredicate());
+    break;
+  case Instruction::PHI: {
+    auto phi = cast<PHINode>(&inst);
+    for (auto bb : phi->blocks()) {
+      if (!addValue(bb))
+        return false;
+    }
+    break;
+  }
+  case Instruction::Call: {
+    auto ci = cast<CallInst>(&inst);
+    if (ci->hasOperandBundles())
+      return false;
+    add(ci->getCallingConv());
+    add(ci->getTailCallKind());
+    addType(ci->getFunctionType());
+    addAttributes(ci->getAttributes());
+    break;
+  }
+  case Instruction::Invoke: {
+    auto ii = cast<InvokeInst>(&inst);
+    if (ii->hasOperandBundles())
+      return false;
+    add(ii->getCallingConv());
+    addType(ii->getFunctionType());
+    addAttributes(ii->getAttributes());
+    break;
+  }
+  case Instruction::ExtractValue:
+    for (auto idx : cast<ExtractValueInst>(&inst)->indices())
+      add(idx);
+    break;
+  case Instruction::InsertValue:
+    for (auto idx : cast<InsertValueInst>(&inst)->indices())
+      add(idx);
+    break;
+  case Instruction::Fence: {
+    auto fi = cast<FenceInst>(&inst);
+    add(static_cast<unsigned>(fi->getOrdering()));
+    add(fi->getSynchScope());
+    break;
+  }
+  case Instruction::AtomicCmpXchg: {
+    auto cxi = cast<AtomicCmpXchgInst>(&inst);
+    add(cxi->isVolatile());
+    add(cxi->isWeak());
+    add(static_cast<unsigned>(cxi->getSuccessOrdering()));
+    add(static_cast<unsigned>(cxi->getFailureOrdering()));
+    add(cxi->getSynchScope());
+    break;
+  }
+  case Instruction::AtomicRMW: {
+    auto rmwi = cast<AtomicRMWInst>(&inst);
+    add(rmwi->getOperation());
+    add(rmwi->isVolatile());
+    add(static_cast<unsigned>(rmwi->getOrdering()));
+    add(rmwi->getSynchScope());
+    break;
+  }
+  case Instruction::LandingPad:
+    add(cast<LandingPadInst>(&inst)->isCleanup());
+    break;
+
+  default:
+    if (inst.isBinaryOp() || inst.isCast())
+      break;
+    // Funclet-based EH pads and anything new.
+    return false;
+  }
+
+  if (!addMetadata(inst.getDebugLoc().getAsMDNode()))
+    return false;
+
+  add(inst.getOpcode());
+  addType(inst.getType());
+  add(inst.getRawSubclassOptionalData());
+  add(inst.getNumOperands());
+  for (const auto &op : inst.operands()) {
+    if (!addValue(op.get()))
+      return false;
+  }
+
+  SmallVector<std::pair<unsigned, MDNode *>, 4> mds;
+  inst.getAllMetadataOtherThanDebugLoc(mds);
+  return addAttachments(mds);
+}
+
+bool ModuleHasher::addFunction(const llvm::Function &f) {
+  addGlobalValueProperties(f);
+  if (!addGlobalObjectProperties(f))
+    return false;
+
+  add(f.getCallingConv());
+  addAttributes(f.getAttributes());
+  add(f.hasGC());
+  if (f.hasGC())
+    add(f.getGC());
+  add(f.hasPersonalityFn());
+  if (f.hasPersonalityFn() && !addValue(f.getPersonalityFn()))
+    return false;
+  add(f.hasPrefixData());
+  if (f.hasPrefixData() && !addValue(f.getPrefixData()))
+    return false;
+  add(f.hasPrologueData());
+  if (f.hasPrologueData() && !addValue(f.getPrologueData()))
+    return false;
+
+  add(f.isDeclaration());
+  if (f.isDeclaration())
+    return true;
+
+  // Number all local values up front, as instructions may refer to values
+  // defined further down (in PHIs) or to basic blocks not visited yet.
+  locals.clear();
+  unsigned numLocals = 0;
+  for (const auto &arg : f.args()) {
+    locals[&arg] = numLocals++;
+    if (hashLocalNames)
+      add(arg.getName());
+  }
+  for (const auto &bb : f) {
+    locals[&bb] = numLocals++;
+    if (hashLocalNames)
+      add(bb.getName());
+    for (const auto &inst : bb) {
+      locals[&inst] = numLocals++;
+      if (hashLocalNames)
+        add(inst.getName());
+    }
+  }
+
+  add(f.size());
+  for (const auto &bb : f) {
+    add(bb.size());
+    for (const auto &inst : bb) {
+      if (!addInstruction(inst))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool ModuleHasher::run(const llvm::Module &m) {
+  module = &m;
+  if (!m.ifunc_empty())
+    return false;
+
+  m.getMDKindNames(mdKindNames);
+
+  add(m.getModuleIdentifier());
+  add(m.getSourceFileName());
+  add(m.getTargetTriple());
+  add(m.getDataLayoutStr());
+  add(m.getModuleInlineAsm());
+
+  // Globals may be referenced before being defined, so number them in advance.
+  unsigned numGlobals = 0;
+  for (const auto &gv : m.global_values())
+    globals[&gv] = numGlobals++;
+
+  add(m.global_size());
+  for (const auto &gv : m.globals()) {
+    addGlobalValueProperties(gv);
+    if (!addGlobalObjectProperties(gv))
+      return false;
+    add(gv.isConstant());
+    add(gv.isExternallyInitialized());
+    add(gv.hasInitializer());
+    if (gv.hasInitializer() && !addConstant(gv.getInitializer()))
+      return false;
+  }
+
+  add(m.size());
+  for (const auto &f : m) {
+    if (!addFunction(f))
+      return false;
+  }
+
+  add(m.alias_size());
+  for (const auto &ga : m.aliases()) {
+    addGlobalValueProperties(ga);
+    if (!addConstant(ga.getAliasee()))
+      return false;
+  }
+
+  for (const auto &nmd : m.named_metadata()) {
+    add(nmd.getName());
+    add(nmd.getNumOperands());
+    for (const auto node : nmd.operands()) {
+      if (!addMetadata(node))
+        return false;
+    }
+  }
+
+  flushBuffer();
+  return true;
+}
+
+} // anonymous namespace
+
+namespace cache {
+bool hashModuleStructure(const llvm::Module &m, bool hashLocalNames,
+                         llvm::MD5 &hasher) {
+  return ModuleHasher(hasher, hashLocalNames).run(m);
+}
+}
+
+#else // LDC_LLVM_VER < 309
+
+namespace cache {
+bool hashModuleStructure(const llvm::Module &, bool, llvm::MD5 &) {
+  return false;
+}
+}
+
+#endif
@@ -0,0 +1,38 @@
+//===-- driver/irhasher.h - Structural LLVM IR hashing ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Computes a hash of an LLVM module by directly walking its globals,
+// functions, constants and metadata, which is considerably cheaper than
+// hashing its serialized bitcode.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_IRHASHER_H
+#define LDC_DRIVER_IRHASHER_H
+
+namespace llvm {
+class Module;
+class MD5;
+}
+
+namespace cache {
+
+/// Feeds a structural representation of the given module to the hasher.
+///
+/// Everything that may influence the generated object code is included.
+/// The names of local values don't, and are only included if hashLocalNames
+/// is set (as they do show up in LLVM bitcode/IR output). Returns false if
+/// the module contains IR constructs not handled by the structural walk
+/// (e.g., funclet-based EH), in which case the hasher state is undefined and
+/// the caller needs to fall back to hashing the module bitcode.
+bool hashModuleStructure(const llvm::Module &m, bool hashLocalNames,
+                         llvm::MD5 &hasher);
+}
+
+#endif
@@ -0,0 +1,334 @@
+//===-- jit.cpp -----------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The JIT-compiled code is not part of any loaded image, so druntime can
+// neither register its ModuleInfos (_d_dso_registry requires the module
+// references to reside in a loaded ELF/Mach-O image) nor scan its data and TLS
+// segments. Hence only programs without module constructors/unittests and
+// without thread-local variables are executed in-process; the JIT'd mutable
+// globals are registered as GC root ranges. Everything else falls back to the
+// regular linking path.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/jit.h"
+#include "mars.h"
+#include "driver/cl_options.h"
+#include "gen/irstate.h"
+#include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "llvm/Support/CommandLine.h"
+#if LDC_LLVM_VER >= 309
+#include "llvm/ADT/Triple.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/OrcMCJITReplacement.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <memory>
+#include <string>
+#include <vector>
+#endif
+
+#if LDC_LLVM_VER >= 309
+static llvm::cl::opt<bool>
+    useJIT("jit",
+           llvm::cl::desc("With -run, execute the program in-process using "
+                          "the JIT instead of linking an executable, if "
+                          "possible (requires shared default libraries)"),
+           llvm::cl::ZeroOrMore);
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+#endif
+
+namespace jit {
+
+#if LDC_LLVM_VER >= 309
+
+namespace {
+
+// These must match the values in druntime/src/object_.d (see
+// gen/moduleinfo.cpp); modules with any of them need to be registered with
+// druntime.
+const unsigned MItlsctor = 0x8;
+const unsigned MItlsdtor = 0x10;
+const unsigned MIctor = 0x20;
+const unsigned MIdtor = 0x40;
+const unsigned MIictor = 0x100;
+const unsigned MIunitTest = 0x200;
+
+std::unique_ptr<llvm::Module> jitModule;
+std::vector<std::string> sharedLibraries;
+
+bool fallBack(const char *reason) {
+  Logger::println("Not executing the program in-process: %s", reason);
+  if (global.params.verbose) {
+    fprintf(global.stdmsg, "jit       not used: %s\n", reason);
+  }
+  return false;
+}
+
+bool needsModuleRegistration(const llvm::Module &m) {
+  for (const auto &gv : m.globals()) {
+    if (gv.isDeclaration() || !gv.getName().endswith("12__ModuleInfoZ"))
+      continue;
+    const auto init = llvm::dyn_cast<llvm::ConstantStruct>(gv.getInitializer());
+    if (!init || init->getNumOperands() == 0)
+      return true;
+    const auto flags = llvm::dyn_cast<llvm::ConstantInt>(init->getOperand(0));
+    if (!flags || (flags->getZExtValue() & (MItlsctor | MItlsdtor | MIctor |
+                                            MIdtor | MIictor | MIunitTest)))
+      return true;
+  }
+  return false;
+}
+
+bool usesThreadLocals(const llvm::Module &m) {
+  for (const auto &gv : m.globals()) {
+    if (gv.isThreadLocal())
+      return true;
+  }
+  return false;
+}
+
+/// Resolves the -l libraries to shared libraries in the -L directories.
+/// Returns false if only a static version of a library is found.
+bool resolveSharedLibraries(std::string &missing) {
+  const bool isDarwin = global.params.targetTriple->isOSDarwin();
+  const char *const sharedExt = isDarwin ? ".dylib" : ".so";
+
+  std::vector<std::string> searchDirs;
+  std::vector<std::string> names;
+  for (const char *sw : *global.params.linkswitches) {
+    llvm::StringRef s = sw;
+    if (s.startswith("-L") && s.size() > 2)
+      searchDirs.push_back(s.substr(2));
+    else if (s.startswith("-l") && s.size() > 2)
+      names.push_back(s.substr(2));
+  }
+
+  for (const auto &name : names) {
+    std::string found;
+    bool staticOnly = false;
+    for (const auto &dir : searchDirs) {
+      llvm::SmallString<128> path(dir);
+      llvm::sys::path::append(path, "lib" + name + sharedExt);
+      if (llvm::sys::fs::exists(path)) {
+        found = path.str();
+        break;
+      }
+      path = dir;
+      llvm::sys::path::append(path, "lib" + name + ".a");
+      if (llvm::sys::fs::exists(path))
+        staticOnly = true;
+    }
+    if (!found.empty()) {
+      sharedLibraries.push_back(found);
+    } else if (staticOnly) {
+      missing = name;
+      return false;
+    }
+    // Otherwise assume a system library, already loaded by the compiler
+    // process or found by the dynamic loader.
+    else {
+      sharedLibraries.push_back("lib" + name + sharedExt);
+    }
+  }
+
+  for (const char *lib : *global.params.libfiles) {
+    if (!llvm::StringRef(lib).endswith(sharedExt)) {
+      missing = lib;
+      return false;
+    }
+    sharedLibraries.push_back(lib);
+  }
+  return true;
+}
+
+/// Defines the magic linker symbols delimiting the ModuleInfo reference
+/// section (the module isn't registered with druntime, see above).
+void defineMagicLinkerSymbols(llvm::Module &m) {
+  const char *const names[] = {"__start___minfo", "__stop___minfo",
+                               "\1section$start$__DATA$.minfo",
+                               "\1section$end$__DATA$.minfo"};
+  for (const char *name : names) {
+    if (auto gv = m.getNamedGlobal(name)) {
+      if (gv->isDeclaration()) {
+        gv->setInitializer(llvm::Constant::getNullValue(gv->getValueType()));
+        gv->setLinkage(llvm::GlobalValue::InternalLinkage);
+      }
+    }
+  }
+}
+
+/// Emits the entry point for the JIT'd program, which initializes druntime,
+/// registers the mutable globals as GC ranges and then calls the C main.
+llvm::Function *emitJITEntryPoint(llvm::Module &m, llvm::Function *cMain) {
+  auto &ctx = m.getContext();
+  const auto &dl = m.getDataLayout();
+  const auto voidTy = llvm::Type::getVoidTy(ctx);
+  const auto voidPtrTy = llvm::Type::getInt8PtrTy(ctx);
+  const auto sizeTy = dl.getIntPtrType(ctx);
+
+  std::vector<llvm::GlobalVariable *> roots;
+  for (auto &gv : m.globals()) {
+    if (!gv.isDeclaration() && !gv.isConstant() &&
+        !gv.getName().startswith("llvm."))
+      roots.push_back(&gv);
+  }
+
+  const auto rtInit = m.getOrInsertFunction(
+      "rt_init", llvm::FunctionType::get(llvm::Type::getInt32Ty(ctx), false));
+  const auto rtTerm = m.getOrInsertFunction(
+      "rt_term", llvm::FunctionType::get(llvm::Type::getInt32Ty(ctx), false));
+  llvm::Type *addRangeParams[] = {voidPtrTy, sizeTy, voidPtrTy};
+  const auto gcAddRange = m.getOrInsertFunction(
+      "gc_addRange", llvm::FunctionType::get(voidTy, addRangeParams, false));
+
+  const auto fn = llvm::Function::Create(
+      cMain->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+      "ldc.jit.main", &m);
+  llvm::IRBuilder<> b(llvm::BasicBlock::Create(ctx, "", fn));
+
+  // _d_run_main() initializes druntime again, which is reference-counted.
+  b.CreateCall(rtInit, {});
+  for (auto gv : roots) {
+    const auto size = dl.getTypeAllocSize(gv->getValueType());
+    if (size == 0)
+      continue;
+    llvm::Value *args[] = {b.CreateBitCast(gv, voidPtrTy),
+                           llvm::ConstantInt::get(sizeTy, size),
+                           llvm::ConstantPointerNull::get(voidPtrTy)};
+    b.CreateCall(gcAddRange, args);
+  }
+
+  std::vector<llvm::Value *> mainArgs;
+  for (auto &arg : fn->args())
+    mainArgs.push_back(&arg);
+  const auto status = b.CreateCall(cMain, mainArgs);
+  b.CreateCall(rtTerm, {});
+  b.CreateRet(status);
+  return fn;
+}
+}
+
+bool isRequested() { return useJIT && global.params.run; }
+
+bool takeModule(llvm::Module &m) {
+  assert(!jitModule && "the JIT requires -singleobj");
+
+  const llvm::Triple processTriple(llvm::sys::getProcessTriple());
+  const llvm::Triple &target = *global.params.targetTriple;
+  if (target.getArch() != processTriple.getArch() ||
+      target.getOS() != processTriple.getOS())
+    return fallBack("not compiling for the host");
+  if (target.isOSWindows())
+    return fallBack("not supported on Windows");
+  if (global.params.objfiles->dim > 1)
+    return fallBack("additional object files");
+  if (global.params.genInstrProf || global.params.cov)
+    return fallBack("instrumented code");
+  if (!m.getFunction("main"))
+    return fallBack("no main function");
+  if (needsModuleRegistration(m))
+    return fallBack("module constructors/destructors or unittests");
+  if (usesThreadLocals(m))
+    return fallBack("thread-local variables");
+
+  std::string missing;
+  if (!resolveSharedLibraries(missing)) {
+    sharedLibraries.clear();
+    const std::string reason = "no shared library for '" + missing + "'";
+    return fallBack(reason.c_str());
+  }
+
+  // `m` is owned by (and freed with) the IRState, so the JIT gets a copy,
+  // which is handed over to the execution engine by runProgram().
+  jitModule = llvm::CloneModule(&m);
+  ldc_optimize_module(jitModule.get(), *gTargetMachine);
+  defineMagicLinkerSymbols(*jitModule);
+
+  IF_LOG Logger::println("Executing the program in-process");
+  return true;
+}
+
+bool hasModule() { return jitModule != nullptr; }
+
+int runProgram() {
+  assert(jitModule);
+
+  for (const auto &lib : sharedLibraries) {
+    std::string errorMsg;
+    if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(lib.c_str(),
+                                                          &errorMsg)) {
+      // Libraries not specified via a path may already be part of the process.
+      if (llvm::sys::path::has_parent_path(lib)) {
+        error(Loc(), "cannot load shared library '%s': %s", lib.c_str(),
+              errorMsg.c_str());
+        return 1;
+      }
+    }
+  }
+
+  llvm::Function *const entryPoint =
+      emitJITEntryPoint(*jitModule, jitModule->getFunction("main"));
+
+  std::string errorMsg;
+  std::vector<std::string> attrs(opts::mAttrs.begin(), opts::mAttrs.end());
+  llvm::EngineBuilder builder(std::move(jitModule));
+  builder.setEngineKind(llvm::EngineKind::JIT)
+      .setErrorStr(&errorMsg)
+      .setUseOrcMCJITReplacement(true)
+      .setMCJITMemoryManager(llvm::make_unique<llvm::SectionMemoryManager>())
+      .setOptLevel(codeGenOptLevel())
+      .setRelocationModel(llvm::Reloc::PIC_)
+      .setMCPU(opts::mCPU)
+      .setMAttrs(attrs);
+  std::unique_ptr<llvm::ExecutionEngine> engine(builder.create());
+  if (!engine) {
+    error(Loc(), "cannot create the JIT: %s", errorMsg.c_str());
+    return 1;
+  }
+  engine->finalizeObject();
+
+  std::vector<std::string> args;
+  args.push_back(global.params.exefile ? global.params.exefile
+                                       : (*global.params.objfiles)[0]);
+  args.insert(args.end(), opts::runargs.begin(), opts::runargs.end());
+
+  if (global.params.verbose) {
+    fprintf(global.stdmsg, "jit       %s\n", args[0].c_str());
+    fflush(global.stdmsg);
+  }
+
+#ifdef _WIN32
+  return engine->runFunctionAsMain(entryPoint, args, _environ);
+#else
+  return engine->runFunctionAsMain(entryPoint, args, environ);
+#endif
+}
+
+#else // LDC_LLVM_VER < 309
+
+bool isRequested() { return false; }
+bool takeModule(llvm::Module &) { return false; }
+bool hasModule() { return false; }
+int runProgram() { return 1; }
+
+#endif
+}
@@ -0,0 +1,43 @@
+//===-- driver/jit.h - In-process execution for -run ------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Executes the program compiled for -run in-process using LLVM's ORC-based
+// JIT, skipping the object file emission, linking and program startup from
+// disk.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_JIT_H
+#define LDC_DRIVER_JIT_H
+
+namespace llvm {
+class Module;
+}
+
+namespace jit {
+
+/// Returns whether -jit has been specified (together with -run).
+bool isRequested();
+
+/// Takes over the given (final, unoptimized) module for in-process execution.
+///
+/// Returns false if the program cannot be executed by the JIT (e.g., because
+/// it uses thread-local variables or module constructors, or only static
+/// versions of the libraries are available), in which case the regular object
+/// file emission and linking is to be done.
+bool takeModule(llvm::Module &m);
+
+/// Returns whether a module has been taken over by takeModule().
+bool hasModule();
+
+/// Executes the program in-process and returns its exit status.
+int runProgram();
+}
+
+#endif
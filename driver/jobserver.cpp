@@ -0,0 +1,135 @@
+//===-- jobserver.cpp -----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/jobserver.h"
+
+#include "driver/cl_options.h"
+#include "gen/logger.h"
+#include "llvm/ADT/StringRef.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace jobserver {
+
+#ifndef _WIN32
+namespace {
+
+int readFd = -1;
+int writeFd = -1;
+std::vector<char> tokens;
+
+/// Looks for the jobserver in the MAKEFLAGS environment variable. Returns
+/// false if the compiler is run by a parallel make, but without access to the
+/// jobserver (a recipe not marked with '+'), in which case it must not run
+/// extra jobs at all.
+bool connectToJobserver(bool &found) {
+  found = false;
+  const char *makeflags = getenv("MAKEFLAGS");
+  if (!makeflags) {
+    return true;
+  }
+
+  // make < 4.2 uses --jobserver-fds, later versions --jobserver-auth.
+  llvm::StringRef flags = makeflags;
+  llvm::StringRef value;
+  for (const char *option : {"--jobserver-fds=", "--jobserver-auth="}) {
+    size_t pos = flags.rfind(option);
+    if (pos != llvm::StringRef::npos) {
+      value = flags.substr(pos + strlen(option)).split(' ').first;
+    }
+  }
+  if (value.empty()) {
+    return true;
+  }
+  found = true;
+
+  // make >= 4.4: --jobserver-auth=fifo:PATH
+  if (value.startswith("fifo:")) {
+    readFd = writeFd = open(value.substr(5).str().c_str(), O_RDWR);
+  } else {
+    auto fds = value.split(',');
+    if (fds.first.getAsInteger(10, readFd) ||
+        fds.second.getAsInteger(10, writeFd)) {
+      readFd = writeFd = -1;
+    }
+  }
+
+  if (readFd < 0 || writeFd < 0 || fcntl(readFd, F_GETFD) == -1 ||
+      fcntl(writeFd, F_GETFD) == -1) {
+    readFd = writeFd = -1;
+    return false;
+  }
+
+  IF_LOG Logger::println("Using jobserver (fds %d, %d)", readFd, writeFd);
+  return true;
+}
+} // anonymous namespace
+
+unsigned acquire(unsigned count) {
+  if (!opts::useJobserver || count == 0) {
+    return count;
+  }
+
+  bool found;
+  if (!connectToJobserver(found)) {
+    IF_LOG Logger::println("No access to the make jobserver, no extra jobs");
+    return 0;
+  }
+  if (!found) {
+    return count;
+  }
+
+  std::atexit(release);
+
+  while (tokens.size() < count) {
+    // Only take tokens which are available right away. Another process may
+    // still grab the token between poll() and read(), in which case the read
+    // waits for the next one to be returned.
+    pollfd pfd = {readFd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLIN)) {
+      break;
+    }
+    char token;
+    if (read(readFd, &token, 1) != 1) {
+      break;
+    }
+    tokens.push_back(token);
+  }
+
+  IF_LOG Logger::println("Acquired %u of %u job tokens",
+                         static_cast<unsigned>(tokens.size()), count);
+  return static_cast<unsigned>(tokens.size());
+}
+
+void release() {
+  for (char token : tokens) {
+    while (write(writeFd, &token, 1) == -1 && errno == EINTR) {
+    }
+  }
+  tokens.clear();
+}
+
+#else // _WIN32
+
+// The Windows jobserver (a named semaphore) is not supported yet.
+unsigned acquire(unsigned count) { return count; }
+
+void release() {}
+
+#endif
+} // namespace jobserver
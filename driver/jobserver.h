@@ -0,0 +1,31 @@
+//===-- driver/jobserver.h - GNU make jobserver client ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// When invoked by a parallel GNU make, the compiler runs extra threads only
+// for job tokens obtained from make's jobserver, so that a `make -jN` build
+// doesn't run more than N jobs in total.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_JOBSERVER_H
+#define LDC_DRIVER_JOBSERVER_H
+
+namespace jobserver {
+
+/// Tries to acquire up to `count` job tokens (one per extra thread) from the
+/// jobserver passed via the MAKEFLAGS environment variable, without waiting
+/// for busy ones. Returns the number of extra threads the compiler may start,
+/// i.e., `count` if not invoked by a jobserver-enabled make.
+unsigned acquire(unsigned count);
+
+/// Returns all acquired tokens to the jobserver.
+void release();
+} // namespace jobserver
+
+#endif
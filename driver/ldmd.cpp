@@ -49,6 +49,8 @@
 #endif
 
 #include "driver/exe_path.h"
+#include "driver/ldmd.h"
+#include "driver/tool.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
@@ -66,13 +68,8 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
-#include <numeric>
 #include <vector>
 
-#ifdef HAVE_SC_ARG_MAX
-#include <unistd.h>
-#endif
-
 namespace ls = llvm::sys;
 
 // We reuse DMD's response file parsing routine for maximum compatibilty - it
@@ -80,6 +77,8 @@ namespace ls = llvm::sys;
 int response_expand(size_t *pargc, char ***pargv);
 void browse(const char *url);
 
+namespace {
+
 /**
  * Prints a formatted error message to stderr and exits the program.
  */
@@ -202,7 +201,8 @@ Usage:\n\
 #if 0
 "  -profile       profile runtime performance of generated code\n"
 #endif
-"  -property      enforce property syntax (deprecated, no effect)\n\
+"  -profile=gc    profile runtime allocations\n\
+  -property      enforce property syntax (deprecated, no effect)\n\
   -quiet         suppress unnecessary messages\n\
   -release       compile release version\n\
   -run srcfile args...   run resulting program, passing args\n\
@@ -339,6 +339,7 @@ struct Params {
   bool alwaysStackFrame = false;
   Model::Type targetModel = Model::automatic;
   bool profile = false;
+  bool profileGC = false;
   bool verbose = false;
   bool vcolumns = false;
   bool vdmd = false;
@@ -476,6 +477,8 @@ Params parseArgs(size_t originalArgc, char **originalArgv,
         result.targetModel = Model::m64;
       } else if (strcmp(p + 1, "profile") == 0) {
         result.profile = true;
+      } else if (strcmp(p + 1, "profile=gc") == 0) {
+        result.profileGC = true;
       } else if (memcmp(p + 1, "transition=", 11) == 0) {
         result.transitions.push_back(p + 1 + 11);
       } else if (strcmp(p + 1, "v") == 0) {
@@ -811,6 +814,9 @@ void buildCommandLine(std::vector<const char *> &r, const Params &p) {
   if (p.profile) {
     warning("CPU profile generation not yet supported by LDC.");
   }
+  if (p.profileGC) {
+    r.push_back("-profile-gc");
+  }
   if (p.verbose) {
     r.push_back("-v");
   }
@@ -976,23 +982,6 @@ void buildCommandLine(std::vector<const char *> &r, const Params &p) {
   r.insert(r.end(), p.runArgs.begin(), p.runArgs.end());
 }
 
-/**
- * Returns the OS-dependent length limit for the command line when invoking
- * subprocesses.
- */
-size_t maxCommandLineLen() {
-#if defined(HAVE_SC_ARG_MAX)
-  // http://www.in-ulm.de/~mascheck/various/argmax – the factor 2 is just
-  // a wild guess to account for the enviroment.
-  return sysconf(_SC_ARG_MAX) / 2;
-#elif defined(_WIN32)
-  // http://blogs.msdn.com/b/oldnewthing/archive/2003/12/10/56028.aspx
-  return 32767;
-#else
-#error "Do not know how to determine maximum command line length."
-#endif
-}
-
 /**
  * Tries to locate an executable with the given name, or an invalid path if
  * nothing was found. Search paths: 1. Directory where this binary resides.
@@ -1017,24 +1006,64 @@ std::string locateBinary(std::string exeName) {
   return "";
 }
 
-static size_t addStrlen(size_t acc, const char *str) {
-  if (!str) {
-    return acc;
+/**
+ * Returns the path of the LDC executable, or an empty string if it couldn't be
+ * found.
+ */
+std::string locateLdc() {
+  std::string ldcExeName = LDC_EXE_NAME;
+#ifdef _WIN32
+  ldcExeName += ".exe";
+#endif
+  return locateBinary(ldcExeName);
+}
+
+} // anonymous namespace
+
+bool invokedAsLdmd(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "-ldmd") == 0) {
+    return true;
+  }
+  return ls::path::stem(argv[0]).find("ldmd") != llvm::StringRef::npos;
+}
+
+std::vector<const char *> translateLdmdArgs(int argc, char **argv) {
+  // Drop the -ldmd switch, if present.
+  std::vector<char *> dmdArgs(argv, argv + argc);
+  if (argc > 1 && strcmp(argv[1], "-ldmd") == 0) {
+    dmdArgs.erase(dmdArgs.begin() + 1);
+  }
+
+  // Only needed for printing the version in the usage information.
+  std::string ldcPath = locateLdc();
+  if (ldcPath.empty()) {
+    ldcPath = exe_path::getExePath();
+  }
+
+  std::vector<const char *> args;
+  args.push_back(argv[0]);
+
+  Params p = parseArgs(dmdArgs.size(), dmdArgs.data(), ldcPath);
+  buildCommandLine(args, p);
+  if (p.vdmd) {
+    printf(" -- Translated:");
+    for (auto &arg : args) {
+      printf(" %s", arg);
+    }
+    puts("");
   }
-  return acc + strlen(str);
+
+  args.push_back(nullptr);
+  return args;
 }
 
-// In driver/main.d
+// In driver/ldmd.d
 int main(int argc, char **argv);
 
-int cppmain(int argc, char **argv) {
+int ldmdMain(int argc, char **argv) {
   exe_path::initialize(argv[0]);
 
-  std::string ldcExeName = LDC_EXE_NAME;
-#ifdef _WIN32
-  ldcExeName += ".exe";
-#endif
-  std::string ldcPath = locateBinary(ldcExeName);
+  std::string ldcPath = locateLdc();
   if (ldcPath.empty()) {
     error("Could not locate " LDC_EXE_NAME " executable.");
   }
@@ -1055,37 +1084,22 @@ int cppmain(int argc, char **argv) {
 
   args.push_back(nullptr);
 
-  // Check if we need to write out a response file.
-  size_t totalLen = std::accumulate(args.begin(), args.end(), 0, addStrlen);
-  if (totalLen > maxCommandLineLen()) {
-    int rspFd;
-    llvm::SmallString<128> rspPath;
-    if (ls::fs::createUniqueFile("ldmd-%%-%%-%%-%%.rsp", rspFd, rspPath)) {
-      error("Could not open temporary response file.");
-    }
-
-    {
-      llvm::raw_fd_ostream rspOut(rspFd, /*shouldClose=*/true);
-      for (auto arg : args) {
-        rspOut << arg << '\n';
-      }
+  // Check if we need to write out a response file (containing all args but
+  // argv[0] and the terminating NULL).
+  std::vector<std::string> rspArgs(args.begin() + 1, args.end() - 1);
+  if (ldcPath.size() + estimateCommandLineLen(rspArgs) > maxCommandLineLen()) {
+    ResponseFile rsp;
+    if (!rsp.write(rspArgs, nativeResponseFileStyle)) {
+      error("Could not write temporary response file.");
     }
 
-    std::string rspArg = "@";
-    rspArg += rspPath.str();
-
+    const std::string rspArg = rsp.getArgument();
     std::vector<const char *> newArgs;
     newArgs.push_back(argv[0]);
     newArgs.push_back(rspArg.c_str());
     newArgs.push_back(nullptr);
 
-    int rc = execute(ldcPath, &newArgs[0]);
-
-    if (ls::fs::remove(rspPath.str())) {
-      warning("Could not remove response file.");
-    }
-
-    return rc;
+    return execute(ldcPath, &newArgs[0]);
   }
   return execute(ldcPath, &args[0]);
 }
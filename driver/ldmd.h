@@ -0,0 +1,29 @@
+//===-- driver/ldmd.h - DMD-style command line translation ------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Allows LDC to handle a DMD-style command line in-process, as done by the
+// ldmd2 wrapper, without executing a second process.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_LDMD_H
+#define LDC_DRIVER_LDMD_H
+
+#include <vector>
+
+/// Returns whether LDC is invoked as ldmd2, i.e., via an executable named
+/// ldmd2 (e.g., a symlink to ldc2) or with -ldmd as first switch.
+bool invokedAsLdmd(int argc, char **argv);
+
+/// Translates the DMD-style command line (including the DFLAGS environment
+/// variable and response files) to the equivalent LDC one. The result starts
+/// with argv[0] and is null-terminated.
+std::vector<const char *> translateLdmdArgs(int argc, char **argv);
+
+#endif // LDC_DRIVER_LDMD_H
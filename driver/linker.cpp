@@ -11,26 +11,43 @@
 #include "mars.h"
 #include "module.h"
 #include "root.h"
+#include "driver/cache.h"
 #include "driver/cl_options.h"
 #include "driver/exe_path.h"
+#include "driver/jit.h"
+#include "driver/timetrace.h"
 #include "driver/tool.h"
 #include "gen/llvm.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
+#include "gen/pgo.h"
 #include "gen/programs.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Linker/Linker.h"
+#if LDC_LLVM_VER >= 309
+#include "llvm/Object/ArchiveWriter.h"
+#endif
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Program.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#if LDC_WITH_LLD
+#include "lld/Driver/Driver.h"
+#include "llvm/Support/MemoryBuffer.h"
+#endif
 #if _WIN32
 #include "llvm/Support/SystemUtils.h"
 #include "llvm/Support/ConvertUTF.h"
 #include <Windows.h>
 #endif
+#include <algorithm>
+#include <chrono>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -46,6 +63,60 @@ static llvm::cl::opt<bool> createStaticLibInObjdir(
     llvm::cl::desc("Create static library in -od directory (DMD-compliant)"),
     llvm::cl::ZeroOrMore, llvm::cl::ReallyHidden);
 
+#if LDC_LLVM_VER >= 308
+static llvm::cl::opt<bool> linkBitcodeOnlyNeeded(
+    "link-bitcode-only-needed",
+    llvm::cl::desc("Only link in the definitions from LLVM bitcode input files "
+                   "that are referenced by the compiled code (-singleobj)"),
+    llvm::cl::ZeroOrMore);
+#endif
+
+#if LDC_WITH_LLD
+static llvm::cl::opt<bool> linkInternally(
+    "link-internally",
+    llvm::cl::desc("Link in-process with the integrated LLD linker (ELF and "
+                   "MSVC targets), multi-threaded as per -parallel-codegen"),
+    llvm::cl::ZeroOrMore);
+#else
+constexpr bool linkInternally = false;
+#endif
+
+static llvm::cl::opt<bool> orderFunctionsByProfile(
+    "order-functions-by-profile",
+    llvm::cl::desc("With -fprofile-instr-use, place the functions compiled in "
+                   "the same invocation in the linked binary by decreasing "
+                   "profiled entry count (Linux, gold linker)"),
+    llvm::cl::ZeroOrMore);
+
+static llvm::cl::opt<bool> linkIncremental(
+    "link-incremental",
+    llvm::cl::desc("Link incrementally, without removing unreferenced or "
+                   "folding identical functions (MSVC targets, link.exe)"),
+    llvm::cl::ZeroOrMore);
+
+enum class PDBMode { full, fastlink, ghash };
+static llvm::cl::opt<PDBMode> pdbMode(
+    "pdb", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("How to generate the PDB with -g (MSVC targets):"),
+    llvm::cl::init(PDBMode::full),
+    clEnumValues(
+        clEnumValN(PDBMode::full, "full",
+                   "Copy all debug info into the PDB (/DEBUG)"),
+        clEnumValN(PDBMode::fastlink, "fastlink",
+                   "Reference the debug info in the object files "
+                   "(link.exe, /DEBUG:FASTLINK)"),
+        clEnumValN(PDBMode::ghash, "ghash",
+                   "Merge the CodeView types by their global hashes "
+                   "(lld-link.exe, /DEBUG:GHASH)")));
+
+#if LDC_LLVM_VER >= 309
+static llvm::cl::opt<bool> useExternalArchiver(
+    "use-external-archiver",
+    llvm::cl::desc("Create static libraries by invoking ar/lib.exe instead of "
+                   "writing them directly"),
+    llvm::cl::ZeroOrMore);
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 
 static void CreateDirectoryOnDisk(llvm::StringRef fileName) {
@@ -117,7 +188,12 @@ void insertBitcodeIntoModule(const char *bcFile, llvm::Module &M,
     fatal();
   }
 #if LDC_LLVM_VER >= 308
-  llvm::Linker(M).linkInModule(std::move(loadedModule));
+  // With LinkOnlyNeeded, only the definitions (transitively) referenced by M
+  // are materialized from the lazily loaded module and linked in.
+  const unsigned flags = linkBitcodeOnlyNeeded && global.params.oneobj
+                             ? llvm::Linker::Flags::LinkOnlyNeeded
+                             : llvm::Linker::Flags::None;
+  llvm::Linker(M).linkInModule(std::move(loadedModule), flags);
 #else
   llvm::Linker(&M).linkInModule(loadedModule.release());
 #endif
@@ -128,6 +204,14 @@ void insertBitcodeIntoModule(const char *bcFile, llvm::Module &M,
 /// Insert LLVM bitcode files into the module
 void insertBitcodeFiles(llvm::Module &M, llvm::LLVMContext &Ctx,
                         Array<const char *> &bitcodeFiles) {
+#if LDC_LLVM_VER >= 308
+  if (linkBitcodeOnlyNeeded && !global.params.oneobj && !bitcodeFiles.empty()) {
+    // The bitcode files are only linked into one of the separately emitted
+    // modules, whose references don't cover the other modules' needs.
+    warning(Loc(), "-link-bitcode-only-needed requires -singleobj, linking "
+                   "complete bitcode files");
+  }
+#endif
 #if LDC_LLVM_VER >= 306
   for (const char *fname : bitcodeFiles) {
     insertBitcodeIntoModule(fname, M, Ctx);
@@ -143,6 +227,58 @@ void insertBitcodeFiles(llvm::Module &M, llvm::LLVMContext &Ctx,
 
 //////////////////////////////////////////////////////////////////////////////
 
+/// Caches the output of a link or archive step with -cache-link, see
+/// cache::calculateLinkHash().
+class CachedLinkOutput {
+  std::string output;
+  bool executable;
+  llvm::SmallString<32> hash;
+  std::chrono::steady_clock::time_point startTime;
+
+public:
+  CachedLinkOutput(std::string output, bool executable)
+      : output(std::move(output)), executable(executable) {}
+
+  /// Recovers the output from the cache if it contains the output of the same
+  /// tool with the same arguments and inputs.
+  bool recover(const std::string &tool,
+               const std::vector<std::string> &args) {
+    if (!cache::isLinkCacheEnabled())
+      return false;
+
+    cache::calculateLinkHash(tool, args, output, hash);
+    if (cache::cacheLookup(hash, cache::linkOutputExtension).empty() ||
+        !cache::recoverObjectFile(hash, cache::linkOutputExtension, output)) {
+      startTime = std::chrono::steady_clock::now();
+      return false;
+    }
+
+#ifndef _WIN32
+    // The cached copy may have lost the executable permissions.
+    if (executable)
+      chmod(output.c_str(), 0755);
+#endif
+    Logger::println("Recovered %s from the cache", output.c_str());
+    return true;
+  }
+
+  /// Adds the output of a successful link or archive step to the cache.
+  void store() {
+    if (hash.empty())
+      return;
+    const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - startTime)
+                            .count();
+    const std::string message =
+        cache::cacheObjectFile(output, hash, cache::linkOutputExtension,
+                               static_cast<unsigned>(millis));
+    if (!message.empty()) {
+      error(Loc(), "%s", message.c_str());
+      fatal();
+    }
+  }
+};
+
 static void appendObjectFiles(std::vector<std::string> &args) {
   for (unsigned i = 0; i < global.params.objfiles->dim; i++)
     args.push_back((*global.params.objfiles)[i]);
@@ -157,6 +293,317 @@ static void appendObjectFiles(std::vector<std::string> &args) {
 
 //////////////////////////////////////////////////////////////////////////////
 
+#if LDC_LLVM_VER >= 309
+/// Returns the path to the linker's LLVM plugin for LTO, either specified via
+/// -flto-binary or searched for in LDC's lib directory and the usual system
+/// library directories.
+static std::string getLTOPluginPath(const char *pluginName) {
+  if (!opts::ltoLibrary.empty()) {
+    if (llvm::sys::fs::exists(opts::ltoLibrary))
+      return opts::ltoLibrary;
+
+    error(Loc(), "-flto-binary: file '%s' not found", opts::ltoLibrary.c_str());
+    fatal();
+  }
+
+  llvm::SmallString<128> ldcLibPath(exe_path::getBaseDir());
+  llvm::sys::path::append(ldcLibPath, "lib", pluginName);
+  const std::string searchPaths[] = {
+      ldcLibPath.str(),
+#if __LP64__
+      std::string("/usr/local/lib64/") + pluginName,
+#endif
+      std::string("/usr/local/lib/") + pluginName,
+#if __LP64__
+      std::string("/usr/lib64/") + pluginName,
+#endif
+      std::string("/usr/lib/") + pluginName,
+      std::string("/usr/lib/bfd-plugins/") + pluginName,
+  };
+  for (const auto &path : searchPaths) {
+    if (llvm::sys::fs::exists(path))
+      return path;
+  }
+
+  error(Loc(), "could not find the linker plugin %s for LTO, specify it via "
+               "-flto-binary",
+        pluginName);
+  fatal();
+  return "";
+}
+
+/// Returns the (absolute) directory for the linker's ThinLTO backend cache,
+/// which shares the -cache directory (and its pruning) with the IR-to-object
+/// cache; or an empty string if no caching is to be done.
+static std::string getThinLTOCacheDir() {
+  if (!opts::isUsingThinLTO() || opts::cacheDir.empty())
+    return "";
+
+  llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
+  llvm::sys::fs::make_absolute(cacheDir);
+  if (auto ec = llvm::sys::fs::create_directories(cacheDir)) {
+    error(Loc(), "Unable to create cache directory: %s\n%s", cacheDir.c_str(),
+          ec.message().c_str());
+    fatal();
+  }
+  return cacheDir.str();
+}
+
+/// Adds the flags making gcc/clang use the linker's LLVM plugin for LTO.
+static void addLTOLinkFlags(std::vector<std::string> &args) {
+  if (global.params.targetTriple->isOSDarwin()) {
+    // ld64 uses the libLTO.dylib next to it by default.
+    if (!opts::ltoLibrary.empty()) {
+      args.push_back("-Wl,-lto_library," + getLTOPluginPath("libLTO.dylib"));
+    }
+    const std::string cacheDir = getThinLTOCacheDir();
+    if (!cacheDir.empty()) {
+      args.push_back("-Wl,-cache_path_lto," + cacheDir);
+    }
+    return;
+  }
+
+  // The gold linker supports the LLVM plugin, including ThinLTO.
+  args.push_back("-fuse-ld=gold");
+  args.push_back("-Wl,-plugin," + getLTOPluginPath("LLVMgold.so"));
+  if (opts::isUsingThinLTO()) {
+    args.push_back("-Wl,-plugin-opt=thinlto");
+    if (opts::parallelCodegen > 0) {
+      args.push_back("-Wl,-plugin-opt=jobs=" +
+                     std::to_string(opts::parallelCodegen.getValue()));
+    }
+#if LDC_LLVM_VER >= 400
+    const std::string cacheDir = getThinLTOCacheDir();
+    if (!cacheDir.empty()) {
+      args.push_back("-Wl,-plugin-opt=cache-dir=" + cacheDir);
+    }
+#endif
+  }
+  if (!opts::mCPU.empty()) {
+    args.push_back("-Wl,-plugin-opt=mcpu=" + opts::mCPU);
+  }
+  // Use the codegen optimization level for LTO, the plugin only accepts 0-3.
+  args.push_back("-Wl,-plugin-opt=O" + std::to_string(codeGenOptLevel()));
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+
+#if LDC_WITH_LLD
+/// Splits a command line as printed by `gcc -###` (each argument enclosed in
+/// double quotes, with \" and \\ escapes) into its arguments.
+static std::vector<std::string> splitQuotedCommandLine(llvm::StringRef line) {
+  std::vector<std::string> result;
+  size_t i = 0;
+  while (true) {
+    i = line.find('"', i);
+    if (i == llvm::StringRef::npos)
+      break;
+    std::string arg;
+    for (++i; i < line.size() && line[i] != '"'; ++i) {
+      if (line[i] == '\\' && i + 1 < line.size())
+        ++i;
+      arg.push_back(line[i]);
+    }
+    result.push_back(std::move(arg));
+    ++i;
+  }
+  return result;
+}
+
+/// Adds the LLD-specific flags for threading and LTO.
+static void addLLDLinkFlags(std::vector<std::string> &ldArgs) {
+#if LDC_LLVM_VER >= 400
+  if (opts::parallelCodegen > 1) {
+    ldArgs.push_back("--threads");
+  }
+#endif
+  if (opts::isUsingLTO()) {
+    ldArgs.push_back("--lto-O" + std::to_string(codeGenOptLevel()));
+#if LDC_LLVM_VER >= 400
+    if (opts::isUsingThinLTO() && opts::parallelCodegen > 0) {
+      ldArgs.push_back("--thinlto-jobs=" +
+                       std::to_string(opts::parallelCodegen.getValue()));
+    }
+#endif
+  }
+}
+
+/// Links in-process using LLD's ELF driver.
+///
+/// The system-specific parts of the linker command line (startup files,
+/// library search paths, dynamic linker, ...) are queried from the C compiler
+/// driver via -###, which prints the linker invocation without executing it.
+static int linkWithLLDFromGcc(const std::string &gcc,
+                              const std::vector<std::string> &gccArgs) {
+  if (!global.params.targetTriple->isOSBinFormatELF()) {
+    error(Loc(), "-link-internally is only supported for ELF and MSVC targets");
+    return 1;
+  }
+
+  llvm::SmallString<128> driverOutput;
+  if (llvm::sys::fs::createTemporaryFile("ldc_link", "txt", driverOutput)) {
+    error(Loc(), "cannot create temporary file for the linker command line");
+    return 1;
+  }
+
+  std::vector<const char *> driverArgs;
+  driverArgs.push_back(gcc.c_str());
+  for (const auto &arg : gccArgs)
+    driverArgs.push_back(arg.c_str());
+  driverArgs.push_back("-###");
+  driverArgs.push_back(nullptr);
+
+  const llvm::StringRef outputRef = driverOutput;
+  const llvm::StringRef *redirects[] = {nullptr, nullptr, &outputRef};
+  std::string errstr;
+  const int status = llvm::sys::ExecuteAndWait(
+      gcc, &driverArgs[0], nullptr, redirects, 0, 0, &errstr);
+
+  auto buffer = llvm::MemoryBuffer::getFile(driverOutput);
+  llvm::sys::fs::remove(driverOutput);
+  if (status != 0 || !buffer) {
+    error(Loc(), "%s -### failed with status: %d", gcc.c_str(), status);
+    return status ? status : 1;
+  }
+
+  // The linker invocation is the last command printed by the driver.
+  std::vector<std::string> ldCommand;
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  (*buffer)->getBuffer().split(lines, '\n');
+  for (auto line : lines) {
+    if (line.startswith(" \""))
+      ldCommand = splitQuotedCommandLine(line);
+  }
+  if (ldCommand.empty()) {
+    error(Loc(), "unable to determine the linker command line from %s -###",
+          gcc.c_str());
+    return 1;
+  }
+
+  // Replace the linker (collect2/ld) and drop the GCC LTO plugin arguments.
+  std::vector<std::string> ldArgs;
+  ldArgs.push_back("ld.lld");
+  for (size_t i = 1; i < ldCommand.size(); ++i) {
+    llvm::StringRef arg = ldCommand[i];
+    if (arg == "-plugin") {
+      ++i;
+      continue;
+    }
+    if (arg.startswith("-plugin-opt=") || arg.startswith("-fresolution=") ||
+        arg.startswith("-pass-through="))
+      continue;
+    ldArgs.push_back(arg);
+  }
+  addLLDLinkFlags(ldArgs);
+
+  std::vector<const char *> realArgs;
+  for (const auto &arg : ldArgs)
+    realArgs.push_back(arg.c_str());
+
+  if (global.params.verbose) {
+    for (const auto &arg : ldArgs)
+      fprintf(global.stdmsg, "%s ", arg.c_str());
+    fprintf(global.stdmsg, "\n");
+    fflush(global.stdmsg);
+  }
+
+#if LDC_LLVM_VER >= 400
+  const bool success = lld::elf::link(realArgs, /*CanExitEarly=*/false);
+#else
+  const bool success = lld::elf::link(realArgs);
+#endif
+  if (!success) {
+    error(Loc(), "linking with LLD failed");
+    return 1;
+  }
+  return 0;
+}
+
+/// Links in-process using LLD's COFF driver, which accepts link.exe's
+/// command line.
+static int linkWithLLDCoff(const std::vector<std::string> &args) {
+  std::vector<const char *> realArgs;
+  realArgs.push_back("lld-link.exe");
+  for (const auto &arg : args)
+    realArgs.push_back(arg.c_str());
+
+  if (global.params.verbose) {
+    for (const char *arg : realArgs)
+      fprintf(global.stdmsg, "%s ", arg);
+    fprintf(global.stdmsg, "\n");
+    fflush(global.stdmsg);
+  }
+
+  if (!lld::coff::link(realArgs)) {
+    error(Loc(), "linking with LLD failed");
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+
+/// Writes a gold section ordering file listing the function sections by
+/// decreasing profiled entry count, so that the hot code ends up contiguous in
+/// .text. Returns the path of the (temporary) file; empty if there's no data.
+static std::string writeSectionOrderingFile() {
+  auto counts = getProfiledFunctionEntryCounts();
+  if (counts.empty())
+    return "";
+
+  std::stable_sort(counts.begin(), counts.end(),
+                   [](const std::pair<std::string, uint64_t> &a,
+                      const std::pair<std::string, uint64_t> &b) {
+                     return a.second > b.second;
+                   });
+
+  llvm::SmallString<128> path;
+  int fd;
+  if (llvm::sys::fs::createTemporaryFile("ldc_section_order", "txt", fd,
+                                         path)) {
+    error(Loc(), "cannot create the section ordering file");
+    return "";
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    for (const auto &entry : counts) {
+      os << entry.first << '\n';
+    }
+  }
+
+  IF_LOG Logger::println("Wrote section ordering file for %u functions: %s",
+                         static_cast<unsigned>(counts.size()), path.c_str());
+  return path.str();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/// Returns the directory containing the shared ldc-jit library: the first -L
+/// directory of the (config file) linker switches containing it, or LDC's own
+/// lib directory. Empty if it cannot be found.
+static std::string getJitLibraryDir() {
+  const char *libName = global.params.targetTriple->isOSDarwin()
+                            ? "libldc-jit.dylib"
+                            : "libldc-jit.so";
+  for (unsigned i = 0; i < global.params.linkswitches->dim; i++) {
+    llvm::StringRef str = (*global.params.linkswitches)[i];
+    if (!str.startswith("-L"))
+      continue;
+    llvm::SmallString<128> path(str.substr(2));
+    llvm::sys::path::append(path, libName);
+    if (llvm::sys::fs::exists(path))
+      return llvm::sys::path::parent_path(path).str();
+  }
+
+  llvm::SmallString<128> path(exe_path::getBaseDir());
+  llvm::sys::path::append(path, "lib", libName);
+  if (llvm::sys::fs::exists(path))
+    return llvm::sys::path::parent_path(path).str();
+  return "";
+}
+
 static std::string gExePath;
 
 static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
@@ -185,6 +632,18 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
     args.push_back("-lldc-profile-rt");
   }
 
+  // Link with jit-rt, the runtime compiling the @dynamicCompile functions, and
+  // the shared library containing its LLVM parts.
+  if (opts::enableDynamicCompile) {
+    args.push_back("-lldc-jit-rt");
+    args.push_back("-lldc-jit");
+    // Let the program find the shared library without LD_LIBRARY_PATH.
+    const std::string jitLibDir = getJitLibraryDir();
+    if (!jitLibDir.empty()) {
+      args.push_back("-Wl,-rpath," + jitLibDir);
+    }
+  }
+
   // user libs
   for (unsigned i = 0; i < global.params.libfiles->dim; i++)
     args.push_back((*global.params.libfiles)[i]);
@@ -196,6 +655,29 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
     args.push_back("-shared");
   }
 
+#if LDC_LLVM_VER >= 309
+  // LLD performs LTO itself, see addLLDLinkFlags().
+  if (opts::isUsingLTO() && !linkInternally) {
+    addLTOLinkFlags(args);
+  }
+#endif
+
+  std::string sectionOrderingFile;
+  if (orderFunctionsByProfile) {
+    if (!global.params.targetTriple->isOSLinux() || linkInternally) {
+      warning(Loc(), "-order-functions-by-profile is only supported for "
+                     "Linux targets linked with gold");
+    } else {
+      sectionOrderingFile = writeSectionOrderingFile();
+      if (!sectionOrderingFile.empty()) {
+        if (!opts::isUsingLTO()) { // LTO already uses gold
+          args.push_back("-fuse-ld=gold");
+        }
+        args.push_back("-Wl,--section-ordering-file," + sectionOrderingFile);
+      }
+    }
+  }
+
   if (fullyStatic) {
     args.push_back("-static");
   }
@@ -223,6 +705,11 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
     args.push_back("-fsanitize=thread");
   }
 
+  // Link the XRay runtime, which patches the sleds. Requires clang 5.0+.
+  if (opts::xrayInstrument) {
+    args.push_back("-fxray-instrument");
+  }
+
   // additional linker switches
   for (unsigned i = 0; i < global.params.linkswitches->dim; i++) {
     const char *p = (*global.params.linkswitches)[i];
@@ -356,8 +843,32 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
   }
   logstr << "\n"; // FIXME where's flush ?
 
-  // try to call linker
-  return executeToolAndWait(gcc, args, global.params.verbose);
+  CachedLinkOutput cachedOutput(output, /*executable=*/true);
+  if (cachedOutput.recover(linkInternally ? "lld" : gcc, args)) {
+    if (!sectionOrderingFile.empty()) {
+      llvm::sys::fs::remove(sectionOrderingFile);
+    }
+    return 0;
+  }
+
+  int status;
+#if LDC_WITH_LLD
+  if (linkInternally) {
+    status = linkWithLLDFromGcc(gcc, args);
+  } else
+#endif
+  {
+    // try to call linker
+    status = executeToolAndWait(gcc, args, global.params.verbose,
+                                ResponseFileStyle::GNU);
+  }
+  if (!sectionOrderingFile.empty()) {
+    llvm::sys::fs::remove(sectionOrderingFile);
+  }
+  if (status == 0) {
+    cachedOutput.store();
+  }
+  return status;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -365,58 +876,6 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
 #ifdef _WIN32
 
 namespace windows {
-bool needsQuotes(const llvm::StringRef &arg) {
-  return // not already quoted
-      !(arg.size() > 1 && arg[0] == '"' &&
-        arg.back() == '"') && // empty or min 1 space or min 1 double quote
-      (arg.empty() || arg.find(' ') != arg.npos || arg.find('"') != arg.npos);
-}
-
-size_t countPrecedingBackslashes(const std::string &arg, size_t index) {
-  size_t count = 0;
-
-  for (size_t i = index - 1; i >= 0; --i) {
-    if (arg[i] != '\\')
-      break;
-    ++count;
-  }
-
-  return count;
-}
-
-std::string quoteArg(const std::string &arg) {
-  if (!needsQuotes(arg))
-    return arg;
-
-  std::string quotedArg;
-  quotedArg.reserve(3 + 2 * arg.size()); // worst case
-
-  quotedArg.push_back('"');
-
-  const size_t argLength = arg.length();
-  for (size_t i = 0; i < argLength; ++i) {
-    if (arg[i] == '"') {
-      // Escape all preceding backslashes (if any).
-      // Note that we *don't* need to escape runs of backslashes that don't
-      // precede a double quote! See MSDN:
-      // http://msdn.microsoft.com/en-us/library/17w5ykft%28v=vs.85%29.aspx
-      quotedArg.append(countPrecedingBackslashes(arg, i), '\\');
-
-      // Escape the double quote.
-      quotedArg.push_back('\\');
-    }
-
-    quotedArg.push_back(arg[i]);
-  }
-
-  // Make sure our final double quote doesn't get escaped by a trailing
-  // backslash.
-  quotedArg.append(countPrecedingBackslashes(arg, argLength), '\\');
-  quotedArg.push_back('"');
-
-  return quotedArg;
-}
-
 int executeAndWait(const char *commandLine) {
   STARTUPINFO si;
   ZeroMemory(&si, sizeof(si));
@@ -492,33 +951,23 @@ int executeMsvcToolAndWait(const std::string &tool,
 
   const size_t commandLineLengthAfterTool = commandLine.size();
 
-  // append (quoted) args
-  for (size_t i = 0; i < args.size(); ++i) {
-    commandLine.push_back(' ');
-    commandLine.append(windows::quoteArg(args[i]));
-  }
-
-  const bool useResponseFile = (!args.empty() && commandLine.size() > 2000);
-  llvm::SmallString<128> responseFilePath;
-  if (useResponseFile) {
-    const size_t firstArgIndex = commandLineLengthAfterTool + 1;
-    llvm::StringRef content(commandLine.data() + firstArgIndex,
-                            commandLine.size() - firstArgIndex);
-
-    if (llvm::sys::fs::createTemporaryFile("ldc_link", "rsp",
-                                           responseFilePath) ||
-        llvm::sys::writeFileWithEncoding(
-            responseFilePath,
-            content)) // keep encoding (LLVM assumes UTF-8 input)
-    {
+  // Pass the args via a response file if the command line would get too long
+  // (conservatively, so that cmd.exe's limit is respected too); otherwise
+  // append them (quoted).
+  ResponseFile responseFile;
+  if (!args.empty() &&
+      commandLine.size() + estimateCommandLineLen(args) > 2000) {
+    if (!responseFile.write(args, ResponseFileStyle::Windows)) {
       error(Loc(), "cannot write temporary response file for %s", tool.c_str());
       return -1;
     }
-
-    // replace all args by @<responseFilePath>
-    std::string responseFileArg = ("@" + responseFilePath).str();
-    commandLine.resize(firstArgIndex);
-    commandLine.append(windows::quoteArg(responseFileArg));
+    commandLine.push_back(' ');
+    commandLine.append(windows::quoteArg(responseFile.getArgument()));
+  } else {
+    for (size_t i = 0; i < args.size(); ++i) {
+      commandLine.push_back(' ');
+      commandLine.append(windows::quoteArg(args[i]));
+    }
   }
 
   if (needMsvcSetup)
@@ -541,9 +990,6 @@ int executeMsvcToolAndWait(const std::string &tool,
     error(Loc(), "`%s` failed with status: %d", commandLine.c_str(), exitCode);
   }
 
-  if (useResponseFile)
-    llvm::sys::fs::remove(responseFilePath);
-
   return exitCode;
 }
 
@@ -562,7 +1008,22 @@ int executeMsvcToolAndWait(const std::string &,
 static int linkObjToBinaryMSVC(bool sharedLib) {
   Logger::println("*** Linking executable ***");
 
-  std::string tool = "link.exe";
+  // With LTO, the object files contain LLVM bitcode, which only LLVM's
+  // lld-link can process (MSVC's /LTCG is for its own intermediate format).
+  // Global type hashing is only implemented by lld-link too (but not by the
+  // integrated LLD, which predates it).
+  const bool ghash = global.params.symdebug && pdbMode == PDBMode::ghash &&
+                     !linkInternally;
+  std::string tool =
+      opts::isUsingLTO() || ghash ? "lld-link.exe" : "link.exe";
+  const bool usingLinkExe = tool == "link.exe" && !linkInternally;
+
+  // Incremental linking is incompatible with /OPT:REF, /OPT:ICF and /LTCG,
+  // and ignored by lld-link.
+  const bool incremental = linkIncremental && usingLinkExe;
+  if (linkIncremental && !incremental) {
+    warning(Loc(), "-link-incremental is only supported by link.exe");
+  }
 
   // build arguments
   std::vector<std::string> args;
@@ -584,16 +1045,26 @@ static int linkObjToBinaryMSVC(bool sharedLib) {
 
   // output debug information
   if (global.params.symdebug) {
-    args.push_back("/DEBUG");
+    if (pdbMode == PDBMode::fastlink && usingLinkExe) {
+      args.push_back("/DEBUG:FASTLINK");
+    } else if (ghash) {
+      args.push_back("/DEBUG:GHASH");
+    } else {
+      args.push_back("/DEBUG");
+    }
+  }
+
+  if (incremental) {
+    args.push_back("/INCREMENTAL");
   }
 
   // enable Link-time Code Generation (aka. whole program optimization)
-  if (global.params.optimize) {
+  if (global.params.optimize && !opts::isUsingLTO() && !incremental) {
     args.push_back("/LTCG");
   }
 
   // remove dead code and fold identical COMDATs
-  if (opts::disableLinkerStripDead) {
+  if (opts::disableLinkerStripDead || incremental) {
     args.push_back("/OPT:NOREF");
   } else {
     args.push_back("/OPT:REF");
@@ -668,6 +1139,12 @@ static int linkObjToBinaryMSVC(bool sharedLib) {
   }
   logstr << "\n"; // FIXME where's flush ?
 
+#if LDC_WITH_LLD
+  if (linkInternally) {
+    return linkWithLLDCoff(args);
+  }
+#endif
+
   // try to call linker
   return executeMsvcToolAndWait(tool, args, global.params.verbose);
 }
@@ -675,6 +1152,13 @@ static int linkObjToBinaryMSVC(bool sharedLib) {
 //////////////////////////////////////////////////////////////////////////////
 
 int linkObjToBinary() {
+  // The program is executed in-process by runProgram().
+  if (jit::hasModule()) {
+    return 0;
+  }
+
+  TimeTraceScope timeTraceScope("Link", global.params.exefile);
+
   if (global.params.targetTriple->isWindowsMSVCEnvironment()) {
     // TODO: Choose dynamic/static MSVCRT version based on staticFlag?
     return linkObjToBinaryMSVC(global.params.dll);
@@ -685,12 +1169,90 @@ int linkObjToBinary() {
 
 //////////////////////////////////////////////////////////////////////////////
 
+static std::string getStaticLibraryName() {
+  std::string libName;
+  if (global.params.libname) { // explicit
+    libName = global.params.libname;
+  } else { // infer from first object file
+    libName = global.params.objfiles->dim
+                  ? FileName::removeExt((*global.params.objfiles)[0])
+                  : "a.out";
+    libName.push_back('.');
+    libName.append(global.lib_ext);
+  }
+  if (createStaticLibInObjdir && global.params.objdir &&
+      !FileName::absolute(libName.c_str())) {
+    libName = FileName::combine(global.params.objdir, libName.c_str());
+  }
+  return libName;
+}
+
+#if LDC_LLVM_VER >= 309
+/// Writes the static library directly using LLVM's archive writer, including
+/// the symbol table, which saves spawning ar/lib.exe.
+static int writeStaticLibrary(const std::string &libName) {
+  const llvm::Triple &triple = *global.params.targetTriple;
+
+  std::vector<llvm::NewArchiveMember> members;
+  members.reserve(global.params.objfiles->dim);
+  for (const char *objfile : *global.params.objfiles) {
+    auto member =
+        llvm::NewArchiveMember::getFile(objfile, /*Deterministic=*/true);
+    if (!member) {
+      error(Loc(), "cannot add '%s' to the static library: %s", objfile,
+            llvm::errorToErrorCode(member.takeError()).message().c_str());
+      return 1;
+    }
+    members.push_back(std::move(*member));
+  }
+
+  if (global.params.verbose) {
+    fprintf(global.stdmsg, "archive   %s\n", libName.c_str());
+    fflush(global.stdmsg);
+  }
+
+  // Archives for MSVC use the GNU format too (as llvm-lib does).
+  const auto kind = triple.isOSDarwin() ? llvm::object::Archive::K_BSD
+                                        : llvm::object::Archive::K_GNU;
+  const auto result =
+      llvm::writeArchive(libName, members, /*WriteSymtab=*/true, kind,
+                         /*Deterministic=*/true, /*Thin=*/false);
+  if (result.second) {
+    error(Loc(), "failed to write static library '%s': %s",
+          result.first.empty() ? libName.c_str() : result.first.str().c_str(),
+          result.second.message().c_str());
+    return 1;
+  }
+  return 0;
+}
+#endif
+
 int createStaticLibrary() {
   Logger::println("*** Creating static library ***");
+  TimeTraceScope timeTraceScope("Archive");
 
   const bool isTargetMSVC =
       global.params.targetTriple->isWindowsMSVCEnvironment();
 
+  // output filename
+  std::string libName = getStaticLibraryName();
+
+  CachedLinkOutput cachedOutput(libName, /*executable=*/false);
+
+#if LDC_LLVM_VER >= 309
+  if (!useExternalArchiver) {
+    CreateDirectoryOnDisk(libName);
+    const std::vector<std::string> writerArgs = {
+        global.params.targetTriple->isOSDarwin() ? "bsd" : "gnu"};
+    if (cachedOutput.recover("ldc-archive-writer", writerArgs))
+      return 0;
+    const int exitCode = writeStaticLibrary(libName);
+    if (exitCode == 0)
+      cachedOutput.store();
+    return exitCode;
+  }
+#endif
+
   // find archiver
   std::string tool(isTargetMSVC ? "lib.exe" : getArchiver());
 
@@ -712,22 +1274,6 @@ int createStaticLibrary() {
     args.push_back("/LTCG");
   }
 
-  // output filename
-  std::string libName;
-  if (global.params.libname) { // explicit
-    libName = global.params.libname;
-  } else { // infer from first object file
-    libName = global.params.objfiles->dim
-                  ? FileName::removeExt((*global.params.objfiles)[0])
-                  : "a.out";
-    libName.push_back('.');
-    libName.append(global.lib_ext);
-  }
-  if (createStaticLibInObjdir && global.params.objdir &&
-      !FileName::absolute(libName.c_str())) {
-    libName = FileName::combine(global.params.objdir, libName.c_str());
-  }
-
   if (isTargetMSVC) {
     args.push_back("/OUT:" + libName);
   } else {
@@ -739,13 +1285,19 @@ int createStaticLibrary() {
   // create path to the library
   CreateDirectoryOnDisk(libName);
 
+  if (cachedOutput.recover(tool, args))
+    return 0;
+
   // try to call archiver
   int exitCode;
   if (isTargetMSVC) {
     exitCode = executeMsvcToolAndWait(tool, args, global.params.verbose);
   } else {
-    exitCode = executeToolAndWait(tool, args, global.params.verbose);
+    exitCode = executeToolAndWait(tool, args, global.params.verbose,
+                                  ResponseFileStyle::GNU);
   }
+  if (exitCode == 0)
+    cachedOutput.store();
   return exitCode;
 }
 
@@ -760,6 +1312,10 @@ void deleteExeFile() {
 //////////////////////////////////////////////////////////////////////////////
 
 int runProgram() {
+  if (jit::hasModule()) {
+    return jit::runProgram();
+  }
+
   assert(!gExePath.empty());
   // assert(gExePath.isValid());
 
@@ -24,9 +24,19 @@
 #include "driver/codegenerator.h"
 #include "driver/configfile.h"
 #include "driver/exe_path.h"
+#include "driver/instancecache.h"
+#include "driver/jit.h"
 #include "driver/ldc-version.h"
+#include "driver/ldmd.h"
 #include "driver/linker.h"
+#include "driver/memorystats.h"
+#include "driver/outputwriter.h"
+#include "driver/parallelsemantic.h"
+#include "driver/statistics.h"
 #include "driver/targetmachine.h"
+#include "driver/templatestats.h"
+#include "driver/timetrace.h"
+#include "driver/toobj.h"
 #include "gen/cl_helpers.h"
 #include "gen/irstate.h"
 #include "gen/linkage.h"
@@ -40,11 +50,16 @@
 #include "gen/passes/Passes.h"
 #include "gen/runtime.h"
 #include "gen/abi.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/LinkAllPasses.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Path.h"
 #if LDC_LLVM_VER >= 308
 #include "llvm/Support/StringSaver.h"
@@ -59,6 +74,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include <assert.h>
 #include <limits.h>
+#include <map>
 #include <stdio.h>
 #include <stdlib.h>
 #if _WIN32
@@ -80,6 +96,17 @@ using namespace opts;
 
 extern void getenv_setargv(const char *envvar, int *pargc, char ***pargv);
 
+static cl::opt<std::string>
+    batchFile("batch",
+              cl::desc("Compile the jobs listed in <jobfile>, one "
+                       "'<source file> <output file>' pair per line, in this "
+                       "process (with the same switches). The jobs must form "
+                       "a single program"),
+              cl::value_desc("jobfile"));
+
+// Output files of the -batch jobs, by source file.
+static std::map<std::string, std::string> batchObjectFiles;
+
 static cl::opt<bool>
     noDefaultLib("nodefaultlib",
                  cl::desc("Don't add a default library for linking implicitly"),
@@ -106,6 +133,12 @@ static cl::opt<bool> linkDebugLib(
     cl::desc("Link with libraries specified in -debuglib, not -defaultlib"),
     cl::ZeroOrMore);
 
+static cl::opt<bool> linkDefaultLibLTO(
+    "link-defaultlib-lto",
+    cl::desc("Link with the LTO bitcode variants of the default libraries "
+             "(requires -flto and a runtime built with BUILD_LTO_LIBS)"),
+    cl::ZeroOrMore);
+
 #if LDC_LLVM_VER >= 309
 static inline llvm::Optional<llvm::Reloc::Model> getRelocModel() {
   if (mRelocModel.getNumOccurrences()) {
@@ -252,6 +285,24 @@ void rename(llvm::StringMap<cl::Option *> &map, const char *from,
 }
 #endif
 
+/// Sets a (hidden) command line option exposed from within LLVM, e.g. to
+/// control LLVM's DWARF writer. Returns false if this LLVM version doesn't
+/// have the option.
+bool setLLVMOption(const char *name, const char *value) {
+#if LDC_LLVM_VER >= 307
+  llvm::StringMap<cl::Option *> &map = cl::getRegisteredOptions();
+#else
+  llvm::StringMap<cl::Option *> map;
+  cl::getRegisteredOptions(map);
+#endif
+  auto i = map.find(name);
+  if (i == map.end()) {
+    return false;
+  }
+  i->getValue()->addOccurrence(0, name, value);
+  return true;
+}
+
 /// Removes command line options exposed from within LLVM that are unlikely
 /// to be useful for end users from the -help output.
 void hideLLVMOptions() {
@@ -379,6 +430,47 @@ llvm::Triple tryGetExplicitTriple(int argc, char **argv) {
   return triple;
 }
 
+/// Reads the jobs of the -batch file, adding their source files to
+/// sourceFiles. Empty lines and lines starting with '#' are ignored.
+///
+/// The jobs are compiled like the modules of a single program: template
+/// instances are only emitted into one of the objects and the C main only
+/// along with the D main, so all the objects have to be linked together.
+/// Modules with the same name in different jobs, and several jobs with a D
+/// main, are rejected.
+static void readBatchFile(Strings &sourceFiles) {
+  auto buffer = llvm::MemoryBuffer::getFile(batchFile);
+  if (!buffer) {
+    error(Loc(), "cannot read batch file '%s': %s", batchFile.c_str(),
+          buffer.getError().message().c_str());
+    fatal();
+  }
+
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  (*buffer)->getBuffer().split(lines, "\n");
+  for (unsigned i = 0; i < lines.size(); ++i) {
+    const llvm::StringRef line = lines[i].trim();
+    if (line.empty() || line.startswith("#")) {
+      continue;
+    }
+
+    const auto job = llvm::getToken(line);
+    const llvm::StringRef source = job.first;
+    const llvm::StringRef output = job.second.trim();
+    if (output.empty() || llvm::getToken(output).second.size()) {
+      error(Loc(), "%s(%u): expected '<source file> <output file>', not '%s'",
+            batchFile.c_str(), i + 1, line.str().c_str());
+      continue;
+    }
+    if (!batchObjectFiles.insert({source.str(), output.str()}).second) {
+      error(Loc(), "%s(%u): source file '%s' is listed twice",
+            batchFile.c_str(), i + 1, source.str().c_str());
+      continue;
+    }
+    sourceFiles.push(dupPathString(source.str()));
+  }
+}
+
 /// Parses switches from the command line, any response files and the global
 /// config file and sets up global.params accordingly.
 ///
@@ -481,6 +573,11 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
       global.params.moduleDepsFile = dupPathString(moduleDeps);
   }
 
+  if (!makeDeps.empty()) {
+    global.params.makeDepsFile = dupPathString(makeDeps);
+    global.params.stringImportFiles = new Strings;
+  }
+
 #if _WIN32
   const auto toWinPaths = [](Strings *paths) {
     if (!paths)
@@ -512,6 +609,28 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
     // profdata file:
     initFromPathString(global.params.datafileInstrProf, usefileInstrProf);
   }
+#if LDC_LLVM_VER < 309
+  if (instrProfIRLevel) {
+    error(Loc(), "-fprofile-instr-ir requires LLVM 3.9 or later");
+  }
+#endif
+#endif
+
+  // The sample profile loader matches the samples by the line offsets from
+  // the function start lines (and the discriminators), so the line info is
+  // needed.
+  if (!usefileSampleProf.empty() && !global.params.symdebug) {
+    global.params.symdebug = 1;
+  }
+  if (lineTablesOnly && !global.params.symdebug) {
+    global.params.symdebug = 1;
+  }
+#if LDC_LLVM_VER >= 400
+  // Optimization remarks refer to the source via the debug locations.
+  if (saveOptimizationRecord && !global.params.symdebug) {
+    global.params.symdebug = 1;
+    lineTablesOnly = true;
+  }
 #endif
 
   processVersions(debugArgs, "debug", DebugCondition::setGlobalLevel,
@@ -534,6 +653,10 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
 
   templateLinkage = opts::linkonceTemplates ? LLGlobalValue::LinkOnceODRLinkage
                                             : LLGlobalValue::WeakODRLinkage;
+  if (opts::linkonceTemplates && instanceCacheEnabled()) {
+    error(Loc(), "-cache-template-instances cannot be combined with "
+                 "-linkonce-templates");
+  }
 
   if (global.params.run || !runargs.empty()) {
     // FIXME: how to properly detect the presence of a PositionalEatsArgs
@@ -567,6 +690,10 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
     }
   }
 
+  if (!batchFile.empty()) {
+    readBatchFile(sourceFiles);
+  }
+
   if (noDefaultLib) {
     deprecation(
         Loc(),
@@ -582,6 +709,11 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
       if (lib.empty()) {
         continue;
       }
+      if (linkDefaultLibLTO) {
+        // The LTO variants are only referenced by the linker plugin, which
+        // pulls in just the archive members actually needed by the program.
+        lib += "-lto";
+      }
 
       char *arg = static_cast<char *>(mem.xmalloc(lib.size() + 3));
       strcpy(arg, "-l");
@@ -651,6 +783,51 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
   if (soname.getNumOccurrences() > 0 && !global.params.dll) {
     error(Loc(), "-soname can be used only when building a shared library");
   }
+
+#if LDC_LLVM_VER < 309
+  if (isUsingLTO()) {
+    error(Loc(), "-flto requires LDC to be built with LLVM 3.9 or later");
+  }
+#endif
+  if (linkDefaultLibLTO && !isUsingLTO()) {
+    error(Loc(), "-link-defaultlib-lto requires -flto");
+  }
+  // LLVM's whole-program devirtualization only runs during full LTO, and the
+  // type tests must not reach the code generator.
+  if (wholeProgramVtables && ltoMode != LTO_Full) {
+    warning(Loc(), "-fwhole-program-vtables requires -flto=full, ignoring");
+    wholeProgramVtables = false;
+  }
+
+  if (compressDebugSections) {
+#if LDC_LLVM_VER >= 400
+    if (!llvm::zlib::isAvailable()) {
+      warning(Loc(), "-gz requires LLVM to be built with zlib, ignoring");
+      compressDebugSections = false;
+    }
+#else
+    warning(Loc(), "-gz requires LDC to be built with LLVM 4.0 or later, "
+                   "ignoring");
+    compressDebugSections = false;
+#endif
+  }
+
+  // The JIT executes a single LLVM module.
+  if (jit::isRequested()) {
+    global.params.oneobj = true;
+  }
+
+  if (!batchFile.empty() &&
+      (global.params.link || global.params.lib || global.params.oneobj ||
+       global.params.objname || global.params.run)) {
+    error(Loc(), "-batch requires -c and cannot be combined with -lib, "
+                 "-singleobj, -of or -run");
+  }
+}
+
+const char *getBatchObjectFile(const char *srcfile) {
+  auto it = batchObjectFiles.find(srcfile);
+  return it == batchObjectFiles.end() ? nullptr : it->second.c_str();
 }
 
 void initializePasses() {
@@ -997,6 +1174,25 @@ void dumpPredefinedVersions() {
   }
 }
 
+/// Returns the output file of -ftime-trace, by default the first object file
+/// with the .time-trace extension.
+std::string getTimeTraceFilename() {
+  if (!opts::timeTraceFile.empty()) {
+    return opts::timeTraceFile;
+  }
+
+  llvm::SmallString<128> filename;
+  if (global.params.objfiles->dim) {
+    filename = (*global.params.objfiles)[0];
+  } else if (global.params.exefile) {
+    filename = global.params.exefile;
+  } else {
+    filename = "ldc";
+  }
+  llvm::sys::path::replace_extension(filename, "time-trace");
+  return filename.str();
+}
+
 } // anonymous namespace
 
 int cppmain(int argc, char **argv) {
@@ -1008,24 +1204,33 @@ int cppmain(int argc, char **argv) {
 
   exe_path::initialize(argv[0]);
 
+  // When invoked as ldmd2, translate the DMD-style command line in-process
+  // instead of going through the ldmd2 wrapper executable.
+  std::vector<const char *> ldmdArgs;
+  if (invokedAsLdmd(argc, argv)) {
+    ldmdArgs = translateLdmdArgs(argc, argv);
+    argc = static_cast<int>(ldmdArgs.size() - 1);
+    argv = const_cast<char **>(ldmdArgs.data());
+  }
+
+  initializeParallelSemantic(argc, argv);
+
   global._init();
   global.version = ldc::dmd_version;
   global.ldc_version = ldc::ldc_version;
   global.llvm_version = ldc::llvm_version;
 
-  // Initialize LLVM before parsing the command line so that --version shows
-  // registered targets.
+  // Register the LLVM targets before parsing the command line so that
+  // --version shows them. Only the backend of the selected target is
+  // initialized later on, in createTargetMachine().
   llvm::InitializeAllTargetInfos();
-  llvm::InitializeAllTargets();
-  llvm::InitializeAllTargetMCs();
-  llvm::InitializeAllAsmPrinters();
-  llvm::InitializeAllAsmParsers();
 
   initializePasses();
 
   bool helpOnly;
   Strings files;
   parseCommandLine(argc, argv, files, helpOnly);
+  Logger::initialize();
 
   if (files.dim == 0 && !helpOnly) {
     cl::PrintHelpMessage();
@@ -1059,7 +1264,8 @@ int cppmain(int argc, char **argv) {
 
   gTargetMachine = createTargetMachine(
       mTargetTriple, mArch, mCPU, mAttrs, bitness, mFloatABI, getRelocModel(),
-      mCodeModel, codeGenOptLevel(), disableFpElim, disableLinkerStripDead);
+      mCodeModel, codeGenOptLevel(), disableFpElim, disableLinkerStripDead,
+      opts::compressDebugSections);
 
 #if LDC_LLVM_VER >= 308
   static llvm::DataLayout DL = gTargetMachine->createDataLayout();
@@ -1086,6 +1292,118 @@ int cppmain(int argc, char **argv) {
       global.obj_ext = "obj";
   }
 
+  // The .dwo sections are moved out of the object files with objcopy, which
+  // only handles ELF; they cannot be split off LTO bitcode either.
+  if (opts::splitDwarf) {
+    if (!global.params.targetTriple->isOSBinFormatELF() || isUsingLTO()) {
+      warning(Loc(), "-gsplit-dwarf is only supported for ELF objects without "
+                     "-flto, ignoring");
+      opts::splitDwarf = false;
+    } else {
+      if (!global.params.symdebug) {
+        global.params.symdebug = 1;
+      }
+      if (!setLLVMOption("split-dwarf", "Enable")) {
+        error(Loc(), "-gsplit-dwarf is not supported by this LLVM version");
+      }
+    }
+  }
+
+  // LLVM only implements segmented stacks for x86 ELF targets and calls a
+  // stack probe function only on x86 (LLVM 4.0+).
+  const bool isX86 =
+      global.params.targetTriple->getArch() == llvm::Triple::x86 ||
+      global.params.targetTriple->getArch() == llvm::Triple::x86_64;
+  if (opts::splitStack &&
+      !(isX86 && global.params.targetTriple->isOSBinFormatELF())) {
+    error(Loc(), "-fsplit-stack is only supported for x86 ELF targets");
+  }
+  if (!opts::stackProbeFunction.empty() &&
+      (LDC_LLVM_VER < 400 || !isX86)) {
+    error(Loc(), "-fstack-probe-function is only supported for x86 targets "
+                 "with LLVM 4.0 or later");
+  }
+
+  for (const auto &mapping : opts::filePrefixMap) {
+    if (mapping.find('=') == std::string::npos) {
+      error(Loc(), "invalid -ffile-prefix-map argument '%s', expected "
+                   "'old=new'",
+            mapping.c_str());
+    }
+  }
+  for (const auto &mapping : opts::debugPrefixMap) {
+    if (mapping.find('=') == std::string::npos) {
+      error(Loc(), "invalid -fdebug-prefix-map argument '%s', expected "
+                   "'old=new'",
+            mapping.c_str());
+    }
+  }
+
+  if (opts::xrayInstrument) {
+    // LLVM 3.9 and 4.0 only implement the XRay sleds for x86_64.
+    const auto arch = global.params.targetTriple->getArch();
+    bool supportedArch = arch == llvm::Triple::x86_64;
+#if LDC_LLVM_VER >= 500
+    supportedArch = supportedArch || arch == llvm::Triple::arm ||
+                    arch == llvm::Triple::aarch64 ||
+                    arch == llvm::Triple::ppc64le ||
+                    arch == llvm::Triple::mips ||
+                    arch == llvm::Triple::mipsel ||
+                    arch == llvm::Triple::mips64 ||
+                    arch == llvm::Triple::mips64el;
+#endif
+    if (LDC_LLVM_VER < 309 || !supportedArch ||
+        !global.params.targetTriple->isOSLinux()) {
+      error(Loc(), "-fxray-instrument is not supported for target '%s' with "
+                   "this LLVM version",
+            global.params.targetTriple->str().c_str());
+    }
+  }
+
+  if (opts::alignFunctions & (opts::alignFunctions - 1)) {
+    error(Loc(), "-falign-functions=%u is not a power of 2",
+          opts::alignFunctions.getValue());
+  }
+  // LLVM has no target-independent loop alignment knob; the x86 backend's
+  // preferred loop alignment can be overridden as log2 (LLVM 4.0+).
+  if (opts::alignLoops) {
+    if (opts::alignLoops & (opts::alignLoops - 1)) {
+      error(Loc(), "-falign-loops=%u is not a power of 2",
+            opts::alignLoops.getValue());
+    } else if (!isX86 ||
+               !setLLVMOption(
+                   "x86-experimental-pref-loop-alignment",
+                   std::to_string(llvm::Log2_32(opts::alignLoops)).c_str())) {
+      warning(Loc(), "-falign-loops is only supported for x86 targets with "
+                     "LLVM 4.0 or later, ignoring");
+    }
+  }
+
+  if (opts::dABIVersion > 1) {
+    error(Loc(), "unknown extern(D) ABI version %u (the latest is 1)",
+          opts::dABIVersion.getValue());
+  } else if (opts::dABIVersion != 0 &&
+             global.params.targetTriple->getArch() != llvm::Triple::x86_64) {
+    warning(Loc(), "-fd-abi-version only affects x86-64 targets, ignoring");
+  }
+
+  // Type units are COMDAT sections, deduplicated by the linker. They need
+  // the unique type identifiers of the composite types.
+  if (opts::debugTypeUnits && global.params.symdebug) {
+#if LDC_LLVM_VER >= 309
+    if (!global.params.targetTriple->isOSBinFormatELF()) {
+      warning(Loc(), "-fdebug-types-section is only supported for ELF "
+                     "objects, ignoring");
+    } else if (!setLLVMOption("generate-type-units", "true")) {
+      error(Loc(),
+            "-fdebug-types-section is not supported by this LLVM version");
+    }
+#else
+    warning(Loc(), "-fdebug-types-section requires LDC to be built with LLVM "
+                   "3.9 or later, ignoring");
+#endif
+  }
+
   // allocate the target abi
   gABI = TargetABI::getTarget();
 
@@ -1097,8 +1415,25 @@ int cppmain(int argc, char **argv) {
     global.lib_ext = "a";
   }
 
+  if (opts::timeTrace) {
+    initializeTimeTrace(opts::timeTraceGranularity);
+  }
+  stats::initialize();
+
   Strings libmodules;
-  return mars_mainBody(files, libmodules);
+  const int status = mars_mainBody(files, libmodules);
+
+  if (opts::timeTrace) {
+    writeTimeTrace(getTimeTraceFilename().c_str());
+  }
+  if (opts::templateStats) {
+    printTemplateStats();
+  }
+  if (opts::memoryStats) {
+    printMemoryStats();
+  }
+  stats::writeFile();
+  return status;
 }
 
 void addDefaultVersionIdentifiers() {
@@ -1106,9 +1441,100 @@ void addDefaultVersionIdentifiers() {
   dumpPredefinedVersions();
 }
 
+namespace {
+/// Escapes a path for use in a Make rule (also understood by Ninja).
+void writeMakeDepsPath(llvm::raw_ostream &os, llvm::StringRef path) {
+  for (char c : path) {
+    if (c == ' ' || c == '#') {
+      os << '\\';
+    } else if (c == '$') {
+      os << '$';
+    }
+    os << c;
+  }
+}
+
+bool isPseudoModule(Module *m) {
+  const char *name = m->toChars();
+  return strcmp(name, "__entrypoint") == 0 || strcmp(name, "__main") == 0;
+}
+} // anonymous namespace
+
+/// Writes the -makedeps file, a Make rule for the compiler output depending
+/// on the root modules, their imports (transitively with
+/// -makedeps-transitive) and all string-imported files.
+void writeMakeDeps(Modules &modules) {
+  if (!global.params.makeDepsFile || modules.dim == 0) {
+    return;
+  }
+
+  std::vector<const char *> deps;
+  llvm::StringSet<> seen;
+  const auto addDep = [&](const char *path) {
+    if (seen.insert(path).second) {
+      deps.push_back(path);
+    }
+  };
+
+  for (auto m : modules) {
+    if (!isPseudoModule(m)) {
+      addDep(m->srcfile->toChars());
+    }
+  }
+  if (makeDepsTransitive) {
+    for (auto m : Module::amodules) {
+      if (!isPseudoModule(m)) {
+        addDep(m->srcfile->toChars());
+      }
+    }
+  } else {
+    for (auto m : modules) {
+      for (auto imported : m->aimports) {
+        if (!isPseudoModule(imported)) {
+          addDep(imported->srcfile->toChars());
+        }
+      }
+    }
+  }
+  for (auto file : *global.params.stringImportFiles) {
+    addDep(file);
+  }
+
+  const char *target = global.params.objname;
+  if (!target && global.params.lib) {
+    target = global.params.libname;
+  }
+  if (!target) {
+    target = modules[0]->objfile->toChars();
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(global.params.makeDepsFile, ec,
+                          llvm::sys::fs::F_Text);
+  if (ec) {
+    error(Loc(), "cannot write dependency file '%s': %s",
+          global.params.makeDepsFile, ec.message().c_str());
+    return;
+  }
+
+  writeMakeDepsPath(os, target);
+  os << ':';
+  for (auto dep : deps) {
+    os << " \\\n  ";
+    writeMakeDepsPath(os, dep);
+  }
+  os << '\n';
+}
+
 void codegenModules(Modules &modules) {
   // Generate one or more object/IR/bitcode files.
   if (global.params.obj && !modules.empty()) {
+    // With -singleobj, all modules end up in a single LLVM module; its machine
+    // code may be emitted in parallel partitions though (see writeModule()).
+    if (!global.params.oneobj) {
+      startParallelCodegen(opts::parallelCodegen);
+    }
+
     ldc::CodeGenerator cg(getGlobalContext(), global.params.oneobj);
 
     // When inlining is enabled, we are calling semantic3 on function
@@ -1129,8 +1555,14 @@ void codegenModules(Modules &modules) {
       if (global.errors)
         fatal();
     }
+
+    finishParallelCodegen();
   }
+  // The -H and -X files may still be written in the background.
+  finishOutputFiles();
+  waitForRootModuleProcesses();
 
+  cache::printStatistics();
   cache::pruneCache();
 
   freeRuntime();
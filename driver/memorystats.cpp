@@ -0,0 +1,114 @@
+//===-- memorystats.cpp ---------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/memorystats.h"
+
+#include "mars.h"
+#include "driver/cl_options.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Defined in ddmd/root/rmem.d.
+extern "C" size_t allocatedFrontendMemory();
+
+namespace {
+const char *const phaseNames[] = {"other",     "parse", "semantic",
+                                  "templates", "CTFE",  "codegen"};
+const unsigned numPhases = sizeof(phaseNames) / sizeof(phaseNames[0]);
+
+struct PhaseStats {
+  uint64_t allocated = 0;
+  uint64_t peakRSSGrowth = 0;
+};
+
+PhaseStats phaseStats[numPhases];
+std::vector<unsigned> phaseStack;
+size_t lastAllocated = 0;
+uint64_t lastPeakRSS = 0;
+
+/// Returns the peak resident set size of the process in bytes (0 if unknown).
+uint64_t getPeakRSS() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return usage.ru_maxrss; // bytes
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+/// Attributes the memory allocated since the last phase transition to the
+/// current phase. The peak RSS is only sampled at top-level transitions, as
+/// the nested phases (template instances, CTFE calls) are far too frequent.
+void account(bool topLevel) {
+  const unsigned phase = phaseStack.empty() ? 0 : phaseStack.back();
+  const size_t allocated = allocatedFrontendMemory();
+  phaseStats[phase].allocated += allocated - lastAllocated;
+  lastAllocated = allocated;
+
+  if (topLevel) {
+    const uint64_t peakRSS = getPeakRSS();
+    if (peakRSS > lastPeakRSS) {
+      phaseStats[phase].peakRSSGrowth += peakRSS - lastPeakRSS;
+      lastPeakRSS = peakRSS;
+    }
+  }
+}
+
+double toMB(uint64_t bytes) { return bytes / (1024.0 * 1024.0); }
+}
+
+bool memoryStatsEnabled() { return opts::memoryStats; }
+
+void memoryPhaseBegin(unsigned phase) {
+  assert(phase < numPhases);
+  account(phaseStack.empty());
+  phaseStack.push_back(phase);
+}
+
+void memoryPhaseEnd() {
+  assert(!phaseStack.empty());
+  account(phaseStack.size() == 1);
+  phaseStack.pop_back();
+}
+
+void printMemoryStats() {
+  account(phaseStack.size() <= 1);
+
+  uint64_t totalAllocated = 0;
+  fprintf(global.stdmsg, "phase       allocated MB  peak RSS growth MB\n");
+  for (unsigned i = 0; i < numPhases; ++i) {
+    const PhaseStats &stats = phaseStats[i];
+    totalAllocated += stats.allocated;
+    fprintf(global.stdmsg, "%-10s %13.3f %19.3f\n", phaseNames[i],
+            toMB(stats.allocated), toMB(stats.peakRSSGrowth));
+  }
+  fprintf(global.stdmsg, "%-10s %13.3f %19.3f\n", "total", toMB(totalAllocated),
+          toMB(lastPeakRSS));
+}
@@ -0,0 +1,68 @@
+//===-- driver/memorystats.h - Memory usage per phase ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Attributes the memory allocated by the frontend to the compilation phases
+// (-vmem), and tracks which phases increase the peak RSS of the process.
+//
+// The frontend's bump allocator (allocmemory() in ddmd/root/rmem.d) never
+// frees, so its allocated bytes are a measure of the memory held by the AST,
+// the template instances and the CTFE values (with -lowmem, the frontend uses
+// the GC heap instead, which isn't accounted). Nested phases (e.g. CTFE during
+// semantic analysis) are accounted exclusively. LLVM's memory only shows up in
+// the peak RSS, which is sampled when entering and leaving top-level phases.
+//
+// The phases are recorded by the frontend (see driver/memorystats.d) and by
+// the code generator.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_MEMORYSTATS_H
+#define LDC_DRIVER_MEMORYSTATS_H
+
+/// The phases memory is attributed to. Keep in sync with driver/memorystats.d.
+enum class MemoryPhase : unsigned {
+  Other,
+  Parse,
+  Semantic,
+  Templates,
+  CTFE,
+  Codegen,
+};
+
+/// Whether -vmem is in effect.
+bool memoryStatsEnabled();
+
+void memoryPhaseBegin(unsigned phase);
+void memoryPhaseEnd();
+
+/// Attributes the memory allocated during its lifetime to a phase, if -vmem is
+/// in effect.
+class MemoryPhaseScope {
+  bool enabled;
+
+public:
+  explicit MemoryPhaseScope(MemoryPhase phase)
+      : enabled(memoryStatsEnabled()) {
+    if (enabled) {
+      memoryPhaseBegin(static_cast<unsigned>(phase));
+    }
+  }
+  ~MemoryPhaseScope() {
+    if (enabled) {
+      memoryPhaseEnd();
+    }
+  }
+  MemoryPhaseScope(const MemoryPhaseScope &) = delete;
+  MemoryPhaseScope &operator=(const MemoryPhaseScope &) = delete;
+};
+
+/// Prints the memory allocated in each phase and the peak RSS.
+void printMemoryStats();
+
+#endif
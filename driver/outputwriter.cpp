@@ -0,0 +1,149 @@
+//===-- outputwriter.cpp --------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The writes are done in order by a single thread, so that the chunks
+// appended to a file (e.g. the JSON output of each module) end up in the
+// order they were submitted in. The data is copied, as the frontend buffers
+// may be allocated from the GC with -lowmem.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/outputwriter.h"
+#include "errors.h"
+#include "llvm/Support/CommandLine.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<bool> writeOutputsInBackground(
+    "write-outputs-in-background",
+    llvm::cl::desc("Write the interface (-H) and JSON (-X) files on a "
+                   "background thread (default: true)"),
+    llvm::cl::ZeroOrMore, llvm::cl::init(true));
+
+struct Write {
+  std::string filename;
+  std::string data;
+  bool append;
+};
+
+bool writeToFile(const Write &write) {
+  FILE *file = fopen(write.filename.c_str(), write.append ? "ab" : "wb");
+  if (!file)
+    return false;
+  const bool written =
+      fwrite(write.data.data(), 1, write.data.size(), file) ==
+      write.data.size();
+  return fclose(file) == 0 && written;
+}
+
+class OutputWriter {
+public:
+  OutputWriter() : thread([this] { run(); }) {}
+
+  void submit(Write write) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      writes.push_back(std::move(write));
+    }
+    available.notify_one();
+  }
+
+  /// Waits for the pending writes and returns the files which couldn't be
+  /// written.
+  std::vector<std::string> finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shutdown = true;
+    }
+    available.notify_one();
+    thread.join();
+    return failed;
+  }
+
+private:
+  void run() {
+    for (;;) {
+      Write write;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return shutdown || !writes.empty(); });
+        if (writes.empty())
+          return;
+        write = std::move(writes.front());
+        writes.pop_front();
+      }
+      if (!writeToFile(write)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed.push_back(write.filename);
+      }
+    }
+  }
+
+  std::deque<Write> writes;
+  std::vector<std::string> failed;
+  std::mutex mutex;
+  std::condition_variable available;
+  bool shutdown = false;
+  // Started last, once the other members are initialized.
+  std::thread thread;
+};
+
+OutputWriter *outputWriter = nullptr;
+
+/// Completes the pending writes if the compilation is aborted via fatal(), as
+/// the files used to be written right away.
+void finishAtExit() {
+  if (outputWriter)
+    outputWriter->finish();
+}
+}
+
+void writeOutputFile(const char *filename, const char *data, size_t length,
+                     bool append) {
+  Write write{filename, std::string(data, length), append};
+  if (!writeOutputsInBackground) {
+    if (!writeToFile(write)) {
+      error(Loc(), "Error writing file '%s'", filename);
+      fatal();
+    }
+    return;
+  }
+
+  if (!outputWriter) {
+    static bool registered = false;
+    if (!registered) {
+      std::atexit(finishAtExit);
+      registered = true;
+    }
+    outputWriter = new OutputWriter;
+  }
+  outputWriter->submit(std::move(write));
+}
+
+void finishOutputFiles() {
+  if (!outputWriter)
+    return;
+  const std::vector<std::string> failed = outputWriter->finish();
+  delete outputWriter;
+  outputWriter = nullptr;
+
+  for (const auto &filename : failed) {
+    error(Loc(), "Error writing file '%s'", filename.c_str());
+  }
+  if (!failed.empty())
+    fatal();
+}
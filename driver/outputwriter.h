@@ -0,0 +1,30 @@
+//===-- driver/outputwriter.h - Writing output files ------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The interface (-H) and JSON (-X) output files are written on a background
+// thread, overlapping with the semantic analysis and code generation of the
+// following modules (see driver/outputwriter.d).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_OUTPUTWRITER_H
+#define LDC_DRIVER_OUTPUTWRITER_H
+
+#include <cstddef>
+
+/// Writes the data to the file (or appends it), on the background thread
+/// unless disabled. The data is copied.
+void writeOutputFile(const char *filename, const char *data, size_t length,
+                     bool append);
+
+/// Waits until all output files are written. Aborts the compilation if one of
+/// them couldn't be written.
+void finishOutputFiles();
+
+#endif
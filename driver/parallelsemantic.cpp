@@ -0,0 +1,166 @@
+//===-- parallelsemantic.cpp ----------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The frontend keeps its state in globals and cannot analyze functions on
+// several threads. Instead, the root modules are assigned round-robin to the
+// processes: every process parses all of them (which is cheap) and demotes
+// the ones it doesn't handle to imported modules before semantic analysis,
+// so that their function bodies are neither analyzed nor compiled. Templates
+// are emitted as in separate compilation.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/parallelsemantic.h"
+#include "errors.h"
+#include "mars.h"
+#include "module.h"
+#include "driver/exe_path.h"
+#include "gen/logger.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Program.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#if _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#endif
+
+namespace {
+
+llvm::cl::opt<unsigned> parallelSemantic(
+    "parallel-semantic",
+    llvm::cl::desc("Distribute the semantic analysis and codegen of the root "
+                   "modules across <N> compiler processes (default: 1). "
+                   "Ignored with -singleobj, -run and the -H, -D, -X and "
+                   "-deps outputs"),
+    llvm::cl::value_desc("N"), llvm::cl::init(1));
+
+// Set for the child processes.
+llvm::cl::opt<unsigned> parallelSemanticProcess(
+    "parallel-semantic-process", llvm::cl::Hidden,
+    llvm::cl::desc("Index of this process for -parallel-semantic"),
+    llvm::cl::init(0));
+
+std::vector<std::string> arguments;
+std::vector<llvm::sys::ProcessInfo> children;
+
+bool isApplicable() {
+  return global.params.obj && !global.params.oneobj && !global.params.run &&
+         !global.params.doHdrGeneration && !global.params.doDocComments &&
+         !global.params.doJsonGeneration && !global.params.moduleDeps &&
+         !global.params.makeDepsFile;
+}
+
+/// Terminates and reaps the child processes if the initial process exits
+/// before waiting for them, e.g. via fatal().
+void killChildProcesses() {
+  for (const auto &child : children) {
+#if _WIN32
+    TerminateProcess(child.ProcessHandle, 1);
+#else
+    kill(child.Pid, SIGKILL);
+#endif
+    std::string errorMsg;
+    llvm::sys::Wait(child, 0, /*WaitUntilTerminates=*/true, &errorMsg);
+  }
+  children.clear();
+}
+
+void startChildProcesses(unsigned numProcesses) {
+  std::atexit(killChildProcesses);
+
+  const std::string &exePath = exe_path::getExePath();
+  for (unsigned i = 1; i < numProcesses; ++i) {
+    std::vector<const char *> args;
+    args.push_back(exePath.c_str());
+    for (const auto &arg : arguments) {
+      args.push_back(arg.c_str());
+    }
+    const std::string process =
+        "-parallel-semantic-process=" + std::to_string(i);
+    args.push_back(process.c_str());
+    args.push_back(nullptr);
+
+    std::string errorMsg;
+    auto child = llvm::sys::ExecuteNoWait(exePath, args.data(), nullptr,
+                                          nullptr, 0, &errorMsg);
+    if (child.Pid == 0) {
+      error(Loc(), "cannot start compiler process: %s", errorMsg.c_str());
+      fatal();
+    }
+    children.push_back(child);
+  }
+}
+}
+
+void initializeParallelSemantic(int argc, char **argv) {
+  arguments.assign(&argv[1], &argv[argc]);
+}
+
+void partitionRootModules(Modules &modules, Modules &otherModules) {
+  if (parallelSemantic <= 1 || modules.dim < 2 || !isApplicable())
+    return;
+
+  const unsigned numProcesses =
+      std::min<unsigned>(parallelSemantic, modules.dim);
+  const unsigned process = parallelSemanticProcess;
+  if (process >= numProcesses) {
+    error(Loc(), "invalid -parallel-semantic-process");
+    fatal();
+  }
+
+  if (process == 0) {
+    startChildProcesses(numProcesses);
+  } else {
+    // The initial process links or archives all object files, and removes
+    // them afterwards with -cleanup-obj.
+    global.params.link = false;
+    global.params.lib = false;
+    global.params.cleanupObjectFiles = false;
+  }
+
+  Modules own;
+  for (d_size_t i = 0; i < modules.dim; ++i) {
+    Module *m = modules[i];
+    if (i % numProcesses == process) {
+      own.push(m);
+    } else {
+      otherModules.push(m);
+    }
+  }
+  for (d_size_t i = 0; i < otherModules.dim; ++i) {
+    otherModules[i]->importedFrom = own[0];
+  }
+  IF_LOG Logger::println("Process %u of %u compiles %llu root modules",
+                         process, numProcesses,
+                         static_cast<unsigned long long>(own.dim));
+
+  modules.setDim(0);
+  modules.append(&own);
+}
+
+void waitForRootModuleProcesses() {
+  bool failed = false;
+  for (const auto &child : children) {
+    std::string errorMsg;
+    auto result = llvm::sys::Wait(child, 0, /*WaitUntilTerminates=*/true,
+                                  &errorMsg);
+    if (result.ReturnCode != 0) {
+      if (!errorMsg.empty())
+        error(Loc(), "compiler process failed: %s", errorMsg.c_str());
+      failed = true;
+    }
+  }
+  children.clear();
+  if (failed)
+    fatal();
+}
@@ -0,0 +1,33 @@
+//===-- driver/parallelsemantic.h - Root modules in processes --*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -parallel-semantic=<N>, the root modules are distributed across N
+// compiler processes. Each one analyzes (semantic3) and compiles only its
+// share of the root modules and treats the others as imported modules, like
+// separate compilation; the initial process links all object files.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_PARALLELSEMANTIC_H
+#define LDC_DRIVER_PARALLELSEMANTIC_H
+
+#include "arraytypes.h"
+
+/// Remembers the command line, which the child processes are started with.
+void initializeParallelSemantic(int argc, char **argv);
+
+/// Moves the root modules handled by other processes from `modules` to
+/// `otherModules`, turning them into imported modules. The initial process
+/// starts the child processes.
+void partitionRootModules(Modules &modules, Modules &otherModules);
+
+/// Waits for the child processes; a fatal error if one of them failed.
+void waitForRootModuleProcesses();
+
+#endif
@@ -0,0 +1,273 @@
+//===-- prefetch.cpp ------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The reader threads don't call into the frontend (which may allocate from
+// the GC with -lowmem); the module lookup is mirrored here. The buffers are
+// malloc'ed and terminated by two zero bytes, like the ones of File::read().
+// The threads are detached and block on the queue once all files are read.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/prefetch.h"
+#include "driver/dircache.h"
+#include "mars.h"
+#include "root/file.h"
+#include "root/filename.h"
+#include "gen/logger.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<bool> prefetchSources(
+    "prefetch-sources",
+    llvm::cl::desc("Read the source files of the root and imported modules on "
+                   "background threads ahead of parsing (default: true)"),
+    llvm::cl::ZeroOrMore, llvm::cl::init(true));
+
+const unsigned numReaderThreads = 4;
+
+struct Entry {
+  /// The path of a root module's file, or the module filename without
+  /// extension of an imported module.
+  std::string name;
+  bool isModule;
+  bool done = false;
+  bool taken = false;
+  /// The source file found for a module; empty if there is none.
+  std::string path;
+  unsigned char *buffer = nullptr;
+  size_t length = 0;
+};
+
+/// Like FileName::combine().
+std::string combine(const std::string &path, const std::string &name) {
+  if (path.empty())
+    return name;
+  std::string result = path;
+#ifdef _WIN32
+  const char last = path.back();
+  if (last != '\\' && last != '/' && last != ':')
+    result += '\\';
+#else
+  if (path.back() != '/')
+    result += '/';
+#endif
+  return result + name;
+}
+
+class Prefetcher {
+public:
+  Prefetcher() {
+    if (global.path) {
+      for (d_size_t i = 0; i < global.path->dim; ++i)
+        importPaths.push_back((*global.path)[i]);
+    }
+    hdrExt = global.hdr_ext;
+    marsExt = global.mars_ext;
+  }
+
+  void enqueue(llvm::StringMap<std::unique_ptr<Entry>> &map,
+               const char *name, bool isModule) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &entry = map[name];
+    if (entry)
+      return;
+    entry.reset(new Entry);
+    entry->name = name;
+    entry->isModule = isModule;
+    queue.push_back(entry.get());
+    workAvailable.notify_one();
+
+    while (threads < numReaderThreads && threads < queue.size()) {
+      std::thread(&Prefetcher::work, this).detach();
+      ++threads;
+    }
+  }
+
+  /// Waits for the entry of the given name and marks it as taken. Returns
+  /// null if it hasn't been prefetched or was already taken.
+  Entry *take(llvm::StringMap<std::unique_ptr<Entry>> &map, const char *name) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = map.find(name);
+    if (it == map.end() || it->second->taken)
+      return nullptr;
+    Entry *entry = it->second.get();
+    entryDone.wait(lock, [entry] { return entry->done; });
+    entry->taken = true;
+    return entry;
+  }
+
+  llvm::StringMap<std::unique_ptr<Entry>> files;
+  llvm::StringMap<std::unique_ptr<Entry>> modules;
+
+private:
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      workAvailable.wait(lock, [this] { return !queue.empty(); });
+      Entry *entry = queue.front();
+      queue.pop_front();
+      const std::string name = entry->name;
+      const bool isModule = entry->isModule;
+      lock.unlock();
+
+      std::string path = isModule ? lookForSourceFile(name) : name;
+      unsigned char *buffer = nullptr;
+      size_t length = 0;
+      if (!path.empty())
+        buffer = readFile(path, length);
+
+      lock.lock();
+      entry->path = std::move(path);
+      entry->buffer = buffer;
+      entry->length = length;
+      entry->done = true;
+      entryDone.notify_all();
+    }
+  }
+
+  /// Mirrors lookForSourceFile() in ddmd/dmodule.d.
+  std::string lookForSourceFile(const std::string &filename) {
+    const std::string sdi = filename + "." + hdrExt;
+    if (fileExistsCached(sdi.c_str()) == 1)
+      return sdi;
+    const std::string sd = filename + "." + marsExt;
+    if (fileExistsCached(sd.c_str()) == 1)
+      return sd;
+    if (fileExistsCached(filename.c_str()) == 2) {
+      const std::string n = combine(filename, "package.d");
+      if (fileExistsCached(n.c_str()) == 1)
+        return n;
+    }
+    if (FileName::absolute(filename.c_str()))
+      return "";
+    for (const auto &p : importPaths) {
+      std::string n = combine(p, sdi);
+      if (fileExistsCached(n.c_str()) == 1)
+        return n;
+      n = combine(p, sd);
+      if (fileExistsCached(n.c_str()) == 1)
+        return n;
+      n = combine(p, filename);
+      if (fileExistsCached(n.c_str()) == 2) {
+        const std::string n2 = combine(n, "package.d");
+        if (fileExistsCached(n2.c_str()) == 1)
+          return n2;
+      }
+    }
+    return "";
+  }
+
+  static unsigned char *readFile(const std::string &path, size_t &length) {
+    uint64_t size;
+    if (llvm::sys::fs::file_size(path, size))
+      return nullptr;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return nullptr;
+    auto buffer = static_cast<unsigned char *>(malloc(size + 2));
+    if (buffer && fread(buffer, 1, size, f) != size) {
+      free(buffer);
+      buffer = nullptr;
+    }
+    fclose(f);
+    if (!buffer)
+      return nullptr;
+    buffer[size] = 0;
+    buffer[size + 1] = 0;
+    length = size;
+    return buffer;
+  }
+
+  std::vector<std::string> importPaths;
+  std::string hdrExt;
+  std::string marsExt;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable entryDone;
+  std::deque<Entry *> queue;
+  unsigned threads = 0;
+};
+
+/// Never destroyed, the detached threads keep using it until the process
+/// exits.
+Prefetcher &getPrefetcher() {
+  static Prefetcher *prefetcher = new Prefetcher;
+  return *prefetcher;
+}
+}
+
+void prefetchSourceFile(File *file) {
+  // Skip files whose contents are set already (the -main dummy module).
+  if (!prefetchSources || file->len)
+    return;
+  Prefetcher &p = getPrefetcher();
+  p.enqueue(p.files, file->name->str, /*isModule=*/false);
+}
+
+void prefetchModule(const char *filename) {
+  if (!prefetchSources)
+    return;
+  Prefetcher &p = getPrefetcher();
+  p.enqueue(p.modules, filename, /*isModule=*/true);
+}
+
+bool readPrefetchedFile(File *file) {
+  if (!prefetchSources || file->len)
+    return false;
+  Prefetcher &p = getPrefetcher();
+  Entry *entry = p.take(p.files, file->name->str);
+  if (!entry || !entry->buffer)
+    return false;
+
+  if (!file->ref)
+    free(file->buffer);
+  file->ref = 0;
+  file->buffer = entry->buffer;
+  file->len = entry->length;
+  entry->buffer = nullptr;
+  return true;
+}
+
+bool takePrefetchedModule(const char *filename, File **file) {
+  if (!prefetchSources)
+    return false;
+  Prefetcher &p = getPrefetcher();
+  Entry *entry = p.take(p.modules, filename);
+  if (!entry)
+    return false;
+
+  IF_LOG Logger::println("Prefetched module %s: %s", filename,
+                         entry->path.empty() ? "not found"
+                                             : entry->path.c_str());
+  *file = nullptr;
+  if (!entry->path.empty()) {
+    *file = File::create(entry->path.c_str());
+    // If the file couldn't be read, Module::read() tries again and reports
+    // the error.
+    if (entry->buffer) {
+      (*file)->buffer = entry->buffer;
+      (*file)->len = entry->length;
+      entry->buffer = nullptr;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,36 @@
+//===-- driver/prefetch.h - Reading source files ahead of time --*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The source files of the root modules, and of the modules imported by parsed
+// modules, are looked up and read on background threads, so that the parser
+// doesn't wait for the file system (see driver/prefetch.d).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_PREFETCH_H
+#define LDC_DRIVER_PREFETCH_H
+
+struct File;
+
+/// Starts reading the file on a background thread.
+void prefetchSourceFile(File *file);
+
+/// Starts looking up (as lookForSourceFile() does) and reading the source file
+/// of an imported module, given as path without extension ("std/stdio").
+void prefetchModule(const char *filename);
+
+/// If the file has been prefetched, waits for it and stores the contents in
+/// `file`. Returns false if it hasn't been prefetched or couldn't be read.
+bool readPrefetchedFile(File *file);
+
+/// If the module has been prefetched, waits for it and returns true; `file`
+/// is then set to its source file (already read), or null if there is none.
+bool takePrefetchedModule(const char *filename, File **file);
+
+#endif
@@ -0,0 +1,85 @@
+//===-- statistics.cpp ----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/statistics.h"
+
+#include "errors.h"
+#include "driver/cache.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+namespace {
+llvm::cl::opt<std::string> statsFile(
+    "stats-file",
+    llvm::cl::desc("Write statistics about the compilation to <file>, as a "
+                   "JSON object: LDC's counters, and the LLVM statistics "
+                   "(LLVM >= 4.0, only counted by LLVM builds with assertions "
+                   "or LLVM_ENABLE_STATS)"),
+    llvm::cl::value_desc("file"), llvm::cl::ZeroOrMore);
+}
+
+namespace stats {
+
+bool isEnabled() { return !statsFile.empty(); }
+
+Counters &counters() {
+  static Counters c;
+  return c;
+}
+
+void initialize() {
+#if LDC_LLVM_VER >= 400
+  if (isEnabled())
+    llvm::EnableStatistics(/*PrintOnExit=*/false);
+#endif
+}
+
+uint64_t countInstructions(const llvm::Module &m) {
+  uint64_t count = 0;
+  for (const auto &f : m)
+    for (const auto &bb : f)
+      count += bb.size();
+  return count;
+}
+
+void writeFile() {
+  if (!isEnabled())
+    return;
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(statsFile, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    error(Loc(), "cannot write statistics file '%s': %s", statsFile.c_str(),
+          ec.message().c_str());
+    return;
+  }
+
+  const Counters &c = counters();
+  unsigned cacheHits, cacheMisses;
+  cache::getHitsAndMisses(cacheHits, cacheMisses);
+  os << "{\"ldc\": {\"modules\": " << c.modules
+     << ", \"functionsCodegenned\": " << c.functionsCodegenned
+     << ", \"typeInfosEmitted\": " << c.typeInfosEmitted
+     << ", \"typeLookups\": " << c.typeLookups
+     << ", \"typeLookupMisses\": " << c.typeLookupMisses
+     << ", \"irInstructions\": " << c.irInstructions
+     << ", \"irInstructionsOptimized\": " << c.irInstructionsOptimized.load()
+     << ", \"cacheHits\": " << cacheHits
+     << ", \"cacheMisses\": " << cacheMisses << "}";
+#if LDC_LLVM_VER >= 400
+  os << ",\n\"llvm\": ";
+  llvm::PrintStatisticsJSON(os);
+#endif
+  os << "}\n";
+}
+}
@@ -0,0 +1,56 @@
+//===-- driver/statistics.h - Compiler statistics export --------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Collects LDC's own counters and LLVM's statistics (STATISTIC) of a
+// compilation and writes them to the -stats-file as a JSON object.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_STATISTICS_H
+#define LDC_DRIVER_STATISTICS_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace llvm {
+class Module;
+}
+
+namespace stats {
+
+/// LDC's counters. The IR of the modules may be optimized on the codegen
+/// worker threads.
+struct Counters {
+  unsigned modules = 0;
+  unsigned functionsCodegenned = 0;
+  unsigned typeInfosEmitted = 0;
+  /// DtoType() calls, and those not answered by the memoized Type::ctype.
+  uint64_t typeLookups = 0;
+  uint64_t typeLookupMisses = 0;
+  uint64_t irInstructions = 0;
+  std::atomic<uint64_t> irInstructionsOptimized{0};
+};
+
+/// Whether -stats-file is given.
+bool isEnabled();
+
+/// Returns the counters, which are only to be updated if isEnabled().
+Counters &counters();
+
+/// Enables the collection of LLVM's statistics (LLVM >= 4.0).
+void initialize();
+
+/// Returns the number of instructions in the module.
+uint64_t countInstructions(const llvm::Module &m);
+
+/// Writes the statistics to the -stats-file.
+void writeFile();
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include "llvm/Target/TargetOptions.h"
 #include "mars.h"
 #include "gen/logger.h"
+#include <cstring>
 
 #if LDC_LLVM_VER >= 307
 #include "driver/cl_options.h"
@@ -225,8 +226,6 @@ static std::string getTargetCPU(const std::string &cpu,
       return cpu;
     }
 
-    // FIXME: Reject attempts to use -mcpu=native unless the target matches
-    // the host.
     std::string hostCPU = llvm::sys::getHostCPUName();
     if (!hostCPU.empty() && hostCPU != "generic") {
       return hostCPU;
@@ -445,6 +444,43 @@ const llvm::Target *lookupTarget(const std::string &arch, llvm::Triple &triple,
   return target;
 }
 
+/// Initializes the LLVM backend (target machine, MC layer, assembly printer
+/// and parser) implementing the given registered target. Initializing only
+/// the needed backend instead of all of them saves start-up time.
+static void initializeBackend(const llvm::Target &target) {
+  if (target.hasTargetMachine()) {
+    return;
+  }
+
+  // The backend is the first one registering a target machine for target.
+  const char *backend = nullptr;
+#define LLVM_TARGET(TargetName)                                                \
+  if (!backend) {                                                              \
+    LLVMInitialize##TargetName##Target();                                      \
+    if (target.hasTargetMachine()) {                                           \
+      backend = #TargetName;                                                   \
+      LLVMInitialize##TargetName##TargetMC();                                  \
+    }                                                                          \
+  }
+#include "llvm/Config/Targets.def"
+
+  if (!backend) {
+    return;
+  }
+
+#define LLVM_ASM_PRINTER(TargetName)                                           \
+  if (strcmp(backend, #TargetName) == 0) {                                     \
+    LLVMInitialize##TargetName##AsmPrinter();                                  \
+  }
+#include "llvm/Config/AsmPrinters.def"
+
+#define LLVM_ASM_PARSER(TargetName)                                            \
+  if (strcmp(backend, #TargetName) == 0) {                                     \
+    LLVMInitialize##TargetName##AsmParser();                                   \
+  }
+#include "llvm/Config/AsmParsers.def"
+}
+
 llvm::TargetMachine *
 createTargetMachine(std::string targetTriple, std::string arch, std::string cpu,
                     std::vector<std::string> attrs,
@@ -456,7 +492,8 @@ createTargetMachine(std::string targetTriple, std::string arch, std::string cpu,
 #endif
                     llvm::CodeModel::Model codeModel,
                     llvm::CodeGenOpt::Level codeGenOptLevel,
-                    bool noFramePointerElim, bool noLinkerStripDead) {
+                    bool noFramePointerElim, bool noLinkerStripDead,
+                    bool compressDebugSections) {
   // Determine target triple. If the user didn't explicitly specify one, use
   // the one set at LLVM configure time.
   llvm::Triple triple;
@@ -488,6 +525,18 @@ createTargetMachine(std::string targetTriple, std::string arch, std::string cpu,
     error(Loc(), "%s", errMsg.c_str());
     fatal();
   }
+  initializeBackend(*target);
+
+  // The host CPU and its features are meaningless for other architectures
+  // (but apply to both the 32 and 64 bit variant of the host's).
+  if (cpu == "native" &&
+      llvm::Triple(llvm::sys::getProcessTriple())
+              .get64BitArchVariant()
+              .getArch() != triple.get64BitArchVariant().getArch()) {
+    warning(Loc(), "-mcpu=native is ignored when targeting a non-host "
+                   "architecture");
+    cpu.clear();
+  }
 
   // Package up features to be passed to target/subtarget.
   llvm::SubtargetFeatures features;
@@ -626,7 +675,22 @@ createTargetMachine(std::string targetTriple, std::string arch, std::string cpu,
     targetOptions.DataSections = true;
   }
 
+  if (compressDebugSections) {
+#if LDC_LLVM_VER >= 500
+    targetOptions.CompressDebugSections = llvm::DebugCompressionType::Z;
+#elif LDC_LLVM_VER >= 400
+    targetOptions.CompressDebugSections = llvm::DebugCompressionType::DCT_Zlib;
+#endif
+  }
+
   return target->createTargetMachine(triple.str(), cpu, features.getString(),
                                      targetOptions, relocModel, codeModel,
                                      codeGenOptLevel);
 }
+
+llvm::TargetMachine *cloneTargetMachine(const llvm::TargetMachine &tm) {
+  return tm.getTarget().createTargetMachine(
+      llvm::Triple(tm.getTargetTriple()).str(), tm.getTargetCPU(),
+      tm.getTargetFeatureString(), tm.Options, tm.getRelocationModel(),
+      tm.getCodeModel(), tm.getOptLevel());
+}
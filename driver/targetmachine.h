@@ -56,7 +56,15 @@ llvm::TargetMachine *createTargetMachine(
     llvm::Reloc::Model relocModel,
 #endif
     llvm::CodeModel::Model codeModel, llvm::CodeGenOpt::Level codeGenOptLevel,
-    bool noFramePointerElim, bool noLinkerStripDead);
+    bool noFramePointerElim, bool noLinkerStripDead,
+    bool compressDebugSections = false);
+
+/**
+ * Creates a fresh LLVM TargetMachine with the same target, CPU, features and
+ * options as the given one, e.g. for use by another codegen thread (a
+ * TargetMachine must not be shared across threads).
+ */
+llvm::TargetMachine *cloneTargetMachine(const llvm::TargetMachine &tm);
 
 /**
  * Returns the Mips ABI which is used for code generation.
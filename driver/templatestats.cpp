@@ -0,0 +1,117 @@
+//===-- templatestats.cpp -------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/templatestats.h"
+
+#include "mars.h"
+#include "template.h"
+#include "driver/cl_options.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace {
+struct Stats {
+  unsigned instances = 0; // only used for the per-template totals
+  unsigned instantiations = 0;
+  double semanticSeconds = 0;
+  unsigned functions = 0;
+  unsigned instructions = 0;
+
+  void add(const Stats &other) {
+    instantiations += other.instantiations;
+    semanticSeconds += other.semanticSeconds;
+    functions += other.functions;
+    instructions += other.instructions;
+  }
+};
+
+llvm::MapVector<TemplateInstance *, Stats> instanceStats;
+
+template <typename Key>
+void printTable(const char *title, const char *firstColumn,
+                const llvm::MapVector<Key, Stats> &table,
+                const char *(*getName)(Key), bool withInstances) {
+  std::vector<std::pair<Key, Stats>> sorted(table.begin(), table.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<Key, Stats> &a,
+                      const std::pair<Key, Stats> &b) {
+                     if (a.second.semanticSeconds != b.second.semanticSeconds)
+                       return a.second.semanticSeconds >
+                              b.second.semanticSeconds;
+                     return a.second.instructions > b.second.instructions;
+                   });
+
+  fprintf(global.stdmsg, "%s\n", title);
+  if (withInstances)
+    fprintf(global.stdmsg, "instances ");
+  fprintf(global.stdmsg, "    count  semantic ms  functions  IR instrs  %s\n",
+          firstColumn);
+  for (const auto &entry : sorted) {
+    const Stats &stats = entry.second;
+    if (withInstances)
+      fprintf(global.stdmsg, "%9u ", stats.instances);
+    fprintf(global.stdmsg, "%9u %12.3f %10u %10u  %s\n", stats.instantiations,
+            stats.semanticSeconds * 1000, stats.functions, stats.instructions,
+            getName(entry.first));
+  }
+}
+}
+
+bool templateStatsEnabled() { return opts::templateStats; }
+
+double templateStatsTimestamp() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void recordTemplateInstantiation(TemplateInstance *ti, double seconds) {
+  Stats &stats = instanceStats[ti];
+  ++stats.instantiations;
+  stats.semanticSeconds += seconds;
+}
+
+void recordTemplateFunction(TemplateInstance *ti, llvm::Function *fn) {
+  Stats &stats = instanceStats[ti];
+  ++stats.functions;
+  for (const auto &bb : *fn)
+    stats.instructions += bb.size();
+}
+
+void printTemplateStats() {
+  if (instanceStats.empty())
+    return;
+
+  // The time of nested instantiations is included in the time of the
+  // enclosing ones.
+  printTable<TemplateInstance *>(
+      "Template instance statistics (inclusive semantic time):", "instance",
+      instanceStats,
+      [](TemplateInstance *ti) -> const char * { return ti->toPrettyChars(); },
+      false);
+
+  llvm::MapVector<Dsymbol *, Stats> templateStats;
+  for (const auto &entry : instanceStats) {
+    // The template declaration is unknown if it couldn't be resolved.
+    if (!entry.first->tempdecl)
+      continue;
+    Stats &stats = templateStats[entry.first->tempdecl];
+    ++stats.instances;
+    stats.add(entry.second);
+  }
+  fprintf(global.stdmsg, "\n");
+  printTable<Dsymbol *>(
+      "Template statistics (summed over the instances):", "template",
+      templateStats,
+      [](Dsymbol *td) -> const char * { return td->toPrettyChars(); }, true);
+}
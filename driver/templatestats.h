@@ -0,0 +1,45 @@
+//===-- driver/templatestats.h - Template instance statistics --*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Accounts the compilation cost of each template instance (-template-stats):
+// how often it is instantiated, the time spent in its semantic analysis, and
+// the number and size of the LLVM functions emitted for it.
+//
+// The instantiations are recorded by the frontend (see
+// driver/templatestats.d).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_TEMPLATESTATS_H
+#define LDC_DRIVER_TEMPLATESTATS_H
+
+class TemplateInstance;
+namespace llvm {
+class Function;
+}
+
+/// Whether -template-stats is in effect.
+bool templateStatsEnabled();
+
+/// Returns a monotonic timestamp in seconds.
+double templateStatsTimestamp();
+
+/// Records an instantiation of `ti` (the primary instance, also if an existing
+/// instance is reused) and the time spent in its (inclusive) semantic
+/// analysis.
+void recordTemplateInstantiation(TemplateInstance *ti, double seconds);
+
+/// Records that `fn` has been defined for (a member of) template instance `ti`.
+void recordTemplateFunction(TemplateInstance *ti, llvm::Function *fn);
+
+/// Prints the statistics, per template instance and per template, sorted by
+/// the semantic analysis time.
+void printTemplateStats();
+
+#endif
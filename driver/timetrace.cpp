@@ -0,0 +1,191 @@
+//===-- timetrace.cpp -----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/timetrace.h"
+
+#include "errors.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  std::string name;
+  std::string detail;
+  Clock::time_point start;
+  Clock::duration duration;
+  unsigned tid;
+};
+
+struct ThreadState {
+  unsigned tid;
+  std::vector<Event> open;
+};
+
+struct Total {
+  Clock::duration duration{};
+  unsigned count = 0;
+};
+
+bool enabled = false;
+Clock::duration granularity;
+Clock::time_point startTime;
+
+// The events are recorded by the main thread and the codegen worker threads.
+std::mutex mutex;
+std::map<std::thread::id, ThreadState> threads;
+std::vector<Event> events;
+llvm::StringMap<Total> totals;
+
+long long microseconds(Clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+void writeEscaped(llvm::raw_ostream &os, llvm::StringRef str) {
+  os << '"';
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (c < 0x20) {
+      os << "\\u00";
+      os.write_hex(c >> 4);
+      os.write_hex(c & 0xf);
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+}
+
+void initializeTimeTrace(unsigned granularityMicroseconds) {
+  granularity = std::chrono::microseconds(granularityMicroseconds);
+  startTime = Clock::now();
+  enabled = true;
+}
+
+bool timeTraceEnabled() { return enabled; }
+
+void timeTraceBegin(const char *name, const char *detail) {
+  if (!enabled)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = threads.find(std::this_thread::get_id());
+  if (it == threads.end()) {
+    ThreadState state;
+    state.tid = threads.size();
+    it = threads.emplace(std::this_thread::get_id(), std::move(state)).first;
+  }
+  ThreadState &thread = it->second;
+  thread.open.push_back(
+      {name, detail ? detail : "", Clock::now(), {}, thread.tid});
+}
+
+void timeTraceEnd() {
+  if (!enabled)
+    return;
+
+  const auto now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex);
+  ThreadState &thread = threads[std::this_thread::get_id()];
+  assert(!thread.open.empty() && "unbalanced time trace events");
+  Event event = std::move(thread.open.back());
+  thread.open.pop_back();
+  event.duration = now - event.start;
+
+  // Recursive events (e.g. nested template instantiations) only count once
+  // towards the total.
+  bool nested = false;
+  for (const auto &outer : thread.open) {
+    if (outer.name == event.name) {
+      nested = true;
+      break;
+    }
+  }
+  if (!nested) {
+    Total &total = totals[event.name];
+    total.duration += event.duration;
+    ++total.count;
+  }
+
+  if (event.duration >= granularity)
+    events.push_back(std::move(event));
+}
+
+void writeTimeTrace(const char *filename) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+#if LDC_LLVM_VER >= 306
+  std::error_code ec;
+  llvm::raw_fd_ostream os(filename, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    error(Loc(), "cannot write time trace file '%s': %s", filename,
+          ec.message().c_str());
+    return;
+  }
+#else
+  std::string errinfo;
+  llvm::raw_fd_ostream os(filename, errinfo, llvm::sys::fs::F_Text);
+  if (!errinfo.empty()) {
+    error(Loc(), "cannot write time trace file '%s': %s", filename,
+          errinfo.c_str());
+    return;
+  }
+#endif
+
+  os << "{\"traceEvents\":[\n";
+  for (const auto &event : events) {
+    os << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid
+       << ",\"ts\":" << microseconds(event.start - startTime)
+       << ",\"dur\":" << microseconds(event.duration) << ",\"name\":";
+    writeEscaped(os, event.name);
+    if (!event.detail.empty()) {
+      os << ",\"args\":{\"detail\":";
+      writeEscaped(os, event.detail);
+      os << '}';
+    }
+    os << "},\n";
+  }
+
+  // The totals are shown as separate rows, sorted by their duration.
+  std::vector<std::pair<llvm::StringRef, Total>> sortedTotals;
+  for (const auto &entry : totals)
+    sortedTotals.emplace_back(entry.getKey(), entry.getValue());
+  std::sort(sortedTotals.begin(), sortedTotals.end(),
+            [](const std::pair<llvm::StringRef, Total> &a,
+               const std::pair<llvm::StringRef, Total> &b) {
+              return a.second.duration > b.second.duration;
+            });
+  unsigned tid = threads.size();
+  for (const auto &entry : sortedTotals) {
+    const Total &total = entry.second;
+    os << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid++
+       << ",\"ts\":0,\"dur\":" << microseconds(total.duration)
+       << ",\"name\":";
+    writeEscaped(os, ("Total " + entry.first).str());
+    os << ",\"args\":{\"count\":" << total.count
+       << ",\"avg us\":" << microseconds(total.duration) / total.count
+       << "}},\n";
+  }
+
+  os << "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"process_name\","
+        "\"args\":{\"name\":\"ldc2\"}}\n";
+  os << "]}\n";
+}
@@ -0,0 +1,58 @@
+//===-- driver/timetrace.h - Compile-time trace events ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Records nested, timed events of the compilation (-ftime-trace) and writes
+// them in the Chrome trace event format, which can be viewed with
+// chrome://tracing or https://ui.perfetto.dev.
+//
+// The begin/end functions are also used by the frontend (see
+// driver/timetrace.d).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_TIMETRACE_H
+#define LDC_DRIVER_TIMETRACE_H
+
+/// Starts recording events, dropping the ones shorter than the given number
+/// of microseconds.
+void initializeTimeTrace(unsigned granularityMicroseconds);
+
+/// Whether events are being recorded.
+bool timeTraceEnabled();
+
+/// Opens an event of the calling thread. `detail` may be null.
+void timeTraceBegin(const char *name, const char *detail);
+
+/// Closes the innermost open event of the calling thread.
+void timeTraceEnd();
+
+/// Writes the recorded events (plus a total per event name) to the given
+/// file, as Chrome trace JSON.
+void writeTimeTrace(const char *filename);
+
+/// Records an event for its lifetime if time tracing is enabled.
+class TimeTraceScope {
+  bool enabled;
+
+public:
+  explicit TimeTraceScope(const char *name, const char *detail = nullptr)
+      : enabled(timeTraceEnabled()) {
+    if (enabled)
+      timeTraceBegin(name, detail);
+  }
+  ~TimeTraceScope() {
+    if (enabled)
+      timeTraceEnd();
+  }
+
+  TimeTraceScope(const TimeTraceScope &) = delete;
+  TimeTraceScope &operator=(const TimeTraceScope &) = delete;
+};
+
+#endif
@@ -9,9 +9,14 @@
 
 #include "driver/toobj.h"
 
+#include "rmem.h"
 #include "driver/cl_options.h"
 #include "driver/cache.h"
+#include "driver/jit.h"
+#include "driver/jobserver.h"
+#include "driver/statistics.h"
 #include "driver/targetmachine.h"
+#include "driver/timetrace.h"
 #include "driver/tool.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
@@ -28,6 +33,7 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Program.h"
 #if LDC_LLVM_VER >= 307
 #include "llvm/Support/Path.h"
@@ -40,8 +46,31 @@
 #include "llvm/Target/TargetSubtargetInfo.h"
 #endif
 #include "llvm/IR/Module.h"
+#include "llvm/Support/MD5.h"
+#if LDC_LLVM_VER >= 309
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#endif
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#endif
+#if LDC_LLVM_VER >= 400
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/YAMLTraits.h"
+#endif
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
 #include <cstddef>
+#include <cstdio>
+#include <deque>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #if LDC_LLVM_VER >= 306
 using LLErrorInfo = std::error_code;
@@ -55,6 +84,11 @@ static llvm::cl::opt<bool>
     NoIntegratedAssembler("no-integrated-as", llvm::cl::Hidden,
                           llvm::cl::desc("Disable integrated assembler"));
 
+static llvm::cl::opt<llvm::cl::boolOrDefault> annotateLL(
+    "annotate-ll", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Annotate the -output-ll IR with use counts, types and "
+                   "debug info as comments (default: only with debug info)"));
+
 // based on llc code, University of Illinois Open Source License
 static void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
                           llvm::raw_fd_ostream &out,
@@ -106,7 +140,40 @@ static void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
   Passes.run(m);
 }
 
-static void assemble(const std::string &asmpath, const std::string &objpath) {
+namespace {
+/// Formats the message of an error encountered while writing a module.
+///
+/// Modules may be written by codegen worker threads, which must neither use
+/// the frontend's error reporting nor abort the compilation via fatal(). So
+/// the writing functions return the first error to their caller, and only the
+/// main thread reports it (see reportFatal()).
+std::string formatError(const char *format, ...) IS_PRINTF(1);
+std::string formatError(const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  const int size = vsnprintf(nullptr, 0, format, ap);
+  va_end(ap);
+  if (size < 0) {
+    return format;
+  }
+  std::string result(size + 1, '\0');
+  va_start(ap, format);
+  vsnprintf(&result[0], result.size(), format, ap);
+  va_end(ap);
+  result.resize(size);
+  return result;
+}
+
+/// Reports an error returned by the module writing functions and aborts the
+/// compilation. Only to be called on the main thread.
+void reportFatal(const std::string &message) {
+  error(Loc(), "%s", message.c_str());
+  fatal();
+}
+}
+
+static bool assemble(const std::string &asmpath, const std::string &objpath,
+                     std::string &errorMessage) {
   std::vector<std::string> args;
   args.push_back("-O3");
   args.push_back("-c");
@@ -157,11 +224,45 @@ static void assemble(const std::string &asmpath, const std::string &objpath) {
 
   // Run the compiler to assembly the program.
   std::string gcc(getGcc());
-  int R = executeToolAndWait(gcc, args, global.params.verbose);
+  int R = executeToolAndWait(gcc, args, global.params.verbose,
+                             ResponseFileStyle::GNU);
   if (R) {
-    error(Loc(), "Error while invoking external assembler.");
-    fatal();
+    errorMessage = "Error while invoking external assembler.";
+    return false;
   }
+  return true;
+}
+
+std::string getDwarfObjectFileName(const std::string &objectFile) {
+  llvm::SmallString<128> path(objectFile);
+  llvm::sys::fs::make_absolute(path);
+  llvm::sys::path::replace_extension(path, "dwo");
+  return path.str();
+}
+
+/// Moves the .dwo sections of the given ELF object file into the separate
+/// .dwo file, the same way GCC and clang do for -gsplit-dwarf.
+static bool extractDwarfObject(const std::string &objpath,
+                               std::string &errorMessage) {
+  std::string objcopy(getProgram("objcopy", "OBJCOPY"));
+
+  std::vector<std::string> args;
+  args.push_back("--extract-dwo");
+  args.push_back(objpath);
+  args.push_back(getDwarfObjectFileName(objpath));
+  if (executeToolAndWait(objcopy, args, global.params.verbose)) {
+    errorMessage = "Error while extracting split DWARF debug info.";
+    return false;
+  }
+
+  args.clear();
+  args.push_back("--strip-dwo");
+  args.push_back(objpath);
+  if (executeToolAndWait(objcopy, args, global.params.verbose)) {
+    errorMessage = "Error while stripping split DWARF debug info.";
+    return false;
+  }
+  return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -187,20 +288,34 @@ static void printDebugLoc(const DebugLoc &debugLoc, formatted_raw_ostream &os) {
 }
 
 class AssemblyAnnotator : public AssemblyAnnotationWriter {
+#if LDC_LLVM_VER < 308
+  const llvm::Module &M;
+  // Collected on the first lookup only, as it walks the whole module.
+  llvm::DebugInfoFinder Finder;
+  bool FinderProcessed = false;
+#endif
+
 // Find the MDNode which corresponds to the DISubprogram data that described F.
 #if LDC_LLVM_VER >= 307
-  static DISubprogram *FindSubprogram(const Function *F,
-                                      DebugInfoFinder &Finder)
+  DISubprogram *FindSubprogram(const Function *F)
 #else
-  static MDNode *FindSubprogram(const Function *F, DebugInfoFinder &Finder)
+  MDNode *FindSubprogram(const Function *F)
 #endif
   {
-#if LDC_LLVM_VER >= 307
+#if LDC_LLVM_VER >= 308
+    return F->getSubprogram();
+#else
+    if (!FinderProcessed) {
+      Finder.processModule(M);
+      FinderProcessed = true;
+    }
+#endif
+#if LDC_LLVM_VER == 307
     for (DISubprogram *Subprogram : Finder.subprograms())
       if (Subprogram->describes(F))
         return Subprogram;
     return nullptr;
-#else
+#elif LDC_LLVM_VER < 307
     for (DISubprogram Subprogram : Finder.subprograms()) {
       if (Subprogram.describes(F)) {
         return Subprogram;
@@ -210,13 +325,11 @@ class AssemblyAnnotator : public AssemblyAnnotationWriter {
 #endif
   }
 
-  static llvm::StringRef GetDisplayName(const Function *F) {
-    llvm::DebugInfoFinder Finder;
-    Finder.processModule(*F->getParent());
+  llvm::StringRef GetDisplayName(const Function *F) {
 #if LDC_LLVM_VER >= 307
-    if (DISubprogram *N = FindSubprogram(F, Finder))
+    if (DISubprogram *N = FindSubprogram(F))
 #else
-    if (MDNode *N = FindSubprogram(F, Finder))
+    if (MDNode *N = FindSubprogram(F))
 #endif
     {
 #if LDC_LLVM_VER >= 307
@@ -230,6 +343,12 @@ class AssemblyAnnotator : public AssemblyAnnotationWriter {
   }
 
 public:
+#if LDC_LLVM_VER < 308
+  explicit AssemblyAnnotator(const llvm::Module &M) : M(M) {}
+#else
+  explicit AssemblyAnnotator(const llvm::Module &) {}
+#endif
+
   void emitFunctionAnnot(const Function *F,
                          formatted_raw_ostream &os) LLVM_OVERRIDE {
     os << "; [#uses = " << F->getNumUses() << ']';
@@ -344,8 +463,12 @@ public:
   }
 };
 
-void writeObjectFile(llvm::Module *m, std::string &filename) {
+bool writeObjectFile(llvm::TargetMachine &Target, llvm::Module *m,
+                     const std::string &filename, std::string &errorMessage) {
   IF_LOG Logger::println("Writing object file to: %s", filename.c_str());
+  // The output file may be a link to a file in the IR-to-object cache from a
+  // previous build; don't write through it.
+  llvm::sys::fs::remove(filename);
   LLErrorInfo errinfo;
   {
     llvm::raw_fd_ostream out(filename.c_str(), errinfo, llvm::sys::fs::F_None);
@@ -355,72 +478,223 @@ void writeObjectFile(llvm::Module *m, std::string &filename) {
     if (errinfo.empty())
 #endif
     {
-      codegenModule(*gTargetMachine, *m, out,
-                    llvm::TargetMachine::CGFT_ObjectFile);
+      codegenModule(Target, *m, out, llvm::TargetMachine::CGFT_ObjectFile);
     } else {
-      error(Loc(), "cannot write object file '%s': %s", filename.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      errorMessage = formatError("cannot write object file '%s': %s",
+                                 filename.c_str(), ERRORINFO_STRING(errinfo));
+      return false;
     }
   }
+  return true;
 }
-} // end of anonymous namespace
 
-void writeModule(llvm::Module *m, std::string filename) {
+#if LDC_LLVM_VER >= 309
+/// Splits the given (optimized) module into filenames.size() partitions and
+/// concurrently emits the machine code for each of them into the respective
+/// object file.
+bool writePartitionedObjectFiles(llvm::TargetMachine &Target, llvm::Module *m,
+                                 const std::vector<std::string> &filenames,
+                                 std::string &errorMessage) {
+  IF_LOG Logger::println("Writing %llu object file partitions",
+                         static_cast<unsigned long long>(filenames.size()));
+
+  std::vector<std::unique_ptr<llvm::raw_fd_ostream>> streams;
+  std::vector<llvm::raw_pwrite_stream *> outputs;
+  for (const auto &filename : filenames) {
+    std::error_code errinfo;
+    streams.emplace_back(llvm::make_unique<llvm::raw_fd_ostream>(
+        filename, errinfo, llvm::sys::fs::F_None));
+    if (errinfo) {
+      errorMessage = formatError("cannot write object file '%s': %s",
+                                 filename.c_str(), errinfo.message().c_str());
+      return false;
+    }
+    outputs.push_back(streams.back().get());
+  }
+
+  // splitCodeGen() takes ownership of the module, which is still owned by the
+  // IRState (or the codegen pool) here, so hand it a copy. Local symbols are
+  // preserved (i.e. kept in the partition referencing them) to avoid promoting
+  // them to (hidden) globals, which might clash with other objects.
+  llvm::splitCodeGen(
+      llvm::CloneModule(m), outputs, {},
+      [&Target]() {
+        return std::unique_ptr<llvm::TargetMachine>(
+            cloneTargetMachine(Target));
+      },
+      llvm::TargetMachine::CGFT_ObjectFile, /*PreserveLocals=*/true);
+  return true;
+}
+#endif
+
+#if LDC_LLVM_VER >= 309
+/// Writes the module as LLVM bitcode to the object file, to be optimized and
+/// compiled by the linker's LTO plugin. For ThinLTO, the bitcode includes the
+/// module summary index used by the linker to decide on cross-module imports.
+bool writeLTOObjectFile(llvm::Module &m, const std::string &filename,
+                        std::string &errorMessage) {
+  IF_LOG Logger::println("Writing LTO bitcode object file to: %s",
+                         filename.c_str());
+  // The output file may be a link to a file in the IR-to-object cache from a
+  // previous build; don't write through it.
+  llvm::sys::fs::remove(filename);
+  LLErrorInfo errinfo;
+  llvm::raw_fd_ostream out(filename.c_str(), errinfo, llvm::sys::fs::F_None);
+  if (out.has_error()) {
+    errorMessage = formatError("cannot write object file '%s': %s",
+                               filename.c_str(), ERRORINFO_STRING(errinfo));
+    return false;
+  }
+
+  if (!opts::isUsingThinLTO()) {
+    llvm::WriteBitcodeToFile(&m, out);
+    return true;
+  }
+
+  // When the function frequency info callback is null, LLVM computes the
+  // frequencies itself.
+#if LDC_LLVM_VER >= 400
+  llvm::ProfileSummaryInfo PSI(m);
+  auto index = llvm::buildModuleSummaryIndex(m, nullptr, &PSI);
+  llvm::WriteBitcodeToFile(&m, out, /*ShouldPreserveUseListOrder=*/true,
+                           &index, /*GenerateHash=*/true);
+#else
+  llvm::ModuleSummaryIndexBuilder indexBuilder(&m, nullptr);
+  llvm::WriteBitcodeToFile(&m, out, /*ShouldPreserveUseListOrder=*/true,
+                           &indexBuilder.getIndex(), /*GenerateHash=*/true);
+#endif
+  return true;
+}
+#endif
+
+bool shouldAssembleExternally() {
   // There is no integrated assembler on AIX because XCOFF is not supported.
   // Starting with LLVM 3.5 the integrated assembler can be used with MinGW.
-  bool const assembleExternally =
-      global.params.output_o &&
-      (NoIntegratedAssembler ||
-       global.params.targetTriple->getOS() == llvm::Triple::AIX);
+  // With LTO, the object files contain bitcode and assembling is up to the
+  // linker.
+  return global.params.output_o && !opts::isUsingLTO() &&
+         (NoIntegratedAssembler ||
+          global.params.targetTriple->getOS() == llvm::Triple::AIX);
+}
 
-  // Use cached object code if possible
-  bool useIR2ObjCache = !opts::cacheDir.empty();
-  llvm::SmallString<32> moduleHash;
-  if (useIR2ObjCache && global.params.output_o && !assembleExternally) {
-    llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
-    llvm::sys::fs::make_absolute(cacheDir);
-    opts::cacheDir = cacheDir.c_str();
+/// Without debug info, the annotations only consist of use counts and a few
+/// types, which are not worth the time they take for large modules.
+bool shouldAnnotateLL() {
+  if (annotateLL == llvm::cl::BOU_UNSET)
+    return global.params.symdebug != 0;
+  return annotateLL == llvm::cl::BOU_TRUE;
+}
 
-    IF_LOG Logger::println("Use IR-to-Object cache in %s",
-                           opts::cacheDir.c_str());
-    LOG_SCOPE
+/// Returns the requested output files for the module written to the given
+/// object file name which can be cached, together with the cache file
+/// extension for each.
+std::vector<std::pair<std::string, const char *>>
+getCacheableOutputs(const std::string &filename) {
+  std::vector<std::pair<std::string, const char *>> result;
+  auto add = [&](const char *ext) {
+    llvm::SmallString<128> path(filename);
+    llvm::sys::path::replace_extension(path, ext);
+    result.emplace_back(path.str(), ext);
+  };
+  if (global.params.output_bc)
+    add(global.bc_ext);
+  if (global.params.output_ll)
+    add(global.ll_ext);
+  if (global.params.output_s)
+    add(global.s_ext);
+  if (global.params.output_o) {
+    if (opts::splitDwarf)
+      add("dwo");
+    result.emplace_back(filename, global.obj_ext);
+  }
+  return result;
+}
 
-    cache::calculateModuleHash(m, moduleHash);
-    std::string cacheFile = cache::cacheLookup(moduleHash);
-    if (!cacheFile.empty()) {
-      cache::recoverObjectFile(moduleHash, filename);
+#if LDC_LLVM_VER >= 400
+/// Records the optimization remarks emitted for a module (by the optimizer
+/// and the backend) in a YAML file next to its object file while in scope.
+class OptimizationRecordScope {
+  llvm::LLVMContext *context = nullptr;
+  std::unique_ptr<llvm::tool_output_file> file;
+
+public:
+  /// Sets errorMessage if the file cannot be written.
+  OptimizationRecordScope(llvm::Module &m, const std::string &filename,
+                          std::string &errorMessage) {
+    if (!opts::saveOptimizationRecord)
+      return;
+
+    llvm::SmallString<128> path(filename);
+    llvm::sys::path::replace_extension(path, "opt.yaml");
+    std::error_code errinfo;
+    file = llvm::make_unique<llvm::tool_output_file>(path, errinfo,
+                                                     llvm::sys::fs::F_None);
+    if (errinfo) {
+      errorMessage =
+          formatError("cannot write optimization record file '%s': %s",
+                      path.c_str(), errinfo.message().c_str());
+      file.reset();
       return;
     }
+
+    context = &m.getContext();
+    context->setDiagnosticsOutputFile(
+        llvm::make_unique<llvm::yaml::Output>(file->os()));
   }
 
+  ~OptimizationRecordScope() {
+    if (!context)
+      return;
+    context->setDiagnosticsOutputFile(nullptr);
+    file->keep();
+  }
+};
+#endif
+
+/// Runs the optimizer on the given module and writes all requested output
+/// files. If moduleHash is not empty, the output files are added to the cache.
+/// If objectPartitions contains more than one file name, the object code is
+/// split into several object files (which are not cached).
+///
+/// May be called from codegen worker threads, so must only use the given
+/// target machine. Returns the message of the first error encountered, or an
+/// empty string on success; reporting it is up to the caller.
+std::string emitModule(llvm::TargetMachine &targetMachine, llvm::Module *m,
+                       const std::string &filename, llvm::StringRef moduleHash,
+                       const std::vector<std::string> &objectPartitions = {}) {
+  bool const assembleExternally = shouldAssembleExternally();
+  const auto startTime = std::chrono::steady_clock::now();
+  std::string errorMessage;
+
+#if LDC_LLVM_VER >= 400
+  OptimizationRecordScope optimizationRecord(*m, filename, errorMessage);
+  if (!errorMessage.empty()) {
+    return errorMessage;
+  }
+#endif
+
   // run optimizer
-  ldc_optimize_module(m);
+  ldc_optimize_module(m, targetMachine);
+  if (stats::isEnabled()) {
+    stats::counters().irInstructionsOptimized += stats::countInstructions(*m);
+  }
+
+  TimeTraceScope timeTraceScope("Emit output files", filename.c_str());
 
   // eventually do our own path stuff, dmd's is a bit strange.
   using LLPath = llvm::SmallString<128>;
 
-  // make sure the output directory exists
-  const auto directory = llvm::sys::path::parent_path(filename);
-  if (!directory.empty()) {
-    if (auto ec = llvm::sys::fs::create_directories(directory)) {
-      error(Loc(), "failed to create output directory: %s\n%s",
-            directory.data(), ec.message().c_str());
-      fatal();
-    }
-  }
-
   // write LLVM bitcode
   if (global.params.output_bc) {
     LLPath bcpath(filename);
     llvm::sys::path::replace_extension(bcpath, global.bc_ext);
     Logger::println("Writing LLVM bitcode to: %s\n", bcpath.c_str());
+    llvm::sys::fs::remove(bcpath.str()); // may be a link into the cache
     LLErrorInfo errinfo;
     llvm::raw_fd_ostream bos(bcpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (bos.has_error()) {
-      error(Loc(), "cannot write LLVM bitcode file '%s': %s", bcpath.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      return formatError("cannot write LLVM bitcode file '%s': %s",
+                         bcpath.c_str(), ERRORINFO_STRING(errinfo));
     }
     llvm::WriteBitcodeToFile(m, bos);
   }
@@ -430,15 +704,21 @@ void writeModule(llvm::Module *m, std::string filename) {
     LLPath llpath(filename);
     llvm::sys::path::replace_extension(llpath, global.ll_ext);
     Logger::println("Writing LLVM IR to: %s\n", llpath.c_str());
+    llvm::sys::fs::remove(llpath.str()); // may be a link into the cache
     LLErrorInfo errinfo;
     llvm::raw_fd_ostream aos(llpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (aos.has_error()) {
-      error(Loc(), "cannot write LLVM IR file '%s': %s", llpath.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      return formatError("cannot write LLVM IR file '%s': %s", llpath.c_str(),
+                         ERRORINFO_STRING(errinfo));
+    }
+    // The IR text of large modules is big; write it in large chunks.
+    aos.SetBufferSize(1 << 20);
+    if (shouldAnnotateLL()) {
+      AssemblyAnnotator annotator(*m);
+      m->print(aos, &annotator);
+    } else {
+      m->print(aos, nullptr);
     }
-    AssemblyAnnotator annotator;
-    m->print(aos, &annotator);
   }
 
   // write native assembly
@@ -450,6 +730,9 @@ void writeModule(llvm::Module *m, std::string filename) {
     }
 
     Logger::println("Writing asm to: %s\n", spath.c_str());
+    if (global.params.output_s) {
+      llvm::sys::fs::remove(spath.str()); // may be a link into the cache
+    }
     LLErrorInfo errinfo;
     {
       llvm::raw_fd_ostream out(spath.c_str(), errinfo, llvm::sys::fs::F_None);
@@ -459,29 +742,473 @@ void writeModule(llvm::Module *m, std::string filename) {
       if (errinfo.empty())
 #endif
       {
-        codegenModule(*gTargetMachine, *m, out,
+        codegenModule(targetMachine, *m, out,
                       llvm::TargetMachine::CGFT_AssemblyFile);
       } else {
-        error(Loc(), "cannot write asm: %s", ERRORINFO_STRING(errinfo));
-        fatal();
+        return formatError("cannot write asm: %s", ERRORINFO_STRING(errinfo));
       }
     }
 
+    bool assembled = true;
     if (assembleExternally) {
-      assemble(spath.str(), filename);
+      llvm::sys::fs::remove(filename); // may be a link into the cache
+      assembled = assemble(spath.str(), filename, errorMessage);
     }
 
     if (!global.params.output_s) {
       llvm::sys::fs::remove(spath.str());
     }
+    if (!assembled) {
+      return errorMessage;
+    }
   }
 
+  bool partitioned = false;
   if (global.params.output_o && !assembleExternally) {
-    writeObjectFile(m, filename);
-    if (useIR2ObjCache) {
-      cache::cacheObjectFile(filename, moduleHash);
+#if LDC_LLVM_VER >= 309
+    partitioned = objectPartitions.size() > 1;
+    if (opts::isUsingLTO()) {
+      if (!writeLTOObjectFile(*m, filename, errorMessage))
+        return errorMessage;
+    } else if (partitioned) {
+      if (!writePartitionedObjectFiles(targetMachine, m, objectPartitions,
+                                       errorMessage))
+        return errorMessage;
+    } else
+#endif
+    {
+      if (!writeObjectFile(targetMachine, m, filename, errorMessage))
+        return errorMessage;
+    }
+  }
+
+  if (global.params.output_o && opts::splitDwarf &&
+      !extractDwarfObject(filename, errorMessage)) {
+    return errorMessage;
+  }
+
+  if (!moduleHash.empty()) {
+    // Attribute the codegen time to the last output (the object file, if
+    // requested) for the -cache-stats estimates.
+    const auto outputs = getCacheableOutputs(filename);
+    const auto codegenMillis =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - startTime)
+            .count();
+    for (const auto &output : outputs) {
+      if (partitioned && output.first == filename) {
+        continue;
+      }
+      const bool last = &output == &outputs.back();
+      errorMessage = cache::cacheObjectFile(
+          output.first, moduleHash, output.second,
+          last ? static_cast<unsigned>(codegenMillis) : 0);
+      if (!errorMessage.empty()) {
+        return errorMessage;
+      }
+    }
+  }
+  return "";
+}
+
+/// Returns the name of the i-th additional object file emitted for the given
+/// one (e.g. `foo_part1.o`) and registers it as object file to be linked or
+/// archived.
+std::string addExtraObjectFile(const std::string &filename, const char *tag,
+                               unsigned i) {
+  llvm::SmallString<128> path(llvm::sys::path::parent_path(filename));
+  llvm::sys::path::append(path, llvm::sys::path::stem(filename) + tag +
+                                    llvm::Twine(i) + "." + global.obj_ext);
+  global.params.objfiles->push(mem.xstrdup(path.c_str()));
+  return path.str();
+}
+
+/// Returns the object file names to be used for splitting the machine code of
+/// a -singleobj module into several partitions, which are emitted in parallel
+/// (see -parallel-codegen). The first one is the regular object file name.
+///
+/// Only done if the compiler links or archives the object files itself, as
+/// this setting changes the set of files it produces. Additional partitions
+/// are registered as object files to be linked/archived.
+std::vector<std::string> getObjectPartitions(const std::string &filename) {
+  std::vector<std::string> result;
+#if LDC_LLVM_VER >= 309
+  unsigned const numPartitions = opts::parallelCodegen;
+  if (!global.params.oneobj || numPartitions < 2 || opts::isUsingLTO() ||
+      opts::splitDwarf ||
+      !(global.params.link || global.params.lib)) {
+    return result;
+  }
+
+  result.push_back(filename);
+  for (unsigned i = 1; i < numPartitions; ++i) {
+    result.push_back(addExtraObjectFile(filename, "_part", i));
+  }
+#endif
+  return result;
+}
+
+#if LDC_LLVM_VER >= 307
+/// A set of worker threads optimizing and emitting modules in the background,
+/// each with its own TargetMachine.
+///
+/// The LLVMContext the frontend generates IR into is not thread-safe, so
+/// modules are handed over as in-memory bitcode and each job is read back
+/// into a fresh context on the worker thread.
+class CodegenPool {
+public:
+  explicit CodegenPool(unsigned numThreads) {
+    for (unsigned i = 0; i < numThreads; ++i) {
+      // Clone on the main thread, gTargetMachine is not to be touched by the
+      // workers.
+      llvm::TargetMachine *tm = cloneTargetMachine(*gTargetMachine);
+      workers.emplace_back([this, tm] { work(tm); });
+    }
+  }
+
+  ~CodegenPool() { join(); }
+
+  /// Waits for all pending jobs to be finished.
+  void join() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shutdown = true;
+    }
+    available.notify_all();
+    for (auto &worker : workers) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+  }
+
+  /// Returns the first error a worker has run into, if any. The workers can't
+  /// abort the compilation themselves, fatal() is only to be called on the
+  /// main thread.
+  std::string getError() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return firstError;
+  }
+
+  CodegenPool(CodegenPool const &) = delete;
+  CodegenPool &operator=(CodegenPool const &) = delete;
+
+  /// Schedules the given module to be written. Doesn't block, see throttle().
+  void submit(llvm::Module &m, const std::string &filename,
+              llvm::StringRef moduleHash) {
+    Job job;
+    {
+      // Preserve the use-list order, as it can influence the optimizer and
+      // the output must not depend on whether modules are written in
+      // parallel.
+      llvm::raw_svector_ostream os(job.bitcode);
+      llvm::WriteBitcodeToFile(&m, os, /*ShouldPreserveUseListOrder=*/true);
+    }
+    job.moduleId = m.getModuleIdentifier();
+    job.filename = filename;
+    job.moduleHash = moduleHash;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+    }
+    available.notify_one();
+  }
+
+  /// Blocks while there are as many jobs waiting for a worker as there are
+  /// workers, so that IR generation runs at most one module ahead per worker
+  /// and memory usage stays bounded.
+  void throttle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    consumed.wait(lock, [this] { return jobs.size() < workers.size(); });
+  }
+
+private:
+  struct Job {
+    llvm::SmallVector<char, 0> bitcode;
+    std::string moduleId;
+    std::string filename;
+    std::string moduleHash;
+  };
+
+  void work(llvm::TargetMachine *tm) {
+    std::unique_ptr<llvm::TargetMachine> targetMachine(tm);
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return shutdown || !jobs.empty(); });
+        if (jobs.empty()) {
+          return;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      consumed.notify_one();
+
+      llvm::LLVMContext context;
+#if LDC_LLVM_VER >= 309
+      if (!global.params.output_ll) {
+        context.setDiscardValueNames(true);
+      }
+#endif
+      // The buffer identifier becomes the module identifier.
+      llvm::MemoryBufferRef buffer(
+          llvm::StringRef(job.bitcode.data(), job.bitcode.size()),
+          job.moduleId);
+      auto module = llvm::parseBitcodeFile(buffer, context);
+      if (!module) {
+#if LDC_LLVM_VER >= 400
+        const std::string message = llvm::toString(module.takeError());
+#else
+        const std::string message = module.getError().message();
+#endif
+        setError("failed to read back module for '" + job.filename +
+                 "': " + message);
+        continue;
+      }
+      job.bitcode.clear();
+
+      std::string message = emitModule(*targetMachine, module->get(),
+                                       job.filename, job.moduleHash);
+      if (!message.empty()) {
+        setError(std::move(message));
+      }
     }
   }
+
+  void setError(std::string message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (firstError.empty()) {
+      firstError = std::move(message);
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<Job> jobs;
+  std::mutex mutex;
+  std::condition_variable available;
+  std::condition_variable consumed;
+  bool shutdown = false;
+  std::string firstError;
+};
+
+// Intentionally not a smart pointer: if the main thread aborts the compilation
+// via fatal() while workers are running, the pool must not be torn down by
+// static destructors.
+CodegenPool *codegenPool = nullptr;
+#endif
+
+/// Optimizes and emits the given module, in the background if parallel
+/// codegen is enabled.
+void scheduleModule(llvm::Module *m, const std::string &filename,
+                    llvm::StringRef moduleHash, bool allowPartitions = true) {
+#if LDC_LLVM_VER >= 307
+  // The logger is not thread-safe, so keep everything on the main thread if
+  // it is enabled (possibly just for this module via pragma).
+  if (codegenPool && !Logger::enabled()) {
+    codegenPool->submit(*m, filename, moduleHash);
+    // Abort early if a worker has already failed.
+    const std::string workerError = codegenPool->getError();
+    if (!workerError.empty()) {
+      reportFatal(workerError);
+    }
+    return;
+  }
+#endif
+
+  const std::string message =
+      emitModule(*gTargetMachine, m, filename, moduleHash,
+                 allowPartitions ? getObjectPartitions(filename)
+                                 : std::vector<std::string>());
+  if (!message.empty()) {
+    reportFatal(message);
+  }
+}
+
+#if LDC_LLVM_VER >= 309
+/// Whether the module is to be split into separately cached fragments (see
+/// -cache-fragments). This changes the set of object files produced, so it is
+/// only done if the compiler links or archives them itself.
+bool useCacheFragments() {
+  return opts::cacheFragments >= 2 && !opts::cacheDir.empty() &&
+         !opts::isUsingLTO() && !opts::splitDwarf &&
+         global.params.output_o && !global.params.output_bc &&
+         !global.params.output_ll && !global.params.output_s &&
+         !shouldAssembleExternally() &&
+         (global.params.link || global.params.lib);
+}
+
+/// Splits the (not yet optimized) module into fragments and writes each one
+/// to its own object file, using the cache on a per-fragment basis.
+///
+/// The fragments are determined by llvm::SplitModule() based on a hash of the
+/// symbol (or comdat) names, so the assignment of a symbol to its fragment is
+/// stable across compilations, and an edit to one function only invalidates
+/// the cached code for the fragment containing it.
+void writeCachedFragments(llvm::Module *m, const std::string &filename) {
+  std::unique_ptr<llvm::Module> clone = llvm::CloneModule(m);
+
+  // SplitModule() turns all symbols with local linkage into hidden globals to
+  // be able to reference them across fragments. Make their names unique to
+  // this module to avoid clashes with the ones of other modules.
+  llvm::MD5 hasher;
+  hasher.update(m->getModuleIdentifier());
+  llvm::MD5::MD5Result hash;
+  hasher.final(hash);
+  llvm::SmallString<32> hashStr;
+  llvm::MD5::stringifyResult(hash, hashStr);
+  const std::string suffix = (".frag" + hashStr.str().substr(0, 8)).str();
+
+  auto uniquifyLocal = [&suffix](llvm::GlobalValue &gv) {
+    if (gv.hasLocalLinkage()) {
+      gv.setName(gv.getName() + suffix);
+    }
+  };
+  for (auto &f : clone->functions()) {
+    uniquifyLocal(f);
+  }
+  for (auto &gv : clone->globals()) {
+    uniquifyLocal(gv);
+  }
+  for (auto &ga : clone->aliases()) {
+    uniquifyLocal(ga);
+  }
+
+  unsigned index = 0;
+  unsigned numHits = 0;
+  llvm::SplitModule(
+      std::move(clone), opts::cacheFragments,
+      [&](std::unique_ptr<llvm::Module> fragment) {
+        const std::string fragmentFile =
+            index == 0 ? filename : addExtraObjectFile(filename, "_frag", index);
+        ++index;
+
+        llvm::SmallString<32> fragmentHash;
+        cache::calculateModuleHash(fragment.get(), fragmentHash);
+        if (!cache::cacheLookup(fragmentHash, global.obj_ext).empty() &&
+            cache::recoverObjectFile(fragmentHash, global.obj_ext,
+                                     fragmentFile)) {
+          ++numHits;
+          return;
+        }
+
+        scheduleModule(fragment.get(), fragmentFile, fragmentHash,
+                       /*allowPartitions=*/false);
+      });
+
+  IF_LOG Logger::println("Cache hits for %u of %u module fragments", numHits,
+                         index);
+}
+#endif
+} // end of anonymous namespace
+
+void startParallelCodegen(unsigned numThreads) {
+  if (numThreads == 0) {
+    return;
+  }
+#if LDC_LLVM_VER >= 307
+  assert(!codegenPool);
+  // Each worker thread runs a job in addition to the main thread's one.
+  numThreads = jobserver::acquire(numThreads);
+  if (numThreads == 0) {
+    return;
+  }
+  codegenPool = new CodegenPool(numThreads);
+#else
+  warning(Loc(), "-parallel-codegen requires LLVM 3.7 or later, ignoring");
+#endif
+}
+
+void throttleParallelCodegen() {
+#if LDC_LLVM_VER >= 307
+  if (codegenPool) {
+    codegenPool->throttle();
+  }
+#endif
+}
+
+void finishParallelCodegen() {
+#if LDC_LLVM_VER >= 307
+  std::string workerError;
+  if (codegenPool) {
+    codegenPool->join();
+    workerError = codegenPool->getError();
+  }
+  delete codegenPool;
+  codegenPool = nullptr;
+  jobserver::release();
+
+  if (!workerError.empty()) {
+    reportFatal(workerError);
+  }
+#endif
+}
+
+void writeModule(llvm::Module *m, std::string filename) {
+  if (stats::isEnabled()) {
+    stats::counters().irInstructions += stats::countInstructions(*m);
+  }
+
+  // With -run -jit, the program may be executed directly from memory.
+  if (jit::isRequested() && jit::takeModule(*m)) {
+    return;
+  }
+
+  // make sure the output directory exists
+  const auto directory = llvm::sys::path::parent_path(filename);
+  if (!directory.empty()) {
+    if (auto ec = llvm::sys::fs::create_directories(directory)) {
+      error(Loc(), "failed to create output directory: %s\n%s",
+            directory.data(), ec.message().c_str());
+      fatal();
+    }
+  }
+
+  // Use cached object code (and other outputs) if possible
+  bool useIR2ObjCache = !opts::cacheDir.empty();
+  llvm::SmallString<32> moduleHash;
+  if (useIR2ObjCache) {
+    llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
+    llvm::sys::fs::make_absolute(cacheDir);
+    opts::cacheDir = cacheDir.c_str();
+
+    IF_LOG Logger::println("Use IR-to-Object cache in %s",
+                           opts::cacheDir.c_str());
+    LOG_SCOPE
+
+#if LDC_LLVM_VER >= 309
+    if (useCacheFragments()) {
+      writeCachedFragments(m, filename);
+      return;
+    }
+#endif
+
+    cache::calculateModuleHash(m, moduleHash);
+
+    // Only use the cache if it contains all requested outputs.
+    const auto outputs = getCacheableOutputs(filename);
+    bool allCached = !outputs.empty();
+    for (const auto &output : outputs) {
+      if (cache::cacheLookup(moduleHash, output.second).empty()) {
+        allCached = false;
+        break;
+      }
+    }
+    if (allCached) {
+      for (const auto &output : outputs) {
+        if (!cache::recoverObjectFile(moduleHash, output.second,
+                                      output.first)) {
+          allCached = false;
+          break;
+        }
+      }
+      if (allCached)
+        return;
+    }
+  }
+
+  scheduleModule(m, filename, moduleHash);
 }
 
 #undef ERRORINFO_STRING
@@ -20,6 +20,33 @@ namespace llvm {
 class Module;
 }
 
+/// Optimizes the given module and writes it to the requested output files.
+///
+/// If parallel codegen has been started, the module may be handed off to a
+/// background thread; in that case, the files are only guaranteed to exist
+/// after finishParallelCodegen() returns.
 void writeModule(llvm::Module *m, std::string filename);
 
+/// Returns the absolute path of the .dwo file receiving the split DWARF debug
+/// info of the given object file (see -gsplit-dwarf).
+std::string getDwarfObjectFileName(const std::string &objectFile);
+
+/// Sets up numThreads worker threads for optimization and machine code
+/// generation of all subsequently written modules. Does nothing for 0.
+///
+/// A single thread pipelines the IR generation of the next module with the
+/// backend work for the previous one. The produced files are identical to
+/// the ones written sequentially.
+void startParallelCodegen(unsigned numThreads);
+
+/// Blocks while the worker threads of parallel codegen are busy and as many
+/// modules are waiting for them as there are workers. To be called before
+/// generating the IR of the next module, after the memory of the previous one
+/// has been freed.
+void throttleParallelCodegen();
+
+/// Waits until all pending modules have been written and shuts down the
+/// worker threads started by startParallelCodegen().
+void finishParallelCodegen();
+
 #endif
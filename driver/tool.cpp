@@ -9,25 +9,168 @@
 
 #include "driver/tool.h"
 #include "mars.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cctype>
+#if defined(HAVE_SC_ARG_MAX)
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+
+size_t maxCommandLineLen() {
+#if defined(HAVE_SC_ARG_MAX)
+  // http://www.in-ulm.de/~mascheck/various/argmax – the factor 2 is just
+  // a wild guess to account for the enviroment.
+  return sysconf(_SC_ARG_MAX) / 2;
+#elif defined(_WIN32)
+  // http://blogs.msdn.com/b/oldnewthing/archive/2003/12/10/56028.aspx
+  return 32767;
+#else
+#error "Do not know how to determine maximum command line length."
+#endif
+}
+
+size_t estimateCommandLineLen(const std::vector<std::string> &args) {
+  size_t length = 0;
+  for (const auto &arg : args) {
+    // Separator, enclosing quotes and every character escaped.
+    length += 3 + 2 * arg.size();
+  }
+  return length;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+namespace windows {
+namespace {
+bool needsQuotes(const llvm::StringRef &arg) {
+  return // not already quoted
+      !(arg.size() > 1 && arg[0] == '"' &&
+        arg.back() == '"') && // empty or min 1 space or min 1 double quote
+      (arg.empty() || arg.find(' ') != arg.npos || arg.find('"') != arg.npos);
+}
+
+size_t countPrecedingBackslashes(const std::string &arg, size_t index) {
+  size_t count = 0;
+  while (count < index && arg[index - count - 1] == '\\')
+    ++count;
+  return count;
+}
+}
+
+std::string quoteArg(const std::string &arg) {
+  if (!needsQuotes(arg))
+    return arg;
+
+  std::string quotedArg;
+  quotedArg.reserve(3 + 2 * arg.size()); // worst case
+
+  quotedArg.push_back('"');
+
+  const size_t argLength = arg.length();
+  for (size_t i = 0; i < argLength; ++i) {
+    if (arg[i] == '"') {
+      // Escape all preceding backslashes (if any).
+      // Note that we *don't* need to escape runs of backslashes that don't
+      // precede a double quote! See MSDN:
+      // http://msdn.microsoft.com/en-us/library/17w5ykft%28v=vs.85%29.aspx
+      quotedArg.append(countPrecedingBackslashes(arg, i), '\\');
+
+      // Escape the double quote.
+      quotedArg.push_back('\\');
+    }
+
+    quotedArg.push_back(arg[i]);
+  }
+
+  // Make sure our final double quote doesn't get escaped by a trailing
+  // backslash.
+  quotedArg.append(countPrecedingBackslashes(arg, argLength), '\\');
+  quotedArg.push_back('"');
+
+  return quotedArg;
+}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+ResponseFile::~ResponseFile() {
+  if (!path.empty())
+    llvm::sys::fs::remove(path);
+}
+
+bool ResponseFile::write(const std::vector<std::string> &args,
+                         ResponseFileStyle style) {
+  assert(style != ResponseFileStyle::None);
+  assert(path.empty() && "response file already written");
+
+  int fd;
+  if (llvm::sys::fs::createTemporaryFile("ldc", "rsp", fd, path)) {
+    path.clear();
+    return false;
+  }
+
+  llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+  for (const auto &arg : args) {
+    if (style == ResponseFileStyle::Windows) {
+      os << windows::quoteArg(arg);
+    } else {
+      // Escape everything the GNU tokenizer treats specially.
+      for (char c : arg) {
+        if (c == '\\' || c == '"' || c == '\'' ||
+            isspace(static_cast<unsigned char>(c)))
+          os << '\\';
+        os << c;
+      }
+    }
+    os << '\n';
+  }
+
+  os.close();
+  return !os.has_error();
+}
+
+//////////////////////////////////////////////////////////////////////////////
 
 int executeToolAndWait(const std::string &tool,
-                       std::vector<std::string> const &args, bool verbose) {
+                       std::vector<std::string> const &args, bool verbose,
+                       ResponseFileStyle rspStyle) {
+  // Pass the arguments via a response file if the command line is too long.
+  ResponseFile rspFile;
+  std::string rspArg;
+  if (rspStyle != ResponseFileStyle::None &&
+      tool.size() + estimateCommandLineLen(args) > maxCommandLineLen()) {
+    if (!rspFile.write(args, rspStyle)) {
+      error(Loc(), "cannot write temporary response file for %s",
+            tool.c_str());
+      return -1;
+    }
+    rspArg = rspFile.getArgument();
+  }
+
   // Construct real argument list.
   // First entry is the tool itself, last entry must be NULL.
   std::vector<const char *> realargs;
   realargs.reserve(args.size() + 2);
   realargs.push_back(tool.c_str());
-  for (const auto &arg : args) {
-    realargs.push_back(arg.c_str());
+  if (!rspArg.empty()) {
+    realargs.push_back(rspArg.c_str());
+  } else {
+    for (const auto &arg : args) {
+      realargs.push_back(arg.c_str());
+    }
   }
   realargs.push_back(nullptr);
 
-  // Print command line if requested
+  // Print command line if requested (including the response file contents)
   if (verbose) {
     // Print it
-    for (size_t i = 0; i < realargs.size() - 1; i++) {
-      fprintf(global.stdmsg, "%s ", realargs[i]);
+    fprintf(global.stdmsg, "%s ", tool.c_str());
+    for (const auto &arg : args) {
+      fprintf(global.stdmsg, "%s ", arg.c_str());
     }
     fprintf(global.stdmsg, "\n");
     fflush(global.stdmsg);
@@ -16,11 +16,63 @@
 #ifndef LDC_DRIVER_TOOL_H
 #define LDC_DRIVER_TOOL_H
 
+#include "llvm/ADT/SmallString.h"
 #include <vector>
 #include <string>
 
+/// The argument quoting conventions of response files.
+enum class ResponseFileStyle {
+  /// The tool doesn't support response files.
+  None,
+  /// Backslash escapes, as used by GCC, binutils and LDC on POSIX hosts.
+  GNU,
+  /// MSVC quoting rules, as used by the MSVC tools and LDC on Windows hosts.
+  Windows
+};
+
+/// The response file style understood by LDC itself on the host.
+#ifdef _WIN32
+const ResponseFileStyle nativeResponseFileStyle = ResponseFileStyle::Windows;
+#else
+const ResponseFileStyle nativeResponseFileStyle = ResponseFileStyle::GNU;
+#endif
+
+/// Returns the OS-dependent length limit for the command line when invoking
+/// subprocesses.
+size_t maxCommandLineLen();
+
+/// Returns an upper bound for the length of the command line consisting of
+/// the given arguments (including separators and worst-case quoting), computed
+/// without actually quoting them.
+size_t estimateCommandLineLen(const std::vector<std::string> &args);
+
+/// A temporary response file, removed again on destruction.
+class ResponseFile {
+public:
+  ~ResponseFile();
+
+  /// Writes the arguments (quoted as per the given style) to a new temporary
+  /// response file in a single pass. Returns false on failure.
+  bool write(const std::vector<std::string> &args, ResponseFileStyle style);
+
+  /// Returns the `@<path>` argument referring to the file.
+  std::string getArgument() const { return "@" + path.str().str(); }
+
+private:
+  llvm::SmallString<128> path;
+};
+
+namespace windows {
+/// Quotes the argument as per the MSVC command line parsing rules.
+std::string quoteArg(const std::string &arg);
+}
+
+/// Executes the tool with the given arguments and returns its exit status.
+/// If the tool supports response files (rspStyle) and the command line would
+/// exceed the length limit, the arguments are passed via a response file.
 int executeToolAndWait(const std::string &tool,
                        std::vector<std::string> const &args,
-                       bool verbose = false);
+                       bool verbose = false,
+                       ResponseFileStyle rspStyle = ResponseFileStyle::None);
 
 #endif
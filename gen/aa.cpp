@@ -10,8 +10,10 @@
 #include "gen/aa.h"
 #include "aggregate.h"
 #include "declaration.h"
+#include "expression.h"
 #include "module.h"
 #include "mtype.h"
+#include "gen/arrays.h"
 #include "gen/dvalue.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
@@ -21,6 +23,8 @@
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
 
 // returns the keytype typeinfo
 static LLValue *to_keyti(DValue *aa) {
@@ -32,6 +36,33 @@ static LLValue *to_keyti(DValue *aa) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// The key hashing and comparisons happen in druntime via the key TypeInfo, so
+// lookups cannot be specialized for known key types without a dedicated
+// runtime entry point. What can be done inline is skipping the runtime call
+// for null (i.e., empty) AAs, for which the lookup functions return early.
+template <typename EmitCall>
+static LLValue *DtoAALookup(LLValue *aaval, LLValue *emptyResult,
+                            EmitCall emitCall) {
+  llvm::BasicBlock *entrybb = gIR->scopebb();
+  llvm::BasicBlock *lookupbb = gIR->insertBB("aa.lookup");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(lookupbb, "aa.lookupend");
+  LLValue *isEmpty = gIR->ir->CreateIsNull(aaval, "aa.isempty");
+  gIR->ir->CreateCondBr(isEmpty, endbb, lookupbb);
+
+  gIR->scope() = IRScope(lookupbb);
+  LLValue *ret = emitCall();
+  lookupbb = gIR->scopebb();
+  llvm::BranchInst::Create(endbb, lookupbb);
+
+  gIR->scope() = IRScope(endbb);
+  llvm::PHINode *phi = gIR->ir->CreatePHI(ret->getType(), 2);
+  phi->addIncoming(emptyResult, entrybb);
+  phi->addIncoming(ret, lookupbb);
+  return phi;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 DLValue *DtoAAIndex(Loc &loc, Type *type, DValue *aa, DValue *key,
                     bool lvalue) {
   // D2:
@@ -66,8 +97,11 @@ DLValue *DtoAAIndex(Loc &loc, Type *type, DValue *aa, DValue *key,
               .getInstruction();
   } else {
     LLValue *keyti = DtoBitCast(to_keyti(aa), funcTy->getParamType(1));
-    ret = gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.index")
+    ret = DtoAALookup(
+        aaval, LLConstant::getNullValue(funcTy->getReturnType()), [&]() {
+          return gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.index")
               .getInstruction();
+        });
   }
 
   // cast return value
@@ -139,8 +173,11 @@ DValue *DtoAAIn(Loc &loc, Type *type, DValue *aa, DValue *key) {
   pkey = DtoBitCast(pkey, getVoidPtrType());
 
   // call runtime
-  LLValue *ret = gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.in")
-                     .getInstruction();
+  LLValue *ret = DtoAALookup(
+      aaval, LLConstant::getNullValue(funcTy->getReturnType()), [&]() {
+        return gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.in")
+            .getInstruction();
+      });
 
   // cast return value
   LLType *targettype = DtoType(type);
@@ -185,9 +222,13 @@ DValue *DtoAARemove(Loc &loc, DValue *aa, DValue *key) {
   pkey = DtoBitCast(pkey, funcTy->getParamType(2));
 
   // call runtime
-  LLCallSite call = gIR->CreateCallOrInvoke(func, aaval, keyti, pkey);
+  LLValue *ret = DtoAALookup(
+      aaval, LLConstant::getNullValue(funcTy->getReturnType()), [&]() {
+        return gIR->CreateCallOrInvoke(func, aaval, keyti, pkey)
+            .getInstruction();
+      });
 
-  return new DImValue(Type::tbool, call.getInstruction());
+  return new DImValue(Type::tbool, ret);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -211,3 +252,208 @@ LLValue *DtoAAEquals(Loc &loc, TOK op, DValue *l, DValue *r) {
 
   return res;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Constant AAs mirror the data structures of druntime's rt/aaA.d:
+//
+//   struct Impl {
+//     Bucket[] buckets;
+//     uint used;
+//     uint deleted;
+//     TypeInfo_Struct entryTI;
+//     uint firstUsed;
+//     immutable uint keysz;
+//     immutable uint valsz;
+//     immutable uint valoff;
+//     Flags flags; // ubyte
+//   }
+//   struct Bucket { size_t hash; void* entry; }
+//
+// An entry holds the key, followed by the value at offset valoff. entryTI is
+// only used for allocating new entries and left null.
+
+namespace {
+/// Mirrors druntime's TypeInfo.getHash() for the key types whose hash is the
+/// value itself (zero- or sign-extended like in rt/typeinfo).
+bool getKeyHash(Expression *key, uint64_t &hash) {
+  if (key->op != TOKint64)
+    return false;
+  const dinteger_t value = key->toInteger();
+  switch (key->type->toBasetype()->ty) {
+  case Tint8:
+    hash = static_cast<int8_t>(value);
+    return true;
+  case Tint16:
+    hash = static_cast<int16_t>(value);
+    return true;
+  case Tbool:
+  case Tuns8:
+  case Tchar:
+    hash = static_cast<uint8_t>(value);
+    return true;
+  case Tuns16:
+  case Twchar:
+    hash = static_cast<uint16_t>(value);
+    return true;
+  case Tint32:
+    hash = static_cast<int32_t>(value);
+    return true;
+  case Tuns32:
+  case Tdchar:
+    hash = static_cast<uint32_t>(value);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Mirrors druntime's calcHash(): the MurmurHash2 finalizer, with the highest
+/// bit set to distinguish filled buckets from empty and deleted ones.
+uint64_t calcHash(uint64_t hash, unsigned sizeBits) {
+  const uint64_t mask =
+      sizeBits == 64 ? ~uint64_t(0) : (uint64_t(1) << sizeBits) - 1;
+  hash &= mask;
+  hash ^= hash >> 13;
+  hash = (hash * 0x5bd1e995) & mask;
+  hash ^= hash >> 15;
+  return hash | (uint64_t(1) << (sizeBits - 1));
+}
+
+uint64_t alignTo(uint64_t size, uint64_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void addPadding(std::vector<LLConstant *> &fields, uint64_t size) {
+  if (size) {
+    fields.push_back(llvm::Constant::getNullValue(
+        llvm::ArrayType::get(LLType::getInt8Ty(gIR->context()), size)));
+  }
+}
+}
+
+LLConstant *DtoConstAA(AssocArrayLiteralExp *e) {
+  IF_LOG Logger::println("DtoConstAA: %s", e->toChars());
+  LOG_SCOPE;
+
+  Type *aatype = e->type->toBasetype();
+  assert(aatype->ty == Taarray);
+  const size_t length = e->keys->dim;
+  if (length == 0)
+    return getNullPtr(getVoidPtrType());
+
+  Type *keyType = static_cast<TypeAArray *>(aatype)->index;
+  Type *valueType = aatype->nextOf();
+  const uint64_t keysz = keyType->size();
+  const uint64_t valsz = valueType->size();
+  const uint64_t valoff = alignTo(keysz, valueType->alignsize());
+  const uint64_t entryAlignment =
+      std::max(keyType->alignsize(), valueType->alignsize());
+  const uint64_t entrySize = alignTo(valoff + valsz, entryAlignment);
+
+  // The bucket count chosen by _d_assocarrayliteralTX:
+  // nextpow2(INIT_DEN * length / INIT_NUM)
+  const uint64_t dim = llvm::NextPowerOf2(40 * length / 18 - 1);
+  const uint64_t mask = dim - 1;
+  const unsigned sizeBits = getTypeBitSize(DtoSize_t());
+
+  std::vector<uint64_t> bucketHashes(dim, 0);
+  std::vector<size_t> bucketEntries(dim, 0);
+  std::vector<LLConstant *> entries;
+  std::vector<Expression *> entryKeys;
+  entries.reserve(length);
+  entryKeys.reserve(length);
+
+  for (size_t i = 0; i < length; ++i) {
+    Expression *key = (*e->keys)[i];
+    uint64_t keyHash;
+    if (!getKeyHash(key, keyHash)) {
+      IF_LOG Logger::println("Unsupported key: %s", key->toChars());
+      return nullptr;
+    }
+    const uint64_t hash = calcHash(keyHash, sizeBits);
+
+    LLConstant *keyInit = DtoConstExpInit(e->loc, keyType, key);
+    LLConstant *valueInit =
+        DtoConstExpInit(e->loc, valueType, (*e->values)[i]);
+    const uint64_t keyInitSize = getTypeAllocSize(keyInit->getType());
+    const uint64_t valueInitSize = getTypeAllocSize(valueInit->getType());
+    if (keyInitSize > valoff || valueInitSize > entrySize - valoff)
+      return nullptr;
+
+    std::vector<LLConstant *> fields;
+    fields.push_back(keyInit);
+    addPadding(fields, valoff - keyInitSize);
+    fields.push_back(valueInit);
+    addPadding(fields, entrySize - valoff - valueInitSize);
+    LLConstant *entry = llvm::ConstantStruct::getAnon(fields, true);
+
+    // Like druntime's findSlotLookup() and findSlotInsert(); a duplicate key
+    // overrides the previous value.
+    uint64_t b = hash & mask;
+    for (uint64_t j = 1; bucketHashes[b] != 0; ++j) {
+      if (bucketHashes[b] == hash &&
+          entryKeys[bucketEntries[b]]->toInteger() == key->toInteger()) {
+        break;
+      }
+      b = (b + j) & mask;
+    }
+    if (bucketHashes[b] == 0) {
+      bucketHashes[b] = hash;
+      bucketEntries[b] = entries.size();
+      entries.push_back(entry);
+      entryKeys.push_back(key);
+    } else {
+      entries[bucketEntries[b]] = entry;
+    }
+  }
+
+  LLConstant *entriesInit = llvm::ConstantStruct::getAnon(entries, true);
+  auto entriesGlobal = new llvm::GlobalVariable(
+      gIR->module, entriesInit->getType(), true,
+      llvm::GlobalValue::InternalLinkage, entriesInit, ".aaEntries");
+  entriesGlobal->setAlignment(entryAlignment);
+
+  LLType *voidPtrType = getVoidPtrType();
+  LLStructType *bucketType =
+      LLStructType::get(gIR->context(), {DtoSize_t(), voidPtrType});
+  std::vector<LLConstant *> buckets;
+  buckets.reserve(dim);
+  uint64_t firstUsed = dim;
+  for (uint64_t b = 0; b < dim; ++b) {
+    if (bucketHashes[b] == 0) {
+      buckets.push_back(llvm::Constant::getNullValue(bucketType));
+      continue;
+    }
+    firstUsed = std::min(firstUsed, b);
+    LLConstant *entryPtr = DtoBitCast(
+        DtoGEPi(entriesGlobal, 0, bucketEntries[b]), voidPtrType);
+    LLConstant *fields[] = {DtoConstSize_t(bucketHashes[b]), entryPtr};
+    buckets.push_back(llvm::ConstantStruct::get(bucketType, fields));
+  }
+  LLConstant *bucketsInit =
+      llvm::ConstantArray::get(llvm::ArrayType::get(bucketType, dim), buckets);
+  auto bucketsGlobal = new llvm::GlobalVariable(
+      gIR->module, bucketsInit->getType(), true,
+      llvm::GlobalValue::InternalLinkage, bucketsInit, ".aaBuckets");
+
+  // Impl.Flags.hasPointers (the integral keys never have a postblit)
+  const bool hasPointers = keyType->hasPointers() || valueType->hasPointers();
+
+  LLConstant *implFields[] = {
+      DtoConstSlice(DtoConstSize_t(dim), DtoGEPi(bucketsGlobal, 0, 0)),
+      DtoConstUint(entries.size()), // used
+      DtoConstUint(0),              // deleted
+      getNullPtr(voidPtrType),      // entryTI
+      DtoConstUint(firstUsed),
+      DtoConstUint(keysz),
+      DtoConstUint(valsz),
+      DtoConstUint(valoff),
+      DtoConstUbyte(hasPointers ? 0x2 : 0)};
+  LLConstant *implInit = llvm::ConstantStruct::getAnon(implFields);
+  auto implGlobal = new llvm::GlobalVariable(
+      gIR->module, implInit->getType(), true,
+      llvm::GlobalValue::InternalLinkage, implInit, ".aaImpl");
+
+  return DtoBitCast(implGlobal, voidPtrType);
+}
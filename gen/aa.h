@@ -17,11 +17,13 @@
 #include "tokens.h"
 
 enum TOK;
+class AssocArrayLiteralExp;
 class DValue;
 class DLValue;
 struct Loc;
 class Type;
 namespace llvm {
+class Constant;
 class Value;
 }
 
@@ -30,4 +32,9 @@ DValue *DtoAAIn(Loc &loc, Type *type, DValue *aa, DValue *key);
 DValue *DtoAARemove(Loc &loc, DValue *aa, DValue *key);
 llvm::Value *DtoAAEquals(Loc &loc, TOK op, DValue *l, DValue *r);
 
+/// Lays out the AA literal like druntime would construct it, as constant data
+/// (which must never be modified). Returns null if the key type isn't
+/// supported; only integral keys are, whose druntime hash is the key itself.
+llvm::Constant *DtoConstAA(AssocArrayLiteralExp *e);
+
 #endif // LDC_GEN_AA_H
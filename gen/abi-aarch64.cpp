@@ -29,26 +29,27 @@ struct AArch64TargetABI : TargetABI {
 
     Type *rt = tf->next->toBasetype();
 
-    // FIXME
-    if (tf->linkage == LINKd)
-      return rt->ty == Tsarray || rt->ty == Tstruct;
+    // extern(D) follows the C rules for POD structs and applies them to static
+    // arrays too; non-POD structs (also as static array elements) are
+    // constructed in place by the callee.
+    if (tf->linkage == LINKd) {
+      if (!isPOD(rt->baseElemOf()))
+        return true;
+    } else if (rt->ty == Tsarray) {
+      return true;
+    }
 
-    return rt->ty == Tsarray ||
-      (rt->ty == Tstruct && rt->size() > 16 && !isHFA((TypeStruct *)rt));
+    return isPassedIndirectly(rt);
   }
 
-  bool passByVal(Type *t) override {
-    t = t->toBasetype();
-    return t->ty == Tsarray ||
-           (t->ty == Tstruct && t->size() > 16 && !isHFA((TypeStruct *)t));
-  }
+  bool passByVal(Type *t) override { return isPassedIndirectly(t); }
 
   void rewriteFunctionType(TypeFunction *tf, IrFuncTy &fty) override {
     Type *retTy = fty.ret->type->toBasetype();
-    if (!fty.ret->byref && retTy->ty == Tstruct) {
-      // Rewrite HFAs only because union HFAs are turned into IR types that are
-      // non-HFA and messes up register selection
-      if (isHFA((TypeStruct *)retTy, &fty.ret->ltype)) {
+    if (!fty.ret->byref && (retTy->ty == Tstruct || retTy->ty == Tsarray)) {
+      // Rewrite HFAs/HVAs only because union HFAs are turned into IR types
+      // that are non-HFA and messes up register selection
+      if (isHFA(retTy, &fty.ret->ltype)) {
         fty.ret->rewrite = &hfaToArray;
         fty.ret->ltype = hfaToArray.type(fty.ret->type);
       }
@@ -67,13 +68,14 @@ struct AArch64TargetABI : TargetABI {
   }
 
   void rewriteArgument(IrFuncTy &fty, IrFuncTyArg &arg) override {
-    // FIXME
     Type *ty = arg.type->toBasetype();
 
     if (ty->ty == Tstruct || ty->ty == Tsarray) {
-      // Rewrite HFAs only because union HFAs are turned into IR types that are
-      // non-HFA and messes up register selection
-      if (ty->ty == Tstruct && isHFA((TypeStruct *)ty, &arg.ltype)) {
+      // Rewrite HFAs/HVAs only because union HFAs are turned into IR types
+      // that are non-HFA and messes up register selection. They are passed
+      // in up to 4 consecutive FP/SIMD registers (e.g., a 4x4 float matrix of
+      // float4 rows in q0-q3).
+      if (isHFA(ty, &arg.ltype)) {
         arg.rewrite = &hfaToArray;
         arg.ltype = hfaToArray.type(arg.type);
       }
@@ -84,6 +86,14 @@ struct AArch64TargetABI : TargetABI {
     }
   }
 
+  /// Composites larger than 16 bytes which aren't HFAs/HVAs are passed as
+  /// pointers to caller-allocated copies and returned via sret.
+  static bool isPassedIndirectly(Type *t) {
+    t = t->toBasetype();
+    return (t->ty == Tstruct || t->ty == Tsarray) && t->size() > 16 &&
+           !isHFA(t);
+  }
+
   /**
   * The AACPS64 uses a special native va_list type:
   *
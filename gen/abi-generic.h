@@ -237,9 +237,8 @@ struct HFAToArray : ABIRewrite {
   }
 
   LLType *type(Type *t) override {
-    assert(t->ty == Tstruct);
     LLType *floatArrayType = nullptr;
-    if (TargetABI::isHFA((TypeStruct *)t, &floatArrayType, maxFloats))
+    if (TargetABI::isHFA(t, &floatArrayType, maxFloats))
       return floatArrayType;
     llvm_unreachable("Type t should be an HFA");
   }
@@ -15,6 +15,7 @@
 #include "mtype.h"
 #include "declaration.h"
 #include "aggregate.h"
+#include "target.h"
 
 #include "gen/irstate.h"
 #include "gen/llvm.h"
@@ -37,7 +38,7 @@ private:
   ExplicitByvalRewrite byvalRewrite;
   IntegerRewrite integerRewrite;
 
-  bool realIs80bits() const { return !isMSVC; }
+  bool realIs80bits() const { return !Target::realIsDouble; }
 
   // Returns true if the D type is passed byval (the callee getting a pointer
   // to a dedicated hidden copy).
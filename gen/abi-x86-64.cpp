@@ -23,13 +23,23 @@
 // attribute to ensure no part of them ends up in registers when only a subset
 // of the desired registers are available.
 //
+// extern(D) follows the C convention by default. With -fd-abi-version=1,
+// aggregates of up to 4 eightbytes are passed in GP registers instead of in
+// memory, and aggregates fitting in registers only partially are split between
+// registers and the stack instead of being passed ByVal. Both sides of such a
+// call are compiled by LDC, so this only needs to be consistent across all
+// objects of a program; on ELF, mixing versions in a link is rejected by the
+// linker (see emitDABIVersionMarker() in gen/modules.cpp).
+//
 //===----------------------------------------------------------------------===//
 
 #include "gen/abi-x86-64.h"
 #include "aggregate.h"
 #include "declaration.h"
+#include "driver/cl_options.h"
 #include "ldcbindings.h"
 #include "mtype.h"
+#include "target.h"
 #include "gen/abi-generic.h"
 #include "gen/abi-x86-64.h"
 #include "gen/abi.h"
@@ -40,6 +50,7 @@
 #include "gen/logger.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
+#include <algorithm>
 #include <cassert>
 #include <map>
 #include <string>
@@ -161,6 +172,14 @@ struct RegCount {
 
     return ArgumentFitsIn;
   }
+
+  // Accounts for an argument LLVM splits between the remaining registers and
+  // the stack.
+  void subtractAvailable(const IrFuncTyArg &arg) {
+    const RegCount wanted(arg.ltype);
+    int_regs = std::max(int_regs - wanted.int_regs, 0);
+    sse_regs = std::max(sse_regs - wanted.sse_regs, 0);
+  }
 };
 }
 
@@ -185,6 +204,26 @@ struct X86_64_C_struct_rewrite : ABIRewrite {
   LLType *type(Type *t) override { return getAbiType(t); }
 };
 
+/**
+ * This type passes an aggregate as array of i64 (in GP registers as long as
+ * enough of them are available). Used for the optimized extern(D) ABI only.
+ */
+struct X86_64_D_words_rewrite : ABIRewrite {
+  LLValue *put(DValue *v) override {
+    return loadFromMemory(getAddressOf(v), type(v->type),
+                          ".X86_64_D_words_rewrite_putResult");
+  }
+
+  LLValue *getLVal(Type *dty, LLValue *v) override {
+    return DtoAllocaDump(v, dty, ".X86_64_D_words_rewrite_dump");
+  }
+
+  LLType *type(Type *t) override {
+    return LLArrayType::get(LLType::getInt64Ty(gIR->context()),
+                            (t->size() + 7) / 8);
+  }
+};
+
 /**
  * This type is used to force LLVM to pass a LL struct in memory,
  * on the function arguments stack. We need this to prevent LLVM
@@ -204,6 +243,7 @@ struct ImplicitByvalRewrite : ABIRewrite {
 struct X86_64TargetABI : TargetABI {
   X86_64_C_struct_rewrite struct_rewrite;
   ImplicitByvalRewrite byvalRewrite;
+  X86_64_D_words_rewrite wordsRewrite;
 
   bool returnInArg(TypeFunction *tf) override;
 
@@ -212,7 +252,9 @@ struct X86_64TargetABI : TargetABI {
   void rewriteFunctionType(TypeFunction *tf, IrFuncTy &fty) override;
   void rewriteVarargs(IrFuncTy &fty, std::vector<IrFuncTyArg *> &args) override;
   void rewriteArgument(IrFuncTy &fty, IrFuncTyArg &arg) override;
-  void rewriteArgument(IrFuncTyArg &arg, RegCount &regCount);
+  void rewriteArgument(IrFuncTyArg &arg, RegCount &regCount,
+                       bool allowSplit = false);
+  bool passWordsInRegs(IrFuncTyArg &arg, RegCount &regCount);
 
   LLValue *prepareVaStart(DLValue *ap) override;
 
@@ -251,7 +293,8 @@ void X86_64TargetABI::rewriteArgument(IrFuncTy &fty, IrFuncTyArg &arg) {
   llvm_unreachable("Please use the other overload explicitly.");
 }
 
-void X86_64TargetABI::rewriteArgument(IrFuncTyArg &arg, RegCount &regCount) {
+void X86_64TargetABI::rewriteArgument(IrFuncTyArg &arg, RegCount &regCount,
+                                      bool allowSplit) {
   LLType *originalLType = arg.ltype;
   Type *t = arg.type->toBasetype();
 
@@ -267,7 +310,13 @@ void X86_64TargetABI::rewriteArgument(IrFuncTyArg &arg, RegCount &regCount) {
     arg.ltype = abiTy;
   }
 
-  if (regCount.trySubtract(arg) == RegCount::ArgumentWouldFitInPartially) {
+  if (regCount.trySubtract(arg) != RegCount::ArgumentWouldFitInPartially) {
+    return;
+  }
+
+  if (allowSplit) {
+    regCount.subtractAvailable(arg);
+  } else {
     // pass LL structs implicitly ByVal, otherwise LLVM passes
     // them partially in registers, partially in memory
     assert(originalLType->isStructTy());
@@ -279,6 +328,27 @@ void X86_64TargetABI::rewriteArgument(IrFuncTyArg &arg, RegCount &regCount) {
   }
 }
 
+bool X86_64TargetABI::passWordsInRegs(IrFuncTyArg &arg, RegCount &regCount) {
+  Type *t = arg.type->toBasetype();
+  if (!(t->ty == Tstruct || t->ty == Tsarray)) {
+    return false;
+  }
+
+  const auto size = t->size();
+  if (size > 32 || static_cast<int>((size + 7) / 8) > regCount.int_regs) {
+    return false;
+  }
+
+  IF_LOG Logger::cout() << "Passing in GP registers: " << t->toChars() << '\n';
+  // undo byval semantics applied via passByVal() returning true
+  arg.byref = false;
+  arg.attrs.clear();
+  arg.rewrite = &wordsRewrite;
+  arg.ltype = wordsRewrite.type(arg.type);
+  regCount.int_regs -= (size + 7) / 8;
+  return true;
+}
+
 void X86_64TargetABI::rewriteFunctionType(TypeFunction *tf, IrFuncTy &fty) {
   RegCount &regCount = getRegCount(fty);
   regCount = RegCount(); // initialize
@@ -311,6 +381,8 @@ void X86_64TargetABI::rewriteFunctionType(TypeFunction *tf, IrFuncTy &fty) {
     fty.reverseParams = true;
   }
 
+  const bool optimizedDABI = tf->linkage == LINKd && opts::dABIVersion >= 1;
+
   int begin = 0, end = fty.args.size(), step = 1;
   if (fty.reverseParams) {
     begin = end - 1;
@@ -321,6 +393,10 @@ void X86_64TargetABI::rewriteFunctionType(TypeFunction *tf, IrFuncTy &fty) {
     IrFuncTyArg &arg = *fty.args[i];
 
     if (arg.byref) {
+      if (optimizedDABI && arg.isByVal() && passWordsInRegs(arg, regCount)) {
+        continue;
+      }
+
       if (!arg.isByVal() && regCount.int_regs > 0) {
         regCount.int_regs--;
       }
@@ -328,7 +404,7 @@ void X86_64TargetABI::rewriteFunctionType(TypeFunction *tf, IrFuncTy &fty) {
       continue;
     }
 
-    rewriteArgument(arg, regCount);
+    rewriteArgument(arg, regCount, optimizedDABI);
   }
 
   // regCount (fty.tag) is now in the state after all implicit & formal args,
@@ -418,11 +494,12 @@ const char *X86_64TargetABI::objcMsgSendFunc(Type *ret,
   }
   if (ret) {
     // complex long double return
-    if (ret->ty == Tcomplex80) {
+    if (ret->ty == Tcomplex80 && !Target::realIsDouble) {
       return "objc_msgSend_fp2ret";
     }
     // long double return
-    if (ret->ty == Tfloat80 || ret->ty == Timaginary80) {
+    if ((ret->ty == Tfloat80 || ret->ty == Timaginary80) &&
+        !Target::realIsDouble) {
       return "objc_msgSend_fpret";
     }
   }
@@ -72,14 +72,78 @@ LLValue *ABIRewrite::loadFromMemory(LLValue *address, LLType *asType,
 // consists of up to 4 of same floating point type.  D floats of same size are
 // considered as same (e.g. ifloat and float are same).  It is the aggregate
 // final data layout that matters so nested structs, unions, and sarrays can
-// result in an HFA.
+// result in an HFA.  Homogeneous Short-Vector Aggregates (HVA) are the same
+// for 64/128-bit vectors; vectors of the same size are considered as same.
 //
 // simple HFAs: struct F1 {float f;}  struct D4 {double a,b,c,d;}
 // interesting HFA: struct {F1[2] vals; float weight;}
+// HVA: struct float4x4 {float4[4] rows;}
 
 namespace {
-bool isNestedHFA(const TypeStruct *t, d_uns64 &floatSize, int &num,
-                 uinteger_t adim) {
+bool isNestedHFA(const TypeStruct *t, d_uns64 &floatSize, Type *&vectorType,
+                 int &num, uinteger_t adim);
+
+// Used internally by isHFA() to check a field or array element of type
+// 'field', which is part of an sarray of dimension 'adim' (1 if not), and
+// update 'n' accordingly.
+bool isHFAElement(Type *field, d_uns64 &floatSize, Type *&vectorType, int &n,
+                  uinteger_t adim) {
+  // reset dim to dimension of sarray we are in (will be 1 if not)
+  uinteger_t dim = adim;
+
+  // Field is an array.  Process the arrayof type and multiply dim by
+  // array dim.  Note that empty arrays immediately exclude this struct
+  // from HFA status.
+  if (field->ty == Tsarray) {
+    TypeSArray *array = (TypeSArray *)field;
+    if (array->dim->toUInteger() == 0)
+      return false;
+    field = array->nextOf()->toBasetype();
+    dim *= array->dim->toUInteger();
+    if (field->ty == Tsarray)
+      return isHFAElement(field, floatSize, vectorType, n, dim);
+  }
+
+  if (field->ty == Tstruct) {
+    return isNestedHFA((TypeStruct *)field, floatSize, vectorType, n, dim);
+  }
+
+  if (field->ty == Tvector) {
+    // only short vectors qualify
+    d_uns64 sz = field->size();
+    if (sz != 8 && sz != 16)
+      return false;
+    n += dim;
+
+    if (floatSize == 0) { // discovered vector type
+      floatSize = sz;
+      vectorType = field;
+    } else if (sz != floatSize || !vectorType) // different type, reject
+      return false;
+    return true;
+  }
+
+  if (field->isfloating()) {
+    d_uns64 sz = field->size();
+    n += dim;
+
+    if (field->iscomplex()) {
+      sz /= 2; // complex is 2 floats, adjust sz
+      n += dim;
+    }
+
+    if (floatSize == 0) // discovered floatSize
+      floatSize = sz;
+    else if (sz != floatSize || vectorType) // different float size, reject
+      return false;
+    return true;
+  }
+
+  return false; // reject all other types
+}
+
+bool isNestedHFA(const TypeStruct *t, d_uns64 &floatSize, Type *&vectorType,
+                 int &num, uinteger_t adim) {
   // Used internally by isHFA() to check struct recursively for HFA-ness.
   // Return true if struct 't' is part of an HFA where 'floatSize' is sizeof
   // the float and 'num' is number of these floats so far.  On return, 'num'
@@ -99,47 +163,13 @@ bool isNestedHFA(const TypeStruct *t, d_uns64 &floatSize, int &num,
   int maxn = num;
 
   for (size_t i = 0; i < fields.dim; ++i) {
-    Type *field = fields[i]->type;
-
     // reset to initial num floats (all union fields are at offset 0)
     if (fields[i]->offset == 0)
       n = num;
 
-    // reset dim to dimension of sarray we are in (will be 1 if not)
-    uinteger_t dim = adim;
-
-    // Field is an array.  Process the arrayof type and multiply dim by
-    // array dim.  Note that empty arrays immediately exclude this struct
-    // from HFA status.
-    if (field->ty == Tsarray) {
-      TypeSArray *array = (TypeSArray *)field;
-      if (array->dim->toUInteger() == 0)
-        return false;
-      field = array->nextOf();
-      dim *= array->dim->toUInteger();
-    }
-
-    if (field->ty == Tstruct) {
-      if (!isNestedHFA((TypeStruct *)field, floatSize, n, dim))
-        return false;
-    } else if (field->isfloating()) {
-      d_uns64 sz = field->size();
-      n += dim;
-
-      if (field->iscomplex()) {
-        sz /= 2; // complex is 2 floats, adjust sz
-        n += dim;
-      }
-
-      if (floatSize == 0) // discovered floatSize
-        floatSize = sz;
-      else if (sz != floatSize) // different float size, reject
-        return false;
-
-      //if (n > 4)
-      //  return false; // too many floats for HFA, reject
-    } else {
-      return false; // reject all other types
+    if (!isHFAElement(fields[i]->type->toBasetype(), floatSize, vectorType, n,
+                      adim)) {
+      return false;
     }
 
     if (n > maxn)
@@ -151,15 +181,23 @@ bool isNestedHFA(const TypeStruct *t, d_uns64 &floatSize, int &num,
 }
 }
 
-bool TargetABI::isHFA(TypeStruct *t, llvm::Type **rewriteType, const int maxFloats) {
+bool TargetABI::isHFA(Type *t, llvm::Type **rewriteType, const int maxFloats) {
   d_uns64 floatSize = 0;
+  Type *vectorType = nullptr;
   int num = 0;
 
-  if (isNestedHFA(t, floatSize, num, 1)) {
+  t = t->toBasetype();
+  if (t->ty != Tstruct && t->ty != Tsarray)
+    return false;
+
+  if (isHFAElement(t, floatSize, vectorType, num, 1)) {
     if (num <= maxFloats) {
       if (rewriteType) {
         llvm::Type *floatType = nullptr;
-        switch (floatSize) {
+        if (vectorType) {
+          floatType = DtoType(vectorType);
+        } else {
+          switch (floatSize) {
           case 4:
             floatType = llvm::Type::getFloatTy(gIR->context());
             break;
@@ -171,6 +209,7 @@ bool TargetABI::isHFA(TypeStruct *t, llvm::Type **rewriteType, const int maxFloa
             break;
           default:
             llvm_unreachable("Unexpected size for float type");
+          }
         }
         *rewriteType = LLArrayType::get(floatType, num);
       }
@@ -159,10 +159,12 @@ struct TargetABI {
 
   /***** Static Helpers *****/
 
-  /// Check if struct 't' is a Homogeneous Floating-point Aggregate (HFA)
-  /// consisting of up to 4 of same floating point type.  If so, optionally
-  /// produce the rewriteType: an array of that floating point type
-  static bool isHFA(TypeStruct *t, llvm::Type **rewriteType = nullptr, const int maxFloats = 4);
+  /// Check if struct or sarray 't' is a Homogeneous Floating-point Aggregate
+  /// (HFA) consisting of up to 4 of same floating point type, or a
+  /// Homogeneous Short-Vector Aggregate (HVA) of up to 4 64/128-bit vectors.
+  /// If so, optionally produce the rewriteType: an array of that floating
+  /// point or vector type
+  static bool isHFA(Type *t, llvm::Type **rewriteType = nullptr, const int maxFloats = 4);
 
 protected:
 
@@ -15,16 +15,22 @@
 #include "init.h"
 #include "module.h"
 #include "mtype.h"
+#include "driver/cl_options.h"
+#include "gen/binops.h"
 #include "gen/dvalue.h"
 #include "gen/funcgenstate.h"
+#include "gen/functions.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "gen/profilegc.h"
 #include "gen/runtime.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
+#include <cstring>
 
 static void DtoSetArray(DValue *array, LLValue *dim, LLValue *ptr);
 
@@ -215,6 +221,78 @@ static bool arrayNeedsPostblit(Type *t) {
   return false;
 }
 
+// Returns the struct if elemType is one whose postblit and destructor, which
+// the runtime calls via its TypeInfo for array copies and assignments, can be
+// called directly in an inline loop instead. For constructions, the postblit
+// needs to be nothrow, as the runtime destroys the already constructed
+// elements if it throws. For assignments of a single value (valueType), the
+// value needs to be of the element type.
+static StructDeclaration *
+getInlinableElementStruct(Type *elemType, bool isConstructing,
+                          Type *valueType = nullptr) {
+  if (elemType->ty != Tstruct)
+    return nullptr;
+  StructDeclaration *sd = static_cast<TypeStruct *>(elemType)->sym;
+  if (valueType && (valueType->ty != Tstruct ||
+                    static_cast<TypeStruct *>(valueType)->sym != sd)) {
+    return nullptr;
+  }
+  if (isConstructing && (!sd->postblit ||
+                         !static_cast<TypeFunction *>(sd->postblit->type)
+                              ->isnothrow)) {
+    return nullptr;
+  }
+  return sd;
+}
+
+// Emits a loop calling emitBody with each index in [0, length).
+template <typename F>
+static void emitElementLoop(LLValue *length, F emitBody) {
+  llvm::BasicBlock *condbb = gIR->insertBB("arrayloop.cond");
+  llvm::BasicBlock *bodybb = gIR->insertBBAfter(condbb, "arrayloop.body");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(bodybb, "arrayloop.end");
+
+  LLValue *itr = DtoAllocaDump(DtoConstSize_t(0), 0, "arrayloop.itr");
+  assert(!gIR->scopereturned());
+  llvm::BranchInst::Create(condbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(condbb);
+  LLValue *cond =
+      gIR->ir->CreateICmpNE(DtoLoad(itr), length, "arrayloop.condition");
+  llvm::BranchInst::Create(bodybb, endbb, cond, gIR->scopebb());
+
+  gIR->scope() = IRScope(bodybb);
+  LLValue *itrVal = DtoLoad(itr);
+  emitBody(itrVal);
+  DtoStore(gIR->ir->CreateAdd(itrVal, DtoConstSize_t(1), "arrayloop.next"),
+           itr);
+  llvm::BranchInst::Create(condbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(endbb);
+}
+
+// Calls the postblit or destructor fd of the struct at ptr.
+static void callStructMember(Loc &loc, FuncDeclaration *fd, LLValue *ptr) {
+  DtoResolveFunction(fd);
+  Expressions args;
+  DFuncValue dfn(fd, getIrFunc(fd)->func, ptr);
+  DtoCallFunction(loc, Type::basic[Tvoid], &dfn, &args);
+}
+
+// Assigns the struct at src to the one at dst the way the runtime does: the
+// previous value is only destroyed after copying the new one, as src might be
+// part of it.
+static void assignStruct(Loc &loc, StructDeclaration *sd, LLValue *dst,
+                         LLValue *src, LLValue *tmpSwap, bool postblit) {
+  if (sd->dtor)
+    DtoMemCpy(tmpSwap, dst, true);
+  DtoMemCpy(dst, src, true);
+  if (postblit && sd->postblit)
+    callStructMember(loc, sd->postblit, dst);
+  if (sd->dtor)
+    callStructMember(loc, sd->dtor, tmpSwap);
+}
+
 // Does array assignment (or initialization) from another array of the same
 // element type or from an appropriate single element.
 void DtoArrayAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
@@ -276,22 +354,79 @@ void DtoArrayAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
             isConstructing || (t->ty == Tsarray && t2->ty == Tsarray);
         copySlice(loc, lhsPtr, lhsSize, rhsPtr, rhsSize, knownInBounds);
       }
-    } else if (isConstructing) {
-      LLFunction *fn = getRuntimeFunction(loc, gIR->module, "_d_arrayctor");
-      LLCallSite call = gIR->CreateCallOrInvoke(fn, DtoTypeInfoOf(elemType),
-                                                DtoSlice(rhsPtr, rhsLength),
-                                                DtoSlice(lhsPtr, lhsLength));
-      call.setCallingConv(llvm::CallingConv::C);
-    } else // assigning
-    {
-      LLValue *tmpSwap = DtoAlloca(elemType, "arrayAssign.tmpSwap");
-      LLFunction *fn = getRuntimeFunction(
-          loc, gIR->module,
-          !canSkipPostblit ? "_d_arrayassign_l" : "_d_arrayassign_r");
-      LLCallSite call = gIR->CreateCallOrInvoke(
-          fn, DtoTypeInfoOf(elemType), DtoSlice(rhsPtr, rhsLength),
-          DtoSlice(lhsPtr, lhsLength), DtoBitCast(tmpSwap, getVoidPtrType()));
-      call.setCallingConv(llvm::CallingConv::C);
+    } else {
+      auto callRuntime = [&] {
+        if (isConstructing) {
+          LLFunction *fn =
+              getRuntimeFunction(loc, gIR->module, "_d_arrayctor");
+          LLCallSite call = gIR->CreateCallOrInvoke(
+              fn, DtoTypeInfoOf(elemType), DtoSlice(rhsPtr, rhsLength),
+              DtoSlice(lhsPtr, lhsLength));
+          call.setCallingConv(llvm::CallingConv::C);
+        } else {
+          LLValue *tmpSwap = DtoAlloca(elemType, "arrayAssign.tmpSwap");
+          LLFunction *fn = getRuntimeFunction(
+              loc, gIR->module,
+              !canSkipPostblit ? "_d_arrayassign_l" : "_d_arrayassign_r");
+          LLCallSite call = gIR->CreateCallOrInvoke(
+              fn, DtoTypeInfoOf(elemType), DtoSlice(rhsPtr, rhsLength),
+              DtoSlice(lhsPtr, lhsLength),
+              DtoBitCast(tmpSwap, getVoidPtrType()));
+          call.setCallingConv(llvm::CallingConv::C);
+        }
+      };
+
+      StructDeclaration *sd =
+          getInlinableElementStruct(elemType, isConstructing);
+      if (!sd) {
+        callRuntime();
+        return;
+      }
+
+      // Copy element-wise with direct postblit/destructor calls. The runtime
+      // is only called for the cases it throws an error for (mismatching
+      // lengths, overlapping slices) or handles specially (overlap for
+      // _d_arrayassign_l).
+      LLValue *elemSize =
+          DtoConstSize_t(getTypeAllocSize(DtoMemType(elemType)));
+      LLValue *size = gIR->ir->CreateMul(elemSize, lhsLength);
+      LLValue *lhsBegin = gIR->ir->CreatePtrToInt(lhsPtr, DtoSize_t());
+      LLValue *rhsBegin = gIR->ir->CreatePtrToInt(rhsPtr, DtoSize_t());
+      LLValue *disjoint = gIR->ir->CreateOr(
+          gIR->ir->CreateICmpULE(gIR->ir->CreateAdd(lhsBegin, size), rhsBegin),
+          gIR->ir->CreateICmpULE(gIR->ir->CreateAdd(rhsBegin, size),
+                                 lhsBegin));
+      LLValue *inlineCopy = gIR->ir->CreateAnd(
+          gIR->ir->CreateICmpEQ(lhsLength, rhsLength), disjoint);
+
+      llvm::BasicBlock *inlinebb = gIR->insertBB("arraycopy.inline");
+      llvm::BasicBlock *runtimebb =
+          gIR->insertBBAfter(inlinebb, "arraycopy.runtime");
+      llvm::BasicBlock *endbb = gIR->insertBBAfter(runtimebb, "arraycopy.end");
+      llvm::BranchInst::Create(inlinebb, runtimebb, inlineCopy,
+                               gIR->scopebb());
+
+      gIR->scope() = IRScope(inlinebb);
+      if (isConstructing) {
+        DtoMemCpy(lhsPtr, rhsPtr, size);
+        emitElementLoop(lhsLength, [&](LLValue *i) {
+          callStructMember(loc, sd->postblit, DtoGEP1(realLhsPtr, i, true));
+        });
+      } else {
+        LLValue *tmpSwap = DtoAlloca(elemType, "arrayAssign.tmpSwap");
+        emitElementLoop(lhsLength, [&](LLValue *i) {
+          assignStruct(loc, sd, DtoGEP1(realLhsPtr, i, true),
+                       DtoGEP1(realRhsArrayPtr, i, true), tmpSwap,
+                       !canSkipPostblit);
+        });
+      }
+      llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+      gIR->scope() = IRScope(runtimebb);
+      callRuntime();
+      llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+      gIR->scope() = IRScope(endbb);
     }
   } else {
     // scalar rhs:
@@ -310,6 +445,23 @@ void DtoArrayAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
       LLValue *actualPtr = DtoBitCast(lhsPtr, rhsType->getPointerTo());
       LLValue *actualLength = gIR->ir->CreateExactUDiv(lhsSize, rhsSize);
       DtoArrayInit(loc, actualPtr, actualLength, rhs);
+    } else if (StructDeclaration *sd = getInlinableElementStruct(
+                   elemType, isConstructing, t2)) {
+      // _d_arraysetctor/_d_arraysetassign with direct postblit/destructor
+      // calls
+      LLValue *value =
+          DtoBitCast(makeLValue(loc, rhs), realLhsPtr->getType());
+      LLValue *tmpSwap =
+          isConstructing ? nullptr : DtoAlloca(elemType, "arrayAssign.tmpSwap");
+      emitElementLoop(lhsLength, [&](LLValue *i) {
+        LLValue *elem = DtoGEP1(realLhsPtr, i, true);
+        if (isConstructing) {
+          DtoMemCpy(elem, value, true);
+          callStructMember(loc, sd->postblit, elem);
+        } else {
+          assignStruct(loc, sd, elem, value, tmpSwap, true);
+        }
+      });
     } else {
       LLFunction *fn = getRuntimeFunction(loc, gIR->module,
                                           isConstructing ? "_d_arraysetctor"
@@ -336,42 +488,114 @@ static void DtoSetArray(DValue *array, LLValue *dim, LLValue *ptr) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-LLConstant *DtoConstArrayInitializer(ArrayInitializer *arrinit,
-                                     Type *targetType) {
-  IF_LOG Logger::println("DtoConstArrayInitializer: %s | %s",
-                         arrinit->toChars(), targetType->toChars());
-  LOG_SCOPE;
-
-  assert(arrinit->value.dim == arrinit->index.dim);
+namespace {
+/// Collects the values of the integer literals of type `ty` returned by
+/// getElement(i) into an array constant. Returns null if one of them isn't
+/// such a literal.
+template <typename T, typename GetElement>
+LLConstant *collectIntegerLiterals(TY ty, size_t count,
+                                   GetElement getElement) {
+  std::vector<T> data;
+  data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    Expression *e = getElement(i);
+    if (!e || e->op != TOKint64 || e->type->toBasetype()->ty != ty) {
+      return nullptr;
+    }
+    // Truncated as by LLConstantInt::get() in toConstElem().
+    data.push_back(static_cast<T>(e->toInteger()));
+  }
+  return llvm::ConstantDataArray::get(gIR->context(), data);
+}
 
-  // get base array type
-  Type *arrty = targetType->toBasetype();
-  size_t arrlen = arrinit->dim;
+template <typename GetElement>
+LLConstant *collectDoubleLiterals(size_t count, GetElement getElement) {
+  std::vector<double> data;
+  data.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    Expression *e = getElement(i);
+    if (!e || e->op != TOKfloat64 || e->type->toBasetype()->ty != Tfloat64) {
+      return nullptr;
+    }
+    // Converted as by DtoConstFP() in toConstElem().
+    data.push_back(static_cast<double>(static_cast<RealExp *>(e)->value));
+  }
+  return llvm::ConstantDataArray::get(gIR->context(), data);
+}
 
-  // for statis arrays, dmd does not include any trailing default
-  // initialized elements in the value/index lists
-  if (arrty->ty == Tsarray) {
-    TypeSArray *tsa = static_cast<TypeSArray *>(arrty);
-    arrlen = static_cast<size_t>(tsa->dim->toInteger());
+/// Builds the constant for an array of integers or doubles directly from the
+/// values of its literal elements, without creating (and uniquing) a
+/// constant per element first. This matters for large lookup tables
+/// computed by CTFE. LLVM turns arrays of zeros into a zeroinitializer.
+/// Returns null for other element types, or if an element isn't a literal of
+/// exactly the element type.
+template <typename GetElement>
+LLConstant *tryConstDataArray(Type *elemty, size_t count,
+                              GetElement getElement) {
+  if (count == 0) {
+    return nullptr;
   }
+  const TY ty = elemty->toBasetype()->ty;
+  switch (ty) {
+  case Tint8:
+  case Tuns8:
+  case Tchar:
+    return collectIntegerLiterals<uint8_t>(ty, count, getElement);
+  case Tint16:
+  case Tuns16:
+  case Twchar:
+    return collectIntegerLiterals<uint16_t>(ty, count, getElement);
+  case Tint32:
+  case Tuns32:
+  case Tdchar:
+    return collectIntegerLiterals<uint32_t>(ty, count, getElement);
+  case Tint64:
+  case Tuns64:
+    return collectIntegerLiterals<uint64_t>(ty, count, getElement);
+  case Tfloat64:
+    return collectDoubleLiterals(count, getElement);
+  default:
+    return nullptr;
+  }
+}
 
-  // make sure the number of initializers is sane
-  if (arrinit->index.dim > arrlen || arrinit->dim > arrlen) {
-    error(arrinit->loc, "too many initializers, %llu, for array[%llu]",
-          static_cast<unsigned long long>(arrinit->index.dim),
-          static_cast<unsigned long long>(arrlen));
-    fatal();
+/// Returns the elements of a static or dynamic array initializer, in order
+/// and filled up with the default initializer. Returns false if one of them
+/// isn't an expression, or on duplicate indices (left to be diagnosed by
+/// the general code path).
+bool getInitializerElements(ArrayInitializer *arrinit, Type *elemty,
+                            size_t arrlen, std::vector<Expression *> &elems) {
+  elems.assign(arrlen, nullptr);
+  size_t j = 0;
+  for (size_t i = 0; i < arrinit->index.dim; i++) {
+    Expression *idx = static_cast<Expression *>(arrinit->index.data[i]);
+    if (idx) {
+      j = idx->toInteger();
+    }
+    auto val = static_cast<Initializer *>(arrinit->value.data[i]);
+    ExpInitializer *ei = val->isExpInitializer();
+    if (j >= arrlen || elems[j] || !ei) {
+      return false;
+    }
+    elems[j] = ei->exp;
+    j++;
   }
 
-  // get elem type
-  Type *elemty;
-  if (arrty->ty == Tvector) {
-    elemty = static_cast<TypeVector *>(arrty)->elementType();
-  } else {
-    elemty = arrty->nextOf();
+  Expression *defaultInit = nullptr;
+  for (auto &e : elems) {
+    if (!e) {
+      if (!defaultInit) {
+        defaultInit = elemty->defaultInit(arrinit->loc);
+      }
+      e = defaultInit;
+    }
   }
-  LLType *llelemty = DtoMemType(elemty);
+  return true;
+}
 
+/// Builds the constant for an array initializer element by element.
+LLConstant *buildConstArray(ArrayInitializer *arrinit, Type *arrty,
+                            Type *elemty, LLType *llelemty, size_t arrlen) {
   // true if array elements differ in type, can happen with array of unions
   bool mismatch = false;
 
@@ -437,18 +661,64 @@ LLConstant *DtoConstArrayInitializer(ArrayInitializer *arrinit,
     initvals[i] = elemDefaultInit;
   }
 
-  LLConstant *constarr;
   if (mismatch) {
-    constarr = LLConstantStruct::getAnon(gIR->context(),
-                                         initvals); // FIXME should this pack?
+    return LLConstantStruct::getAnon(gIR->context(),
+                                     initvals); // FIXME should this pack?
+  }
+  if (arrty->ty == Tvector) {
+    return llvm::ConstantVector::get(initvals);
+  }
+  return LLConstantArray::get(LLArrayType::get(llelemty, arrlen), initvals);
+}
+}
+
+LLConstant *DtoConstArrayInitializer(ArrayInitializer *arrinit,
+                                     Type *targetType) {
+  IF_LOG Logger::println("DtoConstArrayInitializer: %s | %s",
+                         arrinit->toChars(), targetType->toChars());
+  LOG_SCOPE;
+
+  assert(arrinit->value.dim == arrinit->index.dim);
+
+  // get base array type
+  Type *arrty = targetType->toBasetype();
+  size_t arrlen = arrinit->dim;
+
+  // for statis arrays, dmd does not include any trailing default
+  // initialized elements in the value/index lists
+  if (arrty->ty == Tsarray) {
+    TypeSArray *tsa = static_cast<TypeSArray *>(arrty);
+    arrlen = static_cast<size_t>(tsa->dim->toInteger());
+  }
+
+  // make sure the number of initializers is sane
+  if (arrinit->index.dim > arrlen || arrinit->dim > arrlen) {
+    error(arrinit->loc, "too many initializers, %llu, for array[%llu]",
+          static_cast<unsigned long long>(arrinit->index.dim),
+          static_cast<unsigned long long>(arrlen));
+    fatal();
+  }
+
+  // get elem type
+  Type *elemty;
+  if (arrty->ty == Tvector) {
+    elemty = static_cast<TypeVector *>(arrty)->elementType();
   } else {
-    if (arrty->ty == Tvector) {
-      constarr = llvm::ConstantVector::get(initvals);
-    } else {
-      constarr =
-          LLConstantArray::get(LLArrayType::get(llelemty, arrlen), initvals);
-    }
+    elemty = arrty->nextOf();
   }
+  LLType *llelemty = DtoMemType(elemty);
+
+  LLConstant *constarr = nullptr;
+  std::vector<Expression *> elems;
+  if (arrty->ty != Tvector &&
+      getInitializerElements(arrinit, elemty, arrlen, elems)) {
+    constarr = tryConstDataArray(elemty, arrlen,
+                                 [&](size_t i) { return elems[i]; });
+  }
+  if (!constarr) {
+    constarr = buildConstArray(arrinit, arrty, elemty, llelemty, arrlen);
+  }
+
 
   //     std::cout << "constarr: " << *constarr << std::endl;
 
@@ -537,6 +807,15 @@ llvm::Constant *arrayLiteralToConst(IRState *p, ArrayLiteralExp *ale) {
   // element types (with different fields being initialized), we can end up
   // with different types for the initializer values. In this case, we
   // generate a packed struct constant instead of an array constant.
+  Type *arrty = ale->type->toBasetype();
+  if (arrty->ty == Tarray || arrty->ty == Tsarray || arrty->ty == Tpointer) {
+    if (LLConstant *c = tryConstDataArray(
+            arrty->nextOf(), ale->elements->dim,
+            [ale](size_t i) { return indexArrayLiteral(ale, i); })) {
+      return c;
+    }
+  }
+
   LLType *elementType = nullptr;
   bool differentTypes = false;
 
@@ -659,6 +938,7 @@ DSliceValue *DtoNewDynArray(Loc &loc, Type *arrayType, DValue *dim,
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, fnname);
 
   // call allocator
+  emitGCAllocationSiteOf(loc, eltType, arrayLen);
   LLValue *newArray =
       gIR->CreateCallOrInvoke(fn, arrayTypeInfo, arrayLen, ".gc_mem")
           .getInstruction();
@@ -667,20 +947,13 @@ DSliceValue *DtoNewDynArray(Loc &loc, Type *arrayType, DValue *dim,
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-DSliceValue *DtoNewMulDimDynArray(Loc &loc, Type *arrayType, DValue **dims,
-                                  size_t ndims) {
-  IF_LOG Logger::println("DtoNewMulDimDynArray : %s", arrayType->toChars());
-  LOG_SCOPE;
-
+// Calls _d_newarraym(i)TX, allocating each sub-array separately. Returns the
+// resulting void[].
+static LLValue *callNewArraym(Loc &loc, Type *arrayType, Type *vtype,
+                              DValue **dims, size_t ndims) {
   // typeinfo arg
   LLValue *arrayTypeInfo = DtoTypeInfoOf(arrayType);
 
-  // get value type
-  Type *vtype = arrayType->toBasetype();
-  for (size_t i = 0; i < ndims; ++i) {
-    vtype = vtype->nextOf();
-  }
-
   // get runtime function
   const char *fnname =
       vtype->isZeroInit() ? "_d_newarraymTX" : "_d_newarraymiTX";
@@ -725,10 +998,131 @@ DSliceValue *DtoNewMulDimDynArray(Loc &loc, Type *arrayType, DValue **dims,
   DtoStore(DtoBitCast(array, getPtrToType(DtoSize_t())),
            DtoGEPi(darray, 0, 1, ".ptr"));
 
-  // call allocator
+  // call allocator (only the innermost arrays count for the profiled size)
+  if (global.params.tracegc) {
+    LLValue *count = DtoRVal(dims[0]);
+    for (size_t i = 1; i < ndims; ++i) {
+      count = gIR->ir->CreateMul(count, DtoRVal(dims[i]));
+    }
+    emitGCAllocationSiteOf(loc, vtype, count);
+  }
+  return gIR->CreateCallOrInvoke(fn, arrayTypeInfo, DtoLoad(darray), ".gc_mem")
+      .getInstruction();
+}
+
+// Allocates a multi-dimensional array as a single GC block (see
+// -contiguous-muldim-arrays): the slices of the outermost array, followed by
+// the slices of each inner level and finally by all elements, with the slices
+// pointing into the block. Sizes overflowing size_t are left to the runtime,
+// which throws an OutOfMemoryError. Returns the resulting void[].
+static LLValue *newContiguousMulDimArray(Loc &loc, Type *arrayType,
+                                         Type *vtype, DValue **dims,
+                                         size_t ndims) {
+  LLValue *overflow = nullptr;
+  auto checked = [&](llvm::Intrinsic::ID id, LLValue *lhs, LLValue *rhs) {
+    LLFunction *fn =
+        llvm::Intrinsic::getDeclaration(&gIR->module, id, DtoSize_t());
+    LLValue *res = gIR->ir->CreateCall(fn, {lhs, rhs});
+    LLValue *o = gIR->ir->CreateExtractValue(res, 1);
+    overflow = overflow ? gIR->ir->CreateOr(overflow, o) : o;
+    return gIR->ir->CreateExtractValue(res, 0);
+  };
+
+  // The number of slots of each level, their types and their offsets in the
+  // block.
+  std::vector<LLValue *> counts(ndims), offsets(ndims);
+  std::vector<LLType *> slotTypes(ndims);
+  LLValue *count = DtoConstSize_t(1);
+  LLValue *size = DtoConstSize_t(0);
+  Type *t = arrayType->toBasetype();
+  for (size_t k = 0; k < ndims; ++k) {
+    t = t->nextOf();
+    slotTypes[k] = DtoMemType(t);
+    count = checked(llvm::Intrinsic::umul_with_overflow, count,
+                    DtoRVal(dims[k]));
+    counts[k] = count;
+
+    const uint64_t align = getABITypeAlign(slotTypes[k]);
+    size = gIR->ir->CreateAnd(
+        checked(llvm::Intrinsic::uadd_with_overflow, size,
+                DtoConstSize_t(align - 1)),
+        DtoConstSize_t(~(align - 1)));
+    offsets[k] = size;
+    size = checked(
+        llvm::Intrinsic::uadd_with_overflow, size,
+        checked(llvm::Intrinsic::umul_with_overflow, count,
+                DtoConstSize_t(getTypeAllocSize(slotTypes[k]))));
+  }
+
+  LLValue *result =
+      DtoRawAlloca(DtoType(Type::tvoid->arrayOf()), 0, ".newarray");
+  llvm::BasicBlock *allocbb = gIR->insertBB("newarray.contiguous");
+  llvm::BasicBlock *runtimebb =
+      gIR->insertBBAfter(allocbb, "newarray.runtime");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(runtimebb, "newarray.end");
+  llvm::BranchInst::Create(runtimebb, allocbb, overflow, gIR->scopebb());
+
+  gIR->scope() = IRScope(allocbb);
+  LLFunction *fn = getRuntimeFunction(loc, gIR->module, "_d_allocmemory");
+  if (global.params.tracegc) {
+    emitGCAllocationSiteOf(loc, vtype, counts[ndims - 1]);
+  }
+  LLValue *mem =
+      gIR->CreateCallOrInvoke(fn, size, ".gc_mem").getInstruction();
+  if (vtype->isZeroInit()) {
+    DtoMemSetZero(mem, size);
+  }
+
+  std::vector<LLValue *> levels(ndims);
+  for (size_t k = 0; k < ndims; ++k) {
+    levels[k] = DtoBitCast(DtoGEP1(mem, offsets[k], true),
+                           getPtrToType(slotTypes[k]));
+  }
+  for (size_t k = 0; k + 1 < ndims; ++k) {
+    LLValue *innerLength = DtoRVal(dims[k + 1]);
+    emitElementLoop(counts[k], [&](LLValue *i) {
+      LLValue *innerPtr =
+          DtoGEP1(levels[k + 1], gIR->ir->CreateMul(i, innerLength), true);
+      DtoStore(DtoSlice(innerPtr, innerLength),
+               DtoGEP1(levels[k], i, true));
+    });
+  }
+  if (!vtype->isZeroInit()) {
+    DtoArrayInit(loc, levels[ndims - 1], counts[ndims - 1],
+                 toElem(vtype->defaultInitLiteral(loc)));
+  }
+
+  DtoStore(DtoSlice(DtoBitCast(levels[0], getVoidPtrType()),
+                    DtoRVal(dims[0])),
+           result);
+  llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(runtimebb);
+  DtoStore(callNewArraym(loc, arrayType, vtype, dims, ndims), result);
+  llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(endbb);
+  return DtoLoad(result);
+}
+
+DSliceValue *DtoNewMulDimDynArray(Loc &loc, Type *arrayType, DValue **dims,
+                                  size_t ndims) {
+  IF_LOG Logger::println("DtoNewMulDimDynArray : %s", arrayType->toChars());
+  LOG_SCOPE;
+
+  // get value type
+  Type *vtype = arrayType->toBasetype();
+  for (size_t i = 0; i < ndims; ++i) {
+    vtype = vtype->nextOf();
+  }
+
+  // Non-zero default initializers are only expanded for scalars.
+  const bool contiguous =
+      opts::contiguousMulDimArrays &&
+      (vtype->isZeroInit() || vtype->toBasetype()->isscalar());
   LLValue *newptr =
-      gIR->CreateCallOrInvoke(fn, arrayTypeInfo, DtoLoad(darray), ".gc_mem")
-          .getInstruction();
+      contiguous ? newContiguousMulDimArray(loc, arrayType, vtype, dims, ndims)
+                 : callNewArraym(loc, arrayType, vtype, dims, ndims);
 
   IF_LOG Logger::cout() << "final ptr = " << *newptr << '\n';
 
@@ -736,6 +1130,233 @@ DSliceValue *DtoNewMulDimDynArray(Loc &loc, Type *arrayType, DValue **dims,
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Inline fast paths for growing arrays in place.
+//
+// druntime (rt/lifetime.d) stores the used length (in bytes) of an appendable
+// GC block in the block itself: in its last byte for small blocks (<= 256
+// bytes), in its last 2 bytes for medium blocks (< PAGESIZE) and in the first
+// size_t for large blocks (whose data starts at offset LARGEPREFIX). An array
+// can be grown in place if it ends at the used length and the block has
+// capacity left.
+//
+// The block info of an array is cached in the function (per array lvalue): the
+// array's data pointer, a pointer to the size_t-sized word containing the used
+// length, the shift and mask to extract it from that word and the block's
+// capacity in bytes. The cached pointer keeps the block alive (the cache being
+// on the stack). The cache is refreshed on the fast path when the array's data
+// pointer doesn't match the cached one, and invalidated after each runtime
+// call (which may have moved or extended the block), so that arrays which are
+// never grown in place don't pay for querying the GC.
+
+namespace {
+// These must match druntime's rt/lifetime.d and core/memory.d.
+const uint64_t LifetimePageSize = 4096;
+const uint64_t LifetimeMaxSmallSize = 256;
+const uint64_t LifetimeLargePrefix = 16;
+const uint64_t LifetimeLargePad = LifetimeLargePrefix + 1;
+const uint64_t BlkAttrAppendable = 0x8;
+const uint64_t BlkAttrStructFinal = 0x20;
+
+enum AppendCacheField {
+  ACF_Ptr,
+  ACF_UsedSlot,
+  ACF_Shift,
+  ACF_Mask,
+  ACF_Capacity
+};
+}
+
+static llvm::StructType *getAppendCacheType() {
+  LLType *sizeTy = DtoSize_t();
+  LLType *fields[] = {getVoidPtrType(), sizeTy->getPointerTo(), sizeTy, sizeTy,
+                      sizeTy};
+  return llvm::StructType::get(gIR->context(), fields);
+}
+
+/// Whether appending to/growing arrays of the given type is done inline if
+/// possible.
+static bool growsInPlaceInline(Type *arrayType) {
+  // druntime updates the used length of shared arrays atomically, which the
+  // inline path doesn't.
+  Type *tb = arrayType->toBasetype();
+  return isOptimizationEnabled() && !arrayType->isShared() &&
+         !tb->isShared() && !tb->nextOf()->isShared();
+}
+
+static LLValue *getAppendCache(LLValue *arrayLVal) {
+  LLValue *&cache = gIR->funcGen().arrayAppendCaches[arrayLVal];
+  if (!cache) {
+    llvm::StructType *type = getAppendCacheType();
+    cache = DtoRawAlloca(type, 0, ".appendcache");
+    // Initialize it (to no capacity) in the entry block.
+    new llvm::StoreInst(llvm::Constant::getNullValue(type), cache,
+                        gIR->topallocapoint());
+  }
+  return cache;
+}
+
+/// Returns the module-internal function refreshing the cache for the array data
+/// at the given pointer.
+static llvm::Function *getAppendCacheUpdateFunction(Loc &loc) {
+  const char *name = "ldc.array.updateappendcache";
+  if (llvm::Function *fn = gIR->module.getFunction(name)) {
+    return fn;
+  }
+
+  llvm::LLVMContext &ctx = gIR->context();
+  LLType *sizeTy = DtoSize_t();
+  LLType *voidPtrTy = getVoidPtrType();
+  LLType *params[] = {getAppendCacheType()->getPointerTo(), voidPtrTy};
+  auto fn = llvm::Function::Create(
+      llvm::FunctionType::get(LLType::getVoidTy(ctx), params, false),
+      llvm::GlobalValue::InternalLinkage, name, &gIR->module);
+  fn->addFnAttr(llvm::Attribute::NoUnwind);
+  // Keep the fast paths small.
+  fn->addFnAttr(llvm::Attribute::NoInline);
+
+  llvm::Function *sizeOfFn = getRuntimeFunction(loc, gIR->module, "gc_sizeOf");
+  llvm::Function *getAttrFn =
+      getRuntimeFunction(loc, gIR->module, "gc_getAttr");
+
+  auto argIt = fn->arg_begin();
+  LLValue *cache = &*argIt++;
+  LLValue *ptr = &*argIt;
+
+  const uint64_t wordSize = getTypeAllocSize(sizeTy);
+  const bool littleEndian = gDataLayout->isLittleEndian();
+  auto entrybb = llvm::BasicBlock::Create(ctx, "", fn);
+  auto basebb = llvm::BasicBlock::Create(ctx, "block.base", fn);
+  auto largebb = llvm::BasicBlock::Create(ctx, "block.large", fn);
+  auto endbb = llvm::BasicBlock::Create(ctx, "block.end", fn);
+  llvm::IRBuilder<> b(entrybb);
+  auto c = [sizeTy](uint64_t v) { return LLConstantInt::get(sizeTy, v); };
+  auto field = [&](unsigned i) {
+#if LDC_LLVM_VER >= 307
+    return b.CreateStructGEP(getAppendCacheType(), cache, i);
+#else
+    return b.CreateStructGEP(cache, i);
+#endif
+  };
+
+
+  // Small and medium blocks start with the array data.
+  LLValue *size = b.CreateCall(sizeOfFn, ptr);
+  b.CreateCondBr(b.CreateICmpNE(size, c(0)), basebb, largebb);
+
+  b.SetInsertPoint(basebb);
+  LLValue *isSmall = b.CreateICmpULE(size, c(LifetimeMaxSmallSize));
+  LLValue *pad = b.CreateSelect(isSmall, c(1), c(2));
+  LLValue *baseOk = b.CreateICmpULT(size, c(LifetimePageSize));
+  LLValue *baseSlot = b.CreateGEP(ptr, b.CreateSub(size, c(wordSize)));
+  LLValue *baseShift =
+      littleEndian ? b.CreateMul(b.CreateSub(c(wordSize), pad), c(8))
+                   : c(0);
+  LLValue *baseMask = b.CreateSelect(isSmall, c(0xff), c(0xffff));
+  LLValue *baseCap = b.CreateSub(size, pad);
+  b.CreateBr(endbb);
+
+  b.SetInsertPoint(largebb);
+  LLValue *largeBase = b.CreateGEP(
+      ptr, LLConstantInt::getSigned(sizeTy, -int64_t(LifetimeLargePrefix)));
+  LLValue *largeSize = b.CreateCall(sizeOfFn, largeBase);
+  LLValue *largeOk = b.CreateICmpUGE(largeSize, c(LifetimePageSize));
+  LLValue *largeCap = b.CreateSub(largeSize, c(LifetimeLargePad));
+  b.CreateBr(endbb);
+
+  b.SetInsertPoint(endbb);
+  auto phi = [&](LLValue *fromBase, LLValue *fromLarge) {
+    llvm::PHINode *p = b.CreatePHI(fromBase->getType(), 2);
+    p->addIncoming(fromBase, basebb);
+    p->addIncoming(fromLarge, largebb);
+    return p;
+  };
+  LLValue *base = phi(ptr, largeBase);
+  LLValue *ok = phi(baseOk, largeOk);
+  LLValue *slot = phi(baseSlot, largeBase);
+  LLValue *shift = phi(baseShift, c(0));
+  LLValue *mask = phi(baseMask, c(~uint64_t(0)));
+  LLValue *cap = phi(baseCap, largeCap);
+
+  // Blocks with the TypeInfo of structs to be finalized appended aren't
+  // handled.
+  LLValue *attr = b.CreateZExt(b.CreateCall(getAttrFn, base), sizeTy);
+  attr = b.CreateAnd(attr, c(BlkAttrAppendable | BlkAttrStructFinal));
+  ok = b.CreateAnd(ok, b.CreateICmpEQ(attr, c(BlkAttrAppendable)));
+
+  slot = b.CreateBitCast(slot, sizeTy->getPointerTo());
+  b.CreateStore(ptr, field(ACF_Ptr));
+  b.CreateStore(slot, field(ACF_UsedSlot));
+  b.CreateStore(shift, field(ACF_Shift));
+  b.CreateStore(mask, field(ACF_Mask));
+  b.CreateStore(b.CreateSelect(ok, cap, c(0)),
+                field(ACF_Capacity));
+  b.CreateRetVoid();
+
+  return fn;
+}
+
+/// Emits the check whether the array with the given data pointer and length
+/// can be grown in place to newLength elements, as per the cache (refreshed
+/// first if it doesn't describe the array's block). If so, the used length
+/// stored in the GC block is updated and control continues in grownbb,
+/// otherwise in slowbb.
+static void emitInPlaceGrowth(Loc &loc, LLValue *cache, LLValue *ptr,
+                              LLValue *length, LLValue *newLength,
+                              Type *elemType, llvm::BasicBlock *grownbb,
+                              llvm::BasicBlock *slowbb) {
+  LLValue *elemSize = DtoConstSize_t(getTypeAllocSize(DtoMemType(elemType)));
+  LLValue *usedBytes = gIR->ir->CreateMul(length, elemSize);
+  LLValue *newUsedBytes = gIR->ir->CreateMul(newLength, elemSize);
+
+  llvm::BasicBlock *refreshbb = gIR->insertBBBefore(grownbb, "grow.refresh");
+  llvm::BasicBlock *capbb = gIR->insertBBBefore(grownbb, "grow.capacity");
+  llvm::BasicBlock *usedbb = gIR->insertBBBefore(grownbb, "grow.used");
+  llvm::BasicBlock *updatebb = gIR->insertBBBefore(grownbb, "grow.update");
+
+  LLValue *voidPtr = DtoBitCast(ptr, getVoidPtrType());
+  LLValue *cachedPtr = DtoLoad(DtoGEPi(cache, 0, ACF_Ptr));
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(voidPtr, cachedPtr), capbb,
+                        refreshbb);
+
+  gIR->scope() = IRScope(refreshbb);
+  gIR->ir->CreateCall(getAppendCacheUpdateFunction(loc), {cache, voidPtr});
+  llvm::BranchInst::Create(capbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(capbb);
+  LLValue *cap = DtoLoad(DtoGEPi(cache, 0, ACF_Capacity));
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULE(newUsedBytes, cap), usedbb,
+                        slowbb);
+
+  // The array must end at the used length of the block.
+  gIR->scope() = IRScope(usedbb);
+  LLValue *slot = DtoLoad(DtoGEPi(cache, 0, ACF_UsedSlot));
+  LLValue *shift = DtoLoad(DtoGEPi(cache, 0, ACF_Shift));
+  LLValue *mask = DtoLoad(DtoGEPi(cache, 0, ACF_Mask));
+  LLValue *word = DtoLoad(slot);
+  LLValue *used = gIR->ir->CreateAnd(gIR->ir->CreateLShr(word, shift), mask);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(used, usedBytes), updatebb,
+                        slowbb);
+
+  gIR->scope() = IRScope(updatebb);
+  LLValue *newWord = gIR->ir->CreateOr(
+      gIR->ir->CreateAnd(word,
+                         gIR->ir->CreateNot(gIR->ir->CreateShl(mask, shift))),
+      gIR->ir->CreateShl(newUsedBytes, shift));
+  DtoStore(newWord, slot);
+  llvm::BranchInst::Create(grownbb, gIR->scopebb());
+}
+
+/// Emits the runtime call growing the array on the slow path, and invalidates
+/// the cache.
+template <typename EmitCall>
+static void emitGrowthSlowPath(LLValue *cache, EmitCall emitCall) {
+  emitCall();
+  DtoStore(getNullPtr(getVoidPtrType()), DtoGEPi(cache, 0, ACF_Ptr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 DSliceValue *DtoResizeDynArray(Loc &loc, Type *arrayType, DValue *array,
                                LLValue *newdim) {
   IF_LOG Logger::println("DtoResizeDynArray : %s", arrayType->toChars());
@@ -754,15 +1375,69 @@ DSliceValue *DtoResizeDynArray(Loc &loc, Type *arrayType, DValue *array,
   LLFunction *fn =
       getRuntimeFunction(loc, gIR->module, zeroInit ? "_d_arraysetlengthT"
                                                     : "_d_arraysetlengthiT");
+  auto callRuntime = [&]() {
+    emitGCAllocationSiteOf(loc, arrayType->toBasetype()->nextOf(), newdim);
+    return gIR->CreateCallOrInvoke(fn, DtoTypeInfoOf(arrayType), newdim,
+                                   DtoBitCast(DtoLVal(array),
+                                              fn->getFunctionType()
+                                                  ->getParamType(2)),
+                                   ".gc_mem")
+        .getInstruction();
+  };
+
+  if (!growsInPlaceInline(arrayType)) {
+    return getSlice(arrayType, callRuntime());
+  }
 
-  LLValue *newArray =
-      gIR->CreateCallOrInvoke(
-             fn, DtoTypeInfoOf(arrayType), newdim,
-             DtoBitCast(DtoLVal(array), fn->getFunctionType()->getParamType(2)),
-             ".gc_mem")
-          .getInstruction();
+  // Shrinking only sets the length. Growing zero-initialized arrays is done in
+  // place if possible, like druntime does.
+  LLValue *lval = DtoLVal(array);
+  LLValue *length = DtoArrayLen(array);
+  LLValue *ptr = DtoArrayPtr(array);
 
-  return getSlice(arrayType, newArray);
+  llvm::BasicBlock *shrinkbb = gIR->insertBB("setlength.shrink");
+  llvm::BasicBlock *growbb =
+      zeroInit ? gIR->insertBBAfter(shrinkbb, "setlength.grow") : nullptr;
+  llvm::BasicBlock *grownbb =
+      zeroInit ? gIR->insertBBAfter(growbb, "setlength.grown") : nullptr;
+  llvm::BasicBlock *slowbb =
+      gIR->insertBBAfter(zeroInit ? grownbb : shrinkbb, "setlength.slow");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(slowbb, "setlength.end");
+
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULE(newdim, length), shrinkbb,
+                        zeroInit ? growbb : slowbb);
+
+  gIR->scope() = IRScope(shrinkbb);
+  DtoStore(newdim, DtoGEPi(lval, 0, 0));
+  llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+  if (zeroInit) {
+    LLValue *cache = getAppendCache(lval);
+    Type *elemType = arrayType->toBasetype()->nextOf();
+
+    gIR->scope() = IRScope(growbb);
+    emitInPlaceGrowth(loc, cache, ptr, length, newdim, elemType, grownbb,
+                      slowbb);
+
+    gIR->scope() = IRScope(grownbb);
+    LLValue *elemSize = DtoConstSize_t(getTypeAllocSize(DtoMemType(elemType)));
+    DtoMemSetZero(DtoGEP1(ptr, length, true),
+                  gIR->ir->CreateMul(gIR->ir->CreateSub(newdim, length),
+                                     elemSize));
+    DtoStore(newdim, DtoGEPi(lval, 0, 0));
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    gIR->scope() = IRScope(slowbb);
+    emitGrowthSlowPath(cache, callRuntime);
+  } else {
+    gIR->scope() = IRScope(slowbb);
+    callRuntime();
+  }
+  llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+  // The runtime functions assign the result to the array too.
+  gIR->scope() = IRScope(endbb);
+  return new DSliceValue(arrayType, DtoArrayLen(array), DtoArrayPtr(array));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -781,13 +1456,40 @@ void DtoCatAssignElement(Loc &loc, Type *arrayType, DValue *array,
   DValue *expVal = toElem(exp);
 
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, "_d_arrayappendcTX");
-  LLValue *appendedArray =
-      gIR->CreateCallOrInvoke(
-             fn, DtoTypeInfoOf(arrayType),
-             DtoBitCast(DtoLVal(array), fn->getFunctionType()->getParamType(1)),
-             DtoConstSize_t(1), ".appendedArray")
-          .getInstruction();
-  appendedArray = DtoAggrPaint(appendedArray, DtoType(arrayType));
+  auto callRuntime = [&]() {
+    emitGCAllocationSiteOf(loc, arrayType->toBasetype()->nextOf());
+    gIR->CreateCallOrInvoke(
+        fn, DtoTypeInfoOf(arrayType),
+        DtoBitCast(DtoLVal(array), fn->getFunctionType()->getParamType(1)),
+        DtoConstSize_t(1), ".appendedArray");
+  };
+
+  if (growsInPlaceInline(arrayType)) {
+    // Only call druntime if the array cannot be grown in place (the element
+    // might have modified the array).
+    LLValue *lval = DtoLVal(array);
+    LLValue *cache = getAppendCache(lval);
+    LLValue *length = DtoArrayLen(array);
+    LLValue *newLength = gIR->ir->CreateAdd(length, DtoConstSize_t(1));
+
+    llvm::BasicBlock *grownbb = gIR->insertBB("append.grown");
+    llvm::BasicBlock *slowbb = gIR->insertBBAfter(grownbb, "append.slow");
+    llvm::BasicBlock *endbb = gIR->insertBBAfter(slowbb, "append.end");
+    emitInPlaceGrowth(loc, cache, DtoArrayPtr(array), length, newLength,
+                      arrayType->toBasetype()->nextOf(), grownbb, slowbb);
+
+    gIR->scope() = IRScope(grownbb);
+    DtoStore(newLength, DtoGEPi(lval, 0, 0));
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    gIR->scope() = IRScope(slowbb);
+    emitGrowthSlowPath(cache, callRuntime);
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    gIR->scope() = IRScope(endbb);
+  } else {
+    callRuntime();
+  }
 
   LLValue *ptr = DtoArrayPtr(array);
   ptr = DtoGEP1(ptr, oldLength, true, ".lastElem");
@@ -805,13 +1507,17 @@ DSliceValue *DtoCatAssignArray(Loc &loc, DValue *arr, Expression *exp) {
 
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, "_d_arrayappendT");
   // Call _d_arrayappendT(TypeInfo ti, byte[] *px, byte[] y)
+  LLValue *y =
+      DtoAggrPaint(DtoSlice(exp), fn->getFunctionType()->getParamType(2));
+  if (global.params.tracegc) {
+    emitGCAllocationSiteOf(loc, arrayType->toBasetype()->nextOf(),
+                           DtoExtractValue(y, 0));
+  }
   LLValue *newArray =
       gIR->CreateCallOrInvoke(
              fn, DtoTypeInfoOf(arrayType),
              DtoBitCast(DtoLVal(arr), fn->getFunctionType()->getParamType(1)),
-             DtoAggrPaint(DtoSlice(exp),
-                          fn->getFunctionType()->getParamType(2)),
-             ".appendedArray")
+             y, ".appendedArray")
           .getInstruction();
 
   return getSlice(arrayType, newArray);
@@ -884,6 +1590,10 @@ DSliceValue *DtoCatArrays(Loc &loc, Type *arrayType, Expression *exp1,
 
   auto newArray =
       gIR->funcGen().callOrInvoke(fn, args, ".appendedArray").getInstruction();
+  if (global.params.tracegc) {
+    emitGCAllocationSiteOf(loc, arrayType->toBasetype()->nextOf(),
+                           DtoExtractValue(newArray, 0));
+  }
   return getSlice(arrayType, newArray);
 }
 
@@ -896,7 +1606,9 @@ DSliceValue *DtoAppendDChar(Loc &loc, DValue *arr, Expression *exp,
   // Prepare arguments
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, func);
 
-  // Call function (ref string x, dchar c)
+  // Call function (ref string x, dchar c); the number of appended code units
+  // is only known to druntime.
+  emitGCAllocationSite(loc, nullptr);
   LLValue *newArray =
       gIR->CreateCallOrInvoke(
              fn,
@@ -927,12 +1639,7 @@ DSliceValue *DtoAppendDCharToUnicodeString(Loc &loc, DValue *arr,
 
 ////////////////////////////////////////////////////////////////////////////////
 // helper for eq and cmp
-static LLValue *DtoArrayEqCmp_impl(Loc &loc, const char *func, DValue *l,
-                                   DValue *r, bool useti) {
-  IF_LOG Logger::println("comparing arrays");
-  LLFunction *fn = getRuntimeFunction(loc, gIR->module, func);
-  assert(fn);
-
+static void DtoCastToCommonArrayType(Loc &loc, DValue *&l, DValue *&r) {
   // find common dynamic array type
   Type *commonType = l->type->toBasetype()->nextOf()->arrayOf();
 
@@ -940,6 +1647,15 @@ static LLValue *DtoArrayEqCmp_impl(Loc &loc, const char *func, DValue *l,
   Logger::println("casting to dynamic arrays");
   l = DtoCastArray(loc, l, commonType);
   r = DtoCastArray(loc, r, commonType);
+}
+
+static LLValue *DtoArrayEqCmp_impl(Loc &loc, const char *func, DValue *l,
+                                   DValue *r, bool useti) {
+  IF_LOG Logger::println("comparing arrays");
+  LLFunction *fn = getRuntimeFunction(loc, gIR->module, func);
+  assert(fn);
+
+  DtoCastToCommonArrayType(loc, l, r);
 
   LLSmallVector<LLValue *, 3> args;
 
@@ -958,6 +1674,173 @@ static LLValue *DtoArrayEqCmp_impl(Loc &loc, const char *func, DValue *l,
   return gIR->funcGen().callOrInvoke(fn, args).getInstruction();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Inline array comparisons.
+//
+// Instead of calling druntime, which calls the virtual TypeInfo.equals() or
+// TypeInfo.compare() per element, arrays of element types whose TypeInfo
+// compares bitwise (or just numerically) are compared inline, with the same
+// semantics.
+
+/// Returns whether druntime's TypeInfo.equals() for the given (element) type
+/// is a memcmp.
+static bool isBitwiseEqualityComparable(Type *t) {
+  t = t->toBasetype();
+  switch (t->ty) {
+  case Tsarray:
+    return isBitwiseEqualityComparable(t->nextOf());
+  case Tstruct: {
+    // Structs without __xopEquals are compared bitwise.
+    StructDeclaration *sd = static_cast<TypeStruct *>(t)->sym;
+    return sd->sizeok == SIZEOKdone && !sd->xeq;
+  }
+  case Tvoid:
+  case Tpointer:
+  case Tnull:
+    return true;
+  case Tvector:
+    // isintegral() is true for vectors of integers.
+    return false;
+  default:
+    return t->isintegral();
+  }
+}
+
+/// Returns whether druntime's TypeInfo.compare() for the given (element) type
+/// orders like memcmp.
+static bool isMemcmpOrdered(Type *t) {
+  t = t->toBasetype();
+  return t->isintegral() && t->isunsigned() && t->size() == 1;
+}
+
+/// Returns whether druntime's TypeInfo.compare() for the given (element) type
+/// is a plain integer comparison.
+static bool isIntegerOrdered(Type *t) {
+  t = t->toBasetype();
+  return (t->isintegral() && t->ty != Tvector) || t->ty == Tpointer;
+}
+
+static LLValue *DtoArrayEqualsInline(Loc &loc, DValue *l, DValue *r) {
+  IF_LOG Logger::println("comparing arrays inline");
+  LOG_SCOPE;
+
+  DtoCastToCommonArrayType(loc, l, r);
+  Type *elemType = l->type->toBasetype()->nextOf();
+  LLValue *len = DtoArrayLen(l);
+  LLValue *ptr1 = DtoArrayPtr(l);
+  LLValue *ptr2 = DtoArrayPtr(r);
+
+  llvm::BasicBlock *entrybb = gIR->scopebb();
+  llvm::BasicBlock *cmpbb = gIR->insertBB("arrayeq.cmp");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(cmpbb, "arrayeq.end");
+
+  // The lengths must be equal.
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(len, DtoArrayLen(r)), cmpbb,
+                        endbb);
+  gIR->scope() = IRScope(cmpbb);
+
+  llvm::PHINode *res = nullptr;
+  if (isBitwiseEqualityComparable(elemType)) {
+    LLValue *nbytes = gIR->ir->CreateMul(
+        len, DtoConstSize_t(getTypeAllocSize(DtoMemType(elemType))));
+    LLValue *cmp = DtoMemCmp(ptr1, ptr2, nbytes);
+    cmp = gIR->ir->CreateICmpEQ(cmp, LLConstantInt::get(cmp->getType(), 0));
+    llvm::BasicBlock *cmpendbb = gIR->scopebb();
+    llvm::BranchInst::Create(endbb, cmpendbb);
+
+    gIR->scope() = IRScope(endbb);
+    res = gIR->ir->CreatePHI(LLType::getInt1Ty(gIR->context()), 2);
+    res->addIncoming(cmp, cmpendbb);
+  } else {
+    // Compare the floating-point elements one by one (NaN != NaN).
+    llvm::BasicBlock *loopbb = gIR->insertBBBefore(endbb, "arrayeq.loop");
+    llvm::BasicBlock *bodybb = gIR->insertBBBefore(endbb, "arrayeq.body");
+    llvm::BranchInst::Create(loopbb, cmpbb);
+
+    gIR->scope() = IRScope(loopbb);
+    llvm::PHINode *idx = gIR->ir->CreatePHI(DtoSize_t(), 2, "arrayeq.idx");
+    idx->addIncoming(DtoConstSize_t(0), cmpbb);
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(idx, len), bodybb, endbb);
+
+    gIR->scope() = IRScope(bodybb);
+    DLValue elem1(elemType, DtoGEP1(ptr1, idx, true));
+    DLValue elem2(elemType, DtoGEP1(ptr2, idx, true));
+    LLValue *eq = DtoBinNumericEquals(loc, &elem1, &elem2, TOKequal);
+    idx->addIncoming(gIR->ir->CreateAdd(idx, DtoConstSize_t(1)),
+                     gIR->scopebb());
+    llvm::BasicBlock *bodyendbb = gIR->scopebb();
+    gIR->ir->CreateCondBr(eq, loopbb, endbb);
+
+    gIR->scope() = IRScope(endbb);
+    res = gIR->ir->CreatePHI(LLType::getInt1Ty(gIR->context()), 3);
+    res->addIncoming(DtoConstBool(true), loopbb);
+    res->addIncoming(DtoConstBool(false), bodyendbb);
+  }
+  res->addIncoming(DtoConstBool(false), entrybb);
+
+  return res;
+}
+
+static LLValue *DtoArrayCompareInline(Loc &loc, DValue *l, DValue *r) {
+  IF_LOG Logger::println("comparing arrays inline");
+  LOG_SCOPE;
+
+  DtoCastToCommonArrayType(loc, l, r);
+  Type *elemType = l->type->toBasetype()->nextOf();
+  LLValue *len1 = DtoArrayLen(l);
+  LLValue *len2 = DtoArrayLen(r);
+  LLValue *ptr1 = DtoArrayPtr(l);
+  LLValue *ptr2 = DtoArrayPtr(r);
+
+  // If the common elements are equal, the shorter array is the smaller one.
+  LLType *intTy = LLType::getInt32Ty(gIR->context());
+  LLValue *minLen =
+      gIR->ir->CreateSelect(gIR->ir->CreateICmpULT(len1, len2), len1, len2);
+  LLValue *lenCmp = gIR->ir->CreateSelect(
+      gIR->ir->CreateICmpULT(len1, len2), LLConstantInt::getSigned(intTy, -1),
+      gIR->ir->CreateZExt(gIR->ir->CreateICmpUGT(len1, len2), intTy));
+
+  if (isMemcmpOrdered(elemType)) {
+    LLValue *cmp = DtoMemCmp(ptr1, ptr2, minLen);
+    return gIR->ir->CreateSelect(
+        gIR->ir->CreateICmpEQ(cmp, LLConstantInt::get(cmp->getType(), 0)),
+        lenCmp, cmp);
+  }
+
+  // Find the first differing element.
+  llvm::BasicBlock *entrybb = gIR->scopebb();
+  llvm::BasicBlock *loopbb = gIR->insertBB("arraycmp.loop");
+  llvm::BasicBlock *bodybb = gIR->insertBBAfter(loopbb, "arraycmp.body");
+  llvm::BasicBlock *diffbb = gIR->insertBBAfter(bodybb, "arraycmp.diff");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(diffbb, "arraycmp.end");
+  llvm::BranchInst::Create(loopbb, entrybb);
+
+  gIR->scope() = IRScope(loopbb);
+  llvm::PHINode *idx = gIR->ir->CreatePHI(DtoSize_t(), 2, "arraycmp.idx");
+  idx->addIncoming(DtoConstSize_t(0), entrybb);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(idx, minLen), bodybb, endbb);
+
+  gIR->scope() = IRScope(bodybb);
+  LLValue *elem1 = DtoLoad(DtoGEP1(ptr1, idx, true));
+  LLValue *elem2 = DtoLoad(DtoGEP1(ptr2, idx, true));
+  idx->addIncoming(gIR->ir->CreateAdd(idx, DtoConstSize_t(1)), bodybb);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpNE(elem1, elem2), diffbb, loopbb);
+
+  gIR->scope() = IRScope(diffbb);
+  LLValue *lt = isLLVMUnsigned(elemType->toBasetype())
+                    ? gIR->ir->CreateICmpULT(elem1, elem2)
+                    : gIR->ir->CreateICmpSLT(elem1, elem2);
+  LLValue *diff = gIR->ir->CreateSelect(
+      lt, LLConstantInt::getSigned(intTy, -1), LLConstantInt::get(intTy, 1));
+  llvm::BranchInst::Create(endbb, diffbb);
+
+  gIR->scope() = IRScope(endbb);
+  llvm::PHINode *res = gIR->ir->CreatePHI(intTy, 2);
+  res->addIncoming(lenCmp, loopbb);
+  res->addIncoming(diff, diffbb);
+  return res;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r) {
   LLValue *res = nullptr;
@@ -967,6 +1850,15 @@ LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r) {
     const auto predicate = eqTokToICmpPred(op);
     res = gIR->ir->CreateICmp(predicate, DtoArrayLen(l), DtoConstSize_t(0));
   } else {
+    Type *t = l->type->toBasetype()->nextOf()->toBasetype();
+    if (isBitwiseEqualityComparable(t) ||
+        (t->isfloating() && t->ty != Tvector)) {
+      res = DtoArrayEqualsInline(loc, l, r);
+      if (eqTokToICmpPred(op) == llvm::ICmpInst::ICMP_NE) {
+        res = gIR->ir->CreateNot(res);
+      }
+      return res;
+    }
     res = DtoArrayEqCmp_impl(loc, "_adEq2", l, r, true);
     const auto predicate = eqTokToICmpPred(op, /* invert = */ true);
     res = gIR->ir->CreateICmp(predicate, res, DtoConstInt(0));
@@ -983,8 +1875,8 @@ LLValue *DtoArrayCompare(Loc &loc, TOK op, DValue *l, DValue *r) {
 
   if (!res) {
     Type *t = l->type->toBasetype()->nextOf()->toBasetype();
-    if (t->ty == Tchar) {
-      res = DtoArrayEqCmp_impl(loc, "_adCmpChar", l, r, false);
+    if (isIntegerOrdered(t)) {
+      res = DtoArrayCompareInline(loc, l, r);
     } else {
       res = DtoArrayEqCmp_impl(loc, "_adCmp2", l, r, true);
     }
@@ -1216,3 +2108,322 @@ void DtoBoundsCheckFailCall(IRState *irs, Loc &loc) {
   // the function does not return
   irs->ir->CreateUnreachable();
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Inline UTF decoding for foreach over strings.
+//
+// The frontend lowers `foreach (dchar c; str)` and `foreach (i, dchar c; str)`
+// over char[] and wchar[] to _aApplycd1/2 resp. _aApplywd1/2 calls, which
+// decode the string and call the loop body delegate for each code point.
+// When optimizing, the decoding loop is emitted inline instead and calls the
+// body directly, so that it can be inlined. UTF-8 strings are checked for
+// ASCII-only blocks of 16 bytes at a time. Valid multi-byte sequences are
+// decoded inline; on an invalid one, the rest of the string is passed to the
+// runtime function, which throws right away (without calling the body), just
+// as it would have for the whole string.
+
+namespace {
+class StringApply {
+public:
+  StringApply(Loc &loc, const char *fnName, DValue *str, DValue *body)
+      : loc(loc), fnName(fnName), utf8(fnName[7] == 'c'),
+        withIndex(fnName[9] == '2'), len(DtoArrayLen(str)),
+        ptr(DtoArrayPtr(str)), dg(DtoRVal(body)),
+        bodyFty(DtoIrTypeFunction(body)) {
+    LLType *sizeTy = DtoSize_t();
+    LLType *i32Ty = LLType::getInt32Ty(gIR->context());
+    posSlot = DtoRawAlloca(sizeTy, 0, "foreach.pos");
+    nextSlot = DtoRawAlloca(sizeTy, 0, "foreach.nextpos");
+    indexSlot = DtoRawAlloca(sizeTy, 0, "foreach.index");
+    charSlot = DtoRawAlloca(i32Ty, 0, "foreach.dchar");
+    resultSlot = DtoRawAlloca(i32Ty, 0, "foreach.result");
+  }
+
+  /// Emits the loop, returning the result of the apply function.
+  LLValue *emit();
+
+private:
+  Loc &loc;
+  const char *fnName;
+  const bool utf8;
+  const bool withIndex;
+  LLValue *len;
+  LLValue *ptr;
+  LLValue *dg;
+  IrFuncTy &bodyFty;
+  LLValue *posSlot;    // index of the next code unit to decode
+  LLValue *nextSlot;   // index after the decoded code point
+  LLValue *indexSlot;  // index of the decoded code point (body argument)
+  LLValue *charSlot;   // the decoded code point (body argument)
+  LLValue *resultSlot; // result of the last body call
+  llvm::BasicBlock *condbb = nullptr;
+  llvm::BasicBlock *callbb = nullptr;
+  llvm::BasicBlock *invalidbb = nullptr;
+  llvm::BasicBlock *endbb = nullptr;
+
+  static LLConstantInt *size(uint64_t v) { return DtoConstSize_t(v); }
+  static LLConstantInt *i32(unsigned v) { return DtoConstUint(v); }
+
+  /// Loads the code unit at index pos, zero-extended to 32 bits.
+  LLValue *loadUnit(LLValue *pos) {
+    LLValue *unit = DtoLoad(DtoGEP1(ptr, pos, true));
+    return gIR->ir->CreateZExt(unit, LLType::getInt32Ty(gIR->context()));
+  }
+
+  /// Calls the body delegate (`int delegate(void*)` or
+  /// `int delegate(void* index, void* c)`), storing its result and returning
+  /// whether the loop is to be continued.
+  LLValue *callBody(LLValue *index, LLValue *c) {
+    DtoStore(index, indexSlot);
+    DtoStore(c, charSlot);
+
+    LLValue *funcptr = gIR->ir->CreateExtractValue(dg, 1, ".funcptr");
+    LLFunctionType *fty =
+        DtoExtractFunctionType(funcptr->getType()->getContainedType(0));
+    LLValue *context = DtoBitCast(
+        gIR->ir->CreateExtractValue(dg, 0, ".ptr"), fty->getParamType(0));
+
+    LLValue *args[2] = {indexSlot, charSlot};
+    if (!withIndex) {
+      args[0] = charSlot;
+    } else if (bodyFty.reverseParams) {
+      std::swap(args[0], args[1]);
+    }
+    args[0] = DtoBitCast(args[0], fty->getParamType(1));
+
+    LLValue *result;
+    if (withIndex) {
+      args[1] = DtoBitCast(args[1], fty->getParamType(2));
+      result = gIR->CreateCallOrInvoke(funcptr, context, args[0], args[1])
+                   .getInstruction();
+    } else {
+      result =
+          gIR->CreateCallOrInvoke(funcptr, context, args[0]).getInstruction();
+    }
+    DtoStore(result, resultSlot);
+    return gIR->ir->CreateICmpEQ(result, i32(0));
+  }
+
+  /// Branches to callbb with the given code point and next index if valid,
+  /// and to invalidbb otherwise.
+  void decoded(LLValue *c, LLValue *next, LLValue *valid) {
+    DtoStore(c, charSlot);
+    DtoStore(next, nextSlot);
+    gIR->ir->CreateCondBr(valid, callbb, invalidbb);
+  }
+
+  void emitAsciiBlocks(LLValue *pos, llvm::BasicBlock *scalarbb);
+  void emitDecodeUtf8(LLValue *pos);
+  void emitDecodeUtf16(LLValue *pos);
+};
+}
+
+/// Processes 16 bytes at once if they are all ASCII (i.e., none of them has
+/// the high bit set), continuing with scalarbb otherwise.
+void StringApply::emitAsciiBlocks(LLValue *pos, llvm::BasicBlock *scalarbb) {
+  llvm::LLVMContext &ctx = gIR->context();
+  LLType *i64Ty = LLType::getInt64Ty(ctx);
+  llvm::BasicBlock *checkbb = gIR->insertBBBefore(scalarbb, "foreach.ascii16");
+  llvm::BasicBlock *blockbb =
+      gIR->insertBBBefore(scalarbb, "foreach.ascii16.body");
+  llvm::BasicBlock *nextbb =
+      gIR->insertBBBefore(scalarbb, "foreach.ascii16.next");
+
+  LLValue *remaining = gIR->ir->CreateSub(len, pos);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpUGE(remaining, size(16)), checkbb,
+                        scalarbb);
+
+  gIR->scope() = IRScope(checkbb);
+  LLValue *words = DtoBitCast(DtoGEP1(ptr, pos, true), i64Ty->getPointerTo());
+  LLValue *lo = gIR->ir->CreateAlignedLoad(words, 1);
+  LLValue *hi = gIR->ir->CreateAlignedLoad(DtoGEP1(words, size(1), true), 1);
+  LLValue *highBits = gIR->ir->CreateAnd(
+      gIR->ir->CreateOr(lo, hi), LLConstantInt::get(i64Ty, 0x8080808080808080));
+  DtoStore(gIR->ir->CreateAdd(pos, size(16)), nextSlot);
+  gIR->ir->CreateCondBr(
+      gIR->ir->CreateICmpEQ(highBits, LLConstantInt::get(i64Ty, 0)), blockbb,
+      scalarbb);
+
+  gIR->scope() = IRScope(blockbb);
+  LLValue *i = DtoLoad(posSlot);
+  LLValue *next = gIR->ir->CreateAdd(i, size(1));
+  DtoStore(next, posSlot);
+  LLValue *cont = callBody(i, loadUnit(i));
+  gIR->ir->CreateCondBr(cont, nextbb, endbb);
+
+  gIR->scope() = IRScope(nextbb);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(next, DtoLoad(nextSlot)), condbb,
+                        blockbb);
+}
+
+void StringApply::emitDecodeUtf8(LLValue *pos) {
+  llvm::BasicBlock *asciibb = gIR->insertBBBefore(callbb, "foreach.ascii");
+  llvm::BasicBlock *leadbb = gIR->insertBBBefore(callbb, "foreach.utf8.lead");
+  llvm::BasicBlock *seqbbs[3];
+  for (auto &bb : seqbbs) {
+    bb = gIR->insertBBBefore(callbb, "foreach.utf8.seq");
+  }
+
+  LLValue *b0 = loadUnit(pos);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(b0, i32(0x80)), asciibb, leadbb);
+
+  gIR->scope() = IRScope(asciibb);
+  decoded(b0, gIR->ir->CreateAdd(pos, size(1)),
+          LLConstantInt::getTrue(gIR->context()));
+
+  // Lead bytes C2..DF, E0..EF and F0..F4 start sequences of 2, 3 and 4 bytes.
+  // 80..C1 are continuation bytes or start overlong 2-byte sequences, and
+  // F5..FF start sequences above 0x10FFFF.
+  gIR->scope() = IRScope(leadbb);
+  auto lengthSwitch = gIR->ir->CreateSwitch(b0, invalidbb, 0x100 - 0xC2);
+  for (unsigned b = 0xC2; b <= 0xF4; ++b) {
+    const unsigned n = b < 0xE0 ? 2 : b < 0xF0 ? 3 : 4;
+    lengthSwitch->addCase(i32(b), seqbbs[n - 2]);
+  }
+
+  static const uint64_t minValue[] = {0x80, 0x800, 0x10000};
+  for (unsigned n = 2; n <= 4; ++n) {
+    llvm::BasicBlock *decodebb =
+        gIR->insertBBAfter(seqbbs[n - 2], "foreach.utf8.decode");
+
+    gIR->scope() = IRScope(seqbbs[n - 2]);
+    LLValue *complete =
+        gIR->ir->CreateICmpUGE(gIR->ir->CreateSub(len, pos), size(n));
+    gIR->ir->CreateCondBr(complete, decodebb, invalidbb);
+
+    gIR->scope() = IRScope(decodebb);
+    LLValue *c = gIR->ir->CreateAnd(b0, i32(0x7F >> n));
+    LLValue *valid = LLConstantInt::getTrue(gIR->context());
+    for (unsigned k = 1; k < n; ++k) {
+      LLValue *bk = loadUnit(gIR->ir->CreateAdd(pos, size(k)));
+      valid = gIR->ir->CreateAnd(
+          valid, gIR->ir->CreateICmpEQ(gIR->ir->CreateAnd(bk, i32(0xC0)),
+                                       i32(0x80)));
+      c = gIR->ir->CreateOr(gIR->ir->CreateShl(c, i32(6)),
+                            gIR->ir->CreateAnd(bk, i32(0x3F)));
+    }
+    // Reject overlong encodings, surrogates and values above 0x10FFFF.
+    valid = gIR->ir->CreateAnd(
+        valid, gIR->ir->CreateICmpUGE(c, i32(minValue[n - 2])));
+    if (n == 3) {
+      LLValue *surrogate = gIR->ir->CreateICmpULT(
+          gIR->ir->CreateSub(c, i32(0xD800)), i32(0x800));
+      valid = gIR->ir->CreateAnd(valid, gIR->ir->CreateNot(surrogate));
+    } else if (n == 4) {
+      valid = gIR->ir->CreateAnd(valid,
+                                 gIR->ir->CreateICmpULE(c, i32(0x10FFFF)));
+    }
+    decoded(c, gIR->ir->CreateAdd(pos, size(n)), valid);
+  }
+}
+
+void StringApply::emitDecodeUtf16(LLValue *pos) {
+  llvm::BasicBlock *singlebb = gIR->insertBBBefore(callbb, "foreach.utf16");
+  llvm::BasicBlock *abovebb =
+      gIR->insertBBBefore(callbb, "foreach.utf16.above");
+  llvm::BasicBlock *highbb = gIR->insertBBBefore(callbb, "foreach.utf16.high");
+  llvm::BasicBlock *pairbb = gIR->insertBBBefore(callbb, "foreach.utf16.pair");
+
+  LLValue *w0 = loadUnit(pos);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(w0, i32(0xD800)), singlebb,
+                        abovebb);
+
+  gIR->scope() = IRScope(singlebb);
+  decoded(w0, gIR->ir->CreateAdd(pos, size(1)),
+          LLConstantInt::getTrue(gIR->context()));
+
+  // E000..FFFD are single code units, FFFE and FFFF are rejected by druntime.
+  gIR->scope() = IRScope(abovebb);
+  llvm::BasicBlock *bmpbb = gIR->insertBBAfter(abovebb, "foreach.utf16.bmp");
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpUGE(w0, i32(0xE000)), bmpbb, highbb);
+  gIR->scope() = IRScope(bmpbb);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(w0, i32(0xFFFE)), singlebb,
+                        invalidbb);
+
+  // A high surrogate must be followed by a low surrogate.
+  gIR->scope() = IRScope(highbb);
+  LLValue *isHigh = gIR->ir->CreateICmpULT(w0, i32(0xDC00));
+  LLValue *hasNext =
+      gIR->ir->CreateICmpUGE(gIR->ir->CreateSub(len, pos), size(2));
+  gIR->ir->CreateCondBr(gIR->ir->CreateAnd(isHigh, hasNext), pairbb,
+                        invalidbb);
+
+  gIR->scope() = IRScope(pairbb);
+  LLValue *w1 = loadUnit(gIR->ir->CreateAdd(pos, size(1)));
+  LLValue *lowOffset = gIR->ir->CreateSub(w1, i32(0xDC00));
+  LLValue *c = gIR->ir->CreateShl(gIR->ir->CreateSub(w0, i32(0xD800)), i32(10));
+  c = gIR->ir->CreateAdd(gIR->ir->CreateOr(c, lowOffset), i32(0x10000));
+  decoded(c, gIR->ir->CreateAdd(pos, size(2)),
+          gIR->ir->CreateICmpULT(lowOffset, i32(0x400)));
+}
+
+LLValue *StringApply::emit() {
+  condbb = gIR->insertBB("foreach.str.cond");
+  llvm::BasicBlock *scalarbb = gIR->insertBBAfter(condbb, "foreach.decode");
+  callbb = gIR->insertBBAfter(scalarbb, "foreach.str.body");
+  invalidbb = gIR->insertBBAfter(callbb, "foreach.str.invalid");
+  endbb = gIR->insertBBAfter(invalidbb, "foreach.str.end");
+
+  DtoStore(size(0), posSlot);
+  DtoStore(i32(0), resultSlot);
+  gIR->ir->CreateBr(condbb);
+
+  gIR->scope() = IRScope(condbb);
+  LLValue *pos = DtoLoad(posSlot);
+  llvm::BasicBlock *firstbb = gIR->insertBBAfter(condbb, "foreach.str.next");
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpULT(pos, len), firstbb, endbb);
+
+  gIR->scope() = IRScope(firstbb);
+  if (utf8) {
+    emitAsciiBlocks(pos, scalarbb);
+  } else {
+    gIR->ir->CreateBr(scalarbb);
+  }
+
+  gIR->scope() = IRScope(scalarbb);
+  if (utf8) {
+    emitDecodeUtf8(pos);
+  } else {
+    emitDecodeUtf16(pos);
+  }
+
+  gIR->scope() = IRScope(callbb);
+  DtoStore(DtoLoad(nextSlot), posSlot);
+  gIR->ir->CreateCondBr(callBody(pos, DtoLoad(charSlot)), condbb, endbb);
+
+  // Let druntime throw the UnicodeException for the rest of the string.
+  gIR->scope() = IRScope(invalidbb);
+  llvm::Function *fn = getRuntimeFunction(loc, gIR->module, fnName);
+  LLFunctionType *fty = fn->getFunctionType();
+  LLValue *rest = DtoAggrPair(gIR->ir->CreateSub(len, pos),
+                              DtoGEP1(ptr, pos, true), ".rest");
+  LLValue *result =
+      gIR->CreateCallOrInvoke(fn, DtoAggrPaint(rest, fty->getParamType(0)),
+                              DtoAggrPaint(dg, fty->getParamType(1)))
+          .getInstruction();
+  DtoStore(result, resultSlot);
+  gIR->ir->CreateBr(endbb);
+
+  gIR->scope() = IRScope(endbb);
+  return DtoLoad(resultSlot);
+}
+
+DValue *DtoInlineStringApply(Loc &loc, FuncDeclaration *fdecl,
+                             Expressions *arguments) {
+  // _aApplycd1, _aApplycd2, _aApplywd1, _aApplywd2
+  const char *name = fdecl->ident->toChars();
+  if (!isOptimizationEnabled() || fdecl->linkage != LINKc ||
+      strncmp(name, "_aApply", 7) != 0 || strlen(name) != 10 ||
+      (name[7] != 'c' && name[7] != 'w') || name[8] != 'd' ||
+      (name[9] != '1' && name[9] != '2') || arguments->dim != 2) {
+    return nullptr;
+  }
+
+  IF_LOG Logger::println("Inlining %s", name);
+  LOG_SCOPE;
+
+  DValue *str = toElem((*arguments)[0]);
+  DValue *dg = toElem((*arguments)[1]);
+  StringApply apply(loc, name, str, dg);
+  return new DImValue(Type::tint32, apply.emit());
+}
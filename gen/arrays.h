@@ -14,6 +14,7 @@
 #ifndef LDC_GEN_ARRAYS_H
 #define LDC_GEN_ARRAYS_H
 
+#include "arraytypes.h"
 #include "tokens.h"
 #include "gen/llvm.h"
 
@@ -22,6 +23,7 @@ class ArrayLiteralExp;
 class DSliceValue;
 class DValue;
 class Expression;
+class FuncDeclaration;
 struct IRState;
 struct Loc;
 class Type;
@@ -70,6 +72,12 @@ DSliceValue *DtoAppendDCharToString(Loc &loc, DValue *arr, Expression *exp);
 DSliceValue *DtoAppendDCharToUnicodeString(Loc &loc, DValue *arr,
                                            Expression *exp);
 
+/// Emits the _aApply{c,w}d{1,2} runtime call lowered from a foreach over a
+/// string as inline decoding loop if optimizing. Returns null if the function
+/// isn't one of those or the call is to be emitted normally.
+DValue *DtoInlineStringApply(Loc &loc, FuncDeclaration *fdecl,
+                             Expressions *arguments);
+
 LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r);
 LLValue *DtoArrayCompare(Loc &loc, TOK op, DValue *l, DValue *r);
 
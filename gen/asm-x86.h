@@ -2569,6 +2569,68 @@ struct AsmProcessor {
     return true;
   }
 
+  // Whether the instruction can only access memory through its explicit memory
+  // operands (e.g. no stack, string or I/O instructions, branches or calls).
+  bool accessesOnlyOperandMemory(int nOperands) {
+    if (nOperands == 0 ||
+        (opInfo->implicitClobbers & (Clb_SP | Clb_DI | Clb_SI))) {
+      return false;
+    }
+
+    switch (op) {
+    case Op_UpdUpd:
+    case Op_UpdUpdF:
+      // xchg with a memory operand is implicitly locked, i.e. a full barrier
+      for (int i = 0; i < nOperands; i++) {
+        if (operands[i].cls == Opr_Mem) {
+          return false;
+        }
+      }
+      return true;
+    case Op_DstSrc:
+      // lds, les, lfs, lgs and lss load segment registers
+      return !(strlen(opIdent->string) == 3 && opIdent->string[0] == 'l' &&
+               opIdent->string[2] == 's');
+    case Op_SrcSrcMMX:
+      // maskmovq and maskmovdqu store to [EDI]
+      return strncmp(opIdent->string, "maskmov", 7) != 0;
+    case Op_Adjust:
+    case Op_Dst:
+    case Op_Upd:
+    case Op_DstF:
+    case Op_UpdF:
+    case Op_DstSrcF:
+    case Op_UpdSrcF:
+    case Op_DstSrcFW:
+    case Op_UpdSrcFW:
+    case Op_DstSrcSSE:
+    case Op_UpdSrcSSE:
+    case Op_DstSrcMMX:
+    case Op_DstSrcImmS:
+    case Op_DstSrcImmM:
+    case Op_ExtSrcImmS:
+    case Op_UpdSrcShft:
+    case Op_DstSrcNT:
+    case Op_SrcSrc:
+    case Op_SrcSrcF:
+    case Op_SrcSrcFW:
+    case Op_SrcSrcSSEF:
+    case Op_Src_DXAXF:
+    case Op_Shift:
+    case Op_bswap:
+    case Op_cmpxchg:
+    case Op_imul:
+    case Op_imul2:
+    case Op_imul1:
+    case Op_movsx:
+    case Op_movzx:
+    case Op_mul:
+      return true;
+    default:
+      return false;
+    }
+  }
+
   // also set impl clobbers
   bool formatInstruction(int nOperands, AsmCode *asmcode) {
     const char *fmt;
@@ -2825,6 +2887,8 @@ struct AsmProcessor {
       asmcode->regs[Reg_EDX] = true;
     }
 
+    asmcode->accessesOnlyOperandMemory = accessesOnlyOperandMemory(nOperands);
+
     insnTemplate << ' ';
     for (int i__ = 0; i__ < nOperands; i__++) {
       int i;
@@ -2906,6 +2970,11 @@ struct AsmProcessor {
             asmcode->regs[clbr_reg] = true;
           }
         }
+        // segment, control, debug and test registers affect memory accesses
+        if ((operand->reg >= Reg_CS && operand->reg <= Reg_GS) ||
+            operand->reg >= Reg_CR0) {
+          asmcode->accessesOnlyOperandMemory = false;
+        }
         if (opTakesLabel()) {
           insnTemplate << '*';
         }
@@ -2916,6 +2985,15 @@ struct AsmProcessor {
         */
         break;
       case Opr_Mem:
+        // Only plain references to variables (turned into memory operands
+        // below) are known to the optimizer.
+        if (operand->baseReg != Reg_Invalid ||
+            operand->indexReg != Reg_Invalid ||
+            operand->segmentPrefix != Reg_Invalid ||
+            operand->symbolDisplacement.dim == 0) {
+          asmcode->accessesOnlyOperandMemory = false;
+        }
+
         // better: use output operands for simple variable references
         if ((opInfo->operands[i] & Opr_Update) == Opr_Update) {
           mode = Mode_Update;
@@ -63,10 +63,14 @@ struct AsmCode {
   std::vector<bool> regs;
   unsigned dollarLabel;
   int clobbersMemory;
+  // Whether the instruction accesses no memory except through its memory
+  // operands referring to variables.
+  bool accessesOnlyOperandMemory;
   explicit AsmCode(int n_regs) {
     regs.resize(n_regs, false);
     dollarLabel = 0;
     clobbersMemory = 0;
+    accessesOnlyOperandMemory = false;
   }
 };
 
@@ -179,6 +183,9 @@ void AsmStatement_toIR(AsmStatement *stmt, IRState *irs) {
   //#define HOST_WIDE_INT long
   // HOST_WIDE_INT var_frame_offset; // "frame_offset" is a macro
   bool clobbers_mem = code->clobbersMemory;
+  if (clobbers_mem || !code->accessesOnlyOperandMemory) {
+    asmblock->accessesOnlyOperandMemory = false;
+  }
   int input_idx = 0;
   int n_outputs = 0;
   int arg_map[10];
@@ -695,6 +702,15 @@ void CompoundAsmStatement_toIR(CompoundAsmStatement *stmt, IRState *p) {
   llvm::CallInst *call = p->ir->CreateCall(
       ia, args, retty == LLType::getVoidTy(gIR->context()) ? "" : "asm");
 
+#if LDC_LLVM_VER >= 309
+  // Let the optimizer move unrelated loads and stores across the asm block if
+  // all of its memory accesses go through its (pointer) operands.
+  if (asmblock->accessesOnlyOperandMemory) {
+    call->addAttribute(llvm::AttributeSet::FunctionIndex,
+                       llvm::Attribute::InaccessibleMemOrArgMemOnly);
+  }
+#endif
+
   IF_LOG Logger::cout() << "Complete asm statement: " << *call << '\n';
 
   // capture abi return value
@@ -25,6 +25,7 @@ public:
 
   AttrBuilder &clear();
   AttrBuilder &add(LLAttribute attribute);
+  AttrBuilder &add(llvm::StringRef attribute);
   AttrBuilder &remove(LLAttribute attribute);
   AttrBuilder &merge(const AttrBuilder &other);
 
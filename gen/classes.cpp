@@ -10,9 +10,12 @@
 #include "gen/llvm.h"
 #include "aggregate.h"
 #include "declaration.h"
+#include "id.h"
 #include "init.h"
+#include "module.h"
 #include "mtype.h"
 #include "target.h"
+#include "driver/cl_options.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
 #include "gen/dvalue.h"
@@ -20,7 +23,10 @@
 #include "gen/irstate.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/mangling.h"
 #include "gen/nested.h"
+#include "gen/optimizer.h"
+#include "gen/profilegc.h"
 #include "gen/rttibuilder.h"
 #include "gen/runtime.h"
 #include "gen/structs.h"
@@ -77,6 +83,30 @@ void DtoResolveClass(ClassDeclaration *cd) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static ClassFlags::Type build_classinfo_flags(ClassDeclaration *cd);
+
+namespace {
+// These must match druntime's core/memory.d.
+const unsigned BlkAttrFinalize = 0x1;
+const unsigned BlkAttrNoScan = 0x2;
+
+/// Returns the GC block attributes for instances of the given class, as
+/// computed by druntime's _d_allocclass from the ClassInfo flags.
+unsigned getClassBlkAttr(ClassDeclaration *cd) {
+  const ClassFlags::Type flags = build_classinfo_flags(cd);
+  unsigned attr = 0;
+  // extern(C++) classes don't have a ClassInfo pointer in their vtable, so the
+  // GC can't finalize them
+  if ((flags & ClassFlags::hasDtor) && !(flags & ClassFlags::isCPPclass)) {
+    attr |= BlkAttrFinalize;
+  }
+  if (flags & ClassFlags::noPointers) {
+    attr |= BlkAttrNoScan;
+  }
+  return attr;
+}
+}
+
 DValue *DtoNewClass(Loc &loc, TypeClass *tc, NewExp *newexp) {
   // resolve type
   DtoResolveClass(tc->sym);
@@ -94,8 +124,8 @@ DValue *DtoNewClass(Loc &loc, TypeClass *tc, NewExp *newexp) {
     DValue *res = DtoCallFunction(newexp->loc, nullptr, &dfn, newexp->newargs);
     mem = DtoBitCast(DtoRVal(res), DtoType(tc), ".newclass_custom");
   }
-  // default allocator
-  else {
+  // COM objects are malloc'ed by druntime
+  else if (tc->sym->isCOMclass()) {
     llvm::Function *fn =
         getRuntimeFunction(loc, gIR->module, "_d_allocclass");
     LLConstant *ci = DtoBitCast(getIrAggr(tc->sym)->getClassInfoSymbol(),
@@ -104,6 +134,20 @@ DValue *DtoNewClass(Loc &loc, TypeClass *tc, NewExp *newexp) {
         gIR->CreateCallOrInvoke(fn, ci, ".newclass_gc_alloc").getInstruction();
     mem = DtoBitCast(mem, DtoType(tc), ".newclass_gc");
   }
+  // default allocator: call the GC directly with the size and block
+  // attributes _d_allocclass would derive from the ClassInfo
+  else {
+    llvm::Function *fn = getRuntimeFunction(loc, gIR->module, "gc_malloc");
+    LLConstant *ci =
+        DtoBitCast(getIrAggr(tc->sym)->getClassInfoSymbol(),
+                   fn->getFunctionType()->getParamType(2));
+    emitGCAllocationSite(loc, DtoConstSize_t(tc->sym->structsize));
+    mem = gIR->CreateCallOrInvoke(fn, DtoConstSize_t(tc->sym->structsize),
+                                  DtoConstUint(getClassBlkAttr(tc->sym)), ci,
+                                  ".newclass_gc_alloc")
+              .getInstruction();
+    mem = DtoBitCast(mem, DtoType(tc), ".newclass_gc");
+  }
 
   // init
   DtoInitClass(tc, mem);
@@ -162,22 +206,10 @@ void DtoInitClass(TypeClass *tc, LLValue *dst) {
     DtoStore(val, tmp);
   }
 
-  // Copy the rest from the static initializer, if any.
+  // Initialize the rest from the static initializer, if any.
   unsigned const firstDataIdx = isCPPclass ? 1 : 2;
-  uint64_t const dataBytes =
-      tc->sym->structsize - Target::ptrsize * firstDataIdx;
-  if (dataBytes == 0) {
-    return;
-  }
-
-  LLValue *dstarr = DtoGEPi(dst, 0, firstDataIdx);
-
-  // init symbols might not have valid types
-  LLValue *initsym = getIrAggr(tc->sym)->getInitSymbol();
-  initsym = DtoBitCast(initsym, DtoType(tc));
-  LLValue *srcarr = DtoGEPi(initsym, 0, firstDataIdx);
-
-  DtoMemCpy(dstarr, srcarr, DtoConstSize_t(dataBytes));
+  DtoCopyDefaultInit(tc->sym, dst, Target::ptrsize * firstDataIdx,
+                     Target::ptrsize);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -301,6 +333,72 @@ DValue *DtoCastClass(Loc &loc, DValue *val, Type *_to) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Casts the object `obj` to an interface using a thread-local cache for this
+// cast site, which remembers the ClassInfo of the last object successfully
+// cast and the offset of the interface in it. As long as the casts at a site
+// are from objects of the same class (the common case, e.g., for plugins),
+// the pointer is adjusted inline; otherwise druntime's _d_dynamic_cast walks
+// the class hierarchy and the cache is updated.
+static LLValue *castToInterfaceCached(LLValue *obj, LLValue *cinfo,
+                                      llvm::Function *func) {
+  static unsigned numCaches = 0;
+
+  LLType *voidPtrTy = getVoidPtrType();
+  LLStructType *cacheTy =
+      LLStructType::get(gIR->context(), {voidPtrTy, DtoSize_t()});
+  auto cache = new llvm::GlobalVariable(
+      gIR->module, cacheTy, false, llvm::GlobalValue::InternalLinkage,
+      LLConstant::getNullValue(cacheTy),
+      "ldc.ifacecast_cache." + llvm::Twine(numCaches++), nullptr,
+      llvm::GlobalVariable::GeneralDynamicTLSModel);
+
+  LLValue *objPtr = DtoBitCast(obj, voidPtrTy);
+  LLValue *null = LLConstant::getNullValue(voidPtrTy);
+
+  llvm::BasicBlock *entrybb = gIR->scopebb();
+  llvm::BasicBlock *notnullbb = gIR->insertBB("ifacecast.notnull");
+  llvm::BasicBlock *hitbb = gIR->insertBBAfter(notnullbb, "ifacecast.hit");
+  llvm::BasicBlock *slowbb = gIR->insertBBAfter(hitbb, "ifacecast.slow");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(slowbb, "ifacecast.end");
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(objPtr, null), endbb,
+                        notnullbb);
+
+  gIR->scope() = IRScope(notnullbb);
+  LLValue *vtbl = DtoLoad(DtoGEPi(obj, 0, 0));
+  LLValue *objInfo = DtoBitCast(DtoLoad(DtoGEPi(vtbl, 0, 0)), voidPtrTy);
+  LLValue *cachedInfo = DtoLoad(DtoGEPi(cache, 0, 0));
+  LLValue *cachedOffset = DtoLoad(DtoGEPi(cache, 0, 1));
+  gIR->ir->CreateCondBr(
+      gIR->ir->CreateICmpEQ(objInfo, cachedInfo, "ifacecast.cached"), hitbb,
+      slowbb);
+
+  gIR->scope() = IRScope(hitbb);
+  LLValue *hit = gIR->ir->CreateGEP(objPtr, cachedOffset);
+  llvm::BranchInst::Create(endbb, hitbb);
+
+  // Only successful casts are cached, failed ones keep the previous entry.
+  gIR->scope() = IRScope(slowbb);
+  LLValue *res = gIR->CreateCallOrInvoke(func, obj, cinfo).getInstruction();
+  res = DtoBitCast(res, voidPtrTy);
+  LLValue *failed = gIR->ir->CreateICmpEQ(res, null);
+  LLValue *offset =
+      gIR->ir->CreateSub(gIR->ir->CreatePtrToInt(res, DtoSize_t()),
+                         gIR->ir->CreatePtrToInt(objPtr, DtoSize_t()));
+  DtoStore(gIR->ir->CreateSelect(failed, cachedInfo, objInfo),
+           DtoGEPi(cache, 0, 0));
+  DtoStore(gIR->ir->CreateSelect(failed, cachedOffset, offset),
+           DtoGEPi(cache, 0, 1));
+  llvm::BasicBlock *slowendbb = gIR->scopebb();
+  llvm::BranchInst::Create(endbb, slowendbb);
+
+  gIR->scope() = IRScope(endbb);
+  llvm::PHINode *ret = gIR->ir->CreatePHI(voidPtrTy, 3);
+  ret->addIncoming(null, entrybb);
+  ret->addIncoming(hit, hitbb);
+  ret->addIncoming(res, slowendbb);
+  return ret;
+}
+
 DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
   // call:
   // Object _d_dynamic_cast(Object o, ClassInfo c)
@@ -328,13 +426,68 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
   cinfo = DtoBitCast(cinfo, funcTy->getParamType(1));
   assert(funcTy->getParamType(1) == cinfo->getType());
 
-  // call it
-  LLValue *ret = gIR->CreateCallOrInvoke(func, obj, cinfo).getInstruction();
+  const bool toInterface = to->sym->isInterfaceDeclaration() != nullptr;
+  if (to->sym->cpp || (toInterface && !isOptimizationEnabled())) {
+    // call it
+    LLValue *ret = gIR->CreateCallOrInvoke(func, obj, cinfo).getInstruction();
 
-  // cast return value
-  ret = DtoBitCast(ret, DtoType(_to));
+    // cast return value
+    ret = DtoBitCast(ret, DtoType(_to));
 
-  return new DImValue(_to, ret);
+    return new DImValue(_to, ret);
+  }
+
+  if (toInterface) {
+    return new DImValue(
+        _to, DtoBitCast(castToInterfaceCached(obj, cinfo, func), DtoType(_to)));
+  }
+
+  // Casting to a class, check inline whether the object is of exactly that
+  // class (comparing its ClassInfo, vtbl[0], like druntime does). For final
+  // classes, that's all there is to it; otherwise the base classes are walked
+  // by druntime if the check fails.
+  const bool isFinal = (to->sym->storage_class & STCfinal) != 0;
+  LLValue *null = LLConstant::getNullValue(obj->getType());
+
+  llvm::BasicBlock *entrybb = gIR->scopebb();
+  llvm::BasicBlock *notnullbb = gIR->insertBB("dyncast.notnull");
+  llvm::BasicBlock *slowbb =
+      isFinal ? nullptr : gIR->insertBBAfter(notnullbb, "dyncast.slow");
+  llvm::BasicBlock *endbb =
+      gIR->insertBBAfter(isFinal ? notnullbb : slowbb, "dyncast.end");
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(obj, null), endbb, notnullbb);
+
+  gIR->scope() = IRScope(notnullbb);
+  LLValue *vtbl = DtoLoad(DtoGEPi(obj, 0, 0));
+  LLValue *objInfo =
+      DtoBitCast(DtoLoad(DtoGEPi(vtbl, 0, 0)), cinfo->getType());
+  LLValue *isExact = gIR->ir->CreateICmpEQ(objInfo, cinfo, "dyncast.exact");
+
+  llvm::PHINode *ret;
+  if (isFinal) {
+    LLValue *res = gIR->ir->CreateSelect(isExact, obj, null);
+    llvm::BranchInst::Create(endbb, notnullbb);
+
+    gIR->scope() = IRScope(endbb);
+    ret = gIR->ir->CreatePHI(obj->getType(), 2);
+    ret->addIncoming(res, notnullbb);
+  } else {
+    gIR->ir->CreateCondBr(isExact, endbb, slowbb);
+
+    gIR->scope() = IRScope(slowbb);
+    LLValue *res = gIR->CreateCallOrInvoke(func, obj, cinfo).getInstruction();
+    res = DtoBitCast(res, obj->getType());
+    llvm::BasicBlock *slowendbb = gIR->scopebb();
+    llvm::BranchInst::Create(endbb, slowendbb);
+
+    gIR->scope() = IRScope(endbb);
+    ret = gIR->ir->CreatePHI(obj->getType(), 3);
+    ret->addIncoming(obj, notnullbb);
+    ret->addIncoming(res, slowendbb);
+  }
+  ret->addIncoming(null, entrybb);
+
+  return new DImValue(_to, DtoBitCast(ret, DtoType(_to)));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -354,6 +507,40 @@ DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *_to) {
   LLValue *ptr = DtoRVal(val);
   ptr = DtoBitCast(ptr, funcTy->getParamType(0));
 
+  // Like druntime, get the object from the Interface* in vtbl[0] and cast it,
+  // so that the inline checks of DtoDynamicCastObject apply. COM interfaces
+  // have no Interface* in their vtables.
+  TypeClass *from = static_cast<TypeClass *>(val->type->toBasetype());
+  if (!from->sym->isCOMinterface()) {
+    LLValue *null = LLConstant::getNullValue(ptr->getType());
+    LLType *objTy = DtoType(ClassDeclaration::object->type);
+
+    llvm::BasicBlock *entrybb = gIR->scopebb();
+    llvm::BasicBlock *notnullbb = gIR->insertBB("ifacecast.toobject");
+    llvm::BasicBlock *endbb = gIR->insertBBAfter(notnullbb, "ifacecast.done");
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(ptr, null), endbb, notnullbb);
+
+    gIR->scope() = IRScope(notnullbb);
+    LLStructType *interfaceTy = isaStruct(
+        DtoType(Type::typeinfoclass->fields[3]->type->nextOf()));
+    assert(interfaceTy);
+    LLValue *vtbl = DtoLoad(DtoBitCast(
+        ptr, interfaceTy->getPointerTo()->getPointerTo()->getPointerTo()));
+    LLValue *offset = DtoLoad(DtoGEPi(DtoLoad(vtbl), 0, 2));
+    LLValue *obj = gIR->ir->CreateGEP(DtoBitCast(ptr, getVoidPtrType()),
+                                      gIR->ir->CreateNeg(offset));
+    DImValue objVal(ClassDeclaration::object->type, DtoBitCast(obj, objTy));
+    LLValue *res = DtoRVal(DtoDynamicCastObject(loc, &objVal, _to));
+    llvm::BasicBlock *notnullendbb = gIR->scopebb();
+    llvm::BranchInst::Create(endbb, notnullendbb);
+
+    gIR->scope() = IRScope(endbb);
+    llvm::PHINode *ret = gIR->ir->CreatePHI(res->getType(), 2);
+    ret->addIncoming(LLConstant::getNullValue(res->getType()), entrybb);
+    ret->addIncoming(res, notnullendbb);
+    return new DImValue(_to, ret);
+  }
+
   // ClassInfo c
   TypeClass *to = static_cast<TypeClass *>(_to->toBasetype());
   DtoResolveClass(to->sym);
@@ -374,6 +561,42 @@ DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *_to) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#if LDC_LLVM_VER >= 309
+// Whether all vtables of (classes derived from) the given class are assumed
+// to be part of the LTO'd program, carrying the !type metadata. Only the
+// classes of the modules being compiled qualify; e.g., druntime's vtables lack
+// the metadata. C++ classes may be derived from in C++ code.
+static bool hasWholeProgramVtbl(ClassDeclaration *cd) {
+  if (!opts::wholeProgramVtables || cd->isInterfaceDeclaration() ||
+      cd->isCPPclass()) {
+    return false;
+  }
+  Module *m = cd->getModule();
+  return m && m->isRoot();
+}
+
+static llvm::MDString *getVtblTypeId(ClassDeclaration *cd) {
+  return llvm::MDString::get(gIR->context(),
+                             getMangledClassInfoSymbolName(cd));
+}
+#endif
+
+void DtoAddVtblTypeMetadata(ClassDeclaration *cd, llvm::GlobalVariable *vtbl) {
+#if LDC_LLVM_VER >= 309
+  if (!opts::wholeProgramVtables || cd->isInterfaceDeclaration() ||
+      cd->isCPPclass()) {
+    return;
+  }
+  // Objects point to the start of the vtable (the ClassInfo slot), which is
+  // thus the address point for the class and all of its base classes.
+  for (ClassDeclaration *b = cd; b; b = b->baseClass) {
+    vtbl->addTypeMetadata(0, getVtblTypeId(b));
+  }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 LLValue *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
                                    const char *name) {
   // sanity checks
@@ -393,6 +616,19 @@ LLValue *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
   funcval = DtoGEPi(funcval, 0, 0);
   // load vtbl ptr
   funcval = DtoLoad(funcval);
+#if LDC_LLVM_VER >= 309
+  // tell LLVM's whole-program devirtualization which vtables can be loaded
+  ClassDeclaration *cd =
+      static_cast<TypeClass *>(inst->type->toBasetype())->sym;
+  if (hasWholeProgramVtbl(cd)) {
+    LLValue *typeTestArgs[] = {
+        DtoBitCast(funcval, getVoidPtrType()),
+        llvm::MetadataAsValue::get(gIR->context(), getVtblTypeId(cd))};
+    LLValue *typeTest =
+        gIR->ir->CreateCall(GET_INTRINSIC_DECL(type_test), typeTestArgs);
+    gIR->ir->CreateCall(GET_INTRINSIC_DECL(assume), typeTest);
+  }
+#endif
   // index vtbl
   std::string vtblname = name;
   vtblname.append("@vtbl");
@@ -445,7 +681,7 @@ static LLConstant *build_offti_entry(ClassDeclaration *cd, VarDeclaration *vd) {
 }
 
 static LLConstant *build_offti_array(ClassDeclaration *cd, LLType *arrayT) {
-  IrAggr *iraggr = cd->ir->irAggr;
+  IrAggr *iraggr = getIrAggr(cd);
 
   size_t nvars = iraggr->varDecls.size();
   std::vector<LLConstant *> arrayInits(nvars);
@@ -651,15 +887,7 @@ LLConstant *DtoDefineClassInfo(ClassDeclaration *cd) {
   b.push_funcptr(defConstructor, defConstructorVar->type);
 
   // m_RTInfo
-  // The cases where getRTInfo is null are not quite here, but the code is
-  // modelled after what DMD does.
-  if (cd->getRTInfo) {
-    b.push(toConstElem(cd->getRTInfo, gIR));
-  } else if (flags & ClassFlags::noPointers) {
-    b.push_size_as_vp(0); // no pointers
-  } else {
-    b.push_size_as_vp(1); // has pointers
-  }
+  b.push_gc_info(cd, !(flags & ClassFlags::noPointers));
 
   /*size_t n = inits.size();
   for (size_t i=0; i<n; ++i)
@@ -682,3 +910,112 @@ LLConstant *DtoDefineClassInfo(ClassDeclaration *cd) {
   // return initializer
   return finalinit;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Inline fast paths for synchronized statements.
+//
+// The frontend lowers synchronized statements (and functions) to calls of
+// druntime's _d_monitorenter/_d_monitorexit for an object and to
+// _d_criticalenter/_d_criticalexit for a statement-private critical section.
+// Once druntime has initialized the object's monitor resp. the critical
+// section, these only lock or unlock its platform mutex (for monitors without
+// user-defined implementation). When optimizing, this check is done inline
+// and the platform mutex function is called directly; its uncontended path is
+// a single atomic instruction. druntime is still called to create monitors,
+// to initialize critical sections and for user-defined monitors.
+
+namespace {
+// These must match druntime's rt/monitor_.d and rt/critical_.d.
+// struct Monitor { IMonitor impl; DEvent[] devt; size_t refs; Mutex mtx; }
+const unsigned MonitorImplWord = 0;
+const unsigned MonitorMutexWord = 4;
+// struct D_CRITICAL_SECTION { D_CRITICAL_SECTION* next; Mutex mtx; }
+const unsigned CriticalSectionNextWord = 0;
+const unsigned CriticalSectionMutexWord = 1;
+}
+
+/// Loads the pointer-sized word at the given index, with acquire semantics.
+static LLValue *loadWordAcquire(LLValue *words, unsigned index,
+                                const char *name) {
+  llvm::LoadInst *load = gIR->ir->CreateLoad(DtoGEPi1(words, index), name);
+  load->setAlignment(getTypeAllocSize(load->getType()));
+#if LDC_LLVM_VER >= 309
+  load->setAtomic(llvm::AtomicOrdering::Acquire);
+#else
+  load->setAtomic(llvm::Acquire);
+#endif
+  return load;
+}
+
+static void callMutexFunction(Loc &loc, bool lock, LLValue *mutex) {
+  const char *name;
+  if (global.params.targetTriple->isOSWindows()) {
+    name = lock ? "EnterCriticalSection" : "LeaveCriticalSection";
+  } else {
+    name = lock ? "pthread_mutex_lock" : "pthread_mutex_unlock";
+  }
+  llvm::Function *fn = getRuntimeFunction(loc, gIR->module, name);
+  gIR->CreateCallOrInvoke(
+      fn, DtoBitCast(mutex, fn->getFunctionType()->getParamType(0)));
+}
+
+bool DtoInlineSynchronizedCall(Loc &loc, FuncDeclaration *fdecl,
+                               DValue *fnval, Expressions *arguments) {
+  Identifier *id = fdecl->ident;
+  const bool monitor = (id == Id::monitorenter || id == Id::monitorexit);
+  const bool enter = (id == Id::monitorenter || id == Id::criticalenter);
+  if (!isOptimizationEnabled() || fdecl->linkage != LINKc ||
+      arguments->dim != 1 ||
+      (!monitor && !enter && id != Id::criticalexit)) {
+    return false;
+  }
+
+  IF_LOG Logger::println("Inlining fast path of %s", id->toChars());
+  LOG_SCOPE;
+
+  LLValue *arg = DtoRVal(toElem((*arguments)[0]));
+  LLType *wordPtrTy = getVoidPtrType()->getPointerTo();
+  LLValue *words = DtoBitCast(arg, wordPtrTy);
+
+  // A critical section is known to be initialized when leaving it.
+  if (!monitor && !enter) {
+    callMutexFunction(loc, false, DtoGEPi1(words, CriticalSectionMutexWord));
+    return true;
+  }
+
+  llvm::BasicBlock *fastbb = gIR->insertBB("sync.fast");
+  llvm::BasicBlock *slowbb = gIR->insertBBAfter(fastbb, "sync.slow");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(slowbb, "sync.end");
+
+  LLValue *mutex;
+  if (monitor) {
+    // The monitor pointer follows the vtable pointer in the object.
+    llvm::BasicBlock *implbb = gIR->insertBBBefore(fastbb, "sync.impl");
+    LLValue *m = loadWordAcquire(words, 1, ".monitor");
+    gIR->ir->CreateCondBr(gIR->ir->CreateIsNotNull(m), implbb, slowbb);
+
+    gIR->scope() = IRScope(implbb);
+    LLValue *monitorWords = DtoBitCast(m, wordPtrTy);
+    LLValue *impl = DtoLoad(DtoGEPi1(monitorWords, MonitorImplWord), ".impl");
+    mutex = DtoGEPi1(monitorWords, MonitorMutexWord);
+    gIR->ir->CreateCondBr(gIR->ir->CreateIsNull(impl), fastbb, slowbb);
+  } else {
+    LLValue *next = loadWordAcquire(words, CriticalSectionNextWord, ".next");
+    mutex = DtoGEPi1(words, CriticalSectionMutexWord);
+    gIR->ir->CreateCondBr(gIR->ir->CreateIsNotNull(next), fastbb, slowbb);
+  }
+
+  gIR->scope() = IRScope(fastbb);
+  callMutexFunction(loc, enter, mutex);
+  gIR->ir->CreateBr(endbb);
+
+  gIR->scope() = IRScope(slowbb);
+  LLValue *callee = DtoCallableValue(fnval);
+  gIR->CreateCallOrInvoke(
+      callee, DtoBitCast(arg, DtoExtractFunctionType(callee->getType())
+                                  ->getParamType(0)));
+  gIR->ir->CreateBr(endbb);
+
+  gIR->scope() = IRScope(endbb);
+  return true;
+}
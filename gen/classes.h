@@ -15,6 +15,7 @@
 #ifndef LDC_GEN_CLASSES_H
 #define LDC_GEN_CLASSES_H
 
+#include "arraytypes.h"
 #include "gen/structs.h"
 
 class ClassDeclaration;
@@ -39,7 +40,18 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *to);
 
 DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *to);
 
+/// Attaches the !type metadata for the class and its base classes to its
+/// vtable definition (for -fwhole-program-vtables).
+void DtoAddVtblTypeMetadata(ClassDeclaration *cd, llvm::GlobalVariable *vtbl);
+
 llvm::Value *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
                                        const char *name);
 
+/// Emits the _d_monitorenter/exit or _d_criticalenter/exit call lowered from
+/// a synchronized statement with an inline fast path if optimizing. Returns
+/// false if the function isn't one of those or the call is to be emitted
+/// normally.
+bool DtoInlineSynchronizedCall(Loc &loc, FuncDeclaration *fdecl,
+                               DValue *fnval, Expressions *arguments);
+
 #endif
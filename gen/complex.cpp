@@ -305,8 +305,18 @@ DImValue *DtoComplexDiv(Loc &loc, Type *type, DRValue *lhs, DRValue *rhs) {
   // rhs values
   DtoGetComplexParts(loc, type, rhs, rhs_re, rhs_im);
 
+  // With @fastmath (or @llvmFastMathFlag("arcp")), both parts may be
+  // multiplied by the reciprocal of a common divisor instead, so that only a
+  // single division is emitted.
+  const bool useReciprocal = gIR->ir->getFastMathFlags().allowReciprocal();
+
   // if divisor is only real, division is simple
-  if (rhs_re && !rhs_im) {
+  if (rhs_re && !rhs_im && useReciprocal && lhs_re && lhs_im) {
+    LLValue *inv = gIR->ir->CreateFDiv(LLConstantFP::get(rhs_re->getType(), 1),
+                                       rhs_re, "rhs_re_inv");
+    res_re = gIR->ir->CreateFMul(lhs_re, inv, "re_divby_re");
+    res_im = gIR->ir->CreateFMul(lhs_im, inv, "im_divby_re");
+  } else if (rhs_re && !rhs_im) {
     if (lhs_re) {
       res_re = gIR->ir->CreateFDiv(lhs_re, rhs_re, "re_divby_re");
     } else {
@@ -360,8 +370,15 @@ DImValue *DtoComplexDiv(Loc &loc, Type *type, DRValue *lhs, DRValue *rhs) {
     tmp2 = gIR->ir->CreateFMul(rhs_im, rhs_im, "rhs_imsq");
     denom = gIR->ir->CreateFAdd(tmp1, tmp2, "denom");
 
-    res_re = gIR->ir->CreateFDiv(res_re, denom, "res_re");
-    res_im = gIR->ir->CreateFDiv(res_im, denom, "res_im");
+    if (useReciprocal) {
+      LLValue *inv = gIR->ir->CreateFDiv(LLConstantFP::get(denom->getType(), 1),
+                                         denom, "denom_inv");
+      res_re = gIR->ir->CreateFMul(res_re, inv, "res_re");
+      res_im = gIR->ir->CreateFMul(res_im, inv, "res_im");
+    } else {
+      res_re = gIR->ir->CreateFDiv(res_re, denom, "res_re");
+      res_im = gIR->ir->CreateFDiv(res_im, denom, "res_im");
+    }
   }
 
   LLValue *res = DtoAggrPair(DtoType(type), res_re, res_im);
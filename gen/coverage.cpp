@@ -9,10 +9,55 @@
 
 #include "gen/coverage.h"
 
+#include "declaration.h"
 #include "mars.h"
 #include "module.h"
+#include "mtype.h"
+#include "driver/cl_options.h"
+#include "gen/abi.h"
 #include "gen/irstate.h"
+#include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/tollvm.h"
+#include "ir/irfunction.h"
+#include "ir/irmodule.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+static llvm::cl::opt<bool> disableCoverageCounterMerging(
+    "disable-cov-counter-merging", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("Keep one -cov counter increment per statement instead of "
+                   "one per straight-line code segment"));
+
+namespace {
+llvm::AtomicOrdering monotonic() {
+#if LDC_LLVM_VER >= 309
+  return llvm::AtomicOrdering::Monotonic;
+#else
+  return llvm::Monotonic;
+#endif
+}
+
+/// Increments the counter at ptr according to -cov-increment.
+void emitCounterIncrement(IRBuilder<> &builder, LLValue *ptr) {
+  if (opts::coverageIncrement == opts::CoverageIncrement_atomic) {
+    // Do an atomic increment, so this works when multiple threads are
+    // executed.
+    builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, DtoConstUint(1),
+                            monotonic());
+  } else {
+    // Thread-local counters are merged into _d_cover_data when the thread
+    // terminates; plain non-atomic increments of the shared counters may lose
+    // counts with several threads, but are much cheaper under contention.
+    LLValue *count = builder.CreateLoad(ptr);
+    builder.CreateStore(builder.CreateAdd(count, DtoConstUint(1)), ptr);
+  }
+}
+}
 
 void emitCoverageLinecountInc(Loc &loc) {
   // Only emit coverage increment for locations in the source of the current
@@ -29,23 +74,20 @@ void emitCoverageLinecountInc(Loc &loc) {
   IF_LOG Logger::println("Coverage: increment _d_cover_data[%d]", line);
   LOG_SCOPE;
 
-  // Get GEP into _d_cover_data array
+  // Get GEP into _d_cover_data array (or its thread-local copy)
+  const bool threadLocal =
+      opts::coverageIncrement == opts::CoverageIncrement_tls;
   LLConstant *idxs[] = {DtoConstUint(0), DtoConstUint(line)};
   LLValue *ptr = llvm::ConstantExpr::getGetElementPtr(
 #if LDC_LLVM_VER >= 307
       LLArrayType::get(LLType::getInt32Ty(gIR->context()),
                        gIR->dmodule->numlines),
 #endif
-      gIR->dmodule->d_cover_data, idxs, true);
+      threadLocal ? gIR->dmodule->d_cover_data_tls
+                  : gIR->dmodule->d_cover_data,
+      idxs, true);
 
-  // Do an atomic increment, so this works when multiple threads are executed.
-  gIR->ir->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, DtoConstUint(1),
-#if LDC_LLVM_VER >= 309
-                           llvm::AtomicOrdering::Monotonic
-#else
-                           llvm::Monotonic
-#endif
-                           );
+  emitCounterIncrement(gIR->scope().builder, ptr);
 
   unsigned num_sizet_bits = gDataLayout->getTypeSizeInBits(DtoSize_t());
   unsigned idx = line / num_sizet_bits;
@@ -55,3 +97,468 @@ void emitCoverageLinecountInc(Loc &loc) {
 
   gIR->dmodule->d_cover_valid_init[idx] |= (size_t(1) << bitidx);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+// All the statements of a straight-line code segment (a part of a basic block
+// without calls which might not return) are executed the same number of
+// times. Their line count increments are replaced by a single increment of a
+// segment counter in _d_cover_blocks, and a static destructor adds the
+// segment counts to the counts of the lines of the segment when a thread
+// terminates, i.e., before druntime writes the report.
+
+namespace {
+/// A line count increment emitted by emitCoverageLinecountInc().
+struct LineIncrement {
+  llvm::Instruction *first; // the atomicrmw, or the load of the counter
+  llvm::Instruction *last;  // the atomicrmw, or the store of the counter
+  unsigned line;
+};
+
+bool endsSegment(llvm::Instruction &inst) {
+  return llvm::isa<llvm::CallInst>(inst) &&
+         !llvm::isa<llvm::IntrinsicInst>(inst);
+}
+
+/// Collects the line count increments (indexed by their last instruction).
+void collectLineIncrements(
+    llvm::GlobalVariable *counters,
+    std::map<llvm::Instruction *, LineIncrement> &increments) {
+  for (auto user : counters->users()) {
+    auto gep = llvm::dyn_cast<llvm::ConstantExpr>(user);
+    if (!gep || gep->getOpcode() != llvm::Instruction::GetElementPtr ||
+        gep->getNumOperands() != 3) {
+      continue;
+    }
+    const auto line = static_cast<unsigned>(
+        llvm::cast<llvm::ConstantInt>(gep->getOperand(2))->getZExtValue());
+
+    for (auto gepUser : gep->users()) {
+      if (auto rmw = llvm::dyn_cast<llvm::AtomicRMWInst>(gepUser)) {
+        if (rmw->getOperation() == llvm::AtomicRMWInst::Add) {
+          increments[rmw] = {rmw, rmw, line};
+        }
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(gepUser)) {
+        if (store->getPointerOperand() != gep) {
+          continue;
+        }
+        auto add =
+            llvm::dyn_cast<llvm::BinaryOperator>(store->getValueOperand());
+        if (!add || add->getOpcode() != llvm::Instruction::Add ||
+            !add->hasOneUse()) {
+          continue;
+        }
+        auto load = llvm::dyn_cast<llvm::LoadInst>(add->getOperand(0));
+        if (!load || load->getPointerOperand() != gep || !load->hasOneUse()) {
+          continue;
+        }
+        increments[store] = {load, store, line};
+      }
+    }
+  }
+}
+
+/// Builds a static destructor adding the segment counts to the line counts.
+void buildSegmentCountsFlush(
+    Module *m, llvm::GlobalVariable *blocks, LLArrayType *blocksTy,
+    const std::vector<std::map<unsigned, unsigned>> &segments) {
+  std::string dtorname = "_D";
+  dtorname += mangle(m);
+  dtorname += "19_coverageflushBlockFZv";
+
+  IF_LOG Logger::println("Build Coverage Analysis destructor: %s",
+                         dtorname.c_str());
+
+  LLFunctionType *dtorTy = LLFunctionType::get(
+      LLType::getVoidTy(gIR->context()), std::vector<LLType *>(), false);
+  LLFunction *dtor = LLFunction::Create(
+      dtorTy, LLGlobalValue::InternalLinkage, dtorname, &gIR->module);
+  dtor->setCallingConv(gABI->callingConv(dtor->getFunctionType(), LINKd));
+  dtor->addFnAttr(LLAttribute::NoUnwind);
+  if (global.params.targetTriple->getArch() == llvm::Triple::x86_64) {
+    dtor->addFnAttr(LLAttribute::UWTable);
+  }
+
+  auto dataTy = LLArrayType::get(LLType::getInt32Ty(gIR->context()),
+                                 m->numlines);
+  IRBuilder<> builder(llvm::BasicBlock::Create(gIR->context(), "", dtor));
+  for (size_t s = 0; s < segments.size(); ++s) {
+    // Take the segment count (the shared segment counters are reset as they
+    // are flushed by every terminating thread).
+    LLValue *idxs[] = {DtoConstUint(0), DtoConstUint(s)};
+    LLValue *ptr = builder.CreateInBoundsGEP(
+#if LDC_LLVM_VER >= 307
+        blocksTy,
+#endif
+        blocks, idxs);
+    LLValue *count;
+    if (opts::coverageIncrement == opts::CoverageIncrement_atomic) {
+      count = builder.CreateAtomicRMW(llvm::AtomicRMWInst::Xchg, ptr,
+                                      DtoConstUint(0), monotonic());
+    } else {
+      count = builder.CreateLoad(ptr);
+      builder.CreateStore(DtoConstUint(0), ptr);
+    }
+
+    llvm::BasicBlock *addbb =
+        llvm::BasicBlock::Create(gIR->context(), "flush.add", dtor);
+    llvm::BasicBlock *nextbb =
+        llvm::BasicBlock::Create(gIR->context(), "flush.next", dtor);
+    builder.CreateCondBr(builder.CreateICmpEQ(count, DtoConstUint(0)), nextbb,
+                         addbb);
+
+    builder.SetInsertPoint(addbb);
+    for (const auto &lineAndMultiplicity : segments[s]) {
+      LLValue *lineIdxs[] = {DtoConstUint(0),
+                             DtoConstUint(lineAndMultiplicity.first)};
+      LLValue *value = count;
+      if (lineAndMultiplicity.second != 1) {
+        value = builder.CreateMul(
+            count, DtoConstUint(lineAndMultiplicity.second));
+      }
+      builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                              builder.CreateInBoundsGEP(
+#if LDC_LLVM_VER >= 307
+                                  dataTy,
+#endif
+                                  m->d_cover_data, lineIdxs),
+                              value, monotonic());
+    }
+    builder.CreateBr(nextbb);
+
+    builder.SetInsertPoint(nextbb);
+  }
+  builder.CreateRetVoid();
+
+  // Add the dtor to the module's (thread-local) static dtors list.
+  IF_LOG Logger::println("Add %s to module's static destructor list",
+                         dtorname.c_str());
+  FuncDeclaration *fd =
+      FuncDeclaration::genCfunc(nullptr, Type::tvoid, dtorname.c_str());
+  fd->linkage = LINKd;
+  IrFunction *irfunc = getIrFunc(fd, true);
+  irfunc->func = dtor;
+  getIrModule(m)->dtors.push_back(fd);
+}
+}
+
+void mergeCoverageCounters(Module *m) {
+  if (disableCoverageCounterMerging) {
+    return;
+  }
+
+  const bool threadLocal =
+      opts::coverageIncrement == opts::CoverageIncrement_tls;
+  llvm::GlobalVariable *counters =
+      threadLocal ? m->d_cover_data_tls : m->d_cover_data;
+  if (!counters) {
+    return;
+  }
+
+  std::map<llvm::Instruction *, LineIncrement> increments;
+  collectLineIncrements(counters, increments);
+
+  // Group the increments to straight-line code segments.
+  std::vector<llvm::SmallVector<LineIncrement, 8>> segments;
+  for (auto &func : gIR->module) {
+    for (auto &bb : func) {
+      llvm::SmallVector<LineIncrement, 8> segment;
+      auto finishSegment = [&]() {
+        if (segment.size() > 1) {
+          segments.push_back(segment);
+        }
+        segment.clear();
+      };
+      for (auto &inst : bb) {
+        auto it = increments.find(&inst);
+        if (it != increments.end()) {
+          segment.push_back(it->second);
+        } else if (endsSegment(inst)) {
+          finishSegment();
+        }
+      }
+      finishSegment();
+    }
+  }
+
+  if (segments.empty()) {
+    return;
+  }
+
+  IF_LOG Logger::println("Coverage: merging line count increments into %llu "
+                         "segment counters",
+                         static_cast<unsigned long long>(segments.size()));
+  LOG_SCOPE;
+
+  // uint[# segments] _d_cover_blocks
+  LLArrayType *blocksTy =
+      LLArrayType::get(LLType::getInt32Ty(gIR->context()), segments.size());
+  llvm::GlobalVariable *blockCounters = getOrCreateGlobal(
+      Loc(), gIR->module, blocksTy, false, LLGlobalValue::InternalLinkage,
+      llvm::ConstantAggregateZero::get(blocksTy), "_d_cover_blocks",
+      threadLocal);
+
+  std::vector<std::map<unsigned, unsigned>> segmentLines(segments.size());
+  for (size_t s = 0; s < segments.size(); ++s) {
+    IRBuilder<> builder(segments[s].front().first);
+    LLConstant *idxs[] = {DtoConstUint(0), DtoConstUint(s)};
+    emitCounterIncrement(builder, llvm::ConstantExpr::getGetElementPtr(
+#if LDC_LLVM_VER >= 307
+                                      blocksTy,
+#endif
+                                      blockCounters, idxs, true));
+
+    for (const auto &inc : segments[s]) {
+      ++segmentLines[s][inc.line];
+      // Erase the increment: atomicrmw, or store/add/load.
+      if (inc.first == inc.last) {
+        inc.last->eraseFromParent();
+      } else {
+        auto add = llvm::cast<llvm::Instruction>(
+            llvm::cast<llvm::StoreInst>(inc.last)->getValueOperand());
+        inc.last->eraseFromParent();
+        add->eraseFromParent();
+        inc.first->eraseFromParent();
+      }
+    }
+  }
+
+  buildSegmentCountsFlush(m, blockCounters, blocksTy, segmentLines);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// With -cov-format=raw, a global constructor links a descriptor of the
+// module's counters into a list shared by all modules, instead of registering
+// them with druntime. The first module registers an atexit() function, which
+// dumps the counters of all modules into a single binary file per process,
+// $LDC_COVERAGE_DIR/ldc-<pid>.covraw. The ldc-covdata tool merges these files
+// and renders the .lst reports.
+//
+// File format (native endianness, W = size of size_t):
+//   char[8] magic = "LDCCOVR1"; uint W; uint reserved;
+//   for each module:
+//     size_t[3] {filename length, # lines, # valid words};
+//     char[]    filename;
+//     uint[]    counters (_d_cover_data);
+//     size_t[]  valid line bits (_d_cover_valid)
+
+namespace {
+LLConstant *cstring(const char *str) {
+  // The literals emitted by DtoConstString() are null-terminated.
+  return DtoConstString(str)->getAggregateElement(1u);
+}
+
+LLValue *getLibcFunction(const char *name, LLType *returnType,
+                         llvm::ArrayRef<LLType *> params,
+                         bool isVarArg = false) {
+  LLFunctionType *fty = LLFunctionType::get(returnType, params, isVarArg);
+  LLFunction *fn = gIR->module.getFunction(name);
+  if (!fn) {
+    fn = LLFunction::Create(fty, LLGlobalValue::ExternalLinkage, name,
+                            &gIR->module);
+  }
+  return DtoBitCast(fn, getPtrToType(fty));
+}
+
+/// { void* next, size_t[3] sizes, const char* filename, uint* counters,
+///   size_t* valid }
+LLStructType *rawModuleType() {
+  LLType *elems[] = {getVoidPtrType(), LLArrayType::get(DtoSize_t(), 3),
+                     getVoidPtrType(),
+                     getPtrToType(LLType::getInt32Ty(gIR->context())),
+                     getPtrToType(DtoSize_t())};
+  return LLStructType::get(gIR->context(), elems);
+}
+
+/// The head of the linked list of the registered modules.
+llvm::GlobalVariable *getRawModuleListHead() {
+  const char *name = "ldc.cover.modules";
+  if (auto gv = gIR->module.getNamedGlobal(name)) {
+    return gv;
+  }
+  auto gv = new llvm::GlobalVariable(
+      gIR->module, getVoidPtrType(), false, LLGlobalValue::LinkOnceODRLinkage,
+      getNullPtr(getVoidPtrType()), name);
+  setLinkage({LLGlobalValue::LinkOnceODRLinkage, supportsCOMDAT()}, gv);
+  return gv;
+}
+
+/// Builds the function writing the raw coverage file, registered with
+/// atexit().
+///
+/// Pseudocode:
+/// void ldc.cover.write() {
+///   char[4096] path;
+///   auto dir = getenv("LDC_COVERAGE_DIR");
+///   snprintf(path.ptr, path.length, "%s/ldc-%d.covraw", dir ? dir : ".",
+///            getpid());
+///   auto f = fopen(path.ptr, "wb");
+///   if (!f) return;
+///   fwrite(header.ptr, 1, header.length, f);
+///   for (auto m = ldc.cover.modules; m; m = m.next) {
+///     fwrite(m.sizes.ptr, size_t.sizeof, 3, f);
+///     fwrite(m.filename, 1, m.sizes[0], f);
+///     fwrite(m.counters, uint.sizeof, m.sizes[1], f);
+///     fwrite(m.valid, size_t.sizeof, m.sizes[2], f);
+///   }
+///   fclose(f);
+/// }
+LLFunction *getRawWriteFunction() {
+  const char *name = "ldc.cover.write";
+  if (auto fn = gIR->module.getFunction(name)) {
+    return fn;
+  }
+
+  llvm::LLVMContext &ctx = gIR->context();
+  LLType *voidPtrTy = getVoidPtrType();
+  LLType *intTy = LLType::getInt32Ty(ctx);
+  LLType *sizeTy = DtoSize_t();
+  const uint64_t sizeTSize = getTypeAllocSize(sizeTy);
+
+  auto fn = LLFunction::Create(
+      LLFunctionType::get(LLType::getVoidTy(ctx), false),
+      LLGlobalValue::LinkOnceODRLinkage, name, &gIR->module);
+  setLinkage({LLGlobalValue::LinkOnceODRLinkage, supportsCOMDAT()}, fn);
+  fn->addFnAttr(LLAttribute::NoUnwind);
+
+  LLValue *getenvFn = getLibcFunction("getenv", voidPtrTy, {voidPtrTy});
+  LLValue *getpidFn = getLibcFunction(
+      global.params.targetTriple->isOSWindows() ? "_getpid" : "getpid", intTy,
+      {});
+  LLValue *snprintfFn = getLibcFunction("snprintf", intTy,
+                                        {voidPtrTy, sizeTy, voidPtrTy}, true);
+  LLValue *fopenFn =
+      getLibcFunction("fopen", voidPtrTy, {voidPtrTy, voidPtrTy});
+  LLValue *fwriteFn = getLibcFunction("fwrite", sizeTy,
+                                      {voidPtrTy, sizeTy, sizeTy, voidPtrTy});
+  LLValue *fcloseFn = getLibcFunction("fclose", intTy, {voidPtrTy});
+
+  auto entrybb = llvm::BasicBlock::Create(ctx, "", fn);
+  auto headerbb = llvm::BasicBlock::Create(ctx, "write.header", fn);
+  auto modulebb = llvm::BasicBlock::Create(ctx, "write.module", fn);
+  auto countersbb = llvm::BasicBlock::Create(ctx, "write.counters", fn);
+  auto closebb = llvm::BasicBlock::Create(ctx, "write.close", fn);
+  auto endbb = llvm::BasicBlock::Create(ctx, "write.end", fn);
+
+  IRBuilder<> b(entrybb);
+  const unsigned pathLength = 4096;
+  LLValue *path = b.CreateBitCast(
+      b.CreateAlloca(LLArrayType::get(LLType::getInt8Ty(ctx), pathLength)),
+      voidPtrTy);
+  LLValue *dir = b.CreateCall(getenvFn, cstring("LDC_COVERAGE_DIR"));
+  dir = b.CreateSelect(b.CreateIsNull(dir), cstring("."), dir);
+  LLValue *snprintfArgs[] = {path, DtoConstSize_t(pathLength),
+                             cstring("%s/ldc-%d.covraw"), dir,
+                             b.CreateCall(getpidFn)};
+  b.CreateCall(snprintfFn, snprintfArgs);
+  LLValue *fopenArgs[] = {path, cstring("wb")};
+  LLValue *file = b.CreateCall(fopenFn, fopenArgs, "file");
+  b.CreateCondBr(b.CreateIsNull(file), endbb, headerbb);
+
+  b.SetInsertPoint(headerbb);
+  LLConstant *headerFields[] = {
+      llvm::ConstantDataArray::getString(ctx, "LDCCOVR1", false),
+      DtoConstUint(sizeTSize), DtoConstUint(0)};
+  LLConstant *headerInit = LLConstantStruct::getAnon(headerFields, true);
+  auto header = new llvm::GlobalVariable(
+      gIR->module, headerInit->getType(), true, LLGlobalValue::PrivateLinkage,
+      headerInit, ".covraw.header");
+  LLValue *headerArgs[] = {
+      DtoBitCast(header, voidPtrTy), DtoConstSize_t(1),
+      DtoConstSize_t(getTypeAllocSize(headerInit->getType())), file};
+  b.CreateCall(fwriteFn, headerArgs);
+  LLValue *firstModule = b.CreateLoad(getRawModuleListHead());
+  b.CreateBr(modulebb);
+
+  b.SetInsertPoint(modulebb);
+  llvm::PHINode *module = b.CreatePHI(voidPtrTy, 2, "module");
+  module->addIncoming(firstModule, headerbb);
+  b.CreateCondBr(b.CreateIsNull(module), closebb, countersbb);
+
+  b.SetInsertPoint(countersbb);
+  LLValue *desc = b.CreateBitCast(module, getPtrToType(rawModuleType()));
+  LLValue *sizes = DtoGEPi(desc, 0, 1, "", countersbb);
+  auto loadSize = [&](unsigned i) {
+    return b.CreateLoad(DtoGEPi(sizes, 0, i, "", countersbb));
+  };
+  auto loadPtr = [&](unsigned i) {
+    return b.CreateBitCast(b.CreateLoad(DtoGEPi(desc, 0, i, "", countersbb)),
+                           voidPtrTy);
+  };
+  LLValue *writes[][3] = {
+      {b.CreateBitCast(sizes, voidPtrTy), DtoConstSize_t(sizeTSize),
+       DtoConstSize_t(3)},
+      {loadPtr(2), DtoConstSize_t(1), loadSize(0)},
+      {loadPtr(3), DtoConstSize_t(4), loadSize(1)},
+      {loadPtr(4), DtoConstSize_t(sizeTSize), loadSize(2)}};
+  for (auto &w : writes) {
+    LLValue *args[] = {w[0], w[1], w[2], file};
+    b.CreateCall(fwriteFn, args);
+  }
+  LLValue *nextModule = b.CreateLoad(DtoGEPi(desc, 0, 0, "", countersbb));
+  module->addIncoming(nextModule, countersbb);
+  b.CreateBr(modulebb);
+
+  b.SetInsertPoint(closebb);
+  b.CreateCall(fcloseFn, file);
+  b.CreateBr(endbb);
+
+  b.SetInsertPoint(endbb);
+  b.CreateRetVoid();
+
+  return fn;
+}
+}
+
+void registerRawCoverageData(Module *m) {
+  IF_LOG Logger::println("Registering raw coverage data of module %s",
+                         m->toChars());
+  LOG_SCOPE;
+
+  const unsigned sizeTBits = gDataLayout->getTypeSizeInBits(DtoSize_t());
+  const char *filename = remapFilePrefix(m->srcfile->name->toChars());
+  LLConstant *sizes[] = {
+      DtoConstSize_t(strlen(filename)), DtoConstSize_t(m->numlines),
+      DtoConstSize_t((m->numlines + sizeTBits - 1) / sizeTBits)};
+
+  LLStructType *descTy = rawModuleType();
+  LLConstant *descFields[] = {
+      getNullPtr(getVoidPtrType()),
+      llvm::ConstantArray::get(LLArrayType::get(DtoSize_t(), 3), sizes),
+      cstring(filename), DtoGEPi(m->d_cover_data, 0, 0),
+      DtoGEPi(m->d_cover_valid, 0, 0)};
+  auto desc = new llvm::GlobalVariable(
+      gIR->module, descTy, false, LLGlobalValue::InternalLinkage,
+      LLConstantStruct::get(descTy, descFields), ".covraw.module");
+
+  // Prepend the descriptor to the list; the first registered module also
+  // registers the write function.
+  LLFunction *ctor = LLFunction::Create(
+      LLFunctionType::get(LLType::getVoidTy(gIR->context()), false),
+      LLGlobalValue::InternalLinkage, "ldc.cover.register", &gIR->module);
+  ctor->addFnAttr(LLAttribute::NoUnwind);
+
+  auto entrybb = llvm::BasicBlock::Create(gIR->context(), "", ctor);
+  auto atexitbb = llvm::BasicBlock::Create(gIR->context(), "atexit", ctor);
+  auto endbb = llvm::BasicBlock::Create(gIR->context(), "end", ctor);
+
+  IRBuilder<> b(entrybb);
+  llvm::GlobalVariable *head = getRawModuleListHead();
+  LLValue *first = b.CreateLoad(head);
+  b.CreateStore(first, DtoGEPi(desc, 0, 0));
+  b.CreateStore(DtoBitCast(desc, getVoidPtrType()), head);
+  b.CreateCondBr(b.CreateIsNull(first), atexitbb, endbb);
+
+  b.SetInsertPoint(atexitbb);
+  LLFunction *write = getRawWriteFunction();
+  LLValue *atexitFn = getLibcFunction(
+      "atexit", LLType::getInt32Ty(gIR->context()), {write->getType()});
+  b.CreateCall(atexitFn, write);
+  b.CreateBr(endbb);
+
+  b.SetInsertPoint(endbb);
+  b.CreateRetVoid();
+
+  AppendFunctionToLLVMGlobalCtorsDtors(ctor, 65535, true);
+}
@@ -16,7 +16,16 @@
 #define LDC_GEN_COVERAGE_H
 
 struct Loc;
+class Module;
 
 void emitCoverageLinecountInc(Loc &loc);
 
+/// Replaces the line count increments of each straight-line code segment of
+/// the module by a single segment counter increment.
+void mergeCoverageCounters(Module *m);
+
+/// With -cov-format=raw, emits a global constructor registering the module's
+/// counters for the raw coverage file written when the program exits.
+void registerRawCoverageData(Module *m);
+
 #endif
@@ -0,0 +1,422 @@
+//===-- ctfejit.cpp -------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Each bytecode function is translated to an LLVM function
+//   i32 @ctfe.fN(i64 %depth, i64* %result, i64 %param0, ...)
+// with one alloca per register and one basic block per instruction, which the
+// optimizer cleans up. All runtime errors of the bytecode (division by zero,
+// out-of-range shifts, failed asserts, too deep recursion) make the function
+// return 1, so that the AST interpreter re-runs the call and reports them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/ctfejit.h"
+#include "gen/logger.h"
+#if LDC_LLVM_VER >= 309
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/OrcMCJITReplacement.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include <memory>
+#include <string>
+#include <vector>
+#endif
+
+#if LDC_LLVM_VER >= 309
+
+namespace {
+
+/// Keep in sync with Op in gen/ctfebytecode.d.
+enum class Op : uint8_t {
+  Imm,
+  Mov,
+  Add,
+  Sub,
+  Mul,
+  And,
+  Or,
+  Xor,
+  DivS,
+  DivU,
+  ModS,
+  ModU,
+  Shl,
+  ShrS,
+  ShrU,
+  Neg,
+  Com,
+  Not,
+  Eq,
+  Ne,
+  LtS,
+  LeS,
+  LtU,
+  LeU,
+  Norm,
+  Jmp,
+  Jz,
+  Jnz,
+  Call,
+  Ret,
+  Fail,
+};
+
+/// Keep in sync with Kind in gen/ctfebytecode.d.
+enum class Kind : uint8_t { None, Bool, I8, U8, I16, U16, I32, U32 };
+
+llvm::LLVMContext &getContext() {
+  static llvm::LLVMContext context;
+  return context;
+}
+
+/// The engines own the compiled code, which is referenced by the bytecode
+/// functions until the compiler exits.
+std::vector<std::unique_ptr<llvm::ExecutionEngine>> engines;
+
+class FunctionTranslator {
+  const CtfeJitFunction *funcs;
+  llvm::ArrayRef<llvm::Function *> decls;
+  int64_t depthLimit;
+
+  const CtfeJitFunction &func;
+  llvm::Function *fn;
+  llvm::IntegerType *i64;
+  llvm::IRBuilder<> b;
+  std::vector<llvm::AllocaInst *> regs;
+  std::vector<llvm::BasicBlock *> blocks;
+  llvm::BasicBlock *failBB = nullptr;
+  llvm::AllocaInst *calleeResult = nullptr;
+
+  llvm::Value *load(uint32_t r) { return b.CreateLoad(regs[r]); }
+  void store(uint32_t r, llvm::Value *v) { b.CreateStore(v, regs[r]); }
+  llvm::Value *zext(llvm::Value *v) { return b.CreateZExt(v, i64); }
+  llvm::ConstantInt *constant(int64_t value) {
+    return llvm::ConstantInt::get(i64, static_cast<uint64_t>(value), true);
+  }
+
+  /// Branches to the failure block if cond is true.
+  void failIf(llvm::Value *cond) {
+    auto cont = llvm::BasicBlock::Create(fn->getContext(), "", fn);
+    b.CreateCondBr(cond, failBB, cont);
+    b.SetInsertPoint(cont);
+  }
+
+  void normalize(uint32_t r, Kind kind) {
+    llvm::Value *v = load(r);
+    auto narrow = [&](unsigned bits, bool isSigned) {
+      auto t = b.CreateTrunc(v, b.getIntNTy(bits));
+      return isSigned ? b.CreateSExt(t, i64) : b.CreateZExt(t, i64);
+    };
+    switch (kind) {
+    case Kind::None:
+      return;
+    case Kind::Bool:
+      v = zext(b.CreateICmpNE(v, constant(0)));
+      break;
+    case Kind::I8:
+      v = narrow(8, true);
+      break;
+    case Kind::U8:
+      v = narrow(8, false);
+      break;
+    case Kind::I16:
+      v = narrow(16, true);
+      break;
+    case Kind::U16:
+      v = narrow(16, false);
+      break;
+    case Kind::I32:
+      v = narrow(32, true);
+      break;
+    case Kind::U32:
+      v = narrow(32, false);
+      break;
+    }
+    store(r, v);
+  }
+
+  /// Emits the instruction, returns false if it doesn't fall through.
+  bool translate(uint32_t pc, const CtfeJitInstr &ins);
+
+public:
+  FunctionTranslator(const CtfeJitFunction *funcs,
+                     llvm::ArrayRef<llvm::Function *> decls,
+                     int64_t depthLimit, uint32_t index)
+      : funcs(funcs), decls(decls), depthLimit(depthLimit),
+        func(funcs[index]), fn(decls[index]),
+        i64(llvm::Type::getInt64Ty(fn->getContext())),
+        b(fn->getContext()) {}
+
+  void run();
+};
+
+void FunctionTranslator::run() {
+  llvm::LLVMContext &context = fn->getContext();
+  auto entry = llvm::BasicBlock::Create(context, "entry", fn);
+  failBB = llvm::BasicBlock::Create(context, "fail", fn);
+  for (uint32_t i = 0; i <= func.numInstrs; ++i) {
+    blocks.push_back(llvm::BasicBlock::Create(context, "", fn));
+  }
+
+  b.SetInsertPoint(failBB);
+  b.CreateRet(b.getInt32(1));
+
+  b.SetInsertPoint(entry);
+  for (uint32_t i = 0; i < func.numRegs; ++i) {
+    regs.push_back(b.CreateAlloca(i64));
+  }
+  calleeResult = b.CreateAlloca(i64);
+  auto arg = fn->arg_begin();
+  llvm::Value *depth = &*arg++;
+  ++arg; // result
+  for (uint32_t i = 0; i < func.numParams; ++i) {
+    store(i, &*arg++);
+  }
+  b.CreateCondBr(b.CreateICmpSGT(depth, constant(depthLimit)), failBB,
+                 blocks[0]);
+
+  for (uint32_t pc = 0; pc < func.numInstrs; ++pc) {
+    b.SetInsertPoint(blocks[pc]);
+    if (translate(pc, func.code[pc])) {
+      b.CreateBr(blocks[pc + 1]);
+    }
+  }
+  // Unreachable, the bytecode ends with a fail instruction.
+  b.SetInsertPoint(blocks[func.numInstrs]);
+  b.CreateBr(failBB);
+}
+
+bool FunctionTranslator::translate(uint32_t pc, const CtfeJitInstr &ins) {
+  switch (static_cast<Op>(ins.op)) {
+  case Op::Imm:
+    store(ins.a, constant(ins.imm));
+    return true;
+  case Op::Mov:
+    store(ins.a, load(ins.b));
+    return true;
+  case Op::Add:
+    store(ins.a, b.CreateAdd(load(ins.b), load(ins.c)));
+    return true;
+  case Op::Sub:
+    store(ins.a, b.CreateSub(load(ins.b), load(ins.c)));
+    return true;
+  case Op::Mul:
+    store(ins.a, b.CreateMul(load(ins.b), load(ins.c)));
+    return true;
+  case Op::And:
+    store(ins.a, b.CreateAnd(load(ins.b), load(ins.c)));
+    return true;
+  case Op::Or:
+    store(ins.a, b.CreateOr(load(ins.b), load(ins.c)));
+    return true;
+  case Op::Xor:
+    store(ins.a, b.CreateXor(load(ins.b), load(ins.c)));
+    return true;
+  case Op::DivS:
+  case Op::ModS: {
+    llvm::Value *x = load(ins.b);
+    llvm::Value *y = load(ins.c);
+    llvm::Value *minusOne = b.CreateICmpEQ(y, constant(-1));
+    if (static_cast<Op>(ins.op) == Op::DivS) {
+      minusOne = b.CreateAnd(minusOne,
+                             b.CreateICmpEQ(x, constant(INT64_MIN)));
+    }
+    failIf(b.CreateOr(b.CreateICmpEQ(y, constant(0)), minusOne));
+    store(ins.a, static_cast<Op>(ins.op) == Op::DivS ? b.CreateSDiv(x, y)
+                                                     : b.CreateSRem(x, y));
+    return true;
+  }
+  case Op::DivU:
+  case Op::ModU: {
+    llvm::Value *x = load(ins.b);
+    llvm::Value *y = load(ins.c);
+    failIf(b.CreateICmpEQ(y, constant(0)));
+    store(ins.a, static_cast<Op>(ins.op) == Op::DivU ? b.CreateUDiv(x, y)
+                                                     : b.CreateURem(x, y));
+    return true;
+  }
+  case Op::Shl:
+  case Op::ShrS:
+  case Op::ShrU: {
+    llvm::Value *x = load(ins.b);
+    llvm::Value *y = load(ins.c);
+    failIf(b.CreateICmpUGE(y, constant(ins.imm)));
+    llvm::Value *v = static_cast<Op>(ins.op) == Op::Shl
+                         ? b.CreateShl(x, y)
+                         : static_cast<Op>(ins.op) == Op::ShrS
+                               ? b.CreateAShr(x, y)
+                               : b.CreateLShr(x, y);
+    store(ins.a, v);
+    return true;
+  }
+  case Op::Neg:
+    store(ins.a, b.CreateNeg(load(ins.b)));
+    return true;
+  case Op::Com:
+    store(ins.a, b.CreateNot(load(ins.b)));
+    return true;
+  case Op::Not:
+    store(ins.a, zext(b.CreateICmpEQ(load(ins.b), constant(0))));
+    return true;
+  case Op::Eq:
+    store(ins.a, zext(b.CreateICmpEQ(load(ins.b), load(ins.c))));
+    return true;
+  case Op::Ne:
+    store(ins.a, zext(b.CreateICmpNE(load(ins.b), load(ins.c))));
+    return true;
+  case Op::LtS:
+    store(ins.a, zext(b.CreateICmpSLT(load(ins.b), load(ins.c))));
+    return true;
+  case Op::LeS:
+    store(ins.a, zext(b.CreateICmpSLE(load(ins.b), load(ins.c))));
+    return true;
+  case Op::LtU:
+    store(ins.a, zext(b.CreateICmpULT(load(ins.b), load(ins.c))));
+    return true;
+  case Op::LeU:
+    store(ins.a, zext(b.CreateICmpULE(load(ins.b), load(ins.c))));
+    return true;
+  case Op::Norm:
+    normalize(ins.a, static_cast<Kind>(ins.aux));
+    return true;
+  case Op::Jmp:
+    b.CreateBr(blocks[ins.b]);
+    return false;
+  case Op::Jz:
+  case Op::Jnz: {
+    llvm::Value *isZero = b.CreateICmpEQ(load(ins.a), constant(0));
+    if (static_cast<Op>(ins.op) == Op::Jz) {
+      b.CreateCondBr(isZero, blocks[ins.b], blocks[pc + 1]);
+    } else {
+      b.CreateCondBr(isZero, blocks[pc + 1], blocks[ins.b]);
+    }
+    return false;
+  }
+  case Op::Call: {
+    const uint32_t calleeIndex = func.callees[ins.b];
+    const CtfeJitFunction &callee = funcs[calleeIndex];
+    std::vector<llvm::Value *> args;
+    args.push_back(b.CreateAdd(&*fn->arg_begin(), constant(1)));
+    args.push_back(calleeResult);
+    for (uint32_t i = 0; i < callee.numParams; ++i) {
+      args.push_back(load(func.callArgs[func.calleeArgs[ins.b] + i]));
+    }
+    llvm::Value *status = b.CreateCall(decls[calleeIndex], args);
+    failIf(b.CreateICmpNE(status, b.getInt32(0)));
+    store(ins.a, b.CreateLoad(calleeResult));
+    return true;
+  }
+  case Op::Ret:
+    b.CreateStore(load(ins.a), &*std::next(fn->arg_begin()));
+    b.CreateRet(b.getInt32(0));
+    return false;
+  case Op::Fail:
+    b.CreateBr(failBB);
+    return false;
+  }
+  llvm_unreachable("Unknown CTFE bytecode instruction");
+}
+
+/// Emits i32 @ctfe.entry(i64 %depth, i64* %args, i64* %result), calling the
+/// translation of the first function.
+llvm::Function *emitEntryPoint(llvm::Module &module,
+                               const CtfeJitFunction &func,
+                               llvm::Function *target) {
+  llvm::LLVMContext &context = module.getContext();
+  auto i64 = llvm::Type::getInt64Ty(context);
+  llvm::Type *params[] = {i64, i64->getPointerTo(), i64->getPointerTo()};
+  auto type =
+      llvm::FunctionType::get(llvm::Type::getInt32Ty(context), params, false);
+  auto fn = llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
+                                   "ctfe.entry", &module);
+
+  llvm::IRBuilder<> b(llvm::BasicBlock::Create(context, "", fn));
+  auto arg = fn->arg_begin();
+  llvm::Value *depth = &*arg++;
+  llvm::Value *argValues = &*arg++;
+  llvm::Value *result = &*arg;
+  std::vector<llvm::Value *> args = {depth, result};
+  for (uint32_t i = 0; i < func.numParams; ++i) {
+    args.push_back(b.CreateLoad(b.CreateConstGEP1_32(argValues, i)));
+  }
+  b.CreateRet(b.CreateCall(target, args));
+  return fn;
+}
+
+void optimize(llvm::Module &module) {
+  llvm::PassManagerBuilder builder;
+  builder.OptLevel = 2;
+  builder.Inliner = llvm::createFunctionInliningPass(2, 0);
+  llvm::legacy::PassManager mpm;
+  builder.populateModulePassManager(mpm);
+  mpm.run(module);
+}
+}
+
+CtfeJitEntry ldc_ctfeJitCompile(const CtfeJitFunction *funcs,
+                                uint32_t numFuncs, int64_t depthLimit) {
+  auto module = llvm::make_unique<llvm::Module>("ctfe", getContext());
+  module->setTargetTriple(llvm::sys::getProcessTriple());
+
+  auto i64 = llvm::Type::getInt64Ty(getContext());
+  std::vector<llvm::Function *> decls;
+  for (uint32_t i = 0; i < numFuncs; ++i) {
+    std::vector<llvm::Type *> params = {i64, i64->getPointerTo()};
+    params.insert(params.end(), funcs[i].numParams, i64);
+    auto type = llvm::FunctionType::get(llvm::Type::getInt32Ty(getContext()),
+                                        params, false);
+    decls.push_back(llvm::Function::Create(
+        type, llvm::GlobalValue::InternalLinkage,
+        "ctfe.f" + llvm::Twine(i), module.get()));
+  }
+  for (uint32_t i = 0; i < numFuncs; ++i) {
+    FunctionTranslator(funcs, decls, depthLimit, i).run();
+  }
+  emitEntryPoint(*module, funcs[0], decls[0]);
+
+  if (llvm::verifyModule(*module, &llvm::errs())) {
+    IF_LOG Logger::cout() << "Invalid CTFE JIT module: " << *module;
+    return nullptr;
+  }
+  optimize(*module);
+
+  std::string errorMsg;
+  llvm::EngineBuilder builder(std::move(module));
+  builder.setEngineKind(llvm::EngineKind::JIT)
+      .setErrorStr(&errorMsg)
+      .setUseOrcMCJITReplacement(true)
+      .setMCJITMemoryManager(llvm::make_unique<llvm::SectionMemoryManager>())
+      .setOptLevel(llvm::CodeGenOpt::Default);
+  std::unique_ptr<llvm::ExecutionEngine> engine(builder.create());
+  if (!engine) {
+    Logger::println("Cannot create the CTFE JIT: %s", errorMsg.c_str());
+    return nullptr;
+  }
+  engine->finalizeObject();
+  auto entry = reinterpret_cast<CtfeJitEntry>(
+      engine->getFunctionAddress("ctfe.entry"));
+  engines.push_back(std::move(engine));
+  return entry;
+}
+
+#else // LDC_LLVM_VER < 309
+
+CtfeJitEntry ldc_ctfeJitCompile(const CtfeJitFunction *, uint32_t, int64_t) {
+  return nullptr;
+}
+
+#endif
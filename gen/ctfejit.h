@@ -0,0 +1,55 @@
+//===-- gen/ctfejit.h - Native execution of CTFE bytecode -------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -ctfe-jit, the integer functions run by the CTFE bytecode engine (see
+// gen/ctfebytecode.d) are translated to LLVM IR and compiled to native code
+// once they have executed enough bytecode instructions. The interface is
+// called from D, so it is kept to plain C types.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_CTFEJIT_H
+#define LDC_GEN_CTFEJIT_H
+
+#include <cstdint>
+
+/// A bytecode instruction. Keep in sync with Instr in gen/ctfebytecode.d.
+struct CtfeJitInstr {
+  uint8_t op;
+  uint8_t aux;
+  uint32_t a, b, c;
+  int64_t imm;
+};
+
+/// A bytecode function, in a set of functions calling each other.
+struct CtfeJitFunction {
+  const CtfeJitInstr *code;
+  uint32_t numInstrs;
+  /// Per call site: the index of the called function in the set.
+  const uint32_t *callees;
+  /// Per call site: the index of its first argument register in callArgs.
+  const uint32_t *calleeArgs;
+  const uint32_t *callArgs;
+  uint32_t numParams;
+  uint32_t numRegs;
+};
+
+/// Runs the compiled function with the given CTFE call depth. Returns 0 and
+/// stores the return value on success, or a non-zero value if the call has to
+/// be handled by the AST interpreter.
+typedef int32_t (*CtfeJitEntry)(int64_t depth, const int64_t *args,
+                                int64_t *result);
+
+/// Compiles funcs[0] and its callees, or returns null if the JIT is not
+/// available. Calls nested more deeply than depthLimit fail.
+extern "C" CtfeJitEntry ldc_ctfeJitCompile(const CtfeJitFunction *funcs,
+                                           uint32_t numFuncs,
+                                           int64_t depthLimit);
+
+#endif
@@ -15,12 +15,14 @@
 #include "nspace.h"
 #include "rmem.h"
 #include "template.h"
+#include "driver/instancecache.h"
 #include "gen/classes.h"
 #include "gen/functions.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/optimizer.h"
 #include "gen/tollvm.h"
 #include "gen/typinf.h"
 #include "gen/uda.h"
@@ -110,6 +112,28 @@ bool isSpeculativeType(Type *t) {
 
 //////////////////////////////////////////////////////////////////////////////
 
+/// Defines the functions of a template instance defined by another object
+/// file (-cache-template-instances) as available_externally, so that they can
+/// still be inlined.
+static void defineAvailableExternally(TemplateInstance *ti) {
+  if (!willInline())
+    return;
+  for (auto m : *ti->members) {
+    FuncDeclaration *fd = m->isFuncDeclaration();
+    if (!fd || !fd->fbody || fd->naked || fd->neverInline ||
+        fd->inlining == PINLINEnever || fd->semanticRun < PASSsemantic3done ||
+        fd->ir->isDefined()) {
+      continue;
+    }
+    IF_LOG Logger::println("Defining %s as available_externally",
+                           fd->toPrettyChars());
+    LOG_SCOPE
+    DtoDefineFunction(fd, /*linkageAvailableExternally=*/true);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 class CodegenVisitor : public Visitor {
   IRState *irs;
 
@@ -257,14 +281,18 @@ public:
       llvm::GlobalVariable *initZ = ir->getInitSymbol();
       initZ->setInitializer(ir->getDefaultInit());
       setLinkage(lwc, initZ);
+      setVisibility(decl, initZ);
 
       llvm::GlobalVariable *vtbl = ir->getVtblSymbol();
       vtbl->setInitializer(ir->getVtblInit());
       setLinkage(lwc, vtbl);
+      setVisibility(decl, vtbl);
+      DtoAddVtblTypeMetadata(decl, vtbl);
 
       llvm::GlobalVariable *classZ = ir->getClassInfoSymbol();
       classZ->setInitializer(ir->getClassInfoInit());
       setLinkage(lwc, classZ);
+      setVisibility(decl, classZ);
 
       // No need to do TypeInfo here, it is <name>__classZ for classes in D2.
     }
@@ -373,6 +401,7 @@ public:
         irGlobal->constInit = initVal;
         gvar->setInitializer(initVal);
         setLinkage(lwc, gvar);
+        setVisibility(decl, gvar);
 
         // Also set up the debug info.
         irs->DBuilder.EmitGlobalVariable(gvar, decl);
@@ -446,6 +475,18 @@ public:
         Logger::println("Does not need codegen, skipping.");
         return;
       }
+
+      // Instances nested in functions (decl->enclosing) are specific to the
+      // current module.
+      const char *objfile = global.params.oneobj
+                                ? (*global.params.objfiles)[0]
+                                : gIR->dmodule->objfile->name->str;
+      if (instanceCacheEnabled() && !decl->enclosing &&
+          isInstanceDefinedElsewhere(decl, objfile)) {
+        Logger::println("Defined by another object file, skipping.");
+        defineAvailableExternally(decl);
+        return;
+      }
     }
 
     for (auto &m : *decl->members) {
@@ -9,6 +9,8 @@
 
 #include "gen/dibuilder.h"
 
+#include "driver/cl_options.h"
+#include "driver/toobj.h"
 #include "gen/functions.h"
 #include "gen/irstate.h"
 #include "gen/llvmhelpers.h"
@@ -72,6 +74,10 @@ llvm::StringRef uniqueIdent(Type* t) {
   return llvm::StringRef();
 }
 
+/// Returns whether only line tables are emitted (-gline-tables-only), i.e.,
+/// subprograms and locations, but no variables and types.
+bool emitLineTablesOnly() { return opts::lineTablesOnly; }
+
 } // namespace
 
 bool ldc::DIBuilder::mustEmitDebugInfo() { return global.params.symdebug; }
@@ -87,7 +93,7 @@ Module *ldc::DIBuilder::getDefinedModule(Dsymbol *s) {
   }
   // array operations as well
   if (FuncDeclaration *fd = s->isFuncDeclaration()) {
-    if (fd->isArrayOp && (willInline() || !isDruntimeArrayOp(fd))) {
+    if (fd->isArrayOp && !usesDruntimeArrayOp(fd)) {
       return IR->dmodule;
     }
   }
@@ -98,7 +104,7 @@ Module *ldc::DIBuilder::getDefinedModule(Dsymbol *s) {
 ////////////////////////////////////////////////////////////////////////////////
 
 ldc::DIBuilder::DIBuilder(IRState *const IR)
-    : IR(IR), DBuilder(IR->module), CUNode(nullptr),
+    : IR(IR), DBuilder(new llvm::DIBuilder(IR->module)), CUNode(nullptr),
       isTargetMSVCx64(global.params.targetTriple->isWindowsMSVCEnvironment() &&
                       global.params.targetTriple->isArch64Bit()) {}
 
@@ -123,14 +129,14 @@ void ldc::DIBuilder::Declare(const Loc &loc, llvm::Value *var,
   unsigned charnum = (loc.linnum ? loc.charnum : 0);
   auto debugLoc = llvm::DebugLoc::get(loc.linnum, charnum, GetCurrentScope());
 #if LDC_LLVM_VER < 307
-  llvm::Instruction *instr = DBuilder.insertDeclare(var, divar,
+  llvm::Instruction *instr = DBuilder->insertDeclare(var, divar,
 #if LDC_LLVM_VER >= 306
                                                     diexpr,
 #endif
                                                     IR->scopebb());
   instr->setDebugLoc(debugLoc);
 #else // if LLVM >= 3.7
-  DBuilder.insertDeclare(var, divar, diexpr, debugLoc, IR->scopebb());
+  DBuilder->insertDeclare(var, divar, diexpr, debugLoc, IR->scopebb());
 #endif
 }
 
@@ -140,8 +146,9 @@ ldc::DIFile ldc::DIBuilder::CreateFile(Loc &loc) {
     filename = IR->dmodule->srcfile->toChars();
   llvm::SmallString<128> path(filename);
   llvm::sys::fs::make_absolute(path);
+  path = remapDebugFilePrefix(path);
 
-  return DBuilder.createFile(llvm::sys::path::filename(path),
+  return DBuilder->createFile(llvm::sys::path::filename(path),
                              llvm::sys::path::parent_path(path));
 }
 
@@ -234,7 +241,7 @@ ldc::DIType ldc::DIBuilder::CreateBasicType(Type *type) {
         "Unsupported basic type for debug info in DIBuilder::CreateBasicType");
   }
 
-  return DBuilder.createBasicType(type->toChars(),         // name
+  return DBuilder->createBasicType(type->toChars(),         // name
                                   getTypeAllocSize(T) * 8, // size (bits)
                                   getABITypeAlign(T) * 8,  // align (bits)
                                   Encoding);
@@ -251,7 +258,7 @@ ldc::DIType ldc::DIBuilder::CreateEnumType(Type *type) {
     EnumMember *em = m->isEnumMember();
     llvm::StringRef Name(em->toChars());
     uint64_t Val = em->value()->toInteger();
-    auto Subscript = DBuilder.createEnumerator(Name, Val);
+    auto Subscript = DBuilder->createEnumerator(Name, Val);
     subscripts.push_back(Subscript);
   }
 
@@ -259,11 +266,11 @@ ldc::DIType ldc::DIBuilder::CreateEnumType(Type *type) {
   unsigned LineNumber = te->sym->loc.linnum;
   ldc::DIFile File(CreateFile(te->sym));
 
-  return DBuilder.createEnumerationType(
+  return DBuilder->createEnumerationType(
       GetCU(), Name, File, LineNumber,
       getTypeAllocSize(T) * 8,               // size (bits)
       getABITypeAlign(T) * 8,                // align (bits)
-      DBuilder.getOrCreateArray(subscripts), // subscripts
+      DBuilder->getOrCreateArray(subscripts), // subscripts
       CreateTypeDescription(te->sym->memtype, false));
 }
 
@@ -278,7 +285,7 @@ ldc::DIType ldc::DIBuilder::CreatePointerType(Type *type) {
   if (nt->toBasetype()->ty == Tvoid)
     nt = Type::tuns8;
 
-  return DBuilder.createPointerType(CreateTypeDescription(nt, false),
+  return DBuilder->createPointerType(CreateTypeDescription(nt, false),
                                     getTypeAllocSize(T) * 8, // size (bits)
                                     getABITypeAlign(T) * 8,  // align (bits)
                                     type->toChars()          // name
@@ -297,13 +304,13 @@ ldc::DIType ldc::DIBuilder::CreateVectorType(Type *type) {
   if (te->toBasetype()->ty == Tvoid)
     te = Type::tuns8;
   int64_t Dim = tv->size(Loc()) / te->size(Loc());
-  LLMetadata *subscripts[] = {DBuilder.getOrCreateSubrange(0, Dim)};
+  LLMetadata *subscripts[] = {DBuilder->getOrCreateSubrange(0, Dim)};
 
-  return DBuilder.createVectorType(
+  return DBuilder->createVectorType(
       getTypeAllocSize(T) * 8,              // size (bits)
       getABITypeAlign(T) * 8,               // align (bits)
       CreateTypeDescription(te, false),     // element type
-      DBuilder.getOrCreateArray(subscripts) // subscripts
+      DBuilder->getOrCreateArray(subscripts) // subscripts
       );
 }
 
@@ -333,7 +340,7 @@ ldc::DIType ldc::DIBuilder::CreateComplexType(Type *type) {
         CreateMemberType(0, elemtype, file, "re", 0, PROTpublic),
         CreateMemberType(0, elemtype, file, "im", imoffset, PROTpublic)};
 
-    return DBuilder.createStructType(GetCU(),
+    return DBuilder->createStructType(GetCU(),
                                      t->toChars(),            // Name
                                      file,                    // File
                                      0,                       // LineNo
@@ -341,7 +348,7 @@ ldc::DIType ldc::DIBuilder::CreateComplexType(Type *type) {
                                      getABITypeAlign(T) * 8,  // alignment
                                      DIFlagZero,              // What here?
                                      getNullDIType(),         // derived from
-                                     DBuilder.getOrCreateArray(elems),
+                                     DBuilder->getOrCreateArray(elems),
                                      0,               // RunTimeLang
                                      getNullDIType(), // VTableHolder
                                      uniqueIdent(t)); // UniqueIdentifier
@@ -379,7 +386,7 @@ ldc::DIType ldc::DIBuilder::CreateMemberType(unsigned linnum, Type *type,
     break;
   }
 
-  return DBuilder.createMemberType(GetCU(),
+  return DBuilder->createMemberType(GetCU(),
                                    c_name,                  // name
                                    file,                    // file
                                    linnum,                  // line number
@@ -429,7 +436,7 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
   // if we don't know the aggregate's size, we don't know enough about it
   // to provide debug info. probably a forward-declared struct?
   if (sd->sizeok == SIZEOKnone) {
-    return DBuilder.createUnspecifiedType(sd->toChars());
+    return DBuilder->createUnspecifiedType(sd->toChars());
   }
 
   // elements
@@ -447,9 +454,9 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
   unsigned tag = (t->ty == Tstruct) ? llvm::dwarf::DW_TAG_structure_type
                                     : llvm::dwarf::DW_TAG_class_type;
 #if LDC_LLVM_VER >= 307
-  ir->diCompositeType = DBuilder.createReplaceableCompositeType(
+  ir->diCompositeType = DBuilder->createReplaceableCompositeType(
 #else
-  ir->diCompositeType = DBuilder.createReplaceableForwardDecl(
+  ir->diCompositeType = DBuilder->createReplaceableForwardDecl(
 #endif
       tag, name, CU, file, linnum);
 
@@ -460,7 +467,7 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
       derivedFrom = CreateCompositeType(classDecl->baseClass->getType());
       // needs a forward declaration to add inheritence information to elems
       ldc::DIType fwd =
-          DBuilder.createClassType(CU,     // compile unit where defined
+          DBuilder->createClassType(CU,     // compile unit where defined
                                    name,   // name
                                    file,   // file where defined
                                    linnum, // line number where defined
@@ -473,7 +480,7 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
                                    getNullDIType(), // VTableHolder
                                    nullptr,         // TemplateParms
                                    uniqueIdent(t)); // UniqueIdentifier
-      auto dt = DBuilder.createInheritance(fwd, derivedFrom, 0,
+      auto dt = DBuilder->createInheritance(fwd, derivedFrom, 0,
 #if LDC_LLVM_VER >= 306
                                            DIFlags::FlagPublic
 #else
@@ -485,11 +492,11 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
     AddFields(sd, file, elems);
   }
 
-  auto elemsArray = DBuilder.getOrCreateArray(elems);
+  auto elemsArray = DBuilder->getOrCreateArray(elems);
 
   ldc::DIType ret;
   if (t->ty == Tclass) {
-    ret = DBuilder.createClassType(CU,     // compile unit where defined
+    ret = DBuilder->createClassType(CU,     // compile unit where defined
                                    name,   // name
                                    file,   // file where defined
                                    linnum, // line number where defined
@@ -503,7 +510,7 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
                                    nullptr,         // TemplateParms
                                    uniqueIdent(t)); // UniqueIdentifier
   } else {
-    ret = DBuilder.createStructType(CU,     // compile unit where defined
+    ret = DBuilder->createStructType(CU,     // compile unit where defined
                                     name,   // name
                                     file,   // file where defined
                                     linnum, // line number where defined
@@ -518,7 +525,7 @@ ldc::DIType ldc::DIBuilder::CreateCompositeType(Type *type) {
   }
 
 #if LDC_LLVM_VER >= 307
-  ir->diCompositeType = DBuilder.replaceTemporary(
+  ir->diCompositeType = DBuilder->replaceTemporary(
       llvm::TempDINode(ir->diCompositeType), static_cast<llvm::DIType *>(ret));
 #else
   ir->diCompositeType.replaceAllUsesWith(ret);
@@ -540,7 +547,7 @@ ldc::DIType ldc::DIBuilder::CreateArrayType(Type *type) {
       CreateMemberType(0, t->nextOf()->pointerTo(), file, "ptr",
                        global.params.is64bit ? 8 : 4, PROTpublic)};
 
-  return DBuilder.createStructType(GetCU(),
+  return DBuilder->createStructType(GetCU(),
                                    t->toChars(),            // Name
                                    file,                    // File
                                    0,                       // LineNo
@@ -548,7 +555,7 @@ ldc::DIType ldc::DIBuilder::CreateArrayType(Type *type) {
                                    getABITypeAlign(T) * 8,  // alignment in bits
                                    DIFlagZero,              // What here?
                                    getNullDIType(),         // derived from
-                                   DBuilder.getOrCreateArray(elems),
+                                   DBuilder->getOrCreateArray(elems),
                                    0,               // RunTimeLang
                                    getNullDIType(), // VTableHolder
                                    uniqueIdent(t)); // UniqueIdentifier
@@ -564,7 +571,7 @@ ldc::DIType ldc::DIBuilder::CreateSArrayType(Type *type) {
   while (t->ty == Tsarray) {
     TypeSArray *tsa = static_cast<TypeSArray *>(t);
     int64_t Count = tsa->dim->toInteger();
-    auto subscript = DBuilder.getOrCreateSubrange(0, Count);
+    auto subscript = DBuilder->getOrCreateSubrange(0, Count);
     subscripts.push_back(subscript);
     t = t->nextOf();
   }
@@ -576,11 +583,11 @@ ldc::DIType ldc::DIBuilder::CreateSArrayType(Type *type) {
   else if (t->ty == Tfunction)
     t = t->pointerTo();
 
-  return DBuilder.createArrayType(
+  return DBuilder->createArrayType(
       getTypeAllocSize(T) * 8,              // size (bits)
       getABITypeAlign(T) * 8,               // align (bits)
       CreateTypeDescription(t, false),      // element type
-      DBuilder.getOrCreateArray(subscripts) // subscripts
+      DBuilder->getOrCreateArray(subscripts) // subscripts
       );
 }
 
@@ -597,17 +604,19 @@ ldc::DISubroutineType ldc::DIBuilder::CreateFunctionType(Type *type) {
   Type *retType = t->next;
 
   // Create "dummy" subroutine type for the return type
-  LLMetadata *params = {CreateTypeDescription(retType, true)};
+  LLMetadata *params = {emitLineTablesOnly()
+                            ? getNullDIType()
+                            : CreateTypeDescription(retType, true)};
 #if LDC_LLVM_VER == 305
-  auto paramsArray = DBuilder.getOrCreateArray(params);
+  auto paramsArray = DBuilder->getOrCreateArray(params);
 #else
-  auto paramsArray = DBuilder.getOrCreateTypeArray(params);
+  auto paramsArray = DBuilder->getOrCreateTypeArray(params);
 #endif
 
 #if LDC_LLVM_VER >= 308
-  return DBuilder.createSubroutineType(paramsArray);
+  return DBuilder->createSubroutineType(paramsArray);
 #else
-  return DBuilder.createSubroutineType(CreateFile(), paramsArray);
+  return DBuilder->createSubroutineType(CreateFile(), paramsArray);
 #endif
 }
 
@@ -626,7 +635,7 @@ ldc::DIType ldc::DIBuilder::CreateDelegateType(Type *type) {
       CreateMemberType(0, t->next, file, "funcptr",
                        global.params.is64bit ? 8 : 4, PROTpublic)};
 
-  return DBuilder.createStructType(CU,           // compile unit where defined
+  return DBuilder->createStructType(CU,           // compile unit where defined
                                    t->toChars(), // name
                                    file,         // file where defined
                                    0,            // line number where defined
@@ -634,7 +643,7 @@ ldc::DIType ldc::DIBuilder::CreateDelegateType(Type *type) {
                                    getABITypeAlign(T) * 8,  // alignment in bits
                                    DIFlagZero,              // flags
                                    getNullDIType(),         // derived from
-                                   DBuilder.getOrCreateArray(elems),
+                                   DBuilder->getOrCreateArray(elems),
                                    0,               // RunTimeLang
                                    getNullDIType(), // VTableHolder
                                    uniqueIdent(t)); // UniqueIdentifier
@@ -652,7 +661,7 @@ bool isOpaqueEnumType(Type *type) {
 ldc::DIType ldc::DIBuilder::CreateTypeDescription(Type *type, bool derefclass) {
   // Check for opaque enum first, Bugzilla 13792
   if (isOpaqueEnumType(type))
-    return DBuilder.createUnspecifiedType(type->toChars());
+    return DBuilder->createUnspecifiedType(type->toChars());
 
   Type *t = type->toBasetype();
   if (derefclass && t->ty == Tclass) {
@@ -664,10 +673,10 @@ ldc::DIType ldc::DIBuilder::CreateTypeDescription(Type *type, bool derefclass) {
 #if LDC_LLVM_VER >= 309
     return nullptr;
 #else
-    return DBuilder.createUnspecifiedType(t->toChars());
+    return DBuilder->createUnspecifiedType(t->toChars());
 #endif
   if (t->ty == Tnull) // display null as void*
-    return DBuilder.createPointerType(CreateTypeDescription(Type::tvoid, false),
+    return DBuilder->createPointerType(CreateTypeDescription(Type::tvoid, false),
                                       8, 8, "typeof(null)");
   if (t->ty == Tvector)
     return CreateVectorType(type);
@@ -705,31 +714,56 @@ void ldc::DIBuilder::EmitCompileUnit(Module *m) {
   Logger::println("D to dwarf compile_unit");
   LOG_SCOPE;
 
-  assert(!CUNode && "Already created compile unit for this DIBuilder instance");
-
   // prepare srcpath
   llvm::SmallString<128> srcpath(m->srcfile->name->toChars());
   llvm::sys::fs::make_absolute(srcpath);
+  srcpath = remapDebugFilePrefix(srcpath);
 
+  if (CUNode) {
+    // Another module of a -singleobj build; an llvm::DIBuilder only handles a
+    // single compile unit.
+    DBuilder->finalize();
+    DBuilder.reset(new llvm::DIBuilder(IR->module));
+  } else {
 #if LDC_LLVM_VER >= 308
-  if (global.params.targetTriple->isWindowsMSVCEnvironment())
-    IR->module.addModuleFlag(llvm::Module::Warning, "CodeView", 1);
-  else if (global.params.dwarfVersion > 0)
-    IR->module.addModuleFlag(llvm::Module::Warning, "Dwarf Version",
-                             global.params.dwarfVersion);
+    if (global.params.targetTriple->isWindowsMSVCEnvironment())
+      IR->module.addModuleFlag(llvm::Module::Warning, "CodeView", 1);
+    else if (global.params.dwarfVersion > 0)
+      IR->module.addModuleFlag(llvm::Module::Warning, "Dwarf Version",
+                               global.params.dwarfVersion);
 #endif
-  // Metadata without a correct version will be stripped by UpgradeDebugInfo.
-  IR->module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
-                           llvm::DEBUG_METADATA_VERSION);
+    // Metadata without a correct version will be stripped by
+    // UpgradeDebugInfo.
+    IR->module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                             llvm::DEBUG_METADATA_VERSION);
+  }
 
-  CUNode = DBuilder.createCompileUnit(
+  // With -gsplit-dwarf, the skeleton CU refers to the .dwo file next to the
+  // object file (the first one for -singleobj builds).
+  std::string splitName;
+  if (opts::splitDwarf) {
+    splitName = getDwarfObjectFileName(global.params.oneobj
+                                           ? (*global.params.objfiles)[0]
+                                           : m->objfile->name->str);
+  }
+
+  CUNode = DBuilder->createCompileUnit(
       global.params.symdebug == 2 ? llvm::dwarf::DW_LANG_C
                                   : llvm::dwarf::DW_LANG_D,
       llvm::sys::path::filename(srcpath), llvm::sys::path::parent_path(srcpath),
       "LDC (http://wiki.dlang.org/LDC)",
       isOptimizationEnabled(), // isOptimized
       llvm::StringRef(),       // Flags TODO
-      1                        // Runtime Version TODO
+      1,                       // Runtime Version TODO
+      splitName,               // SplitName
+      emitLineTablesOnly()
+#if LDC_LLVM_VER >= 309
+          ? llvm::DICompileUnit::LineTablesOnly
+          : llvm::DICompileUnit::FullDebug // Kind
+#else
+          ? llvm::DIBuilder::LineTablesOnly
+          : llvm::DIBuilder::FullDebug // Kind
+#endif
       );
 }
 
@@ -756,7 +790,7 @@ ldc::DISubprogram ldc::DIBuilder::EmitSubProgram(FuncDeclaration *fd) {
       CreateFunctionType(static_cast<TypeFunction *>(fd->type));
 
   // FIXME: duplicates?
-  auto SP = DBuilder.createFunction(
+  auto SP = DBuilder->createFunction(
       CU,                                 // context
       fd->toPrettyChars(),                // name
       getIrFunc(fd)->func->getName(),     // linkage name
@@ -805,7 +839,7 @@ ldc::DISubprogram ldc::DIBuilder::EmitThunk(llvm::Function *Thunk,
   name.append(".__thunk");
 
   // FIXME: duplicates?
-  auto SP = DBuilder.createFunction(
+  auto SP = DBuilder->createFunction(
       CU,                                 // context
       name,                               // name
       Thunk->getName(),                   // linkage name
@@ -850,20 +884,20 @@ ldc::DISubprogram ldc::DIBuilder::EmitModuleCTor(llvm::Function *Fn,
   // Create "dummy" subroutine type for the return type
   LLMetadata *params = {CreateTypeDescription(Type::tvoid, true)};
 #if LDC_LLVM_VER >= 306
-  auto paramsArray = DBuilder.getOrCreateTypeArray(params);
+  auto paramsArray = DBuilder->getOrCreateTypeArray(params);
 #else
-  auto paramsArray = DBuilder.getOrCreateArray(params);
+  auto paramsArray = DBuilder->getOrCreateArray(params);
 #endif
 #if LDC_LLVM_VER >= 308
-  ldc::DISubroutineType DIFnType = DBuilder.createSubroutineType(paramsArray);
+  ldc::DISubroutineType DIFnType = DBuilder->createSubroutineType(paramsArray);
 #else
   ldc::DISubroutineType DIFnType =
-      DBuilder.createSubroutineType(file, paramsArray);
+      DBuilder->createSubroutineType(file, paramsArray);
 #endif
 
   // FIXME: duplicates?
   auto SP =
-      DBuilder.createFunction(CU,            // context
+      DBuilder->createFunction(CU,            // context
                               prettyname,    // name
                               Fn->getName(), // linkage name
                               file,          // file
@@ -915,7 +949,7 @@ void ldc::DIBuilder::EmitBlockStart(Loc &loc) {
   LOG_SCOPE;
 
   ldc::DILexicalBlock block =
-      DBuilder.createLexicalBlock(GetCurrentScope(),           // scope
+      DBuilder->createLexicalBlock(GetCurrentScope(),           // scope
                                   CreateFile(loc),             // file
                                   loc.linnum,                  // line
                                   loc.linnum ? loc.charnum : 0 // column
@@ -974,6 +1008,9 @@ void ldc::DIBuilder::EmitStopPoint(Loc &loc) {
 Loc ldc::DIBuilder::GetCurrentLoc() const { return currentLoc; }
 
 void ldc::DIBuilder::EmitValue(llvm::Value *val, VarDeclaration *vd) {
+  if (emitLineTablesOnly())
+    return;
+
   auto sub = IR->func()->variableMap.find(vd);
   if (sub == IR->func()->variableMap.end())
     return;
@@ -983,9 +1020,9 @@ void ldc::DIBuilder::EmitValue(llvm::Value *val, VarDeclaration *vd) {
     return;
 
   llvm::Instruction *instr =
-      DBuilder.insertDbgValueIntrinsic(val, 0, debugVariable,
+      DBuilder->insertDbgValueIntrinsic(val, 0, debugVariable,
 #if LDC_LLVM_VER >= 306
-                                       DBuilder.createExpression(),
+                                       DBuilder->createExpression(),
 #endif
 #if LDC_LLVM_VER >= 307
                                        IR->ir->getCurrentDebugLocation(),
@@ -1003,7 +1040,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
                                        llvm::ArrayRef<llvm::Value *> addr
 #endif
                                        ) {
-  if (!mustEmitDebugInfo())
+  if (!mustEmitDebugInfo() || emitLineTablesOnly())
     return;
 
   Logger::println("D to dwarf local variable");
@@ -1024,11 +1061,11 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
   if (vd->storage_class & (STCref | STCout)) {
 #if LDC_LLVM_VER >= 308
     auto T = DtoType(type);
-    TD = DBuilder.createReferenceType(llvm::dwarf::DW_TAG_reference_type, TD,
+    TD = DBuilder->createReferenceType(llvm::dwarf::DW_TAG_reference_type, TD,
                                       getTypeAllocSize(T) * 8, // size (bits)
                                       DtoAlignment(type) * 8); // align (bits)
 #else
-    TD = DBuilder.createReferenceType(llvm::dwarf::DW_TAG_reference_type, TD);
+    TD = DBuilder->createReferenceType(llvm::dwarf::DW_TAG_reference_type, TD);
 #endif
   } else {
     // FIXME: For MSVC x64 targets, declare dynamic array and vector parameters
@@ -1059,7 +1096,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
 
 #if LDC_LLVM_VER < 306
   if (addr.empty()) {
-    debugVariable = DBuilder.createLocalVariable(tag,                 // tag
+    debugVariable = DBuilder->createLocalVariable(tag,                 // tag
                                                  GetCurrentScope(),   // scope
                                                  vd->toChars(),       // name
                                                  CreateFile(vd), // file
@@ -1069,7 +1106,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
                                                  Flags           // flags
                                                  );
   } else {
-    debugVariable = DBuilder.createComplexVariable(tag,                 // tag
+    debugVariable = DBuilder->createComplexVariable(tag,                 // tag
                                                    GetCurrentScope(),   // scope
                                                    vd->toChars(),       // name
                                                    CreateFile(vd), // file
@@ -1078,7 +1115,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
                                                    addr);
   }
 #elif LDC_LLVM_VER < 308
-  debugVariable = DBuilder.createLocalVariable(tag,                 // tag
+  debugVariable = DBuilder->createLocalVariable(tag,                 // tag
                                                GetCurrentScope(),   // scope
                                                vd->toChars(),       // name
                                                CreateFile(vd),      // file
@@ -1103,7 +1140,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
         argNo++;
     }
 
-    debugVariable = DBuilder.createParameterVariable(GetCurrentScope(), // scope
+    debugVariable = DBuilder->createParameterVariable(GetCurrentScope(), // scope
                                                      vd->toChars(),     // name
                                                      argNo + 1,
                                                      CreateFile(vd), // file
@@ -1113,7 +1150,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
                                                      Flags           // flags
                                                      );
   } else {
-    debugVariable = DBuilder.createAutoVariable(GetCurrentScope(), // scope
+    debugVariable = DBuilder->createAutoVariable(GetCurrentScope(), // scope
                                                 vd->toChars(),     // name
                                                 CreateFile(vd),    // file
                                                 vd->loc.linnum,    // line num
@@ -1128,8 +1165,8 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
 // declare
 #if LDC_LLVM_VER >= 306
   Declare(vd->loc, ll, debugVariable, addr.empty()
-                                          ? DBuilder.createExpression()
-                                          : DBuilder.createExpression(addr));
+                                          ? DBuilder->createExpression()
+                                          : DBuilder->createExpression(addr));
 #else
   Declare(vd->loc, ll, debugVariable);
 #endif
@@ -1137,7 +1174,7 @@ void ldc::DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
 
 void ldc::DIBuilder::EmitGlobalVariable(llvm::GlobalVariable *llVar,
                                         VarDeclaration *vd) {
-  if (!mustEmitDebugInfo())
+  if (!mustEmitDebugInfo() || emitLineTablesOnly())
     return;
 
   Logger::println("D to dwarf global_variable");
@@ -1149,7 +1186,7 @@ void ldc::DIBuilder::EmitGlobalVariable(llvm::GlobalVariable *llVar,
 #if LDC_LLVM_VER >= 400
   auto DIVar =
 #endif
-      DBuilder.createGlobalVariable(
+      DBuilder->createGlobalVariable(
 #if LDC_LLVM_VER >= 306
           GetCU(), // context
 #endif
@@ -1175,5 +1212,5 @@ void ldc::DIBuilder::Finalize() {
   if (!mustEmitDebugInfo())
     return;
 
-  DBuilder.finalize();
+  DBuilder->finalize();
 }
@@ -18,6 +18,7 @@
 
 #include "gen/tollvm.h"
 #include "mars.h"
+#include <memory>
 
 struct IRState;
 
@@ -71,7 +72,8 @@ typedef llvm::DIExpression DIExpression;
 
 class DIBuilder {
   IRState *const IR;
-  llvm::DIBuilder DBuilder;
+  /// Replaced for each compile unit (see EmitCompileUnit()).
+  std::unique_ptr<llvm::DIBuilder> DBuilder;
 
 #if LDC_LLVM_VER >= 307
   DICompileUnit CUNode;
@@ -95,6 +97,8 @@ public:
   explicit DIBuilder(IRState *const IR);
 
   /// \brief Emit the Dwarf compile_unit global for a Module m.
+  /// For -singleobj builds, this is called for each module, finalizing the
+  /// compile unit of the previous one.
   /// \param m        Module to emit as compile unit.
   void EmitCompileUnit(Module *m);
 
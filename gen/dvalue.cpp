@@ -9,6 +9,7 @@
 
 #include "gen/dvalue.h"
 #include "declaration.h"
+#include "gen/funcgenstate.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
@@ -44,6 +45,14 @@ LLValue *DtoLVal(DValue *v) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void *DValue::operator new(size_t size) {
+  if (gIR->funcGenStates.empty()) {
+    // Outside of function bodies, e.g. for the initializers of globals.
+    return ::operator new(size);
+  }
+  return gIR->funcGen().valueAllocator.Allocate(size, alignof(DValue));
+}
+
 DValue::DValue(Type *t, LLValue *v) : type(t), val(v) {
   assert(type);
   assert(val);
@@ -110,10 +119,12 @@ DRValue *DLValue::getRVal() {
     return nullptr;
   }
 
-  LLValue *rval = DtoLoad(val);
+  LLValue *rval;
   if (type->toBasetype()->ty == Tbool) {
-    assert(rval->getType() == llvm::Type::getInt8Ty(gIR->context()));
+    rval = DtoBoolLoad(val);
     rval = gIR->ir->CreateTrunc(rval, llvm::Type::getInt1Ty(gIR->context()));
+  } else {
+    rval = DtoLoad(val);
   }
 
   return new DImValue(type, rval);
@@ -47,6 +47,12 @@ public:
 
   virtual ~DValue() = default;
 
+  /// DValues are only needed while emitting the IR of a function body, so
+  /// they are bump-allocated from the current FuncGenState and released in one
+  /// go along with it, not individually.
+  static void *operator new(size_t size);
+  static void operator delete(void *) {}
+
   /// Returns true iff the value can be accessed at the end of the entry basic
   /// block of the current function, in the sense that it is either not derived
   /// from an llvm::Instruction (but from a global, constant, etc.) or that
@@ -0,0 +1,483 @@
+//===-- dynamic-compile.cpp -----------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The embedded bitcode module contains the definitions of the dynamic
+// functions and, as available_externally definitions for inlining, the
+// functions and constants they depend on. All other globals are declarations,
+// resolved by the runtime to their addresses in the program (listed in the
+// module's descriptor), so that the code compiled at runtime shares all state
+// with the statically compiled code. The @dynamicCompileConst variables are
+// declarations as well; the runtime turns them into constants with the values
+// they have when compileDynamicCode() is called.
+//
+// In the object file, each dynamic function becomes a thunk calling the
+// function pointed to by <name>.jit_ptr, which initially is the statically
+// compiled body (<name>.static) and is replaced by the runtime.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/dynamic-compile.h"
+
+#include "declaration.h"
+#include "errors.h"
+#include "module.h"
+#include "gen/irstate.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/tollvm.h"
+#include "ir/irfunction.h"
+#include "ir/irvar.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <memory>
+#include <string>
+#include <vector>
+#endif
+
+#if LDC_LLVM_VER >= 400
+
+namespace {
+
+/// { const char* name, void* address }
+LLStructType *symbolType() {
+  LLType *elems[] = {getVoidPtrType(), getVoidPtrType()};
+  return LLStructType::get(gIR->context(), elems);
+}
+
+/// { void* next, const void* bitcode, size_t bitcodeSize,
+///   size_t numFuncs, Symbol* funcs, size_t numSymbols, Symbol* symbols,
+///   size_t numConsts, Symbol* consts }
+/// Must match ModuleDesc in runtime/jit-rt/cpp/jit.cpp.
+LLStructType *descriptorType() {
+  LLType *symbolsTy = getPtrToType(symbolType());
+  LLType *elems[] = {getVoidPtrType(), getVoidPtrType(), DtoSize_t(),
+                     DtoSize_t(),      symbolsTy,        DtoSize_t(),
+                     symbolsTy,        DtoSize_t(),      symbolsTy};
+  return LLStructType::get(gIR->context(), elems);
+}
+
+LLConstant *cstring(const std::string &str) {
+  // The literals emitted by DtoConstString() are null-terminated.
+  return DtoConstString(str.c_str())->getAggregateElement(1u);
+}
+
+LLConstant *symbol(const std::string &name, LLConstant *address) {
+  LLConstant *fields[] = {cstring(name), DtoBitCast(address, getVoidPtrType())};
+  return LLConstantStruct::get(symbolType(), fields);
+}
+
+/// Returns a pointer to a constant array of the symbols (null if empty).
+LLConstant *symbolTable(const std::vector<LLConstant *> &symbols,
+                        const char *name) {
+  if (symbols.empty()) {
+    return getNullPtr(getPtrToType(symbolType()));
+  }
+  LLArrayType *tableTy = LLArrayType::get(symbolType(), symbols.size());
+  auto table = new llvm::GlobalVariable(
+      gIR->module, tableTy, true, LLGlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(tableTy, symbols), name);
+  return DtoGEPi(table, 0, 0);
+}
+
+/// Calls `callback` for the global values referenced by the constant
+/// operands of the function's instructions.
+template <class Callback>
+void forEachReferencedGlobal(llvm::Function &fn, Callback callback) {
+  llvm::SmallPtrSet<llvm::Constant *, 32> visited;
+  std::vector<llvm::Constant *> worklist;
+  if (fn.hasPersonalityFn()) {
+    worklist.push_back(fn.getPersonalityFn());
+  }
+  for (auto &bb : fn) {
+    for (auto &inst : bb) {
+      for (llvm::Value *op : inst.operands()) {
+        if (auto c = llvm::dyn_cast<llvm::Constant>(op)) {
+          worklist.push_back(c);
+        }
+      }
+    }
+  }
+
+  while (!worklist.empty()) {
+    llvm::Constant *c = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(c).second) {
+      continue;
+    }
+    if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+      callback(gv);
+      continue;
+    }
+    for (llvm::Value *op : c->operands()) {
+      worklist.push_back(llvm::cast<llvm::Constant>(op));
+    }
+  }
+}
+
+bool usesThreadLocals(llvm::Function &fn) {
+  bool result = false;
+  forEachReferencedGlobal(fn, [&result](llvm::GlobalValue *gv) {
+    result = result || gv->isThreadLocal();
+  });
+  return result;
+}
+
+/// Collects the globals the dynamic functions depend on, and determines the
+/// ones whose definition is embedded.
+class Dependencies {
+public:
+  explicit Dependencies(
+      const llvm::SmallPtrSetImpl<llvm::GlobalValue *> &consts)
+      : consts(consts) {}
+
+  /// All referenced globals, including the dynamic functions.
+  llvm::SmallPtrSet<llvm::GlobalValue *, 32> reachable;
+  /// The globals defined in the embedded module.
+  llvm::SmallPtrSet<const llvm::GlobalValue *, 32> definitions;
+
+  void addDynamicFunction(llvm::Function *fn) {
+    reachable.insert(fn);
+    definitions.insert(fn);
+    worklist.push_back(fn);
+  }
+
+  void run() {
+    while (!worklist.empty()) {
+      llvm::GlobalValue *gv = worklist.back();
+      worklist.pop_back();
+      if (auto fn = llvm::dyn_cast<llvm::Function>(gv)) {
+        forEachReferencedGlobal(*fn,
+                                [this](llvm::GlobalValue *gv) { add(gv); });
+      } else {
+        addConstant(llvm::cast<llvm::GlobalVariable>(gv)->getInitializer());
+      }
+    }
+  }
+
+private:
+  const llvm::SmallPtrSetImpl<llvm::GlobalValue *> &consts;
+  std::vector<llvm::GlobalValue *> worklist;
+
+  /// Returns whether the definition of the global can be copied to the
+  /// embedded module; the copies can't be interposed and must not have any
+  /// state of their own.
+  bool canEmbedDefinition(llvm::GlobalValue *gv) {
+    if (gv->isDeclaration() || gv->isInterposable() || consts.count(gv)) {
+      return false;
+    }
+    if (auto fn = llvm::dyn_cast<llvm::Function>(gv)) {
+      return !usesThreadLocals(*fn);
+    }
+    if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+      return var->isConstant() && !var->isThreadLocal();
+    }
+    return false;
+  }
+
+  void add(llvm::GlobalValue *gv) {
+    if (!reachable.insert(gv).second) {
+      return;
+    }
+    if (canEmbedDefinition(gv)) {
+      definitions.insert(gv);
+      worklist.push_back(gv);
+    }
+  }
+
+  void addConstant(llvm::Constant *init) {
+    llvm::SmallPtrSet<llvm::Constant *, 16> visited;
+    std::vector<llvm::Constant *> constants = {init};
+    while (!constants.empty()) {
+      llvm::Constant *c = constants.back();
+      constants.pop_back();
+      if (!visited.insert(c).second) {
+        continue;
+      }
+      if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+        add(gv);
+        continue;
+      }
+      for (llvm::Value *op : c->operands()) {
+        constants.push_back(llvm::cast<llvm::Constant>(op));
+      }
+    }
+  }
+};
+
+/// Turns the dynamic function into a thunk calling the function pointed to
+/// by the returned <name>.jit_ptr variable, initialized with the original
+/// function (renamed to <name>.static).
+llvm::GlobalVariable *emitThunk(IrFunction *irFunc) {
+  llvm::Module &m = gIR->module;
+  llvm::Function *fn = irFunc->func;
+  const std::string name = fn->getName();
+
+  auto thunk = LLFunction::Create(fn->getFunctionType(), fn->getLinkage(), "",
+                                  &m);
+  thunk->copyAttributesFrom(fn);
+  thunk->setComdat(fn->getComdat());
+  fn->replaceAllUsesWith(thunk);
+  thunk->takeName(fn);
+  irFunc->func = thunk;
+
+  fn->setName(name + ".static");
+  fn->setLinkage(LLGlobalValue::InternalLinkage);
+  fn->setVisibility(LLGlobalValue::DefaultVisibility);
+  fn->setDLLStorageClass(LLGlobalValue::DefaultStorageClass);
+  fn->setComdat(nullptr);
+
+  auto slot = new llvm::GlobalVariable(m, fn->getType(), false,
+                                       LLGlobalValue::InternalLinkage, fn,
+                                       name + ".jit_ptr");
+
+  IRBuilder<> b(llvm::BasicBlock::Create(gIR->context(), "", thunk));
+  std::vector<LLValue *> args;
+  for (auto &arg : thunk->args()) {
+    args.push_back(&arg);
+  }
+  llvm::CallInst *call = b.CreateCall(b.CreateLoad(slot), args);
+  call->setCallingConv(fn->getCallingConv());
+  call->setAttributes(fn->getAttributes());
+  call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  if (thunk->getReturnType()->isVoidTy()) {
+    b.CreateRetVoid();
+  } else {
+    b.CreateRet(call);
+  }
+
+  return slot;
+}
+
+/// Removes the globals not needed by the dynamic functions from the clone.
+void eraseGlobals(llvm::Module &m,
+                  const llvm::SmallPtrSetImpl<llvm::GlobalValue *> &keep) {
+  std::vector<llvm::GlobalValue *> unused;
+  for (auto &fn : m.functions()) {
+    if (!keep.count(&fn))
+      unused.push_back(&fn);
+  }
+  for (auto &var : m.globals()) {
+    if (!keep.count(&var))
+      unused.push_back(&var);
+  }
+  for (auto &alias : m.aliases()) {
+    unused.push_back(&alias);
+  }
+
+  for (llvm::GlobalValue *gv : unused) {
+    if (auto fn = llvm::dyn_cast<llvm::Function>(gv)) {
+      fn->dropAllReferences();
+    } else {
+      gv->dropAllReferences();
+    }
+  }
+  for (llvm::GlobalValue *gv : unused) {
+    gv->removeDeadConstantUsers();
+    if (!gv->use_empty()) {
+      gv->replaceAllUsesWith(llvm::UndefValue::get(gv->getType()));
+    }
+    gv->eraseFromParent();
+  }
+}
+}
+
+void generateDynamicCompiledCode(IRState *irs) {
+  std::vector<IrFunction *> &irFuncs = irs->dynamicCompiledFunctions;
+  if (irFuncs.empty()) {
+    irs->dynamicCompileConsts.clear();
+    return;
+  }
+
+  IF_LOG Logger::println("Embedding %llu dynamic functions of module %s",
+                         static_cast<unsigned long long>(irFuncs.size()),
+                         irs->dmodule->toChars());
+  LOG_SCOPE;
+
+  llvm::Module &m = irs->module;
+
+  llvm::SmallPtrSet<llvm::GlobalValue *, 8> consts;
+  for (VarDeclaration *vd : irs->dynamicCompileConsts) {
+    LLValue *value = getIrGlobal(vd)->value;
+    if (auto gvar = llvm::dyn_cast<llvm::GlobalVariable>(value)) {
+      consts.insert(gvar);
+    }
+  }
+
+  Dependencies deps(consts);
+  llvm::SmallPtrSet<llvm::GlobalValue *, 8> isDynamic;
+  for (IrFunction *irFunc : irFuncs) {
+    FuncDeclaration *fd = irFunc->decl;
+    if (!irFunc->targetClones.empty()) {
+      fd->error("'@ldc.attributes.dynamicCompile' cannot be combined with "
+                "'@ldc.attributes.targetClones'");
+      continue;
+    }
+    // The code compiled at runtime doesn't know the thread it runs in.
+    if (usesThreadLocals(*irFunc->func)) {
+      fd->error("'@ldc.attributes.dynamicCompile' functions cannot access "
+                "thread-local variables");
+      continue;
+    }
+    isDynamic.insert(irFunc->func);
+    deps.addDynamicFunction(irFunc->func);
+  }
+  if (global.errors) {
+    fatal();
+  }
+  deps.run();
+
+  // Build the module to embed.
+  llvm::ValueToValueMapTy vmap;
+  std::unique_ptr<llvm::Module> jitModule = llvm::CloneModule(
+      &m, vmap, [&deps](const llvm::GlobalValue *gv) {
+        return deps.definitions.count(gv) != 0;
+      });
+
+  // Visit the globals in module order for deterministic symbol tables.
+  std::vector<llvm::GlobalValue *> reachable;
+  for (auto &fn : m.functions()) {
+    if (deps.reachable.count(&fn))
+      reachable.push_back(&fn);
+  }
+  for (auto &var : m.globals()) {
+    if (deps.reachable.count(&var))
+      reachable.push_back(&var);
+  }
+  for (auto &alias : m.aliases()) {
+    if (deps.reachable.count(&alias))
+      reachable.push_back(&alias);
+  }
+
+  llvm::SmallPtrSet<llvm::GlobalValue *, 32> kept;
+  std::vector<LLConstant *> symbols;
+  std::vector<LLConstant *> constSymbols;
+  for (llvm::GlobalValue *gv : reachable) {
+    auto clone = llvm::cast<llvm::GlobalValue>(vmap[gv]);
+    kept.insert(clone);
+
+    if (auto obj = llvm::dyn_cast<llvm::GlobalObject>(clone)) {
+      obj->setComdat(nullptr);
+    }
+    clone->setVisibility(LLGlobalValue::DefaultVisibility);
+    clone->setDLLStorageClass(LLGlobalValue::DefaultStorageClass);
+
+    if (isDynamic.count(gv)) {
+      clone->setLinkage(LLGlobalValue::ExternalLinkage);
+      continue;
+    }
+
+    if (clone->isThreadLocal()) {
+      error(irFuncs[0]->decl->loc,
+            "'@ldc.attributes.dynamicCompile' code cannot refer to the "
+            "thread-local variable '%s'",
+            gv->getName().str().c_str());
+      continue;
+    }
+    if (!clone->isDeclaration()) {
+      clone->setLinkage(LLGlobalValue::AvailableExternallyLinkage);
+    } else if (clone->hasLocalLinkage()) {
+      clone->setLinkage(LLGlobalValue::ExternalLinkage);
+    }
+
+    if (auto fn = llvm::dyn_cast<llvm::Function>(clone)) {
+      if (fn->isIntrinsic())
+        continue;
+    }
+    if (!clone->hasName()) {
+      clone->setName("ldc.jit.anon");
+    }
+    (consts.count(gv) ? constSymbols : symbols)
+        .push_back(symbol(clone->getName(), gv));
+  }
+  if (global.errors) {
+    fatal();
+  }
+
+  eraseGlobals(*jitModule, kept);
+  llvm::StripDebugInfo(*jitModule);
+  // The runtime compiles the code for the host CPU.
+  for (auto &fn : jitModule->functions()) {
+    fn.removeFnAttr("target-cpu");
+    fn.removeFnAttr("target-features");
+  }
+
+  std::string bitcode;
+  {
+    llvm::raw_string_ostream os(bitcode);
+    llvm::WriteBitcodeToFile(jitModule.get(), os);
+  }
+  auto bitcodeVar = new llvm::GlobalVariable(
+      m, LLArrayType::get(LLType::getInt8Ty(gIR->context()), bitcode.size()),
+      true, LLGlobalValue::PrivateLinkage,
+      llvm::ConstantDataArray::getString(gIR->context(), bitcode, false),
+      ".jit.bitcode");
+  bitcodeVar->setAlignment(16);
+
+  // Replace the dynamic functions by thunks.
+  std::vector<LLConstant *> funcSymbols;
+  for (IrFunction *irFunc : irFuncs) {
+    const std::string name = irFunc->func->getName();
+    funcSymbols.push_back(symbol(name, emitThunk(irFunc)));
+  }
+
+  LLStructType *descTy = descriptorType();
+  LLConstant *descFields[] = {
+      getNullPtr(getVoidPtrType()),
+      DtoBitCast(bitcodeVar, getVoidPtrType()),
+      DtoConstSize_t(bitcode.size()),
+      DtoConstSize_t(funcSymbols.size()),
+      symbolTable(funcSymbols, ".jit.funcs"),
+      DtoConstSize_t(symbols.size()),
+      symbolTable(symbols, ".jit.symbols"),
+      DtoConstSize_t(constSymbols.size()),
+      symbolTable(constSymbols, ".jit.consts")};
+  auto desc = new llvm::GlobalVariable(
+      m, descTy, false, LLGlobalValue::InternalLinkage,
+      LLConstantStruct::get(descTy, descFields), ".jit.module");
+
+  irFuncs.clear();
+  irs->dynamicCompileConsts.clear();
+
+  // Register the descriptor with the runtime.
+  LLFunction *ctor = LLFunction::Create(
+      LLFunctionType::get(LLType::getVoidTy(gIR->context()), false),
+      LLGlobalValue::InternalLinkage, "ldc.dynamic_compile.register", &m);
+  ctor->addFnAttr(LLAttribute::NoUnwind);
+
+  LLFunction *registerFn = m.getFunction("_d_dynamic_compile_register");
+  if (!registerFn) {
+    LLType *params[] = {getVoidPtrType()};
+    registerFn = LLFunction::Create(
+        LLFunctionType::get(LLType::getVoidTy(gIR->context()), params, false),
+        LLGlobalValue::ExternalLinkage, "_d_dynamic_compile_register", &m);
+  }
+
+  IRBuilder<> b(llvm::BasicBlock::Create(gIR->context(), "", ctor));
+  b.CreateCall(registerFn, DtoBitCast(desc, getVoidPtrType()));
+  b.CreateRetVoid();
+
+  AppendFunctionToLLVMGlobalCtorsDtors(ctor, 65535, true);
+}
+
+#else // LDC_LLVM_VER < 400
+
+void generateDynamicCompiledCode(IRState *irs) {
+  std::vector<IrFunction *> &irFuncs = irs->dynamicCompiledFunctions;
+  if (!irFuncs.empty()) {
+    error(irFuncs[0]->decl->loc, "'@ldc.attributes.dynamicCompile' requires "
+                                 "LDC to be built with LLVM 4.0 or later");
+    fatal();
+  }
+  irs->dynamicCompileConsts.clear();
+}
+
+#endif
@@ -0,0 +1,27 @@
+//===-- gen/dynamic-compile.h - Runtime-compiled functions ------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Embeds the IR of the @ldc.attributes.dynamicCompile functions into the
+// object file, to be compiled for the host CPU by the ldc-jit-rt runtime
+// library when the program calls compileDynamicCode().
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_DYNAMIC_COMPILE_H
+#define LDC_GEN_DYNAMIC_COMPILE_H
+
+struct IRState;
+
+/// Embeds the bitcode of the dynamic functions of the module
+/// (irs->dynamicCompiledFunctions) and turns the functions into thunks
+/// dispatching to the code compiled at runtime. Called once the IR of the
+/// module is complete, before optimizing it.
+void generateDynamicCompiledCode(IRState *irs);
+
+#endif
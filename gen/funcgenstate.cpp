@@ -9,6 +9,9 @@
 
 #include "gen/funcgenstate.h"
 
+#include "declaration.h"
+#include "mtype.h"
+#include "driver/cl_options.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
 #include "gen/ms-cxx-helper.h"
@@ -16,19 +19,22 @@
 #include "ir/irfunction.h"
 
 JumpTarget::JumpTarget(llvm::BasicBlock *targetBlock,
-                       CleanupCursor cleanupScope, Statement *targetStatement)
+                       CleanupCursor cleanupScope, Statement *targetStatement,
+                       size_t lifetimeScope)
     : targetBlock(targetBlock), cleanupScope(cleanupScope),
-      targetStatement(targetStatement) {}
+      targetStatement(targetStatement), lifetimeScope(lifetimeScope) {}
 
-JumpTargets::JumpTargets(TryCatchFinallyScopes &scopes) : scopes(scopes) {}
+JumpTargets::JumpTargets(TryCatchFinallyScopes &scopes,
+                         LocalLifetimes &lifetimes)
+    : scopes(scopes), lifetimes(lifetimes) {}
 
 void JumpTargets::pushLoopTarget(Statement *loopStatement,
                                  llvm::BasicBlock *continueTarget,
                                  llvm::BasicBlock *breakTarget) {
   continueTargets.emplace_back(continueTarget, scopes.currentCleanupScope(),
-                               loopStatement);
+                               loopStatement, lifetimes.currentScope());
   breakTargets.emplace_back(breakTarget, scopes.currentCleanupScope(),
-                            loopStatement);
+                            loopStatement, lifetimes.currentScope());
 }
 
 void JumpTargets::popLoopTarget() {
@@ -38,8 +44,8 @@ void JumpTargets::popLoopTarget() {
 
 void JumpTargets::pushBreakTarget(Statement *switchStatement,
                                   llvm::BasicBlock *targetBlock) {
-  breakTargets.push_back(
-      {targetBlock, scopes.currentCleanupScope(), switchStatement});
+  breakTargets.push_back({targetBlock, scopes.currentCleanupScope(),
+                          switchStatement, lifetimes.currentScope()});
 }
 
 void JumpTargets::popBreakTarget() { breakTargets.pop_back(); }
@@ -69,6 +75,7 @@ void JumpTargets::jumpToStatement(std::vector<JumpTarget> &targets,
                                   Statement *loopOrSwitchStatement) {
   for (auto it = targets.rbegin(), end = targets.rend(); it != end; ++it) {
     if (it->targetStatement == loopOrSwitchStatement) {
+      lifetimes.endForJump(it->lifetimeScope);
       scopes.runCleanups(it->cleanupScope, it->targetBlock);
       return;
     }
@@ -80,6 +87,7 @@ void JumpTargets::jumpToClosest(std::vector<JumpTarget> &targets) {
   assert(!targets.empty() &&
          "Encountered break/continue but no loop in scope.");
   JumpTarget &t = targets.back();
+  lifetimes.endForJump(t.lifetimeScope);
   scopes.runCleanups(t.cleanupScope, t.targetBlock);
 }
 
@@ -98,6 +106,18 @@ llvm::BasicBlock *SwitchCaseTargets::getOrCreate(Statement *stmt,
   return bb;
 }
 
+namespace {
+bool isNothrow(FuncDeclaration *fd) {
+  Type *t = fd->type->toBasetype();
+  return t->ty == Tfunction && static_cast<TypeFunction *>(t)->isnothrow;
+}
+}
+
 FuncGenState::FuncGenState(IrFunction &irFunc, IRState &irs)
-    : irFunc(irFunc), scopes(irs), jumpTargets(scopes), switchTargets(),
+    : irFunc(irFunc), scopes(irs), jumpTargets(scopes, localLifetimes),
+      switchTargets(),
+      lastUseCopies(irFunc.decl), defaultInitElision(irFunc.decl),
+      scopeArrayLiterals(irFunc.decl),
+      errorsSkipCleanups(opts::unwindTables == opts::UnwindTables_minimal &&
+                         isNothrow(irFunc.decl)),
       irs(irs) {}
@@ -15,11 +15,16 @@
 #ifndef LDC_GEN_FUNCGENSTATE_H
 #define LDC_GEN_FUNCGENSTATE_H
 
+#include "gen/init-elision.h"
 #include "gen/irstate.h"
+#include "gen/lifetimes.h"
+#include "gen/moves.h"
 #include "gen/pgo.h"
+#include "gen/scope-literals.h"
 #include "gen/trycatchfinally.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/Support/Allocator.h"
 #include <vector>
 
 class Identifier;
@@ -54,15 +59,19 @@ struct JumpTarget {
   /// handle both unlabeled and labeled jumps.
   Statement *targetStatement = nullptr;
 
+  /// The number of active scopes with lifetime markers (see gen/lifetimes.h)
+  /// at the target.
+  size_t lifetimeScope = 0;
+
   JumpTarget() = default;
   JumpTarget(llvm::BasicBlock *targetBlock, CleanupCursor cleanupScope,
-             Statement *targetStatement);
+             Statement *targetStatement, size_t lifetimeScope = 0);
 };
 
 /// Keeps track of labels and implicit loop targets for goto/break/continue.
 class JumpTargets {
 public:
-  explicit JumpTargets(TryCatchFinallyScopes &scopes);
+  JumpTargets(TryCatchFinallyScopes &scopes, LocalLifetimes &lifetimes);
 
   /// Registers a loop statement to be used as a target for break/continue
   /// statements in the current scope.
@@ -127,6 +136,7 @@ private:
   void jumpToClosest(std::vector<JumpTarget> &targets);
 
   TryCatchFinallyScopes &scopes;
+  LocalLifetimes &lifetimes;
 
   using LabelTargetMap = llvm::DenseMap<Identifier *, JumpTarget>;
   /// The labels we have encountered in this function so far, accessed by
@@ -176,6 +186,10 @@ public:
   // The function code is being generated for.
   IrFunction &irFunc;
 
+  /// Backs the DValues created while emitting the function body (see
+  /// gen/dvalue.h).
+  llvm::BumpPtrAllocator valueAllocator;
+
   TryCatchFinallyScopes scopes;
 
   JumpTargets jumpTargets;
@@ -199,6 +213,29 @@ public:
   /// value.
   llvm::AllocaInst *retValSlot = nullptr;
 
+  /// The caches of the GC block info of the arrays grown in this function
+  /// (see gen/arrays.cpp), by array lvalue.
+  llvm::DenseMap<llvm::Value *, llvm::Value *> arrayAppendCaches;
+
+  /// The struct copies which are emitted as moves (see gen/moves.h).
+  LastUseCopies lastUseCopies;
+
+  /// The locals whose default initialization is skipped (see
+  /// gen/init-elision.h).
+  DefaultInitElision defaultInitElision;
+
+  /// The array literals which don't need to be GC-allocated (see
+  /// gen/scope-literals.h).
+  ScopeArrayLiterals scopeArrayLiterals;
+
+  /// The lifetimes of the locals of the nested scopes (see gen/lifetimes.h).
+  LocalLifetimes localLifetimes;
+
+  /// With -funwind-tables=minimal, Errors (the only Throwables which can
+  /// escape from nothrow functions) don't run the cleanups of a nothrow
+  /// function, so calls outside of try/catch blocks need no landing pads.
+  const bool errorsSkipCleanups;
+
   /// Emits a call or invoke to the given callee, depending on whether there
   /// are catches/cleanups active or not.
   template <typename T>
@@ -216,6 +253,9 @@ llvm::CallSite FuncGenState::callOrInvoke(llvm::Value *callee, const T &args,
   // to our advantage.
   llvm::Function *calleeFn = llvm::dyn_cast<llvm::Function>(callee);
 
+  if (errorsSkipCleanups && !scopes.isCatching())
+    isNothrow = true;
+
   // Ignore 'nothrow' if there are active catch blocks handling non-Exception
   // Throwables.
   if (isNothrow && scopes.isCatchingNonExceptions())
@@ -15,6 +15,8 @@
 #include "module.h"
 #include "statement.h"
 #include "template.h"
+#include "driver/cl_options.h"
+#include "driver/inlinecache.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 #include "gen/recursivevisitor.h"
@@ -174,11 +176,32 @@ bool defineAsExternallyAvailable(FuncDeclaration &fdecl) {
     return false;
   }
 
+  // Callers must go through the thunk of the module defining the function to
+  // get the code compiled at runtime.
+  if (opts::enableDynamicCompile && hasDynamicCompileUDA(&fdecl)) {
+    IF_LOG Logger::println("@dynamicCompile functions cannot be inlined.");
+    return false;
+  }
+
   if (fdecl.inlining != PINLINEalways && !isInlineCandidate(fdecl))
     return false;
 
   IF_LOG Logger::println("Potential inlining candidate");
 
+  if (inlineCacheEnabled()) {
+    switch (lookupInlineCandidate(fdecl)) {
+    case InlineCandidateStatus::notCached:
+      break;
+    case InlineCandidateStatus::cached:
+      // The cached IR is linked in after codegen of the module.
+      IF_LOG Logger::println("IR cached, only declaring it");
+      return false;
+    case InlineCandidateStatus::tooLarge:
+      IF_LOG Logger::println("Cached summary exceeds the threshold");
+      return false;
+    }
+  }
+
   {
     IF_LOG Logger::println("Do semantic analysis");
     LOG_SCOPE
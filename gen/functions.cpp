@@ -11,6 +11,7 @@
 
 #include "aggregate.h"
 #include "declaration.h"
+#include "expression.h"
 #include "id.h"
 #include "init.h"
 #include "ldcbindings.h"
@@ -19,6 +20,8 @@
 #include "statement.h"
 #include "template.h"
 #include "driver/cl_options.h"
+#include "driver/statistics.h"
+#include "driver/templatestats.h"
 #include "gen/abi.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
@@ -37,16 +40,34 @@
 #include "gen/pgo.h"
 #include "gen/pragma.h"
 #include "gen/runtime.h"
+#include "gen/target-clones.h"
 #include "gen/tollvm.h"
 #include "gen/uda.h"
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include <iostream>
 
+/// Returns the aggregate whose (complete) instance a `this` of type
+/// `thistype` refers to, if its size is known. Interfaces are excluded, as
+/// their references point into the middle of an object.
+static AggregateDeclaration *getThisAggregate(Type *thistype) {
+  Type *t = thistype->toBasetype();
+  AggregateDeclaration *ad = nullptr;
+  if (t->ty == Tstruct) {
+    ad = static_cast<TypeStruct *>(t)->sym;
+  } else if (t->ty == Tclass) {
+    ClassDeclaration *cd = static_cast<TypeClass *>(t)->sym;
+    if (!cd->isInterfaceDeclaration())
+      ad = cd;
+  }
+  return ad && ad->sizeok == SIZEOKdone ? ad : nullptr;
+}
+
 llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
                                     Type *nesttype, bool isMain, bool isCtor,
                                     bool isIntrinsic, bool hasSel) {
@@ -93,6 +114,9 @@ llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
     } else {
       // sext/zext return
       attrs.add(DtoShouldExtend(byref ? rt->pointerTo() : rt));
+      if (byref) {
+        attrs.add(LLAttribute::NonNull).addDereferenceable(rt->size());
+      }
     }
     newIrFty.ret = new IrFuncTyArg(rt, byref, attrs);
   }
@@ -105,6 +129,10 @@ llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
     if (isCtor) {
       attrs.add(LLAttribute::Returned);
     }
+    // `this` refers to a complete instance of (at least) the aggregate.
+    if (AggregateDeclaration *ad = getThisAggregate(thistype)) {
+      attrs.addDereferenceable(ad->structsize);
+    }
     newIrFty.arg_this =
         new IrFuncTyArg(thistype, thistype->toBasetype()->ty == Tstruct, attrs);
     ++nextLLArgIdx;
@@ -164,7 +192,8 @@ llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
       loweredDType = ltd;
     } else if (passPointer) {
       // ref/out
-      attrs.addDereferenceable(loweredDType->size());
+      attrs.add(LLAttribute::NonNull)
+          .addDereferenceable(loweredDType->size());
     } else {
       if (abi->passByVal(loweredDType)) {
         // LLVM ByVal parameters are pointers to a copy in the function
@@ -186,6 +215,17 @@ llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
   // let the ABI rewrite the types as necessary
   abi->rewriteFunctionType(f, newIrFty);
 
+  // Mark the pointers and slices to immutable data passed as LLVM values for
+  // the D alias analysis (gen/passes/DAliasAnalysis.cpp).
+  for (auto arg : newIrFty.args) {
+    Type *t = arg->type->toBasetype();
+    if (!arg->byref && !arg->rewrite &&
+        (t->ty == Tpointer || t->ty == Tarray) &&
+        t->nextOf()->isImmutable()) {
+      arg->attrs.add("ldc.immutable");
+    }
+  }
+
   // Now we can modify irFty safely.
   irFty = llvm_move(newIrFty);
 
@@ -473,6 +513,17 @@ void applyTargetMachineAttributes(llvm::Function &func,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/// Returns whether the function is one of the constructs of foreach loops
+/// over opApply, which only perform well if the opApply is inlined and then
+/// the (then known) loop body delegate, too.
+static bool isInlineHintCandidate(FuncDeclaration *fdecl) {
+  if (fdecl->ident == Id::apply || fdecl->ident == Id::applyReverse) {
+    return fdecl->isMember() != nullptr;
+  }
+  FuncLiteralDeclaration *fld = fdecl->isFuncLiteralDeclaration();
+  return fld && fld->fes;
+}
+
 void DtoDeclareFunction(FuncDeclaration *fdecl) {
   DtoResolveFunction(fdecl);
 
@@ -554,6 +605,11 @@ void DtoDeclareFunction(FuncDeclaration *fdecl) {
   // add func to IRFunc
   irFunc->func = func;
 
+  // First apply the TargetMachine attributes, such that they can be overridden
+  // by UDAs. UDAs may also add parameter attributes (@restrict).
+  applyTargetMachineAttributes(*func, *gTargetMachine);
+  applyFuncDeclUDAs(fdecl, irFunc);
+
   // parameter attributes
   if (!DtoIsIntrinsic(fdecl)) {
     applyParamAttrsToLLFunc(f, getIrFunc(fdecl)->irFty, func);
@@ -562,11 +618,6 @@ void DtoDeclareFunction(FuncDeclaration *fdecl) {
     }
   }
 
-  // First apply the TargetMachine attributes, such that they can be overridden
-  // by UDAs.
-  applyTargetMachineAttributes(*func, *gTargetMachine);
-  applyFuncDeclUDAs(fdecl, irFunc);
-
   // main
   if (fdecl->isMain()) {
     // Detect multiple main functions, which is disallowed. DMD checks this
@@ -585,6 +636,8 @@ void DtoDeclareFunction(FuncDeclaration *fdecl) {
       irFunc->setAlwaysInline();
     } else if (fdecl->inlining == PINLINEnever) {
       irFunc->setNeverInline();
+    } else if (isInlineHintCandidate(fdecl)) {
+      irFunc->setInlineHint();
     }
   }
 
@@ -681,6 +734,24 @@ void DtoDeclareFunction(FuncDeclaration *fdecl) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/// Nested functions and function literals can only be referenced from the
+/// object file containing their enclosing function - unless that function is
+/// a template instance, or may be emitted as available_externally elsewhere
+/// for cross-module inlining, or contains template instances (e.g. with a
+/// function literal alias argument), which may be emitted elsewhere too. In/out
+/// contracts are called by the overriding functions' contracts, possibly
+/// defined in other modules.
+static bool isFunctionLocal(FuncDeclaration *fdecl) {
+  FuncDeclaration *parent = fdecl->toParent2()->isFuncDeclaration();
+  if (!parent || parent->hasNestedTemplateInstances) {
+    return false;
+  }
+  if (fdecl->ident == Id::ensure || fdecl->ident == Id::require) {
+    return false;
+  }
+  return !DtoIsTemplateInstance(fdecl) && !willCrossModuleInline();
+}
+
 static LinkageWithCOMDAT lowerFuncLinkage(FuncDeclaration *fdecl) {
   // Intrinsics are always external.
   if (DtoIsIntrinsic(fdecl)) {
@@ -689,7 +760,7 @@ static LinkageWithCOMDAT lowerFuncLinkage(FuncDeclaration *fdecl) {
 
   // Generated array op functions behave like templates in that they might be
   // emitted into many different modules.
-  if (fdecl->isArrayOp && (willInline() || !isDruntimeArrayOp(fdecl))) {
+  if (fdecl->isArrayOp && !usesDruntimeArrayOp(fdecl)) {
     return LinkageWithCOMDAT(templateLinkage, supportsCOMDAT());
   }
 
@@ -700,6 +771,13 @@ static LinkageWithCOMDAT lowerFuncLinkage(FuncDeclaration *fdecl) {
     return LinkageWithCOMDAT(LLGlobalValue::ExternalLinkage, false);
   }
 
+  // Internal linkage lets LLVM switch function-local delegate bodies to the
+  // fast calling convention if their address isn't taken (i.e., all calls are
+  // direct), and drop them altogether once all calls have been inlined.
+  if (isFunctionLocal(fdecl) && !hasWeakUDA(fdecl)) {
+    return LinkageWithCOMDAT(LLGlobalValue::InternalLinkage, false);
+  }
+
   return DtoLinkage(fdecl);
 }
 
@@ -774,9 +852,43 @@ void defineParameters(IrFuncTy &irFty, VarDeclarations &parameters) {
   }
 }
 
+/// Emits an llvm.assume() call telling the optimizer that the memory the
+/// parameter `vd` points to is aligned to `alignment` bytes.
+void emitAssumeAligned(VarDeclaration *vd, unsigned alignment) {
+#if LDC_LLVM_VER >= 306
+  DLValue param(vd->type, getIrParameter(vd)->value);
+  LLValue *ptr = vd->type->toBasetype()->ty == Tarray ? DtoArrayPtr(&param)
+                                                      : DtoRVal(&param);
+  LLValue *addr = gIR->ir->CreatePtrToInt(ptr, DtoSize_t());
+  LLValue *misalignment =
+      gIR->ir->CreateAnd(addr, DtoConstSize_t(alignment - 1));
+  LLValue *isAligned =
+      gIR->ir->CreateICmpEQ(misalignment, DtoConstSize_t(0), "isAligned");
+  gIR->ir->CreateCall(GET_INTRINSIC_DECL(assume), isAligned);
+#endif
+}
+
+/// Returns whether the function doesn't call any other function (besides LLVM
+/// intrinsics), so that no exception can be thrown from or through it.
+bool isLeafFunction(llvm::Function *func) {
+  for (auto &bb : *func) {
+    for (auto &inst : bb) {
+      if (llvm::isa<llvm::InvokeInst>(inst))
+        return false;
+      if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+        llvm::Function *callee = call->getCalledFunction();
+        if (!callee || !callee->isIntrinsic())
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
 } // anonymous namespace
 
 void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
+  Logger::FunctionScope logFunctionScope(fd);
   IF_LOG Logger::println("DtoDefineFunction(%s): %s", fd->toPrettyChars(),
                          fd->loc.toChars());
   LOG_SCOPE;
@@ -791,6 +903,7 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
       // Fix linkage
       const auto lwc = lowerFuncLinkage(fd);
       setLinkage(lwc, getIrFunc(fd)->func);
+      setVisibility(fd, getIrFunc(fd)->func);
     }
     return;
   }
@@ -826,7 +939,7 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
   }
 
   // Skip array ops implemented in druntime
-  if (fd->isArrayOp && !willInline() && isDruntimeArrayOp(fd)) {
+  if (usesDruntimeArrayOp(fd)) {
     IF_LOG Logger::println(
         "No code generation for array op %s implemented in druntime",
         fd->toChars());
@@ -928,6 +1041,7 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
            lwc.first != llvm::GlobalValue::LinkOnceAnyLinkage);
   } else {
     setLinkage(lwc, func);
+    setVisibility(fd, func);
   }
 
   // On x86_64, always set 'uwtable' for System V ABI compatibility.
@@ -951,6 +1065,25 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
     }
   }
 
+  // With segmented stacks, the prologue checks the remaining stack space and
+  // calls __morestack to allocate a new segment if necessary.
+  if (opts::splitStack) {
+    func->addFnAttr("split-stack");
+  }
+  if (!opts::stackProbeFunction.empty()) {
+    func->addFnAttr("probe-stack", opts::stackProbeFunction);
+  }
+  // The backend instruments functions with at least the threshold number of
+  // instructions, unless @xrayAlways/@xrayNever set function-instrument.
+  if (opts::xrayInstrument) {
+    func->addFnAttr("xray-instruction-threshold",
+                    llvm::utostr(opts::xrayInstructionThreshold));
+  }
+  // -falign-functions doesn't override an explicit @alignCode.
+  if (opts::alignFunctions && func->getAlignment() == 0) {
+    func->setAlignment(opts::alignFunctions);
+  }
+
   llvm::BasicBlock *beginbb =
       llvm::BasicBlock::Create(gIR->context(), "", func);
 
@@ -1021,6 +1154,11 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
   if (fd->parameters)
     defineParameters(irFty, *fd->parameters);
 
+  // tell the optimizer about the alignment of @assumeAligned parameters
+  for (const auto &pair : irFunc->assumedAlignments) {
+    emitAssumeAligned(pair.first, pair.second);
+  }
+
   // Initialize PGO state for this function
   funcGen.pgo.assignRegionCounters(fd, irFunc->func);
 
@@ -1115,8 +1253,34 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
 
   gIR->scopes.pop_back();
 
+  // With -funwind-tables=minimal, nothrow leaf functions get neither unwind
+  // tables nor an entry in .eh_frame.
+  if (funcGen.errorsSkipCleanups && isLeafFunction(func)) {
+    func->removeFnAttr(LLAttribute::UWTable);
+    func->addFnAttr(LLAttribute::NoUnwind);
+  }
+
   assert(&gIR->funcGen() == &funcGen);
   gIR->funcGenStates.pop_back();
+
+  if (!irFunc->targetClones.empty()) {
+    emitTargetClones(irFunc);
+  }
+
+  if (irFunc->dynamicCompile && !linkageAvailableExternally) {
+    gIR->dynamicCompiledFunctions.push_back(irFunc);
+  }
+
+  if (!linkageAvailableExternally) {
+    if (stats::isEnabled()) {
+      ++stats::counters().functionsCodegenned;
+    }
+    if (opts::templateStats) {
+      if (TemplateInstance *ti = fd->isInstantiated()) {
+        recordTemplateFunction(ti, func);
+      }
+    }
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1139,6 +1303,11 @@ DValue *DtoArgument(Parameter *fnarg, Expression *argexp) {
   if (fnarg && (fnarg->storageClass & STClazy)) {
     assert(argexp->type->toBasetype()->ty == Tdelegate);
     assert(!arg->isLVal());
+    // The thunk evaluating the argument is only useful if it is inlined into
+    // the callee (once that is inlined itself).
+    if (argexp->op == TOKfunction) {
+      getIrFunc(static_cast<FuncExp *>(argexp)->fd)->setInlineHint();
+    }
     return arg;
   }
 
@@ -1164,6 +1333,13 @@ int binary(const char *p, const char **tab, int high) {
   return -1;
 }
 
+bool usesDruntimeArrayOp(FuncDeclaration *fd) {
+  // When optimizing, the generated loops are vectorized for the target CPU,
+  // unlike the generic druntime implementations.
+  return fd->isArrayOp && !willInline() && !isOptimizationEnabled() &&
+         isDruntimeArrayOp(fd);
+}
+
 int isDruntimeArrayOp(FuncDeclaration *fd) {
   /* Some of the array op functions are written as library functions,
    * presumably to optimize them with special CPU vector instructions.
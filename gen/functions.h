@@ -47,4 +47,8 @@ DValue *DtoArgument(Parameter *fnarg, Expression *argexp);
 // Search for a druntime array op
 int isDruntimeArrayOp(FuncDeclaration *fd);
 
+// Whether a call to the druntime implementation is emitted for an array op
+// (instead of generating its code, which can be vectorized for the target)
+bool usesDruntimeArrayOp(FuncDeclaration *fd);
+
 #endif
@@ -0,0 +1,258 @@
+//===-- init-elision.cpp --------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/init-elision.h"
+
+#include "aggregate.h"
+#include "declaration.h"
+#include "expression.h"
+#include "init.h"
+#include "mtype.h"
+#include "statement.h"
+#include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "gen/recursivevisitor.h"
+#include "llvm/Support/CommandLine.h"
+
+static llvm::cl::opt<bool> disableInitElision(
+    "disable-default-init-elision", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("Always default-initialize locals, even if they are "
+                   "overwritten before being read"));
+
+namespace {
+
+/// Stops when reaching a reference to the variable.
+struct MentionsVar : public StoppableVisitor {
+  VarDeclaration *vd;
+
+  explicit MentionsVar(VarDeclaration *vd) : vd(vd) {}
+
+  using StoppableVisitor::visit;
+
+  void visit(VarExp *e) override { stop = e->var == vd; }
+  void visit(SymOffExp *e) override { stop = e->var == vd; }
+
+  void visit(Statement *) override {}
+  void visit(Expression *) override {}
+  void visit(Declaration *) override {}
+  void visit(Initializer *) override {}
+  void visit(Dsymbol *) override {}
+};
+
+template <class T> bool mentions(T *node, VarDeclaration *vd) {
+  if (!node)
+    return false;
+  MentionsVar visitor(vd);
+  RecursiveWalker walker(&visitor, false);
+  node->accept(&walker);
+  return visitor.stop;
+}
+
+/// Stops when reaching a jump to a label or inline assembly.
+struct HasGotos : public StoppableVisitor {
+  using StoppableVisitor::visit;
+
+  void visit(GotoStatement *) override { stop = true; }
+  void visit(GotoCaseStatement *) override { stop = true; }
+  void visit(GotoDefaultStatement *) override { stop = true; }
+  void visit(AsmStatement *) override { stop = true; }
+
+  void visit(Statement *) override {}
+  void visit(Expression *) override {}
+  void visit(Declaration *) override {}
+  void visit(Initializer *) override {}
+  void visit(Dsymbol *) override {}
+};
+
+/// Returns whether values of type `t` contain bytes which aren't part of any
+/// field (and are zeroed by the default initialization only).
+bool hasPadding(Type *t) {
+  t = t->toBasetype();
+  switch (t->ty) {
+  case Tsarray:
+    return hasPadding(t->nextOf());
+  case Tstruct: {
+    StructDeclaration *sd = static_cast<TypeStruct *>(t)->sym;
+    uint64_t end = 0;
+    for (VarDeclaration *field : sd->fields) {
+      if (field->offset != end || hasPadding(field->type))
+        return true;
+      end += field->type->size();
+    }
+    return end != sd->structsize;
+  }
+  case Tfloat80:
+  case Timaginary80:
+  case Tcomplex80:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Returns whether `vd` is a local with the default initializer provided by
+/// the frontend (a blit of a constant), which can be skipped.
+bool isDefaultInitialized(FuncDeclaration *fd, VarDeclaration *vd) {
+  if (!vd->_init || vd->isDataseg() || vd->toParent2() != fd ||
+      vd->nestedrefs.dim || (vd->storage_class & (STCref | STCout))) {
+    return false;
+  }
+
+  ExpInitializer *ei = vd->_init->isExpInitializer();
+  if (!ei || ei->exp->op != TOKblit)
+    return false;
+  auto blit = static_cast<BlitExp *>(ei->exp);
+  if (blit->e1->op != TOKvar || static_cast<VarExp *>(blit->e1)->var != vd)
+    return false;
+  Expression *init = blit->e2;
+  const bool isConstant =
+      init->op == TOKint64 || init->op == TOKfloat64 ||
+      init->op == TOKcomplex80 || init->op == TOKnull ||
+      (init->op == TOKvar &&
+       static_cast<VarExp *>(init)->var->isSymbolDeclaration());
+  if (!isConstant)
+    return false;
+
+  // A destructor would read the variable if leaving its scope before the
+  // assignment.
+  Type *t = vd->type;
+  return !t->needsDestruction() && !t->baseElemOf()->needsNested() &&
+         !hasPadding(t);
+}
+
+/// Returns the default-initialized variable declared by `stmt`, if any.
+VarDeclaration *getDeclaredVariable(FuncDeclaration *fd, Statement *stmt) {
+  ExpStatement *es = stmt ? stmt->isExpStatement() : nullptr;
+  if (!es || !es->exp || es->exp->op != TOKdeclaration)
+    return nullptr;
+  VarDeclaration *vd = static_cast<DeclarationExp *>(es->exp)
+                           ->declaration->isVarDeclaration();
+  return vd && isDefaultInitialized(fd, vd) ? vd : nullptr;
+}
+
+/// Determines whether a statement referring to `vd` completely overwrites
+/// `vd` before any other reference to it.
+struct OverwritesFirst : public Visitor {
+  VarDeclaration *vd;
+  bool result = false;
+
+  explicit OverwritesFirst(VarDeclaration *vd) : vd(vd) {}
+
+  static bool check(Statement *stmt, VarDeclaration *vd) {
+    OverwritesFirst v(vd);
+    stmt->accept(&v);
+    return v.result;
+  }
+
+  using Visitor::visit;
+
+  void visit(Statement *) override {}
+
+  void visit(ScopeStatement *stmt) override {
+    result = stmt->statement && check(stmt->statement, vd);
+  }
+
+  void visit(CompoundStatement *stmt) override {
+    for (Statement *s : *stmt->statements) {
+      if (mentions(s, vd)) {
+        result = check(s, vd);
+        return;
+      }
+    }
+  }
+
+  // A finally block might be run before the assignment in the body.
+  void visit(TryFinallyStatement *stmt) override {
+    result = stmt->_body && !mentions(stmt->finalbody, vd) &&
+             check(stmt->_body, vd);
+  }
+
+  // `v = rhs` or `v[] = rhs`, with rhs not referring to v
+  void visit(ExpStatement *stmt) override {
+    Expression *e = stmt->exp;
+    if (!e || (e->op != TOKassign && e->op != TOKconstruct && e->op != TOKblit))
+      return;
+
+    auto ae = static_cast<AssignExp *>(e);
+    Expression *lhs = ae->e1;
+    if (lhs->op == TOKslice) {
+      // Only a static array is fully overwritten by `v[] = rhs`; a dynamic
+      // array needs its initial ptr/length to be written through.
+      auto se = static_cast<SliceExp *>(lhs);
+      if (se->lwr || se->upr || vd->type->toBasetype()->ty != Tsarray)
+        return;
+      lhs = se->e1;
+    }
+    result = lhs->op == TOKvar && static_cast<VarExp *>(lhs)->var == vd &&
+             !mentions(ae->e2, vd);
+  }
+
+  void visit(DtorExpStatement *) override {}
+};
+
+/// Checks the default-initialized locals declared in each statement list.
+struct FindSkippableInits : public StoppableVisitor {
+  FuncDeclaration *fd;
+  llvm::SmallPtrSetImpl<VarDeclaration *> &skippable;
+
+  FindSkippableInits(FuncDeclaration *fd,
+                     llvm::SmallPtrSetImpl<VarDeclaration *> &skippable)
+      : fd(fd), skippable(skippable) {}
+
+  using StoppableVisitor::visit;
+
+  void visit(CompoundStatement *cs) override {
+    Statements &stmts = *cs->statements;
+    for (size_t i = 0; i < stmts.dim; ++i) {
+      VarDeclaration *vd = getDeclaredVariable(fd, stmts[i]);
+      if (!vd)
+        continue;
+      for (size_t j = i + 1; j < stmts.dim; ++j) {
+        if (mentions(stmts[j], vd)) {
+          if (OverwritesFirst::check(stmts[j], vd)) {
+            IF_LOG Logger::println("Default initialization of %s is dead",
+                                   vd->toChars());
+            skippable.insert(vd);
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  void visit(Statement *) override {}
+  void visit(Expression *) override {}
+  void visit(Declaration *) override {}
+  void visit(Initializer *) override {}
+  void visit(Dsymbol *) override {}
+};
+}
+
+bool DefaultInitElision::canSkip(VarDeclaration *vd) {
+  if (!isOptimizationEnabled() || disableInitElision)
+    return false;
+
+  if (!analyzed) {
+    analyzed = true;
+
+    if (fd->fbody) {
+      HasGotos gotos;
+      RecursiveWalker gotoWalker(&gotos, false);
+      fd->fbody->accept(&gotoWalker);
+
+      if (!gotos.stop) {
+        FindSkippableInits finder(fd, skippable);
+        RecursiveWalker walker(&finder);
+        fd->fbody->accept(&walker);
+      }
+    }
+  }
+
+  return skippable.count(vd) != 0;
+}
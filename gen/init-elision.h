@@ -0,0 +1,44 @@
+//===-- gen/init-elision.h - Default initialization elision -----*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Finds the default-initialized locals which are completely overwritten before
+// they are read, so that their default initialization can be skipped.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_INIT_ELISION_H
+#define LDC_GEN_INIT_ELISION_H
+
+#include "llvm/ADT/SmallPtrSet.h"
+
+class FuncDeclaration;
+class VarDeclaration;
+
+/// D default-initializes all locals without explicit initializer. LLVM often
+/// fails to remove these stores (or copies of the init symbol) for large
+/// static arrays and structs if the variable is assigned right afterwards,
+/// especially if there are calls in between. This analysis finds the locals
+/// for which the first statement after the declaration referring to the
+/// variable overwrites it completely, without gotos in the function which
+/// could skip that statement.
+class DefaultInitElision {
+public:
+  explicit DefaultInitElision(FuncDeclaration *fd) : fd(fd) {}
+
+  /// Returns whether the default initialization of `vd` can be skipped.
+  bool canSkip(VarDeclaration *vd);
+
+private:
+  FuncDeclaration *fd;
+  /// The function body is analyzed on the first query.
+  bool analyzed = false;
+  llvm::SmallPtrSet<VarDeclaration *, 8> skippable;
+};
+
+#endif
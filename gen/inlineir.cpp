@@ -51,37 +51,40 @@ DValue *DtoInlineIRExpr(Loc &loc, FuncDeclaration *fdecl,
   // temporarily disable value name discarding.
   TempDisableDiscardValueNames tempDisable(gIR->context());
 
-  // Generate a random new function name. Because the inlineIR function is
-  // always inlined, this name does not escape the current compiled module; not
-  // even at -O0.
-  static size_t namecounter = 0;
-  std::string mangled_name = "inline.ir." + std::to_string(namecounter++);
   TemplateInstance *tinst = fdecl->parent->isTemplateInstance();
   assert(tinst);
 
-  // 1. Define the inline function (define a new function for each call)
+  Objects &objs = tinst->tdtypes;
+  assert(objs.dim == 3);
+
+  Expression *a0 = isExpression(objs[0]);
+  assert(a0);
+  StringExp *strexp = a0->toStringExp();
+  assert(strexp);
+  assert(strexp->sz == 1);
+  std::string code(strexp->toPtr(), strexp->numberOfCodeUnits());
+
+  Type *ret = isType(objs[1]);
+  assert(ret);
+
+  Tuple *a2 = isTuple(objs[2]);
+  assert(a2);
+  Objects &arg_types = a2->objects;
+
+  // Some parent function attributes are applied to the inlineIR function too.
+  // This is needed e.g. when the parent function has "unsafe-fp-math"="true"
+  // applied.
+  assert(!gIR->funcGenStates.empty() && "Inline ir outside function");
+  auto enclosingFunc = gIR->topfunc();
+  assert(enclosingFunc);
+
+  // Everything after the function name in the definition. Together with the
+  // enclosing function's attributes, this identifies the function uniquely, so
+  // that all calls with the same IR and signature share one parsed definition.
+  std::string signature;
   {
-
-    Objects &objs = tinst->tdtypes;
-    assert(objs.dim == 3);
-
-    Expression *a0 = isExpression(objs[0]);
-    assert(a0);
-    StringExp *strexp = a0->toStringExp();
-    assert(strexp);
-    assert(strexp->sz == 1);
-    std::string code(strexp->toPtr(), strexp->numberOfCodeUnits());
-
-    Type *ret = isType(objs[1]);
-    assert(ret);
-
-    Tuple *a2 = isTuple(objs[2]);
-    assert(a2);
-    Objects &arg_types = a2->objects;
-
-    std::string str;
-    llvm::raw_string_ostream stream(str);
-    stream << "define " << *DtoType(ret) << " @" << mangled_name << "(";
+    llvm::raw_string_ostream stream(signature);
+    stream << "(";
 
     for (size_t i = 0;;) {
       Type *ty = isType(arg_types[i]);
@@ -107,6 +110,33 @@ DValue *DtoInlineIRExpr(Loc &loc, FuncDeclaration *fdecl,
     }
 
     stream << ")\n{\n" << code << "\n}";
+  }
+
+  std::string returnType;
+  {
+    llvm::raw_string_ostream stream(returnType);
+    stream << *DtoType(ret);
+  }
+
+  const std::string cacheKey =
+      returnType + ' ' + signature + '\0' +
+      enclosingFunc->getAttributes().getAsString(
+          llvm::AttributeSet::FunctionIndex);
+
+  llvm::Function *&fun = gIR->inlineIRCache[cacheKey];
+
+  // 1. Define the inline function, unless an identical one has already been
+  //    defined in this module
+  if (!fun) {
+    // Generate a random new function name. Because the inlineIR function is
+    // always inlined, this name does not escape the current compiled module;
+    // not even at -O0.
+    static size_t namecounter = 0;
+    std::string mangled_name = "inline.ir." + std::to_string(namecounter++);
+
+    std::string str;
+    llvm::raw_string_ostream stream(str);
+    stream << "define " << returnType << " @" << mangled_name << signature;
 
     llvm::SMDiagnostic err;
 
@@ -142,27 +172,18 @@ DValue *DtoInlineIRExpr(Loc &loc, FuncDeclaration *fdecl,
             errstr.c_str());
     }
 #endif
-  }
 
-  // 2. Call the function that was just defined and return the returnvalue
-  {
-    llvm::Function *fun = gIR->module.getFunction(mangled_name);
-
-    // Apply some parent function attributes to the inlineIR function too. This
-    // is needed e.g. when the parent function has "unsafe-fp-math"="true"
-    // applied.
-    {
-      assert(!gIR->funcGenStates.empty() && "Inline ir outside function");
-      auto enclosingFunc = gIR->topfunc();
-      assert(enclosingFunc);
-      copyFnAttributes(fun, enclosingFunc);
-    }
+    fun = gIR->module.getFunction(mangled_name);
+    copyFnAttributes(fun, enclosingFunc);
 
     fun->setLinkage(llvm::GlobalValue::PrivateLinkage);
     fun->removeFnAttr(llvm::Attribute::NoInline);
     fun->addFnAttr(llvm::Attribute::AlwaysInline);
     fun->setCallingConv(llvm::CallingConv::C);
+  }
 
+  // 2. Call the function and return the returnvalue
+  {
     // Build the runtime arguments
     size_t n = arguments->dim;
     llvm::SmallVector<llvm::Value *, 8> args;
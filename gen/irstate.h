@@ -99,9 +99,13 @@ struct IRAsmBlock {
   bool retemu; // emulate abi ret with a temporary
   LLValue *(*retfixup)(IRBuilderHelper b, LLValue *orig); // Modifies retval
 
+  // false if any of the instructions may access memory other than through its
+  // memory operands, e.g. via registers or the stack
+  bool accessesOnlyOperandMemory;
+
   explicit IRAsmBlock(CompoundAsmStatement *b)
       : outputcount(0), asmBlock(b), retty(nullptr), retn(0), retemu(false),
-        retfixup(nullptr) {}
+        retfixup(nullptr), accessesOnlyOperandMemory(true) {}
 };
 
 // represents the module
@@ -177,6 +181,10 @@ struct IRState {
   // PGO data file reader
   std::unique_ptr<llvm::IndexedInstrProfReader> PGOReader;
   llvm::IndexedInstrProfReader *getPGOReader() const { return PGOReader.get(); }
+  // The largest function entry count of each function name in the PGO data
+  // file, regardless of the control-flow hash. Read the first time a function
+  // with stale profile data is encountered.
+  std::unique_ptr<llvm::StringMap<uint64_t>> PGOEntryCounts;
 
   // for inline asm
   IRAsmBlock *asmBlock;
@@ -186,6 +194,16 @@ struct IRState {
   // eliminated.
   std::vector<LLConstant *> usedArray;
 
+  // The -profile-gc allocation sites of the current module, registered by
+  // registerGCAllocationSites().
+  std::vector<LLConstant *> gcAllocationSites;
+
+  // The @dynamicCompile functions defined in the current module and the
+  // @dynamicCompileConst variables referenced by it, see
+  // generateDynamicCompiledCode().
+  std::vector<IrFunction *> dynamicCompiledFunctions;
+  std::vector<VarDeclaration *> dynamicCompileConsts;
+
   /// Whether to emit array bounds checking in the current function.
   bool emitArrayBoundsChecks();
 
@@ -197,6 +215,14 @@ struct IRState {
   llvm::StringMap<llvm::GlobalVariable *> stringLiteral2ByteCache;
   llvm::StringMap<llvm::GlobalVariable *> stringLiteral4ByteCache;
 
+  // Globals for the files embedded by getStringImportBlob(), keyed by name.
+  llvm::StringMap<llvm::GlobalVariable *> stringImportBlobs;
+
+  // Functions defined for pragma(LDC_inline_ir) calls, keyed by their IR
+  // (including the signature) and the attributes inherited from the calling
+  // function. Lets repeated instantiations share a single parsed definition.
+  llvm::StringMap<llvm::Function *> inlineIRCache;
+
 /// Vector of options passed to the linker as metadata in object file.
 #if LDC_LLVM_VER >= 306
   llvm::SmallVector<llvm::Metadata *, 5> LinkerMetadataArgs;
@@ -0,0 +1,124 @@
+//===-- lifetimes.cpp -----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/lifetimes.h"
+
+#include "declaration.h"
+#include "expression.h"
+#include "statement.h"
+#include "visitor.h"
+#include "gen/funcgenstate.h"
+#include "gen/irstate.h"
+#include "gen/llvm.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "gen/tollvm.h"
+#include "llvm/Support/CommandLine.h"
+
+static llvm::cl::opt<bool> disableLifetimeMarkers(
+    "disable-lifetime-markers", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("Don't emit lifetime markers for the locals of nested "
+                   "scopes"));
+
+namespace {
+bool isEnabled() { return isOptimizationEnabled() && !disableLifetimeMarkers; }
+
+/// Collects the plain stack locals declared in a statement, not descending
+/// into statements which are scopes on their own.
+struct CollectDeclaredVars : public Visitor {
+  llvm::SmallPtrSetImpl<VarDeclaration *> &vars;
+
+  explicit CollectDeclaredVars(llvm::SmallPtrSetImpl<VarDeclaration *> &vars)
+      : vars(vars) {}
+
+  void collect(Statement *stmt) {
+    if (stmt)
+      stmt->accept(this);
+  }
+
+  using Visitor::visit;
+
+  void visit(Statement *) override {}
+
+  void visit(CompoundStatement *stmt) override {
+    for (Statement *s : *stmt->statements)
+      collect(s);
+  }
+
+  void visit(LabelStatement *stmt) override { collect(stmt->statement); }
+
+  // The frontend wraps the rest of the scope after the declaration of a
+  // variable with destructor in a try-finally.
+  void visit(TryFinallyStatement *stmt) override { collect(stmt->_body); }
+
+  void visit(ExpStatement *stmt) override {
+    if (!stmt->exp || stmt->exp->op != TOKdeclaration)
+      return;
+    VarDeclaration *vd = static_cast<DeclarationExp *>(stmt->exp)
+                             ->declaration->isVarDeclaration();
+    if (vd && !vd->isDataseg() && !vd->aliassym && !vd->nestedrefs.dim &&
+        !(vd->storage_class & (STCmanifest | STCref | STCout | STClazy)) &&
+        !isSpecialRefVar(vd)) {
+      vars.insert(vd);
+    }
+  }
+};
+
+llvm::ConstantInt *getSize(llvm::AllocaInst *alloca) {
+  return llvm::ConstantInt::get(
+      LLType::getInt64Ty(gIR->context()),
+      getTypeAllocSize(alloca->getAllocatedType()));
+}
+}
+
+void LocalLifetimes::pushScope(Statement *body) {
+  scopes.emplace_back();
+  scopes.back().cleanupScope = gIR->funcGen().scopes.currentCleanupScope();
+  if (isEnabled()) {
+    CollectDeclaredVars collector(scopes.back().vars);
+    collector.collect(body);
+  }
+}
+
+void LocalLifetimes::endLifetimes(const Scope &scope) {
+  for (auto it = scope.started.rbegin(), end = scope.started.rend(); it != end;
+       ++it) {
+    gIR->ir->CreateLifetimeEnd(*it, getSize(*it));
+  }
+}
+
+void LocalLifetimes::popScope() {
+  assert(!scopes.empty());
+  if (!gIR->scopereturned())
+    endLifetimes(scopes.back());
+  scopes.pop_back();
+}
+
+void LocalLifetimes::endForJump(size_t targetScope) {
+  assert(targetScope <= scopes.size());
+  const size_t cleanupScope = gIR->funcGen().scopes.currentCleanupScope();
+  for (size_t i = scopes.size(); i > targetScope; --i) {
+    // No cleanups have been pushed since entering the scope.
+    if (scopes[i - 1].cleanupScope == cleanupScope)
+      endLifetimes(scopes[i - 1]);
+  }
+}
+
+void LocalLifetimes::startLifetime(VarDeclaration *vd, llvm::Value *storage) {
+  if (scopes.empty() || !scopes.back().vars.count(vd))
+    return;
+  auto alloca = llvm::dyn_cast<llvm::AllocaInst>(storage);
+  if (!alloca)
+    return;
+
+  IF_LOG Logger::println("Starting lifetime of %s", vd->toChars());
+  gIR->ir->CreateLifetimeStart(alloca, getSize(alloca));
+  scopes.back().started.push_back(alloca);
+}
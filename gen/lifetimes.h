@@ -0,0 +1,75 @@
+//===-- gen/lifetimes.h - Lifetime markers for scoped locals ----*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Emits llvm.lifetime.start/end markers for the locals declared in nested
+// scopes, so that LLVM can assign the locals of disjoint scopes to the same
+// stack slot.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_LIFETIMES_H
+#define LDC_GEN_LIFETIMES_H
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include <cstddef>
+#include <vector>
+
+class Statement;
+class VarDeclaration;
+namespace llvm {
+class AllocaInst;
+class Value;
+}
+
+/// All locals are allocated in the entry block of the function. The lifetime
+/// of a local declared in a ScopeStatement starts at its declaration and ends
+/// when the control flow falls through the end of the scope, or leaves it by
+/// a break, continue or return.
+///
+/// The cleanups (finally blocks) pushed inside a scope may refer to its
+/// locals, so jumps running such cleanups, gotos and exceptions don't end the
+/// lifetimes; that only keeps the stack slots reserved for longer.
+class LocalLifetimes {
+public:
+  /// Returns the number of active scopes, identifying the innermost one.
+  size_t currentScope() const { return scopes.size(); }
+
+  /// Enters the scope of a ScopeStatement, before emitting its `body`.
+  void pushScope(Statement *body);
+
+  /// Ends the lifetime of the locals of the innermost scope if its end is
+  /// reachable, and leaves that scope.
+  void popScope();
+
+  /// Ends the lifetimes of the locals of the scopes nested in `targetScope`
+  /// before jumping to it, unless cleanups of these scopes need to be run on
+  /// the way. Called before running the cleanups.
+  void endForJump(size_t targetScope);
+
+  /// Starts the lifetime of the freshly allocated `storage` of `vd` if it is
+  /// a local of the innermost scope.
+  void startLifetime(VarDeclaration *vd, llvm::Value *storage);
+
+private:
+  struct Scope {
+    /// The cleanup scope (see gen/trycatchfinally.h) on entering the scope.
+    size_t cleanupScope = 0;
+    /// The locals declared directly in the scope.
+    llvm::SmallPtrSet<VarDeclaration *, 4> vars;
+    /// The allocas of the locals whose lifetime has been started.
+    llvm::SmallVector<llvm::AllocaInst *, 4> started;
+  };
+
+  std::vector<Scope> scopes;
+
+  void endLifetimes(const Scope &scope);
+};
+
+#endif
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "gen/llvmhelpers.h"
+#include "driver/cl_options.h"
 #include "gen/cl_helpers.h"
 #include "declaration.h"
 #include "expression.h"
@@ -25,6 +26,7 @@
 #include "gen/nested.h"
 #include "gen/mangling.h"
 #include "gen/pragma.h"
+#include "gen/profilegc.h"
 #include "gen/runtime.h"
 #include "gen/tollvm.h"
 #include "gen/typinf.h"
@@ -36,11 +38,17 @@
 #include "ir/irtypeaggr.h"
 #include "mars.h"
 #include "module.h"
+#include "rmem.h"
 #include "template.h"
 #include "llvm/MC/MCAsmInfo.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include <algorithm>
 #include <stack>
 
 #include "llvm/Support/CommandLine.h"
@@ -93,6 +101,7 @@ LLValue *DtoNew(Loc &loc, Type *newtype) {
   LLConstant *ti = DtoTypeInfoOf(newtype);
   assert(isaPointer(ti));
   // call runtime allocator
+  emitGCAllocationSiteOf(loc, newtype);
   LLValue *mem = gIR->CreateCallOrInvoke(fn, ti, ".gc_mem").getInstruction();
   // cast
   return DtoBitCast(mem, DtoPtrToType(newtype), ".gc_mem");
@@ -103,6 +112,7 @@ LLValue *DtoNewStruct(Loc &loc, TypeStruct *newtype) {
       loc, gIR->module,
       newtype->isZeroInit(newtype->sym->loc) ? "_d_newitemT" : "_d_newitemiT");
   LLConstant *ti = DtoTypeInfoOf(newtype);
+  emitGCAllocationSiteOf(loc, newtype);
   LLValue *mem = gIR->CreateCallOrInvoke(fn, ti, ".gc_struct").getInstruction();
   return DtoBitCast(mem, DtoPtrToType(newtype), ".gc_struct");
 }
@@ -206,6 +216,7 @@ LLValue *DtoGcMalloc(Loc &loc, LLType *lltype, const char *name) {
   // parameters
   LLValue *size = DtoConstSize_t(getTypeAllocSize(lltype));
   // call runtime allocator
+  emitGCAllocationSite(loc, size);
   LLValue *mem = gIR->CreateCallOrInvoke(fn, size, name).getInstruction();
   // cast
   return DtoBitCast(mem, getPtrToType(lltype), name);
@@ -244,6 +255,122 @@ LLValue *DtoAllocaDump(LLValue *val, LLType *asType, int alignment,
   return DtoBitCast(mem, asMemType->getPointerTo());
 }
 
+/******************************************************************************
+ * DEFAULT INITIALIZER HELPERS
+ ******************************************************************************/
+
+namespace {
+// Initializers with more non-zero scalars than this are copied from the init
+// symbol.
+const size_t maxDefaultInitStores = 16;
+// Larger aggregates are only expanded if their initializer is all zeros.
+const uint64_t maxDefaultInitExpandedSize = 1024;
+
+using DefaultInitStore = std::pair<uint64_t, LLConstant *>;
+
+// Collects the non-zero scalars of init at or past startOffset, together with
+// their byte offsets. Returns false if there are too many of them.
+bool collectDefaultInitStores(LLConstant *init, uint64_t offset,
+                              uint64_t startOffset,
+                              llvm::SmallVectorImpl<DefaultInitStore> &stores) {
+  // undef parts end up as zeros in the init symbol
+  if (init->isNullValue() || llvm::isa<llvm::UndefValue>(init)) {
+    return true;
+  }
+
+  LLType *type = init->getType();
+  if (auto st = llvm::dyn_cast<LLStructType>(type)) {
+    const llvm::StructLayout *layout = gDataLayout->getStructLayout(st);
+    for (unsigned i = 0, n = st->getNumElements(); i < n; ++i) {
+      LLConstant *elem = init->getAggregateElement(i);
+      if (!elem ||
+          !collectDefaultInitStores(elem, offset + layout->getElementOffset(i),
+                                    startOffset, stores)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (auto at = llvm::dyn_cast<LLArrayType>(type)) {
+    const uint64_t elemSize = getTypeAllocSize(at->getElementType());
+    for (unsigned i = 0, n = at->getNumElements(); i < n; ++i) {
+      LLConstant *elem = init->getAggregateElement(i);
+      if (!elem || !collectDefaultInitStores(elem, offset + i * elemSize,
+                                             startOffset, stores)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (offset < startOffset) {
+    return true;
+  }
+  if (stores.size() == maxDefaultInitStores) {
+    return false;
+  }
+  stores.push_back(std::make_pair(offset, init));
+  return true;
+}
+}
+
+void DtoCopyDefaultInit(AggregateDeclaration *ad, LLValue *dst,
+                        uint64_t startOffset, unsigned align) {
+  const uint64_t size = ad->structsize;
+  assert(startOffset <= size);
+  if (startOffset == size) {
+    return;
+  }
+  if (align == 0) {
+    align = std::max(DtoAlignment(ad->type), 1u);
+  }
+
+  IrAggr *irAggr = getIrAggr(ad);
+  LLValue *mem = DtoBitCast(dst, getVoidPtrType());
+  LLValue *nbytes = DtoConstSize_t(size - startOffset);
+
+  // Building the initializer of a class defines its interface vtbls (and
+  // thunks), which must only happen in the module defining the class.
+  const bool canExpand =
+      !ad->isClassDeclaration() || ad->getModule() == gIR->dmodule;
+  LLConstant *init = canExpand ? irAggr->getDefaultInit() : nullptr;
+
+  llvm::SmallVector<DefaultInitStore, maxDefaultInitStores> stores;
+  if (!init || (!init->isNullValue() &&
+                (size > maxDefaultInitExpandedSize ||
+                 !collectDefaultInitStores(init, 0, startOffset, stores)))) {
+    IF_LOG Logger::println("copying default initializer of %s from init symbol",
+                           ad->toPrettyChars());
+    LLValue *initsym = DtoBitCast(irAggr->getInitSymbol(), getVoidPtrType());
+    DtoMemCpy(DtoGEPi1(mem, startOffset), DtoGEPi1(initsym, startOffset),
+              nbytes, align);
+    return;
+  }
+
+  IF_LOG Logger::println("expanding default initializer of %s into %u stores",
+                         ad->toPrettyChars(),
+                         static_cast<unsigned>(stores.size()));
+
+  // Only skip the memset if the stores cover every byte, padding included.
+  uint64_t storedBytes = 0;
+  for (const auto &store : stores) {
+    storedBytes += getTypeStoreSize(store.second->getType());
+  }
+  if (storedBytes < size - startOffset) {
+    DtoMemSetZero(DtoGEPi1(mem, startOffset), nbytes, align);
+  }
+
+  for (const auto &store : stores) {
+    LLConstant *val = store.second;
+    LLValue *ptr = DtoBitCast(DtoGEPi1(mem, store.first),
+                              getPtrToType(val->getType()));
+    llvm::StoreInst *st = gIR->ir->CreateStore(val, ptr);
+    st->setAlignment(
+        static_cast<unsigned>(llvm::MinAlign(align, store.first)));
+  }
+}
+
 /******************************************************************************
  * ASSERT HELPER
  ******************************************************************************/
@@ -279,8 +406,42 @@ void DtoAssert(Module *M, Loc &loc, DValue *msg) {
  ******************************************************************************/
 
 LLValue *DtoModuleFileName(Module *M, const Loc &loc) {
-  return DtoConstString(loc.filename ? loc.filename
-                                     : M->srcfile->name->toChars());
+  return DtoConstString(remapFilePrefix(
+      loc.filename ? loc.filename : M->srcfile->name->toChars()));
+}
+
+namespace {
+/// Replaces the prefix of `path` according to the last matching `old=new`
+/// mapping, as GCC does. Returns false if none matches.
+bool applyPrefixMap(const llvm::cl::list<std::string> &mappings,
+                    std::string &path) {
+  for (auto it = mappings.rbegin(), end = mappings.rend(); it != end; ++it) {
+    const auto split = llvm::StringRef(*it).split('=');
+    if (!split.first.empty() && llvm::StringRef(path).startswith(split.first)) {
+      path = (split.second + llvm::StringRef(path).drop_front(
+                                 split.first.size())).str();
+      return true;
+    }
+  }
+  return false;
+}
+}
+
+const char *remapFilePrefix(const char *path) {
+  if (!path || opts::filePrefixMap.empty())
+    return path;
+
+  std::string remapped = path;
+  if (!applyPrefixMap(opts::filePrefixMap, remapped))
+    return path;
+  return mem.xstrdup(remapped.c_str());
+}
+
+std::string remapDebugFilePrefix(llvm::StringRef path) {
+  std::string remapped = path;
+  if (!applyPrefixMap(opts::debugPrefixMap, remapped))
+    applyPrefixMap(opts::filePrefixMap, remapped);
+  return remapped;
 }
 
 /******************************************************************************
@@ -919,6 +1080,7 @@ void DtoVarDeclaration(VarDeclaration *vd) {
     irLocal->value = allocainst;
 
     gIR->DBuilder.EmitLocalVariable(allocainst, vd);
+    gIR->funcGen().localLifetimes.startLifetime(vd, allocainst);
   }
 
   IF_LOG Logger::cout() << "llvm value for decl: " << *getIrLocal(vd)->value
@@ -926,9 +1088,14 @@ void DtoVarDeclaration(VarDeclaration *vd) {
 
   if (vd->_init) {
     if (ExpInitializer *ex = vd->_init->isExpInitializer()) {
-      // TODO: Refactor this so that it doesn't look like toElem has no effect.
-      Logger::println("expression initializer");
-      toElem(ex->exp);
+      if (gIR->funcGen().defaultInitElision.canSkip(vd)) {
+        Logger::println("default initializer skipped, overwritten before use");
+      } else {
+        // TODO: Refactor this so that it doesn't look like toElem has no
+        // effect.
+        Logger::println("expression initializer");
+        toElem(ex->exp);
+      }
     }
   }
 }
@@ -1661,6 +1828,13 @@ llvm::Constant *buildStringLiteralConstant(StringExp *se, bool zeroTerm) {
   Type *dtype = se->type->toBasetype();
   Type *cty = dtype->nextOf()->toBasetype();
 
+  // Build 8-bit strings from the raw data instead of per-character constants.
+  if (cty->size() == 1 && se->sz == 1) {
+    return llvm::ConstantDataArray::getString(
+        gIR->context(), llvm::StringRef(se->toPtr(), se->numberOfCodeUnits()),
+        zeroTerm);
+  }
+
   LLType *ct = DtoMemType(cty);
   auto len = se->numberOfCodeUnits();
   if (zeroTerm) {
@@ -1679,6 +1853,123 @@ llvm::Constant *buildStringLiteralConstant(StringExp *se, bool zeroTerm) {
   return LLConstantArray::get(at, vals);
 }
 
+static llvm::cl::opt<unsigned> stringImportIncbinThreshold(
+    "string-import-incbin-threshold", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::init(1024 * 1024), llvm::cl::value_desc("bytes"),
+    llvm::cl::desc("Embed string imports of at least <bytes> bytes directly "
+                   "from the file into the object file (ELF only, 0 to "
+                   "disable)"));
+
+static std::string escapeAsmString(llvm::StringRef str) {
+  std::string result;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+    }
+    result += c;
+  }
+  return result;
+}
+
+/// Returns the path of a file with the given data, named after its hash, in
+/// the temporary directory, writing it unless it already exists. The imported
+/// file itself may have changed since the frontend has read it, and .incbin
+/// only reads the file when assembling the object.
+static bool getSnapshotFile(llvm::StringRef data, llvm::StringRef hash,
+                            llvm::SmallString<128> &path) {
+  llvm::sys::path::system_temp_directory(/*erasedOnReboot=*/true, path);
+  llvm::sys::path::append(path, "ldc-string-import-" + hash);
+
+  auto existing = llvm::MemoryBuffer::getFile(path);
+  if (existing && (*existing)->getBuffer() == data) {
+    return true;
+  }
+
+  // Written via a temporary file, so that concurrent compiler invocations
+  // never embed a partially written one.
+  int fd;
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", fd, tempFile)) {
+    return false;
+  }
+  bool ok;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+    os.flush();
+    ok = !os.has_error();
+    os.clear_error();
+  }
+  if (!ok || llvm::sys::fs::rename(tempFile, path)) {
+    llvm::sys::fs::remove(tempFile);
+    return false;
+  }
+  return true;
+}
+
+llvm::GlobalVariable *getStringImportBlob(StringExp *se) {
+  if (!se->importedFile || stringImportIncbinThreshold == 0 ||
+      se->numberOfCodeUnits() < stringImportIncbinThreshold ||
+      !global.params.targetTriple->isOSBinFormatELF()) {
+    return nullptr;
+  }
+  Type *const dtype = se->type->toBasetype();
+  if (dtype->ty == Tsarray || se->sz != 1 ||
+      dtype->nextOf()->toBasetype()->size() != 1) {
+    return nullptr;
+  }
+
+  // Name the blob after the hash of the contents. This makes identical
+  // files share a COMDAT section across object files, and makes the hash of
+  // the contents (rather than the data itself) part of the cache key.
+  const llvm::StringRef data(se->toPtr(), se->numberOfCodeUnits());
+  llvm::MD5 hasher;
+  hasher.update(data);
+  llvm::MD5::MD5Result hash;
+  hasher.final(hash);
+  llvm::SmallString<32> hashStr;
+  llvm::MD5::stringifyResult(hash, hashStr);
+  const std::string name = ("ldc.string_import." + hashStr).str();
+
+  // Keyed by name, as different files may have the same contents.
+  llvm::GlobalVariable *&blob = gIR->stringImportBlobs[name];
+  if (blob) {
+    return blob;
+  }
+
+  // Embed the data as seen by the frontend (e.g. at CTFE), and matching the
+  // hash.
+  llvm::SmallString<128> path;
+  if (!getSnapshotFile(data, hashStr, path)) {
+    return nullptr;
+  }
+
+  // The data (plus the terminating zero of string literals) is assembled by
+  // the .incbin directive, so that it is neither copied into the IR nor
+  // hashed for the cache as part of the bitcode.
+  std::string asmstr;
+  llvm::raw_string_ostream os(asmstr);
+  os << "\t.section\t.rodata." << name << ",\"aG\",%progbits," << name
+     << ",comdat\n"
+     << "\t.weak\t" << name << "\n"
+     << "\t.hidden\t" << name << "\n"
+     << "\t.type\t" << name << ",%object\n"
+     << "\t.size\t" << name << ", " << (data.size() + 1) << "\n"
+     << name << ":\n"
+     << "\t.incbin\t\"" << escapeAsmString(path) << "\"\n"
+     << "\t.byte\t0\n"
+     << "\t.text\n";
+  gIR->module.appendModuleInlineAsm(os.str());
+
+  auto type =
+      LLArrayType::get(LLType::getInt8Ty(gIR->context()), data.size() + 1);
+  blob = new llvm::GlobalVariable(gIR->module, type, true,
+                                  llvm::GlobalValue::ExternalLinkage, nullptr,
+                                  name);
+  blob->setVisibility(llvm::GlobalValue::HiddenVisibility);
+  return blob;
+}
+
 llvm::GlobalVariable *getOrCreateGlobal(const Loc &loc, llvm::Module &module,
                                         llvm::Type *type, bool isConstant,
                                         llvm::GlobalValue::LinkageTypes linkage,
@@ -1709,6 +2000,129 @@ llvm::GlobalVariable *getOrCreateGlobal(const Loc &loc, llvm::Module &module,
                                   nullptr, tlsModel);
 }
 
+void DtoSetThreadLocalModels(llvm::Module &module) {
+  if (clThreadModel.getNumOccurrences()) {
+    return;
+  }
+
+  for (auto &gv : module.getGlobalList()) {
+    if (gv.getThreadLocalMode() !=
+        llvm::GlobalVariable::GeneralDynamicTLSModel) {
+      continue;
+    }
+
+    // The model the backend would derive from the default one anyway.
+    switch (gTargetMachine->getTLSModel(&gv)) {
+    case llvm::TLSModel::GeneralDynamic:
+      break;
+    case llvm::TLSModel::LocalDynamic:
+      gv.setThreadLocalMode(llvm::GlobalVariable::LocalDynamicTLSModel);
+      break;
+    case llvm::TLSModel::InitialExec:
+      gv.setThreadLocalMode(llvm::GlobalVariable::InitialExecTLSModel);
+      break;
+    case llvm::TLSModel::LocalExec:
+      gv.setThreadLocalMode(llvm::GlobalVariable::LocalExecTLSModel);
+      break;
+    }
+  }
+}
+
+namespace {
+/// Returns the raw data of the given string literal global, or an empty
+/// StringRef if the global isn't a private, unnamed_addr string literal.
+llvm::StringRef getStringLiteralData(llvm::GlobalVariable &gv,
+                                     std::string &storage) {
+  if (!gv.hasPrivateLinkage() || !gv.isConstant() || !gv.hasInitializer() ||
+#if LDC_LLVM_VER >= 309
+      !gv.hasGlobalUnnamedAddr() ||
+#else
+      !gv.hasUnnamedAddr() ||
+#endif
+      gv.hasSection() || gv.getAlignment() != 0 ||
+      !gv.getName().startswith(".str")) {
+    return llvm::StringRef();
+  }
+
+  llvm::Constant *init = gv.getInitializer();
+  if (auto cda = llvm::dyn_cast<llvm::ConstantDataArray>(init)) {
+    if (cda->getElementType()->isIntegerTy()) {
+      return cda->getRawDataValues();
+    }
+    return llvm::StringRef();
+  }
+  // The empty string literal is a single zero terminator.
+  if (llvm::isa<llvm::ConstantAggregateZero>(init)) {
+    auto at = llvm::dyn_cast<llvm::ArrayType>(init->getType());
+    if (at && at->getElementType()->isIntegerTy()) {
+      storage.assign(
+          at->getNumElements() * at->getElementType()->getIntegerBitWidth() / 8,
+          '\0');
+      return storage;
+    }
+  }
+  return llvm::StringRef();
+}
+}
+
+void DtoPoolStringLiteralSuffixes(llvm::Module &module) {
+  struct Literal {
+    llvm::GlobalVariable *gvar;
+    llvm::Type *elementType;
+    std::string reversedData;
+  };
+
+  std::vector<Literal> literals;
+  for (auto &gv : module.getGlobalList()) {
+    std::string storage;
+    llvm::StringRef data = getStringLiteralData(gv, storage);
+    if (data.empty()) {
+      continue;
+    }
+    literals.push_back(
+        {&gv, gv.getInitializer()->getType()->getArrayElementType(),
+         std::string(data.rbegin(), data.rend())});
+  }
+  if (literals.size() < 2) {
+    return;
+  }
+
+  // Sorting the reversed contents in descending order places each literal
+  // right after all the literals it is a suffix of.
+  std::stable_sort(literals.begin(), literals.end(),
+                   [](const Literal &a, const Literal &b) {
+                     if (a.elementType != b.elementType) {
+                       return a.elementType < b.elementType;
+                     }
+                     return a.reversedData > b.reversedData;
+                   });
+
+  const Literal *container = &literals[0];
+  for (size_t i = 1; i < literals.size(); ++i) {
+    const Literal &lit = literals[i];
+    if (lit.elementType != container->elementType ||
+        !llvm::StringRef(container->reversedData)
+             .startswith(lit.reversedData)) {
+      container = &lit;
+      continue;
+    }
+
+    const size_t elementSize = lit.elementType->getIntegerBitWidth() / 8;
+    const size_t offset =
+        (container->reversedData.size() - lit.reversedData.size()) /
+        elementSize;
+    LLConstant *idxs[] = {DtoConstUint(0), DtoConstUint(offset)};
+    LLConstant *ptr = llvm::ConstantExpr::getGetElementPtr(
+#if LDC_LLVM_VER >= 307
+        container->gvar->getInitializer()->getType(),
+#endif
+        container->gvar, idxs, true);
+    lit.gvar->replaceAllUsesWith(
+        llvm::ConstantExpr::getBitCast(ptr, lit.gvar->getType()));
+    lit.gvar->eraseFromParent();
+  }
+}
+
 FuncDeclaration *getParentFunc(Dsymbol *sym, bool stopOnStatic) {
   if (!sym) {
     return nullptr;
@@ -63,12 +63,28 @@ LLValue *DtoAllocaDump(LLValue *val, Type *asType, const char *name = "");
 LLValue *DtoAllocaDump(LLValue *val, LLType *asType, int alignment = 0,
                        const char *name = "");
 
+/// Initializes the aggregate instance at dst with its default initializer,
+/// skipping the first startOffset bytes. Initializers with only a few non-zero
+/// parts are emitted as a memset and some stores instead of a copy of the init
+/// symbol. align is the alignment guaranteed for dst, 0 for the alignment of
+/// the aggregate type.
+void DtoCopyDefaultInit(AggregateDeclaration *ad, LLValue *dst,
+                        uint64_t startOffset = 0, unsigned align = 0);
+
 // assertion generator
 void DtoAssert(Module *M, Loc &loc, DValue *msg);
 
 // returns module file name
 LLValue *DtoModuleFileName(Module *M, const Loc &loc);
 
+/// Applies the -ffile-prefix-map mappings to a source file path embedded in
+/// the output. Returns `path` itself if no mapping matches.
+const char *remapFilePrefix(const char *path);
+
+/// Applies the -fdebug-prefix-map and -ffile-prefix-map mappings to a path
+/// in the debug info.
+std::string remapDebugFilePrefix(llvm::StringRef path);
+
 /// emits goto to LabelStatement with the target identifier
 void DtoGoto(Loc &loc, LabelDsymbol *target);
 
@@ -247,6 +263,12 @@ stringLiteralCacheForType(Type *charType);
 
 llvm::Constant *buildStringLiteralConstant(StringExp *se, bool zeroTerm);
 
+/// Returns the global for a large string created by import("file"), whose
+/// (zero-terminated) data is embedded straight from a file (a snapshot of the
+/// contents seen by the frontend), or null if the string is to be emitted as a
+/// regular literal.
+llvm::GlobalVariable *getStringImportBlob(StringExp *se);
+
 /// Tries to create an LLVM global with the given properties. If a variable with
 /// the same mangled name already exists, checks if the types match and returns
 /// it instead.
@@ -260,6 +282,17 @@ llvm::GlobalVariable *getOrCreateGlobal(const Loc &loc, llvm::Module &module,
                                         llvm::StringRef name,
                                         bool isThreadLocal = false);
 
+/// Replaces the default TLS model of the module's thread-local globals by the
+/// one the backend would pick for them (TargetMachine::getTLSModel()), unless
+/// a model was selected on the command line. This makes the models explicit
+/// in IR and bitcode output, e.g. for LTO, where the linker's code generator
+/// doesn't know the relocation model of the original compilation.
+void DtoSetThreadLocalModels(llvm::Module &module);
+
+/// Replaces string literals which are a suffix of another string literal in
+/// the same module by a pointer into the latter.
+void DtoPoolStringLiteralSuffixes(llvm::Module &module);
+
 FuncDeclaration *getParentFunc(Dsymbol *sym, bool stopOnStatic);
 
 void Declaration_codegen(Dsymbol *decl);
@@ -7,6 +7,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "dsymbol.h"
 #include "mars.h"
 #include "llvm/Support/CommandLine.h"
 #include <cassert>
@@ -43,6 +44,8 @@ void Stream::writeValue(std::ostream &OS, const llvm::Value &V) {
 }
 
 namespace Logger {
+#ifndef LDC_DISABLE_LOGGING
+
 static std::string indent_str;
 bool _enabled;
 
@@ -50,26 +53,50 @@ static llvm::cl::opt<bool, true>
     enabledopt("vv", llvm::cl::desc("Print front-end/glue code debug log"),
                llvm::cl::location(_enabled), llvm::cl::ZeroOrMore);
 
-void indent() {
-  if (_enabled) {
-    indent_str += "* ";
+static llvm::cl::list<std::string> functionFilter(
+    "vv-filter", llvm::cl::CommaSeparated, llvm::cl::value_desc("names"),
+    llvm::cl::desc("Restrict the -vv log to the code generation of the "
+                   "functions whose qualified name contains one of <names>"));
+
+// Whether -vv has been given together with -vv-filter.
+static bool filtering = false;
+
+void initialize() {
+  if (_enabled && !functionFilter.empty()) {
+    filtering = true;
+    _enabled = false;
   }
 }
 
-void undent() {
-  if (_enabled) {
-    assert(!indent_str.empty());
-    indent_str.resize(indent_str.size() - 2);
+FunctionScope::FunctionScope(Dsymbol *fd)
+    : active(filtering), wasEnabled(_enabled) {
+  if (!active || _enabled) {
+    return;
+  }
+  const llvm::StringRef name = fd->toPrettyChars();
+  for (const auto &f : functionFilter) {
+    if (name.find(f) != llvm::StringRef::npos) {
+      _enabled = true;
+      break;
+    }
   }
 }
 
-Stream cout() {
-  if (_enabled) {
-    return Stream(std::cout << indent_str);
+FunctionScope::~FunctionScope() {
+  if (active) {
+    _enabled = wasEnabled;
   }
-  return Stream(nullptr);
 }
 
+void _indent() { indent_str += "* "; }
+
+void _undent() {
+  assert(!indent_str.empty());
+  indent_str.resize(indent_str.size() - 2);
+}
+
+Stream _cout() { return Stream(std::cout << indent_str); }
+
 #if defined(_MSC_VER)
 static inline void search_and_replace(std::string &str, const std::string &what,
                                       const std::string &replacement) {
@@ -110,7 +137,24 @@ void print(const char *fmt, ...) {
     va_end(va);
   }
 }
-void attention(Loc &loc, const char *fmt, ...) {
+
+#else // LDC_DISABLE_LOGGING
+
+// Keep accepting -vv for build scripts, but tell the user that there is no log.
+static llvm::cl::opt<bool>
+    enabledopt("vv", llvm::cl::desc("Print front-end/glue code debug log "
+                                    "(not supported by this build)"),
+               llvm::cl::ZeroOrMore, llvm::cl::Hidden);
+
+void initialize() {
+  if (enabledopt) {
+    warning(Loc(), "-vv: this LDC has been built without the debug log");
+  }
+}
+
+#endif // LDC_DISABLE_LOGGING
+
+void attention(Loc loc, const char *fmt, ...) {
   va_list va;
   va_start(va, fmt);
   vwarning(loc, fmt, va);
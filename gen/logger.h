@@ -32,6 +32,7 @@ class Value;
 #endif
 #endif
 
+class Dsymbol;
 struct Loc;
 
 class Stream {
@@ -93,17 +94,70 @@ private:
 };
 
 namespace Logger {
+#ifndef LDC_DISABLE_LOGGING
+
 extern bool _enabled;
 
-void indent();
-void undent();
-Stream cout();
+void _indent();
+void _undent();
+Stream _cout();
 void println(const char *fmt, ...) IS_PRINTF(1);
 void print(const char *fmt, ...) IS_PRINTF(1);
+
+// The entry points without formatting are inline, so that the disabled log
+// costs a load and a branch, not a call. The arguments are still evaluated
+// though, so guard anything more expensive than plain values with IF_LOG.
+inline void indent() {
+  if (_enabled) {
+    _indent();
+  }
+}
+inline void undent() {
+  if (_enabled) {
+    _undent();
+  }
+}
+inline Stream cout() { return _enabled ? _cout() : Stream(); }
 inline void enable() { _enabled = true; }
 inline void disable() { _enabled = false; }
 inline bool enabled() { return _enabled; }
 
+/// Sets up the log after the command line has been parsed.
+void initialize();
+
+/// With -vv-filter, enables the log for the code generation of the functions
+/// matching the filter (including their nested functions).
+struct FunctionScope {
+  explicit FunctionScope(Dsymbol *fd);
+  ~FunctionScope();
+
+private:
+  bool active;
+  bool wasEnabled;
+};
+
+#else // LDC_DISABLE_LOGGING
+
+// The log has been compiled out: everything guarded by IF_LOG is dead code.
+inline void indent() {}
+inline void undent() {}
+inline Stream cout() { return Stream(); }
+inline void println(const char *, ...) IS_PRINTF(1);
+inline void print(const char *, ...) IS_PRINTF(1);
+inline void println(const char *, ...) {}
+inline void print(const char *, ...) {}
+inline void enable() {}
+inline void disable() {}
+constexpr bool enabled() { return false; }
+
+void initialize();
+
+struct FunctionScope {
+  explicit FunctionScope(Dsymbol *) {}
+};
+
+#endif // LDC_DISABLE_LOGGING
+
 void attention(Loc loc, const char *fmt, ...) IS_PRINTF(2);
 
 struct LoggerScope {
@@ -30,6 +30,9 @@ enum TypeDataFields {
 
   TD_Type, /// A value of the LLVM type corresponding to this D type
 
+  TD_Postblit, /// True if copying a value of this type (or an element, for
+               /// dynamic arrays) runs a postblit.
+
   // Must be kept last:
   TD_NumFields /// The number of fields in TypeInfo metadata
 };
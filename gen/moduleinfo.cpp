@@ -9,6 +9,10 @@
 
 #include "gen/moduleinfo.h"
 
+#include "attrib.h"
+#include "declaration.h"
+#include "errors.h"
+#include "expression.h"
 #include "gen/abi.h"
 #include "gen/classes.h"
 #include "gen/irstate.h"
@@ -20,6 +24,24 @@
 #include "ir/irmodule.h"
 #include "ir/irtype.h"
 #include "module.h"
+#include "llvm/Support/CommandLine.h"
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
+static llvm::cl::opt<bool> keepRedundantImports(
+    "disable-moduleinfo-import-reduction",
+    llvm::cl::desc("List all imported modules in ModuleInfo, including the "
+                   "ones reachable through other imported modules"),
+    llvm::cl::Hidden, llvm::cl::ZeroOrMore);
+
+static llvm::cl::opt<bool> emitUnittestTable(
+    "unittest-table",
+    llvm::cl::desc("Additionally emit a record for each unittest into the "
+                   "__ldc_unittests section, so that test runners can run "
+                   "the unittests of a module individually (ELF and Mach-O "
+                   "only)"),
+    llvm::cl::ZeroOrMore);
 
 // These must match the values in druntime/src/object_.d
 #define MIstandalone 0x4
@@ -135,16 +157,89 @@ llvm::Function *buildModuleSharedDtor(Module *m) {
   return buildForwarderFunction(name, getIrModule(m)->sharedDtors);
 }
 
-/// Builds the (constant) data content for the importedModules[] array.
-llvm::Constant *buildImportedModules(Module *m, size_t &count) {
-  const auto moduleInfoPtrTy = DtoPtrToType(Module::moduleinfo->type);
+/// Adds the modules reachable from the given one via the importedModules[] of
+/// their ModuleInfos to reached, without passing through m. Returns whether m
+/// itself is reachable.
+bool collectReachableModules(Module *from, Module *m,
+                             std::unordered_set<Module *> &reached) {
+  bool reachesM = false;
+  std::vector<Module *> worklist(1, from);
+  while (!worklist.empty()) {
+    Module *cur = worklist.back();
+    worklist.pop_back();
+    for (auto mod : cur->aimports) {
+      if (!mod->needModuleInfo()) {
+        continue;
+      }
+      if (mod == m) {
+        reachesM = true;
+      } else if (reached.insert(mod).second) {
+        worklist.push_back(mod);
+      }
+    }
+  }
+  return reachesM;
+}
 
-  std::vector<LLConstant *> importInits;
+/// Returns the modules to list in the importedModules[] array of m.
+///
+/// druntime only uses the imported modules to order the module constructors,
+/// which only depends on which modules are reachable. Imports that are also
+/// reachable through another listed import are therefore left out, making the
+/// import graph druntime walks at startup smaller. This is only done if m is
+/// not part of an import cycle; every object file then keeps the reachability
+/// the full import graph has.
+std::vector<Module *> getImportedModules(Module *m) {
+  std::vector<Module *> imports;
   for (auto mod : m->aimports) {
-    if (!mod->needModuleInfo() || mod == m) {
+    if (!mod->needModuleInfo() || mod == m ||
+        std::find(imports.begin(), imports.end(), mod) != imports.end()) {
       continue;
     }
+    imports.push_back(mod);
+  }
+
+  if (keepRedundantImports || imports.size() < 2) {
+    return imports;
+  }
+
+  std::vector<std::unordered_set<Module *>> reachable(imports.size());
+  for (size_t i = 0; i < imports.size(); ++i) {
+    if (collectReachableModules(imports[i], m, reachable[i])) {
+      IF_LOG Logger::println("%s is part of an import cycle, listing all imports",
+                             m->toChars());
+      return imports;
+    }
+  }
+
+  // Drop the imports reachable from another import which is kept.
+  std::vector<bool> keep(imports.size(), true);
+  for (size_t i = 0; i < imports.size(); ++i) {
+    for (size_t j = 0; j < imports.size(); ++j) {
+      if (j != i && keep[j] && reachable[j].count(imports[i])) {
+        IF_LOG Logger::println("not listing %s, reachable through %s",
+                               imports[i]->toChars(), imports[j]->toChars());
+        keep[i] = false;
+        break;
+      }
+    }
+  }
+
+  std::vector<Module *> result;
+  for (size_t i = 0; i < imports.size(); ++i) {
+    if (keep[i]) {
+      result.push_back(imports[i]);
+    }
+  }
+  return result;
+}
+
+/// Builds the (constant) data content for the importedModules[] array.
+llvm::Constant *buildImportedModules(Module *m, size_t &count) {
+  const auto moduleInfoPtrTy = DtoPtrToType(Module::moduleinfo->type);
 
+  std::vector<LLConstant *> importInits;
+  for (auto mod : getImportedModules(m)) {
     importInits.push_back(
         DtoBitCast(getIrModule(mod)->moduleInfoSymbol(), moduleInfoPtrTy));
   }
@@ -195,6 +290,93 @@ llvm::Constant *buildLocalClasses(Module *m, size_t &count) {
   const auto type = llvm::ArrayType::get(classinfoTy, classInfoRefs.size());
   return LLConstantArray::get(type, classInfoRefs);
 }
+
+/// Returns the first string UDA of a unittest as its name, if any.
+const char *getUnittestName(FuncDeclaration *fd) {
+  if (!fd->userAttribDecl) {
+    return nullptr;
+  }
+
+  Expressions *attrs = fd->userAttribDecl->getAttributes();
+  expandTuples(attrs);
+  for (auto attr : *attrs) {
+    // Don't evaluate the attributes which aren't (narrow) strings at all.
+    Type *t = attr->type ? attr->type->toBasetype() : nullptr;
+    if (!t || !t->isString() || t->nextOf()->toBasetype()->ty != Tchar) {
+      continue;
+    }
+
+    unsigned prevErrors = global.startGagging();
+    Expression *e = attr->ctfeInterpret();
+    if (global.endGagging(prevErrors)) {
+      continue;
+    }
+
+    if (e->op == TOKstring && static_cast<StringExp *>(e)->sz == 1) {
+      return static_cast<StringExp *>(e)->toStringz();
+    }
+  }
+  return nullptr;
+}
+
+/// Emits a record for each unittest of the module into the __ldc_unittests
+/// section, in addition to the __unittest forwarder referenced by the
+/// ModuleInfo:
+///
+///   struct UnittestRecord {
+///     void function() func;
+///     const(char)* name; // the first string UDA, or the function name
+///     const(char)* file;
+///     size_t line;
+///     ModuleInfo* moduleInfo;
+///   }
+///
+/// All fields are pointer-sized, so the section of the linked image is an
+/// array of records delimited by __start___ldc_unittests and
+/// __stop___ldc_unittests (section$start$__DATA$__ldc_unittests and
+/// section$end$__DATA$__ldc_unittests on Darwin).
+void emitUnittestRecords(Module *m, llvm::GlobalVariable *moduleInfoSym) {
+  const auto &unitTests = getIrModule(m)->unitTests;
+  if (!emitUnittestTable || unitTests.empty()) {
+    return;
+  }
+
+  const auto triple = global.params.targetTriple;
+  if (!triple->isOSBinFormatELF() && !triple->isOSBinFormatMachO()) {
+    warning(m->loc, "-unittest-table is only supported for ELF and Mach-O "
+                    "targets");
+    return;
+  }
+  const char *section = triple->isOSBinFormatMachO() ? "__DATA,__ldc_unittests"
+                                                     : "__ldc_unittests";
+
+  const auto voidPtrTy = getVoidPtrType();
+  const auto recordTy = llvm::StructType::get(
+      gIR->context(),
+      {voidPtrTy, voidPtrTy, voidPtrTy, DtoSize_t(), voidPtrTy}, false);
+  const auto cstring = [](const char *str) {
+    return DtoConstString(str)->getAggregateElement(1u);
+  };
+
+  for (auto fd : unitTests) {
+    const auto func = getIrFunc(fd)->func;
+    const char *name = getUnittestName(fd);
+    LLConstant *fields[] = {
+        DtoBitCast(func, voidPtrTy),
+        cstring(name ? name : fd->toPrettyChars()),
+        cstring(remapFilePrefix(fd->loc.filename ? fd->loc.filename : "")),
+        DtoConstSize_t(fd->loc.linnum),
+        DtoBitCast(moduleInfoSym, voidPtrTy)};
+
+    auto record = new llvm::GlobalVariable(
+        gIR->module, recordTy, true, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantStruct::get(recordTy, fields),
+        func->getName() + ".record");
+    record->setSection(section);
+    record->setAlignment(gDataLayout->getABITypeAlignment(voidPtrTy));
+    gIR->usedArray.push_back(record);
+  }
+}
 }
 
 llvm::GlobalVariable *genModuleInfo(Module *m) {
@@ -313,5 +495,11 @@ llvm::GlobalVariable *genModuleInfo(Module *m) {
   LLGlobalVariable *moduleInfoSym = getIrModule(m)->moduleInfoSymbol();
   b.finalize(moduleInfoSym->getType()->getPointerElementType(), moduleInfoSym);
   setLinkage({LLGlobalValue::ExternalLinkage, false}, moduleInfoSym);
+  // The ModuleInfos of imported modules may be referenced from other shared
+  // libraries, even with -fvisibility=hidden.
+  moduleInfoSym->setVisibility(LLGlobalValue::DefaultVisibility);
+
+  emitUnittestRecords(m, moduleInfoSym);
+
   return moduleInfoSym;
 }
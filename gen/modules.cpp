@@ -22,8 +22,12 @@
 #include "statement.h"
 #include "target.h"
 #include "template.h"
+#include "driver/cl_options.h"
+#include "driver/timetrace.h"
 #include "gen/abi.h"
 #include "gen/arrays.h"
+#include "gen/coverage.h"
+#include "gen/dynamic-compile.h"
 #include "gen/functions.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
@@ -31,6 +35,8 @@
 #include "gen/logger.h"
 #include "gen/moduleinfo.h"
 #include "gen/optimizer.h"
+#include "gen/pgo.h"
+#include "gen/profilegc.h"
 #include "gen/programs.h"
 #include "gen/runtime.h"
 #include "gen/structs.h"
@@ -504,7 +510,199 @@ void build_llvm_used_array(IRState *p) {
   llvmUsed->setSection("llvm.metadata");
 }
 
+/// With -fno-plt, calls to functions defined in other shared libraries load
+/// the function address from the GOT instead of going through the PLT.
+void addNonLazyBindAttributes(llvm::Module &module) {
+  for (auto &func : module) {
+    if (func.isDeclaration() && !func.isIntrinsic() &&
+        !func.hasHiddenVisibility()) {
+      func.addFnAttr(llvm::Attribute::NonLazyBind);
+    }
+  }
+}
+
+/// Objects compiled with different -fd-abi-version values can't call each
+/// other's extern(D) functions. On x86-64 ELF, every object defines the strong
+/// symbol __ldc_dabi in a COMDAT group named after the ABI version: the linker
+/// keeps a single group per version, so mixing versions in the same link
+/// fails with a multiple definition of __ldc_dabi. Mismatches across shared
+/// library boundaries and on other object formats go undetected.
+void emitDABIVersionMarker(IRState *irs) {
+  const auto &triple = *global.params.targetTriple;
+  if (triple.getArch() != llvm::Triple::x86_64 || !triple.isOSBinFormatELF()) {
+    return;
+  }
+
+  const char *const name = "__ldc_dabi";
+  if (irs->module.getNamedValue(name)) {
+    return;
+  }
+  LLType *const i8Ty = LLType::getInt8Ty(irs->context());
+  auto marker = new llvm::GlobalVariable(
+      irs->module, i8Ty, true, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantInt::get(i8Ty, opts::dABIVersion), name);
+  marker->setComdat(irs->module.getOrInsertComdat(
+      ("__ldc_dabi_v" + llvm::Twine(opts::dABIVersion.getValue())).str()));
+  irs->usedArray.push_back(marker);
+}
+
 // Add module-private variables and functions for coverage analysis.
+// With -cov-increment=thread-local, the line counts are incremented in a
+// thread-local copy of _d_cover_data, which is added to the shared counters
+// by a static destructor when the thread terminates. The main thread's static
+// destructors run before the shared ones writing the coverage report.
+void addThreadLocalCoverageCounters(Module *m) {
+  LLType *const counterTy = LLType::getInt32Ty(gIR->context());
+  LLArrayType *type = LLArrayType::get(counterTy, m->numlines);
+
+  // static uint[# source lines] _d_cover_data_tls
+  IF_LOG Logger::println("Build thread-local variable: uint[%d] "
+                         "_d_cover_data_tls",
+                         m->numlines);
+  m->d_cover_data_tls = getOrCreateGlobal(
+      Loc(), gIR->module, type, false, LLGlobalValue::InternalLinkage,
+      llvm::ConstantAggregateZero::get(type), "_d_cover_data_tls", true);
+
+  // Create "static destructor" that adds the thread's counts to _d_cover_data
+  std::string dtorname = "_D";
+  dtorname += mangle(m);
+  dtorname += "17_coveragemergeTLSFZv";
+
+  IF_LOG Logger::println("Build Coverage Analysis destructor: %s",
+                         dtorname.c_str());
+
+  LLFunctionType *dtorTy = LLFunctionType::get(
+      LLType::getVoidTy(gIR->context()), std::vector<LLType *>(), false);
+  LLFunction *dtor = LLFunction::Create(
+      dtorTy, LLGlobalValue::InternalLinkage, dtorname, &gIR->module);
+  dtor->setCallingConv(gABI->callingConv(dtor->getFunctionType(), LINKd));
+  dtor->addFnAttr(LLAttribute::NoUnwind);
+  if (global.params.targetTriple->getArch() == llvm::Triple::x86_64) {
+    dtor->addFnAttr(LLAttribute::UWTable);
+  }
+
+  llvm::BasicBlock *entrybb =
+      llvm::BasicBlock::Create(gIR->context(), "", dtor);
+  llvm::BasicBlock *loopbb =
+      llvm::BasicBlock::Create(gIR->context(), "merge.loop", dtor);
+  llvm::BasicBlock *addbb =
+      llvm::BasicBlock::Create(gIR->context(), "merge.add", dtor);
+  llvm::BasicBlock *nextbb =
+      llvm::BasicBlock::Create(gIR->context(), "merge.next", dtor);
+  llvm::BasicBlock *endbb =
+      llvm::BasicBlock::Create(gIR->context(), "merge.end", dtor);
+  IRBuilder<> builder(entrybb);
+  builder.CreateBr(loopbb);
+
+  // Only touch the shared counters of the lines executed by this thread.
+  builder.SetInsertPoint(loopbb);
+  llvm::PHINode *index = builder.CreatePHI(counterTy, 2, "i");
+  index->addIncoming(DtoConstUint(0), entrybb);
+  LLValue *idxs[] = {DtoConstUint(0), index};
+  LLValue *count = builder.CreateLoad(builder.CreateInBoundsGEP(
+#if LDC_LLVM_VER >= 307
+      type,
+#endif
+      m->d_cover_data_tls, idxs));
+  builder.CreateCondBr(builder.CreateICmpEQ(count, DtoConstUint(0)), nextbb,
+                       addbb);
+
+  builder.SetInsertPoint(addbb);
+  builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                          builder.CreateInBoundsGEP(
+#if LDC_LLVM_VER >= 307
+                              type,
+#endif
+                              m->d_cover_data, idxs),
+                          count,
+#if LDC_LLVM_VER >= 309
+                          llvm::AtomicOrdering::Monotonic
+#else
+                          llvm::Monotonic
+#endif
+                          );
+  builder.CreateBr(nextbb);
+
+  builder.SetInsertPoint(nextbb);
+  LLValue *nextIndex = builder.CreateAdd(index, DtoConstUint(1));
+  index->addIncoming(nextIndex, nextbb);
+  builder.CreateCondBr(
+      builder.CreateICmpULT(nextIndex, DtoConstUint(m->numlines)), loopbb,
+      endbb);
+
+  builder.SetInsertPoint(endbb);
+  builder.CreateRetVoid();
+
+  // Add the dtor to the module's (thread-local) static dtors list.
+  IF_LOG Logger::println("Add %s to module's static destructor list",
+                         dtorname.c_str());
+  FuncDeclaration *fd =
+      FuncDeclaration::genCfunc(nullptr, Type::tvoid, dtorname.c_str());
+  fd->linkage = LINKd;
+  IrFunction *irfunc = getIrFunc(fd, true);
+  irfunc->func = dtor;
+  getIrModule(m)->dtors.push_back(fd);
+}
+
+// Emits a shared static constructor registering the module's coverage data
+// with druntime, which writes the .lst listing when the program exits.
+void registerCoverageWithDruntime(Module *m, LLValue *d_cover_valid_slice,
+                                  LLValue *d_cover_data_slice) {
+  // Create "static constructor" that calls _d_cover_register2(string filename,
+  // size_t[] valid, uint[] data, ubyte minPercent)
+  // Build ctor name
+  LLFunction *ctor = nullptr;
+  std::string ctorname = "_D";
+  ctorname += mangle(m);
+  ctorname += "12_coverageanalysisCtor1FZv";
+  {
+    IF_LOG Logger::println("Build Coverage Analysis constructor: %s",
+                           ctorname.c_str());
+
+    LLFunctionType *ctorTy = LLFunctionType::get(
+        LLType::getVoidTy(gIR->context()), std::vector<LLType *>(), false);
+    ctor = LLFunction::Create(ctorTy, LLGlobalValue::InternalLinkage, ctorname,
+                              &gIR->module);
+    ctor->setCallingConv(gABI->callingConv(ctor->getFunctionType(), LINKd));
+    // Set function attributes. See functions.cpp:DtoDefineFunction()
+    if (global.params.targetTriple->getArch() == llvm::Triple::x86_64) {
+      ctor->addFnAttr(LLAttribute::UWTable);
+    }
+
+    llvm::BasicBlock *bb = llvm::BasicBlock::Create(gIR->context(), "", ctor);
+    IRBuilder<> builder(bb);
+
+    // Set up call to _d_cover_register2
+    llvm::Function *fn =
+        getRuntimeFunction(Loc(), gIR->module, "_d_cover_register2");
+    LLValue *args[] = {
+        DtoConstString(remapFilePrefix(m->srcfile->name->toChars())),
+        d_cover_valid_slice, d_cover_data_slice,
+        DtoConstUbyte(global.params.covPercent)};
+    // Check if argument types are correct
+    for (unsigned i = 0; i < 4; ++i) {
+      assert(args[i]->getType() == fn->getFunctionType()->getParamType(i));
+    }
+
+    builder.CreateCall(fn, args);
+
+    builder.CreateRetVoid();
+  }
+
+  // Add the ctor to the module's static ctors list. TODO: This is quite the
+  // hack.
+  {
+    IF_LOG Logger::println("Add %s to module's shared static constructor list",
+                           ctorname.c_str());
+    FuncDeclaration *fd =
+        FuncDeclaration::genCfunc(nullptr, Type::tvoid, ctorname.c_str());
+    fd->linkage = LINKd;
+    IrFunction *irfunc = getIrFunc(fd, true);
+    irfunc->func = ctor;
+    getIrModule(m)->sharedCtors.push_back(fd);
+  }
+}
+
 void addCoverageAnalysis(Module *m) {
   IF_LOG {
     Logger::println("Adding coverage analysis for module %s (%d lines)",
@@ -573,57 +771,15 @@ void addCoverageAnalysis(Module *m) {
                           m->d_cover_data, idxs, true));
   }
 
-  // Create "static constructor" that calls _d_cover_register2(string filename,
-  // size_t[] valid, uint[] data, ubyte minPercent)
-  // Build ctor name
-  LLFunction *ctor = nullptr;
-  std::string ctorname = "_D";
-  ctorname += mangle(m);
-  ctorname += "12_coverageanalysisCtor1FZv";
-  {
-    IF_LOG Logger::println("Build Coverage Analysis constructor: %s",
-                           ctorname.c_str());
-
-    LLFunctionType *ctorTy = LLFunctionType::get(
-        LLType::getVoidTy(gIR->context()), std::vector<LLType *>(), false);
-    ctor = LLFunction::Create(ctorTy, LLGlobalValue::InternalLinkage, ctorname,
-                              &gIR->module);
-    ctor->setCallingConv(gABI->callingConv(ctor->getFunctionType(), LINKd));
-    // Set function attributes. See functions.cpp:DtoDefineFunction()
-    if (global.params.targetTriple->getArch() == llvm::Triple::x86_64) {
-      ctor->addFnAttr(LLAttribute::UWTable);
-    }
-
-    llvm::BasicBlock *bb = llvm::BasicBlock::Create(gIR->context(), "", ctor);
-    IRBuilder<> builder(bb);
-
-    // Set up call to _d_cover_register2
-    llvm::Function *fn =
-        getRuntimeFunction(Loc(), gIR->module, "_d_cover_register2");
-    LLValue *args[] = {DtoConstString(m->srcfile->name->toChars()),
-                       d_cover_valid_slice, d_cover_data_slice,
-                       DtoConstUbyte(global.params.covPercent)};
-    // Check if argument types are correct
-    for (unsigned i = 0; i < 4; ++i) {
-      assert(args[i]->getType() == fn->getFunctionType()->getParamType(i));
-    }
-
-    builder.CreateCall(fn, args);
-
-    builder.CreateRetVoid();
+  if (opts::coverageFormat == opts::CoverageFormat_raw) {
+    registerRawCoverageData(m);
+  } else {
+    registerCoverageWithDruntime(m, d_cover_valid_slice, d_cover_data_slice);
   }
 
-  // Add the ctor to the module's static ctors list. TODO: This is quite the
-  // hack.
-  {
-    IF_LOG Logger::println("Add %s to module's shared static constructor list",
-                           ctorname.c_str());
-    FuncDeclaration *fd =
-        FuncDeclaration::genCfunc(nullptr, Type::tvoid, ctorname.c_str());
-    fd->linkage = LINKd;
-    IrFunction *irfunc = getIrFunc(fd, true);
-    irfunc->func = ctor;
-    getIrModule(m)->sharedCtors.push_back(fd);
+  if (opts::coverageIncrement == opts::CoverageIncrement_tls &&
+      m->numlines > 0) {
+    addThreadLocalCoverageCounters(m);
   }
 
   IF_LOG Logger::undent();
@@ -649,8 +805,9 @@ void addCoverageAnalysisInitializer(Module *m) {
 void loadInstrProfileData(IRState *irs) {
 #if LDC_WITH_PGO
   // Only load from datafileInstrProf if we are not generating instrumented
-  // code.
-  if (!global.params.genInstrProf && global.params.datafileInstrProf) {
+  // code. IR-level profiles are applied by the optimizer.
+  if (!global.params.genInstrProf && global.params.datafileInstrProf &&
+      !opts::instrProfIRLevel) {
     IF_LOG Logger::println("Read profile data from %s",
                            global.params.datafileInstrProf);
 
@@ -675,6 +832,7 @@ void loadInstrProfileData(IRState *irs) {
     }
 #endif
     irs->PGOReader = std::move(readerOrErr.get());
+    irs->PGOEntryCounts.reset();
 
 #if LDC_LLVM_VER >= 309
     if (!irs->module.getProfileSummary()) {
@@ -717,7 +875,7 @@ void codegenModule(IRState *irs, Module *m) {
   assert(!gIR && "gIR not null, codegen already in progress?!");
   gIR = irs;
 
-  initRuntime();
+  TimeTraceScope timeTraceScope("Generate IR", m->toChars());
 
   // Skip pseudo-modules for coverage analysis
   std::string name = m->toChars();
@@ -734,6 +892,13 @@ void codegenModule(IRState *irs, Module *m) {
   for (unsigned k = 0; k < m->members->dim; k++) {
     Dsymbol *dsym = (*m->members)[k];
     assert(dsym);
+    // The TypeInfos added to the members by semantic analysis are only
+    // emitted once they are referenced (see DtoTypeInfoOf()). Every object
+    // file referencing a TypeInfo defines its own copy anyway, with
+    // TYPEINFO_LINKAGE_TYPE and a COMDAT (see RTTIBuilder::finalize()).
+    if (dsym->isTypeInfoDeclaration()) {
+      continue;
+    }
     Declaration_codegen(dsym);
   }
 
@@ -741,6 +906,20 @@ void codegenModule(IRState *irs, Module *m) {
     fatal();
   }
 
+  if (m->d_cover_valid) {
+    mergeCoverageCounters(m);
+  }
+
+  registerGCAllocationSites(m);
+
+  generateDynamicCompiledCode(irs);
+
+  if (irs->getPGOReader()) {
+    reportProfileDataMatching(m->toChars());
+  }
+
+  emitDABIVersionMarker(irs);
+
   // Skip emission of all the additional module metadata if requested by the
   // user.
   if (!m->noModuleInfo) {
@@ -754,6 +933,10 @@ void codegenModule(IRState *irs, Module *m) {
     addCoverageAnalysisInitializer(m);
   }
 
+  if (opts::noPLT) {
+    addNonLazyBindAttributes(irs->module);
+  }
+
   gIR = nullptr;
   irs->dmodule = nullptr;
 }
@@ -0,0 +1,226 @@
+//===-- moves.cpp ---------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/moves.h"
+
+#include "aggregate.h"
+#include "declaration.h"
+#include "expression.h"
+#include "mtype.h"
+#include "statement.h"
+#include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "gen/recursivevisitor.h"
+#include "llvm/Support/CommandLine.h"
+
+static llvm::cl::opt<bool> disableMoveOnLastUse(
+    "disable-move-on-last-use", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("Always call the postblit when copying a struct from a "
+                   "local variable, even if the copy is its last use"));
+
+namespace {
+
+/// Returns the variable `v` if `e` is a copy `(dst = v).__postblit()`.
+VarDeclaration *getCopiedVariable(CallExp *e) {
+  if (e->e1->op != TOKdotvar)
+    return nullptr;
+  auto dve = static_cast<DotVarExp *>(e->e1);
+  if (dve->e1->op != TOKblit)
+    return nullptr;
+  auto blit = static_cast<BlitExp *>(dve->e1);
+  Type *t = blit->e2->type->toBasetype();
+  if (t->ty != Tstruct || blit->e2->op != TOKvar)
+    return nullptr;
+  StructDeclaration *sd = static_cast<TypeStruct *>(t)->sym;
+  if (!sd->postblit || dve->var != sd->postblit)
+    return nullptr;
+
+  VarDeclaration *vd = static_cast<VarExp *>(blit->e2)->var->isVarDeclaration();
+  // `v = v`
+  if (vd && blit->e1->op == TOKvar &&
+      static_cast<VarExp *>(blit->e1)->var == vd) {
+    return nullptr;
+  }
+  return vd;
+}
+
+/// Counts the reads of the variables of a function body and remembers their
+/// copies, along with the innermost loop around their declaration and copy.
+class LastUseAnalysis : public RecursiveVisitor {
+public:
+  struct VarInfo {
+    unsigned numUses = 0;
+    bool declared = false;
+    Statement *declLoop = nullptr;
+    CallExp *copy = nullptr;
+    Statement *copyLoop = nullptr;
+  };
+
+  llvm::DenseMap<VarDeclaration *, VarInfo> vars;
+  /// Set if the body contains gotos or inline assembly, whose effects on the
+  /// control flow and the variables aren't tracked.
+  bool unstructured = false;
+
+  using RecursiveVisitor::visit;
+
+  // Statements
+
+  void visit(WhileStatement *stmt) override {
+    inLoop(stmt, [&] {
+      recurse(stmt->condition);
+      recurse(stmt->_body);
+    });
+  }
+
+  void visit(DoStatement *stmt) override {
+    inLoop(stmt, [&] {
+      recurse(stmt->_body);
+      recurse(stmt->condition);
+    });
+  }
+
+  void visit(ForStatement *stmt) override {
+    recurse(stmt->_init);
+    inLoop(stmt, [&] {
+      recurse(stmt->condition);
+      recurse(stmt->_body);
+      recurse(stmt->increment);
+    });
+  }
+
+  void visit(ForeachStatement *stmt) override {
+    recurse(stmt->aggr);
+    inLoop(stmt, [&] { recurse(stmt->_body); });
+  }
+
+  void visit(ForeachRangeStatement *stmt) override {
+    recurse(stmt->lwr);
+    recurse(stmt->upr);
+    inLoop(stmt, [&] { recurse(stmt->_body); });
+  }
+
+  void visit(UnrolledLoopStatement *stmt) override {
+    inLoop(stmt, [&] { recurse(stmt->statements); });
+  }
+
+  // The case statements are part of the body already.
+  void visit(SwitchStatement *stmt) override {
+    recurse(stmt->condition);
+    recurse(stmt->_body);
+  }
+
+  void visit(ThrowStatement *stmt) override { recurse(stmt->exp); }
+
+  void visit(DebugStatement *stmt) override { recurse(stmt->statement); }
+
+  // Destroying a variable doesn't read it.
+  void visit(DtorExpStatement *stmt) override {}
+
+  void visit(GotoStatement *stmt) override { unstructured = true; }
+  void visit(GotoCaseStatement *stmt) override { unstructured = true; }
+  void visit(GotoDefaultStatement *stmt) override { unstructured = true; }
+  void visit(AsmStatement *stmt) override { unstructured = true; }
+
+  // Declarations
+
+  void visit(VarDeclaration *decl) override {
+    auto &info = vars[decl];
+    info.declared = true;
+    info.declLoop = loop;
+    recurse(decl->_init);
+  }
+
+  // Expressions
+
+  void visit(VarExp *e) override { use(e->var); }
+
+  void visit(SymOffExp *e) override { use(e->var); }
+
+  void visit(AssignExp *e) override {
+    // (Re)initializing a variable doesn't read it.
+    if ((e->op == TOKconstruct || e->op == TOKblit) && e->e1->op == TOKvar) {
+      recurse(e->e2);
+      return;
+    }
+    visit(static_cast<BinExp *>(e));
+  }
+
+  void visit(CallExp *e) override {
+    if (VarDeclaration *vd = getCopiedVariable(e)) {
+      auto &info = vars[vd];
+      info.copy = e;
+      info.copyLoop = loop;
+    }
+    RecursiveVisitor::visit(e);
+  }
+
+private:
+  Statement *loop = nullptr;
+
+  template <typename F> void inLoop(Statement *stmt, F visitLoop) {
+    Statement *outer = loop;
+    loop = stmt;
+    visitLoop();
+    loop = outer;
+  }
+
+  void use(Declaration *decl) {
+    if (VarDeclaration *vd = decl->isVarDeclaration())
+      ++vars[vd].numUses;
+  }
+};
+
+/// Returns whether the copy of `vd` can be a move, given the analysis of the
+/// body of `fd`.
+bool isMovable(FuncDeclaration *fd, VarDeclaration *vd,
+               const LastUseAnalysis::VarInfo &info) {
+  // The copy must be the only read, executed at most once per lifetime of
+  // the variable.
+  if (info.numUses != 1 || !info.copy || info.copyLoop != info.declLoop)
+    return false;
+  if (!info.declared && !vd->isParameter())
+    return false;
+
+  // Only plain locals owned by this function qualify.
+  if (vd->toParent2() != fd || vd->isDataseg() || vd->nestedrefs.dim ||
+      (vd->storage_class & (STCref | STCout | STClazy | STCresult)) ||
+      (fd->nrvo_can && fd->nrvo_var == vd)) {
+    return false;
+  }
+
+  // Nested structs can't be reset to their init value for their destructor.
+  auto sd = static_cast<TypeStruct *>(vd->type->toBasetype())->sym;
+  return !(sd->dtor && sd->isNested());
+}
+}
+
+VarDeclaration *LastUseCopies::getMovedVariable(CallExp *e) {
+  if (!isOptimizationEnabled() || disableMoveOnLastUse)
+    return nullptr;
+
+  if (!analyzed) {
+    analyzed = true;
+
+    LastUseAnalysis analysis;
+    if (fd->fbody)
+      fd->fbody->accept(&analysis);
+    if (!analysis.unstructured) {
+      for (const auto &entry : analysis.vars) {
+        if (isMovable(fd, entry.first, entry.second)) {
+          IF_LOG Logger::println("Copy of %s is its last use",
+                                 entry.first->toChars());
+          moves[entry.second.copy] = entry.first;
+        }
+      }
+    }
+  }
+
+  auto it = moves.find(e);
+  return it == moves.end() ? nullptr : it->second;
+}
@@ -0,0 +1,45 @@
+//===-- gen/moves.h - Struct moves on last use ------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Finds the copies of struct locals with a postblit which are the last use of
+// the local, so that they can be emitted as moves instead.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_MOVES_H
+#define LDC_GEN_MOVES_H
+
+#include "llvm/ADT/DenseMap.h"
+
+class CallExp;
+class FuncDeclaration;
+class VarDeclaration;
+
+/// The frontend lowers copies of struct lvalues with a postblit to
+/// `(dst = v).__postblit()`, both for assignments/initializations and for the
+/// temporaries of by-value arguments. If the local `v` is never read again,
+/// the copy can be emitted as a move instead: a blit, followed by resetting
+/// `v` to its init value (if it has a destructor), so that neither the
+/// postblit nor the destructor of `v` have any effect.
+class LastUseCopies {
+public:
+  explicit LastUseCopies(FuncDeclaration *fd) : fd(fd) {}
+
+  /// Returns the local moved from if `e` is such a copy on the last use of the
+  /// local, null otherwise.
+  VarDeclaration *getMovedVariable(CallExp *e);
+
+private:
+  FuncDeclaration *fd;
+  /// The function body is analyzed on the first query.
+  bool analyzed = false;
+  llvm::DenseMap<CallExp *, VarDeclaration *> moves;
+};
+
+#endif
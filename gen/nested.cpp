@@ -19,6 +19,7 @@
 #include "ir/irfunction.h"
 #include "ir/irtypeaggr.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include <algorithm>
 
 static unsigned getVthisIdx(AggregateDeclaration *ad) {
   return getFieldGEPIndex(ad, ad->vthis);
@@ -374,30 +375,48 @@ static void DtoCreateNestedContextType(FuncDeclaration *fd) {
   }
 
   // Add the direct nested variables of this function, and update their
-  // indices to match.
-  // TODO: optimize ordering for minimal space usage?
+  // indices to match. The variables are laid out by decreasing alignment to
+  // minimize the padding between them.
+  struct NestedVar {
+    VarDeclaration *vd;
+    LLType *type;
+    unsigned alignment;
+  };
+  std::vector<NestedVar> nestedVars;
+  nestedVars.reserve(fd->closureVars.dim);
   for (auto vd : fd->closureVars) {
-    unsigned alignment = DtoAlignment(vd);
-    if (alignment > 1) {
-      builder.alignCurrentOffset(alignment);
-    }
-
-    IrLocal &irLocal = *getIrLocal(vd, true);
-    irLocal.nestedIndex = builder.currentFieldIndex();
-    irLocal.nestedDepth = depth;
-
     LLType *t = nullptr;
-    if (vd->isRef() || vd->isOut())
+    unsigned alignment = 0;
+    if (vd->isRef() || vd->isOut()) {
       t = DtoType(vd->type->pointerTo());
-    else if (vd->isParameter() && (vd->storage_class & STClazy))
+      alignment = getABITypeAlign(t);
+    } else if (vd->isParameter() && (vd->storage_class & STClazy)) {
       t = getIrParameter(vd)->value->getType()->getContainedType(0);
-    else
+      alignment = getABITypeAlign(t);
+    } else {
       t = DtoMemType(vd->type);
+      alignment = DtoAlignment(vd);
+    }
+    nestedVars.push_back({vd, t, alignment});
+  }
+  std::stable_sort(nestedVars.begin(), nestedVars.end(),
+                   [](const NestedVar &a, const NestedVar &b) {
+                     return a.alignment > b.alignment;
+                   });
+
+  for (const auto &var : nestedVars) {
+    if (var.alignment > 1) {
+      builder.alignCurrentOffset(var.alignment);
+    }
+
+    IrLocal &irLocal = *getIrLocal(var.vd, true);
+    irLocal.nestedIndex = builder.currentFieldIndex();
+    irLocal.nestedDepth = depth;
 
-    builder.addType(t, getTypeAllocSize(t));
+    builder.addType(var.type, getTypeAllocSize(var.type));
 
-    IF_LOG Logger::cout() << "Nested var '" << vd->toChars() << "' of type "
-                          << *t << "\n";
+    IF_LOG Logger::cout() << "Nested var '" << var.vd->toChars()
+                          << "' of type " << *var.type << "\n";
   }
 
   LLStructType *frameType =
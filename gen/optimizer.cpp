@@ -9,6 +9,8 @@
 
 #include "gen/optimizer.h"
 #include "errors.h"
+#include "driver/cl_options.h"
+#include "driver/timetrace.h"
 #include "gen/cl_helpers.h"
 #include "gen/logger.h"
 #include "gen/passes/Passes.h"
@@ -32,12 +34,20 @@
 #endif
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/IR/LegacyPassNameParser.h"
 #include "llvm/Transforms/Instrumentation.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#endif
 
-extern llvm::TargetMachine *gTargetMachine;
 using namespace llvm;
 
 static cl::opt<signed char> optimizeLevel(
@@ -83,6 +93,38 @@ static cl::opt<bool> disableGCToStack(
     cl::desc("Disable promotion of GC allocations to stack memory"),
     cl::ZeroOrMore);
 
+static cl::opt<bool> disableDelegateSpecialization(
+    "disable-dg-specialization",
+    cl::desc("Disable the specialization of functions (e.g., opApply) for "
+             "the delegate literals passed to them"),
+    cl::ZeroOrMore);
+
+static cl::opt<bool> disableNothrowInference(
+    "disable-nounwind-inference",
+    cl::desc("Disable the inference of nounwind for functions with the new "
+             "pass manager (the legacy pipeline uses PruneEH)"),
+    cl::ZeroOrMore);
+
+static cl::opt<bool> disableBoundsCheckElim(
+    "disable-bounds-check-elim",
+    cl::desc("Disable the elimination and hoisting of array bounds checks"),
+    cl::ZeroOrMore);
+
+#if LDC_LLVM_VER >= 309
+static cl::opt<bool> disableDAliasAnalysis(
+    "disable-d-alias-analysis",
+    cl::desc("Disable the D-specific alias analysis (using immutable)"),
+    cl::ZeroOrMore);
+#endif
+
+#if LDC_LLVM_VER >= 400
+static cl::opt<bool> useNewPassManager(
+    "new-pass-manager",
+    cl::desc("Optimize using the (experimental) new LLVM pass manager and its "
+             "default pipeline"),
+    cl::ZeroOrMore);
+#endif
+
 static cl::opt<cl::boolOrDefault, false, opts::FlagParser<cl::boolOrDefault>>
     enableInlining(
         "inlining",
@@ -152,6 +194,11 @@ bool willCrossModuleInline() {
 
 bool isOptimizationEnabled() { return optimizeLevel != 0; }
 
+bool willUseTypeMetadata() {
+  return isOptimizationEnabled() && !disableLangSpecificPasses &&
+         (!disableGCToStack || !disableSimplifyDruntimeCalls);
+}
+
 llvm::CodeGenOpt::Level codeGenOptLevel() {
   // Use same appoach as clang (see lib/CodeGen/BackendUtil.cpp)
   if (optLevel() == 0) {
@@ -193,6 +240,20 @@ static void addGarbageCollect2StackPass(const PassManagerBuilder &builder,
   }
 }
 
+static void addDelegateSpecializationPass(const PassManagerBuilder &builder,
+                                          PassManagerBase &pm) {
+  if (builder.OptLevel >= 2 && builder.SizeLevel == 0) {
+    addPass(pm, createDelegateSpecializationPass());
+  }
+}
+
+static void addBoundsCheckEliminationPass(const PassManagerBuilder &builder,
+                                          PassManagerBase &pm) {
+  // Versioning loops trades code size for speed.
+  addPass(pm, createBoundsCheckElimination(builder.OptLevel >= 2 &&
+                                           builder.SizeLevel == 0));
+}
+
 static void addAddressSanitizerPasses(const PassManagerBuilder &Builder,
                                       PassManagerBase &PM) {
   PM.add(createAddressSanitizerFunctionPass());
@@ -221,6 +282,28 @@ static void addThreadSanitizerPass(const PassManagerBuilder &Builder,
   PM.add(createThreadSanitizerPass());
 }
 
+static void addAddDiscriminatorsPass(const PassManagerBuilder &Builder,
+                                     PassManagerBase &PM) {
+  PM.add(createAddDiscriminatorsPass());
+}
+
+#if LDC_WITH_PGO && LDC_LLVM_VER >= 309
+/// Inlines the small functions before the IR-level profiling instrumentation
+/// (or profile annotation), so that their profiles are specific to the call
+/// sites. Mirrors the preinliner of clang's IR-level PGO.
+static void addPGOPreinlinePasses(legacy::PassManagerBase &mpm) {
+  if (optLevel() == 0 || !willInline()) {
+    return;
+  }
+  mpm.add(createFunctionInliningPass(75));
+  mpm.add(createSROAPass());
+  mpm.add(createEarlyCSEPass());
+  mpm.add(createCFGSimplificationPass());
+  mpm.add(createInstructionCombiningPass());
+  mpm.add(createGlobalDCEPass());
+}
+#endif
+
 static void addInstrProfilingPass(legacy::PassManagerBase &mpm) {
 #if LDC_WITH_PGO
   if (global.params.genInstrProf) {
@@ -229,11 +312,22 @@ static void addInstrProfilingPass(legacy::PassManagerBase &mpm) {
     if (global.params.datafileInstrProf)
       options.InstrProfileOutput = global.params.datafileInstrProf;
 #if LDC_LLVM_VER >= 309
+    if (opts::instrProfIRLevel) {
+      addPGOPreinlinePasses(mpm);
+      mpm.add(createPGOInstrumentationGenLegacyPass());
+    }
     mpm.add(createInstrProfilingLegacyPass(options));
 #else
     mpm.add(createInstrProfilingPass(options));
 #endif
   }
+#if LDC_LLVM_VER >= 309
+  else if (opts::instrProfIRLevel && global.params.datafileInstrProf) {
+    addPGOPreinlinePasses(mpm);
+    mpm.add(
+        createPGOInstrumentationUseLegacyPass(global.params.datafileInstrProf));
+  }
+#endif
 #endif
 }
 
@@ -260,6 +354,13 @@ static void addOptimizationPasses(PassManagerBase &mpm,
   builder.OptLevel = optLevel;
   builder.SizeLevel = sizeLevel;
 
+#if LDC_LLVM_VER >= 309
+  if (optLevel > 0 && !disableLangSpecificPasses && !disableDAliasAnalysis) {
+    mpm.add(createDAliasAnalysisPass());
+    fpm.add(createDAliasAnalysisPass());
+  }
+#endif
+
   if (willInline()) {
     unsigned threshold = 225;
     if (sizeLevel == 1) { // -Os
@@ -278,6 +379,11 @@ static void addOptimizationPasses(PassManagerBase &mpm,
     builder.Inliner = createAlwaysInlinerPass();
 #endif
   }
+#if LDC_LLVM_VER >= 309
+  // Keep the module summary-friendly structure for the ThinLTO backends.
+  builder.PrepareForThinLTO = opts::isUsingThinLTO();
+#endif
+
   builder.DisableUnitAtATime = !unitAtATime;
   builder.DisableUnrollLoops = optLevel == 0;
 
@@ -328,22 +434,158 @@ static void addOptimizationPasses(PassManagerBase &mpm,
       builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
                            addGarbageCollect2StackPass);
     }
+
+    if (!disableBoundsCheckElim) {
+      builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                           addBoundsCheckEliminationPass);
+    }
+
+    // Before the inliner, which is then able to inline the delegate calls.
+    if (!disableDelegateSpecialization) {
+      builder.addExtension(PassManagerBuilder::EP_ModuleOptimizerEarly,
+                           addDelegateSpecializationPass);
+    }
   }
 
   // EP_OptimizerLast does not exist in LLVM 3.0, add it manually below.
   builder.addExtension(PassManagerBuilder::EP_OptimizerLast,
                        addStripExternalsPass);
 
+  // Distinguish the basic blocks of a line in the debug line info, e.g. for
+  // the sample profiles gathered from a build.
+  if (global.params.symdebug) {
+    builder.addExtension(PassManagerBuilder::EP_EarlyAsPossible,
+                         addAddDiscriminatorsPass);
+  }
+
   addInstrProfilingPass(mpm);
 
+  // The function pass manager (with the discriminators) is run before the
+  // module pass manager.
+  if (optLevel > 0 && !opts::usefileSampleProf.empty()) {
+    mpm.add(createSampleProfileLoaderPass(opts::usefileSampleProf));
+  }
+
   builder.populateFunctionPassManager(fpm);
   builder.populateModulePassManager(mpm);
 }
 
+#if LDC_LLVM_VER >= 400
+/// Optimizes the module using the new pass manager, sharing the analyses
+/// across the whole pipeline. Returns false if options not supported by it
+/// (yet) are in effect, leaving the optimization to the legacy pass manager.
+static bool runNewPassManagerPipeline(llvm::Module *M,
+                                      TargetMachine &targetMachine) {
+  // There are no new pass manager versions of the sanitizer and profiling
+  // instrumentation passes yet, its default pipeline always inlines and
+  // doesn't load sample profiles.
+  const unsigned level = optLevel();
+  if (!useNewPassManager || level == 0 || !willInline() ||
+      opts::sanitize != opts::None || global.params.genInstrProf ||
+#if LDC_WITH_PGO
+      (opts::instrProfIRLevel && global.params.datafileInstrProf) ||
+#endif
+      !opts::usefileSampleProf.empty()) {
+    return false;
+  }
+
+  Logger::println("Optimizing with the new pass manager");
+
+  TargetLibraryInfoImpl tlii(Triple(M->getTargetTriple()));
+  if (disableSimplifyLibCalls) {
+    tlii.disableAllFunctions();
+  }
+
+  PassBuilder pb(&targetMachine);
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+
+  // These must be registered before the default analyses.
+  AAManager aa = pb.buildDefaultAAPipeline();
+  if (!disableLangSpecificPasses && !disableDAliasAnalysis) {
+    registerDAliasAnalysis(fam, aa);
+  }
+  fam.registerPass([&] { return std::move(aa); });
+  fam.registerPass([&] { return TargetLibraryAnalysis(tlii); });
+
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  PassBuilder::OptimizationLevel pbLevel = PassBuilder::O3;
+  if (sizeLevel() == 1) {
+    pbLevel = PassBuilder::Os;
+  } else if (sizeLevel() == 2) {
+    pbLevel = PassBuilder::Oz;
+  } else if (level == 1) {
+    pbLevel = PassBuilder::O1;
+  } else if (level == 2) {
+    pbLevel = PassBuilder::O2;
+  }
+
+  ModulePassManager mpm;
+  if (stripDebug) {
+    StripDebugInfo(*M);
+  }
+  if (!noVerify) {
+    mpm.addPass(VerifierPass());
+  }
+  const bool speed = level >= 2 && sizeLevel() == 0;
+  if (speed && !disableLangSpecificPasses && !disableDelegateSpecialization) {
+    mpm.addPass(DelegateSpecializationPass());
+  }
+  if (!disableNothrowInference) {
+    mpm.addPass(NothrowInferencePass());
+  }
+  mpm.addPass(pb.buildPerModuleDefaultPipeline(pbLevel));
+
+  // The default pipeline has no extension points yet, so the D-specific
+  // function passes are run after it, followed by a cleanup.
+  if (!disableLangSpecificPasses) {
+    FunctionPassManager fpm;
+    if (speed && !disableSimplifyDruntimeCalls) {
+      fpm.addPass(SimplifyDRuntimeCallsPass());
+    }
+    if (speed && !disableGCToStack) {
+      fpm.addPass(GarbageCollect2StackPass());
+    }
+    if (!disableBoundsCheckElim) {
+      fpm.addPass(BoundsCheckEliminationPass(speed));
+    }
+    fpm.addPass(InstCombinePass());
+    fpm.addPass(SimplifyCFGPass());
+    mpm.addPass(createModuleToFunctionPassAdaptor(std::move(fpm)));
+  }
+
+  mpm.addPass(StripExternalsPass());
+  mpm.addPass(GlobalDCEPass());
+
+  mpm.run(*M, mam);
+
+  if (!noVerify) {
+    verifyModule(M);
+  }
+  return true;
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // This function runs optimization passes based on command line arguments.
 // Returns true if any optimization passes were invoked.
-bool ldc_optimize_module(llvm::Module *M) {
+bool ldc_optimize_module(llvm::Module *M, TargetMachine &targetMachine) {
+  TimeTraceScope timeTraceScope("Optimize",
+                                M->getModuleIdentifier().c_str());
+
+#if LDC_LLVM_VER >= 400
+  if (runNewPassManagerPipeline(M, targetMachine)) {
+    return true;
+  }
+#endif
+
 // Create a PassManager to hold and optimize the collection of
 // per-module passes we are about to build.
 #if LDC_LLVM_VER >= 307
@@ -391,10 +633,10 @@ bool ldc_optimize_module(llvm::Module *M) {
 #if LDC_LLVM_VER >= 307
   // Add internal analysis passes from the target machine.
   mpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+      targetMachine.getTargetIRAnalysis()));
 #else
   // Add internal analysis passes from the target machine.
-  gTargetMachine->addAnalysisPasses(mpm);
+  targetMachine.addAnalysisPasses(mpm);
 #endif
 
 // Also set up a manager for the per-function passes.
@@ -406,13 +648,13 @@ bool ldc_optimize_module(llvm::Module *M) {
 #if LDC_LLVM_VER >= 307
   // Add internal analysis passes from the target machine.
   fpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+      targetMachine.getTargetIRAnalysis()));
 #elif LDC_LLVM_VER >= 306
   fpm.add(new DataLayoutPass());
-  gTargetMachine->addAnalysisPasses(fpm);
+  targetMachine.addAnalysisPasses(fpm);
 #else
                                     fpm.add(new DataLayoutPass(M));
-                                    gTargetMachine->addAnalysisPasses(fpm);
+                                    targetMachine.addAnalysisPasses(fpm);
 #endif
 
   // If the -strip-debug command line option was specified, add it before
@@ -455,6 +697,17 @@ void verifyModule(llvm::Module *m) {
   Logger::println("Verification passed!");
 }
 
+static void hashFileContents(llvm::raw_ostream &hash_os,
+                             llvm::StringRef filename) {
+  if (filename.empty()) {
+    return;
+  }
+  auto buffer = MemoryBuffer::getFile(filename);
+  if (buffer) {
+    hash_os << (*buffer)->getBuffer();
+  }
+}
+
 // Output to `hash_os` all optimization settings that influence object code output
 // and that are not observable in the IR.
 // This is used to calculate the hash use for caching that uniquely identifies
@@ -466,10 +719,29 @@ void outputOptimizationSettings(llvm::raw_ostream &hash_os) {
   hash_os << disableSimplifyDruntimeCalls;
   hash_os << disableSimplifyLibCalls;
   hash_os << disableGCToStack;
+  hash_os << disableBoundsCheckElim;
+  hash_os << disableDelegateSpecialization;
+  hash_os << disableNothrowInference;
+#if LDC_LLVM_VER >= 309
+  hash_os << disableDAliasAnalysis;
+#endif
+#if LDC_LLVM_VER >= 400
+  hash_os << useNewPassManager;
+#endif
   hash_os << unitAtATime;
   hash_os << stripDebug;
   hash_os << opts::sanitize;
   hash_os << disableLoopUnrolling;
   hash_os << disableLoopVectorization;
   hash_os << disableSLPVectorization;
+
+  // The sample and IR-level profiles are only applied by the optimizer, so
+  // their contents aren't part of the IR hash.
+  hashFileContents(hash_os, opts::usefileSampleProf);
+#if LDC_WITH_PGO
+  if (opts::instrProfIRLevel && !global.params.genInstrProf &&
+      global.params.datafileInstrProf) {
+    hashFileContents(hash_os, global.params.datafileInstrProf);
+  }
+#endif
 }
@@ -38,9 +38,12 @@ extern llvm::cl::opt<SanitizerCheck> sanitize;
 
 namespace llvm {
 class Module;
+class TargetMachine;
 }
 
-bool ldc_optimize_module(llvm::Module *m);
+/// Runs the optimization passes selected on the command line on the given
+/// module, using the given target machine for target-specific analyses.
+bool ldc_optimize_module(llvm::Module *m, llvm::TargetMachine &targetMachine);
 
 // Returns whether the normal, full inlining pass will be run.
 bool willInline();
@@ -49,6 +52,10 @@ bool willCrossModuleInline();
 
 bool isOptimizationEnabled();
 
+/// Returns whether the D-specific passes reading the TypeInfo and ClassInfo
+/// metadata (see gen/metadata.h) will be run.
+bool willUseTypeMetadata();
+
 llvm::CodeGenOpt::Level codeGenOptLevel();
 
 void verifyModule(llvm::Module *m);
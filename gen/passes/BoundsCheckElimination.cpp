@@ -0,0 +1,451 @@
+//===-- BoundsCheckElimination.cpp - Remove redundant bounds checks -------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass removes the array bounds checks emitted by DtoIndexBoundsCheck(),
+// i.e. branches on `index < length` to a block calling _d_arraybounds.
+//
+// Checks which scalar evolution proves to always hold are simply folded.
+// For the remaining checks of an innermost loop whose index is an induction
+// variable with unit stride, the range of the index over the whole loop is
+// known before entering it. The loop is then versioned: a single check of all
+// the index ranges against the (loop-invariant) lengths is done in the
+// preheader, selecting either a copy of the loop without these checks or the
+// original loop, which fails at the exact same iteration as before.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "bounds-check-elim"
+
+#include "Passes.h"
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <tuple>
+
+using namespace llvm;
+
+STATISTIC(NumFolded, "Number of bounds checks proven to always succeed");
+STATISTIC(NumHoisted, "Number of bounds checks hoisted out of loops");
+STATISTIC(NumVersioned, "Number of loops versioned");
+
+static cl::opt<unsigned> LoopSizeLimit(
+    "bce-loop-size-limit", cl::init(200), cl::Hidden,
+    cl::desc("Maximum number of instructions of a loop to be versioned for "
+             "hoisting its bounds checks"));
+
+namespace {
+/// A branch emitted by DtoIndexBoundsCheck().
+struct BoundsCheck {
+  BranchInst *Br;
+  Value *Index;
+  Value *Length;
+  /// The successor taken if the index is in bounds.
+  unsigned OkSucc;
+};
+
+/// The runtime condition of a loop version without bounds checks.
+struct LoopVersion {
+  Loop *L;
+  Value *Cond;
+  SmallVector<BoundsCheck, 4> Checks;
+};
+
+/// Returns whether the given block calls _d_arraybounds and doesn't return.
+bool isBoundsFailBlock(BasicBlock *BB) {
+  for (auto &I : *BB) {
+    CallSite CS(&I);
+    if (!CS) {
+      continue;
+    }
+    auto Callee = CS.getCalledFunction();
+    if (Callee && Callee->getName() == "_d_arraybounds") {
+      return isa<UnreachableInst>(BB->getTerminator()) ||
+             BB->getTerminator() == &I;
+    }
+  }
+  return false;
+}
+
+bool matchBoundsCheck(BranchInst *Br, BoundsCheck &Check) {
+  if (!Br->isConditional()) {
+    return false;
+  }
+  auto Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+  if (!Cmp) {
+    return false;
+  }
+
+  unsigned FailSucc;
+  if (isBoundsFailBlock(Br->getSuccessor(1))) {
+    FailSucc = 1;
+  } else if (isBoundsFailBlock(Br->getSuccessor(0))) {
+    FailSucc = 0;
+  } else {
+    return false;
+  }
+
+  // The predicate holding if the index is in bounds (InstCombine may have
+  // swapped the operands and/or the successors).
+  const auto Pred =
+      FailSucc == 1 ? Cmp->getPredicate() : Cmp->getInversePredicate();
+  if (Pred == ICmpInst::ICMP_ULT) {
+    Check.Index = Cmp->getOperand(0);
+    Check.Length = Cmp->getOperand(1);
+  } else if (Pred == ICmpInst::ICMP_UGT) {
+    Check.Index = Cmp->getOperand(1);
+    Check.Length = Cmp->getOperand(0);
+  } else {
+    return false;
+  }
+  Check.Br = Br;
+  Check.OkSucc = 1 - FailSucc;
+  return true;
+}
+
+/// Replaces the bounds check by a branch to the in-bounds successor.
+void foldBoundsCheck(BranchInst *Br, unsigned OkSucc) {
+  BasicBlock *BB = Br->getParent();
+  Br->getSuccessor(1 - OkSucc)->removePredecessor(BB);
+  Value *Cond = Br->getCondition();
+  BranchInst::Create(Br->getSuccessor(OkSucc), Br);
+  Br->eraseFromParent();
+  RecursivelyDeleteTriviallyDeadInstructions(Cond);
+}
+
+/// Returns whether the given loop can be cloned into a version without bounds
+/// checks.
+bool canVersion(Loop *L) {
+  if (!L->empty() || !L->getLoopPreheader() || !L->getLoopLatch() ||
+      !L->isLoopExiting(L->getLoopLatch())) {
+    return false;
+  }
+
+  unsigned Size = 0;
+  for (auto BB : L->getBlocks()) {
+#if LDC_LLVM_VER >= 308
+    if (BB->isEHPad()) {
+#else
+    if (BB->isLandingPad()) {
+#endif
+      return false;
+    }
+
+    for (auto &I : *BB) {
+      if (++Size > LoopSizeLimit) {
+        return false;
+      }
+
+      if (auto CI = dyn_cast<CallInst>(&I)) {
+#if LDC_LLVM_VER >= 308
+        if (CI->cannotDuplicate() || CI->isConvergent()) {
+#else
+        if (CI->cannotDuplicate()) {
+#endif
+          return false;
+        }
+      }
+
+      // Values used outside of the loop must be merged in (LCSSA) PHIs of the
+      // exit blocks, which are then extended by the cloned values.
+      for (auto U : I.users()) {
+        auto UI = cast<Instruction>(U);
+        if (L->contains(UI)) {
+          continue;
+        }
+        auto PN = dyn_cast<PHINode>(UI);
+        if (!PN) {
+          return false;
+        }
+        for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+          if (PN->getIncomingValue(i) == &I &&
+              !L->contains(PN->getIncomingBlock(i))) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/// Clones the loop and branches to the clone without the given bounds checks
+/// if Cond holds at the end of the preheader.
+void versionLoop(const LoopVersion &Version) {
+  Loop *L = Version.L;
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Header = L->getHeader();
+  Function *F = Header->getParent();
+
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock *, 16> Clones;
+  for (auto BB : L->getBlocks()) {
+    auto Clone = CloneBasicBlock(BB, VMap, ".bce", F);
+    VMap[BB] = Clone;
+    Clones.push_back(Clone);
+  }
+  for (auto Clone : Clones) {
+    for (auto &I : *Clone) {
+#if LDC_LLVM_VER >= 309
+      RemapInstruction(&I, VMap,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+#else
+      RemapInstruction(&I, VMap,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+#endif
+    }
+  }
+
+  // The exit blocks are shared by both versions.
+  SmallVector<BasicBlock *, 8> ExitBlocks;
+  L->getUniqueExitBlocks(ExitBlocks);
+  for (auto Exit : ExitBlocks) {
+    for (auto &I : *Exit) {
+      auto PN = dyn_cast<PHINode>(&I);
+      if (!PN) {
+        break;
+      }
+      for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+        BasicBlock *Pred = PN->getIncomingBlock(i);
+        if (!L->contains(Pred)) {
+          continue;
+        }
+        Value *V = PN->getIncomingValue(i);
+        Value *MappedV = VMap.lookup(V);
+        PN->addIncoming(MappedV ? MappedV : V, cast<BasicBlock>(VMap[Pred]));
+      }
+    }
+  }
+
+  for (const auto &Check : Version.Checks) {
+    foldBoundsCheck(cast<BranchInst>(VMap[Check.Br]), Check.OkSucc);
+  }
+
+  auto OldTerm = Preheader->getTerminator();
+  BranchInst::Create(cast<BasicBlock>(VMap[Header]), Header, Version.Cond,
+                     OldTerm);
+  OldTerm->eraseFromParent();
+
+  ++NumVersioned;
+  NumHoisted += Version.Checks.size();
+}
+
+struct LLVM_LIBRARY_VISIBILITY BoundsCheckElimination : public FunctionPass {
+  static char ID; // Pass identification
+  bool AllowVersioning;
+
+  explicit BoundsCheckElimination(bool AllowVersioning = true)
+      : FunctionPass(ID), AllowVersioning(AllowVersioning) {}
+
+  bool runOnFunction(Function &F) override;
+
+  /// Shared by the legacy and the new pass manager.
+  bool eliminate(Function &F, LoopInfo &LI, ScalarEvolution &SE);
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<DominatorTreeWrapperPass>();
+#if LDC_LLVM_VER >= 307
+    AU.addRequired<LoopInfoWrapperPass>();
+#else
+    AU.addRequired<LoopInfo>();
+#endif
+#if LDC_LLVM_VER >= 308
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+#else
+    AU.addRequired<ScalarEvolution>();
+#endif
+  }
+
+private:
+  Value *buildVersionCondition(Loop *L, ArrayRef<BoundsCheck> Checks,
+                               ScalarEvolution &SE, SCEVExpander &Expander);
+};
+}
+
+char BoundsCheckElimination::ID = 0;
+static RegisterPass<BoundsCheckElimination>
+    X("bounds-check-elim", "Eliminate and hoist D array bounds checks");
+
+FunctionPass *createBoundsCheckElimination(bool allowVersioning) {
+  return new BoundsCheckElimination(allowVersioning);
+}
+
+#if LDC_LLVM_VER >= 400
+PreservedAnalyses
+BoundsCheckEliminationPass::run(Function &F, FunctionAnalysisManager &AM) {
+  BoundsCheckElimination Impl(AllowVersioning);
+  if (!Impl.eliminate(F, AM.getResult<LoopAnalysis>(F),
+                      AM.getResult<ScalarEvolutionAnalysis>(F))) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+#endif
+
+/// Builds the condition for all checks of the loop to succeed in the
+/// preheader, or returns null if an index range cannot be determined.
+Value *BoundsCheckElimination::buildVersionCondition(
+    Loop *L, ArrayRef<BoundsCheck> Checks, ScalarEvolution &SE,
+    SCEVExpander &Expander) {
+  // At most that many iterations can start, as every one ends in the latch.
+  const SCEV *BackedgeCount = SE.getExitCount(L, L->getLoopLatch());
+  if (isa<SCEVCouldNotCompute>(BackedgeCount)) {
+    return nullptr;
+  }
+
+  // The index is in [Low, High] for all iterations, if Low <= High (i.e., the
+  // induction variable doesn't wrap).
+  using Range = std::tuple<const SCEV *, const SCEV *, Value *>;
+  SmallVector<Range, 4> Ranges;
+  DenseSet<std::pair<const SCEV *, Value *>> Seen;
+  for (const auto &Check : Checks) {
+    const SCEV *Index = SE.getSCEV(Check.Index);
+    if (!Seen.insert(std::make_pair(Index, Check.Length)).second) {
+      continue;
+    }
+
+    auto AR = cast<SCEVAddRecExpr>(Index);
+    Type *Ty = AR->getType();
+    if (SE.getTypeSizeInBits(BackedgeCount->getType()) >
+        SE.getTypeSizeInBits(Ty)) {
+      return nullptr;
+    }
+    const SCEV *Count = SE.getNoopOrZeroExtend(BackedgeCount, Ty);
+    const SCEV *Start = AR->getStart();
+    const SCEV *Step = AR->getStepRecurrence(SE);
+
+    const SCEV *Low, *High;
+    if (Step->isOne()) {
+      Low = Start;
+      High = SE.getAddExpr(Start, Count);
+    } else if (Step->isAllOnesValue()) {
+      Low = SE.getMinusSCEV(Start, Count);
+      High = Start;
+    } else {
+      return nullptr;
+    }
+
+    if (!isSafeToExpand(Low, SE) || !isSafeToExpand(High, SE)) {
+      return nullptr;
+    }
+    Ranges.push_back(std::make_tuple(Low, High, Check.Length));
+  }
+
+  Instruction *InsertPt = L->getLoopPreheader()->getTerminator();
+  IRBuilder<> B(InsertPt);
+  Value *Cond = nullptr;
+  for (const auto &R : Ranges) {
+    Type *Ty = std::get<2>(R)->getType();
+    Value *Low = Expander.expandCodeFor(std::get<0>(R), Ty, InsertPt);
+    Value *High = Expander.expandCodeFor(std::get<1>(R), Ty, InsertPt);
+    Value *InBounds = B.CreateAnd(B.CreateICmpULE(Low, High),
+                                  B.CreateICmpULT(High, std::get<2>(R)));
+    Cond = Cond ? B.CreateAnd(Cond, InBounds) : InBounds;
+  }
+  Cond->setName("bce.cond");
+  return Cond;
+}
+
+bool BoundsCheckElimination::runOnFunction(Function &F) {
+#if LDC_LLVM_VER >= 307
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+#else
+  LoopInfo &LI = getAnalysis<LoopInfo>();
+#endif
+#if LDC_LLVM_VER >= 308
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+#else
+  ScalarEvolution &SE = getAnalysis<ScalarEvolution>();
+#endif
+
+  return eliminate(F, LI, SE);
+}
+
+bool BoundsCheckElimination::eliminate(Function &F, LoopInfo &LI,
+                                       ScalarEvolution &SE) {
+  SmallVector<BoundsCheck, 16> Proven;
+  MapVector<Loop *, SmallVector<BoundsCheck, 4>> LoopChecks;
+  for (auto &BB : F) {
+    auto Br = dyn_cast<BranchInst>(BB.getTerminator());
+    BoundsCheck Check;
+    if (!Br || !matchBoundsCheck(Br, Check)) {
+      continue;
+    }
+
+    const SCEV *Index = SE.getSCEV(Check.Index);
+    if (SE.isKnownPredicate(ICmpInst::ICMP_ULT, Index,
+                            SE.getSCEV(Check.Length))) {
+      Proven.push_back(Check);
+      continue;
+    }
+
+    Loop *L = LI.getLoopFor(&BB);
+    auto AR = dyn_cast<SCEVAddRecExpr>(Index);
+    if (AllowVersioning && L && AR && AR->getLoop() == L && AR->isAffine() &&
+        L->isLoopInvariant(Check.Length)) {
+      LoopChecks[L].push_back(Check);
+    }
+  }
+
+  // Expand all versioning conditions while the analyses are still valid.
+  SmallVector<LoopVersion, 4> Versions;
+  {
+#if LDC_LLVM_VER >= 307
+    SCEVExpander Expander(SE, F.getParent()->getDataLayout(), "bce");
+#else
+    SCEVExpander Expander(SE, "bce");
+#endif
+    for (auto &Entry : LoopChecks) {
+      Loop *L = Entry.first;
+      if (!canVersion(L)) {
+        continue;
+      }
+      if (Value *Cond =
+              buildVersionCondition(L, Entry.second, SE, Expander)) {
+        LoopVersion Version;
+        Version.L = L;
+        Version.Cond = Cond;
+        Version.Checks = std::move(Entry.second);
+        Versions.push_back(std::move(Version));
+      }
+    }
+  }
+
+  for (const auto &Check : Proven) {
+    DEBUG(errs() << "Bounds check always succeeds: " << *Check.Br << '\n');
+    foldBoundsCheck(Check.Br, Check.OkSucc);
+    ++NumFolded;
+  }
+
+  for (const auto &Version : Versions) {
+    DEBUG(errs() << "Versioning loop: " << *Version.L);
+    versionLoop(Version);
+  }
+
+  return !Proven.empty() || !Versions.empty();
+}
@@ -0,0 +1,142 @@
+//===-- DAliasAnalysis.cpp - D-specific alias analysis --------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This alias analysis makes use of D's immutable: the memory pointed to by
+// function parameters which are (by-value) pointers or slices to immutable
+// data cannot be modified by anything during the function call. The frontend
+// marks such parameters with the "ldc.immutable" attribute.
+//
+// Only the parameters themselves are special. After inlining, the pointer is
+// a value in the caller (which may well have constructed the immutable data
+// right before the call), so it isn't treated specially anymore. This is also
+// why the memory is not reported as constant (pointsToConstantMemory()): that
+// would make functions only reading it readnone, which is not true for their
+// callers.
+//
+// Slice parameters marked with @restrict get the "ldc.restrict" attribute
+// (pointer parameters simply get LLVM's noalias): the memory accessed through
+// them is not accessed through any other parameter during the call, like with
+// C99's restrict.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dalias"
+
+#include "Passes.h"
+
+#if LDC_LLVM_VER >= 309
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Pass.h"
+#include <memory>
+using namespace llvm;
+
+namespace {
+class DAAResult : public AAResultBase<DAAResult> {
+  friend AAResultBase<DAAResult>;
+
+  /// Returns the pointer or slice parameter the given pointer is derived from,
+  /// if any.
+  static const Argument *getParameter(const Value *V) {
+    for (unsigned i = 0; i < 16; ++i) {
+      if (auto GEP = dyn_cast<GEPOperator>(V)) {
+        V = GEP->getPointerOperand();
+      } else if (Operator::getOpcode(V) == Instruction::BitCast ||
+                 Operator::getOpcode(V) == Instruction::AddrSpaceCast) {
+        V = cast<Operator>(V)->getOperand(0);
+      } else {
+        break;
+      }
+    }
+
+    // The pointer of a slice.
+    if (auto EVI = dyn_cast<ExtractValueInst>(V)) {
+      if (EVI->getNumIndices() != 1 || EVI->getIndices()[0] != 1) {
+        return nullptr;
+      }
+      V = EVI->getAggregateOperand();
+    }
+
+    return dyn_cast<Argument>(V);
+  }
+
+  static bool hasAttribute(const Argument *A, StringRef Kind) {
+    return A && A->getParent()->getAttributes().hasAttribute(A->getArgNo() + 1,
+                                                             Kind);
+  }
+
+  /// Returns whether the given pointer is derived from a parameter pointing to
+  /// immutable data.
+  static bool pointsToImmutableParameter(const Value *V) {
+    return hasAttribute(getParameter(V), "ldc.immutable");
+  }
+
+public:
+  AliasResult alias(const MemoryLocation &LocA, const MemoryLocation &LocB) {
+    // Memory accessed through a restricted parameter isn't accessed through
+    // any other parameter.
+    const Argument *ParamA = getParameter(LocA.Ptr);
+    const Argument *ParamB = getParameter(LocB.Ptr);
+    if (ParamA && ParamB && ParamA != ParamB &&
+        (hasAttribute(ParamA, "ldc.restrict") ||
+         hasAttribute(ParamB, "ldc.restrict"))) {
+      return NoAlias;
+    }
+
+    // Immutable data cannot be aliased by memory being written to. If both
+    // locations are immutable, they are only read, so let the other analyses
+    // decide whether they are the same.
+    if (pointsToImmutableParameter(LocA.Ptr) !=
+        pointsToImmutableParameter(LocB.Ptr)) {
+      return NoAlias;
+    }
+    return AAResultBase::alias(LocA, LocB);
+  }
+
+  ModRefInfo getModRefInfo(ImmutableCallSite CS, const MemoryLocation &Loc) {
+    ModRefInfo Result = AAResultBase::getModRefInfo(CS, Loc);
+    if (pointsToImmutableParameter(Loc.Ptr)) {
+      Result = ModRefInfo(Result & MRI_Ref);
+    }
+    return Result;
+  }
+};
+
+#if LDC_LLVM_VER >= 400
+class DAliasAnalysis : public AnalysisInfoMixin<DAliasAnalysis> {
+  friend AnalysisInfoMixin<DAliasAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  typedef DAAResult Result;
+  DAAResult run(Function &, FunctionAnalysisManager &) { return DAAResult(); }
+};
+AnalysisKey DAliasAnalysis::Key;
+#endif
+}
+
+ImmutablePass *createDAliasAnalysisPass() {
+  auto Result = std::make_shared<DAAResult>();
+  return createExternalAAWrapperPass(
+      [Result](Pass &, Function &, AAResults &AAR) {
+        AAR.addAAResult(*Result);
+      });
+}
+
+#if LDC_LLVM_VER >= 400
+void registerDAliasAnalysis(FunctionAnalysisManager &FAM, AAManager &AA) {
+  FAM.registerPass([] { return DAliasAnalysis(); });
+  AA.registerFunctionAnalysis<DAliasAnalysis>();
+}
+#endif
+
+#endif // LDC_LLVM_VER >= 309
@@ -0,0 +1,337 @@
+//===-- DelegateSpecialization.cpp - Specialize functions for delegates ---===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A foreach loop over an aggregate with opApply is lowered to a call of
+// opApply with a delegate to the loop body. Unless the opApply is inlined,
+// every iteration is an indirect call (and the closure frame of the loop body
+// is likely to be GC-allocated).
+//
+// This pass clones functions taking a delegate parameter they call, for each
+// delegate function literal passed by the callers, with the delegate function
+// pointer replaced by the constant. The calls of the delegate in the clone are
+// then direct calls, which the inliner can handle independently of whether
+// the clone itself is inlined. Delegates are recognized by their LLVM type
+// ({ i8*, <function>* }), passed by value or, as on Win64, by reference to a
+// copy stored by the caller right before the call.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dg-specialize"
+
+#include "Passes.h"
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <map>
+#include <tuple>
+
+using namespace llvm;
+
+STATISTIC(NumSpecialized, "Number of functions specialized for a delegate");
+STATISTIC(NumCallsRedirected, "Number of calls redirected to a specialization");
+
+static cl::opt<unsigned> SizeLimit(
+    "dg-specialize-size-limit", cl::init(250), cl::Hidden,
+    cl::desc("Maximum number of instructions of a function to be cloned for a "
+             "delegate argument"));
+
+namespace {
+/// Returns whether `Ty` is the type of a D delegate, i.e., a context pointer
+/// and a function pointer (and not, e.g., a slice).
+bool isDelegateType(Type *Ty) {
+  auto STy = dyn_cast<StructType>(Ty);
+  if (!STy || STy->getNumElements() != 2) {
+    return false;
+  }
+  auto CtxPtrTy = dyn_cast<PointerType>(STy->getElementType(0));
+  auto FuncPtrTy = dyn_cast<PointerType>(STy->getElementType(1));
+  return CtxPtrTy && CtxPtrTy->getElementType()->isIntegerTy(8) &&
+         FuncPtrTy && FuncPtrTy->getElementType()->isFunctionTy();
+}
+
+/// Returns whether the delegate is passed by reference, i.e., as pointer to a
+/// copy owned by the callee (e.g., on Win64).
+bool isDelegateRefType(Type *Ty) {
+  auto PTy = dyn_cast<PointerType>(Ty);
+  return PTy && isDelegateType(PTy->getElementType());
+}
+
+/// Returns the index of the delegate field `Ptr` points to, if it is a GEP
+/// into `Dg`, or -1.
+int getFieldIndex(Value *Ptr, Value *Dg) {
+  auto GEP = dyn_cast<GetElementPtrInst>(Ptr);
+  if (!GEP || GEP->getPointerOperand() != Dg || GEP->getNumIndices() != 2 ||
+      !GEP->hasAllConstantIndices() ||
+      !cast<Constant>(GEP->getOperand(1))->isNullValue()) {
+    return -1;
+  }
+  return static_cast<int>(
+      cast<ConstantInt>(GEP->getOperand(2))->getZExtValue());
+}
+
+/// Returns the function pointer stored to the delegate copy `Ptr` passed by
+/// reference to `Call`, as a whole or as single field, if memory isn't written
+/// otherwise between the store and the call (except for stores to other
+/// allocas, e.g. the copies of other arguments).
+Value *getStoredFuncPtr(Value *Ptr, Instruction *Call) {
+  if (!isa<AllocaInst>(Ptr)) {
+    return nullptr;
+  }
+  for (BasicBlock::iterator It(Call), Begin = Call->getParent()->begin();
+       It != Begin;) {
+    Instruction &I = *--It;
+    if (auto SI = dyn_cast<StoreInst>(&I)) {
+      Value *Dst = SI->getPointerOperand();
+      if (Dst == Ptr) {
+        return FindInsertedValue(SI->getValueOperand(), 1);
+      }
+      const int Field = getFieldIndex(Dst, Ptr);
+      if (Field == 1) {
+        return SI->getValueOperand();
+      }
+      if (Field == 0 || isa<AllocaInst>(Dst->stripPointerCasts())) {
+        continue;
+      }
+    }
+    if (I.mayWriteToMemory()) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+/// Returns the defined function a delegate argument of `Call` is constructed
+/// with.
+Function *getDelegateFunction(Value *Dg, Instruction *Call) {
+  Value *FuncPtr = nullptr;
+  if (isDelegateType(Dg->getType())) {
+    const unsigned FuncPtrIdx = 1;
+    FuncPtr = FindInsertedValue(Dg, FuncPtrIdx);
+  } else if (isDelegateRefType(Dg->getType())) {
+    FuncPtr = getStoredFuncPtr(Dg, Call);
+  }
+  if (!FuncPtr) {
+    return nullptr;
+  }
+  auto F = dyn_cast<Function>(FuncPtr->stripPointerCasts());
+  return F && !F->isDeclaration() ? F : nullptr;
+}
+
+/// Collects the extractions of the function pointer from the delegate `Dg`.
+void getExtractedFuncPtrs(Value *Dg, SmallVectorImpl<Instruction *> &FuncPtrs) {
+  for (auto U : Dg->users()) {
+    auto EVI = dyn_cast<ExtractValueInst>(U);
+    if (EVI && EVI->getNumIndices() == 1 && EVI->getIndices()[0] == 1) {
+      FuncPtrs.push_back(EVI);
+    }
+  }
+}
+
+/// Collects the loads of the function pointer of a delegate passed by
+/// reference. Returns false if the copy may be modified or escape.
+bool getLoadedFuncPtrs(Argument *Param,
+                       SmallVectorImpl<Instruction *> &FuncPtrs) {
+  for (auto U : Param->users()) {
+    if (auto LI = dyn_cast<LoadInst>(U)) {
+      getExtractedFuncPtrs(LI, FuncPtrs);
+      continue;
+    }
+
+    const int Field = getFieldIndex(U, Param);
+    if (Field < 0) {
+      return false;
+    }
+    for (auto GU : U->users()) {
+      auto LI = dyn_cast<LoadInst>(GU);
+      if (!LI) {
+        return false;
+      }
+      if (Field == 1) {
+        FuncPtrs.push_back(LI);
+      }
+    }
+  }
+  return true;
+}
+
+/// Collects the function pointer values of a delegate parameter, passed by
+/// value or by reference, and returns whether the delegate is called.
+bool getCalledFuncPtrs(Argument *Param,
+                       SmallVectorImpl<Instruction *> &FuncPtrs) {
+  if (isDelegateType(Param->getType())) {
+    getExtractedFuncPtrs(Param, FuncPtrs);
+  } else if (!isDelegateRefType(Param->getType()) ||
+             !getLoadedFuncPtrs(Param, FuncPtrs)) {
+    FuncPtrs.clear();
+    return false;
+  }
+
+  for (auto FuncPtr : FuncPtrs) {
+    for (auto U : FuncPtr->users()) {
+      Value *Callee = FuncPtr;
+      if (auto BC = dyn_cast<BitCastInst>(U)) {
+        if (!BC->hasOneUse()) {
+          continue;
+        }
+        Callee = BC;
+        U = *BC->user_begin();
+      }
+      CallSite CS(U);
+      if (CS && CS.getCalledValue() == Callee) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool isSpecializable(Function *F) {
+  if (F->isDeclaration() || F->isVarArg() ||
+#if LDC_LLVM_VER >= 309
+      F->isInterposable()) {
+#else
+      F->mayBeOverridden()) {
+#endif
+    return false;
+  }
+
+  unsigned Size = 0;
+  for (auto &BB : *F) {
+    Size += BB.size();
+  }
+  return Size <= SizeLimit;
+}
+
+struct LLVM_LIBRARY_VISIBILITY DelegateSpecialization : public ModulePass {
+  static char ID; // Pass identification
+  DelegateSpecialization() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override;
+
+private:
+  typedef std::tuple<Function *, unsigned, Function *> Key;
+  DenseMap<std::pair<Function *, unsigned>, bool> CalledParams;
+  std::map<Key, Function *> Specializations;
+
+  bool callsDelegateParam(Function *F, unsigned ArgNo);
+  Function *getSpecialization(Function *F, unsigned ArgNo, Function *DgFunc);
+};
+}
+
+char DelegateSpecialization::ID = 0;
+static RegisterPass<DelegateSpecialization>
+    X("dg-specialize", "Specialize functions for delegate literal arguments");
+
+ModulePass *createDelegateSpecializationPass() {
+  return new DelegateSpecialization();
+}
+
+#if LDC_LLVM_VER >= 400
+PreservedAnalyses DelegateSpecializationPass::run(Module &M,
+                                                  ModuleAnalysisManager &) {
+  DelegateSpecialization Impl;
+  return Impl.runOnModule(M) ? PreservedAnalyses::none()
+                             : PreservedAnalyses::all();
+}
+#endif
+
+bool DelegateSpecialization::callsDelegateParam(Function *F, unsigned ArgNo) {
+  auto It = CalledParams.find(std::make_pair(F, ArgNo));
+  if (It != CalledParams.end()) {
+    return It->second;
+  }
+  SmallVector<Instruction *, 4> FuncPtrs;
+  const bool Result =
+      getCalledFuncPtrs(&*std::next(F->arg_begin(), ArgNo), FuncPtrs);
+  CalledParams[std::make_pair(F, ArgNo)] = Result;
+  return Result;
+}
+
+Function *DelegateSpecialization::getSpecialization(Function *F,
+                                                    unsigned ArgNo,
+                                                    Function *DgFunc) {
+  Function *&Clone = Specializations[Key(F, ArgNo, DgFunc)];
+  if (Clone) {
+    return Clone;
+  }
+
+  ValueToValueMapTy VMap;
+#if LDC_LLVM_VER >= 309
+  Clone = CloneFunction(F, VMap);
+#else
+  Clone = CloneFunction(F, VMap, /*ModuleLevelChanges=*/false);
+  F->getParent()->getFunctionList().push_back(Clone);
+#endif
+  Clone->setName(F->getName() + ".dg." + DgFunc->getName());
+  Clone->setLinkage(GlobalValue::InternalLinkage);
+  Clone->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+  Clone->setComdat(nullptr);
+
+  SmallVector<Instruction *, 4> FuncPtrs;
+  getCalledFuncPtrs(&*std::next(Clone->arg_begin(), ArgNo), FuncPtrs);
+  for (auto FuncPtr : FuncPtrs) {
+    FuncPtr->replaceAllUsesWith(
+        ConstantExpr::getPointerCast(DgFunc, FuncPtr->getType()));
+    FuncPtr->eraseFromParent();
+  }
+
+  DEBUG(errs() << "Specialized " << F->getName() << " for "
+               << DgFunc->getName() << '\n');
+  ++NumSpecialized;
+  return Clone;
+}
+
+bool DelegateSpecialization::runOnModule(Module &M) {
+  SmallVector<std::pair<CallSite, unsigned>, 16> Candidates;
+  for (auto &F : M) {
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        CallSite CS(&I);
+        if (!CS) {
+          continue;
+        }
+        Function *Callee = CS.getCalledFunction();
+        if (!Callee || Callee == &F || !isSpecializable(Callee)) {
+          continue;
+        }
+        for (unsigned i = 0, e = CS.arg_size(); i != e; ++i) {
+          if (getDelegateFunction(CS.getArgument(i), &I) &&
+              callsDelegateParam(Callee, i)) {
+            Candidates.push_back(std::make_pair(CS, i));
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  for (auto &Candidate : Candidates) {
+    CallSite CS = Candidate.first;
+    const unsigned ArgNo = Candidate.second;
+    CS.setCalledFunction(getSpecialization(
+        CS.getCalledFunction(), ArgNo,
+        getDelegateFunction(CS.getArgument(ArgNo), CS.getInstruction())));
+    ++NumCallsRedirected;
+  }
+
+  return !Candidates.empty();
+}
@@ -25,12 +25,17 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/ValueTracking.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#endif
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
@@ -49,12 +54,33 @@ STATISTIC(NumToDynSize,
           "Number of calls promoted to dynamically-sized allocas");
 STATISTIC(NumDeleted,
           "Number of GC calls deleted because the return value was unused");
+STATISTIC(NumOverBudget,
+          "Number of calls not promoted due to the function's stack budget");
+STATISTIC(NumInRecursive,
+          "Number of calls not promoted because the function is recursive");
+STATISTIC(NumAppendBuffers,
+          "Number of local arrays appended to in a stack buffer first");
 
 static cl::opt<unsigned>
-    SizeLimit("dgc2stack-size-limit", cl::init(1024), cl::Hidden,
+    SizeLimit("dgc2stack-size-limit", cl::init(4096), cl::Hidden,
               cl::desc("Require allocs to be smaller than n bytes to be "
                        "promoted, 0 to ignore."));
 
+static cl::opt<unsigned> FunctionLimit(
+    "dgc2stack-function-limit", cl::init(4096), cl::Hidden,
+    cl::desc("Limit the total size of the allocs promoted in a function to n "
+             "bytes (upper bound for dynamically-sized allocs), 0 to ignore."));
+
+static cl::opt<unsigned> CalleeDepthLimit(
+    "dgc2stack-callee-depth", cl::init(3), cl::Hidden,
+    cl::desc("Maximum depth of callees analyzed for capturing the allocated "
+             "memory, 0 to only rely on 'nocapture' attributes."));
+
+static cl::opt<unsigned> AppendBufferSize(
+    "dgc2stack-append-buffer-size", cl::init(256), cl::Hidden,
+    cl::desc("Size in bytes of the stack buffers given to local arrays which "
+             "are only appended to, 0 to disable."));
+
 namespace {
 struct Analysis {
   const DataLayout &DL;
@@ -106,6 +132,13 @@ protected:
 public:
   ReturnType::Type ReturnType;
 
+  // Upper bound for the size of the analyzed allocation in bytes, or 0 if
+  // unknown (the size limit has been disabled).
+  uint64_t MaxSize;
+
+  // Why analyze() rejected the last call, for the optimization remarks.
+  const char *Reason;
+
   // Analyze the current call, filling in some fields. Returns true if
   // this is an allocation we can stack-allocate.
   virtual bool analyze(CallSite CS, const Analysis &A) = 0;
@@ -119,8 +152,20 @@ public:
     return new AllocaInst(Ty, ".nongc_mem", Begin); // FIXME: align?
   }
 
-  explicit FunctionInfo(ReturnType::Type returnType) : ReturnType(returnType) {}
+  explicit FunctionInfo(ReturnType::Type returnType)
+      : ReturnType(returnType), MaxSize(0), Reason(nullptr) {}
   virtual ~FunctionInfo() = default;
+
+protected:
+  bool reject(const char *reason) {
+    Reason = reason;
+    return false;
+  }
+
+  bool checkSizeLimit() {
+    return SizeLimit == 0 || MaxSize < SizeLimit ||
+           reject("the allocation exceeds the size limit");
+  }
 };
 
 static bool isKnownLessThan(Value *Val, uint64_t Limit, const Analysis &A) {
@@ -164,9 +209,10 @@ public:
     Value *TypeInfo = CS.getArgument(TypeInfoArgNr);
     Ty = A.getTypeFor(TypeInfo);
     if (!Ty) {
-      return false;
+      return reject("the allocated type is unknown");
     }
-    return A.DL.getTypeAllocSize(Ty) < SizeLimit;
+    MaxSize = A.DL.getTypeAllocSize(Ty);
+    return checkSizeLimit();
   }
 };
 
@@ -200,13 +246,21 @@ public:
     // miscompilations for humongous arrays, but as the value "range"
     // (set bits) inference algorithm is rather limited, this is
     // useful for experimenting.
+    uint64_t ElemSize = A.DL.getTypeAllocSize(Ty);
     if (SizeLimit > 0) {
-      uint64_t ElemSize = A.DL.getTypeAllocSize(Ty);
       if (!isKnownLessThan(arrSize, SizeLimit / ElemSize, A)) {
-        return false;
+        return reject(isa<Constant>(arrSize)
+                          ? "the allocation exceeds the size limit"
+                          : "the dynamic size may exceed the size limit");
       }
     }
 
+    if (auto C = dyn_cast<ConstantInt>(arrSize)) {
+      MaxSize = ElemSize * C->getZExtValue();
+    } else {
+      MaxSize = SizeLimit;
+    }
+
     return true;
   }
 
@@ -255,17 +309,20 @@ public:
   }
 };
 
-// FunctionInfo for _d_allocclass
+// FunctionInfo for _d_allocclass, and for gc_malloc called with a ClassInfo
+// (as emitted for class allocations)
 class AllocClassFI : public FunctionInfo {
+  unsigned ClassInfoArgNr;
+
 public:
   bool analyze(CallSite CS, const Analysis &A) override {
-    if (CS.arg_size() != 1) {
-      return false;
+    if (CS.arg_size() != ClassInfoArgNr + 1) {
+      return reject("not a class allocation");
     }
-    Value *arg = CS.getArgument(0)->stripPointerCasts();
+    Value *arg = CS.getArgument(ClassInfoArgNr)->stripPointerCasts();
     GlobalVariable *ClassInfo = dyn_cast<GlobalVariable>(arg);
     if (!ClassInfo) {
-      return false;
+      return reject("the allocated class is unknown");
     }
 
     std::string metaname = CD_PREFIX;
@@ -273,12 +330,12 @@ public:
 
     NamedMDNode *meta = A.M.getNamedMetadata(metaname);
     if (!meta) {
-      return false;
+      return reject("the allocated class is unknown");
     }
 
     MDNode *node = static_cast<MDNode *>(meta->getOperand(0));
     if (!node || node->getNumOperands() != CD_NumFields) {
-      return false;
+      return reject("the allocated class is unknown");
     }
 
 // Inserting destructor calls is not implemented yet, so classes
@@ -300,12 +357,12 @@ public:
         dyn_cast<Constant>(node->getOperand(CD_CustomDelete));
 #endif
     if (hasDestructor == nullptr || hasCustomDelete == nullptr) {
-      return false;
+      return reject("the allocated class is unknown");
     }
 
     if (ConstantExpr::getOr(hasDestructor, hasCustomDelete) !=
         ConstantInt::getFalse(A.M.getContext())) {
-      return false;
+      return reject("the class has a destructor or a custom deallocator");
     }
 
 #if LDC_LLVM_VER >= 306
@@ -314,12 +371,23 @@ public:
 #else
     Ty = node->getOperand(CD_BodyType)->getType();
 #endif
-    return A.DL.getTypeAllocSize(Ty) < SizeLimit;
+    MaxSize = A.DL.getTypeAllocSize(Ty);
+
+    // gc_malloc must not be asked for more than the class instance.
+    if (ClassInfoArgNr != 0) {
+      auto Size = dyn_cast<ConstantInt>(CS.getArgument(0));
+      if (!Size || Size->getZExtValue() > MaxSize) {
+        return reject("more memory than the class instance is allocated");
+      }
+    }
+
+    return checkSizeLimit();
   }
 
   // The default promote() should be fine.
 
-  AllocClassFI() : FunctionInfo(ReturnType::Pointer) {}
+  explicit AllocClassFI(unsigned classInfoArgNr)
+      : FunctionInfo(ReturnType::Pointer), ClassInfoArgNr(classInfoArgNr) {}
 };
 
 /// Describes runtime functions that allocate a chunk of memory with a
@@ -331,7 +399,7 @@ class UntypedMemoryFI : public FunctionInfo {
 public:
   bool analyze(CallSite CS, const Analysis &A) override {
     if (CS.arg_size() < SizeArgNr + 1) {
-      return false;
+      return reject("the allocation size is unknown");
     }
 
     SizeArg = CS.getArgument(SizeArgNr);
@@ -343,10 +411,18 @@ public:
     // is useful for experimenting.
     if (SizeLimit > 0) {
       if (!isKnownLessThan(SizeArg, SizeLimit, A)) {
-        return false;
+        return reject(isa<Constant>(SizeArg)
+                          ? "the allocation exceeds the size limit"
+                          : "the dynamic size may exceed the size limit");
       }
     }
 
+    if (auto C = dyn_cast<ConstantInt>(SizeArg)) {
+      MaxSize = C->getZExtValue();
+    } else {
+      MaxSize = SizeLimit;
+    }
+
     // Should be i8.
     Ty = CS.getType()->getContainedType(0);
     return true;
@@ -371,8 +447,10 @@ public:
 
     // Convert array size to 32 bits if necessary
     Value *count = Builder.CreateIntCast(SizeArg, Builder.getInt32Ty(), false);
-    AllocaInst *alloca =
-        Builder.CreateAlloca(Ty, count, ".nongc_mem"); // FIXME: align?
+    AllocaInst *alloca = Builder.CreateAlloca(Ty, count, ".nongc_mem");
+    // The GC returns memory aligned to 16 bytes, which the users of the
+    // untyped memory (e.g., closure frames) may rely on.
+    alloca->setAlignment(16);
 
     return Builder.CreateBitCast(alloca, CS.getType());
   }
@@ -382,6 +460,52 @@ public:
 };
 }
 
+//===----------------------------------------------------------------------===//
+// Optimization remarks
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// Reports the promoted and the rejected allocations as optimization remarks
+/// (LLVM >= 4.0), shown by -pass-remarks[-missed]=dgc2stack and saved by
+/// -fsave-optimization-record.
+class RemarkEmitter {
+#if LDC_LLVM_VER >= 400
+  OptimizationRemarkEmitter ORE;
+
+public:
+  explicit RemarkEmitter(Function &F) : ORE(&F) {}
+
+  void promoted(Instruction *I, Function *Callee, uint64_t MaxSize) {
+    ORE.emit(OptimizationRemark(DEBUG_TYPE, "Promoted", I)
+             << "promoted " << ore::NV("Callee", Callee)
+             << " allocation of at most "
+             << ore::NV("Size", static_cast<unsigned>(MaxSize))
+             << " bytes to the stack");
+  }
+
+  void deleted(Instruction *I, Function *Callee) {
+    ORE.emit(OptimizationRemark(DEBUG_TYPE, "Deleted", I)
+             << "deleted unused " << ore::NV("Callee", Callee)
+             << " allocation");
+  }
+
+  void missed(Instruction *I, const char *Name, Function *Callee,
+              const char *Reason) {
+    ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, Name, I)
+             << ore::NV("Callee", Callee)
+             << " allocation not promoted to the stack: "
+             << ore::NV("Reason", Reason));
+  }
+#else
+public:
+  explicit RemarkEmitter(Function &) {}
+  void promoted(Instruction *, Function *, uint64_t) {}
+  void deleted(Instruction *, Function *) {}
+  void missed(Instruction *, const char *, Function *, const char *) {}
+#endif
+};
+}
+
 //===----------------------------------------------------------------------===//
 // GarbageCollect2Stack Pass Implementation
 //===----------------------------------------------------------------------===//
@@ -397,6 +521,7 @@ class LLVM_LIBRARY_VISIBILITY GarbageCollect2Stack : public FunctionPass {
   ArrayFI NewArrayU;
   ArrayFI NewArrayT;
   AllocClassFI AllocClass;
+  AllocClassFI GCMallocClass;
   UntypedMemoryFI AllocMemory;
 
 public:
@@ -410,6 +535,11 @@ public:
 
   bool runOnFunction(Function &F) override;
 
+  /// Shared by the legacy and the new pass manager; the call graph is
+  /// optional.
+  bool promote(Function &F, const DataLayout &DL, DominatorTree &DT,
+               CallGraph *CG);
+
   void getAnalysisUsage(AnalysisUsage &AU) const override {
 #if LDC_LLVM_VER < 307
     AU.addRequired<DataLayoutPass>();
@@ -429,14 +559,31 @@ FunctionPass *createGarbageCollect2Stack() {
   return new GarbageCollect2Stack();
 }
 
+#if LDC_LLVM_VER >= 400
+PreservedAnalyses GarbageCollect2StackPass::run(Function &F,
+                                                FunctionAnalysisManager &AM) {
+  GarbageCollect2Stack Impl;
+  Impl.doInitialization(*F.getParent());
+  // The call graph isn't available to function passes; only direct recursion
+  // is detected then.
+  if (!Impl.promote(F, F.getParent()->getDataLayout(),
+                    AM.getResult<DominatorTreeAnalysis>(F), nullptr)) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+#endif
+
 GarbageCollect2Stack::GarbageCollect2Stack()
     : FunctionPass(ID), AllocMemoryT(ReturnType::Pointer, 0),
       NewArrayU(ReturnType::Array, 0, 1, false),
-      NewArrayT(ReturnType::Array, 0, 1, true), AllocMemory(0) {
+      NewArrayT(ReturnType::Array, 0, 1, true), AllocClass(0),
+      GCMallocClass(2), AllocMemory(0) {
   KnownFunctions["_d_allocmemoryT"] = &AllocMemoryT;
   KnownFunctions["_d_newarrayU"] = &NewArrayU;
   KnownFunctions["_d_newarrayT"] = &NewArrayT;
   KnownFunctions["_d_allocclass"] = &AllocClass;
+  KnownFunctions["gc_malloc"] = &GCMallocClass;
   KnownFunctions["_d_allocmemory"] = &AllocMemory;
 }
 
@@ -465,11 +612,321 @@ static bool
 isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &DT,
                       SmallVector<CallInst *, 4> &RemoveTailCallInsts);
 
+/// Returns whether F may (directly or indirectly) call itself, as per the call
+/// graph. Only direct self-calls are detected if it isn't available.
+/// Calls to external code are not considered.
+static bool isRecursive(Function &F, CallGraph *CG) {
+  if (!CG) {
+    for (auto U : F.users()) {
+      auto I = dyn_cast<Instruction>(U);
+      if (I && I->getParent()->getParent() == &F && CallSite(I) &&
+          CallSite(I).getCalledFunction() == &F) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  CallGraphNode *Start = (*CG)[&F];
+  SmallVector<CallGraphNode *, 16> Worklist;
+  SmallPtrSet<CallGraphNode *, 16> Visited;
+  Worklist.push_back(Start);
+  while (!Worklist.empty()) {
+    CallGraphNode *N = Worklist.pop_back_val();
+    for (const auto &Record : *N) {
+      CallGraphNode *Callee = Record.second;
+      if (Callee == Start) {
+        return true;
+      }
+      Function *CalleeF = Callee->getFunction();
+      if (CalleeF && !CalleeF->isDeclaration() &&
+#if LDC_LLVM_VER >= 306
+          Visited.insert(Callee).second
+#else
+          Visited.insert(Callee)
+#endif
+          ) {
+        Worklist.push_back(Callee);
+      }
+    }
+  }
+  return false;
+}
+
+namespace {
+/// The context of a capture query: either the function containing the GC
+/// call, or a callee the allocated memory is passed to.
+struct CaptureQuery {
+  /// The GC call and the dominator tree of its function, for detecting derived
+  /// values live across the allocation (only for the allocating function).
+  BasicBlock::iterator Alloc;
+  DominatorTree *DT;
+  SmallVector<CallInst *, 4> *RemoveTailCallInsts;
+
+  /// For callees: the query of the caller, the parameter being analyzed and
+  /// the aggregate passed for it by the caller (used to resolve the function
+  /// pointers of delegates).
+  const CaptureQuery *Caller;
+  Argument *Param;
+  Value *CallerAggr;
+  unsigned Depth;
+};
+
+typedef std::pair<Function *, std::pair<unsigned, int>> CalleeParam;
+}
+
+static bool mayBeCaptured(Value *V, int FieldIdx, const CaptureQuery &Q,
+                          SmallVectorImpl<CalleeParam> &Path);
+
+//===----------------------------------------------------------------------===//
+// Stack buffers for local arrays only appended to
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// A local dynamic array (the alloca of its slice), which is only appended to
+/// via _d_arrayappendcTX and whose memory doesn't escape the function.
+struct AppendBuffer {
+  AllocaInst *Array;
+  Type *ElemTy;
+  SmallVector<CallSite, 4> Appends;
+  SmallVector<CallInst *, 4> RemoveTailCallInsts;
+};
+}
+
+/// Returns whether the type is a D slice ({ size_t, T* }).
+static bool isSliceType(Type *Ty) {
+  auto ST = dyn_cast<StructType>(Ty);
+  return ST && ST->getNumElements() == 2 &&
+         ST->getElementType(0)->isIntegerTy() &&
+         ST->getElementType(1)->isPointerTy();
+}
+
+/// Checks the uses of the slice (or of a pointer to its field FieldIdx, as
+/// used for loading and storing the length and pointer). Besides the appends,
+/// the slice may only be loaded and (re)assigned; the loaded pointers must not
+/// escape (which includes being stored back, e.g. when slicing the array).
+static bool usesAllowAppendBuffer(Value *V, int FieldIdx, AppendBuffer &Buf) {
+  SmallVector<CalleeParam, 4> Path;
+  CaptureQuery Q = {BasicBlock::iterator(), nullptr, &Buf.RemoveTailCallInsts,
+                    nullptr, nullptr, nullptr, 0};
+
+  for (User *U : V->users()) {
+    auto I = dyn_cast<Instruction>(U);
+    if (!I) {
+      return false;
+    }
+
+    switch (I->getOpcode()) {
+    case Instruction::Load: {
+      Type *Ty = I->getType();
+      if (FieldIdx < 0 && isSliceType(Ty)) {
+        if (mayBeCaptured(I, 1, Q, Path)) {
+          return false;
+        }
+      } else if (FieldIdx == 1 && Ty->isPointerTy()) {
+        if (mayBeCaptured(I, -1, Q, Path)) {
+          return false;
+        }
+      } else if (FieldIdx == 1 || !Ty->isIntegerTy()) {
+        // Reinterpreting the pointer.
+        return false;
+      }
+      break;
+    }
+    case Instruction::Store:
+      // Storing the address of the slice.
+      if (I->getOperand(0) == V) {
+        return false;
+      }
+      break;
+    case Instruction::BitCast:
+      if (FieldIdx >= 0 || !usesAllowAppendBuffer(I, FieldIdx, Buf)) {
+        return false;
+      }
+      break;
+    case Instruction::GetElementPtr: {
+      auto GEP = cast<GetElementPtrInst>(I);
+      if (FieldIdx >= 0 || GEP->getNumIndices() != 2 ||
+          !isSliceType(cast<PointerType>(V->getType())->getElementType())) {
+        return false;
+      }
+      auto Idx0 = dyn_cast<ConstantInt>(GEP->getOperand(1));
+      auto Idx1 = dyn_cast<ConstantInt>(GEP->getOperand(2));
+      if (!Idx0 || !Idx0->isZero() || !Idx1 ||
+          !usesAllowAppendBuffer(I, Idx1->getZExtValue(), Buf)) {
+        return false;
+      }
+      break;
+    }
+    case Instruction::Call:
+    case Instruction::Invoke: {
+      if (auto II = dyn_cast<IntrinsicInst>(I)) {
+        if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+            II->getIntrinsicID() == Intrinsic::lifetime_end) {
+          break;
+        }
+      }
+      CallSite CS(I);
+      if (FieldIdx < 0 && std::find(Buf.Appends.begin(), Buf.Appends.end(),
+                                    CS) != Buf.Appends.end() &&
+          CS.getArgument(1) == V) {
+        break;
+      }
+      return false;
+    }
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Finds the local arrays of the function which can be given a stack buffer.
+static void findAppendBuffers(Function &F, const Analysis &A,
+                              std::vector<AppendBuffer> &Buffers) {
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      CallSite CS(&I);
+      if (!CS.getInstruction()) {
+        continue;
+      }
+      Function *Callee = CS.getCalledFunction();
+      if (!Callee || !Callee->isDeclaration() ||
+          Callee->getName() != "_d_arrayappendcTX" || CS.arg_size() != 3) {
+        continue;
+      }
+
+      // The result (the new slice, also written to the array) must be unused,
+      // and the number of appended elements known.
+      auto Array =
+          dyn_cast<AllocaInst>(CS.getArgument(1)->stripPointerCasts());
+      auto N = dyn_cast<ConstantInt>(CS.getArgument(2));
+      Type *ArrTy = A.getTypeFor(CS.getArgument(0));
+      if (!Array || !N || N->isZero() || !I.use_empty() || !ArrTy ||
+          !isSliceType(ArrTy) || Array->getAllocatedType() != ArrTy ||
+          Array->getParent() != &F.getEntryBlock() || Array->isArrayAllocation()) {
+        continue;
+      }
+
+      auto It = std::find_if(
+          Buffers.begin(), Buffers.end(),
+          [Array](const AppendBuffer &B) { return B.Array == Array; });
+      if (It == Buffers.end()) {
+        AppendBuffer Buf;
+        Buf.Array = Array;
+        Buf.ElemTy = cast<PointerType>(cast<StructType>(ArrTy)->getElementType(1))
+                         ->getElementType();
+        Buffers.push_back(Buf);
+        It = Buffers.end() - 1;
+      }
+      It->Appends.push_back(CS);
+    }
+  }
+
+  Buffers.erase(std::remove_if(Buffers.begin(), Buffers.end(),
+                               [](AppendBuffer &Buf) {
+                                 return !usesAllowAppendBuffer(Buf.Array, -1,
+                                                               Buf);
+                               }),
+                Buffers.end());
+}
+
+static Value *CreateStructGEP(IRBuilder<> &B, Value *Ptr, unsigned Idx) {
+#if LDC_LLVM_VER >= 307
+  return B.CreateStructGEP(nullptr, Ptr, Idx);
+#else
+  return B.CreateStructGEP(Ptr, Idx);
+#endif
+}
+
+/// Gives the array a stack buffer of the given capacity (in elements), used
+/// until it is exceeded. An append is done inline if the slice ends at the
+/// used end of the buffer (or is empty and the buffer unused), the runtime
+/// only being called otherwise (which then moves the array to the GC heap,
+/// like for any non-GC memory). This mirrors the runtime's semantics for GC
+/// blocks, so the array may be reassigned (e.g., reset to null) freely.
+static void promoteAppendBuffer(AppendBuffer &Buf, uint64_t Capacity) {
+  NumAppendBuffers++;
+  DEBUG(errs() << "Giving a stack buffer to: " << *Buf.Array << '\n');
+
+  for (auto CI : Buf.RemoveTailCallInsts) {
+    CI->setTailCall(false);
+  }
+
+  Function &F = *Buf.Array->getParent()->getParent();
+  LLVMContext &Ctx = F.getContext();
+  auto SliceTy = cast<StructType>(Buf.Array->getAllocatedType());
+  Type *SizeTy = SliceTy->getElementType(0);
+  Type *PtrTy = SliceTy->getElementType(1);
+
+  // Allocate the buffer and the number of its used elements in the entry
+  // block.
+  BasicBlock &Entry = F.getEntryBlock();
+  IRBuilder<> EntryB(&Entry, Entry.begin());
+  Value *Stack = EntryB.CreateBitCast(
+      EntryB.CreateAlloca(ArrayType::get(Buf.ElemTy, Capacity), nullptr,
+                          ".appendbuf"),
+      PtrTy);
+  Value *Used = EntryB.CreateAlloca(SizeTy, nullptr, ".appendbuf.used");
+  EntryB.CreateStore(ConstantInt::get(SizeTy, 0), Used);
+
+  for (CallSite CS : Buf.Appends) {
+    Instruction *Call = CS.getInstruction();
+    BasicBlock *Head = Call->getParent();
+    BasicBlock *Slow = Head->splitBasicBlock(Call, "appendbuf.slow");
+    BasicBlock *Cont;
+    if (auto Invoke = dyn_cast<InvokeInst>(Call)) {
+      Cont = Invoke->getNormalDest();
+    } else {
+      Cont = Slow->splitBasicBlock(
+#if LDC_LLVM_VER >= 308
+          std::next(Call->getIterator()),
+#else
+          std::next(BasicBlock::iterator(Call)),
+#endif
+          "appendbuf.cont");
+    }
+    BasicBlock *Fast = BasicBlock::Create(Ctx, "appendbuf.fast", &F, Slow);
+
+    // Check whether the append can be done in the buffer.
+    Head->getTerminator()->eraseFromParent();
+    IRBuilder<> B(Head);
+    Value *LenPtr = CreateStructGEP(B, Buf.Array, 0);
+    Value *PtrPtr = CreateStructGEP(B, Buf.Array, 1);
+    Value *Len = B.CreateLoad(LenPtr, ".len");
+    Value *Ptr = B.CreateLoad(PtrPtr, ".ptr");
+    Value *UsedLen = B.CreateLoad(Used, ".used");
+    Value *Zero = ConstantInt::get(SizeTy, 0);
+    Value *N = B.CreateIntCast(CS.getArgument(2), SizeTy, false);
+
+    Value *AtUsedEnd = B.CreateAnd(
+        B.CreateICmpEQ(B.CreateGEP(Ptr, Len), B.CreateGEP(Stack, UsedLen)),
+        B.CreateICmpUGE(Ptr, Stack));
+    Value *IsFresh =
+        B.CreateAnd(B.CreateICmpEQ(Len, Zero), B.CreateICmpEQ(UsedLen, Zero));
+    Value *NewUsed = B.CreateAdd(UsedLen, N);
+    Value *Fits =
+        B.CreateICmpULE(NewUsed, ConstantInt::get(SizeTy, Capacity));
+    B.CreateCondBr(B.CreateAnd(B.CreateOr(AtUsedEnd, IsFresh), Fits), Fast,
+                   Slow);
+
+    // Append in place.
+    IRBuilder<> FB(Fast);
+    FB.CreateStore(FB.CreateSelect(IsFresh, Stack, Ptr), PtrPtr);
+    FB.CreateStore(FB.CreateAdd(Len, N), LenPtr);
+    FB.CreateStore(NewUsed, Used);
+    FB.CreateBr(Cont);
+
+    for (auto I = Cont->begin(); isa<PHINode>(I); ++I) {
+      auto PN = cast<PHINode>(I);
+      PN->addIncoming(PN->getIncomingValueForBlock(Slow), Fast);
+    }
+  }
+}
+
 /// runOnFunction - Top level algorithm.
 ///
 bool GarbageCollect2Stack::runOnFunction(Function &F) {
-  DEBUG(errs() << "\nRunning -dgc2stack on function " << F.getName() << '\n');
-
 #if LDC_LLVM_VER >= 307
   const DataLayout &DL = F.getParent()->getDataLayout();
   DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
@@ -483,6 +940,14 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
   CallGraphWrapperPass *CGPass = getAnalysisIfAvailable<CallGraphWrapperPass>();
   CallGraph *CG = CGPass ? &CGPass->getCallGraph() : nullptr;
 #endif
+
+  return promote(F, DL, DT, CG);
+}
+
+bool GarbageCollect2Stack::promote(Function &F, const DataLayout &DL,
+                                   DominatorTree &DT, CallGraph *CG) {
+  DEBUG(errs() << "\nRunning -dgc2stack on function " << F.getName() << '\n');
+
   CallGraphNode *CGNode = CG ? (*CG)[&F] : nullptr;
 
   Analysis A = {DL, *M, CG, CGNode};
@@ -491,6 +956,42 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
 
   IRBuilder<> AllocaBuilder(&Entry, Entry.begin());
 
+  RemarkEmitter Remarks(F);
+
+  // The stack budget of the function. Promoting allocations in recursive
+  // functions could exhaust the stack however small they are; this is
+  // determined lazily as it requires walking the call graph. A remark is
+  // emitted for rejected GC calls (not for append buffers, Call is null).
+  uint64_t PromotedSize = 0;
+  enum { RecursionUnknown, NotRecursive, IsRecursive } Recursion =
+      RecursionUnknown;
+  auto fitsStackBudget = [&](uint64_t Size, Instruction *Call,
+                             Function *Callee) {
+    if (Recursion == RecursionUnknown) {
+      Recursion = isRecursive(F, CG) ? IsRecursive : NotRecursive;
+    }
+    if (Recursion == IsRecursive) {
+      DEBUG(errs() << "Not promoting in recursive function\n");
+      NumInRecursive++;
+      if (Call) {
+        Remarks.missed(Call, "Recursive", Callee,
+                       "the function may be recursive");
+      }
+      return false;
+    }
+    if (FunctionLimit > 0 && PromotedSize + Size > FunctionLimit) {
+      DEBUG(errs() << "Stack budget exceeded (" << PromotedSize << " + " << Size
+                   << " bytes)\n");
+      NumOverBudget++;
+      if (Call) {
+        Remarks.missed(Call, "OverBudget", Callee,
+                       "the stack budget of the function is exhausted");
+      }
+      return false;
+    }
+    return true;
+  };
+
   bool Changed = false;
   for (auto &BB : F) {
     for (auto I = BB.begin(), E = BB.end(); I != E;) {
@@ -521,6 +1022,7 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
       if (Inst->use_empty()) {
         Changed = true;
         NumDeleted++;
+        Remarks.deleted(Inst, Callee);
         RemoveCall(CS, A);
         continue;
       }
@@ -528,22 +1030,31 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
       DEBUG(errs() << "GarbageCollect2Stack inspecting: " << *Inst);
 
       if (!info->analyze(CS, A)) {
+        Remarks.missed(Inst, "Unsupported", Callee, info->Reason);
+        continue;
+      }
+
+      if (!fitsStackBudget(info->MaxSize, Inst, Callee)) {
         continue;
       }
 
       SmallVector<CallInst *, 4> RemoveTailCallInsts;
-      if (info->ReturnType == ReturnType::Array) {
-        if (!isSafeToStackAllocateArray(originalI, DT, RemoveTailCallInsts)) {
-          continue;
-        }
-      } else {
-        if (!isSafeToStackAllocate(originalI, Inst, DT, RemoveTailCallInsts)) {
-          continue;
-        }
+      const bool isSafe =
+          info->ReturnType == ReturnType::Array
+              ? isSafeToStackAllocateArray(originalI, DT, RemoveTailCallInsts)
+              : isSafeToStackAllocate(originalI, Inst, DT,
+                                      RemoveTailCallInsts);
+      if (!isSafe) {
+        Remarks.missed(Inst, "Escapes", Callee,
+                       "the allocated memory may escape");
+        continue;
       }
 
+      Remarks.promoted(Inst, Callee, info->MaxSize);
+
       // Let's alloca this!
       Changed = true;
+      PromotedSize += info->MaxSize;
 
       // First demote tail calls which use the value so there IR is never
       // in an invalid state.
@@ -567,6 +1078,25 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
     }
   }
 
+  // Give the local arrays only appended to a stack buffer. This changes the
+  // CFG, so it is done last (the dominator tree isn't needed).
+  if (AppendBufferSize > 0) {
+    std::vector<AppendBuffer> Buffers;
+    findAppendBuffers(F, A, Buffers);
+    for (auto &Buf : Buffers) {
+      const uint64_t ElemSize = DL.getTypeAllocSize(Buf.ElemTy);
+      const uint64_t Capacity = ElemSize ? AppendBufferSize / ElemSize : 0;
+      if (Capacity == 0 ||
+          !fitsStackBudget(Capacity * ElemSize, nullptr, nullptr)) {
+        continue;
+      }
+
+      Changed = true;
+      PromotedSize += Capacity * ElemSize;
+      promoteAppendBuffer(Buf, Capacity);
+    }
+  }
+
   return Changed;
 }
 
@@ -800,43 +1330,120 @@ bool isSafeToStackAllocateArray(
   return true;
 }
 
-/// Returns true if the GC call passed in is safe to turn
-/// into a stack allocation. This requires that the return value does not
-/// escape from the function and no derived pointers are live at the call site
-/// (i.e. if it's in a loop then the function can't use any pointer returned
-/// from an earlier call after a new call has been made).
-///
-/// This is currently conservative where loops are involved: it can handle
-/// simple loops, but returns false if any derived pointer is used in a
-/// subsequent iteration.
+/// Returns the value of field Idx of the aggregate, looking through the
+/// aggregates passed for the analyzed parameters by the callers.
+static Value *findFieldValue(Value *Aggr, ArrayRef<unsigned> Idx,
+                             const CaptureQuery *Q) {
+  while (true) {
+    if (Value *V = FindInsertedValue(Aggr, Idx)) {
+      return V->stripPointerCasts();
+    }
+    if (!Q || !Q->Caller || Aggr != Q->Param) {
+      return nullptr;
+    }
+    Aggr = Q->CallerAggr;
+    Q = Q->Caller;
+  }
+}
+
+/// Returns the function (with a definition which cannot be overridden) called
+/// by CS, if known. Calls via the function pointer of a delegate are resolved
+/// if the delegate has been constructed in the function or a caller.
+static Function *getAnalyzableCallee(CallSite CS, const CaptureQuery &Q) {
+  Value *Callee = CS.getCalledValue()->stripPointerCasts();
+  if (auto EVI = dyn_cast<ExtractValueInst>(Callee)) {
+    Callee = findFieldValue(EVI->getAggregateOperand(), EVI->getIndices(), &Q);
+  }
+
+  auto F = dyn_cast_or_null<Function>(Callee);
+  if (!F || F->isDeclaration() ||
+#if LDC_LLVM_VER >= 309
+      F->isInterposable() ||
+#else
+      F->mayBeOverridden() ||
+#endif
+      F->arg_size() != CS.arg_size()) {
+    return nullptr;
+  }
+  return F;
+}
+
+/// Returns true if the pointer (FieldIdx < 0) or the aggregate containing the
+/// pointer in field FieldIdx (e.g., a delegate's context) may be captured by
+/// the call when passed as argument ArgNo.
+static bool mayBeCapturedByCall(CallSite CS, unsigned ArgNo, int FieldIdx,
+                                const CaptureQuery &Q,
+                                SmallVectorImpl<CalleeParam> &Path) {
+  if (FieldIdx < 0 && CS.paramHasAttr(ArgNo + 1, LLAttribute::NoCapture)) {
+    return false;
+  }
+
+  Function *F = getAnalyzableCallee(CS, Q);
+  if (!F || Q.Depth >= CalleeDepthLimit) {
+    return true;
+  }
+  if (FieldIdx < 0 && F->doesNotCapture(ArgNo + 1)) {
+    return false;
+  }
+
+  Argument *Param = &*std::next(F->arg_begin(), ArgNo);
+  if (Param->getType() != CS.getArgument(ArgNo)->getType()) {
+    return true;
+  }
+
+  // For (mutually) recursive functions, assume a pointer isn't captured by
+  // recursive calls. Aggregates are re-analyzed for each caller as their
+  // delegate function pointers may differ.
+  const CalleeParam Key(F, std::make_pair(ArgNo, FieldIdx));
+  if (std::find(Path.begin(), Path.end(), Key) != Path.end()) {
+    return FieldIdx >= 0;
+  }
+
+  CaptureQuery CalleeQ = {BasicBlock::iterator(), nullptr, nullptr, &Q,
+                          Param, CS.getArgument(ArgNo), Q.Depth + 1};
+  Path.push_back(Key);
+  const bool Captured = mayBeCaptured(Param, FieldIdx, CalleeQ, Path);
+  Path.pop_back();
+  return Captured;
+}
+
+/// Returns true if the pointer (FieldIdx < 0) or the aggregate containing the
+/// pointer in field FieldIdx may be captured, or (for the allocating function)
+/// if a derived value is live across the original allocation.
 ///
 /// Based on LLVM's PointerMayBeCaptured(), which only does escape analysis but
-/// doesn't care about loops.
-///
-/// Alloc is the actual call to the runtime function, and V is the pointer to
-/// the memory it returns (which might not be equal to Alloc in case of
-/// functions returning D arrays).
-///
-/// If the value is used in a call instruction with the tail attribute set,
-/// the attribute has to be removed before promoting the memory to the
-/// stack. The affected instructions are added to RemoveTailCallInsts. If
-/// the function returns false, these entries are meaningless.
-bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &DT,
-                           SmallVector<CallInst *, 4> &RemoveTailCallInsts) {
-  assert(isa<PointerType>(V->getType()) && "Allocated value is not a pointer?");
-
-  SmallVector<Use *, 16> Worklist;
+/// doesn't care about loops. In addition, the pointer is tracked through
+/// first-class aggregates (delegates) and into the callees it is passed to.
+static bool mayBeCaptured(Value *V, int FieldIdx, const CaptureQuery &Q,
+                          SmallVectorImpl<CalleeParam> &Path) {
+  typedef std::pair<Use *, int> TrackedUse;
+  SmallVector<TrackedUse, 16> Worklist;
   SmallSet<Use *, 16> Visited;
 
-  for (Value::use_iterator UI = V->use_begin(), UE = V->use_end(); UI != UE;
-       ++UI) {
-    Use *U = &(*UI);
-    Visited.insert(U);
-    Worklist.push_back(U);
-  }
+  auto addUses = [&](Value *Def, int Idx) {
+    for (Use &U : Def->uses()) {
+#if LDC_LLVM_VER >= 306
+      if (Visited.insert(&U).second) {
+#else
+      if (Visited.insert(&U)) {
+#endif
+        Worklist.push_back(TrackedUse(&U, Idx));
+      }
+    }
+  };
+
+  // It's not safe to stack-allocate if a derived value is live across the
+  // original allocation.
+  auto isLiveAcrossRealloc = [&](Instruction *I) {
+    return Q.DT && mayBeUsedAfterRealloc(I, Q.Alloc, *Q.DT);
+  };
+
+  addUses(V, FieldIdx);
 
   while (!Worklist.empty()) {
-    Use *U = Worklist.pop_back_val();
+    Use *U = Worklist.back().first;
+    const int Idx = Worklist.back().second;
+    Worklist.pop_back();
     Instruction *I = cast<Instruction>(U->getUser());
     V = U->get();
 
@@ -852,72 +1459,152 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &
         break;
       }
 
-      // Not captured if only passed via 'nocapture' arguments.  Note that
-      // calling a function pointer does not in itself cause the pointer to
-      // be captured.  This is a subtle point considering that (for example)
-      // the callee might return its own address.  It is analogous to saying
-      // that loading a value from a pointer does not cause the pointer to be
-      // captured, even though the loaded value might be the pointer itself
-      // (think of self-referential objects).
-      CallSite::arg_iterator B = CS.arg_begin(), E = CS.arg_end();
-      for (CallSite::arg_iterator A = B; A != E; ++A) {
-        if (A->get() == V) {
-          if (!CS.paramHasAttr(A - B + 1, LLAttribute::NoCapture)) {
-            // The parameter is not marked 'nocapture' - captured.
-            return false;
-          }
-
-          if (CS.isCall()) {
-            CallInst *CI = cast<CallInst>(I);
-            if (CI->isTailCall()) {
-              RemoveTailCallInsts.push_back(CI);
-            }
-          }
+      // Note that calling a function pointer does not in itself cause the
+      // pointer to be captured. This is a subtle point considering that (for
+      // example) the callee might return its own address. It is analogous to
+      // saying that loading a value from a pointer does not cause the pointer
+      // to be captured, even though the loaded value might be the pointer
+      // itself (think of self-referential objects).
+      if (CS.isCallee(U)) {
+        break;
+      }
+
+      if (U < CS.arg_begin() || U >= CS.arg_end()) {
+        return true;
+      }
+      const unsigned ArgNo = U - CS.arg_begin();
+
+      // The cache of the GC block info for growing arrays inline (see
+      // gen/arrays.cpp) only holds the data pointer for comparisons, and
+      // never has capacity for memory not allocated by the GC.
+      if (Function *Callee = CS.getCalledFunction()) {
+        if (Callee->getName() == "ldc.array.updateappendcache") {
+          break;
+        }
+      }
+
+      // Not captured if only passed via 'nocapture' arguments or to callees
+      // which don't capture it.
+      if (mayBeCapturedByCall(CS, ArgNo, Idx, Q, Path)) {
+        return true;
+      }
+
+      if (Q.RemoveTailCallInsts && CS.isCall()) {
+        CallInst *CI = cast<CallInst>(I);
+        if (CI->isTailCall()) {
+          Q.RemoveTailCallInsts->push_back(CI);
         }
       }
-      // Only passed via 'nocapture' arguments, or is the called function - not
-      // captured.
       break;
     }
     case Instruction::Load:
       // Loading from a pointer does not cause it to be captured.
       break;
+    case Instruction::ICmp:
+      // Comparing the pointer doesn't let it outlive the function.
+      break;
     case Instruction::Store:
       if (V == I->getOperand(0)) {
-        // Stored the pointer - it may be captured.
-        return false;
+        // Stored the pointer (or aggregate) - it may be captured.
+        return true;
       }
       // Storing to the pointee does not cause the pointer to be captured.
       break;
+    case Instruction::InsertValue: {
+      InsertValueInst *IVI = cast<InsertValueInst>(I);
+      if (IVI->getNumIndices() != 1) {
+        return true;
+      }
+      const int InsertIdx = IVI->getIndices()[0];
+      if (V == IVI->getInsertedValueOperand()) {
+        // Only track pointers directly contained in the aggregate.
+        if (Idx >= 0) {
+          return true;
+        }
+        if (isLiveAcrossRealloc(I)) {
+          return true;
+        }
+        addUses(I, InsertIdx);
+      } else if (InsertIdx != Idx) {
+        // The field containing the pointer is left intact.
+        if (isLiveAcrossRealloc(I)) {
+          return true;
+        }
+        addUses(I, Idx);
+      }
+      // Otherwise, the field containing the pointer is overwritten.
+      break;
+    }
+    case Instruction::ExtractValue: {
+      ExtractValueInst *EVI = cast<ExtractValueInst>(I);
+      if (Idx < 0 || static_cast<int>(EVI->getIndices()[0]) != Idx) {
+        // Doesn't extract the pointer (pointers are not aggregates).
+        break;
+      }
+      if (EVI->getNumIndices() != 1) {
+        return true;
+      }
+      if (isLiveAcrossRealloc(I)) {
+        return true;
+      }
+      addUses(I, -1);
+      break;
+    }
     case Instruction::BitCast:
     case Instruction::GetElementPtr:
+      // Only pointers can be cast or indexed.
+      if (Idx >= 0) {
+        return true;
+      }
+    // fall through
     case Instruction::PHI:
     case Instruction::Select:
-      // It's not safe to stack-allocate if this derived pointer is live across
-      // the original allocation.
-      if (mayBeUsedAfterRealloc(I, Alloc, DT)) {
-        return false;
+      if (isLiveAcrossRealloc(I)) {
+        return true;
       }
 
       // The original value is not captured via this if the new value isn't.
-      for (Instruction::use_iterator UI = I->use_begin(), UE = I->use_end();
-           UI != UE; ++UI) {
-        Use *U = &(*UI);
-#if LDC_LLVM_VER >= 306
-        if (Visited.insert(U).second) {
-#else
-        if (Visited.insert(U)) {
-#endif
-          Worklist.push_back(U);
-        }
-      }
+      addUses(I, Idx);
       break;
     default:
       // Something else - be conservative and say it is captured.
-      return false;
+      return true;
     }
   }
 
   // All uses examined - not captured or live across original allocation.
-  return true;
+  return false;
+}
+
+/// Returns true if the GC call passed in is safe to turn
+/// into a stack allocation. This requires that the return value does not
+/// escape from the function and no derived pointers are live at the call site
+/// (i.e. if it's in a loop then the function can't use any pointer returned
+/// from an earlier call after a new call has been made).
+///
+/// This is currently conservative where loops are involved: it can handle
+/// simple loops, but returns false if any derived pointer is used in a
+/// subsequent iteration.
+///
+/// The memory may be passed to calls via 'nocapture' arguments, or (directly
+/// or as context of a delegate, e.g. a closure frame) to callees defined in
+/// the module which are found not to capture it, such as functions only
+/// invoking the delegate.
+///
+/// Alloc is the actual call to the runtime function, and V is the pointer to
+/// the memory it returns (which might not be equal to Alloc in case of
+/// functions returning D arrays).
+///
+/// If the value is used in a call instruction with the tail attribute set,
+/// the attribute has to be removed before promoting the memory to the
+/// stack. The affected instructions are added to RemoveTailCallInsts. If
+/// the function returns false, these entries are meaningless.
+bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &DT,
+                           SmallVector<CallInst *, 4> &RemoveTailCallInsts) {
+  assert(isa<PointerType>(V->getType()) && "Allocated value is not a pointer?");
+
+  CaptureQuery Q = {Alloc, &DT, &RemoveTailCallInsts, nullptr, nullptr,
+                    nullptr, 0};
+  SmallVector<CalleeParam, 4> Path;
+  return !mayBeCaptured(V, -1, Q, Path);
 }
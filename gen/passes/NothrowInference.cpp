@@ -0,0 +1,190 @@
+//===-- NothrowInference.cpp - Infer nounwind for defined functions -------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Many D functions can't throw without being annotated nothrow, so calls to
+// them inside a try block or with active cleanups are emitted as invokes. This
+// pass infers nounwind bottom-up over the strongly connected components of
+// the call graph: a function can't unwind if it only calls functions which
+// can't either. The invokes of nounwind functions are then turned into plain
+// calls, and the landing pads which became unreachable are removed.
+//
+// Note that D's nothrow is not used for this, as Errors may still be thrown by
+// nothrow functions.
+//
+// The legacy pass manager pipeline already does this with the PruneEH pass;
+// the new pass manager has no equivalent yet.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "infer-nounwind"
+
+#include "Passes.h"
+
+#include "llvm/Pass.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+STATISTIC(NumNoUnwind, "Number of functions inferred as nounwind");
+STATISTIC(NumInvokesConverted, "Number of invokes turned into calls");
+
+namespace {
+bool hasExactDefinition(const Function *F) {
+#if LDC_LLVM_VER >= 309
+  return F && !F->isDeclaration() && !F->isInterposable();
+#else
+  return F && !F->isDeclaration() && !F->mayBeOverridden();
+#endif
+}
+
+/// Returns whether an instruction of F may unwind, assuming the functions of
+/// its SCC don't.
+bool mayUnwind(Function &F, const SmallPtrSetImpl<Function *> &SCC) {
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (!I.mayThrow()) {
+        continue;
+      }
+      if (auto CI = dyn_cast<CallInst>(&I)) {
+        if (SCC.count(CI->getCalledFunction())) {
+          continue;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool inferNoUnwind(CallGraph &CG) {
+  bool Changed = false;
+  // The SCCs are visited bottom-up, i.e., callees first.
+  for (auto I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+    SmallPtrSet<Function *, 8> SCC;
+    bool Inferable = true;
+    for (CallGraphNode *Node : *I) {
+      Function *F = Node->getFunction();
+      if (!hasExactDefinition(F)) {
+        Inferable = false;
+        break;
+      }
+      SCC.insert(F);
+    }
+    if (!Inferable) {
+      continue;
+    }
+
+    bool AllNoUnwind = true;
+    for (Function *F : SCC) {
+      if (!F->doesNotThrow()) {
+        AllNoUnwind = false;
+        if (mayUnwind(*F, SCC)) {
+          Inferable = false;
+          break;
+        }
+      }
+    }
+    if (!Inferable || AllNoUnwind) {
+      continue;
+    }
+
+    for (Function *F : SCC) {
+      if (!F->doesNotThrow()) {
+        DEBUG(errs() << "Inferred nounwind: " << F->getName() << '\n');
+        F->setDoesNotThrow();
+        ++NumNoUnwind;
+      }
+    }
+    Changed = true;
+  }
+  return Changed;
+}
+
+void changeToCall(InvokeInst *II) {
+  CallSite CS(II);
+  SmallVector<Value *, 8> Args(CS.arg_begin(), CS.arg_end());
+#if LDC_LLVM_VER >= 308
+  SmallVector<OperandBundleDef, 1> Bundles;
+  II->getOperandBundlesAsDefs(Bundles);
+  CallInst *Call =
+      CallInst::Create(II->getCalledValue(), Args, Bundles, "", II);
+#else
+  CallInst *Call = CallInst::Create(II->getCalledValue(), Args, "", II);
+#endif
+  Call->takeName(II);
+  Call->setCallingConv(II->getCallingConv());
+  Call->setAttributes(II->getAttributes());
+  Call->setDebugLoc(II->getDebugLoc());
+  II->replaceAllUsesWith(Call);
+
+  BranchInst::Create(II->getNormalDest(), II);
+  II->getUnwindDest()->removePredecessor(II->getParent());
+  II->eraseFromParent();
+}
+
+bool convertInvokes(Module &M) {
+  bool Changed = false;
+  for (auto &F : M) {
+    bool FChanged = false;
+    for (auto &BB : F) {
+      auto II = dyn_cast<InvokeInst>(BB.getTerminator());
+      if (II && II->doesNotThrow()) {
+        changeToCall(II);
+        ++NumInvokesConverted;
+        FChanged = true;
+      }
+    }
+    if (FChanged) {
+      removeUnreachableBlocks(F);
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+bool runNothrowInference(Module &M) {
+  CallGraph CG(M);
+  bool Changed = inferNoUnwind(CG);
+  return convertInvokes(M) || Changed;
+}
+
+struct LLVM_LIBRARY_VISIBILITY NothrowInference : public ModulePass {
+  static char ID; // Pass identification
+  NothrowInference() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override { return runNothrowInference(M); }
+};
+}
+
+char NothrowInference::ID = 0;
+static RegisterPass<NothrowInference>
+    X("infer-nounwind",
+      "Infer nounwind for functions and turn invokes of them into calls");
+
+ModulePass *createNothrowInferencePass() { return new NothrowInference(); }
+
+#if LDC_LLVM_VER >= 400
+PreservedAnalyses NothrowInferencePass::run(Module &M,
+                                            ModuleAnalysisManager &) {
+  return runNothrowInference(M) ? PreservedAnalyses::none()
+                                : PreservedAnalyses::all();
+}
+#endif
@@ -15,8 +15,12 @@
 #define LDC_PASSES_H
 
 #include "gen/metadata.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/IR/PassManager.h"
+#endif
 namespace llvm {
 class FunctionPass;
+class ImmutablePass;
 class ModulePass;
 }
 
@@ -27,4 +31,64 @@ llvm::FunctionPass *createGarbageCollect2Stack();
 
 llvm::ModulePass *createStripExternalsPass();
 
+// Clones functions calling a delegate parameter for delegate literal arguments.
+llvm::ModulePass *createDelegateSpecializationPass();
+
+// Infers nounwind bottom-up over the call graph and turns invokes of nounwind
+// functions into calls.
+llvm::ModulePass *createNothrowInferencePass();
+
+// Removes and hoists array bounds checks (the latter by versioning loops).
+llvm::FunctionPass *createBoundsCheckElimination(bool allowVersioning = true);
+
+#if LDC_LLVM_VER >= 309
+// Makes use of immutable parameters in alias analysis queries.
+llvm::ImmutablePass *createDAliasAnalysisPass();
+#endif
+
+#if LDC_LLVM_VER >= 400
+// The passes for the new pass manager.
+namespace llvm {
+class AAManager;
+}
+
+struct SimplifyDRuntimeCallsPass
+    : llvm::PassInfoMixin<SimplifyDRuntimeCallsPass> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+};
+
+struct GarbageCollect2StackPass
+    : llvm::PassInfoMixin<GarbageCollect2StackPass> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+};
+
+struct StripExternalsPass : llvm::PassInfoMixin<StripExternalsPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+struct DelegateSpecializationPass
+    : llvm::PassInfoMixin<DelegateSpecializationPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+struct NothrowInferencePass : llvm::PassInfoMixin<NothrowInferencePass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+struct BoundsCheckEliminationPass
+    : llvm::PassInfoMixin<BoundsCheckEliminationPass> {
+  bool AllowVersioning;
+  explicit BoundsCheckEliminationPass(bool allowVersioning = true)
+      : AllowVersioning(allowVersioning) {}
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+};
+
+// Adds the D alias analysis to the given alias analysis pipeline.
+void registerDAliasAnalysis(llvm::FunctionAnalysisManager &FAM,
+                            llvm::AAManager &AA);
+#endif
+
 #endif
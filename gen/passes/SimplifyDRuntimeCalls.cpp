@@ -18,21 +18,27 @@
 
 #include "Passes.h"
 #include "llvm/Pass.h"
-#if LDC_LLVM_VER >= 307
 #include "llvm/IR/Module.h"
-#endif
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/ValueTracking.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#endif
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "globals.h"
 #include "gen/runtime.h"
+#include <algorithm>
 
 using namespace llvm;
 
@@ -215,6 +221,12 @@ struct LLVM_LIBRARY_VISIBILITY ArrayCastLenOpt : public LibCallOptimization {
 
 /// AllocationOpt - Common optimizations for various GC allocations.
 struct LLVM_LIBRARY_VISIBILITY AllocationOpt : public LibCallOptimization {
+  static bool isNewArrayWithLength(Function *Callee) {
+    return StringSwitch<bool>(Callee->getName())
+        .Cases("_d_newarrayT", "_d_newarrayiT", "_d_newarrayU", true)
+        .Default(false);
+  }
+
   Value *CallOptimizer(Function *Callee, CallInst *CI,
                        IRBuilder<> &B) override {
     // Allocations are never equal to constants, so remove any equality
@@ -246,6 +258,21 @@ struct LLVM_LIBRARY_VISIBILITY AllocationOpt : public LibCallOptimization {
       }
     }
 
+    // The length of a new array is the requested one, which helps to match
+    // it with the length of the slice it is initialized from.
+    if (isNewArrayWithLength(Callee)) {
+      Value *Length = CI->getArgOperand(1);
+      for (auto I = CI->user_begin(), E = CI->user_end(); I != E;) {
+        auto EVI = dyn_cast<ExtractValueInst>(*I++);
+        if (EVI && EVI->getNumIndices() == 1 && EVI->getIndices()[0] == 0 &&
+            EVI->getType() == Length->getType() && !EVI->use_empty()) {
+          // Don't delete the extractvalue, there may be an iterator to it.
+          EVI->replaceAllUsesWith(Length);
+          *Changed = true;
+        }
+      }
+    }
+
     // If it's not used (anymore), pre-emptively GC it.
     if (CI->use_empty()) {
       return CI;
@@ -272,31 +299,287 @@ struct LLVM_LIBRARY_VISIBILITY ArraySliceCopyOpt : public LibCallOptimization {
     Value *Size = CI->getOperand(1);
 
     // Check the lengths match
-    if (CI->getOperand(3) != Size) {
+    if (!isSameValue(CI->getOperand(3), Size)) {
       return nullptr;
     }
 
-    // Assume unknown size unless we have constant size (that fits in an uint)
-    unsigned Sz = ~0U;
-    if (ConstantInt *Int = dyn_cast<ConstantInt>(Size)) {
-      if (Int->getValue().isIntN(32)) {
-        Sz = Int->getValue().getZExtValue();
-      }
-    }
+    Value *Dst = CI->getOperand(0);
+    Value *Src = CI->getOperand(2);
 
     // Check if the pointers may alias
-    if (AA->alias(CI->getOperand(0), Sz, CI->getOperand(2), Sz)) {
-      return nullptr;
+    if (!DL || !isDistinctAllocation(Dst, Src)) {
+#if LDC_LLVM_VER >= 307
+      uint64_t Sz = MemoryLocation::UnknownSize;
+#else
+      uint64_t Sz = AliasAnalysis::UnknownSize;
+#endif
+      if (ConstantInt *Int = dyn_cast<ConstantInt>(Size)) {
+        Sz = Int->getZExtValue();
+      }
+      if (AA->alias(Dst, Sz, Src, Sz)) {
+        return nullptr;
+      }
     }
 
     // Equal length and the pointers definitely don't alias, so it's safe to
     // replace the call with memcpy
-    return EmitMemCpy(CI->getOperand(0), CI->getOperand(2), Size, 1, B);
+    unsigned Align = 1;
+    if (DL) {
+#if LDC_LLVM_VER >= 307
+      Align =
+          std::min(getKnownAlignment(Dst, *DL), getKnownAlignment(Src, *DL));
+#else
+      Align = std::min(getKnownAlignment(Dst, DL), getKnownAlignment(Src, DL));
+#endif
+    }
+    return EmitMemCpy(Dst, Src, Size, std::max(Align, 1u), B);
+  }
+
+private:
+  /// Returns whether A and B are the same value or computed the same (the
+  /// sizes are usually products of the array length and the element size).
+  static bool isSameValue(Value *A, Value *B) {
+    if (A == B) {
+      return true;
+    }
+    auto BinA = dyn_cast<BinaryOperator>(A);
+    auto BinB = dyn_cast<BinaryOperator>(B);
+    return BinA && BinB && BinA->isIdenticalTo(BinB);
+  }
+
+  /// Returns the runtime call V is the data pointer of the result of, if the
+  /// call always returns a newly allocated array.
+  static CallInst *getNewArrayCall(Value *V) {
+    auto EVI = dyn_cast<ExtractValueInst>(V);
+    if (!EVI || EVI->getNumIndices() != 1 || EVI->getIndices()[0] != 1) {
+      return nullptr;
+    }
+    auto Call = dyn_cast<CallInst>(EVI->getAggregateOperand());
+    if (!Call || !Call->getCalledFunction()) {
+      return nullptr;
+    }
+    return StringSwitch<bool>(Call->getCalledFunction()->getName())
+                   .Cases("_d_newarrayT", "_d_newarrayiT", "_d_newarrayU", true)
+                   .Cases("_d_newarraymTX", "_d_newarraymiTX", true)
+                   .Default(false)
+               ? Call
+               : nullptr;
+  }
+
+  Value *getUnderlyingObject(Value *V) {
+#if LDC_LLVM_VER >= 307
+    return GetUnderlyingObject(V, *DL);
+#else
+    return GetUnderlyingObject(V, DL);
+#endif
+  }
+
+  /// Returns whether the memory pointed to by A and B is known to be part of
+  /// different allocations, one of them being an array allocated by the
+  /// runtime in this function (which alias analysis doesn't know about, as
+  /// the pointer is part of the returned slice).
+  bool isDistinctAllocation(Value *A, Value *B) {
+    Value *ObjA = getUnderlyingObject(A);
+    Value *ObjB = getUnderlyingObject(B);
+    CallInst *NewA = getNewArrayCall(ObjA);
+    CallInst *NewB = getNewArrayCall(ObjB);
+    if (NewA && NewB) {
+      return NewA != NewB;
+    }
+    if (!NewA && !NewB) {
+      return false;
+    }
+    // The other pointer is either a different identified object or a
+    // parameter (which cannot point to memory allocated during the call).
+    Value *Other = NewA ? ObjB : ObjA;
+    return isIdentifiedObject(Other) || isa<Argument>(Other);
   }
 };
 
 // TODO: More optimizations! :)
 
+
+//===---------------------------------------===//
+// '_d_arrayappendT' Optimizations
+
+/// Returns the LLVM type of the D type described by a TypeInfo, and whether
+/// copying it runs a postblit, as recorded in the TypeInfo metadata.
+static Type *getTypeForTypeInfo(Module &M, Value *TI, bool &HasPostblit) {
+  auto TIGlobal = dyn_cast<GlobalVariable>(TI->stripPointerCasts());
+  if (!TIGlobal) {
+    return nullptr;
+  }
+
+  std::string MetaName = TD_PREFIX;
+  MetaName += TIGlobal->getName();
+  NamedMDNode *Meta = M.getNamedMetadata(MetaName);
+  if (!Meta || Meta->getNumOperands() == 0) {
+    return nullptr;
+  }
+
+  MDNode *Node = static_cast<MDNode *>(Meta->getOperand(0));
+  if (!Node || Node->getNumOperands() != TD_NumFields) {
+    return nullptr;
+  }
+
+#if LDC_LLVM_VER >= 306
+  auto Postblit =
+      mdconst::dyn_extract<ConstantInt>(Node->getOperand(TD_Postblit));
+  auto TypeMD = dyn_cast<ConstantAsMetadata>(Node->getOperand(TD_Type));
+  if (!Postblit || !TypeMD) {
+    return nullptr;
+  }
+  HasPostblit = !Postblit->isZero();
+  return TypeMD->getValue()->getType();
+#else
+  auto Postblit = dyn_cast<ConstantInt>(Node->getOperand(TD_Postblit));
+  if (!Postblit) {
+    return nullptr;
+  }
+  HasPostblit = !Postblit->isZero();
+  return Node->getOperand(TD_Type)->getType();
+#endif
+}
+
+/// ArrayAppendFusionOpt - Fuse a sequence of array appends to the same array,
+/// "s ~= a; s ~= b; s ~= c;", into a single _d_arrayappendcTX reserving the
+/// space for all of them, followed by a memcpy per appended slice.
+struct LLVM_LIBRARY_VISIBILITY ArrayAppendFusionOpt
+    : public LibCallOptimization {
+  /// Returns whether Next appends to the same array as CI.
+  static bool isSameAppend(const CallInst *CI, const Instruction *Next) {
+    auto NextCI = dyn_cast<CallInst>(Next);
+    return NextCI && NextCI->getCalledFunction() == CI->getCalledFunction() &&
+           NextCI->getArgOperand(0) == CI->getArgOperand(0) &&
+           NextCI->getArgOperand(1)->stripPointerCasts() ==
+               CI->getArgOperand(1)->stripPointerCasts();
+  }
+
+  /// Returns the next append to the same array following CI in its block,
+  /// if nothing in between accesses memory.
+  static CallInst *getNextAppend(CallInst *CI) {
+    for (auto I = std::next(BasicBlock::iterator(CI)),
+              E = CI->getParent()->end();
+         I != E; ++I) {
+      if (isSameAppend(CI, &*I)) {
+        return cast<CallInst>(&*I);
+      }
+      if (I->mayReadOrWriteMemory()) {
+        return nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Returns the previous unused append to the same array preceding CI in its
+  /// block, if nothing in between accesses memory.
+  static CallInst *getPrevAppend(CallInst *CI) {
+    for (auto I = BasicBlock::iterator(CI), B = CI->getParent()->begin();
+         I != B;) {
+      --I;
+      if (isSameAppend(CI, &*I)) {
+        return I->use_empty() ? cast<CallInst>(&*I) : nullptr;
+      }
+      if (I->mayReadOrWriteMemory()) {
+        return nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  Value *CallOptimizer(Function *Callee, CallInst *CI,
+                       IRBuilder<> &B) override {
+    // Verify we have a reasonable prototype for _d_arrayappendT
+    const FunctionType *FT = Callee->getFunctionType();
+    if (Callee->arg_size() != 3 || !isa<StructType>(FT->getReturnType()) ||
+        !isa<PointerType>(FT->getParamType(1)) ||
+        FT->getParamType(2) != FT->getReturnType() || !DL) {
+      return nullptr;
+    }
+
+    // Only the last append of a sequence triggers the fusion, so that the
+    // preceding ones (which are erased) are behind the iterator of the caller.
+    if (getNextAppend(CI)) {
+      return nullptr;
+    }
+    SmallVector<CallInst *, 4> Appends;
+    for (CallInst *Prev = getPrevAppend(CI); Prev; Prev = getPrevAppend(Prev)) {
+      Appends.push_back(Prev);
+    }
+    if (Appends.empty()) {
+      return nullptr;
+    }
+    std::reverse(Appends.begin(), Appends.end());
+    Appends.push_back(CI);
+
+    // The TypeInfo is the one of the array type; we need its element size.
+    Module *M = Caller->getParent();
+    // _d_arrayappendT runs the postblit of the appended elements, the
+    // memcpys of the fused version wouldn't.
+    bool HasPostblit = true;
+    auto ArrTy = dyn_cast_or_null<StructType>(
+        getTypeForTypeInfo(*M, CI->getOperand(0), HasPostblit));
+    if (!ArrTy || HasPostblit || ArrTy->getNumElements() != 2 ||
+        !isa<PointerType>(ArrTy->getElementType(1))) {
+      return nullptr;
+    }
+    Type *ElemTy =
+        cast<PointerType>(ArrTy->getElementType(1))->getElementType();
+    if (!ElemTy->isSized()) {
+      return nullptr;
+    }
+    const uint64_t ElemSize = DL->getTypeAllocSize(ElemTy);
+    Type *SizeTy = DL->getIntPtrType(*Context);
+    if (ElemSize == 0 ||
+        FT->getReturnType()->getStructElementType(0) != SizeTy) {
+      return nullptr;
+    }
+
+    Function *AppendFn = M->getFunction("_d_arrayappendcTX");
+    if (!AppendFn) {
+      AppendFn = getRuntimeFunction(Loc(), *M, "_d_arrayappendcTX");
+    }
+    FunctionType *AppendFT = AppendFn->getFunctionType();
+    if (AppendFT->getNumParams() != 3 ||
+        AppendFT->getReturnType() != FT->getReturnType()) {
+      return nullptr;
+    }
+
+    // Reserve the space for all appended slices at once.
+    SmallVector<Value *, 4> Lengths;
+    Value *Total = nullptr;
+    for (CallInst *Append : Appends) {
+      Value *Len = B.CreateExtractValue(Append->getOperand(2), 0);
+      Lengths.push_back(Len);
+      Total = Total ? B.CreateAdd(Total, Len) : Len;
+    }
+    Value *NewArr = B.CreateCall(
+        AppendFn,
+        {B.CreatePointerCast(CI->getOperand(0), AppendFT->getParamType(0)),
+         B.CreatePointerCast(CI->getOperand(1), AppendFT->getParamType(1)),
+         Total},
+        ".appendedArray");
+
+    // Copy the slices to the end of the new array.
+    Value *NewLen = B.CreateExtractValue(NewArr, 0);
+    Value *NewPtr = B.CreateExtractValue(NewArr, 1);
+    Value *Offset = B.CreateMul(B.CreateSub(NewLen, Total),
+                                ConstantInt::get(SizeTy, ElemSize));
+    const unsigned Align = DL->getABITypeAlignment(ElemTy);
+    for (size_t i = 0, e = Appends.size(); i != e; ++i) {
+      Value *Size = B.CreateMul(Lengths[i], ConstantInt::get(SizeTy, ElemSize));
+      EmitMemCpy(B.CreateGEP(NewPtr, Offset),
+                 B.CreateExtractValue(Appends[i]->getOperand(2), 1), Size,
+                 Align, B);
+      Offset = B.CreateAdd(Offset, Size);
+    }
+
+    for (size_t i = 0, e = Appends.size() - 1; i != e; ++i) {
+      Appends[i]->eraseFromParent();
+    }
+    return NewArr;
+  }
+};
 } // end anonymous namespace.
 
 //===----------------------------------------------------------------------===//
@@ -304,6 +587,37 @@ struct LLVM_LIBRARY_VISIBILITY ArraySliceCopyOpt : public LibCallOptimization {
 //===----------------------------------------------------------------------===//
 
 namespace {
+/// Reports the simplified calls and the ones which couldn't be simplified as
+/// optimization remarks (LLVM >= 4.0), shown by
+/// -pass-remarks[-missed]=simplify-drtcalls and saved by
+/// -fsave-optimization-record.
+class RemarkEmitter {
+#if LDC_LLVM_VER >= 400
+  OptimizationRemarkEmitter ORE;
+
+public:
+  explicit RemarkEmitter(Function &F) : ORE(&F) {}
+
+  void simplified(CallInst *CI, bool deleted) {
+    ORE.emit(OptimizationRemark(DEBUG_TYPE, deleted ? "Deleted" : "Simplified",
+                                CI)
+             << (deleted ? "deleted unused call to " : "simplified call to ")
+             << ore::NV("Callee", CI->getCalledFunction()));
+  }
+
+  void missed(CallInst *CI) {
+    ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "NotSimplified", CI)
+             << "call to " << ore::NV("Callee", CI->getCalledFunction())
+             << " not simplified");
+  }
+#else
+public:
+  explicit RemarkEmitter(Function &) {}
+  void simplified(CallInst *, bool) {}
+  void missed(CallInst *) {}
+#endif
+};
+
 /// This pass optimizes library functions from the D runtime as used by LDC.
 ///
 class LLVM_LIBRARY_VISIBILITY SimplifyDRuntimeCalls : public FunctionPass {
@@ -313,6 +627,7 @@ class LLVM_LIBRARY_VISIBILITY SimplifyDRuntimeCalls : public FunctionPass {
   ArraySetLengthOpt ArraySetLength;
   ArrayCastLenOpt ArrayCastLen;
   ArraySliceCopyOpt ArraySliceCopy;
+  ArrayAppendFusionOpt ArrayAppendFusion;
 
   // GC allocations
   AllocationOpt Allocation;
@@ -324,7 +639,13 @@ public:
   void InitOptimizations();
   bool runOnFunction(Function &F) override;
 
-  bool runOnce(Function &F, const DataLayout *DL, AliasAnalysisPass &AA);
+  /// Shared by the legacy and the new pass manager.
+  bool simplify(Function &F, const DataLayout *DL, AliasAnalysis &AA);
+
+  /// Collects the calls it couldn't simplify in Unsimplified.
+  bool runOnce(Function &F, const DataLayout *DL, AliasAnalysis &AA,
+               RemarkEmitter &Remarks,
+               SmallVectorImpl<CallInst *> &Unsimplified);
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
 #if LDC_LLVM_VER >= 307
@@ -346,6 +667,18 @@ FunctionPass *createSimplifyDRuntimeCalls() {
   return new SimplifyDRuntimeCalls();
 }
 
+#if LDC_LLVM_VER >= 400
+PreservedAnalyses SimplifyDRuntimeCallsPass::run(Function &F,
+                                                 FunctionAnalysisManager &AM) {
+  SimplifyDRuntimeCalls Impl;
+  if (!Impl.simplify(F, &F.getParent()->getDataLayout(),
+                     AM.getResult<AAManager>(F))) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+#endif
+
 /// Optimizations - Populate the Optimizations map with all the optimizations
 /// we know.
 void SimplifyDRuntimeCalls::InitOptimizations() {
@@ -354,6 +687,7 @@ void SimplifyDRuntimeCalls::InitOptimizations() {
   Optimizations["_d_arraysetlengthiT"] = &ArraySetLength;
   Optimizations["_d_array_cast_len"] = &ArrayCastLen;
   Optimizations["_d_array_slice_copy"] = &ArraySliceCopy;
+  Optimizations["_d_arrayappendT"] = &ArrayAppendFusion;
 
   /* Delete calls to runtime functions which aren't needed if their result is
    * unused. That comes down to functions that don't do anything but
@@ -373,40 +707,59 @@ void SimplifyDRuntimeCalls::InitOptimizations() {
   Optimizations["_d_newarraymvT"] = &Allocation;
   Optimizations["_d_newclass"] = &Allocation;
   Optimizations["_d_allocclass"] = &Allocation;
+  Optimizations["gc_malloc"] = &Allocation;
 }
 
 /// runOnFunction - Top level algorithm.
 ///
 bool SimplifyDRuntimeCalls::runOnFunction(Function &F) {
-  if (Optimizations.empty()) {
-    InitOptimizations();
-  }
-
 #if LDC_LLVM_VER >= 307
   const DataLayout *DL = &F.getParent()->getDataLayout();
 #else
   DataLayoutPass *DLP = getAnalysisIfAvailable<DataLayoutPass>();
   const DataLayout *DL = DLP ? &DLP->getDataLayout() : nullptr;
 #endif
-  AliasAnalysisPass &AA = getAnalysis<AliasAnalysisPass>();
+#if LDC_LLVM_VER >= 308
+  AliasAnalysis &AA = getAnalysis<AliasAnalysisPass>().getAAResults();
+#else
+  AliasAnalysis &AA = getAnalysis<AliasAnalysisPass>();
+#endif
+
+  return simplify(F, DL, AA);
+}
+
+bool SimplifyDRuntimeCalls::simplify(Function &F, const DataLayout *DL,
+                                     AliasAnalysis &AA) {
+  if (Optimizations.empty()) {
+    InitOptimizations();
+  }
 
   // Iterate to catch opportunities opened up by other optimizations,
   // such as calls that are only used as arguments to unused calls:
   // When the second call gets deleted the first call will become unused, but
   // without iteration we wouldn't notice if we inspected the first call
   // before the second one.
+  RemarkEmitter Remarks(F);
+  SmallVector<CallInst *, 8> Unsimplified;
   bool EverChanged = false;
   bool Changed;
   do {
-    Changed = runOnce(F, DL, AA);
+    Unsimplified.clear();
+    Changed = runOnce(F, DL, AA, Remarks, Unsimplified);
     EverChanged |= Changed;
   } while (Changed);
 
+  // The last iteration didn't change anything, so its calls are still there.
+  for (auto CI : Unsimplified) {
+    Remarks.missed(CI);
+  }
+
   return EverChanged;
 }
 
-bool SimplifyDRuntimeCalls::runOnce(Function &F, const DataLayout *DL,
-                                    AliasAnalysisPass &AAP) {
+bool SimplifyDRuntimeCalls::runOnce(
+    Function &F, const DataLayout *DL, AliasAnalysis &AA,
+    RemarkEmitter &Remarks, SmallVectorImpl<CallInst *> &Unsimplified) {
   IRBuilder<> Builder(F.getContext());
 
   bool Changed = false;
@@ -439,14 +792,10 @@ bool SimplifyDRuntimeCalls::runOnce(Function &F, const DataLayout *DL,
       --ciIt;
       Builder.SetInsertPoint(&BB, I);
 
-#if LDC_LLVM_VER >= 308
-      AliasAnalysis &AA = AAP.getAAResults();
-#else
-      AliasAnalysis &AA = AAP;
-#endif
       // Try to optimize this call.
       Value *Result = OMI->second->OptimizeCall(CI, Changed, DL, AA, Builder);
       if (Result == nullptr) {
+        Unsimplified.push_back(CI);
         continue;
       }
 
@@ -455,6 +804,7 @@ bool SimplifyDRuntimeCalls::runOnce(Function &F, const DataLayout *DL,
 
       // Something changed!
       Changed = true;
+      Remarks.simplified(CI, Result == CI);
 
       if (Result == CI) {
         assert(CI->use_empty());
@@ -47,6 +47,14 @@ static RegisterPass<StripExternals>
 
 ModulePass *createStripExternalsPass() { return new StripExternals(); }
 
+#if LDC_LLVM_VER >= 400
+PreservedAnalyses StripExternalsPass::run(Module &M, ModuleAnalysisManager &) {
+  StripExternals Impl;
+  return Impl.runOnModule(M) ? PreservedAnalyses::none()
+                             : PreservedAnalyses::all();
+}
+#endif
+
 bool StripExternals::runOnModule(Module &M) {
   bool Changed = false;
 
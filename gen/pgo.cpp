@@ -21,6 +21,7 @@
 #include "init.h"
 #include "statement.h"
 #include "llvm.h"
+#include "driver/cl_options.h"
 #include "gen/cl_helpers.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
@@ -43,6 +44,49 @@ llvm::cl::opt<bool, false, opts::FlagParser<bool>> enablePGOIndirectCalls(
 }
 #endif
 
+namespace {
+llvm::cl::opt<bool, false, opts::FlagParser<bool>> useStaleEntryCounts(
+    "pgo-stale-entry-counts",
+    llvm::cl::desc("(*) Use the entry counts of functions whose profile data "
+                   "is stale (control-flow hash mismatch)"),
+    llvm::cl::init(true), llvm::cl::Hidden);
+
+llvm::cl::opt<bool> reportProfileMatching(
+    "pgo-report",
+    llvm::cl::desc("Report how many functions matched the profile data"),
+    llvm::cl::Hidden);
+
+/// How the profile data of the functions of the current module matched.
+struct ProfileMatchStats {
+  unsigned matched = 0; // hash matched, all counts used
+  unsigned stale = 0;   // hash mismatch, only the entry count used
+  unsigned dropped = 0; // hash mismatch or malformed, nothing used
+  unsigned missing = 0; // no profile data for the function name
+};
+ProfileMatchStats matchStats;
+
+/// Returns the largest entry count of the profile records for `FuncName`,
+/// regardless of their control-flow hashes.
+llvm::Optional<uint64_t> getStaleEntryCount(llvm::StringRef FuncName) {
+  auto &EntryCounts = gIR->PGOEntryCounts;
+  if (!EntryCounts) {
+    // The reader doesn't offer a lookup by name only, so read all records.
+    EntryCounts = llvm::make_unique<llvm::StringMap<uint64_t>>();
+    for (const auto &Record : *gIR->getPGOReader()) {
+      if (Record.Counts.empty())
+        continue;
+      uint64_t &Count = (*EntryCounts)[Record.Name];
+      Count = std::max(Count, Record.Counts[0]);
+    }
+  }
+
+  auto It = EntryCounts->find(FuncName);
+  if (It == EntryCounts->end())
+    return llvm::None;
+  return It->second;
+}
+}
+
 /// \brief Stable hasher for PGO region counters.
 ///
 /// PGOHash produces a stable hash of a given function's control flow.
@@ -843,6 +887,10 @@ void CodeGenPGO::assignRegionCounters(const FuncDeclaration *D,
   if (!global.params.genInstrProf && !PGOReader)
     return;
 
+  // The instrumentation is done by the optimizer then.
+  if (opts::instrProfIRLevel)
+    return;
+
   emitInstrumentation = D->emitInstrumentation;
   setFuncName(fn);
 
@@ -874,11 +922,50 @@ void CodeGenPGO::computeRegionCounts(const FuncDeclaration *FD) {
 
 /// Apply attributes to llvm::Function based on profiling data.
 void CodeGenPGO::applyFunctionAttributes(llvm::Function *Fn) {
-  if (!haveRegionCounts())
+  uint64_t FunctionCount;
+  if (haveRegionCounts())
+    FunctionCount = getRegionCount(nullptr);
+  else if (StaleEntryCount)
+    FunctionCount = *StaleEntryCount;
+  else
     return;
 
-  uint64_t FunctionCount = getRegionCount(nullptr);
   Fn->setEntryCount(FunctionCount);
+
+  // Mark the hot and cold functions (relative to the hottest one of the
+  // program), and place them in the .text.hot/.text.unlikely sections on ELF
+  // targets, so that the hot code is kept together.
+  const char *SectionPrefix = "";
+  uint64_t MaxFunctionCount = gIR->getPGOReader()->getMaximumFunctionCount();
+  if (MaxFunctionCount > 0) {
+    if (FunctionCount >= static_cast<uint64_t>(0.3 * MaxFunctionCount)) {
+      Fn->addFnAttr(llvm::Attribute::InlineHint);
+      SectionPrefix = ".hot";
+    } else if (FunctionCount <=
+               static_cast<uint64_t>(0.01 * MaxFunctionCount)) {
+      Fn->addFnAttr(llvm::Attribute::Cold);
+      SectionPrefix = ".unlikely";
+    }
+  }
+  if (*SectionPrefix == 0 || Fn->hasSection() ||
+      !global.params.targetTriple->isOSBinFormatELF()) {
+    SectionPrefix = "";
+  } else {
+#if LDC_LLVM_VER >= 400
+    // Like the function section names, the section name is then chosen by
+    // the backend.
+    Fn->setSectionPrefix(SectionPrefix);
+#else
+    Fn->setSection((llvm::Twine(".text") + SectionPrefix + "." + Fn->getName())
+                       .str());
+#endif
+  }
+
+  if (FunctionCount > 0) {
+    getProfiledFunctionEntryCounts().emplace_back(
+        (llvm::Twine(".text") + SectionPrefix + "." + Fn->getName()).str(),
+        FunctionCount);
+  }
 }
 
 void CodeGenPGO::emitCounterIncrement(const RootObject *S) const {
@@ -900,6 +987,7 @@ void CodeGenPGO::emitCounterIncrement(const RootObject *S) const {
 void CodeGenPGO::loadRegionCounts(llvm::IndexedInstrProfReader *PGOReader,
                                   const FuncDeclaration *fd) {
   RegionCounts.clear();
+  StaleEntryCount.reset();
 
 #if LDC_LLVM_VER >= 309
   llvm::Expected<llvm::InstrProfRecord> RecordExpected =
@@ -920,6 +1008,21 @@ void CodeGenPGO::loadRegionCounts(llvm::IndexedInstrProfReader *PGOReader,
                              FuncName.c_str());
       // Don't output a compiler warning when profile data is missing for a
       // function, because it could be intentional.
+      ++matchStats.missing;
+    } else if (IPE == llvm::instrprof_error::hash_mismatch &&
+               useStaleEntryCounts &&
+               (StaleEntryCount = getStaleEntryCount(FuncName))) {
+      // The function has changed since the profile was recorded, so the
+      // region counts can't be mapped to the statements anymore. How often it
+      // is called is still a good estimate though.
+      IF_LOG Logger::println(
+          "Using entry count of stale profile data for function: %s",
+          FuncName.c_str());
+      warning(fd->loc, "Using only the entry count of the stale profile data "
+                       "for function '%s' ('%s'): control-flow hash mismatch",
+              const_cast<FuncDeclaration *>(fd)->toPrettyChars(),
+              FuncName.c_str());
+      ++matchStats.stale;
     } else if (IPE == llvm::instrprof_error::hash_mismatch) {
       IF_LOG Logger::println(
           "Ignoring profile data: hash mismatch for function: %s",
@@ -928,6 +1031,7 @@ void CodeGenPGO::loadRegionCounts(llvm::IndexedInstrProfReader *PGOReader,
                        "control-flow hash mismatch",
               const_cast<FuncDeclaration *>(fd)->toPrettyChars(),
               FuncName.c_str());
+      ++matchStats.dropped;
     } else if (IPE == llvm::instrprof_error::malformed) {
       IF_LOG Logger::println("Profile data is malformed for function: %s",
                              FuncName.c_str());
@@ -935,17 +1039,21 @@ void CodeGenPGO::loadRegionCounts(llvm::IndexedInstrProfReader *PGOReader,
                        "control-flow hash mismatch",
               const_cast<FuncDeclaration *>(fd)->toPrettyChars(),
               FuncName.c_str());
+      ++matchStats.dropped;
     } else {
       IF_LOG Logger::println("Error loading profile counts for function: %s",
                              FuncName.c_str());
       warning(fd->loc, "Error loading profile data for function '%s' ('%s')",
               const_cast<FuncDeclaration *>(fd)->toPrettyChars(),
               FuncName.c_str());
+      ++matchStats.dropped;
     }
     RegionCounts.clear();
     return;
   }
 
+  ++matchStats.matched;
+
 #if LDC_LLVM_VER >= 309
   ProfRecord =
       llvm::make_unique<llvm::InstrProfRecord>(std::move(RecordExpected.get()));
@@ -1082,7 +1190,11 @@ llvm::MDNode *CodeGenPGO::createProfileWeightsForeachRange(
 void CodeGenPGO::emitIndirectCallPGO(llvm::Instruction *callSite,
                                      llvm::Value *funcPtr) {
 #if LDC_LLVM_VER >= 309
-  if (enablePGOIndirectCalls)
+  // Calls of (bitcast) functions, e.g. the druntime Objective-C message send
+  // or of delegates with a statically known function pointer, have a single
+  // target already.
+  if (enablePGOIndirectCalls &&
+      !llvm::isa<llvm::Function>(funcPtr->stripPointerCasts()))
     valueProfile(llvm::IPVK_IndirectCallTarget, callSite, funcPtr, true);
 #endif
 }
@@ -1130,3 +1242,20 @@ void CodeGenPGO::valueProfile(uint32_t valueKind, llvm::Instruction *valueSite,
 }
 
 #endif // LDC_WITH_PGO
+
+std::vector<std::pair<std::string, uint64_t>> &getProfiledFunctionEntryCounts() {
+  static std::vector<std::pair<std::string, uint64_t>> counts;
+  return counts;
+}
+
+void reportProfileDataMatching(const char *moduleName) {
+#if LDC_WITH_PGO
+  if (global.params.verbose || reportProfileMatching) {
+    fprintf(global.stdmsg, "profile   %s: %u matched, %u stale (entry count "
+                           "used), %u dropped, %u without profile data\n",
+            moduleName, matchStats.matched, matchStats.stale,
+            matchStats.dropped, matchStats.missing);
+  }
+  matchStats = ProfileMatchStats();
+#endif
+}
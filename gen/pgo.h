@@ -19,6 +19,7 @@
 #define LDC_GEN_PGO_H
 
 #include "gen/llvm.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include <string>
 #include <vector>
@@ -177,7 +178,9 @@ public:
   }
 
   /// Adds profiling instrumentation/annotation of indirect calls to `funcPtr`
-  /// for callsite `callSite`.
+  /// for callsite `callSite`, i.e. of calls through function pointers,
+  /// delegates and vtables. The profiled targets are promoted to guarded
+  /// direct calls by LLVM's indirect call promotion.
   /// Does nothing for LLVM < 3.9.
   void emitIndirectCallPGO(llvm::Instruction *callSite, llvm::Value *funcPtr);
 
@@ -203,6 +206,9 @@ private:
   std::unique_ptr<llvm::DenseMap<const RootObject *, uint64_t>> StmtCountMap;
   std::vector<uint64_t> RegionCounts;
   uint64_t CurrentRegionCount;
+  /// The entry count of the profile data for this function if its
+  /// control-flow hash doesn't match anymore (and RegionCounts is empty).
+  llvm::Optional<uint64_t> StaleEntryCount;
 
 #if LDC_LLVM_VER >= 309
   std::array<unsigned, llvm::IPVK_Last + 1> NumValueSites;
@@ -239,4 +245,14 @@ private:
 
 #endif // LLVM version
 
+/// The profiled entry counts of the functions emitted with PGO data in this
+/// compiler invocation, as (function section name, count) pairs. Used to order
+/// the functions in the linked binary (-order-functions-by-profile).
+std::vector<std::pair<std::string, uint64_t>> &getProfiledFunctionEntryCounts();
+
+/// With -fprofile-instr-use and -v or -pgo-report, prints how many of the
+/// functions of module `moduleName` matched the profile data, and resets the
+/// statistics.
+void reportProfileDataMatching(const char *moduleName);
+
 #endif //  LDC_GEN_PGO_H
@@ -71,6 +71,21 @@ LDCPragma DtoGetPragma(Scope *sc, PragmaDeclaration *decl,
         {"bitop.bt", LLVMbitop_bt},   {"bitop.btc", LLVMbitop_btc},
         {"bitop.btr", LLVMbitop_btr}, {"bitop.bts", LLVMbitop_bts},
         {"bitop.vld", LLVMbitop_vld}, {"bitop.vst", LLVMbitop_vst},
+        {"nontemporal.load", LLVMnontemporal_load},
+        {"nontemporal.store", LLVMnontemporal_store},
+        {"simd.extractelement", LLVMsimd_extractelement},
+        {"simd.gather", LLVMsimd_gather},
+        {"simd.insertelement", LLVMsimd_insertelement},
+        {"simd.maskedload", LLVMsimd_maskedload},
+        {"simd.maskedstore", LLVMsimd_maskedstore},
+        {"simd.reduce.add", LLVMsimd_reduce},
+        {"simd.reduce.and", LLVMsimd_reduce},
+        {"simd.reduce.max", LLVMsimd_reduce},
+        {"simd.reduce.min", LLVMsimd_reduce},
+        {"simd.reduce.mul", LLVMsimd_reduce},
+        {"simd.reduce.or", LLVMsimd_reduce},
+        {"simd.reduce.xor", LLVMsimd_reduce},
+        {"simd.shufflevector", LLVMsimd_shufflevector},
     };
 
     static std::string prefix = "ldc.";
@@ -390,6 +405,31 @@ void DtoCheckPragma(PragmaDeclaration *decl, Dsymbol *s,
     }
     break;
 
+  case LLVMsimd_extractelement:
+  case LLVMsimd_insertelement:
+  case LLVMsimd_shufflevector:
+  case LLVMsimd_maskedload:
+  case LLVMsimd_maskedstore:
+  case LLVMsimd_gather:
+  case LLVMsimd_reduce:
+  case LLVMnontemporal_load:
+  case LLVMnontemporal_store:
+    // These are usually templates over the accessed type; remember the full
+    // intrinsic name, e.g. so that the reduction operation can be recovered.
+    if (FuncDeclaration *fd = s->isFuncDeclaration()) {
+      fd->llvmInternal = llvm_internal;
+      fd->intrinsicName = strdup(arg1str);
+    } else if (TemplateDeclaration *td = s->isTemplateDeclaration()) {
+      td->llvmInternal = llvm_internal;
+      td->intrinsicName = strdup(arg1str);
+    } else {
+      error(s->loc, "the '%s' pragma is only allowed on function or template "
+                    "declarations",
+            ident->toChars());
+      fatal();
+    }
+    break;
+
   case LLVMno_typeinfo:
     s->llvmInternal = llvm_internal;
     break;
@@ -520,6 +560,15 @@ bool DtoIsIntrinsic(FuncDeclaration *fd) {
   case LLVMbitop_bts:
   case LLVMbitop_vld:
   case LLVMbitop_vst:
+  case LLVMsimd_extractelement:
+  case LLVMsimd_insertelement:
+  case LLVMsimd_shufflevector:
+  case LLVMsimd_maskedload:
+  case LLVMsimd_maskedstore:
+  case LLVMsimd_gather:
+  case LLVMsimd_reduce:
+  case LLVMnontemporal_load:
+  case LLVMnontemporal_store:
     return true;
 
   default:
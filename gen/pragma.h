@@ -49,7 +49,16 @@ enum LDCPragma {
   LLVMbitop_vld,
   LLVMbitop_vst,
   LLVMextern_weak,
-  LLVMprofile_instr
+  LLVMprofile_instr,
+  LLVMsimd_extractelement,
+  LLVMsimd_insertelement,
+  LLVMsimd_shufflevector,
+  LLVMsimd_maskedload,
+  LLVMsimd_maskedstore,
+  LLVMsimd_gather,
+  LLVMsimd_reduce,
+  LLVMnontemporal_load,
+  LLVMnontemporal_store
 };
 
 LDCPragma DtoGetPragma(Scope *sc, PragmaDeclaration *decl, const char *&arg1str);
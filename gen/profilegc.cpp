@@ -0,0 +1,302 @@
+//===-- profilegc.cpp -----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Every GC allocation site gets a pair of counters (allocations, bytes), which
+// are incremented atomically next to the allocator call, and an entry
+// {file, function, line, counters} in the module's constant site table. A
+// global constructor links the module's table into a list shared by all
+// modules; the first one registers an atexit() function which writes the
+// non-zero counts of all sites to profilegc.log.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/profilegc.h"
+
+#include "declaration.h"
+#include "module.h"
+#include "mtype.h"
+#include "gen/irstate.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/tollvm.h"
+#include "ir/irfunction.h"
+
+namespace {
+const char *const reportFileName = "profilegc.log";
+
+llvm::AtomicOrdering monotonic() {
+#if LDC_LLVM_VER >= 309
+  return llvm::AtomicOrdering::Monotonic;
+#else
+  return llvm::Monotonic;
+#endif
+}
+
+/// size_t[2]: allocations, bytes
+LLArrayType *siteCountersType() { return LLArrayType::get(DtoSize_t(), 2); }
+
+/// { const char* file, const char* function, uint line, size_t[2]* counters }
+LLStructType *siteType() {
+  LLType *elems[] = {getVoidPtrType(), getVoidPtrType(),
+                     LLType::getInt32Ty(gIR->context()),
+                     getPtrToType(siteCountersType())};
+  return LLStructType::get(gIR->context(), elems);
+}
+
+/// { void* next, size_t numSites, Site* sites }
+LLStructType *moduleSitesType() {
+  LLType *elems[] = {getVoidPtrType(), DtoSize_t(), getPtrToType(siteType())};
+  return LLStructType::get(gIR->context(), elems);
+}
+
+LLConstant *cstring(const char *str) {
+  // The literals emitted by DtoConstString() are null-terminated.
+  return DtoConstString(str)->getAggregateElement(1u);
+}
+
+LLValue *getLibcFunction(const char *name, LLType *returnType,
+                         llvm::ArrayRef<LLType *> params,
+                         bool isVarArg = false) {
+  LLFunctionType *fty = LLFunctionType::get(returnType, params, isVarArg);
+  LLFunction *fn = gIR->module.getFunction(name);
+  if (!fn) {
+    fn = LLFunction::Create(fty, LLGlobalValue::ExternalLinkage, name,
+                            &gIR->module);
+  }
+  return DtoBitCast(fn, getPtrToType(fty));
+}
+
+/// The head of the linked list of the registered modules' site tables.
+llvm::GlobalVariable *getModuleListHead() {
+  const char *name = "ldc.profilegc.modules";
+  if (auto gv = gIR->module.getNamedGlobal(name)) {
+    return gv;
+  }
+  auto gv = new llvm::GlobalVariable(
+      gIR->module, getVoidPtrType(), false, LLGlobalValue::LinkOnceODRLinkage,
+      getNullPtr(getVoidPtrType()), name);
+  setLinkage({LLGlobalValue::LinkOnceODRLinkage, supportsCOMDAT()}, gv);
+  return gv;
+}
+
+/// Builds the function writing the report, registered with atexit().
+///
+/// Pseudocode:
+/// void ldc.profilegc.report() {
+///   auto f = fopen("profilegc.log", "w");
+///   if (!f) return;
+///   fputs(header, f);
+///   for (auto m = ldc.profilegc.modules; m; m = m.next)
+///     foreach (ref site; m.sites[0 .. m.numSites])
+///       if (site.counters[0])
+///         fprintf(f, ..., site.counters[1], site.counters[0], site.function,
+///                 site.file, site.line);
+///   fclose(f);
+/// }
+LLFunction *getReportFunction() {
+  const char *name = "ldc.profilegc.report";
+  if (auto fn = gIR->module.getFunction(name)) {
+    return fn;
+  }
+
+  llvm::LLVMContext &ctx = gIR->context();
+  LLType *voidPtrTy = getVoidPtrType();
+  LLType *intTy = LLType::getInt32Ty(ctx);
+  LLType *i64Ty = LLType::getInt64Ty(ctx);
+
+  auto fn = LLFunction::Create(
+      LLFunctionType::get(LLType::getVoidTy(ctx), false),
+      LLGlobalValue::LinkOnceODRLinkage, name, &gIR->module);
+  setLinkage({LLGlobalValue::LinkOnceODRLinkage, supportsCOMDAT()}, fn);
+  fn->addFnAttr(LLAttribute::NoUnwind);
+
+  LLValue *fopenFn =
+      getLibcFunction("fopen", voidPtrTy, {voidPtrTy, voidPtrTy});
+  LLValue *fputsFn = getLibcFunction("fputs", intTy, {voidPtrTy, voidPtrTy});
+  LLValue *fprintfFn =
+      getLibcFunction("fprintf", intTy, {voidPtrTy, voidPtrTy}, true);
+  LLValue *fcloseFn = getLibcFunction("fclose", intTy, {voidPtrTy});
+
+  auto entrybb = llvm::BasicBlock::Create(ctx, "", fn);
+  auto headerbb = llvm::BasicBlock::Create(ctx, "report.header", fn);
+  auto modulebb = llvm::BasicBlock::Create(ctx, "report.module", fn);
+  auto sitesbb = llvm::BasicBlock::Create(ctx, "report.sites", fn);
+  auto sitebb = llvm::BasicBlock::Create(ctx, "report.site", fn);
+  auto printbb = llvm::BasicBlock::Create(ctx, "report.print", fn);
+  auto nextsitebb = llvm::BasicBlock::Create(ctx, "report.nextsite", fn);
+  auto nextmodulebb = llvm::BasicBlock::Create(ctx, "report.nextmodule", fn);
+  auto closebb = llvm::BasicBlock::Create(ctx, "report.close", fn);
+  auto endbb = llvm::BasicBlock::Create(ctx, "report.end", fn);
+
+  IRBuilder<> b(entrybb);
+  LLValue *fopenArgs[] = {cstring(reportFileName), cstring("w")};
+  LLValue *file = b.CreateCall(fopenFn, fopenArgs, "file");
+  b.CreateCondBr(b.CreateIsNull(file), endbb, headerbb);
+
+  b.SetInsertPoint(headerbb);
+  LLValue *fputsArgs[] = {
+      cstring("bytes allocated, allocations, function, file:line\n"), file};
+  b.CreateCall(fputsFn, fputsArgs);
+  LLValue *firstModule = b.CreateLoad(getModuleListHead());
+  b.CreateBr(modulebb);
+
+  b.SetInsertPoint(modulebb);
+  llvm::PHINode *module = b.CreatePHI(voidPtrTy, 2, "module");
+  module->addIncoming(firstModule, headerbb);
+  b.CreateCondBr(b.CreateIsNull(module), closebb, sitesbb);
+
+  // The site tables are never empty.
+  b.SetInsertPoint(sitesbb);
+  LLValue *desc = b.CreateBitCast(module, getPtrToType(moduleSitesType()));
+  LLValue *numSites = b.CreateLoad(DtoGEPi(desc, 0, 1, "", sitesbb));
+  LLValue *sites = b.CreateLoad(DtoGEPi(desc, 0, 2, "", sitesbb));
+  b.CreateBr(sitebb);
+
+  b.SetInsertPoint(sitebb);
+  llvm::PHINode *index = b.CreatePHI(DtoSize_t(), 2, "i");
+  index->addIncoming(DtoConstSize_t(0), sitesbb);
+  LLValue *site = DtoGEP1(sites, index, true, "", sitebb);
+  LLValue *counters = b.CreateLoad(DtoGEPi(site, 0, 3, "", sitebb));
+  LLValue *count = b.CreateLoad(DtoGEPi(counters, 0, 0, "", sitebb));
+  b.CreateCondBr(b.CreateIsNull(count), nextsitebb, printbb);
+
+  b.SetInsertPoint(printbb);
+  LLValue *bytes = b.CreateLoad(DtoGEPi(counters, 0, 1, "", printbb));
+  LLValue *fprintfArgs[] = {
+      file,
+      cstring("%15llu\t%15llu\t%s\t%s:%u\n"),
+      b.CreateZExt(bytes, i64Ty),
+      b.CreateZExt(count, i64Ty),
+      b.CreateLoad(DtoGEPi(site, 0, 1, "", printbb)),
+      b.CreateLoad(DtoGEPi(site, 0, 0, "", printbb)),
+      b.CreateLoad(DtoGEPi(site, 0, 2, "", printbb))};
+  b.CreateCall(fprintfFn, fprintfArgs);
+  b.CreateBr(nextsitebb);
+
+  b.SetInsertPoint(nextsitebb);
+  LLValue *nextIndex = b.CreateAdd(index, DtoConstSize_t(1));
+  index->addIncoming(nextIndex, nextsitebb);
+  b.CreateCondBr(b.CreateICmpULT(nextIndex, numSites), sitebb, nextmodulebb);
+
+  b.SetInsertPoint(nextmodulebb);
+  LLValue *nextModule = b.CreateLoad(DtoGEPi(desc, 0, 0, "", nextmodulebb));
+  module->addIncoming(nextModule, nextmodulebb);
+  b.CreateBr(modulebb);
+
+  b.SetInsertPoint(closebb);
+  b.CreateCall(fcloseFn, file);
+  b.CreateBr(endbb);
+
+  b.SetInsertPoint(endbb);
+  b.CreateRetVoid();
+
+  return fn;
+}
+}
+
+void emitGCAllocationSite(Loc &loc, LLValue *bytes) {
+  if (!global.params.tracegc) {
+    return;
+  }
+
+  const char *function = gIR->funcGenStates.empty()
+                             ? ""
+                             : gIR->func()->decl->toPrettyChars();
+  IF_LOG Logger::println("GC allocation site %s in %s", loc.toChars(),
+                         function);
+  LOG_SCOPE;
+
+  LLArrayType *countersTy = siteCountersType();
+  auto counters = new llvm::GlobalVariable(
+      gIR->module, countersTy, false, LLGlobalValue::PrivateLinkage,
+      llvm::ConstantAggregateZero::get(countersTy), ".gcsite");
+
+  LLConstant *fields[] = {cstring(remapFilePrefix(loc.filename)),
+                          cstring(function),
+                          DtoConstUint(loc.linnum), counters};
+  gIR->gcAllocationSites.push_back(
+      LLConstantStruct::get(siteType(), fields));
+
+  gIR->ir->CreateAtomicRMW(llvm::AtomicRMWInst::Add, DtoGEPi(counters, 0, 0),
+                           DtoConstSize_t(1), monotonic());
+  if (bytes) {
+    gIR->ir->CreateAtomicRMW(llvm::AtomicRMWInst::Add, DtoGEPi(counters, 0, 1),
+                             gIR->ir->CreateZExtOrTrunc(bytes, DtoSize_t()),
+                             monotonic());
+  }
+}
+
+void emitGCAllocationSiteOf(Loc &loc, Type *elemType, LLValue *count) {
+  if (!global.params.tracegc) {
+    return;
+  }
+
+  LLValue *bytes = DtoConstSize_t(getTypeAllocSize(DtoMemType(elemType)));
+  if (count) {
+    bytes = gIR->ir->CreateMul(count, bytes);
+  }
+  emitGCAllocationSite(loc, bytes);
+}
+
+void registerGCAllocationSites(Module *m) {
+  std::vector<LLConstant *> &sites = gIR->gcAllocationSites;
+  if (sites.empty()) {
+    return;
+  }
+
+  IF_LOG Logger::println("Registering %llu GC allocation sites of module %s",
+                         static_cast<unsigned long long>(sites.size()),
+                         m->toChars());
+  LOG_SCOPE;
+
+  LLArrayType *tableTy = LLArrayType::get(siteType(), sites.size());
+  auto table = new llvm::GlobalVariable(
+      gIR->module, tableTy, true, LLGlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(tableTy, sites), ".gcsites");
+
+  LLStructType *descTy = moduleSitesType();
+  LLConstant *descFields[] = {getNullPtr(getVoidPtrType()),
+                              DtoConstSize_t(sites.size()),
+                              DtoGEPi(table, 0, 0)};
+  auto desc = new llvm::GlobalVariable(
+      gIR->module, descTy, false, LLGlobalValue::InternalLinkage,
+      LLConstantStruct::get(descTy, descFields), ".gcsites.module");
+  sites.clear();
+
+  // Prepend the table to the list; the first registered module also
+  // registers the report function.
+  LLFunction *ctor = LLFunction::Create(
+      LLFunctionType::get(LLType::getVoidTy(gIR->context()), false),
+      LLGlobalValue::InternalLinkage, "ldc.profilegc.register", &gIR->module);
+  ctor->addFnAttr(LLAttribute::NoUnwind);
+
+  auto entrybb = llvm::BasicBlock::Create(gIR->context(), "", ctor);
+  auto atexitbb = llvm::BasicBlock::Create(gIR->context(), "atexit", ctor);
+  auto endbb = llvm::BasicBlock::Create(gIR->context(), "end", ctor);
+
+  IRBuilder<> b(entrybb);
+  llvm::GlobalVariable *head = getModuleListHead();
+  LLValue *first = b.CreateLoad(head);
+  b.CreateStore(first, DtoGEPi(desc, 0, 0));
+  b.CreateStore(DtoBitCast(desc, getVoidPtrType()), head);
+  b.CreateCondBr(b.CreateIsNull(first), atexitbb, endbb);
+
+  b.SetInsertPoint(atexitbb);
+  LLFunction *report = getReportFunction();
+  LLValue *atexitFn =
+      getLibcFunction("atexit", LLType::getInt32Ty(gIR->context()),
+                      {report->getType()});
+  b.CreateCall(atexitFn, report);
+  b.CreateBr(endbb);
+
+  b.SetInsertPoint(endbb);
+  b.CreateRetVoid();
+
+  AppendFunctionToLLVMGlobalCtorsDtors(ctor, 65535, true);
+}
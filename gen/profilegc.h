@@ -0,0 +1,39 @@
+//===-- gen/profilegc.h - GC allocation profiling ---------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains functions to generate code for counting the GC
+// allocations of each allocation site. The profiling is enabled by the
+// "-profile-gc" commandline switch.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_PROFILEGC_H
+#define LDC_GEN_PROFILEGC_H
+
+struct Loc;
+class Module;
+class Type;
+namespace llvm {
+class Value;
+}
+
+/// Counts a GC allocation of the given number of bytes (a size_t value, or
+/// null if the size is unknown) for the allocation site at loc.
+void emitGCAllocationSite(Loc &loc, llvm::Value *bytes);
+
+/// Counts a GC allocation of count elements of type elemType (a single one if
+/// count is null) for the allocation site at loc.
+void emitGCAllocationSiteOf(Loc &loc, Type *elemType,
+                            llvm::Value *count = nullptr);
+
+/// Emits the table of the module's allocation sites and a global constructor
+/// registering it for the report written when the program exits.
+void registerGCAllocationSites(Module *m);
+
+#endif
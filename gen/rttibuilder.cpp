@@ -9,6 +9,8 @@
 
 #include "gen/rttibuilder.h"
 #include "aggregate.h"
+#include "declaration.h"
+#include "expression.h"
 #include "mtype.h"
 #include "gen/arrays.h"
 #include "gen/functions.h"
@@ -19,6 +21,7 @@
 #include "gen/tollvm.h"
 #include "ir/iraggr.h"
 #include "ir/irfunction.h"
+#include <vector>
 
 RTTIBuilder::RTTIBuilder(AggregateDeclaration *base_class) {
   DtoResolveDsymbol(base_class);
@@ -72,6 +75,114 @@ void RTTIBuilder::push_classinfo(ClassDeclaration *cd) {
 
 void RTTIBuilder::push_string(const char *str) { push(DtoConstString(str)); }
 
+namespace {
+/// Sets the bits of the pointer-sized words of a value of type `t` at `offset`
+/// which may contain GC pointers.
+void setPointerBits(Type *t, uint64_t offset, std::vector<bool> &bits) {
+  const uint64_t ptrSize = gDataLayout->getPointerSize();
+  auto mark = [&](uint64_t pointerOffset) {
+    const uint64_t word = pointerOffset / ptrSize;
+    if (word < bits.size())
+      bits[word] = true;
+    // A misaligned pointer spans two words.
+    if (pointerOffset % ptrSize && word + 1 < bits.size())
+      bits[word + 1] = true;
+  };
+
+  t = t->toBasetype();
+  switch (t->ty) {
+  case Tpointer:
+  case Tclass:
+  case Taarray:
+  case Tdelegate: // context pointer
+    mark(offset);
+    break;
+  case Tarray:
+    mark(offset + ptrSize);
+    break;
+  case Tsarray: {
+    Type *elemType = t->nextOf();
+    if (!elemType->hasPointers())
+      break;
+    const uint64_t elemSize = elemType->size();
+    const uint64_t dim = static_cast<TypeSArray *>(t)->dim->toInteger();
+    for (uint64_t i = 0; i < dim; ++i)
+      setPointerBits(elemType, offset + i * elemSize, bits);
+    break;
+  }
+  case Tstruct:
+    if (!t->hasPointers())
+      break;
+    for (VarDeclaration *field : static_cast<TypeStruct *>(t)->sym->fields)
+      setPointerBits(field->type, offset + field->offset, bits);
+    break;
+  default:
+    break;
+  }
+}
+
+/// Returns the precise GC info of an aggregate instance: its size in bytes,
+/// followed by a bitmap with a bit for each pointer-sized word.
+LLConstant *getPointerBitmap(AggregateDeclaration *ad) {
+  std::string name = mangle(ad);
+  name.append(".rtinfo");
+  if (auto existing = gIR->module.getGlobalVariable(name, true))
+    return DtoBitCast(existing, getVoidPtrType());
+
+  const uint64_t ptrSize = gDataLayout->getPointerSize();
+  const uint64_t size = ad->structsize;
+  std::vector<bool> bits((size + ptrSize - 1) / ptrSize);
+  if (auto cd = ad->isClassDeclaration()) {
+    // The vtbl pointer, the monitor and the interface vtbl pointers don't
+    // point to GC memory.
+    for (; cd; cd = cd->baseClass) {
+      for (VarDeclaration *field : cd->fields)
+        setPointerBits(field->type, field->offset, bits);
+    }
+  } else {
+    for (VarDeclaration *field : ad->fields)
+      setPointerBits(field->type, field->offset, bits);
+  }
+
+  const uint64_t bitsPerWord = ptrSize * 8;
+  std::vector<LLConstant *> words;
+  words.push_back(DtoConstSize_t(size));
+  for (size_t i = 0; i < bits.size(); i += bitsPerWord) {
+    uint64_t word = 0;
+    for (size_t j = 0; j < bitsPerWord && i + j < bits.size(); ++j) {
+      if (bits[i + j])
+        word |= uint64_t(1) << j;
+    }
+    words.push_back(DtoConstSize_t(word));
+  }
+
+  auto init =
+      LLConstantArray::get(LLArrayType::get(DtoSize_t(), words.size()), words);
+  const LinkageWithCOMDAT lwc(TYPEINFO_LINKAGE_TYPE, supportsCOMDAT());
+  auto G = new LLGlobalVariable(gIR->module, init->getType(), true, lwc.first,
+                                init, name);
+  setLinkage(lwc, G);
+  return DtoBitCast(G, getVoidPtrType());
+}
+}
+
+void RTTIBuilder::push_gc_info(AggregateDeclaration *ad, bool hasPointers) {
+  if (Expression *e = ad->getRTInfo) {
+    const bool isMarker =
+        e->op == TOKnull || (e->op == TOKint64 && e->toInteger() <= 1);
+    if (!isMarker) {
+      push(toConstElem(e, gIR));
+      return;
+    }
+  }
+
+  if (hasPointers) {
+    push(getPointerBitmap(ad));
+  } else {
+    push_size_as_vp(0); // no pointers
+  }
+}
+
 void RTTIBuilder::push_null_void_array() {
   LLType *T = DtoType(Type::tvoid->arrayOf());
   push(getNullValue(T));
@@ -56,6 +56,12 @@ public:
   void push_typeinfo(Type *t);
   void push_classinfo(ClassDeclaration *cd);
 
+  /// Pushes the GC info of an aggregate (m_RTInfo): the result of
+  /// object.RTInfo!T if that's more than a null or "has pointers" marker,
+  /// otherwise a bitmap of the pointer-sized words of an instance which may
+  /// contain GC pointers (null if there are none).
+  void push_gc_info(AggregateDeclaration *ad, bool hasPointers);
+
   /// pushes the function pointer or a null void* if it cannot.
   void push_funcptr(FuncDeclaration *fd, Type *castto = nullptr);
 
@@ -88,6 +88,7 @@ static void checkForImplicitGCCall(const Loc &loc, const char *name) {
         "_d_allocclass",
         "_d_newitemT",
         "_d_newitemiT",
+        "gc_malloc",
     };
 
     if (binary_search(&GCNAMES[0],
@@ -311,6 +312,8 @@ static void buildRuntimeModule() {
                 llvm::Attribute::Cold),
       Attr_Cold_NoReturn(Attr_Cold, llvm::AttributeSet::FunctionIndex,
                          llvm::Attribute::NoReturn),
+      Attr_Cold_NoUnwind(Attr_Cold, llvm::AttributeSet::FunctionIndex,
+                         llvm::Attribute::NoUnwind),
       Attr_ReadOnly_NoUnwind(Attr_ReadOnly, llvm::AttributeSet::FunctionIndex,
                              llvm::Attribute::NoUnwind),
       Attr_ReadOnly_1_NoCapture(Attr_ReadOnly, 1, llvm::Attribute::NoCapture),
@@ -349,6 +352,31 @@ static void buildRuntimeModule() {
   //////////////////////////////////////////////////////////////////////////////
   //////////////////////////////////////////////////////////////////////////////
 
+  // size_t gc_sizeOf(void* p)
+  createFwdDecl(LINKc, sizeTy, {"gc_sizeOf"}, {voidPtrTy}, {}, Attr_NoUnwind);
+
+  // uint gc_getAttr(void* p)
+  createFwdDecl(LINKc, uintTy, {"gc_getAttr"}, {voidPtrTy}, {}, Attr_NoUnwind);
+
+  // Platform mutex functions, called directly by the fast paths of
+  // synchronized statements.
+  if (global.params.targetTriple->isOSWindows()) {
+    // void EnterCriticalSection(void* cs)
+    // void LeaveCriticalSection(void* cs)
+    createFwdDecl(LINKwindows, voidTy,
+                  {"EnterCriticalSection", "LeaveCriticalSection"}, {voidPtrTy},
+                  {}, Attr_NoUnwind);
+  } else {
+    // int pthread_mutex_lock(void* mutex)
+    // int pthread_mutex_unlock(void* mutex)
+    createFwdDecl(LINKc, intTy, {"pthread_mutex_lock", "pthread_mutex_unlock"},
+                  {voidPtrTy}, {}, Attr_NoUnwind);
+  }
+
+  // void* gc_malloc(size_t sz, uint ba, const TypeInfo ti)
+  createFwdDecl(LINKc, voidPtrTy, {"gc_malloc"}, {sizeTy, uintTy, typeInfoTy},
+                {0, 0, STCconst}, Attr_NoAlias);
+
   // void* _d_allocmemory(size_t sz)
   createFwdDecl(LINKc, voidPtrTy, {"_d_allocmemory"}, {sizeTy}, {},
                 Attr_NoAlias);
@@ -621,15 +649,15 @@ static void buildRuntimeModule() {
 
   // int _d_switch_string(char[][] table, char[] ca)
   createFwdDecl(LINKc, intTy, {"_d_switch_string"},
-                {stringTy->arrayOf(), stringTy}, {}, Attr_ReadOnly);
+                {stringTy->arrayOf(), stringTy}, {}, Attr_ReadOnly_NoUnwind);
 
   // int _d_switch_ustring(wchar[][] table, wchar[] ca)
   createFwdDecl(LINKc, intTy, {"_d_switch_ustring"},
-                {wstringTy->arrayOf(), wstringTy}, {}, Attr_ReadOnly);
+                {wstringTy->arrayOf(), wstringTy}, {}, Attr_ReadOnly_NoUnwind);
 
   // int _d_switch_dstring(dchar[][] table, dchar[] ca)
   createFwdDecl(LINKc, intTy, {"_d_switch_dstring"},
-                {dstringTy->arrayOf(), dstringTy}, {}, Attr_ReadOnly);
+                {dstringTy->arrayOf(), dstringTy}, {}, Attr_ReadOnly_NoUnwind);
 
   //////////////////////////////////////////////////////////////////////////////
   //////////////////////////////////////////////////////////////////////////////
@@ -655,24 +683,29 @@ static void buildRuntimeModule() {
     }
   }
 
+  // The EH functions are only called while handling an exception, so they are
+  // marked cold to keep the landing pads out of the hot code.
   if (useMSVCEH()) {
     // _d_enter_cleanup(ptr frame)
-    createFwdDecl(LINKc, boolTy, {"_d_enter_cleanup"}, {voidPtrTy});
+    createFwdDecl(LINKc, boolTy, {"_d_enter_cleanup"}, {voidPtrTy}, {},
+                  Attr_Cold);
 
     // _d_leave_cleanup(ptr frame)
-    createFwdDecl(LINKc, voidTy, {"_d_leave_cleanup"}, {voidPtrTy});
+    createFwdDecl(LINKc, voidTy, {"_d_leave_cleanup"}, {voidPtrTy}, {},
+                  Attr_Cold);
 
     // Object _d_eh_enter_catch(ptr exception, ClassInfo catchType)
     createFwdDecl(LINKc, objectTy, {"_d_eh_enter_catch"},
-                  {voidPtrTy, classInfoTy}, {});
+                  {voidPtrTy, classInfoTy}, {}, Attr_Cold);
   } else {
 
     // void _d_eh_resume_unwind(ptr)
-    createFwdDecl(LINKc, voidTy, {"_d_eh_resume_unwind"}, {voidPtrTy});
+    createFwdDecl(LINKc, voidTy, {"_d_eh_resume_unwind"}, {voidPtrTy}, {},
+                  Attr_Cold_NoReturn);
 
     // Object _d_eh_enter_catch(ptr)
     createFwdDecl(LINKc, objectTy, {"_d_eh_enter_catch"}, {voidPtrTy}, {},
-                  Attr_NoUnwind);
+                  Attr_Cold_NoUnwind);
   }
 
   //////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,91 @@
+//===-- scope-literals.cpp ------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/scope-literals.h"
+
+#include "declaration.h"
+#include "expression.h"
+#include "mtype.h"
+#include "statement.h"
+#include "gen/logger.h"
+#include "gen/recursivevisitor.h"
+#include "llvm/Support/CommandLine.h"
+
+static llvm::cl::opt<bool> disableScopeLiterals(
+    "disable-scope-array-literals", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("Always allocate dynamic array literals on the GC heap, "
+                   "even if they are only passed to scope parameters"));
+
+namespace {
+
+/// Returns the dynamic array literal `e`, if it is one.
+ArrayLiteralExp *isDynamicArrayLiteral(Expression *e) {
+  if (!e || e->op != TOKarrayliteral || e->type->toBasetype()->ty != Tarray)
+    return nullptr;
+  return static_cast<ArrayLiteralExp *>(e);
+}
+
+/// Returns the type of the function called by `e`.
+TypeFunction *getCalleeType(CallExp *e) {
+  Type *t = e->e1->type->toBasetype();
+  if (t->ty == Tdelegate || t->ty == Tpointer)
+    t = t->nextOf()->toBasetype();
+  return t->ty == Tfunction ? static_cast<TypeFunction *>(t) : nullptr;
+}
+
+/// Collects the array literals passed directly to scope parameters.
+struct FindScopeLiterals : public RecursiveVisitor {
+  llvm::DenseMap<ArrayLiteralExp *, ScopeArrayLiterals::Kind> &literals;
+
+  explicit FindScopeLiterals(
+      llvm::DenseMap<ArrayLiteralExp *, ScopeArrayLiterals::Kind> &literals)
+      : literals(literals) {}
+
+  using RecursiveVisitor::visit;
+
+  void visit(CallExp *e) override {
+    TypeFunction *tf = getCalleeType(e);
+    if (tf && e->arguments) {
+      for (size_t i = 0; i < e->arguments->dim; ++i) {
+        ArrayLiteralExp *ale = isDynamicArrayLiteral((*e->arguments)[i]);
+        Parameter *param = Parameter::getNth(tf->parameters, i);
+        if (!ale || !param ||
+            (param->storageClass & (STCscope | STCref | STCout | STClazy)) !=
+                STCscope) {
+          continue;
+        }
+        IF_LOG Logger::println("Array literal %s does not escape",
+                               ale->toChars());
+        Type *elemType = param->type->toBasetype()->nextOf();
+        literals[ale] = elemType && !elemType->isMutable()
+                            ? ScopeArrayLiterals::readOnly
+                            : ScopeArrayLiterals::onStack;
+      }
+    }
+    RecursiveVisitor::visit(e);
+  }
+};
+}
+
+ScopeArrayLiterals::Kind ScopeArrayLiterals::getKind(ArrayLiteralExp *e) {
+  if (disableScopeLiterals)
+    return escaping;
+
+  if (!analyzed) {
+    analyzed = true;
+
+    if (fd->fbody) {
+      FindScopeLiterals finder(literals);
+      fd->fbody->accept(&finder);
+    }
+  }
+
+  auto it = literals.find(e);
+  return it == literals.end() ? escaping : it->second;
+}
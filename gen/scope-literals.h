@@ -0,0 +1,55 @@
+//===-- gen/scope-literals.h - Non-escaping array literals ------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Finds the dynamic array literals which cannot escape the function, so that
+// they can be placed in stack memory instead of being allocated on the GC heap.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_SCOPE_LITERALS_H
+#define LDC_GEN_SCOPE_LITERALS_H
+
+#include "llvm/ADT/DenseMap.h"
+
+class ArrayLiteralExp;
+class FuncDeclaration;
+
+/// Dynamic array literals are allocated on the GC heap, which is wasted for
+/// the common `foo([a, b, c])`: a literal passed directly to a `scope`
+/// parameter doesn't outlive the call. These literals can be constructed in
+/// stack memory instead, or be emitted as constant global if all elements are
+/// constants and the callee can't write to them either (for `const`,
+/// `immutable` and `inout` element types).
+/// (Literals iterated over by a non-`ref` foreach statement are already
+/// lowered to static arrays by the frontend.)
+class ScopeArrayLiterals {
+public:
+  enum Kind {
+    /// The literal may escape and needs to be GC-allocated.
+    escaping,
+    /// The literal can be placed in stack memory.
+    onStack,
+    /// Like onStack, but the literal is never written to either, so it can be
+    /// a global if constant.
+    readOnly
+  };
+
+  explicit ScopeArrayLiterals(FuncDeclaration *fd) : fd(fd) {}
+
+  /// Returns how the dynamic array literal `e` can be allocated.
+  Kind getKind(ArrayLiteralExp *e);
+
+private:
+  FuncDeclaration *fd;
+  /// The function body is analyzed on the first query.
+  bool analyzed = false;
+  llvm::DenseMap<ArrayLiteralExp *, Kind> literals;
+};
+
+#endif
@@ -28,7 +28,10 @@
 #include "ir/irmodule.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
 #include <fstream>
+#include <map>
 #include <math.h>
 #include <stdio.h>
 
@@ -84,6 +87,321 @@ static LLValue *call_string_switch_runtime(llvm::Value *table, Expression *e) {
 
 //////////////////////////////////////////////////////////////////////////////
 
+static llvm::cl::opt<unsigned> unrolledLoopSizeWarning(
+    "unrolled-loop-size-warning", llvm::cl::ZeroOrMore,
+    llvm::cl::value_desc("instructions"),
+    llvm::cl::desc("Warn about foreach loops over tuples whose unrolled body "
+                   "exceeds this number of LLVM instructions (0 = disabled)"),
+    llvm::cl::init(0));
+
+/// Returns the number of instructions in the blocks of a function from
+/// `begin` up to (excluding) `end`.
+static size_t countInstructions(llvm::BasicBlock *begin,
+                                llvm::BasicBlock *end) {
+  size_t count = 0;
+  for (llvm::BasicBlock *bb = begin; bb && bb != end; bb = bb->getNextNode()) {
+    count += bb->size();
+  }
+  return count;
+}
+
+static llvm::cl::opt<unsigned> switchPeelThreshold(
+    "pgo-switch-peel-threshold",
+    llvm::cl::desc("With profile data, emit switch cases taken at least this "
+                   "percentage of times as compare-and-branch ahead of the "
+                   "switch (0 = disabled)"),
+    llvm::cl::init(40), llvm::cl::Hidden);
+
+// String switches with more cases than this call the druntime binary search
+// instead of being lowered to an inline decision tree.
+static const size_t maxInlineStringSwitchCases = 512;
+
+/// Attaches an `llvm.loop` node with the given (name, value) hints to the
+/// latch of a loop and returns it. Hints without a value are flags.
+static llvm::MDNode *
+setLoopMetadata(llvm::BranchInst *latch,
+                llvm::ArrayRef<std::pair<const char *, llvm::Constant *>> hints) {
+  llvm::LLVMContext &ctx = latch->getContext();
+#if LDC_LLVM_VER >= 306
+  auto tempNode = llvm::MDNode::getTemporary(ctx, llvm::None);
+  llvm::SmallVector<llvm::Metadata *, 4> args;
+#if LDC_LLVM_VER >= 307
+  args.push_back(tempNode.get());
+#else
+  args.push_back(tempNode);
+#endif
+  for (const auto &hint : hints) {
+    llvm::Metadata *ops[] = {llvm::MDString::get(ctx, hint.first),
+                             hint.second
+                                 ? llvm::ConstantAsMetadata::get(hint.second)
+                                 : nullptr};
+    args.push_back(
+        llvm::MDNode::get(ctx, llvm::makeArrayRef(ops, hint.second ? 2 : 1)));
+  }
+#else
+  llvm::MDNode *tempNode = llvm::MDNode::getTemporary(ctx, llvm::None);
+  llvm::SmallVector<llvm::Value *, 4> args;
+  args.push_back(tempNode);
+  for (const auto &hint : hints) {
+    llvm::Value *ops[] = {llvm::MDString::get(ctx, hint.first), hint.second};
+    args.push_back(
+        llvm::MDNode::get(ctx, llvm::makeArrayRef(ops, hint.second ? 2 : 1)));
+  }
+#endif
+  llvm::MDNode *loopID = llvm::MDNode::get(ctx, args);
+  loopID->replaceOperandWith(0, loopID);
+#if LDC_LLVM_VER < 307
+  llvm::MDNode::deleteTemporary(tempNode);
+#endif
+  latch->setMetadata("llvm.loop", loopID);
+  return loopID;
+}
+
+/// Attaches the unroll and vectorization hints of a loop, given by
+/// `pragma(LDC_unroll[, n])`/`pragma(LDC_vectorize[, n])` or implied by
+/// `@optStrategy("speed")`, to its latch.
+static void setLoopHints(llvm::BranchInst *latch, int unrollHint,
+                         int vectorizeHint, bool optimizeForSpeed) {
+  if (!latch || (!unrollHint && !vectorizeHint && !optimizeForSpeed)) {
+    return;
+  }
+
+  llvm::LLVMContext &ctx = latch->getContext();
+  auto i32 = [&ctx](int value) {
+    return llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx), value);
+  };
+  llvm::SmallVector<std::pair<const char *, llvm::Constant *>, 4> hints;
+
+  if (unrollHint == 1) {
+    hints.push_back({"llvm.loop.unroll.disable", nullptr});
+  } else if (unrollHint > 1) {
+    hints.push_back({"llvm.loop.unroll.count", i32(unrollHint)});
+  } else if (unrollHint < 0) {
+    hints.push_back({"llvm.loop.unroll.enable", nullptr});
+  }
+
+  if (vectorizeHint > 0) {
+    hints.push_back({"llvm.loop.vectorize.width", i32(vectorizeHint)});
+  }
+  if (vectorizeHint != 1 && (vectorizeHint || optimizeForSpeed)) {
+    hints.push_back(
+        {"llvm.loop.vectorize.enable", llvm::ConstantInt::getTrue(ctx)});
+  }
+
+  setLoopMetadata(latch, hints);
+}
+
+/// Marks the loop of a generated array operation function as parallel and
+/// asks for it to be vectorized. The slices of an array operation must not
+/// overlap, so there are no dependencies between the iterations (which the
+/// vectorizer would otherwise have to check for at runtime).
+static void markArrayOpLoop(llvm::BranchInst *latch, llvm::BasicBlock *first,
+                            llvm::BasicBlock *last) {
+  std::pair<const char *, llvm::Constant *> vectorize[] = {
+      {"llvm.loop.vectorize.enable",
+       llvm::ConstantInt::getTrue(latch->getContext())}};
+  llvm::MDNode *loopID = setLoopMetadata(latch, vectorize);
+
+  // Mark the memory accesses of the loop body, except for the ones of the
+  // local variables (the loop counter).
+  for (llvm::BasicBlock *bb = first;; bb = bb->getNextNode()) {
+    for (auto &inst : *bb) {
+      llvm::Value *ptr = nullptr;
+      if (auto load = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+        ptr = load->getPointerOperand();
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+        ptr = store->getPointerOperand();
+      }
+      if (ptr && !llvm::isa<llvm::AllocaInst>(ptr->stripPointerCasts())) {
+        inst.setMetadata("llvm.mem.parallel_loop_access", loopID);
+      }
+    }
+    if (bb == last) {
+      break;
+    }
+  }
+}
+
+static llvm::FunctionType *getCalleeType(llvm::CallInst *call) {
+#if LDC_LLVM_VER >= 307
+  return call->getFunctionType();
+#else
+  return llvm::cast<llvm::FunctionType>(
+      call->getCalledValue()->getType()->getPointerElementType());
+#endif
+}
+
+/// Marks the call emitted for a `pragma(LDC_musttail) return` statement as
+/// musttail, i.e., as guaranteed tail call, or issues an error if that isn't
+/// possible. The call must be the last instruction before the `ret` and its
+/// result has to be returned unmodified.
+static void markMusttailCall(ReturnStatement *stmt, llvm::Function *caller,
+                             LLValue *returnValue, bool hasCleanups) {
+  const char *reason = nullptr;
+  llvm::CallInst *call = nullptr;
+
+  llvm::BasicBlock *bb = gIR->scopebb();
+  llvm::Instruction *last = bb->empty() ? nullptr : &bb->back();
+  if (returnValue) {
+    // a bitcast of the result (class references) is fine
+    if (auto bitcast = llvm::dyn_cast<llvm::BitCastInst>(returnValue)) {
+      if (bitcast == last) {
+        returnValue = bitcast->getOperand(0);
+        last = bitcast->getPrevNode();
+      }
+    }
+    if (returnValue == last) {
+      call = llvm::dyn_cast<llvm::CallInst>(last);
+    }
+  } else {
+    call = llvm::dyn_cast_or_null<llvm::CallInst>(last);
+  }
+
+  if (hasCleanups) {
+    reason = "destructors, scope guards or finally blocks run after the call";
+  } else if (!call) {
+    reason = "the result isn't returned directly";
+  } else if (getCalleeType(call) != caller->getFunctionType() ||
+             call->getCallingConv() != caller->getCallingConv()) {
+    reason = "the callee's signature is ABI-incompatible with the caller's";
+  }
+
+  if (reason) {
+    error(stmt->loc, "cannot guarantee a tail call: %s", reason);
+    return;
+  }
+
+  call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+}
+
+namespace {
+/// Computes the index of the case matching a string switch condition (in the
+/// order of the sorted cases), or -1 if there is none, like the _d_switch_*
+/// druntime functions. The string length is switched on first, then on the
+/// character distinguishing most of the remaining candidates, until a single
+/// candidate is left, which is verified using memcmp.
+class StringSwitchLowering {
+  IRState *irs;
+  CaseStatements *cases;
+  LLValue *ptr = nullptr;
+  LLType *charType = nullptr;
+  llvm::BasicBlock *endbb = nullptr;
+  llvm::SmallVector<std::pair<LLValue *, llvm::BasicBlock *>, 16> results;
+
+  StringExp *caseString(size_t i) {
+    return static_cast<StringExp *>((*cases)[i]->exp);
+  }
+
+  void addResult(LLValue *index) {
+    results.push_back(std::make_pair(index, irs->scopebb()));
+    llvm::BranchInst::Create(endbb, irs->scopebb());
+  }
+
+  void emitCharTree(const std::vector<size_t> &candidates, size_t length,
+                    std::vector<bool> &checked) {
+    if (candidates.size() == 1) {
+      const size_t i = candidates[0];
+      LLValue *index = DtoConstUint(i);
+      if (std::find(checked.begin(), checked.end(), false) != checked.end()) {
+        LLConstant *str = toConstElem(caseString(i), irs);
+        LLValue *nbytes = DtoConstSize_t(length * getTypeAllocSize(charType));
+        LLValue *cmp = DtoMemCmp(
+            ptr, llvm::ConstantExpr::getExtractValue(str, 1), nbytes);
+        LLValue *eq =
+            irs->ir->CreateICmpEQ(cmp, LLConstantInt::get(cmp->getType(), 0));
+        index = irs->ir->CreateSelect(eq, index, DtoConstInt(-1));
+      }
+      addResult(index);
+      return;
+    }
+
+    // Find the position with the most distinct characters.
+    size_t bestPos = 0;
+    std::map<unsigned, std::vector<size_t>> bestSplit;
+    for (size_t pos = 0; pos < length; ++pos) {
+      if (checked[pos]) {
+        continue;
+      }
+      std::map<unsigned, std::vector<size_t>> split;
+      for (size_t i : candidates) {
+        split[caseString(i)->charAt(pos)].push_back(i);
+      }
+      if (split.size() > bestSplit.size()) {
+        bestPos = pos;
+        bestSplit = std::move(split);
+      }
+    }
+    assert(bestSplit.size() > 1 && "duplicate string switch cases");
+
+    LLValue *c = DtoLoad(DtoGEP1(ptr, DtoConstSize_t(bestPos), true));
+    results.push_back(std::make_pair(DtoConstInt(-1), irs->scopebb()));
+    llvm::SwitchInst *si = llvm::SwitchInst::Create(
+        c, endbb, bestSplit.size(), irs->scopebb());
+
+    checked[bestPos] = true;
+    for (const auto &group : bestSplit) {
+      llvm::BasicBlock *bb = irs->insertBBBefore(endbb, "stringswitch.char");
+      si->addCase(llvm::cast<llvm::ConstantInt>(
+                      LLConstantInt::get(charType, group.first)),
+                  bb);
+      irs->scope() = IRScope(bb);
+      emitCharTree(group.second, length, checked);
+    }
+    checked[bestPos] = false;
+  }
+
+public:
+  StringSwitchLowering(IRState *irs, CaseStatements *cases)
+      : irs(irs), cases(cases) {}
+
+  static bool isApplicable(CaseStatements *cases) {
+    if (cases->dim > maxInlineStringSwitchCases) {
+      return false;
+    }
+    for (auto cs : *cases) {
+      if (cs->exp->op != TOKstring) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  LLValue *emit(Expression *condition) {
+    DValue *val = toElemDtor(condition);
+    LLValue *len = DtoArrayLen(val);
+    ptr = DtoArrayPtr(val);
+    charType = ptr->getType()->getContainedType(0);
+
+    std::map<size_t, std::vector<size_t>> byLength;
+    for (size_t i = 0; i < cases->dim; ++i) {
+      byLength[caseString(i)->numberOfCodeUnits()].push_back(i);
+    }
+
+    endbb = irs->insertBB("stringswitch.end");
+    results.push_back(std::make_pair(DtoConstInt(-1), irs->scopebb()));
+    llvm::SwitchInst *si =
+        llvm::SwitchInst::Create(len, endbb, byLength.size(), irs->scopebb());
+    for (const auto &group : byLength) {
+      llvm::BasicBlock *bb = irs->insertBBBefore(endbb, "stringswitch.len");
+      si->addCase(DtoConstSize_t(group.first), bb);
+      irs->scope() = IRScope(bb);
+      std::vector<bool> checked(group.first, false);
+      emitCharTree(group.second, group.first, checked);
+    }
+
+    irs->scope() = IRScope(endbb);
+    llvm::PHINode *index = irs->ir->CreatePHI(
+        LLType::getInt32Ty(irs->context()), results.size(), "stringswitch.idx");
+    for (const auto &r : results) {
+      index->addIncoming(r.first, r.second);
+    }
+    return index;
+  }
+};
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 class ToIRVisitor : public Visitor {
   IRState *irs;
 
@@ -242,6 +560,11 @@ public:
     // we can use a shared return bb for all these cases.
     const bool useRetValSlot = funcGen.scopes.currentCleanupScope() != 0;
     const bool sharedRetBlockExists = !!funcGen.retBlock;
+    if (stmt->isMusttail) {
+      markMusttailCall(stmt, llFunc, returnValue, useRetValSlot);
+    } else {
+      funcGen.localLifetimes.endForJump(0);
+    }
     if (useRetValSlot) {
       if (!sharedRetBlockExists) {
         funcGen.retBlock = irs->insertBB("return");
@@ -301,16 +624,14 @@ public:
     emitCoverageLinecountInc(stmt->loc);
 
     if (stmt->exp) {
-      elem *e;
       // a cast(void) around the expression is allowed, but doesn't require any
       // code
       if (stmt->exp->op == TOKcast && stmt->exp->type == Type::tvoid) {
         CastExp *cexp = static_cast<CastExp *>(stmt->exp);
-        e = toElemDtor(cexp->e1);
+        toElemDtor(cexp->e1);
       } else {
-        e = toElemDtor(stmt->exp);
+        toElemDtor(stmt->exp);
       }
-      delete e;
     }
   }
 
@@ -348,7 +669,18 @@ public:
     }
     auto brinstr =
         llvm::BranchInst::Create(ifbb, elsebb, cond_val, irs->scopebb());
-    PGO.addBranchWeights(brinstr, brweights);
+    if (brweights || !stmt->expectedCondition) {
+      PGO.addBranchWeights(brinstr, brweights);
+    } else {
+      // pragma(LDC_expect), using the weights LLVM uses for llvm.expect
+      const uint32_t likely = 2000, unlikely = 1;
+      const bool expectTrue = stmt->expectedCondition > 0;
+      brinstr->setMetadata(llvm::LLVMContext::MD_prof,
+                           llvm::MDBuilder(irs->context())
+                               .createBranchWeights(
+                                   expectTrue ? likely : unlikely,
+                                   expectTrue ? unlikely : likely));
+    }
 
     // replace current scope
     irs->scope() = IRScope(ifbb);
@@ -393,7 +725,10 @@ public:
 
     if (stmt->statement) {
       irs->DBuilder.EmitBlockStart(stmt->statement->loc);
+      auto &lifetimes = irs->funcGen().localLifetimes;
+      lifetimes.pushScope(stmt->statement);
       stmt->statement->accept(this);
+      lifetimes.popScope();
       irs->DBuilder.EmitBlockEnd();
     }
   }
@@ -426,7 +761,6 @@ public:
     emitCoverageLinecountInc(stmt->condition->loc);
     DValue *cond_e = toElemDtor(stmt->condition);
     LLValue *cond_val = DtoRVal(DtoCast(stmt->loc, cond_e, Type::tbool));
-    delete cond_e;
 
     // conditional branch
     auto branchinst =
@@ -501,7 +835,6 @@ public:
     emitCoverageLinecountInc(stmt->condition->loc);
     DValue *cond_e = toElemDtor(stmt->condition);
     LLValue *cond_val = DtoRVal(DtoCast(stmt->loc, cond_e, Type::tbool));
-    delete cond_e;
 
     // conditional branch
     auto branchinst =
@@ -515,6 +848,8 @@ public:
           PGO.createProfileWeightsWhileLoop(stmt->condition, loopcount);
       PGO.addBranchWeights(branchinst, brweights);
     }
+    setLoopHints(branchinst, stmt->unrollHint, stmt->vectorizeHint,
+                 irs->func()->optimizeForSpeed);
 
     // rewrite the scope
     irs->scope() = IRScope(endbb);
@@ -568,7 +903,6 @@ public:
       emitCoverageLinecountInc(stmt->condition->loc);
       DValue *cond_e = toElemDtor(stmt->condition);
       cond_val = DtoRVal(DtoCast(stmt->loc, cond_e, Type::tbool));
-      delete cond_e;
     } else {
       cond_val = DtoConstBool(true);
     }
@@ -598,15 +932,29 @@ public:
     irs->scope() = IRScope(forincbb);
 
     // increment
-    if (stmt->increment) {
+    if (stmt->foreachKey && stmt->increment) {
+      // The frontend only sets the key of a lowered foreach loop if it is
+      // below a bound of its own type, so incrementing it doesn't overflow.
+      // Telling LLVM so lets it compute the trip count and widen narrow keys
+      // (e.g., `foreach (int i; 0 .. n)`), which the vectorizer depends on.
+      emitCoverageLinecountInc(stmt->increment->loc);
+      VarDeclaration *key = stmt->foreachKey;
+      LLValue *keyptr = DtoLVal(makeVarDValue(key->type, key));
+      LLValue *v = DtoLoad(keyptr);
+      const bool isUnsigned = isLLVMUnsigned(key->type);
+      v = irs->ir->CreateAdd(v, LLConstantInt::get(v->getType(), 1), "",
+                             /*HasNUW=*/isUnsigned, /*HasNSW=*/!isUnsigned);
+      DtoStore(v, keyptr);
+    } else if (stmt->increment) {
       emitCoverageLinecountInc(stmt->increment->loc);
-      DValue *inc = toElemDtor(stmt->increment);
-      delete inc;
+      toElemDtor(stmt->increment);
     }
 
     // loop
     if (!irs->scopereturned()) {
-      llvm::BranchInst::Create(forbb, irs->scopebb());
+      auto latch = llvm::BranchInst::Create(forbb, irs->scopebb());
+      setLoopHints(latch, stmt->unrollHint, stmt->vectorizeHint,
+                   irs->func()->optimizeForSpeed);
     }
 
     irs->funcGen().jumpTargets.popLoopTarget();
@@ -868,7 +1216,8 @@ public:
     indices.reserve(caseCount);
     bool useSwitchInst = true;
 
-    // For string switches, sort the cases and emit the table data.
+    // For string switches, sort the cases and emit the table data (unless
+    // lowered to an inline decision tree).
     llvm::Value *stringTableSlice = nullptr;
     const bool isStringSwitch = !stmt->condition->type->isintegral();
     if (isStringSwitch) {
@@ -878,27 +1227,32 @@ public:
       cases = cases->copy();
       std::sort(cases->begin(), cases->end(), compareCaseStrings);
 
-      // Emit constants for the case values.
-      llvm::SmallVector<llvm::Constant *, 16> stringConsts;
-      stringConsts.reserve(caseCount);
       for (size_t i = 0; i < caseCount; ++i) {
-        stringConsts.push_back(toConstElem((*cases)[i]->exp, irs));
         indices.push_back(DtoConstUint(i));
       }
 
-      // Create internal global with the data table.
-      const auto elemTy = DtoType(stmt->condition->type);
-      const auto arrTy = llvm::ArrayType::get(elemTy, stringConsts.size());
-      const auto arrInit = LLConstantArray::get(arrTy, stringConsts);
-      const auto arr = new llvm::GlobalVariable(
-          irs->module, arrTy, true, llvm::GlobalValue::InternalLinkage, arrInit,
-          ".string_switch_table_data");
-
-      // Create D slice to pass to runtime later.
-      const auto arrPtr =
-          llvm::ConstantExpr::getBitCast(arr, getPtrToType(elemTy));
-      const auto arrLen = DtoConstSize_t(stringConsts.size());
-      stringTableSlice = DtoConstSlice(arrLen, arrPtr);
+      if (!StringSwitchLowering::isApplicable(cases)) {
+        // Emit constants for the case values.
+        llvm::SmallVector<llvm::Constant *, 16> stringConsts;
+        stringConsts.reserve(caseCount);
+        for (size_t i = 0; i < caseCount; ++i) {
+          stringConsts.push_back(toConstElem((*cases)[i]->exp, irs));
+        }
+
+        // Create internal global with the data table.
+        const auto elemTy = DtoType(stmt->condition->type);
+        const auto arrTy = llvm::ArrayType::get(elemTy, stringConsts.size());
+        const auto arrInit = LLConstantArray::get(arrTy, stringConsts);
+        const auto arr = new llvm::GlobalVariable(
+            irs->module, arrTy, true, llvm::GlobalValue::InternalLinkage,
+            arrInit, ".string_switch_table_data");
+
+        // Create D slice to pass to runtime later.
+        const auto arrPtr =
+            llvm::ConstantExpr::getBitCast(arr, getPtrToType(elemTy));
+        const auto arrLen = DtoConstSize_t(stringConsts.size());
+        stringTableSlice = DtoConstSlice(arrLen, arrPtr);
+      }
     } else {
       for (auto cs : *cases) {
         if (cs->exp->op == TOKvar) {
@@ -945,7 +1299,10 @@ public:
       // The case index value.
       LLValue *condVal;
       if (isStringSwitch) {
-        condVal = call_string_switch_runtime(stringTableSlice, stmt->condition);
+        condVal = stringTableSlice
+                      ? call_string_switch_runtime(stringTableSlice,
+                                                   stmt->condition)
+                      : StringSwitchLowering(irs, cases).emit(stmt->condition);
       } else {
         condVal = DtoRVal(toElemDtor(stmt->condition));
       }
@@ -955,12 +1312,51 @@ public:
       // statement bodies, because the counters should only count the jumps
       // directly from the switch statement and not "goto default", etc.
       llvm::SwitchInst *si;
+      // The cases peeled off into compare-and-branch chains in front of the
+      // switch because they dominate the profile.
+      std::vector<bool> peeled(caseCount, false);
       if (!PGO.emitsInstrumentation()) {
+        if (PGO.haveRegionCounts() && switchPeelThreshold > 0) {
+          uint64_t total =
+              stmt->sdefault ? PGO.getRegionCount(stmt->sdefault) : 0;
+          for (auto cs : *cases) {
+            total += PGO.getRegionCount(cs);
+          }
+
+          std::vector<size_t> hot;
+          for (size_t i = 0; i < caseCount; ++i) {
+            const uint64_t count = PGO.getRegionCount((*cases)[i]);
+            if (count > 0 && count * 100 >= total * switchPeelThreshold) {
+              hot.push_back(i);
+            }
+          }
+          std::sort(hot.begin(), hot.end(), [&](size_t a, size_t b) {
+            return PGO.getRegionCount((*cases)[a]) >
+                   PGO.getRegionCount((*cases)[b]);
+          });
+
+          for (size_t i : hot) {
+            const uint64_t count = PGO.getRegionCount((*cases)[i]);
+            LLValue *cmp =
+                irs->ir->CreateICmpEQ(condVal, indices[i], "hotcase");
+            llvm::BasicBlock *nextbb = irs->insertBB("coldcases");
+            auto br = llvm::BranchInst::Create(
+                funcGen.switchTargets.get((*cases)[i]), nextbb, cmp,
+                irs->scopebb());
+            total -= count;
+            PGO.addBranchWeights(br, PGO.createProfileWeights(count, total));
+            irs->scope() = IRScope(nextbb);
+            peeled[i] = true;
+          }
+        }
+
         si = llvm::SwitchInst::Create(condVal, defaultTargetBB, caseCount,
                                       irs->scopebb());
         for (size_t i = 0; i < caseCount; ++i) {
-          si->addCase(isaConstantInt(indices[i]),
-                      funcGen.switchTargets.get((*cases)[i]));
+          if (!peeled[i]) {
+            si->addCase(isaConstantInt(indices[i]),
+                        funcGen.switchTargets.get((*cases)[i]));
+          }
         }
       } else {
         auto switchbb = irs->scopebb();
@@ -996,9 +1392,10 @@ public:
         std::vector<uint64_t> case_prof_counts;
         case_prof_counts.push_back(
             stmt->sdefault ? PGO.getRegionCount(stmt->sdefault) : 0);
-        for (auto cs : *cases) {
-          auto w = PGO.getRegionCount(cs);
-          case_prof_counts.push_back(w);
+        for (size_t i = 0; i < caseCount; ++i) {
+          if (!peeled[i]) {
+            case_prof_counts.push_back(PGO.getRegionCount((*cases)[i]));
+          }
         }
 
         auto brweights = PGO.createProfileWeights(case_prof_counts);
@@ -1199,6 +1596,32 @@ public:
       }
     }
 
+    // Every tuple element gets its own copy of the body; report huge ones.
+    if (unrolledLoopSizeWarning) {
+      size_t total = 0, largest = 0, largestIndex = 0;
+      for (size_t i = 0; i < nstmt; i++) {
+        size_t size = countInstructions(
+            blocks[i], (i + 1 == nstmt) ? endbb : blocks[i + 1]);
+        total += size;
+        if (size > largest) {
+          largest = size;
+          largestIndex = i;
+        }
+      }
+      if (total > unrolledLoopSizeWarning) {
+        warning(stmt->loc, "foreach over %llu tuple elements unrolled to %llu "
+                           "instructions (threshold: %u)",
+                static_cast<unsigned long long>(nstmt),
+                static_cast<unsigned long long>(total),
+                unrolledLoopSizeWarning.getValue());
+        warningSupplemental(stmts[largestIndex]->loc,
+                            "largest copy of the body (element %llu): %llu "
+                            "instructions",
+                            static_cast<unsigned long long>(largestIndex),
+                            static_cast<unsigned long long>(largest));
+      }
+    }
+
     irs->scope() = IRScope(endbb);
 
     // end the dwarf lexical block
@@ -1442,7 +1865,14 @@ public:
     }
 
     // jump to condition
-    llvm::BranchInst::Create(condbb, irs->scopebb());
+    auto latch = llvm::BranchInst::Create(condbb, irs->scopebb());
+
+    // The loop is all there is to generated array operation functions.
+    if (irs->func()->decl->isArrayOp) {
+      markArrayOpLoop(latch, bodybb, irs->scopebb());
+    } else {
+      setLoopHints(latch, 0, 0, irs->func()->optimizeForSpeed);
+    }
 
     // end the dwarf lexical block
     irs->DBuilder.EmitBlockEnd();
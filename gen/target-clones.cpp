@@ -0,0 +1,350 @@
+//===-- target-clones.cpp -------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The body of a function with @targetClones("avx2", "sse4.2", "default") is
+// cloned for each of the targets. The function itself becomes a dispatcher
+// calling the clone for the first listed target supported by the CPU, which is
+// determined by a resolver (using CPUID) on the first call and cached in a
+// function pointer. This works the same on all platforms, whether or not they
+// support ifuncs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/target-clones.h"
+
+#include "declaration.h"
+#include "mars.h"
+#include "gen/irstate.h"
+#include "gen/llvm.h"
+#include "gen/logger.h"
+#include "gen/uda.h"
+#include "ir/irfunction.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+namespace {
+
+enum CPUIDRegister { EAX, EBX, ECX, EDX };
+
+// XCR0 bits which need to be set for the OS to preserve the register state.
+const unsigned XCR0_AVX = 0x6;     // XMM, YMM
+const unsigned XCR0_AVX512 = 0xe6; // XMM, YMM, opmask, ZMM
+
+/// A CPU feature and where CPUID reports it.
+struct CPUFeature {
+  const char *name;
+  unsigned leaf; // 1 or 7
+  CPUIDRegister reg;
+  unsigned bit;
+  unsigned xcr0;
+};
+
+const CPUFeature cpuFeatures[] = {
+    {"sse", 1, EDX, 25, 0},
+    {"sse2", 1, EDX, 26, 0},
+    {"sse3", 1, ECX, 0, 0},
+    {"ssse3", 1, ECX, 9, 0},
+    {"fma", 1, ECX, 12, XCR0_AVX},
+    {"sse4.1", 1, ECX, 19, 0},
+    {"sse4.2", 1, ECX, 20, 0},
+    {"popcnt", 1, ECX, 23, 0},
+    {"aes", 1, ECX, 25, 0},
+    {"avx", 1, ECX, 28, XCR0_AVX},
+    {"f16c", 1, ECX, 29, XCR0_AVX},
+    {"rdrnd", 1, ECX, 30, 0},
+    {"bmi", 7, EBX, 3, 0},
+    {"avx2", 7, EBX, 5, XCR0_AVX},
+    {"bmi2", 7, EBX, 8, 0},
+    {"avx512f", 7, EBX, 16, XCR0_AVX512},
+    {"avx512dq", 7, EBX, 17, XCR0_AVX512},
+    {"avx512cd", 7, EBX, 28, XCR0_AVX512},
+    {"avx512bw", 7, EBX, 30, XCR0_AVX512},
+    {"avx512vl", 7, EBX, 31, XCR0_AVX512},
+};
+
+/// The CPUID bits (of leaf 1 ECX/EDX and leaf 7 EBX) and XCR0 bits which need
+/// to be set for a target.
+struct FeatureMask {
+  unsigned leaf1ecx = 0;
+  unsigned leaf1edx = 0;
+  unsigned leaf7ebx = 0;
+  unsigned xcr0 = 0;
+};
+
+struct TargetClone {
+  std::string spec;
+  FeatureMask mask;
+  llvm::Function *func = nullptr;
+};
+
+bool parseTargetSpec(FuncDeclaration *fd, llvm::StringRef spec,
+                     FeatureMask &mask) {
+  llvm::SmallVector<llvm::StringRef, 4> fragments;
+  llvm::SplitString(spec, fragments, ",");
+  for (auto s : fragments) {
+    s = s.trim();
+    if (s.empty() || s.startswith("tune=")) {
+      continue;
+    }
+
+    const CPUFeature *feature = nullptr;
+    for (const auto &f : cpuFeatures) {
+      if (s == f.name) {
+        feature = &f;
+        break;
+      }
+    }
+    if (!feature) {
+      fd->error("cannot dispatch on '%s' of '@ldc.attributes.targetClones' "
+                "target '%s'; only CPU features are supported",
+                s.str().c_str(), spec.str().c_str());
+      return false;
+    }
+
+    const unsigned bit = 1u << feature->bit;
+    if (feature->leaf == 7) {
+      mask.leaf7ebx |= bit;
+    } else if (feature->reg == ECX) {
+      mask.leaf1ecx |= bit;
+    } else {
+      mask.leaf1edx |= bit;
+    }
+    mask.xcr0 |= feature->xcr0;
+  }
+  return true;
+}
+
+/// Returns the suffix of the name of the clone for a target.
+std::string getCloneSuffix(llvm::StringRef spec) {
+  std::string suffix;
+  for (char c : spec) {
+    if (llvm::isAlnum(c)) {
+      suffix += c;
+    } else if (c != ' ') {
+      suffix += '_';
+    }
+  }
+  return suffix;
+}
+
+llvm::Value *emitCPUID(llvm::IRBuilder<> &b, unsigned leaf) {
+  llvm::Type *i32 = b.getInt32Ty();
+  llvm::Type *regs[] = {i32, i32, i32, i32};
+  llvm::Type *params[] = {i32, i32};
+  auto fty = llvm::FunctionType::get(
+      llvm::StructType::get(b.getContext(), regs), params, false);
+  auto cpuid = llvm::InlineAsm::get(
+      fty, "cpuid",
+      "={ax},={bx},={cx},={dx},{ax},{cx},~{dirflag},~{fpsr},~{flags}", false);
+  llvm::Value *args[] = {b.getInt32(leaf), b.getInt32(0)};
+  return b.CreateCall(cpuid, args);
+}
+
+llvm::Value *emitXGETBV(llvm::IRBuilder<> &b) {
+  llvm::Type *i32 = b.getInt32Ty();
+  llvm::Type *regs[] = {i32, i32};
+  llvm::Type *params[] = {i32};
+  auto fty = llvm::FunctionType::get(
+      llvm::StructType::get(b.getContext(), regs), params, false);
+  auto xgetbv = llvm::InlineAsm::get(
+      fty, "xgetbv", "={ax},={dx},{cx},~{dirflag},~{fpsr},~{flags}", false);
+  llvm::Value *args[] = {b.getInt32(0)};
+  return b.CreateExtractValue(b.CreateCall(xgetbv, args), 0);
+}
+
+llvm::Value *emitHasBits(llvm::IRBuilder<> &b, llvm::Value *reg,
+                         unsigned bits) {
+  llvm::Value *mask = b.getInt32(bits);
+  return b.CreateICmpEQ(b.CreateAnd(reg, mask), mask);
+}
+
+/// Emits the function returning the clone to use on the executing CPU.
+llvm::Function *emitResolver(llvm::Function *func,
+                             llvm::ArrayRef<TargetClone> clones,
+                             llvm::Function *defaultClone) {
+  llvm::LLVMContext &ctx = func->getContext();
+  auto resolver = llvm::Function::Create(
+      llvm::FunctionType::get(func->getType(), false),
+      llvm::GlobalValue::InternalLinkage, func->getName() + ".resolver",
+      func->getParent());
+  resolver->addFnAttr(llvm::Attribute::NoInline);
+  resolver->addFnAttr(llvm::Attribute::NoUnwind);
+
+  auto entry = llvm::BasicBlock::Create(ctx, "entry", resolver);
+  auto xgetbvBB = llvm::BasicBlock::Create(ctx, "xgetbv", resolver);
+  auto selectBB = llvm::BasicBlock::Create(ctx, "select", resolver);
+  llvm::IRBuilder<> b(entry);
+
+  llvm::Value *maxLeaf = b.CreateExtractValue(emitCPUID(b, 0), EAX);
+  llvm::Value *leaf1 = emitCPUID(b, 1);
+  llvm::Value *leaf1ecx = b.CreateExtractValue(leaf1, ECX);
+  llvm::Value *leaf1edx = b.CreateExtractValue(leaf1, EDX);
+  // Higher leaves than the maximum return the data of the maximum leaf.
+  llvm::Value *leaf7ebx = b.CreateSelect(
+      b.CreateICmpUGE(maxLeaf, b.getInt32(7)),
+      b.CreateExtractValue(emitCPUID(b, 7), EBX), b.getInt32(0));
+  // XGETBV is only available if the OS enabled it (OSXSAVE).
+  b.CreateCondBr(emitHasBits(b, leaf1ecx, 1u << 27), xgetbvBB, selectBB);
+
+  b.SetInsertPoint(xgetbvBB);
+  llvm::Value *xcr0 = emitXGETBV(b);
+  b.CreateBr(selectBB);
+
+  b.SetInsertPoint(selectBB);
+  llvm::PHINode *xcr0Phi = b.CreatePHI(b.getInt32Ty(), 2, "xcr0");
+  xcr0Phi->addIncoming(b.getInt32(0), entry);
+  xcr0Phi->addIncoming(xcr0, xgetbvBB);
+
+  // Select the first supported target, in the order they were listed.
+  llvm::Value *result = defaultClone;
+  for (auto it = clones.rbegin(), end = clones.rend(); it != end; ++it) {
+    if (it->func == defaultClone) {
+      continue;
+    }
+    const FeatureMask &mask = it->mask;
+    llvm::Value *supported = b.CreateAnd(
+        b.CreateAnd(emitHasBits(b, leaf1ecx, mask.leaf1ecx),
+                    emitHasBits(b, leaf1edx, mask.leaf1edx)),
+        b.CreateAnd(emitHasBits(b, leaf7ebx, mask.leaf7ebx),
+                    emitHasBits(b, xcr0Phi, mask.xcr0)));
+    result = b.CreateSelect(supported, it->func, result);
+  }
+  b.CreateRet(result);
+
+  return resolver;
+}
+
+/// Replaces the body of func by a call of the function pointer returned by the
+/// resolver on the first call.
+void emitDispatcher(llvm::Function *func, llvm::Function *resolver) {
+  llvm::LLVMContext &ctx = func->getContext();
+  llvm::PointerType *fnPtrTy = func->getType();
+  auto cache = new llvm::GlobalVariable(
+      *func->getParent(), fnPtrTy, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantPointerNull::get(fnPtrTy), func->getName() + ".resolved");
+  const unsigned alignment = gDataLayout->getABITypeAlignment(fnPtrTy);
+#if LDC_LLVM_VER >= 309
+  const auto ordering = llvm::AtomicOrdering::Monotonic;
+#else
+  const auto ordering = llvm::Monotonic;
+#endif
+
+  func->dropAllReferences();
+#if LDC_LLVM_VER >= 309
+  func->setSubprogram(nullptr);
+#endif
+
+  auto entry = llvm::BasicBlock::Create(ctx, "entry", func);
+  auto resolveBB = llvm::BasicBlock::Create(ctx, "resolve", func);
+  auto callBB = llvm::BasicBlock::Create(ctx, "call", func);
+  llvm::IRBuilder<> b(entry);
+
+  // Racing threads resolve to the same function, so a monotonic load/store is
+  // enough.
+  llvm::LoadInst *cached = b.CreateLoad(cache);
+  cached->setAlignment(alignment);
+  cached->setAtomic(ordering);
+  b.CreateCondBr(b.CreateIsNull(cached), resolveBB, callBB);
+
+  b.SetInsertPoint(resolveBB);
+  llvm::Value *resolved = b.CreateCall(resolver);
+  llvm::StoreInst *store = b.CreateStore(resolved, cache);
+  store->setAlignment(alignment);
+  store->setAtomic(ordering);
+  b.CreateBr(callBB);
+
+  b.SetInsertPoint(callBB);
+  llvm::PHINode *callee = b.CreatePHI(fnPtrTy, 2);
+  callee->addIncoming(cached, entry);
+  callee->addIncoming(resolved, resolveBB);
+  llvm::SmallVector<llvm::Value *, 8> args;
+  for (auto it = func->arg_begin(), end = func->arg_end(); it != end; ++it) {
+    args.push_back(&*it);
+  }
+  llvm::CallInst *call = b.CreateCall(callee, args);
+  call->setCallingConv(func->getCallingConv());
+  call->setAttributes(func->getAttributes());
+  call->setTailCall();
+  if (func->getReturnType()->isVoidTy()) {
+    b.CreateRetVoid();
+  } else {
+    b.CreateRet(call);
+  }
+}
+
+} // anonymous namespace
+
+void emitTargetClones(IrFunction *irFunc) {
+  FuncDeclaration *fd = irFunc->decl;
+  llvm::Function *func = irFunc->func;
+  IF_LOG Logger::println("Emitting target clones of %s", fd->toPrettyChars());
+  LOG_SCOPE;
+
+  const llvm::Triple &triple = *global.params.targetTriple;
+  if (triple.getArch() != llvm::Triple::x86 &&
+      triple.getArch() != llvm::Triple::x86_64) {
+    fd->error("'@ldc.attributes.targetClones' is only supported for x86 "
+              "targets");
+    return;
+  }
+  if (func->isVarArg() || fd->naked) {
+    fd->error("'@ldc.attributes.targetClones' cannot be applied to variadic "
+              "or naked functions");
+    return;
+  }
+  // The definition is only there for inlining, keep it as is.
+  if (func->hasAvailableExternallyLinkage()) {
+    return;
+  }
+
+  std::vector<TargetClone> clones;
+  bool hasDefault = false;
+  for (const auto &spec : irFunc->targetClones) {
+    TargetClone clone;
+    clone.spec = llvm::StringRef(spec).trim();
+    if (clone.spec == "default") {
+      if (hasDefault) {
+        continue;
+      }
+      hasDefault = true;
+    } else if (!parseTargetSpec(fd, clone.spec, clone.mask)) {
+      return;
+    }
+    clones.push_back(clone);
+  }
+  if (!hasDefault) {
+    fd->error("'@ldc.attributes.targetClones' requires a \"default\" target");
+    return;
+  }
+
+  llvm::Function *defaultClone = nullptr;
+  for (auto &clone : clones) {
+    llvm::ValueToValueMapTy vmap;
+#if LDC_LLVM_VER >= 309
+    clone.func = llvm::CloneFunction(func, vmap);
+#else
+    clone.func = llvm::CloneFunction(func, vmap, /*ModuleLevelChanges=*/false);
+    func->getParent()->getFunctionList().push_back(clone.func);
+#endif
+    clone.func->setName(func->getName() + "." + getCloneSuffix(clone.spec));
+    clone.func->setLinkage(llvm::GlobalValue::InternalLinkage);
+    clone.func->setDLLStorageClass(llvm::GlobalValue::DefaultStorageClass);
+    clone.func->setComdat(nullptr);
+    if (clone.spec == "default") {
+      defaultClone = clone.func;
+    } else {
+      applyTargetSpec(clone.func, clone.spec);
+    }
+  }
+
+  emitDispatcher(func, emitResolver(func, clones, defaultClone));
+}
@@ -0,0 +1,24 @@
+//===-- gen/target-clones.h - Function multiversioning ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Compiles a function for several targets (@ldc.attributes.targetClones),
+// with the function dispatching to the best one for the CPU at runtime.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_TARGET_CLONES_H
+#define LDC_GEN_TARGET_CLONES_H
+
+struct IrFunction;
+
+/// Turns the (defined) function into a dispatcher to clones of its body for
+/// the targets listed in irFunc->targetClones.
+void emitTargetClones(IrFunction *irFunc);
+
+#endif
@@ -29,6 +29,7 @@ int Target::realalignsize;
 int Target::c_longsize;
 int Target::c_long_doublesize;
 bool Target::reverseCppOverloads;
+bool Target::realIsDouble;
 */
 
 void Target::_init() {
@@ -40,6 +41,7 @@ void Target::_init() {
   realalignsize = gDataLayout->getABITypeAlignment(real);
   c_longsize = global.params.is64bit ? 8 : 4;
   c_long_doublesize = realsize;
+  realIsDouble = real->isDoubleTy();
 
   // according to DMD, only for MSVC++:
   reverseCppOverloads = global.params.targetTriple->isWindowsMSVCEnvironment();
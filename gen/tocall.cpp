@@ -12,6 +12,7 @@
 #include "mtype.h"
 #include "target.h"
 #include "pragma.h"
+#include "template.h"
 #include "gen/abi.h"
 #include "gen/classes.h"
 #include "gen/dvalue.h"
@@ -257,6 +258,317 @@ static LLValue *getTypeinfoArrayArgumentForDVarArg(Expressions *arguments,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static TypeVector *getSimdVectorType(CallExp *e, Type *t, const char *what) {
+  Type *tb = t->toBasetype();
+  if (tb->ty != Tvector) {
+    e->error("%s must be a vector type, not %s", what, t->toChars());
+    fatal();
+  }
+  return static_cast<TypeVector *>(tb);
+}
+
+static void checkSimdArgCount(CallExp *e, const char *name, size_t count) {
+  if (e->arguments->dim != count) {
+    e->error("%s intrinsic expects %llu arguments", name,
+             static_cast<unsigned long long>(count));
+    fatal();
+  }
+}
+
+// Converts a D mask vector (any integral vector, lanes being either all zero or
+// all ones as produced by vector comparisons) to the <N x i1> LLVM expects.
+static LLValue *toSimdMask(IRState *p, CallExp *e, Expression *maskExp,
+                           unsigned numLanes) {
+  TypeVector *tv = getSimdVectorType(e, maskExp->type, "mask");
+  if (!tv->isintegral()) {
+    e->error("mask must be an integral vector, not %s",
+             maskExp->type->toChars());
+    fatal();
+  }
+  LLValue *mask = DtoRVal(maskExp);
+  if (mask->getType()->getVectorNumElements() != numLanes) {
+    e->error("mask has %u lanes, but %u are required",
+             mask->getType()->getVectorNumElements(), numLanes);
+    fatal();
+  }
+  return p->ir->CreateICmpNE(mask,
+                             llvm::Constant::getNullValue(mask->getType()));
+}
+
+// Folds all lanes of a vector with a log2(N)-deep tree of shuffles, which maps
+// to horizontal instructions where the target has them and to a sequence of
+// plain vector operations everywhere else.
+static LLValue *emitSimdReduction(IRState *p, CallExp *e, const char *op,
+                                  TypeVector *tv, LLValue *vec) {
+  const bool isFloat = tv->isfloating();
+  const bool isUnsigned = tv->isunsigned();
+  const bool isBitwise =
+      !strcmp(op, "and") || !strcmp(op, "or") || !strcmp(op, "xor");
+  if (isFloat && isBitwise) {
+    e->error("simd.reduce.%s intrinsic requires an integral vector", op);
+    fatal();
+  }
+
+  const unsigned numLanes = vec->getType()->getVectorNumElements();
+  if (numLanes & (numLanes - 1)) {
+    e->error("simd.reduce.%s intrinsic requires a power-of-two number of "
+             "lanes",
+             op);
+    fatal();
+  }
+
+  LLType *i32 = LLType::getInt32Ty(gIR->context());
+  for (unsigned width = numLanes / 2; width > 0; width /= 2) {
+    llvm::SmallVector<LLConstant *, 16> mask;
+    for (unsigned i = 0; i < numLanes; ++i) {
+      mask.push_back(i < width ? DtoConstUint(width + i)
+                               : llvm::UndefValue::get(i32));
+    }
+    LLValue *upper = p->ir->CreateShuffleVector(
+        vec, llvm::UndefValue::get(vec->getType()),
+        llvm::ConstantVector::get(mask));
+
+    if (!strcmp(op, "add")) {
+      vec = isFloat ? p->ir->CreateFAdd(vec, upper)
+                    : p->ir->CreateAdd(vec, upper);
+    } else if (!strcmp(op, "mul")) {
+      vec = isFloat ? p->ir->CreateFMul(vec, upper)
+                    : p->ir->CreateMul(vec, upper);
+    } else if (!strcmp(op, "and")) {
+      vec = p->ir->CreateAnd(vec, upper);
+    } else if (!strcmp(op, "or")) {
+      vec = p->ir->CreateOr(vec, upper);
+    } else if (!strcmp(op, "xor")) {
+      vec = p->ir->CreateXor(vec, upper);
+    } else {
+      const bool isMin = !strcmp(op, "min");
+      assert(isMin || !strcmp(op, "max"));
+      LLValue *cmp;
+      if (isFloat) {
+        cmp = isMin ? p->ir->CreateFCmpOLT(vec, upper)
+                    : p->ir->CreateFCmpOGT(vec, upper);
+      } else if (isUnsigned) {
+        cmp = isMin ? p->ir->CreateICmpULT(vec, upper)
+                    : p->ir->CreateICmpUGT(vec, upper);
+      } else {
+        cmp = isMin ? p->ir->CreateICmpSLT(vec, upper)
+                    : p->ir->CreateICmpSGT(vec, upper);
+      }
+      vec = p->ir->CreateSelect(cmp, vec, upper);
+    }
+  }
+
+  return p->ir->CreateExtractElement(vec, DtoConstUint(0));
+}
+
+// Lowers the portable ldc.simd.* intrinsics directly to vector instructions.
+static bool DtoLowerSimdIntrinsic(IRState *p, FuncDeclaration *fndecl,
+                                  CallExp *e, DValue *&result) {
+  // T extractelement(V)(V vec, int index)
+  if (fndecl->llvmInternal == LLVMsimd_extractelement) {
+    checkSimdArgCount(e, "simd.extractelement", 2);
+    getSimdVectorType(e, (*e->arguments)[0]->type, "first argument");
+    LLValue *vec = DtoRVal((*e->arguments)[0]);
+    LLValue *index = DtoRVal((*e->arguments)[1]);
+    result = new DImValue(e->type, p->ir->CreateExtractElement(vec, index));
+    return true;
+  }
+
+  // V insertelement(V, T)(V vec, T value, int index)
+  if (fndecl->llvmInternal == LLVMsimd_insertelement) {
+    checkSimdArgCount(e, "simd.insertelement", 3);
+    getSimdVectorType(e, (*e->arguments)[0]->type, "first argument");
+    LLValue *vec = DtoRVal((*e->arguments)[0]);
+    LLValue *val = DtoRVal((*e->arguments)[1]);
+    LLValue *index = DtoRVal((*e->arguments)[2]);
+    result =
+        new DImValue(e->type, p->ir->CreateInsertElement(vec, val, index));
+    return true;
+  }
+
+  // R shufflevector(R, V, mask...)(V a, V b)
+  if (fndecl->llvmInternal == LLVMsimd_shufflevector) {
+    checkSimdArgCount(e, "simd.shufflevector", 2);
+    getSimdVectorType(e, (*e->arguments)[0]->type, "first argument");
+    getSimdVectorType(e, e->type, "return type");
+    LLValue *a = DtoRVal((*e->arguments)[0]);
+    LLValue *b = DtoRVal((*e->arguments)[1]);
+    const unsigned numInputLanes = a->getType()->getVectorNumElements();
+
+    // The mask consists of the value arguments of the template instance.
+    TemplateInstance *ti = fndecl->parent->isTemplateInstance();
+    llvm::SmallVector<LLConstant *, 16> mask;
+    if (ti && ti->tiargs) {
+      for (auto o : *ti->tiargs) {
+        Expression *ie = isExpression(o);
+        if (!ie) {
+          continue;
+        }
+        ie = ie->optimize(WANTvalue);
+        if (ie->op != TOKint64) {
+          e->error("simd.shufflevector mask must consist of integer "
+                   "constants, not %s",
+                   ie->toChars());
+          fatal();
+        }
+        const dinteger_t lane = ie->toInteger();
+        if (lane >= 2 * numInputLanes) {
+          e->error("simd.shufflevector mask index %llu out of range [0, %u)",
+                   static_cast<unsigned long long>(lane), 2 * numInputLanes);
+          fatal();
+        }
+        mask.push_back(DtoConstUint(static_cast<unsigned>(lane)));
+      }
+    }
+
+    LLType *resultType = DtoType(e->type);
+    if (mask.size() != resultType->getVectorNumElements()) {
+      e->error("simd.shufflevector mask has %llu elements, but the result "
+               "type %s has %u lanes",
+               static_cast<unsigned long long>(mask.size()),
+               e->type->toChars(), resultType->getVectorNumElements());
+      fatal();
+    }
+
+    LLValue *ret =
+        p->ir->CreateShuffleVector(a, b, llvm::ConstantVector::get(mask));
+    result = new DImValue(e->type, ret);
+    return true;
+  }
+
+  // V maskedLoad(V, M)(const(void)* ptr, M mask, V passThru)
+  if (fndecl->llvmInternal == LLVMsimd_maskedload) {
+    checkSimdArgCount(e, "simd.maskedload", 3);
+#if LDC_LLVM_VER >= 307
+    getSimdVectorType(e, e->type, "return type");
+    LLType *vecType = DtoType(e->type);
+    LLValue *ptr =
+        DtoBitCast(DtoRVal((*e->arguments)[0]), getPtrToType(vecType));
+    LLValue *mask = toSimdMask(p, e, (*e->arguments)[1],
+                               vecType->getVectorNumElements());
+    LLValue *passThru = DtoRVal((*e->arguments)[2]);
+    LLValue *ret = p->ir->CreateMaskedLoad(
+        ptr, getABITypeAlign(vecType->getVectorElementType()), mask, passThru);
+    result = new DImValue(e->type, ret);
+#else
+    e->error("simd.maskedload intrinsic requires LLVM 3.7+");
+    fatal();
+#endif
+    return true;
+  }
+
+  // void maskedStore(V, M)(V value, void* ptr, M mask)
+  if (fndecl->llvmInternal == LLVMsimd_maskedstore) {
+    checkSimdArgCount(e, "simd.maskedstore", 3);
+#if LDC_LLVM_VER >= 307
+    getSimdVectorType(e, (*e->arguments)[0]->type, "first argument");
+    LLValue *val = DtoRVal((*e->arguments)[0]);
+    LLType *vecType = val->getType();
+    LLValue *ptr =
+        DtoBitCast(DtoRVal((*e->arguments)[1]), getPtrToType(vecType));
+    LLValue *mask = toSimdMask(p, e, (*e->arguments)[2],
+                               vecType->getVectorNumElements());
+    p->ir->CreateMaskedStore(
+        val, ptr, getABITypeAlign(vecType->getVectorElementType()), mask);
+#else
+    e->error("simd.maskedstore intrinsic requires LLVM 3.7+");
+    fatal();
+#endif
+    result = nullptr;
+    return true;
+  }
+
+  // V gather(V, I, M)(const(T)* base, I indices, M mask, V passThru)
+  if (fndecl->llvmInternal == LLVMsimd_gather) {
+    checkSimdArgCount(e, "simd.gather", 4);
+#if LDC_LLVM_VER >= 309
+    getSimdVectorType(e, e->type, "return type");
+    TypeVector *indicesType =
+        getSimdVectorType(e, (*e->arguments)[1]->type, "indices");
+    if (!indicesType->isintegral()) {
+      e->error("indices must be an integral vector, not %s",
+               indicesType->toChars());
+      fatal();
+    }
+    LLType *vecType = DtoType(e->type);
+    LLType *elemType = vecType->getVectorElementType();
+    LLValue *base =
+        DtoBitCast(DtoRVal((*e->arguments)[0]), getPtrToType(elemType));
+    LLValue *indices = DtoRVal((*e->arguments)[1]);
+    if (indices->getType()->getVectorNumElements() !=
+        vecType->getVectorNumElements()) {
+      e->error("simd.gather intrinsic requires as many indices as result "
+               "lanes");
+      fatal();
+    }
+    LLValue *ptrs = p->ir->CreateGEP(base, indices);
+    LLValue *mask = toSimdMask(p, e, (*e->arguments)[2],
+                               vecType->getVectorNumElements());
+    LLValue *passThru = DtoRVal((*e->arguments)[3]);
+    LLValue *ret = p->ir->CreateMaskedGather(ptrs, getABITypeAlign(elemType),
+                                             mask, passThru);
+    result = new DImValue(e->type, ret);
+#else
+    e->error("simd.gather intrinsic requires LLVM 3.9+");
+    fatal();
+#endif
+    return true;
+  }
+
+  // T reduce.<op>(V)(V vec)
+  if (fndecl->llvmInternal == LLVMsimd_reduce) {
+    checkSimdArgCount(e, "simd.reduce", 1);
+    assert(fndecl->intrinsicName);
+    const char *op = strrchr(fndecl->intrinsicName, '.') + 1;
+    TypeVector *tv =
+        getSimdVectorType(e, (*e->arguments)[0]->type, "first argument");
+    LLValue *vec = DtoRVal((*e->arguments)[0]);
+    result = new DImValue(e->type, emitSimdReduction(p, e, op, tv, vec));
+    return true;
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+#if LDC_LLVM_VER >= 309
+const auto orderingMonotonic = llvm::AtomicOrdering::Monotonic;
+const auto orderingAcquire = llvm::AtomicOrdering::Acquire;
+const auto orderingRelease = llvm::AtomicOrdering::Release;
+const auto orderingAcquireRelease = llvm::AtomicOrdering::AcquireRelease;
+const auto orderingSequentiallyConsistent =
+    llvm::AtomicOrdering::SequentiallyConsistent;
+#else
+const auto orderingMonotonic = llvm::Monotonic;
+const auto orderingAcquire = llvm::Acquire;
+const auto orderingRelease = llvm::Release;
+const auto orderingAcquireRelease = llvm::AcquireRelease;
+const auto orderingSequentiallyConsistent = llvm::SequentiallyConsistent;
+#endif
+}
+
+/// Returns whether the given ordering is valid for a successful cmpxchg, i.e.,
+/// at least monotonic.
+static bool isValidCmpxchgSuccessOrdering(llvm::AtomicOrdering ordering) {
+  return ordering == orderingMonotonic || ordering == orderingAcquire ||
+         ordering == orderingRelease || ordering == orderingAcquireRelease ||
+         ordering == orderingSequentiallyConsistent;
+}
+
+/// Returns whether the given ordering is valid for a failed cmpxchg, which
+/// doesn't store: neither release nor acq_rel, and not stronger than the
+/// success ordering.
+static bool isValidCmpxchgFailureOrdering(llvm::AtomicOrdering successOrdering,
+                                          llvm::AtomicOrdering ordering) {
+  // These are ordered by strength.
+  return (ordering == orderingMonotonic || ordering == orderingAcquire ||
+          ordering == orderingSequentiallyConsistent) &&
+         ordering <= llvm::AtomicCmpXchgInst::getStrongestFailureOrdering(
+                         successOrdering);
+}
+
 bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
                             DValue *&result) {
   // va_start instruction
@@ -443,15 +755,34 @@ bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
   }
 
   // cmpxchg instruction
+  // (ptr, cmp, val, successOrdering [, failureOrdering [, weak]])
   if (fndecl->llvmInternal == LLVMatomic_cmp_xchg) {
-    if (e->arguments->dim != 4) {
-      e->error("cmpxchg instruction expects 4 arguments");
+    if (e->arguments->dim < 4 || e->arguments->dim > 6) {
+      e->error("cmpxchg instruction expects 4 to 6 arguments");
       fatal();
     }
     Expression *exp1 = (*e->arguments)[0];
     Expression *exp2 = (*e->arguments)[1];
     Expression *exp3 = (*e->arguments)[2];
-    auto atomicOrdering = llvm::AtomicOrdering((*e->arguments)[3]->toInteger());
+    auto successOrdering =
+        llvm::AtomicOrdering((*e->arguments)[3]->toInteger());
+    if (!isValidCmpxchgSuccessOrdering(successOrdering)) {
+      e->error("cmpxchg success ordering must be at least monotonic");
+      fatal();
+    }
+    auto failureOrdering =
+        e->arguments->dim > 4
+            ? llvm::AtomicOrdering((*e->arguments)[4]->toInteger())
+            : llvm::AtomicCmpXchgInst::getStrongestFailureOrdering(
+                  successOrdering);
+    if (!isValidCmpxchgFailureOrdering(successOrdering, failureOrdering)) {
+      e->error("cmpxchg failure ordering must be monotonic, acquire or "
+               "sequentially consistent, and no stronger than the success "
+               "ordering");
+      fatal();
+    }
+    const bool isWeak =
+        e->arguments->dim > 5 && (*e->arguments)[5]->toInteger() != 0;
     LLValue *ptr = DtoRVal(exp1);
     LLType *pointeeType = ptr->getType()->getContainedType(0);
     DValue *dcmp = toElem(exp2);
@@ -488,10 +819,32 @@ bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
       val = DtoRVal(dval);
     }
 
-    LLValue *ret = p->ir->CreateAtomicCmpXchg(ptr, cmp, val, atomicOrdering,
-                                              atomicOrdering);
+    llvm::AtomicCmpXchgInst *cmpxchg = p->ir->CreateAtomicCmpXchg(
+        ptr, cmp, val, successOrdering, failureOrdering);
+    cmpxchg->setWeak(isWeak);
+
+    // If the declaration returns a struct { T previousValue; bool exchanged; },
+    // return the success flag too. This is needed for weak cmpxchg, which may
+    // fail spuriously even if the previous value equals cmp.
+    // The pair is only returned if it differs from the exchanged type, which
+    // may be such a struct itself.
+    Type *retType = e->type->toBasetype();
+    if (!retType->equals(exp3->type->toBasetype()) && retType->ty == Tstruct &&
+        static_cast<TypeStruct *>(retType)->sym->fields.dim == 2 &&
+        static_cast<TypeStruct *>(retType)->sym->fields[1]->type->ty ==
+            Tbool) {
+      LLValue *mem = DtoAlloca(e->type, ".cmpxchg_result");
+      LLValue *previous = p->ir->CreateExtractValue(cmpxchg, 0);
+      DtoStore(previous, DtoBitCast(DtoGEPi(mem, 0, 0),
+                                    getPtrToType(previous->getType())));
+      LLValue *success = p->ir->CreateExtractValue(cmpxchg, 1);
+      DtoStoreZextI8(success, DtoGEPi(mem, 0, 1));
+      result = new DLValue(e->type, mem);
+      return true;
+    }
+
     // Use the same quickfix as for dragonegg - see r210956
-    ret = p->ir->CreateExtractValue(ret, 0);
+    LLValue *ret = p->ir->CreateExtractValue(cmpxchg, 0);
     if (ret->getType() != pointeeType) {
       ret = DtoAllocaDump(ret, exp3->type);
       result = new DLValue(exp3->type, ret);
@@ -623,7 +976,33 @@ bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
     return true;
   }
 
-  return false;
+  if (fndecl->llvmInternal == LLVMnontemporal_load) {
+    if (e->arguments->dim != 1) {
+      e->error("nontemporal.load intrinsic expects 1 argument");
+      fatal();
+    }
+
+    Expression *exp1 = (*e->arguments)[0];
+    LLValue *ptr = DtoBitCast(DtoRVal(exp1), getPtrToType(DtoType(e->type)));
+    result = new DImValue(e->type, DtoNontemporalLoad(ptr));
+    return true;
+  }
+
+  if (fndecl->llvmInternal == LLVMnontemporal_store) {
+    if (e->arguments->dim != 2) {
+      e->error("nontemporal.store intrinsic expects 2 arguments");
+      fatal();
+    }
+
+    Expression *exp1 = (*e->arguments)[0];
+    Expression *exp2 = (*e->arguments)[1];
+    LLValue *val = DtoRVal(exp1);
+    LLValue *ptr = DtoBitCast(DtoRVal(exp2), getPtrToType(val->getType()));
+    DtoNontemporalStore(val, ptr);
+    return true;
+  }
+
+  return DtoLowerSimdIntrinsic(p, fndecl, e, result);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -898,7 +1277,8 @@ DValue *DtoCallFunction(Loc &loc, Type *resulttype, DValue *fnval,
 
 #if LDC_LLVM_VER >= 309
   // PGO: Insert instrumentation or attach profile metadata at indirect call
-  // sites.
+  // sites. For delegate calls, the function pointer is profiled; the context
+  // is passed unchanged to the promoted direct calls.
   if (!call.getCalledFunction()) {
     auto &PGO = gIR->funcGen().pgo;
     PGO.emitIndirectCallPGO(call.getInstruction(), callable);
@@ -7,6 +7,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "gen/aa.h"
 #include "gen/arrays.h"
 #include "gen/binops.h"
 #include "gen/classes.h"
@@ -160,30 +161,32 @@ public:
     Type * const t = e->type->toBasetype();
     Type * const cty = t->nextOf()->toBasetype();
 
-    auto _init = buildStringLiteralConstant(e, t->ty != Tsarray);
+    llvm::GlobalVariable *gvar = getStringImportBlob(e);
+    if (gvar == nullptr) {
+      auto _init = buildStringLiteralConstant(e, t->ty != Tsarray);
 
-    if (t->ty == Tsarray) {
-      result = _init;
-      return;
-    }
+      if (t->ty == Tsarray) {
+        result = _init;
+        return;
+      }
 
-    auto stringLiteralCache = stringLiteralCacheForType(cty);
-    llvm::StringRef key(e->toChars());
-    llvm::GlobalVariable *gvar =
-        (stringLiteralCache->find(key) == stringLiteralCache->end())
-            ? nullptr
-            : (*stringLiteralCache)[key];
-    if (gvar == nullptr) {
-      llvm::GlobalValue::LinkageTypes _linkage =
-          llvm::GlobalValue::PrivateLinkage;
-      gvar = new llvm::GlobalVariable(gIR->module, _init->getType(), true,
-                                      _linkage, _init, ".str");
+      auto stringLiteralCache = stringLiteralCacheForType(cty);
+      llvm::StringRef key(e->toChars());
+      gvar = (stringLiteralCache->find(key) == stringLiteralCache->end())
+                 ? nullptr
+                 : (*stringLiteralCache)[key];
+      if (gvar == nullptr) {
+        llvm::GlobalValue::LinkageTypes _linkage =
+            llvm::GlobalValue::PrivateLinkage;
+        gvar = new llvm::GlobalVariable(gIR->module, _init->getType(), true,
+                                        _linkage, _init, ".str");
 #if LDC_LLVM_VER >= 309
-      gvar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        gvar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
 #else
-      gvar->setUnnamedAddr(true);
+        gvar->setUnnamedAddr(true);
 #endif
-      (*stringLiteralCache)[key] = gvar;
+        (*stringLiteralCache)[key] = gvar;
+      }
     }
 
     llvm::ConstantInt *zero =
@@ -737,6 +740,25 @@ public:
 
   //////////////////////////////////////////////////////////////////////////////
 
+  void visit(AssocArrayLiteralExp *e) override {
+    IF_LOG Logger::print("AssocArrayLiteralExp::toConstElem: %s @ %s\n",
+                         e->toChars(), e->type->toChars());
+    LOG_SCOPE;
+
+    // The AA can only be laid out as constant data if it is never modified.
+    // A const AA may still be modified through a mutable reference.
+    if (e->type->toBasetype()->ty == Taarray && e->type->isImmutable()) {
+      result = DtoConstAA(e);
+      if (result) {
+        return;
+      }
+    }
+
+    visit(static_cast<Expression *>(e));
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+
   void visit(Expression *e) override {
     e->error("expression '%s' is not a constant", e->toChars());
     if (!global.gag) {
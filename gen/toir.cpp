@@ -27,6 +27,7 @@
 #include "gen/nested.h"
 #include "gen/optimizer.h"
 #include "gen/pragma.h"
+#include "gen/profilegc.h"
 #include "gen/runtime.h"
 #include "gen/structs.h"
 #include "gen/tollvm.h"
@@ -193,6 +194,30 @@ void pushVarDtorCleanup(IRState *p, VarDeclaration *vd) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/// Returns the implementation of the virtual method `fdecl` for instances of
+/// type `t` if it is known statically, i.e., if `t` is a final class.
+static FuncDeclaration *getFinalClassOverride(Type *t, FuncDeclaration *fdecl) {
+  if (t->ty != Tclass)
+    return nullptr;
+  ClassDeclaration *cd = static_cast<TypeClass *>(t)->sym;
+  if (!(cd->storage_class & STCfinal) || cd->isInterfaceDeclaration() ||
+      cd->cpp) {
+    return nullptr;
+  }
+
+  // Methods of interfaces are indexed into the interface vtables.
+  ClassDeclaration *owner = fdecl->toParent()->isClassDeclaration();
+  if (!owner || owner->isInterfaceDeclaration() || fdecl->vtblIndex < 0 ||
+      static_cast<size_t>(fdecl->vtblIndex) >= cd->vtbl.dim) {
+    return nullptr;
+  }
+
+  FuncDeclaration *impl = cd->vtbl[fdecl->vtblIndex]->isFuncDeclaration();
+  return impl && !impl->isAbstract() ? impl : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 static Expression *skipOverCasts(Expression *e) {
   while (e->op == TOKcast)
     e = static_cast<CastExp *>(e)->e1;
@@ -381,31 +406,33 @@ public:
 
     LLType *ct = DtoMemType(cty);
 
-    llvm::StringMap<llvm::GlobalVariable *> *stringLiteralCache =
-        stringLiteralCacheForType(cty);
-    LLConstant *_init = buildStringLiteralConstant(e, true);
-    const auto at = _init->getType();
-
-    llvm::StringRef key(e->toChars());
-    llvm::GlobalVariable *gvar =
-        (stringLiteralCache->find(key) == stringLiteralCache->end())
-            ? nullptr
-            : (*stringLiteralCache)[key];
+    llvm::GlobalVariable *gvar = getStringImportBlob(e);
     if (gvar == nullptr) {
-      llvm::GlobalValue::LinkageTypes _linkage =
-          llvm::GlobalValue::PrivateLinkage;
-      IF_LOG {
-        Logger::cout() << "type: " << *at << '\n';
-        Logger::cout() << "init: " << *_init << '\n';
-      }
-      gvar = new llvm::GlobalVariable(gIR->module, at, true, _linkage, _init,
-                                      ".str");
+      llvm::StringMap<llvm::GlobalVariable *> *stringLiteralCache =
+          stringLiteralCacheForType(cty);
+      LLConstant *_init = buildStringLiteralConstant(e, true);
+      const auto at = _init->getType();
+
+      llvm::StringRef key(e->toChars());
+      gvar = (stringLiteralCache->find(key) == stringLiteralCache->end())
+                 ? nullptr
+                 : (*stringLiteralCache)[key];
+      if (gvar == nullptr) {
+        llvm::GlobalValue::LinkageTypes _linkage =
+            llvm::GlobalValue::PrivateLinkage;
+        IF_LOG {
+          Logger::cout() << "type: " << *at << '\n';
+          Logger::cout() << "init: " << *_init << '\n';
+        }
+        gvar = new llvm::GlobalVariable(gIR->module, at, true, _linkage, _init,
+                                        ".str");
 #if LDC_LLVM_VER >= 309
-      gvar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        gvar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
 #else
-      gvar->setUnnamedAddr(true);
+        gvar->setUnnamedAddr(true);
 #endif
-      (*stringLiteralCache)[key] = gvar;
+        (*stringLiteralCache)[key] = gvar;
+      }
     }
 
     llvm::ConstantInt *zero =
@@ -445,7 +472,7 @@ public:
     LOG_SCOPE;
 
     if (e->e1->op == TOKarraylength) {
-      Logger::println("performing array.length assignment");
+      IF_LOG Logger::println("performing array.length assignment");
       ArrayLengthExp *ale = static_cast<ArrayLengthExp *>(e->e1);
       DLValue arrval(ale->e1->type, DtoLVal(ale->e1));
       DValue *newlen = toElem(e->e2);
@@ -466,7 +493,7 @@ public:
 
       Declaration *d = static_cast<VarExp *>(e->e1)->var;
       if (d->storage_class & (STCref | STCout)) {
-        Logger::println("performing ref variable initialization");
+        IF_LOG Logger::println("performing ref variable initialization");
         // Note that the variable value is accessed directly (instead
         // of via getLVal(), which would perform a load from the
         // uninitialized location), and that rhs is stored as an l-value!
@@ -488,7 +515,7 @@ public:
       // Check if this is an initialization of a static array with an array
       // literal that the frontend has foolishly rewritten into an
       // assignment of a dynamic array literal to a slice.
-      Logger::println("performing static array literal assignment");
+      IF_LOG Logger::println("performing static array literal assignment");
       SliceExp *const se = static_cast<SliceExp *>(e->e1);
       Type *const t2 = e->e2->type->toBasetype();
       Type *const ta = se->e1->type->toBasetype();
@@ -512,10 +539,23 @@ public:
       return;
     }
 
+    // struct init symbol, e.g., `S v = S.init;` or a default-initialized `S v;`
+    if (e->e1->type->toBasetype()->ty == Tstruct && e->e2->op == TOKvar) {
+      auto ve = static_cast<VarExp *>(e->e2);
+      if (SymbolDeclaration *sdecl = ve->var->isSymbolDeclaration()) {
+        IF_LOG Logger::println("performing aggregate default initialization");
+        DtoResolveStruct(sdecl->dsym);
+        // don't copy anything to empty structs
+        if (sdecl->dsym->fields.dim > 0)
+          DtoCopyDefaultInit(sdecl->dsym, DtoLVal(result));
+        return;
+      }
+    }
+
     DValue *r = toElem(e->e2);
 
     if (e->e1->type->toBasetype()->ty == Tstruct && e->e2->op == TOKint64) {
-      Logger::println("performing aggregate zero initialization");
+      IF_LOG Logger::println("performing aggregate zero initialization");
       assert(e->e2->toInteger() == 0);
       DtoMemSetZero(DtoLVal(result));
       TypeStruct *ts = static_cast<TypeStruct *>(e->e1->type);
@@ -536,8 +576,8 @@ public:
       lvalueElem = true;
     }
 
-    Logger::println("performing normal assignment (rhs has lvalue elems = %d)",
-                    lvalueElem);
+    IF_LOG Logger::println(
+        "performing normal assignment (rhs has lvalue elems = %d)", lvalueElem);
     DtoAssign(e->loc, result, r, e->op, !lvalueElem);
   }
 
@@ -662,6 +702,21 @@ public:
       }
     }
 
+    // A copy of a local on its last use: blit it and reset the source instead
+    // of running the postblit.
+    if (VarDeclaration *source =
+            p->funcGen().lastUseCopies.getMovedVariable(e)) {
+      IF_LOG Logger::println("Moving from %s", source->toChars());
+      auto blit = static_cast<BlitExp *>(static_cast<DotVarExp *>(e->e1)->e1);
+      toElem(blit);
+      auto sd = static_cast<TypeStruct *>(source->type->toBasetype())->sym;
+      if (sd->dtor && sd->fields.dim > 0) {
+        DtoResolveStruct(sd);
+        DtoCopyDefaultInit(sd, DtoLVal(toElem(blit->e2)));
+      }
+      return nullptr;
+    }
+
     // Check if we are about to construct a just declared temporary. DMD
     // unfortunately rewrites this as
     //   MyStruct(myArgs) => (MyStruct tmp; tmp).this(myArgs),
@@ -682,7 +737,7 @@ public:
           VarExp *ve = static_cast<VarExp *>(ce->e2);
           if (VarDeclaration *vd = ve->var->isVarDeclaration()) {
             if (vd->needsScopeDtor()) {
-              Logger::println("Delaying edtor");
+              IF_LOG Logger::println("Delaying edtor");
               delayedDtorVar = vd;
               delayedDtorExp = vd->edtor;
               vd->edtor = nullptr;
@@ -725,6 +780,14 @@ public:
       DValue *result = nullptr;
       if (DtoLowerMagicIntrinsic(p, fndecl, e, result))
         return result;
+
+      // foreach over a string, lowered to a druntime call by the frontend
+      if ((result = DtoInlineStringApply(e->loc, fndecl, e->arguments)))
+        return result;
+
+      // synchronized statements, lowered to druntime calls by the frontend
+      if (DtoInlineSynchronizedCall(e->loc, fndecl, fnval, e->arguments))
+        return nullptr;
     }
 
     DValue *result =
@@ -845,7 +908,7 @@ public:
 
     DValue *v = toElem(e->e1, true);
     if (DFuncValue *fv = v->isFunc()) {
-      Logger::println("is func");
+      IF_LOG Logger::println("is func");
       // Logger::println("FuncDeclaration");
       FuncDeclaration *fd = fv->func;
       assert(fd);
@@ -854,11 +917,11 @@ public:
       return;
     }
     if (v->isIm()) {
-      Logger::println("is immediate");
+      IF_LOG Logger::println("is immediate");
       result = v;
       return;
     }
-    Logger::println("is nothing special");
+    IF_LOG Logger::println("is nothing special");
 
     // we special case here, since apparently taking the address of a slice is
     // ok
@@ -957,7 +1020,15 @@ public:
       // Get the actual function value to call.
       LLValue *funcval = nullptr;
       if (nonFinal) {
-        funcval = DtoVirtualFunctionPointer(l, fdecl, e->toChars());
+        if (FuncDeclaration *impl = getFinalClassOverride(e1type, fdecl)) {
+          IF_LOG Logger::println("Devirtualized call to %s",
+                                 impl->toPrettyChars());
+          DtoResolveFunction(impl);
+          fdecl = impl;
+          funcval = getIrFunc(impl)->func;
+        } else {
+          funcval = DtoVirtualFunctionPointer(l, fdecl, e->toChars());
+        }
       } else {
         funcval = getIrFunc(fdecl)->func;
       }
@@ -982,7 +1053,7 @@ public:
 
     // special cases: `this(int) { this(); }` and `this(int) { super(); }`
     if (!e->var) {
-      Logger::println("this exp without var declaration");
+      IF_LOG Logger::println("this exp without var declaration");
       result = new DLValue(e->type, p->func()->thisArg);
       return;
     }
@@ -995,14 +1066,14 @@ public:
     LLValue *v;
     const auto ident = p->func()->decl->ident;
     if (ident == Id::ensure || ident == Id::require) {
-      Logger::println("contract this exp");
+      IF_LOG Logger::println("contract this exp");
       v = DtoBitCast(p->func()->nestArg, DtoType(e->type)->getPointerTo());
     } else if (vd->toParent2() != p->func()->decl) {
-      Logger::println("nested this exp");
+      IF_LOG Logger::println("nested this exp");
       result = DtoNestedVariable(e->loc, e->type, vd, e->type->ty == Tstruct);
       return;
     } else {
-      Logger::println("normal this exp");
+      IF_LOG Logger::println("normal this exp");
       v = p->func()->thisArg;
     }
     result = new DLValue(e->type, DtoBitCast(v, DtoPtrToType(e->type)));
@@ -1238,7 +1309,7 @@ public:
       }
       eval = p->ir->CreateFCmp(cmpop, DtoRVal(l), DtoRVal(r));
     } else if (t->ty == Tsarray || t->ty == Tarray) {
-      Logger::println("static or dynamic array");
+      IF_LOG Logger::println("static or dynamic array");
       eval = DtoArrayCompare(e->loc, e->op, l, r);
     } else if (t->ty == Taarray) {
       eval = LLConstantInt::getFalse(gIR->context());
@@ -1309,7 +1380,7 @@ public:
     // class equality should be rewritten as a.opEquals(b) by this time
     if (t->isintegral() || t->ty == Tpointer || t->ty == Tclass ||
         t->ty == Tnull) {
-      Logger::println("integral or pointer or interface");
+      IF_LOG Logger::println("integral or pointer or interface");
       llvm::ICmpInst::Predicate cmpop;
       switch (e->op) {
       case TOKequal:
@@ -1335,16 +1406,16 @@ public:
     {
       eval = DtoBinNumericEquals(e->loc, l, r, e->op);
     } else if (t->ty == Tsarray || t->ty == Tarray) {
-      Logger::println("static or dynamic array");
+      IF_LOG Logger::println("static or dynamic array");
       eval = DtoArrayEquals(e->loc, e->op, l, r);
     } else if (t->ty == Taarray) {
-      Logger::println("associative array");
+      IF_LOG Logger::println("associative array");
       eval = DtoAAEquals(e->loc, e->op, l, r);
     } else if (t->ty == Tdelegate) {
-      Logger::println("delegate");
+      IF_LOG Logger::println("delegate");
       eval = DtoDelegateEquals(e->op, DtoRVal(l), DtoRVal(r));
     } else if (t->ty == Tstruct) {
-      Logger::println("struct");
+      IF_LOG Logger::println("struct");
       // when this is reached it means there is no opEquals overload.
       eval = DtoStructEquals(e->op, l, r);
     } else {
@@ -1436,7 +1507,7 @@ public:
 
     // new class
     if (ntype->ty == Tclass) {
-      Logger::println("new class");
+      IF_LOG Logger::println("new class");
       result = DtoNewClass(e->loc, static_cast<TypeClass *>(ntype), e);
       isArgprefixHandled = true; // by DtoNewClass()
     }
@@ -1675,7 +1746,7 @@ public:
     if (global.params.useInvariants && condty->ty == Tclass &&
         !(static_cast<TypeClass *>(condty)->sym->isInterfaceDeclaration()) &&
         !(static_cast<TypeClass *>(condty)->sym->isCPPclass())) {
-      Logger::println("calling class invariant");
+      IF_LOG Logger::println("calling class invariant");
       llvm::Function *fn = getRuntimeFunction(
           e->loc, gIR->module,
           gABI->mangleFunctionForLLVM("_D9invariant12_d_invariantFC6ObjectZv",
@@ -1690,7 +1761,7 @@ public:
              condty->nextOf()->ty == Tstruct &&
              (invdecl = static_cast<TypeStruct *>(condty->nextOf())
                             ->sym->inv) != nullptr) {
-      Logger::print("calling struct invariant");
+      IF_LOG Logger::print("calling struct invariant");
       DtoResolveFunction(invdecl);
       DFuncValue invfunc(invdecl, getIrFunc(invdecl)->func, DtoRVal(cond));
       DtoCallFunction(e->loc, nullptr, &invfunc, nullptr);
@@ -2151,9 +2222,9 @@ public:
     }
 
     if (fd->isNested()) {
-      Logger::println("nested");
+      IF_LOG Logger::println("nested");
     }
-    Logger::println("kind = %s", fd->kind());
+    IF_LOG Logger::println("kind = %s", fd->kind());
 
     // We need to actually codegen the function here, as literals are not added
     // to the module member list.
@@ -2251,13 +2322,22 @@ public:
       result = new DSliceValue(e->type, DtoConstSize_t(0),
                                getNullPtr(getPtrToType(llElemType)));
     } else if (dyn) {
-      if (arrayType->isImmutable() && isConstLiteral(e)) {
+      const auto kind = p->funcGen().scopeArrayLiterals.getKind(e);
+      if ((arrayType->isImmutable() || kind == ScopeArrayLiterals::readOnly) &&
+          isConstLiteral(e)) {
         llvm::Constant *init = arrayLiteralToConst(p, e);
         auto global = new llvm::GlobalVariable(
             gIR->module, init->getType(), true,
             llvm::GlobalValue::InternalLinkage, init, ".immutablearray");
         result = new DSliceValue(arrayType, DtoConstSize_t(e->elements->dim),
                                  DtoBitCast(global, getPtrToType(llElemType)));
+      } else if (kind != ScopeArrayLiterals::escaping) {
+        // only passed to a scope parameter, see gen/scope-literals.h
+        llvm::Value *storage =
+            DtoRawAlloca(llStoType, DtoAlignment(elemType), "arrayliteral");
+        initializeArrayLiteral(p, e, storage);
+        result = new DSliceValue(arrayType, DtoConstSize_t(len),
+                                 DtoBitCast(storage, getPtrToType(llElemType)));
       } else {
         DSliceValue *dynSlice = DtoNewDynArray(
             e->loc, arrayType,
@@ -2291,15 +2371,15 @@ public:
 
     if (e->useStaticInit) {
       DtoResolveStruct(e->sd);
-      LLValue *initsym = getIrAggr(e->sd)->getInitSymbol();
-      initsym = DtoBitCast(initsym, DtoType(e->type->pointerTo()));
 
-      if (!dstMem)
-        return new DLValue(e->type, initsym);
+      if (dstMem) {
+        DtoCopyDefaultInit(e->sd, dstMem);
+        return new DLValue(e->type, dstMem);
+      }
 
-      assert(dstMem->getType() == initsym->getType());
-      DtoMemCpy(dstMem, initsym);
-      return new DLValue(e->type, dstMem);
+      LLValue *initsym = getIrAggr(e->sd)->getInitSymbol();
+      initsym = DtoBitCast(initsym, DtoType(e->type->pointerTo()));
+      return new DLValue(e->type, initsym);
     }
 
     if (e->inProgressMemory) {
@@ -2431,6 +2511,15 @@ public:
         valuesInits.push_back(evalConst);
       }
 
+      // Like immutable array literals, immutable AA literals with constant
+      // keys and values don't need to be constructed at runtime.
+      if (basetype->ty == Taarray && basetype->isImmutable()) {
+        if (LLConstant *aa = DtoConstAA(e)) {
+          result = new DImValue(e->type, aa);
+          return;
+        }
+      }
+
       assert(aatype->ty == Taarray);
       Type *indexType = static_cast<TypeAArray *>(aatype)->index;
       assert(indexType && vtype);
@@ -2471,6 +2560,8 @@ public:
       slice = DtoConstSlice(DtoConstSize_t(e->keys->dim), slice);
       LLValue *valuesArray = DtoAggrPaint(slice, funcTy->getParamType(2));
 
+      // The size of the AA's buckets and nodes is only known to druntime.
+      emitGCAllocationSite(e->loc, nullptr);
       LLValue *aa = gIR->CreateCallOrInvoke(func, aaTypeInfo, keysArray,
                                             valuesArray, "aa")
                         .getInstruction();
@@ -2615,7 +2706,7 @@ public:
     // Array literals are assigned element-wise, other expressions are cast and
     // splat across the vector elements. This is what DMD does.
     if (e->e1->op == TOKarrayliteral) {
-      Logger::println("array literal expression");
+      IF_LOG Logger::println("array literal expression");
       ArrayLiteralExp *lit = static_cast<ArrayLiteralExp *>(e->e1);
       assert(lit->elements->dim == e->dim &&
              "Array literal vector initializer "
@@ -2626,7 +2717,7 @@ public:
         DtoStore(llval, DtoGEPi(vector, 0, i));
       }
     } else {
-      Logger::println("normal (splat) expression");
+      IF_LOG Logger::println("normal (splat) expression");
       DValue *val = toElem(e->e1);
       LLValue *llval = DtoRVal(DtoCast(e->loc, val, type->elementType()));
       for (unsigned int i = 0; i < e->dim; ++i) {
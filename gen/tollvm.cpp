@@ -14,6 +14,8 @@
 #include "id.h"
 #include "init.h"
 #include "module.h"
+#include "driver/cl_options.h"
+#include "driver/statistics.h"
 #include "gen/abi.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
@@ -34,6 +36,7 @@
 #include "ir/irtypeclass.h"
 #include "ir/irtypefunction.h"
 #include "ir/irtypestruct.h"
+#include "llvm/IR/MDBuilder.h"
 
 bool DtoIsInMemoryOnly(Type *type) {
   Type *typ = type->toBasetype();
@@ -77,13 +80,8 @@ LLAttribute DtoShouldExtend(Type *type) {
   return LLAttribute::None;
 }
 
-LLType *DtoType(Type *t) {
-  t = stripModifiers(t);
-
-  if (t->ctype) {
-    return t->ctype->getLLType();
-  }
-
+namespace {
+LLType *buildType(Type *t) {
   IF_LOG Logger::println("Building type: %s", t->toChars());
   LOG_SCOPE;
 
@@ -143,7 +141,8 @@ LLType *DtoType(Type *t) {
       IF_LOG Logger::cout()
           << "Struct with multiple Types detected: " << ts->toChars() << " ("
           << ts->sym->locToChars() << ")" << std::endl;
-      return ts->sym->type->ctype->getLLType();
+      ts->ctype = ts->sym->type->ctype;
+      return ts->ctype->getLLType();
     }
     return IrTypeStruct::get(ts->sym)->getLLType();
   }
@@ -154,7 +153,8 @@ LLType *DtoType(Type *t) {
       IF_LOG Logger::cout()
           << "Class with multiple Types detected: " << tc->toChars() << " ("
           << tc->sym->locToChars() << ")" << std::endl;
-      return tc->sym->type->ctype->getLLType();
+      tc->ctype = tc->sym->type->ctype;
+      return tc->ctype->getLLType();
     }
     return IrTypeClass::get(tc->sym)->getLLType();
   }
@@ -182,7 +182,10 @@ LLType *DtoType(Type *t) {
       // better choice, make the outer indirection a void pointer.
       return getVoidPtrType()->getContainedType(0);
     }
-    return DtoType(bt);
+    LLType *lt = DtoType(bt);
+    // Look up the enum type directly from now on.
+    t->ctype = bt->ctype;
+    return lt;
   }
 
   // associative arrays
@@ -198,6 +201,35 @@ LLType *DtoType(Type *t) {
   }
   return nullptr;
 }
+}
+
+LLType *DtoType(Type *t) {
+  static const bool countLookups = stats::isEnabled();
+  if (countLookups) {
+    ++stats::counters().typeLookups;
+  }
+
+  if (t->ctype) {
+    return t->ctype->getLLType();
+  }
+
+  if (countLookups) {
+    ++stats::counters().typeLookupMisses;
+  }
+
+  Type *unqualified = stripModifiers(t);
+  if (unqualified->ctype) {
+    t->ctype = unqualified->ctype;
+    return t->ctype->getLLType();
+  }
+
+  LLType *lt = buildType(unqualified);
+  // Make qualified types hit the fast path above next time.
+  if (t != unqualified) {
+    t->ctype = unqualified->ctype;
+  }
+  return lt;
+}
 
 LLType *DtoMemType(Type *t) { return i1ToI8(voidToI8(DtoType(t))); }
 
@@ -220,7 +252,7 @@ LLType *i1ToI8(LLType *t) {
 ////////////////////////////////////////////////////////////////////////////////
 
 LLValue *DtoDelegateEquals(TOK op, LLValue *lhs, LLValue *rhs) {
-  Logger::println("Doing delegate equality");
+  IF_LOG Logger::println("Doing delegate equality");
   if (rhs == nullptr) {
     rhs = LLConstant::getNullValue(lhs->getType());
   }
@@ -260,10 +292,35 @@ void setLinkage(LinkageWithCOMDAT lwc, llvm::GlobalObject *obj) {
   obj->setLinkage(lwc.first);
   if (lwc.second)
     obj->setComdat(gIR->module.getOrInsertComdat(obj->getName()));
+
+  // With -fvisibility=hidden, the definitions are only visible outside of the
+  // shared library if whitelisted by setVisibility().
+  if (opts::symbolVisibility == opts::SymbolVisibility_hidden &&
+      !obj->hasLocalLinkage()) {
+    obj->setVisibility(llvm::GlobalValue::HiddenVisibility);
+  }
 }
 
 void setLinkage(Dsymbol *sym, llvm::GlobalObject *obj) {
   setLinkage(DtoLinkage(sym), obj);
+  setVisibility(sym, obj);
+}
+
+namespace {
+/// Returns whether the symbol or one of its enclosing aggregates is declared
+/// `export`.
+bool isExported(Dsymbol *sym) {
+  for (; sym && !sym->isModule(); sym = sym->toParent()) {
+    if (sym->prot().kind == PROTexport)
+      return true;
+  }
+  return false;
+}
+}
+
+void setVisibility(Dsymbol *sym, llvm::GlobalObject *obj) {
+  if (!obj->hasLocalLinkage() && isExported(sym))
+    obj->setVisibility(llvm::GlobalValue::DefaultVisibility);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -499,6 +556,35 @@ LLValue *DtoVolatileLoad(LLValue *src, const char *name) {
   return ld;
 }
 
+// The !nontemporal metadata node, i.e. !{i32 1}.
+static llvm::MDNode *getNontemporalNode() {
+  llvm::LLVMContext &ctx = gIR->context();
+#if LDC_LLVM_VER >= 306
+  llvm::Metadata *one = llvm::ConstantAsMetadata::get(DtoConstInt(1));
+#else
+  llvm::Value *one = DtoConstInt(1);
+#endif
+  return llvm::MDNode::get(ctx, one);
+}
+
+// Like DtoLoad, but hints that the loaded data will not be reused soon, so it
+// need not be kept in the caches.
+LLValue *DtoNontemporalLoad(LLValue *src, const char *name) {
+  llvm::LoadInst *ld = gIR->ir->CreateLoad(src, name);
+  ld->setMetadata("nontemporal", getNontemporalNode());
+  return ld;
+}
+
+// Loads a D bool (stored as i8), annotated with its value range [0, 2).
+LLValue *DtoBoolLoad(LLValue *src, const char *name) {
+  llvm::LoadInst *ld = gIR->ir->CreateLoad(src, name);
+  assert(ld->getType() == llvm::Type::getInt8Ty(gIR->context()));
+  llvm::MDBuilder mdb(gIR->context());
+  ld->setMetadata(llvm::LLVMContext::MD_range,
+                  mdb.createRange(llvm::APInt(8, 0), llvm::APInt(8, 2)));
+  return ld;
+}
+
 void DtoStore(LLValue *src, LLValue *dst) {
   assert(src->getType() != llvm::Type::getInt1Ty(gIR->context()) &&
          "Should store bools as i8 instead of i1.");
@@ -511,6 +597,15 @@ void DtoVolatileStore(LLValue *src, LLValue *dst) {
   gIR->ir->CreateStore(src, dst)->setVolatile(true);
 }
 
+// Like DtoStore, but hints that the stored data will not be reused soon, e.g.
+// to bypass the caches with streaming stores.
+void DtoNontemporalStore(LLValue *src, LLValue *dst) {
+  assert(src->getType() != llvm::Type::getInt1Ty(gIR->context()) &&
+         "Should store bools as i8 instead of i1.");
+  gIR->ir->CreateStore(src, dst)->setMetadata("nontemporal",
+                                              getNontemporalNode());
+}
+
 void DtoStoreZextI8(LLValue *src, LLValue *dst) {
   if (src->getType() == llvm::Type::getInt1Ty(gIR->context())) {
     llvm::Type *i8 = llvm::Type::getInt8Ty(gIR->context());
@@ -68,6 +68,8 @@ LinkageWithCOMDAT DtoLinkage(Dsymbol *sym);
 bool supportsCOMDAT();
 void setLinkage(LinkageWithCOMDAT lwc, llvm::GlobalObject *obj);
 void setLinkage(Dsymbol *sym, llvm::GlobalObject *obj);
+// Gives exported symbols default visibility with -fvisibility=hidden.
+void setVisibility(Dsymbol *sym, llvm::GlobalObject *obj);
 
 // some types
 LLIntegerType *DtoSize_t();
@@ -100,8 +102,11 @@ LLConstant *DtoConstBool(bool);
 LLValue *DtoLoad(LLValue *src, const char *name = "");
 LLValue *DtoVolatileLoad(LLValue *src, const char *name = "");
 LLValue *DtoAlignedLoad(LLValue *src, const char *name = "");
+LLValue *DtoNontemporalLoad(LLValue *src, const char *name = "");
+LLValue *DtoBoolLoad(LLValue *src, const char *name = "");
 void DtoStore(LLValue *src, LLValue *dst);
 void DtoVolatileStore(LLValue *src, LLValue *dst);
+void DtoNontemporalStore(LLValue *src, LLValue *dst);
 void DtoStoreZextI8(LLValue *src, LLValue *dst);
 void DtoAlignedStore(LLValue *src, LLValue *dst);
 LLValue *DtoBitCast(LLValue *v, LLType *t, const llvm::Twine &name = "");
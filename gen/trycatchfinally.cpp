@@ -130,7 +130,7 @@ void TryCatchScope::emitCatchBodies(IRState &irs, llvm::Value *ehPtrSlot) {
         PGO.createProfileWeights(p.catchCount, p.uncaughtCount);
     DtoResolveClass(p.cd);
     auto ci = getIrAggr(p.cd)->getClassInfoSymbol();
-    catchBlocks.push_back({ci, p.catchBB, branchWeights});
+    catchBlocks.push_back({p.cd, ci, p.catchBB, branchWeights});
   }
 }
 
@@ -668,6 +668,10 @@ llvm::BasicBlock *TryCatchFinallyScopes::emitLandingPad() {
 
   // Add landingpad clauses, emit finallys and 'if' chain to catch the
   // exception.
+  // Catch clauses for (subclasses of) a class already caught by an inner-more
+  // clause can never match; they are left out, so that the personality
+  // function doesn't need to walk the class hierarchy for them.
+  llvm::SmallVector<ClassDeclaration *, 8> caughtClasses;
   CleanupCursor lastCleanup = currentCleanupScope();
   for (auto it = tryCatchScopes.rbegin(), end = tryCatchScopes.rend();
        it != end; ++it) {
@@ -687,6 +691,16 @@ llvm::BasicBlock *TryCatchFinallyScopes::emitLandingPad() {
     }
 
     for (const auto &cb : tryCatchScope.getCatchBlocks()) {
+      const bool isShadowed = std::any_of(
+          caughtClasses.begin(), caughtClasses.end(),
+          [&cb](ClassDeclaration *cd) {
+            return cd == cb.classDecl || cd->isBaseOf2(cb.classDecl);
+          });
+      if (isShadowed) {
+        continue;
+      }
+      caughtClasses.push_back(cb.classDecl);
+
       // Add the ClassInfo reference to the landingpad instruction so it is
       // emitted to the EH tables.
       landingPad->addClause(cb.classInfoPtr);
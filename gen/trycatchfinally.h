@@ -14,6 +14,7 @@
 #include <stddef.h>
 #include <vector>
 
+class ClassDeclaration;
 class Identifier;
 struct IRState;
 class TryCatchStatement;
@@ -45,6 +46,8 @@ public:
   /// Each catch body is emitted only once, but may be target from many landing
   /// pads (in case of nested catch or cleanup scopes).
   struct CatchBlock {
+    /// The class to match the exception object against.
+    ClassDeclaration *classDecl;
     /// The ClassInfo reference corresponding to the type to match the
     /// exception object against.
     llvm::GlobalVariable *classInfoPtr;
@@ -196,6 +199,9 @@ public:
   /// Unregisters the last registered try/catch scope.
   void popTryCatch();
 
+  /// Indicates whether there are any active catch blocks.
+  bool isCatching() const { return !tryCatchScopes.empty(); }
+
   /// Indicates whether there are any active catch blocks that handle
   /// non-Exception Throwables.
   bool isCatchingNonExceptions() const;
@@ -35,6 +35,7 @@
 #include "mtype.h"
 #include "scope.h"
 #include "template.h"
+#include "driver/statistics.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
 #include "gen/irstate.h"
@@ -43,6 +44,7 @@
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
 #include "gen/metadata.h"
+#include "gen/optimizer.h"
 #include "gen/rttibuilder.h"
 #include "gen/runtime.h"
 #include "gen/structs.h"
@@ -189,6 +191,10 @@ static void emitTypeMetadata(TypeInfoDeclaration *tid) {
   // an indirection), as there must be a valid LLVM undef value of that type.
   // As those types cannot appear as LLVM values, they are not interesting for
   // the optimizer passes anyway.
+  if (!willUseTypeMetadata()) {
+    return;
+  }
+
   Type *t = tid->tinfo->toBasetype();
   if (t->ty < Terror && t->ty != Tvoid && t->ty != Tfunction &&
       t->ty != Tident) {
@@ -198,16 +204,24 @@ static void emitTypeMetadata(TypeInfoDeclaration *tid) {
     llvm::NamedMDNode *meta = gIR->module.getNamedMetadata(metaname);
 
     if (!meta) {
+      Type *elem = (t->ty == Tarray ? t->nextOf() : t)->baseElemOf();
+      const bool hasPostblit = elem->ty == Tstruct &&
+                               static_cast<TypeStruct *>(elem)->sym->postblit;
+      llvm::Constant *postblit = llvm::ConstantInt::get(
+          llvm::Type::getInt1Ty(gIR->context()), hasPostblit);
+
 // Construct the fields
 #if LDC_LLVM_VER >= 306
       llvm::Metadata *mdVals[TD_NumFields];
       mdVals[TD_TypeInfo] = llvm::ValueAsMetadata::get(getIrGlobal(tid)->value);
       mdVals[TD_Type] = llvm::ConstantAsMetadata::get(
           llvm::UndefValue::get(DtoType(tid->tinfo)));
+      mdVals[TD_Postblit] = llvm::ConstantAsMetadata::get(postblit);
 #else
       MDNodeField *mdVals[TD_NumFields];
       mdVals[TD_TypeInfo] = llvm::cast<MDNodeField>(getIrGlobal(tid)->value);
       mdVals[TD_Type] = llvm::UndefValue::get(DtoType(tid->tinfo));
+      mdVals[TD_Postblit] = postblit;
 #endif
 
       // Construct the metadata and insert it into the module.
@@ -532,15 +546,7 @@ public:
     }
 
     // immutable(void)* m_RTInfo;
-    // The cases where getRTInfo is null are not quite here, but the code is
-    // modelled after what DMD does.
-    if (sd->getRTInfo) {
-      b.push(toConstElem(sd->getRTInfo, gIR));
-    } else if (!tc->hasPointers()) {
-      b.push_size_as_vp(0); // no pointers
-    } else {
-      b.push_size_as_vp(1); // has pointers
-    }
+    b.push_gc_info(sd, tc->hasPointers());
 
     // finish
     b.finalize(getIrGlobal(decl));
@@ -703,6 +709,8 @@ void TypeInfoDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p) {
   }
 
   IrGlobal *irg = getIrGlobal(decl, true);
+  // Only the linkage of the declaration; the definitions get
+  // TYPEINFO_LINKAGE_TYPE and a COMDAT in RTTIBuilder::finalize().
   const LinkageWithCOMDAT lwc(LLGlobalValue::ExternalLinkage, false);
 
   irg->value = gIR->module.getGlobalVariable(mangled);
@@ -721,7 +729,10 @@ void TypeInfoDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p) {
     // implicit monitor.
     auto g = new LLGlobalVariable(gIR->module, irg->type, false, lwc.first,
                                   nullptr, mangled);
-    setLinkage(lwc, g);
+    // The builtin TypeInfos are only declared, as they are defined in druntime.
+    if (!builtinTypeInfo(decl->tinfo)) {
+      setLinkage(lwc, g);
+    }
     irg->value = g;
   }
 
@@ -735,6 +746,15 @@ void TypeInfoDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p) {
   // define custom typedef
   LLVMDefineVisitor v;
   decl->accept(&v);
+
+  // The TypeInfo of an exported type is exported as well.
+  if (Dsymbol *sym = decl->tinfo->toDsymbol(nullptr)) {
+    setVisibility(sym, llvm::cast<LLGlobalVariable>(irg->value));
+  }
+
+  if (stats::isEnabled()) {
+    ++stats::counters().typeInfosEmitted;
+  }
 }
 
 /* ========================================================================= */
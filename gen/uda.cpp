@@ -1,6 +1,8 @@
 #include "gen/uda.h"
 
 #include "gen/llvm.h"
+#include "driver/cl_options.h"
+#include "gen/irstate.h"
 #include "gen/llvmhelpers.h"
 #include "aggregate.h"
 #include "attrib.h"
@@ -8,6 +10,7 @@
 #include "expression.h"
 #include "ir/irfunction.h"
 #include "module.h"
+#include "mtype.h"
 
 #include "llvm/ADT/StringExtras.h"
 
@@ -15,12 +18,19 @@ namespace {
 
 /// Names of the attribute structs we recognize.
 namespace attr {
+const std::string alignCode = "alignCode";
+const std::string assumeAligned = "assumeAligned";
+const std::string dynamicCompile = "_dynamicCompile";
+const std::string dynamicCompileConst = "_dynamicCompileConst";
 const std::string llvmAttr = "llvmAttr";
 const std::string llvmFastMathFlag = "llvmFastMathFlag";
 const std::string optStrategy = "optStrategy";
+const std::string restrict = "restrict";
 const std::string section = "section";
 const std::string target = "target";
+const std::string targetClones = "targetClones";
 const std::string weak = "_weak";
+const std::string xray = "_xray";
 }
 
 /// Checks whether `moduleDecl` is the ldc.attributes module.
@@ -159,6 +169,10 @@ void applyAttrOptStrategy(StructLiteralExp *sle, IrFunction *irFunc) {
     irFunc->func->addFnAttr(llvm::Attribute::OptimizeForSize);
   } else if (value == "minsize") {
     irFunc->func->addFnAttr(llvm::Attribute::MinSize);
+  } else if (value == "speed") {
+    irFunc->func->removeFnAttr(llvm::Attribute::OptimizeForSize);
+    irFunc->func->removeFnAttr(llvm::Attribute::MinSize);
+    irFunc->optimizeForSpeed = true;
   } else {
     sle->warning(
         "ignoring unrecognized parameter '%s' for '@ldc.attributes.%s'",
@@ -172,15 +186,205 @@ void applyAttrSection(StructLiteralExp *sle, llvm::GlobalObject *globj) {
 }
 
 void applyAttrTarget(StructLiteralExp *sle, llvm::Function *func) {
+  checkStructElems(sle, {Type::tstring});
+  applyTargetSpec(func, getFirstElemString(sle));
+}
+
+// @alignCode(bytes)
+void applyAttrAlignCode(StructLiteralExp *sle, llvm::Function *func) {
+  checkStructElems(sle, {Type::tuns32});
+  const auto alignment = (*sle->elements)[0]->toInteger();
+
+  if (alignment == 0 || (alignment & (alignment - 1))) {
+    sle->error("'@ldc.attributes.%s' requires a power of 2 alignment",
+               sle->sd->ident->string);
+    return;
+  }
+
+  func->setAlignment(static_cast<unsigned>(alignment));
+}
+
+// @xrayAlways, @xrayNever (_xray("always"), _xray("never"))
+void applyAttrXRay(StructLiteralExp *sle, llvm::Function *func) {
+  checkStructElems(sle, {Type::tstring});
+  llvm::StringRef value = getStringElem(sle, 0);
+
+  if (value == "always") {
+    func->addFnAttr("function-instrument", "xray-always");
+  } else if (value == "never") {
+    func->addFnAttr("function-instrument", "xray-never");
+  } else {
+    sle->warning(
+        "ignoring unrecognized parameter '%s' for '@ldc.attributes.%s'",
+        value.data(), sle->sd->ident->string);
+  }
+}
+
+// @assumeAligned(64, "param")
+void applyAttrAssumeAligned(StructLiteralExp *sle, IrFunction *irFunc) {
+  checkStructElems(sle, {Type::tuns32, Type::tstring});
+  const auto alignment = (*sle->elements)[0]->toInteger();
+  llvm::StringRef paramName = getStringElem(sle, 1);
+
+  if (alignment == 0 || (alignment & (alignment - 1))) {
+    sle->error("'@ldc.attributes.%s' requires a power of 2 alignment",
+               sle->sd->ident->string);
+    return;
+  }
+
+  // Only functions with a body have parameter declarations.
+  FuncDeclaration *fd = irFunc->decl;
+  if (!fd->parameters) {
+    return;
+  }
+
+  for (auto vd : *fd->parameters) {
+    if (paramName != vd->ident->toChars()) {
+      continue;
+    }
+    const auto ty = vd->type->toBasetype()->ty;
+    if ((vd->storage_class & STClazy) ||
+        !(ty == Tpointer || ty == Tarray || ty == Tclass)) {
+      sle->error("'@ldc.attributes.%s' parameter '%s' must be a pointer, "
+                 "slice or class reference",
+                 sle->sd->ident->string, paramName.data());
+      return;
+    }
+    irFunc->assumedAlignments.emplace_back(vd, alignment);
+    return;
+  }
+
+  sle->error("'@ldc.attributes.%s': '%s' is not a parameter of '%s'",
+             sle->sd->ident->string, paramName.data(), fd->toChars());
+}
+
+// @restrict("param")
+void applyAttrRestrict(StructLiteralExp *sle, IrFunction *irFunc) {
+  checkStructElems(sle, {Type::tstring});
+  llvm::StringRef paramName = getStringElem(sle, 0);
+
+  auto tf = static_cast<TypeFunction *>(irFunc->decl->type);
+  const size_t numParams = Parameter::dim(tf->parameters);
+  size_t paramIdx = 0;
+  for (; paramIdx < numParams; ++paramIdx) {
+    Identifier *ident = Parameter::getNth(tf->parameters, paramIdx)->ident;
+    if (ident && paramName == ident->toChars()) {
+      break;
+    }
+  }
+  if (paramIdx == numParams) {
+    sle->error("'@ldc.attributes.%s': '%s' is not a parameter of '%s'",
+               sle->sd->ident->string, paramName.data(),
+               irFunc->decl->toChars());
+    return;
+  }
+
+  for (auto arg : irFunc->irFty.args) {
+    if (arg->parametersIdx != paramIdx) {
+      continue;
+    }
+
+    // ref/out parameters and pointers (class references) passed as such get
+    // LLVM's noalias. Slices are marked for the D alias analysis
+    // (gen/passes/DAliasAnalysis.cpp), as the pointer is an aggregate member.
+    const auto ty = arg->type->toBasetype()->ty;
+    if (arg->byref ? arg->isByVal() : (ty != Tpointer && ty != Tclass &&
+                                       ty != Tarray)) {
+      sle->error("'@ldc.attributes.%s' parameter '%s' must be a pointer, "
+                 "slice, class reference or ref parameter",
+                 sle->sd->ident->string, paramName.data());
+    } else if (arg->rewrite) {
+      sle->warning("ignoring '@ldc.attributes.%s' for parameter '%s' passed "
+                   "in a different form by the target ABI",
+                   sle->sd->ident->string, paramName.data());
+    } else if (!arg->byref && ty == Tarray) {
+      arg->attrs.add("ldc.restrict");
+    } else {
+      arg->attrs.add(LLAttribute::NoAlias);
+    }
+    return;
+  }
+}
+
+// @dynamicCompile
+void applyAttrDynamicCompile(StructLiteralExp *sle, IrFunction *irFunc) {
+  checkStructElems(sle, {});
+  if (!opts::enableDynamicCompile)
+    return;
+
+  FuncDeclaration *fd = irFunc->decl;
+  if (irFunc->func->isVarArg() || fd->naked) {
+    sle->error("'@ldc.attributes.dynamicCompile' cannot be applied to "
+               "variadic or naked functions");
+    return;
+  }
+  irFunc->dynamicCompile = true;
+}
+
+// @dynamicCompileConst
+void applyAttrDynamicCompileConst(StructLiteralExp *sle, VarDeclaration *decl,
+                                  llvm::GlobalVariable *gvar) {
+  checkStructElems(sle, {});
+  if (!opts::enableDynamicCompile)
+    return;
+
+  // The value is read from the variable when compiling the code at runtime,
+  // which doesn't know the thread the code is going to run in.
+  if (gvar->isThreadLocal()) {
+    sle->error("'@ldc.attributes.dynamicCompileConst' cannot be applied to "
+               "thread-local variables");
+    return;
+  }
+  gIR->dynamicCompileConsts.push_back(decl);
+}
+
+// @targetClones("avx2", "sse4.2", "default")
+void applyAttrTargetClones(StructLiteralExp *sle, IrFunction *irFunc) {
+  if (sle->elements->dim != 1) {
+    sle->error(
+        "unexpected field count in 'ldc.attributes.%s'; does druntime not "
+        "match compiler version?",
+        sle->sd->ident->string);
+    fatal();
+  }
+
+  auto arg = (*sle->elements)[0];
+  if (!arg || arg->op == TOKnull) {
+    sle->error("'@ldc.attributes.%s' requires at least one target",
+               sle->sd->ident->string);
+    return;
+  }
+  Type *argType = arg->type->toBasetype();
+  if (arg->op != TOKarrayliteral || argType->ty != Tarray ||
+      !argType->nextOf()->equals(Type::tstring)) {
+    sle->error("invalid field type in 'ldc.attributes.%s'; does druntime not "
+               "match compiler version?",
+               sle->sd->ident->string);
+    fatal();
+  }
+
+  irFunc->targetClones.clear();
+  for (auto elem : *static_cast<ArrayLiteralExp *>(arg)->elements) {
+    if (!elem || elem->op != TOKstring) {
+      sle->error("'@ldc.attributes.%s' requires string literal targets",
+                 sle->sd->ident->string);
+      return;
+    }
+    auto strexp = static_cast<StringExp *>(elem);
+    assert(strexp->sz == 1);
+    irFunc->targetClones.push_back(strexp->toStringz());
+  }
+}
+
+} // anonymous namespace
+
+void applyTargetSpec(llvm::Function *func, const std::string &targetspec) {
   // TODO: this is a rudimentary implementation for @target. Many more
   // target-related attributes could be applied to functions (not just for
   // @target): clang applies many attributes that LDC does not.
   // The current implementation here does not do any checking of the specified
   // string and simply passes all to llvm.
 
-  checkStructElems(sle, {Type::tstring});
-  std::string targetspec = getFirstElemString(sle);
-
   if (targetspec.empty() || targetspec == "default")
     return;
 
@@ -236,8 +440,6 @@ void applyAttrTarget(StructLiteralExp *sle, llvm::Function *func) {
   }
 }
 
-} // anonymous namespace
-
 void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar) {
   if (!decl->userAttribDecl)
     return;
@@ -252,15 +454,37 @@ void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar) {
     auto name = sle->sd->ident->string;
     if (name == attr::section) {
       applyAttrSection(sle, gvar);
+    } else if (name == attr::alignCode) {
+      sle->error(
+          "Special attribute 'ldc.attributes.alignCode' is only valid for "
+          "functions");
+    } else if (name == attr::assumeAligned) {
+      sle->error(
+          "Special attribute 'ldc.attributes.assumeAligned' is only valid for "
+          "functions");
+    } else if (name == attr::dynamicCompile) {
+      sle->error("Special attribute 'ldc.attributes.dynamicCompile' is only "
+                 "valid for functions");
+    } else if (name == attr::dynamicCompileConst) {
+      applyAttrDynamicCompileConst(sle, decl, gvar);
     } else if (name == attr::optStrategy) {
       sle->error(
           "Special attribute 'ldc.attributes.optStrategy' is only valid for "
           "functions");
+    } else if (name == attr::restrict) {
+      sle->error("Special attribute 'ldc.attributes.restrict' is only valid "
+                 "for functions");
     } else if (name == attr::target) {
       sle->error("Special attribute 'ldc.attributes.target' is only valid for "
                  "functions");
+    } else if (name == attr::targetClones) {
+      sle->error("Special attribute 'ldc.attributes.targetClones' is only "
+                 "valid for functions");
     } else if (name == attr::weak) {
       // @weak is applied elsewhere
+    } else if (name == attr::xray) {
+      sle->error("Special attribute 'ldc.attributes.xrayAlways/xrayNever' is "
+                 "only valid for functions");
     } else {
       sle->warning(
           "Ignoring unrecognized special attribute 'ldc.attributes.%s'",
@@ -284,18 +508,33 @@ void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc) {
       continue;
 
     auto name = sle->sd->ident->string;
-    if (name == attr::llvmAttr) {
+    if (name == attr::alignCode) {
+      applyAttrAlignCode(sle, func);
+    } else if (name == attr::assumeAligned) {
+      applyAttrAssumeAligned(sle, irFunc);
+    } else if (name == attr::dynamicCompile) {
+      applyAttrDynamicCompile(sle, irFunc);
+    } else if (name == attr::dynamicCompileConst) {
+      sle->error("Special attribute 'ldc.attributes.dynamicCompileConst' is "
+                 "only valid for variables");
+    } else if (name == attr::llvmAttr) {
       applyAttrLLVMAttr(sle, func);
     } else if (name == attr::llvmFastMathFlag) {
       applyAttrLLVMFastMathFlag(sle, irFunc);
     } else if (name == attr::optStrategy) {
       applyAttrOptStrategy(sle, irFunc);
+    } else if (name == attr::restrict) {
+      applyAttrRestrict(sle, irFunc);
     } else if (name == attr::section) {
       applyAttrSection(sle, func);
     } else if (name == attr::target) {
       applyAttrTarget(sle, func);
+    } else if (name == attr::targetClones) {
+      applyAttrTargetClones(sle, irFunc);
     } else if (name == attr::weak) {
       // @weak is applied elsewhere
+    } else if (name == attr::xray) {
+      applyAttrXRay(sle, func);
     } else {
       sle->warning(
           "ignoring unrecognized special attribute 'ldc.attributes.%s'",
@@ -335,3 +574,19 @@ bool hasWeakUDA(Dsymbol *sym) {
 
   return false;
 }
+
+/// Checks whether 'fd' has the @ldc.attributes._dynamicCompile() UDA applied.
+bool hasDynamicCompileUDA(FuncDeclaration *fd) {
+  if (!fd->userAttribDecl)
+    return false;
+
+  Expressions *attrs = fd->userAttribDecl->getAttributes();
+  expandTuples(attrs);
+  for (auto &attr : *attrs) {
+    auto sle = getLdcAttributesStruct(attr);
+    if (sle && sle->sd->ident->string == attr::dynamicCompile)
+      return true;
+  }
+
+  return false;
+}
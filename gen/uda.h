@@ -20,12 +20,20 @@ class FuncDeclaration;
 class VarDeclaration;
 struct IrFunction;
 namespace llvm {
+class Function;
 class GlobalVariable;
 }
 
+#include <string>
+
 void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc);
 void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar);
 
 bool hasWeakUDA(Dsymbol *sym);
+bool hasDynamicCompileUDA(FuncDeclaration *fd);
+
+/// Sets the target CPU/features of a function as specified by a @target
+/// string ("arch=<cpu>,<feature>,no-<feature>").
+void applyTargetSpec(llvm::Function *func, const std::string &targetspec);
 
 #endif
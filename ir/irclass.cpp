@@ -26,6 +26,7 @@
 #include "gen/llvmhelpers.h"
 #include "gen/arrays.h"
 #include "gen/metadata.h"
+#include "gen/optimizer.h"
 #include "gen/runtime.h"
 #include "gen/functions.h"
 #include "gen/abi.h"
@@ -83,7 +84,8 @@ LLGlobalVariable *IrAggr::getClassInfoSymbol() {
 
   // Generate some metadata on this ClassInfo if it's for a class.
   ClassDeclaration *classdecl = aggrdecl->isClassDeclaration();
-  if (classdecl && !aggrdecl->isInterfaceDeclaration()) {
+  if (classdecl && !aggrdecl->isInterfaceDeclaration() &&
+      willUseTypeMetadata()) {
     // Gather information
     LLType *type = DtoType(aggrdecl->type);
     LLType *bodyType = llvm::cast<LLPointerType>(type)->getElementType();
@@ -458,6 +460,7 @@ llvm::GlobalVariable *IrAggr::getInterfaceVtbl(BaseClass *b, bool new_instance,
       getOrCreateGlobal(cd->loc, gIR->module, vtbl_constant->getType(), true,
                         lwc.first, vtbl_constant, mangledName);
   setLinkage(lwc, GV);
+  setVisibility(cd, GV);
 
   // insert into the vtbl map
   interfaceVtblMap.insert({{b->sym, interfaces_index}, GV});
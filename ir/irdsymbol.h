@@ -14,8 +14,6 @@
 #ifndef LDC_IR_IRDSYMBOL_H
 #define LDC_IR_IRDSYMBOL_H
 
-#include <vector>
-
 struct IrModule;
 struct IrFunction;
 struct IrAggr;
@@ -48,24 +46,28 @@ struct IrDsymbol {
 
   enum State { Initial, Resolved, Declared, Initialized, Defined };
 
-  static std::vector<IrDsymbol *> list;
+  /// Forgets the codegen state of all symbols, when starting a new LLVM
+  /// module. Constant time: the state of each symbol is only cleared when it
+  /// is accessed for the first time afterwards.
   static void resetAll();
 
-  // overload all of these to make sure
-  // the static list is up to date
-  IrDsymbol();
-  IrDsymbol(const IrDsymbol &s);
-  ~IrDsymbol();
+  IrDsymbol() : irData(nullptr) {}
 
   void reset();
 
-  Type type() const { return m_type; }
-  State state() const { return m_state; }
+  Type type() {
+    update();
+    return m_type;
+  }
+  State state() {
+    update();
+    return m_state;
+  }
 
-  bool isResolved() const { return m_state >= Resolved; }
-  bool isDeclared() const { return m_state >= Declared; }
-  bool isInitialized() const { return m_state >= Initialized; }
-  bool isDefined() const { return m_state >= Defined; }
+  bool isResolved() { return state() >= Resolved; }
+  bool isDeclared() { return state() >= Declared; }
+  bool isInitialized() { return state() >= Initialized; }
+  bool isDefined() { return state() >= Defined; }
 
   void setResolved();
   void setDeclared();
@@ -82,6 +84,17 @@ private:
   friend IrParameter *getIrParameter(VarDeclaration *decl, bool create);
   friend IrField *getIrField(VarDeclaration *decl, bool create);
 
+  /// Incremented by resetAll().
+  static unsigned generation;
+
+  /// Clears the state left over from a previous LLVM module.
+  void update() {
+    if (m_generation != generation) {
+      reset();
+      m_generation = generation;
+    }
+  }
+
   union {
     void *irData;
     IrModule *irModule;
@@ -95,6 +108,7 @@ private:
   };
   Type m_type = Type::NotSet;
   State m_state = State::Initial;
+  unsigned m_generation = 0;
 };
 
 #endif
@@ -36,6 +36,12 @@ void IrFunction::setAlwaysInline() {
   func->addFnAttr(llvm::Attribute::AlwaysInline);
 }
 
+void IrFunction::setInlineHint() {
+  if (!func->hasFnAttribute(llvm::Attribute::NoInline)) {
+    func->addFnAttr(llvm::Attribute::InlineHint);
+  }
+}
+
 IrFunction *getIrFunc(FuncDeclaration *decl, bool create) {
   if (!isIrFuncCreated(decl) && create) {
     assert(decl->ir->irFunc == NULL);
@@ -20,6 +20,9 @@
 #include "gen/llvm.h"
 #include "ir/irfuncty.h"
 #include <stack>
+#include <string>
+#include <utility>
+#include <vector>
 
 class FuncDeclaration;
 class TypeFunction;
@@ -33,6 +36,8 @@ struct IrFunction {
   // annotations
   void setNeverInline();
   void setAlwaysInline();
+  // Raises the inlining threshold of the function (unless never-inline).
+  void setInlineHint();
 
   llvm::Function *func = nullptr;
   FuncDeclaration *decl = nullptr;
@@ -49,6 +54,8 @@ struct IrFunction {
   // enclosing functions)
   int depth = -1;
   bool nestedContextCreated = false; // holds whether nested context is created
+  // @optStrategy("speed"): asks for all loops to be vectorized
+  bool optimizeForSpeed = false;
 
   // TODO: Move to FuncGenState?
   llvm::Value *_arguments = nullptr;
@@ -71,6 +78,19 @@ struct IrFunction {
   /// Stores the FastMath options for this functions.
   /// These are set e.g. by math related UDA's from ldc.attributes.
   llvm::FastMathFlags FMF;
+
+  /// The targets to compile clones of this function for, with the function
+  /// itself dispatching to one of them at runtime (set by the
+  /// @ldc.attributes.targetClones UDA).
+  std::vector<std::string> targetClones;
+
+  /// Whether the function is compiled again for the host CPU at runtime (set
+  /// by the @ldc.attributes.dynamicCompile UDA with -enable-dynamic-compile).
+  bool dynamicCompile = false;
+
+  /// Parameters pointing to memory with a known alignment (set by the
+  /// @ldc.attributes.assumeAligned UDA).
+  std::vector<std::pair<VarDeclaration *, unsigned>> assumedAlignments;
 };
 
 IrFunction *getIrFunc(FuncDeclaration *decl, bool create = false);
@@ -38,7 +38,7 @@ IrModule *getIrModule(Module *m) {
   }
 
   assert(m && "null module");
-  if (m->ir->m_type == IrDsymbol::NotSet) {
+  if (m->ir->type() == IrDsymbol::NotSet) {
     m->ir->irModule = new IrModule(m);
     m->ir->m_type = IrDsymbol::ModuleType;
   }
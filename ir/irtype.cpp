@@ -11,6 +11,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include "mars.h"
 #include "mtype.h"
+#include "driver/cl_options.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
 #include "gen/llvmhelpers.h"
@@ -55,6 +56,10 @@ llvm::Type *getReal80Type(llvm::LLVMContext &ctx) {
 #endif
     ;
 
+  if (opts::realPrecision == opts::RealPrecision_Double) {
+    return llvm::Type::getDoubleTy(ctx);
+  }
+
   // only x86 has 80bit float - but no support with MS C Runtime!
   if (anyX86 && !global.params.targetTriple->isWindowsMSVCEnvironment()) {
     return llvm::Type::getX86_FP80Ty(ctx);
@@ -0,0 +1,17 @@
+# Merges all the raw profiles in PROFILE_DIR into the indexed profile OUTPUT
+# using the PROFDATA tool (ldc-profdata). Invoked via cmake -P by the
+# train-runtime-profile target.
+
+file(GLOB profiles ${PROFILE_DIR}/*.profraw)
+if(NOT profiles)
+    message(FATAL_ERROR "No profiles found in ${PROFILE_DIR}.")
+endif()
+
+execute_process(
+    COMMAND ${PROFDATA} merge -output=${OUTPUT} ${profiles}
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Merging the profiles into ${OUTPUT} failed.")
+endif()
+message(STATUS "Runtime profile written to ${OUTPUT}")
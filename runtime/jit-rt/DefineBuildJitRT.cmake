@@ -0,0 +1,62 @@
+# Add the runtime library compiling the @dynamicCompile functions at runtime
+# (-enable-dynamic-compile). Requires the ORC JIT API of LLVM 4.0 or later.
+if(LDC_DYNAMIC_COMPILE)
+    file(GLOB LDC_JITRT_D ${JITRT_DIR}/d/ldc/*.d)
+    file(GLOB LDC_JITRT_CXX ${JITRT_DIR}/cpp/*.cpp)
+
+    # The LLVM parts live in a shared library (ldc-jit), so that programs
+    # don't need to link against the LLVM libraries themselves.
+    macro(build_jit_runtime d_flags c_flags ld_flags path_suffix outlist_targets)
+        get_target_suffix("" "${path_suffix}" target_suffix)
+
+        set(output_path ${CMAKE_BINARY_DIR}/lib${path_suffix})
+
+        add_library(ldc-jit${target_suffix} SHARED ${LDC_JITRT_CXX})
+        set_target_properties(
+            ldc-jit${target_suffix} PROPERTIES
+            OUTPUT_NAME                 ldc-jit
+            VERSION                     ${LDC_VERSION}
+            LINKER_LANGUAGE             CXX
+            ARCHIVE_OUTPUT_DIRECTORY    ${output_path}
+            LIBRARY_OUTPUT_DIRECTORY    ${output_path}
+            RUNTIME_OUTPUT_DIRECTORY    ${output_path}
+            COMPILE_FLAGS               "${c_flags} ${LLVM_CXXFLAGS} -fPIC"
+            LINK_FLAGS                  "${ld_flags}"
+        )
+        target_link_libraries(ldc-jit${target_suffix} ${LLVM_LIBRARIES} ${LLVM_LDFLAGS})
+
+        set(jitrt_d_o "")
+        set(jitrt_d_bc "")
+        foreach(f ${LDC_JITRT_D})
+            dc(
+                ${f}
+                "${d_flags}"
+                "${JITRT_DIR}"
+                "${target_suffix}"
+                jitrt_d_o
+                jitrt_d_bc
+            )
+        endforeach()
+
+        add_library(ldc-jit-rt${target_suffix} STATIC ${jitrt_d_o})
+        set_target_properties(
+            ldc-jit-rt${target_suffix} PROPERTIES
+            OUTPUT_NAME                 ldc-jit-rt
+            VERSION                     ${LDC_VERSION}
+            LINKER_LANGUAGE             C
+            ARCHIVE_OUTPUT_DIRECTORY    ${output_path}
+            LIBRARY_OUTPUT_DIRECTORY    ${output_path}
+            RUNTIME_OUTPUT_DIRECTORY    ${output_path}
+        )
+
+        list(APPEND ${outlist_targets} "ldc-jit${target_suffix}" "ldc-jit-rt${target_suffix}")
+    endmacro()
+
+    # Install D interface files to jit-rt.
+    install(DIRECTORY ${JITRT_DIR}/d/ldc DESTINATION ${INCLUDE_INSTALL_DIR} FILES_MATCHING PATTERN "*.d")
+
+else()
+    # No runtime compilation supported, define NOP macro
+    macro(build_jit_runtime d_flags c_flags ld_flags path_suffix outlist_targets)
+    endmacro()
+endif()
@@ -0,0 +1,438 @@
+//===-- jit.cpp -----------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Compiles the bitcode embedded for the @dynamicCompile functions (see
+// gen/dynamic-compile.cpp) for the host CPU using LLVM's ORC JIT, and points
+// the thunks of the functions to the compiled code.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#if LLVM_VERSION_MAJOR >= 5
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#else
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#endif
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+// These must match the descriptor emitted by gen/dynamic-compile.cpp.
+struct Symbol {
+  const char *name;
+  void *address;
+};
+
+struct ModuleDesc {
+  ModuleDesc *next;
+  const void *bitcode;
+  std::size_t bitcodeSize;
+  // The addresses are those of the <name>.jit_ptr variables of the thunks.
+  std::size_t numFuncs;
+  const Symbol *funcs;
+  std::size_t numSymbols;
+  const Symbol *symbols;
+  std::size_t numConsts;
+  const Symbol *consts;
+};
+
+/// The registered modules, most recently registered first.
+ModuleDesc *modules = nullptr;
+
+std::mutex &getLock() {
+  static std::mutex lock;
+  return lock;
+}
+
+#if LLVM_VERSION_MAJOR >= 5
+using ObjectLayer = llvm::orc::RTDyldObjectLinkingLayer;
+using CompileLayer =
+    llvm::orc::IRCompileLayer<ObjectLayer, llvm::orc::SimpleCompiler>;
+using ModuleHandle = CompileLayer::ModuleHandleT;
+#else
+using ObjectLayer = llvm::orc::ObjectLinkingLayer<>;
+using CompileLayer = llvm::orc::IRCompileLayer<ObjectLayer>;
+using ModuleHandle = CompileLayer::ModuleSetHandleT;
+#endif
+
+std::string errorMessage(llvm::Error err) {
+  std::string result;
+  llvm::handleAllErrors(std::move(err),
+                        [&result](const llvm::ErrorInfoBase &info) {
+                          result = info.message();
+                        });
+  return result;
+}
+
+bool getSymbolAddress(llvm::JITSymbol symbol, void *&address) {
+#if LLVM_VERSION_MAJOR >= 5
+  if (!symbol) {
+    llvm::consumeError(symbol.takeError());
+    return false;
+  }
+  auto result = symbol.getAddress();
+  if (!result) {
+    llvm::consumeError(result.takeError());
+    return false;
+  }
+  address = reinterpret_cast<void *>(static_cast<std::uintptr_t>(*result));
+#else
+  if (!symbol) {
+    return false;
+  }
+  address = reinterpret_cast<void *>(
+      static_cast<std::uintptr_t>(symbol.getAddress()));
+#endif
+  return true;
+}
+
+/// Creates the target machine for the host CPU.
+std::unique_ptr<llvm::TargetMachine> createHostTargetMachine(
+    std::string &error) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  std::vector<std::string> attrs;
+  llvm::StringMap<bool> features;
+  if (llvm::sys::getHostCPUFeatures(features)) {
+    for (const auto &feature : features) {
+      attrs.push_back((feature.second ? "+" : "-") + feature.first().str());
+    }
+  }
+
+  llvm::EngineBuilder builder;
+  builder.setErrorStr(&error)
+      .setMCPU(llvm::sys::getHostCPUName())
+      .setMAttrs(attrs)
+      .setOptLevel(llvm::CodeGenOpt::Aggressive);
+  return std::unique_ptr<llvm::TargetMachine>(builder.selectTarget());
+}
+
+/// Reads an integer of `bits` bits stored in the host's byte order.
+llvm::APInt readInt(unsigned bits, const char *data,
+                    const llvm::DataLayout &dl) {
+  const unsigned bytes = (bits + 7) / 8;
+  std::vector<uint64_t> words((bytes + 7) / 8);
+  for (unsigned i = 0; i < bytes; ++i) {
+    const auto byte = static_cast<unsigned char>(
+        data[dl.isLittleEndian() ? i : bytes - 1 - i]);
+    words[i / 8] |= static_cast<uint64_t>(byte) << (8 * (i % 8));
+  }
+  return llvm::APInt(bits, words);
+}
+
+/// Builds a constant of the given type from the value in memory at `data`,
+/// or returns null if the type isn't supported.
+llvm::Constant *readConstant(llvm::Type *type, const char *data,
+                             const llvm::DataLayout &dl) {
+  switch (type->getTypeID()) {
+  case llvm::Type::IntegerTyID:
+    return llvm::ConstantInt::get(
+        type->getContext(), readInt(type->getIntegerBitWidth(), data, dl));
+  case llvm::Type::HalfTyID:
+  case llvm::Type::FloatTyID:
+  case llvm::Type::DoubleTyID:
+  case llvm::Type::X86_FP80TyID:
+  case llvm::Type::FP128TyID:
+  case llvm::Type::PPC_FP128TyID: {
+    llvm::APFloat value(type->getFltSemantics(),
+                        readInt(type->getPrimitiveSizeInBits(), data, dl));
+    return llvm::ConstantFP::get(type->getContext(), value);
+  }
+  case llvm::Type::PointerTyID: {
+    auto address = llvm::ConstantInt::get(
+        type->getContext(), readInt(dl.getPointerSizeInBits(), data, dl));
+    return llvm::ConstantExpr::getIntToPtr(address, type);
+  }
+  case llvm::Type::ArrayTyID:
+  case llvm::Type::VectorTyID: {
+    auto seqType = llvm::cast<llvm::SequentialType>(type);
+    llvm::Type *elemType = seqType->getElementType();
+    const uint64_t stride = dl.getTypeAllocSize(elemType);
+    std::vector<llvm::Constant *> elems;
+    for (uint64_t i = 0; i < seqType->getNumElements(); ++i) {
+      llvm::Constant *elem = readConstant(elemType, data + i * stride, dl);
+      if (!elem) {
+        return nullptr;
+      }
+      elems.push_back(elem);
+    }
+    if (auto arrayType = llvm::dyn_cast<llvm::ArrayType>(type)) {
+      return llvm::ConstantArray::get(arrayType, elems);
+    }
+    return llvm::ConstantVector::get(elems);
+  }
+  case llvm::Type::StructTyID: {
+    auto structType = llvm::cast<llvm::StructType>(type);
+    const llvm::StructLayout *layout = dl.getStructLayout(structType);
+    std::vector<llvm::Constant *> elems;
+    for (unsigned i = 0; i < structType->getNumElements(); ++i) {
+      llvm::Constant *elem =
+          readConstant(structType->getElementType(i),
+                       data + layout->getElementOffset(i), dl);
+      if (!elem) {
+        return nullptr;
+      }
+      elems.push_back(elem);
+    }
+    return llvm::ConstantStruct::get(structType, elems);
+  }
+  default:
+    return nullptr;
+  }
+}
+
+class DynamicCompiler {
+public:
+  explicit DynamicCompiler(std::unique_ptr<llvm::TargetMachine> tm)
+      : targetMachine(std::move(tm)),
+        dataLayout(targetMachine->createDataLayout()),
+#if LLVM_VERSION_MAJOR >= 5
+        objectLayer(
+            []() { return std::make_shared<llvm::SectionMemoryManager>(); }),
+#endif
+        compileLayer(objectLayer, llvm::orc::SimpleCompiler(*targetMachine)) {
+    // Make the symbols of the program available to the resolver.
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+  }
+
+  /// Compiles the module and points the thunks to the compiled functions.
+  bool compile(const ModuleDesc &desc, unsigned optLevel, unsigned sizeLevel,
+               std::string &error) {
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(
+        llvm::StringRef(static_cast<const char *>(desc.bitcode),
+                        desc.bitcodeSize),
+        "", false);
+    auto parsed = llvm::parseBitcodeFile(buffer->getMemBufferRef(), context);
+    if (!parsed) {
+      error = errorMessage(parsed.takeError());
+      return false;
+    }
+    std::unique_ptr<llvm::Module> module = std::move(*parsed);
+    module->setTargetTriple(targetMachine->getTargetTriple().str());
+    module->setDataLayout(dataLayout);
+
+    if (!foldConstants(*module, desc, error)) {
+      return false;
+    }
+
+    targetMachine->setOptLevel(codeGenOptLevel(optLevel));
+    optimize(*module, optLevel, sizeLevel);
+
+    // Resolve the declarations to the addresses in the program.
+    auto symbols = std::make_shared<llvm::StringMap<llvm::JITTargetAddress>>();
+    for (std::size_t i = 0; i < desc.numSymbols; ++i) {
+      (*symbols)[mangle(desc.symbols[i].name)] =
+          reinterpret_cast<std::uintptr_t>(desc.symbols[i].address);
+    }
+    auto resolver = llvm::orc::createLambdaResolver(
+        [symbols](const std::string &name) {
+          auto it = symbols->find(name);
+          if (it != symbols->end()) {
+            return llvm::JITSymbol(it->second, llvm::JITSymbolFlags::Exported);
+          }
+          return llvm::JITSymbol(nullptr);
+        },
+        [](const std::string &name) {
+          if (auto address =
+                  llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name)) {
+            return llvm::JITSymbol(address, llvm::JITSymbolFlags::Exported);
+          }
+          return llvm::JITSymbol(nullptr);
+        });
+
+#if LLVM_VERSION_MAJOR >= 5
+    auto added = compileLayer.addModule(std::move(module), std::move(resolver));
+    if (!added) {
+      error = errorMessage(added.takeError());
+      return false;
+    }
+    ModuleHandle handle = *added;
+#else
+    std::vector<std::unique_ptr<llvm::Module>> moduleSet;
+    moduleSet.push_back(std::move(module));
+    ModuleHandle handle = compileLayer.addModuleSet(
+        std::move(moduleSet), llvm::make_unique<llvm::SectionMemoryManager>(),
+        std::move(resolver));
+#endif
+
+    for (std::size_t i = 0; i < desc.numFuncs; ++i) {
+      const Symbol &func = desc.funcs[i];
+      void *address = nullptr;
+      if (!getSymbolAddress(
+              compileLayer.findSymbolIn(handle, mangle(func.name), false),
+              address)) {
+        error = std::string("cannot find the compiled function ") + func.name;
+        return false;
+      }
+      *static_cast<void **>(func.address) = address;
+    }
+    return true;
+  }
+
+private:
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::TargetMachine> targetMachine;
+  const llvm::DataLayout dataLayout;
+  ObjectLayer objectLayer;
+  CompileLayer compileLayer;
+
+  static llvm::CodeGenOpt::Level codeGenOptLevel(unsigned optLevel) {
+    switch (optLevel) {
+    case 0:
+      return llvm::CodeGenOpt::None;
+    case 1:
+      return llvm::CodeGenOpt::Less;
+    case 2:
+      return llvm::CodeGenOpt::Default;
+    default:
+      return llvm::CodeGenOpt::Aggressive;
+    }
+  }
+
+  std::string mangle(llvm::StringRef name) const {
+    std::string result;
+    llvm::raw_string_ostream os(result);
+    llvm::Mangler::getNameWithPrefix(os, name, dataLayout);
+    return os.str();
+  }
+
+  /// Turns the declarations of the @dynamicCompileConst variables into
+  /// constants with their current values.
+  bool foldConstants(llvm::Module &module, const ModuleDesc &desc,
+                     std::string &error) {
+    for (std::size_t i = 0; i < desc.numConsts; ++i) {
+      const Symbol &var = desc.consts[i];
+      llvm::GlobalVariable *gvar = module.getNamedGlobal(var.name);
+      if (!gvar) {
+        continue;
+      }
+      llvm::Constant *init =
+          readConstant(gvar->getValueType(),
+                       static_cast<const char *>(var.address), dataLayout);
+      if (!init) {
+        error = std::string("unsupported type of @dynamicCompileConst "
+                            "variable ") +
+                var.name;
+        return false;
+      }
+      gvar->setInitializer(init);
+      gvar->setConstant(true);
+      gvar->setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+    return true;
+  }
+
+  void optimize(llvm::Module &module, unsigned optLevel, unsigned sizeLevel) {
+    llvm::legacy::PassManager mpm;
+    llvm::legacy::FunctionPassManager fpm(&module);
+
+    llvm::TargetLibraryInfoImpl tlii(targetMachine->getTargetTriple());
+    mpm.add(new llvm::TargetLibraryInfoWrapperPass(tlii));
+    mpm.add(llvm::createTargetTransformInfoWrapperPass(
+        targetMachine->getTargetIRAnalysis()));
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(
+        targetMachine->getTargetIRAnalysis()));
+
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = optLevel;
+    builder.SizeLevel = sizeLevel;
+    if (optLevel > 1) {
+      builder.Inliner =
+          llvm::createFunctionInliningPass(optLevel, sizeLevel, false);
+    } else {
+      builder.Inliner = llvm::createAlwaysInlinerLegacyPass();
+    }
+    builder.LoopVectorize = optLevel > 1 && sizeLevel < 2;
+    builder.SLPVectorize = optLevel > 1 && sizeLevel < 2;
+    builder.populateFunctionPassManager(fpm);
+    builder.populateModulePassManager(mpm);
+
+    fpm.doInitialization();
+    for (auto &fn : module) {
+      fpm.run(fn);
+    }
+    fpm.doFinalization();
+    mpm.run(module);
+  }
+};
+
+/// Created on the first compilation and kept alive until the end of the
+/// program, as the compiled code is never freed.
+DynamicCompiler *compiler = nullptr;
+std::string lastError;
+}
+
+extern "C" {
+
+/// Called by the module constructors emitted by the compiler.
+void _d_dynamic_compile_register(void *desc) {
+  std::lock_guard<std::mutex> guard(getLock());
+  auto module = static_cast<ModuleDesc *>(desc);
+  module->next = modules;
+  modules = module;
+}
+
+/// Compiles the registered modules. Returns null on success, or else an error
+/// message which is valid until the next call.
+const char *_d_dynamic_compile(unsigned optLevel, unsigned sizeLevel) {
+  std::lock_guard<std::mutex> guard(getLock());
+  lastError.clear();
+
+  if (!compiler) {
+    std::unique_ptr<llvm::TargetMachine> tm =
+        createHostTargetMachine(lastError);
+    if (!tm) {
+      if (lastError.empty()) {
+        lastError = "cannot create the target machine";
+      }
+      return lastError.c_str();
+    }
+    compiler = new DynamicCompiler(std::move(tm));
+  }
+
+  for (ModuleDesc *module = modules; module; module = module->next) {
+    if (!compiler->compile(*module, optLevel, sizeLevel, lastError)) {
+      return lastError.c_str();
+    }
+  }
+  return nullptr;
+}
+}
@@ -0,0 +1,125 @@
+//===-- tests/api/compile_session.cpp - Compile session API test ----------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Compiles in-memory modules through the API of driver/api.h and checks the
+// diagnostics and object files. Also checks that the host survives sessions
+// which end in a fatal error, i.e., that the compiler's exit path doesn't run
+// the host's exit handlers or terminate it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/api.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using ldc::api::CompileSession;
+using ldc::api::Diagnostic;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what, const CompileSession &session) {
+  if (!condition) {
+    fprintf(stderr, "FAILED: %s\ncompiler output:\n%s\n", what,
+            session.output().c_str());
+    ++failures;
+  }
+}
+
+bool hasError(const CompileSession &session, const char *file,
+              unsigned line) {
+  for (const auto &d : session.diagnostics()) {
+    if (d.kind == Diagnostic::Error && d.file == file && d.line == line) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char hostExitMessage[] = "host exit handler ran";
+
+/// Writes to stdout, which is redirected to the session output in the
+/// compiler children.
+void hostExitHandler() { printf("%s\n", hostExitMessage); }
+
+void checkHostExitHandler(const CompileSession &session) {
+  check(session.output().find(hostExitMessage) == std::string::npos,
+        "the host's exit handler ran in the compiler", session);
+}
+
+void testErrors() {
+  CompileSession session;
+  session.addMemoryFile("bad.d", "module bad;\n"
+                                 "\n"
+                                 "int foo() { return undefinedSymbol; }\n");
+  check(!session.compile(), "a module with errors compiles", session);
+  check(hasError(session, "bad.d", 3),
+        "no error diagnostic for bad.d(3) with the in-memory file name",
+        session);
+  check(session.objects().empty(), "objects of a failed session", session);
+  checkHostExitHandler(session);
+}
+
+void testObjects() {
+  CompileSession session;
+  session.addMemoryFile("pkg/imported.d", "module pkg.imported;\n"
+                                          "enum answer = 42;\n",
+                        /*compile=*/false);
+  session.addMemoryFile("good.d", "module good;\n"
+                                  "import pkg.imported;\n"
+                                  "int foo() { return answer; }\n");
+  check(session.compile(), "a valid module doesn't compile", session);
+  check(session.diagnostics().empty(), "diagnostics of a valid module",
+        session);
+  check(session.objects().size() == 1, "not exactly one object file",
+        session);
+  for (const auto &obj : session.objects()) {
+    check(obj.name.compare(0, 4, "good") == 0, "unexpected object file name",
+          session);
+    check(!obj.contents.empty(), "empty object file", session);
+  }
+  checkHostExitHandler(session);
+}
+
+void testFatalError() {
+  CompileSession session;
+  // Missing imports are fatal errors.
+  session.addMemoryFile("fatal.d", "module fatal;\n"
+                                   "import does.not.exist;\n");
+  check(!session.compile(), "a module with a missing import compiles",
+        session);
+  check(hasError(session, "fatal.d", 2),
+        "no error diagnostic for the missing import", session);
+  for (const auto &d : session.diagnostics()) {
+    check(d.message != "the compiler has crashed",
+          "the compiler crashed on a fatal error", session);
+  }
+  checkHostExitHandler(session);
+}
+
+} // anonymous namespace
+
+int apiTestMain(int argc, char **argv) {
+  ldc::api::initialize(argv[0]);
+  atexit(&hostExitHandler);
+
+  testErrors();
+  testObjects();
+  testFatalError();
+  // The host state must be unaffected by the previous sessions.
+  testObjects();
+
+  if (failures == 0) {
+    printf("all compile session tests passed\n");
+  }
+  return failures == 0 ? 0 : 1;
+}
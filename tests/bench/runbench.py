@@ -0,0 +1,162 @@
+#!/usr/bin/env python
+# Compile-time benchmark driver.
+#
+# Compiles a fixed corpus with LDC and records the wall-clock time, the peak
+# RSS of the compiler process and the size of the produced object file for
+# each benchmark. The results are compared against the baselines stored in
+# baselines.json; a benchmark exceeding its baseline by more than the
+# tolerance makes the run fail.
+#
+# Usage: runbench.py --ldc2 <ldc2> --druntime <dir> --phobos <dir>
+#                    [--output <dir>] [--repeat N] [--update-baselines]
+#                    [--no-baselines]
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+CORPUS_DIR = os.path.join(BENCH_DIR, 'corpus')
+BASELINES_FILE = os.path.join(BENCH_DIR, 'baselines.json')
+
+# Allowed relative increase over the baseline, per metric. Timings are noisy,
+# memory and code size much less so.
+TOLERANCES = {'time': 0.10, 'rss': 0.05, 'size': 0.02}
+
+PHOBOS_MODULES = ['std/algorithm/searching.d', 'std/conv.d', 'std/format.d',
+                  'std/regex/package.d', 'std/uni.d']
+
+
+def generate_huge_literal(path, elements=200000):
+    with open(path, 'w') as f:
+        f.write('// Generated by runbench.py.\nmodule literal;\n\n')
+        f.write('immutable uint[] table = [\n')
+        for i in range(0, elements, 16):
+            row = ', '.join(str((j * 2654435761) & 0xFFFFFFFF)
+                            for j in range(i, min(i + 16, elements)))
+            f.write('    ' + row + ',\n')
+        f.write('];\n')
+
+
+def benchmarks(args):
+    """Returns (name, source files, extra flags) of each benchmark."""
+    literal = os.path.join(args.output, 'literal.d')
+    generate_huge_literal(literal)
+    phobos = [os.path.join(args.phobos, m) for m in PHOBOS_MODULES]
+    imports = ['-I' + os.path.join(args.druntime, 'src'), '-I' + args.phobos]
+    return [
+        ('phobos', phobos, imports + ['-singleobj']),
+        ('templates', [os.path.join(CORPUS_DIR, 'templates.d')], []),
+        ('ctfe', [os.path.join(CORPUS_DIR, 'ctfe.d')], []),
+        ('literal', [literal], []),
+    ]
+
+
+def run_compiler(cmd):
+    """Runs cmd, returning (seconds, peak RSS in KiB or None)."""
+    start = time.time()
+    proc = subprocess.Popen(cmd)
+    if hasattr(os, 'wait4'):
+        _, status, usage = os.wait4(proc.pid, 0)
+        proc.returncode = status
+        # ru_maxrss is in bytes on macOS and in KiB elsewhere.
+        rss = usage.ru_maxrss
+        if sys.platform == 'darwin':
+            rss //= 1024
+    else:
+        proc.wait()
+        status = proc.returncode
+        rss = None
+    elapsed = time.time() - start
+    if status != 0:
+        sys.exit('Benchmark compilation failed: ' + ' '.join(cmd))
+    return elapsed, rss
+
+
+def measure(args, name, sources, flags):
+    obj = os.path.join(args.output, name + ('.obj' if os.name == 'nt' else '.o'))
+    trace = os.path.join(args.output, name + '.time-trace')
+    cmd = [args.ldc2, '-c', '-O', '-of=' + obj, '-ftime-trace',
+           '-ftime-trace-file=' + trace] + flags + sources
+    times = []
+    rss = None
+    for _ in range(args.repeat):
+        elapsed, peak = run_compiler(cmd)
+        times.append(elapsed)
+        if peak is not None:
+            rss = peak if rss is None else max(rss, peak)
+    # Use the fastest run, the one least disturbed by other processes.
+    result = {'time': min(times), 'size': os.path.getsize(obj)}
+    if rss is not None:
+        result['rss'] = rss
+    return result
+
+
+def compare(name, result, baseline):
+    """Prints result against baseline and returns the regressed metrics."""
+    regressions = []
+    for metric in ('time', 'rss', 'size'):
+        if metric not in result:
+            continue
+        value = result[metric]
+        line = '  %-5s %12.3f' % (metric, value)
+        if baseline and metric in baseline:
+            base = baseline[metric]
+            delta = (value - base) / base if base else 0.0
+            line += '  (baseline %.3f, %+.1f%%)' % (base, delta * 100)
+            if delta > TOLERANCES[metric]:
+                line += '  REGRESSION'
+                regressions.append(name + '.' + metric)
+        print(line)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='LDC compile-time benchmarks')
+    parser.add_argument('--ldc2', required=True)
+    parser.add_argument('--druntime', required=True)
+    parser.add_argument('--phobos', required=True)
+    parser.add_argument('--output', default='bench-output')
+    parser.add_argument('--repeat', type=int, default=3)
+    parser.add_argument('--update-baselines', action='store_true',
+                        help='store the results as the new baselines')
+    parser.add_argument('--no-baselines', action='store_true',
+                        help="don't compare the results to the baselines "
+                             '(e.g., when only running the compiler for '
+                             'profiling)')
+    args = parser.parse_args()
+
+    if not os.path.isdir(args.output):
+        os.makedirs(args.output)
+
+    baselines = {}
+    if not args.no_baselines:
+        with open(BASELINES_FILE) as f:
+            baselines = json.load(f)
+
+    results = {}
+    regressions = []
+    for name, sources, flags in benchmarks(args):
+        print(name + ':')
+        results[name] = measure(args, name, sources, flags)
+        regressions += compare(name, results[name], baselines.get(name))
+
+    with open(os.path.join(args.output, 'results.json'), 'w') as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.update_baselines:
+        with open(BASELINES_FILE, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('Baselines updated.')
+    elif regressions:
+        sys.exit('Regressions: ' + ', '.join(regressions))
+
+
+if __name__ == '__main__':
+    main()
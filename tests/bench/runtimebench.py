@@ -0,0 +1,132 @@
+#!/usr/bin/env python
+# Runtime benchmark driver for the code generated by LDC.
+#
+# Compiles each microbenchmark in runtime/ with the given LDC, runs it
+# repeatedly and collects the timings the benchmark prints. The samples are
+# compared against those stored in runtime_baselines.json using Welch's
+# t-test: a benchmark regresses if it is both significantly and noticeably
+# (more than the tolerance) slower than its baseline.
+#
+# Usage: runtimebench.py --ldc2 <ldc2> [--output <dir>] [--runs N]
+#                        [--dflags "<flags>"] [--update-baselines]
+#                        [--no-baselines]
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import math
+import os
+import shlex
+import subprocess
+import sys
+
+BENCH_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         'runtime')
+BASELINES_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              'runtime_baselines.json')
+
+# Relative slowdown of the mean below which differences are ignored.
+TOLERANCE = 0.03
+# |t| above which a difference of the means is considered significant.
+T_THRESHOLD = 3.0
+
+
+def mean(xs):
+    return sum(xs) / float(len(xs))
+
+
+def variance(xs):
+    m = mean(xs)
+    return sum((x - m) ** 2 for x in xs) / float(max(len(xs) - 1, 1))
+
+
+def welch_t(a, b):
+    """Welch's t statistic of the difference of the means of a and b."""
+    se = math.sqrt(variance(a) / len(a) + variance(b) / len(b))
+    if se == 0:
+        return 0.0 if mean(a) == mean(b) else float('inf')
+    return (mean(a) - mean(b)) / se
+
+
+def build(args, source):
+    name = os.path.splitext(os.path.basename(source))[0]
+    exe = os.path.join(args.output, name + ('.exe' if os.name == 'nt' else ''))
+    cmd = [args.ldc2, '-O3', '-release', '-I' + BENCH_DIR,
+           os.path.join(BENCH_DIR, 'harness.d'), source, '-of=' + exe,
+           '-od=' + os.path.join(args.output, name + '.objs')]
+    cmd += shlex.split(args.dflags)
+    subprocess.check_call(cmd)
+    return exe
+
+
+def run(exe, runs):
+    samples = []
+    for _ in range(runs):
+        out = subprocess.check_output([exe]).decode().strip()
+        samples.append(int(out.splitlines()[-1]) / 1e6)  # milliseconds
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description='LDC runtime benchmarks')
+    parser.add_argument('--ldc2', required=True)
+    parser.add_argument('--output', default='runtime-bench-output')
+    parser.add_argument('--runs', type=int, default=10)
+    parser.add_argument('--dflags', default='',
+                        help='additional flags to compile the benchmarks with')
+    parser.add_argument('--update-baselines', action='store_true',
+                        help='store the samples as the new baselines')
+    parser.add_argument('--no-baselines', action='store_true',
+                        help="don't compare against the baselines (e.g. when "
+                             "just running the benchmarks for PGO training)")
+    args = parser.parse_args()
+
+    if not os.path.isdir(args.output):
+        os.makedirs(args.output)
+
+    baselines = {}
+    if not args.no_baselines:
+        with open(BASELINES_FILE) as f:
+            baselines = json.load(f)
+
+    results = {}
+    regressions = []
+    sources = sorted(glob.glob(os.path.join(BENCH_DIR, '*.d')))
+    for source in sources:
+        name = os.path.splitext(os.path.basename(source))[0]
+        if name == 'harness':
+            continue
+        samples = run(build(args, source), args.runs)
+        results[name] = samples
+
+        line = '%-15s %10.3f ms +- %.3f' % (name, mean(samples),
+                                             math.sqrt(variance(samples)))
+        base = baselines.get(name)
+        if base:
+            delta = (mean(samples) - mean(base)) / mean(base)
+            t = welch_t(samples, base)
+            line += '  (baseline %.3f ms, %+.1f%%, t=%.1f)' % (mean(base),
+                                                              delta * 100, t)
+            if delta > TOLERANCE and t > T_THRESHOLD:
+                line += '  REGRESSION'
+                regressions.append(name)
+            elif delta < -TOLERANCE and t < -T_THRESHOLD:
+                line += '  improvement'
+        print(line)
+
+    with open(os.path.join(args.output, 'results.json'), 'w') as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.update_baselines:
+        with open(BASELINES_FILE, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('Baselines updated.')
+    elif regressions:
+        sys.exit('Regressions: ' + ', '.join(regressions))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,99 @@
+#!/usr/bin/env python
+# Checks size metrics of a textual LLVM IR module or an object file against
+# upper limits, for the code size regression tests in this directory.
+#
+# Usage: irsize.py <file.ll> [--max-instructions N] [--max-functions N]
+#                            [--max-globals N]
+#        irsize.py <file.o> --section <name>=<max bytes> ...
+#
+# The measured values are always printed; the script fails if one of them
+# exceeds its limit.
+
+from __future__ import print_function
+
+import argparse
+import re
+import subprocess
+import sys
+
+LABEL = re.compile(r'^[\w.$"-]+:')
+GLOBAL = re.compile(r'^@[\w.$"-]+ = ')
+
+
+def ir_metrics(path):
+    instructions = functions = globals_ = 0
+    in_function = False
+    with open(path) as f:
+        for line in f:
+            if in_function:
+                if line.startswith('}'):
+                    in_function = False
+                elif line.strip() and not line.lstrip().startswith(';') \
+                        and not LABEL.match(line):
+                    instructions += 1
+            elif line.startswith('define '):
+                functions += 1
+                in_function = True
+            elif GLOBAL.match(line):
+                globals_ += 1
+    return {'instructions': instructions, 'functions': functions,
+            'globals': globals_}
+
+
+def section_sizes(path):
+    """Returns the section sizes of an object file, using llvm-size."""
+    out = subprocess.check_output(['llvm-size', '-A', path]).decode()
+    sizes = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0].startswith('.') and parts[1].isdigit():
+            sizes[parts[0]] = sizes.get(parts[0], 0) + int(parts[1])
+    return sizes
+
+
+def section_size(sizes, name):
+    """Size of section name, including its per-symbol sections (name.*)."""
+    return sum(size for section, size in sizes.items()
+               if section == name or section.startswith(name + '.'))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Code size checks')
+    parser.add_argument('file')
+    parser.add_argument('--max-instructions', type=int)
+    parser.add_argument('--max-functions', type=int)
+    parser.add_argument('--max-globals', type=int)
+    parser.add_argument('--section', action='append', default=[],
+                        metavar='NAME=BYTES',
+                        help='upper limit of the size of an object section')
+    args = parser.parse_args()
+
+    limits = {}
+    if args.section:
+        sizes = section_sizes(args.file)
+        measured = {}
+        for spec in args.section:
+            name, limit = spec.rsplit('=', 1)
+            limits[name] = int(limit)
+            measured[name] = section_size(sizes, name)
+    else:
+        measured = ir_metrics(args.file)
+        for metric in ('instructions', 'functions', 'globals'):
+            limit = getattr(args, 'max_' + metric)
+            if limit is not None:
+                limits[metric] = limit
+
+    failed = False
+    for name in sorted(limits):
+        status = 'ok'
+        if measured[name] > limits[name]:
+            status = 'TOO LARGE'
+            failed = True
+        print('%-14s %8d (limit %d) %s' % (name, measured[name], limits[name],
+                                            status))
+    if failed:
+        sys.exit('%s exceeds its size limits' % args.file)
+
+
+if __name__ == '__main__':
+    main()
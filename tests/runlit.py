@@ -1,5 +1,194 @@
 #!/usr/bin/env python
 # wrapper to run lit from commandline
+#
+# Besides the regular lit arguments, this wrapper understands:
+#   --shard=K/N         only run the tests of shard K (1-based) out of N; a
+#                       test's shard is derived from a hash of its path, so
+#                       adding or removing tests doesn't move the others
+#   --skip-unchanged    skip tests which passed before with the same compiler,
+#                       runtime libraries, config, test tools, linker, test
+#                       file and test inputs
+# Both can also be set via the LIT_SHARD and LIT_SKIP_UNCHANGED environment
+# variables, e.g. to configure CI runners without changing the ctest command.
+
+import ast
+import glob
+import hashlib
+import json
+import os
+import platform
+import re
+import sys
+import zlib
+
+PASS_CACHE_FILE = '.lit-pass-cache.json'
+
+# The external tools the test results depend on: the ones used in RUN lines,
+# and the linker invoked by the compiler (via the C compiler, see getGcc()).
+TEST_TOOLS = ('FileCheck', 'not', 'ld', 'ld.gold')
+
+
+def site_config_value(exec_root, name):
+    with open(os.path.join(exec_root, 'lit.site.cfg')) as f:
+        m = re.search(r'^config\.%s\s*=\s*"?([^"\n]*)' % name, f.read(), re.M)
+    return m.group(1).strip() if m else None
+
+
+def site_config_list(exec_root, name):
+    """Returns a list literal like config.excludes from the site config, so
+    that test discovery matches lit's."""
+    with open(os.path.join(exec_root, 'lit.site.cfg')) as f:
+        m = re.search(r'^config\.%s\s*=\s*(\[[^\]]*\])' % name, f.read(),
+                      re.M)
+    return ast.literal_eval(m.group(1)) if m else []
+
+
+def discover_tests(source_root, suffixes, excludes):
+    tests = []
+    for dirpath, dirnames, filenames in os.walk(source_root):
+        dirnames[:] = sorted(d for d in dirnames if d not in excludes)
+        for f in sorted(filenames):
+            if f.endswith(suffixes) and f not in excludes:
+                tests.append(os.path.relpath(os.path.join(dirpath, f),
+                                             source_root))
+    return tests
+
+
+def in_shard(test, shard, num_shards):
+    key = test.replace(os.sep, '/').encode('utf-8')
+    return zlib.crc32(key) % num_shards == shard - 1
+
+
+def hash_file(h, path):
+    with open(path, 'rb') as f:
+        h.update(f.read())
+
+
+def find_program(name, dirs):
+    exe_suffix = '.exe' if platform.system() == 'Windows' else ''
+    for d in dirs:
+        path = os.path.join(d, name + exe_suffix)
+        if os.path.isfile(path):
+            return path
+    return None
+
+
+def compiler_hash(exec_root, lit):
+    """Hashes everything besides the tests themselves which the test results
+    depend on: the files in the LDC bin dir (compiler, tools and ldc2.conf),
+    the runtime libraries, lit, and the test tools and linker found in the
+    PATH the tests are run with."""
+    h = hashlib.sha1(lit.__version__.encode('ascii'))
+    bin_dir = site_config_value(exec_root, 'ldc2_bin_dir')
+    # The runtime libraries are built into lib<suffix> next to the bin dir.
+    lib_dirs = glob.glob(os.path.join(os.path.dirname(bin_dir), 'lib*'))
+    for d in [bin_dir] + sorted(lib_dirs):
+        if not os.path.isdir(d):
+            continue
+        for f in sorted(os.listdir(d)):
+            path = os.path.join(d, f)
+            if os.path.isfile(path):
+                h.update(f.encode('utf-8'))
+                hash_file(h, path)
+
+    # Same search order as set up by lit.site.cfg.
+    dirs = [bin_dir, site_config_value(exec_root, 'test_source_root'),
+            site_config_value(exec_root, 'llvm_tools_dir')] + \
+        os.environ.get('PATH', '').split(os.pathsep)
+    cc = os.environ.get('CC') or \
+        ('clang' if platform.system() == 'Darwin' else 'gcc')
+    for tool in TEST_TOOLS + (cc,):
+        path = tool if os.path.isabs(tool) else find_program(tool, dirs)
+        h.update(tool.encode('utf-8'))
+        if path and os.path.isfile(path):
+            hash_file(h, path)
+    return h.hexdigest()
+
+
+def test_hash(source_root, test, compiler_hash):
+    """Hashes the compiler etc., the test file and its directory's inputs."""
+    h = hashlib.sha1(compiler_hash.encode('ascii'))
+    path = os.path.join(source_root, test)
+    hash_file(h, path)
+    inputs = os.path.join(os.path.dirname(path), 'inputs')
+    for dirpath, dirnames, filenames in os.walk(inputs):
+        dirnames.sort()
+        for f in sorted(filenames):
+            hash_file(h, os.path.join(dirpath, f))
+    return h.hexdigest()
+
+
+def main(lit):
+    args = []
+    shard = os.environ.get('LIT_SHARD')
+    skip_unchanged = bool(os.environ.get('LIT_SKIP_UNCHANGED'))
+    for arg in sys.argv[1:]:
+        if arg.startswith('--shard='):
+            shard = arg[len('--shard='):]
+        elif arg == '--skip-unchanged':
+            skip_unchanged = True
+        else:
+            args.append(arg)
+
+    if not shard and not skip_unchanged:
+        lit.main()
+        return
+
+    # Explicit test paths replace the test suite directory argument.
+    options = [a for a in args if a.startswith('-')]
+    exec_root = os.path.abspath(
+        next((a for a in args if not a.startswith('-')), '.'))
+    source_root = site_config_value(exec_root, 'test_source_root')
+    suffixes = tuple(site_config_list(exec_root, 'suffixes'))
+    excludes = site_config_list(exec_root, 'excludes')
+    if site_config_value(exec_root, 'with_PGO') != 'True':
+        excludes.append('PGO')
+    tests = discover_tests(source_root, suffixes, excludes)
+
+    if shard:
+        k, n = [int(x) for x in shard.split('/')]
+        if not 1 <= k <= n:
+            sys.exit('Invalid shard %s' % shard)
+        tests = [t for t in tests if in_shard(t, k, n)]
+
+    cache_path = os.path.join(exec_root, PASS_CACHE_FILE)
+    cache = {}
+    hashes = {}
+    if skip_unchanged:
+        environment_hash = compiler_hash(exec_root, lit)
+        if os.path.exists(cache_path):
+            with open(cache_path) as f:
+                cache = json.load(f)
+        hashes = dict((t, test_hash(source_root, t, environment_hash))
+                      for t in tests)
+        skipped = [t for t in tests if cache.get(t) == hashes[t]]
+        tests = [t for t in tests if cache.get(t) != hashes[t]]
+        print('Skipping %d unchanged tests which passed before.' % len(skipped))
+
+    if not tests:
+        print('No tests to run.')
+        return
+
+    # Lit maps paths below the exec root to the test sources.
+    results = os.path.join(exec_root, '.lit-results.json')
+    sys.argv = [sys.argv[0]] + options + ['-o', results] + \
+        [os.path.join(exec_root, t) for t in tests]
+    try:
+        lit.main()
+    finally:
+        if skip_unchanged and os.path.exists(results):
+            with open(results) as f:
+                for result in json.load(f)['tests']:
+                    # Names look like 'LDC :: codegen/foo.d'.
+                    test = os.path.normpath(result['name'].split(' :: ', 1)[1])
+                    if result['code'] == 'PASS' and test in hashes:
+                        cache[test] = hashes[test]
+                    else:
+                        cache.pop(test, None)
+            with open(cache_path, 'w') as f:
+                json.dump(cache, f, indent=1, sort_keys=True)
+
+
 if __name__=='__main__':
     try:
         import lit
@@ -10,4 +199,4 @@ if __name__=='__main__':
                  '(Python versions older than 2.7.9 or 3.4 do not have pip installed, see:\n' \
                  'https://pip.pypa.io/en/latest/installing/)')
 
-    lit.main()
+    main(lit)
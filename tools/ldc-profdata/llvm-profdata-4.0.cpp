@@ -11,6 +11,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
@@ -32,6 +33,8 @@
 #include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 
 using namespace llvm;
 
@@ -371,6 +374,34 @@ static void parseInputFilenamesFile(MemoryBuffer *Buffer,
   }
 }
 
+/// Scales the input weights by 2^(-age / HalfLife), where the age of a file is
+/// the time between its modification and the one of the newest input, so that
+/// older profiles fade. As the weights are integers, the newest profiles get
+/// 1024 times their given weight; the merged counts are scaled accordingly
+/// (only their ratios matter for the optimizations).
+static void applyTimeDecay(WeightedFileVector &WFV, unsigned HalfLifeHours) {
+  const uint64_t NewestScale = 1024;
+  std::vector<Optional<sys::TimePoint<>>> Times(WFV.size());
+  sys::TimePoint<> Newest;
+  for (size_t I = 0; I < WFV.size(); ++I) {
+    sys::fs::file_status Status;
+    if (WFV[I].Filename == "-" || sys::fs::status(WFV[I].Filename, Status))
+      continue;
+    Times[I] = Status.getLastModificationTime();
+    Newest = std::max(Newest, *Times[I]);
+  }
+
+  const double HalfLife = HalfLifeHours * 3600.0;
+  for (size_t I = 0; I < WFV.size(); ++I) {
+    // Stdin (and files without status) counts as new.
+    double Age = 0;
+    if (Times[I])
+      Age = std::chrono::duration<double>(Newest - *Times[I]).count();
+    double Weight = WFV[I].Weight * NewestScale * std::exp2(-Age / HalfLife);
+    WFV[I].Weight = std::max<uint64_t>(1, std::llround(Weight));
+  }
+}
+
 static int merge_main(int argc, const char *argv[]) {
   cl::list<std::string> InputFilenames(cl::Positional,
                                        cl::desc("<filename...>"));
@@ -407,6 +438,10 @@ static int merge_main(int argc, const char *argv[]) {
       cl::desc("Number of merge threads to use (default: autodetect)"));
   cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
                         cl::aliasopt(NumThreads));
+  cl::opt<unsigned> DecayHalfLife(
+      "decay-half-life", cl::init(0), cl::value_desc("hours"),
+      cl::desc("Halve the weight of the inputs for every <hours> they are "
+               "older than the newest input (by modification time)"));
 
   cl::ParseCommandLineOptions(argc, argv, "LLVM profile data merger\n");
 
@@ -425,6 +460,9 @@ static int merge_main(int argc, const char *argv[]) {
     exitWithError("No input files specified. See " +
                   sys::path::filename(argv[0]) + " -help");
 
+  if (DecayHalfLife)
+    applyTimeDecay(WeightedInputs, DecayHalfLife);
+
   if (DumpInputFileList) {
     for (auto &WF : WeightedInputs)
       outs() << WF.Weight << "," << WF.Filename << "\n";